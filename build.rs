@@ -1,5 +1,6 @@
 extern crate cc;
-use std::path::PathBuf;
+use std::collections::BTreeSet;
+use std::path::{Path, PathBuf};
 use std::process::Command;
 use std::{env, error::Error, fs::File, io::Read};
 
@@ -35,6 +36,29 @@ fn finalize_nanox_configuration(command: &mut cc::Build, bolos_sdk: &String) ->
         .define("HAVE_SE_BUTTON", None)
         .define("HAVE_SE_SCREEN", None)
         .define("HAVE_MCU_SERIAL_STORAGE", None)
+        .file(format!("{bolos_sdk}/nanox/syscalls.c"))
+        .file(format!("{bolos_sdk}/nanox/cx_stubs.S"))
+        .file(format!(
+            "{bolos_sdk}/nanox/lib_cxng/src/cx_exported_functions.c"
+        ))
+        .include(format!("{bolos_sdk}/nanox/"))
+        .include(format!("{bolos_sdk}/nanox/lib_cxng/include"))
+        .flag("-mno-movt")
+        .flag("-ffixed-r9")
+        .flag("-fropi")
+        .flag("-frwpi");
+    // The BLE stack is left out of apps only using USB
+    #[cfg(not(feature = "no_ble"))]
+    configure_ble(command, bolos_sdk);
+    configure_lib_bagl(command, bolos_sdk);
+    format!("{bolos_sdk}/nanox/Makefile.conf.cx")
+}
+
+/// BLE transport of the Nano X: the ACI of the BlueNRG controller and the
+/// Ledger GATT service
+#[cfg(not(feature = "no_ble"))]
+fn configure_ble(command: &mut cc::Build, bolos_sdk: &String) {
+    command
         .define("HAVE_BLE", None)
         .define("HAVE_BLE_APDU", None)
         .file(format!("{bolos_sdk}/nanox/ledger_protocol.c"))
@@ -50,6 +74,9 @@ fn finalize_nanox_configuration(command: &mut cc::Build, bolos_sdk: &String) ->
         .file(format!(
             "{bolos_sdk}/nanox/lib_blewbxx/core/auto/ble_hci_le.c"
         ))
+        .file(format!(
+            "{bolos_sdk}/nanox/lib_blewbxx/core/auto/ble_l2cap_aci.c"
+        ))
         .file(format!(
             "{bolos_sdk}/nanox/lib_blewbxx/core/template/osal.c"
         ))
@@ -60,20 +87,7 @@ fn finalize_nanox_configuration(command: &mut cc::Build, bolos_sdk: &String) ->
         .include(format!("{bolos_sdk}/nanox/lib_blewbxx/core"))
         .include(format!("{bolos_sdk}/nanox/lib_blewbxx/core/auto"))
         .include(format!("{bolos_sdk}/nanox/lib_blewbxx/core/template"))
-        .include(format!("{bolos_sdk}/nanox/lib_blewbxx_impl/include"))
-        .file(format!("{bolos_sdk}/nanox/syscalls.c"))
-        .file(format!("{bolos_sdk}/nanox/cx_stubs.S"))
-        .file(format!(
-            "{bolos_sdk}/nanox/lib_cxng/src/cx_exported_functions.c"
-        ))
-        .include(format!("{bolos_sdk}/nanox/"))
-        .include(format!("{bolos_sdk}/nanox/lib_cxng/include"))
-        .flag("-mno-movt")
-        .flag("-ffixed-r9")
-        .flag("-fropi")
-        .flag("-frwpi");
-    configure_lib_bagl(command, bolos_sdk);
-    format!("{bolos_sdk}/nanox/Makefile.conf.cx")
+        .include(format!("{bolos_sdk}/nanox/lib_blewbxx_impl/include"));
 }
 
 fn finalize_nanosplus_configuration(command: &mut cc::Build, bolos_sdk: &String) -> String {
@@ -92,35 +106,350 @@ fn finalize_nanosplus_configuration(command: &mut cc::Build, bolos_sdk: &String)
         .file(format!(
             "{bolos_sdk}/nanosplus/lib_cxng/src/cx_exported_functions.c"
         ))
+        // BLAKE3 is not provided by the OS and is linked into the app
+        .define("HAVE_BLAKE3", None)
+        .file(format!("{bolos_sdk}/nanosplus/lib_cxng/src/cx_blake3.c"))
+        .file(format!(
+            "{bolos_sdk}/nanosplus/lib_cxng/src/cx_blake3_ref.c"
+        ))
+        // Neither is Groestl, whose reference code uses the cxlib scratch RAM
+        .define("HAVE_GROESTL", None)
+        .file(format!(
+            "{bolos_sdk}/nanosplus/lib_cxng/src/cx_Groestl-ref.c"
+        ))
+        .file("./src/c/cx_ram.c")
         .include(format!("{bolos_sdk}/nanosplus/"))
         .include(format!("{bolos_sdk}/nanosplus/lib_cxng/include"))
+        .include(format!("{bolos_sdk}/nanosplus/lib_cxng/src"))
         .flag("-fropi")
         .flag("-frwpi");
     configure_lib_bagl(command, bolos_sdk);
     format!("{bolos_sdk}/nanosplus/Makefile.conf.cx")
 }
 
+/// lib_bagl fonts: name as in `HAVE_BAGL_FONT_<name>`, and file holding its data
+const BAGL_FONTS: [(&str, &str); 16] = [
+    ("LUCIDA_CONSOLE_8PX", "bagl_font_lucida_console_8.inc"),
+    (
+        "OPEN_SANS_LIGHT_16_22PX",
+        "bagl_font_open_sans_light_16_22px.inc",
+    ),
+    (
+        "OPEN_SANS_REGULAR_8_11PX",
+        "bagl_font_open_sans_regular_8_11px.inc",
+    ),
+    (
+        "OPEN_SANS_REGULAR_10_13PX",
+        "bagl_font_open_sans_regular_10_13px.inc",
+    ),
+    (
+        "OPEN_SANS_REGULAR_11_14PX",
+        "bagl_font_open_sans_regular_11_14px.inc",
+    ),
+    (
+        "OPEN_SANS_REGULAR_13_18PX",
+        "bagl_font_open_sans_regular_13_18px.inc",
+    ),
+    (
+        "OPEN_SANS_REGULAR_22_30PX",
+        "bagl_font_open_sans_regular_22_30px.inc",
+    ),
+    (
+        "OPEN_SANS_SEMIBOLD_8_11PX",
+        "bagl_font_open_sans_semibold_8_11px.inc",
+    ),
+    (
+        "OPEN_SANS_EXTRABOLD_11PX",
+        "bagl_font_open_sans_extrabold_11px.inc",
+    ),
+    ("OPEN_SANS_LIGHT_16PX", "bagl_font_open_sans_light_16px.inc"),
+    (
+        "OPEN_SANS_REGULAR_11PX",
+        "bagl_font_open_sans_regular_11px.inc",
+    ),
+    (
+        "OPEN_SANS_SEMIBOLD_10_13PX",
+        "bagl_font_open_sans_semibold_10_13px.inc",
+    ),
+    (
+        "OPEN_SANS_SEMIBOLD_11_16PX",
+        "bagl_font_open_sans_semibold_11_16px.inc",
+    ),
+    (
+        "OPEN_SANS_SEMIBOLD_13_18PX",
+        "bagl_font_open_sans_semibold_13_18px.inc",
+    ),
+    ("SYMBOLS_0", "bagl_font_symbols.inc"),
+    ("SYMBOLS_1", "bagl_font_symbols.inc"),
+];
+
+/// Lines of the initializer of the C definition starting at `start` in
+/// `inc`, comments excluded
+fn c_initializer(inc: &str, start: usize) -> Vec<&str> {
+    inc[start..]
+        .lines()
+        .skip(1)
+        .take_while(|line| !line.starts_with("};"))
+        .filter(|line| !line.trim_start().starts_with("//"))
+        .collect()
+}
+
+/// Fields of the `bagl_font_t` definition of font `name` in `inc`, one per
+/// line with the comments and separators stripped
+fn bagl_font_header<'a>(inc: &'a str, name: &str) -> Vec<&'a str> {
+    let struct_name = match name {
+        "LUCIDA_CONSOLE_8PX" => "LUCIDA_CONSOLE_8",
+        _ => name,
+    };
+    inc.find(&format!("const bagl_font_t font{struct_name} "))
+        .map(|start| c_initializer(inc, start))
+        .unwrap_or_default()
+        .into_iter()
+        .filter_map(|line| {
+            let line = line.split("//").next()?.split("/*").next()?;
+            let field = line.trim().trim_matches(',').trim();
+            (!field.is_empty()).then_some(field)
+        })
+        .collect()
+}
+
+/// Initializer of the array named by the field of `header` starting with
+/// `prefix`
+fn bagl_font_array<'a>(inc: &'a str, header: &[&str], prefix: &str) -> Vec<&'a str> {
+    header
+        .iter()
+        .find(|field| field.starts_with(prefix))
+        .and_then(|array| inc.find(&format!("{array}[")))
+        .map(|start| c_initializer(inc, start))
+        .unwrap_or_default()
+}
+
+/// Approximate flash size of a font, from its definition in `inc`: bitmap
+/// bytes, 4 bytes per character descriptor and the font header.
+fn bagl_font_size(inc: &str, name: &str) -> usize {
+    // The font header names its character and bitmap arrays
+    let header = bagl_font_header(inc, name);
+    let count = |prefix: &str, pattern: &str| -> usize {
+        bagl_font_array(inc, &header, prefix)
+            .iter()
+            .map(|line| line.matches(pattern).count())
+            .sum()
+    };
+    count("bitmap", "0x") + 4 * count("characters", "{") + 24
+}
+
+fn parse_c_number(s: &str) -> Option<usize> {
+    let s = s.trim();
+    match s.strip_prefix("0x").or_else(|| s.strip_prefix("0X")) {
+        Some(hex) => usize::from_str_radix(hex, 16).ok(),
+        None => s.parse().ok(),
+    }
+}
+
+/// 1 bpp font, as defined in its `.inc` file
+struct BaglFont {
+    /// `BAGL_FONT_*` identifier
+    id: String,
+    height: usize,
+    kerning: usize,
+    first: usize,
+    last: usize,
+    /// Width and bitmap offset of each character
+    chars: Vec<(usize, usize)>,
+    bitmap: Vec<u8>,
+}
+
+fn parse_bagl_font(inc: &str, name: &str) -> Option<BaglFont> {
+    let header = bagl_font_header(inc, name);
+    if header.len() < 9 || parse_c_number(header[1])? != 1 {
+        return None;
+    }
+    let chars = bagl_font_array(inc, &header, "characters")
+        .iter()
+        .filter_map(|line| {
+            let fields = line.split('{').nth(1)?.split('}').next()?;
+            let fields: Vec<usize> = fields.split(',').filter_map(parse_c_number).collect();
+            Some((*fields.first()?, *fields.get(2)?))
+        })
+        .collect();
+    let bitmap = bagl_font_array(inc, &header, "bitmap")
+        .iter()
+        .flat_map(|line| line.split(','))
+        .filter_map(|byte| parse_c_number(byte).map(|b| b as u8))
+        .collect();
+    Some(BaglFont {
+        id: header[0].to_string(),
+        height: parse_c_number(header[2])?,
+        kerning: parse_c_number(header[4])?,
+        first: parse_c_number(header[5])?,
+        last: parse_c_number(header[6])?,
+        chars,
+        bitmap,
+    })
+}
+
+/// Rows of character `ch` of `font`, each starting on a byte
+fn bagl_glyph_rows(font: &BaglFont, ch: usize) -> Vec<u8> {
+    let (width, offset) = font.chars[ch - font.first];
+    let stride = (width + 7) / 8;
+    let mut rows = vec![0u8; stride * font.height];
+    for r in 0..font.height {
+        for c in 0..width {
+            let bit = r * width + c;
+            if font
+                .bitmap
+                .get(offset + bit / 8)
+                .map_or(false, |b| b & (1 << (bit % 8)) != 0)
+            {
+                rows[r * stride + c / 8] |= 1 << (c % 8);
+            }
+        }
+    }
+    rows
+}
+
+/// C source of the glyph atlas of the characters `first..=last` of each
+/// font, and its size in bytes
+fn bagl_atlas(fonts: &[(&str, BaglFont, usize, usize)]) -> (String, usize) {
+    let mut src = String::from("// Generated by build.rs from BAGL_ATLAS\n#include \"bagl.h\"\n\n");
+    let mut table = String::new();
+    let mut size = 0;
+    for (name, font, first, last) in fonts {
+        let mut rows = Vec::new();
+        let mut offsets = Vec::new();
+        for ch in *first..=*last {
+            offsets.push(rows.len().to_string());
+            rows.extend(bagl_glyph_rows(font, ch));
+        }
+        offsets.push(rows.len().to_string());
+        size += rows.len() + 2 * offsets.len() + 16;
+        let rows: Vec<String> = rows.iter().map(|b| format!("0x{b:02X}")).collect();
+        src += &format!(
+            "static const unsigned char rows{name}[] = {{\n  {}\n}};\n",
+            rows.join(", ")
+        );
+        src += &format!(
+            "static const unsigned short offsets{name}[] = {{\n  {}\n}};\n\n",
+            offsets.join(", ")
+        );
+        table += &format!(
+            "  {{ {}, 0x{first:02X}, 0x{last:02X}, offsets{name}, rows{name} }},\n",
+            font.id
+        );
+    }
+    src += &format!("const bagl_atlas_t C_bagl_atlases[] = {{\n{table}}};\n");
+    src += "const unsigned int C_bagl_atlases_count = sizeof(C_bagl_atlases)/sizeof(C_bagl_atlases[0]);\n";
+    (src, size)
+}
+
+/// Fonts exported to src/ui.rs, which draws text without lib_bagl
+const UI_FONTS: [&str; 2] = ["OPEN_SANS_REGULAR_11PX", "OPEN_SANS_EXTRABOLD_11PX"];
+
+/// Rust definition of `font` as a `ui::Font`, keeping the layout of its
+/// bitmap: the rows of each character are packed and start on a byte
+fn ui_font(name: &str, font: &BaglFont) -> String {
+    let glyphs: Vec<String> = font
+        .chars
+        .iter()
+        .map(|(width, offset)| format!("({width}, {offset})"))
+        .collect();
+    let bitmap: Vec<String> = font.bitmap.iter().map(|b| format!("0x{b:02x}")).collect();
+    format!(
+        "pub const {name}: Font = Font {{\n    height: {},\n    kerning: {},\n    first: {},\n    \
+         glyphs: &[{}],\n    bitmap: &[{}],\n}};\n",
+        font.height,
+        font.kerning,
+        font.first,
+        glyphs.join(", "),
+        bitmap.join(", ")
+    )
+}
+
+/// Fonts listed in BAGL_ATLAS, comma-separated names optionally followed by
+/// a range of characters, e.g. "OPEN_SANS_REGULAR_11PX:0x20-0x7e"
+fn bagl_atlas_fonts<'a>(
+    list: &'a str,
+    selected: impl Fn(&str) -> bool,
+    bolos_sdk: &String,
+) -> Vec<(&'a str, BaglFont, usize, usize)> {
+    let mut fonts = Vec::new();
+    for entry in list.split(',').map(str::trim).filter(|e| !e.is_empty()) {
+        let (name, range) = entry.split_once(':').unwrap_or((entry, ""));
+        let font = BAGL_FONTS
+            .iter()
+            .find(|(n, _)| *n == name && selected(n))
+            .and_then(|(_, inc)| {
+                std::fs::read_to_string(format!("{bolos_sdk}/lib_bagl/src/{inc}")).ok()
+            })
+            .and_then(|inc| parse_bagl_font(&inc, name));
+        let Some(font) = font else {
+            println!("cargo:warning=BAGL_ATLAS: {name} is not a 1 bpp font built into the app");
+            continue;
+        };
+        let (first, last) = match range.split_once('-') {
+            Some((a, b)) => match (parse_c_number(a), parse_c_number(b)) {
+                (Some(a), Some(b)) => (a, b),
+                _ => {
+                    println!("cargo:warning=BAGL_ATLAS: invalid range {range}");
+                    continue;
+                }
+            },
+            None => (font.first, font.last),
+        };
+        let (first, last) = (first.max(font.first), last.min(font.last));
+        if first <= last && last - font.first < font.chars.len() {
+            fonts.push((name, font, first, last));
+        }
+    }
+    fonts
+}
+
 fn configure_lib_bagl(command: &mut cc::Build, bolos_sdk: &String) {
     if env::var_os("CARGO_FEATURE_LIB_BAGL").is_some() {
+        // Only build the fonts listed in BAGL_FONTS (comma-separated names,
+        // e.g. "OPEN_SANS_REGULAR_11PX,SYMBOLS_0"), or all of them if unset.
+        let selection = env::var("BAGL_FONTS").ok();
+        let mut saved = 0;
+        for (name, inc) in BAGL_FONTS {
+            let selected = selection
+                .as_ref()
+                .map_or(true, |list| list.split(',').any(|f| f.trim() == name));
+            if selected {
+                command.define(&format!("HAVE_BAGL_FONT_{name}"), None);
+            } else if let Ok(data) =
+                std::fs::read_to_string(format!("{bolos_sdk}/lib_bagl/src/{inc}"))
+            {
+                saved += bagl_font_size(&data, name);
+            }
+        }
+        if let Some(list) = &selection {
+            for f in list.split(',').map(str::trim).filter(|f| !f.is_empty()) {
+                if !BAGL_FONTS.iter().any(|(name, _)| name == &f) {
+                    println!("cargo:warning=BAGL_FONTS: unknown font {f}");
+                }
+            }
+            // Not a warning: only shown with `cargo build -vv`
+            println!("lib_bagl: about {saved} bytes of font data left out");
+        }
+        // Pre-rendered glyphs of the fonts listed in BAGL_ATLAS
+        if let Ok(list) = env::var("BAGL_ATLAS") {
+            let selected = |name: &str| {
+                selection
+                    .as_ref()
+                    .map_or(true, |list| list.split(',').any(|f| f.trim() == name))
+            };
+            let fonts = bagl_atlas_fonts(&list, selected, bolos_sdk);
+            if !fonts.is_empty() {
+                let (src, size) = bagl_atlas(&fonts);
+                let path = PathBuf::from(env::var_os("OUT_DIR").unwrap()).join("bagl_atlas.c");
+                std::fs::write(&path, src).expect("cannot write bagl_atlas.c");
+                command.define("HAVE_BAGL_ATLAS", None).file(path);
+                // Shown with `cargo build -vv`, as the font data left out
+                println!("lib_bagl: {size} bytes of glyph atlas");
+            }
+        }
         command
             .define("HAVE_BAGL", None)
-            // Just include all the fonts for now; we can shrink the X and S+ images later.
-            .define("HAVE_BAGL_FONT_LUCIDA_CONSOLE_8PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_LIGHT_16_22PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_8_11PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_10_13PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_11_14PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_13_18PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_22_30PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_SEMIBOLD_8_11PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_EXTRABOLD_11PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_LIGHT_16PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_REGULAR_11PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_SEMIBOLD_10_13PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_SEMIBOLD_11_16PX", None)
-            .define("HAVE_BAGL_FONT_OPEN_SANS_SEMIBOLD_13_18PX", None)
-            .define("HAVE_BAGL_FONT_SYMBOLS_0", None)
-            .define("HAVE_BAGL_FONT_SYMBOLS_1", None)
             .include(format!("{bolos_sdk}/lib_bagl/src/"))
             .file(format!("{bolos_sdk}/lib_bagl/src/bagl.c"))
             .file(format!("{bolos_sdk}/lib_bagl/src/bagl_fonts.c"))
@@ -128,8 +457,204 @@ fn configure_lib_bagl(command: &mut cc::Build, bolos_sdk: &String) {
     }
 }
 
+/// Product string descriptor, UTF-16LE, of `name`
+fn usb_string_descriptor(name: &str) -> Vec<u8> {
+    let mut desc = vec![0, 0x03];
+    desc.extend(name.encode_utf16().flat_map(u16::to_le_bytes));
+    assert!(desc.len() <= 0xff, "USB_PRODUCT: `{name}` is too long");
+    desc[0] = desc.len() as u8;
+    desc
+}
+
+/// Generate the USB product string descriptor, USB_PRODUCT or the name of
+/// the device by default, as a const array for usbd_impl.c and as the
+/// USB_PRODUCT variable for src/usbd.rs
+fn configure_usb_product(command: &mut cc::Build, device_name: &str) {
+    let product = env::var("USB_PRODUCT").unwrap_or_else(|_| String::from(device_name));
+    let bytes = usb_string_descriptor(&product)
+        .iter()
+        .map(|b| format!("0x{b:02x},"))
+        .collect::<Vec<_>>()
+        .join(" ");
+    let src = format!(
+        "// Generated by build.rs from \"{product}\"\n\
+         static uint8_t const USBD_PRODUCT_FS_STRING[] = {{ {bytes} }};\n"
+    );
+    let out_dir = PathBuf::from(env::var_os("OUT_DIR").unwrap());
+    std::fs::write(out_dir.join("usbd_product.h"), src).expect("cannot write usbd_product.h");
+    command
+        .define("HAVE_USBD_PRODUCT_H", None)
+        .include(&out_dir);
+    println!("cargo:rustc-env=USB_PRODUCT={product}");
+}
+
+/// Generate the Rust sources taken from the C SDK and the layout of the
+/// device: the Flash page size, the cxlib function numbers and the UI fonts
+fn export_rust_sources(
+    bolos_sdk: &str,
+    out_dir: &Path,
+    linkerscript: &str,
+    stubs_dir: &str,
+) -> Result<(), Box<dyn Error>> {
+    // Export the Flash page size of the layout to src/nvm.rs, which needs it
+    // as a literal for `repr(align(...))`
+    let layout = std::fs::read_to_string(linkerscript)?;
+    let page_size = layout
+        .lines()
+        .filter_map(|line| line.trim().strip_prefix("PAGE_SIZE"))
+        .find_map(|rest| rest.trim_start().strip_prefix('='))
+        .and_then(|value| {
+            value
+                .trim()
+                .trim_end_matches(';')
+                .trim()
+                .parse::<usize>()
+                .ok()
+        })
+        .ok_or("PAGE_SIZE not found in layout")?;
+    std::fs::write(
+        out_dir.join("page_size.rs"),
+        format!("page_layout!({page_size});\n"),
+    )?;
+
+    // Export the cxlib function numbers of cx_stubs.h to src/trampoline.rs,
+    // which calls the OS trampoline directly
+    let stubs = std::fs::read_to_string(format!("{bolos_sdk}/{stubs_dir}/cx_stubs.h"))?;
+    let numbers: String = stubs
+        .lines()
+        .filter_map(|line| line.strip_prefix("#define _NR_"))
+        .filter_map(|line| {
+            let mut words = line.split_whitespace();
+            Some(format!(
+                "pub const {}: u32 = {};\n",
+                words.next()?,
+                words.next()?
+            ))
+        })
+        .collect();
+    std::fs::write(out_dir.join("cx_numbers.rs"), numbers)?;
+
+    // Export the fonts of src/ui.rs, decoded from the lib_bagl sources
+    let mut fonts = String::new();
+    for name in UI_FONTS {
+        let (_, inc) = BAGL_FONTS.iter().find(|(n, _)| *n == name).unwrap();
+        let inc = std::fs::read_to_string(format!("{bolos_sdk}/lib_bagl/src/{inc}"))?;
+        fonts += &ui_font(
+            name,
+            &parse_bagl_font(&inc, name).ok_or("cannot parse UI font")?,
+        );
+    }
+    std::fs::write(out_dir.join("ui_fonts.rs"), fonts)?;
+    Ok(())
+}
+
+/// Names of the functions and of the statics declared in the `extern "C"`
+/// blocks of `src`
+fn extern_symbols(src: &str, functions: &mut BTreeSet<String>, statics: &mut BTreeSet<String>) {
+    for (start, _) in src.match_indices("extern \"C\" {") {
+        let block = &src[start..];
+        let mut depth = 0;
+        let end = block
+            .char_indices()
+            .find(|&(_, c)| {
+                match c {
+                    '{' => depth += 1,
+                    '}' => depth -= 1,
+                    _ => (),
+                }
+                c == '}' && depth == 0
+            })
+            .map_or(block.len(), |(i, _)| i);
+        let code = block[..end]
+            .lines()
+            .map(|line| line.split("//").next().unwrap_or(""));
+        for line in code {
+            // Function pointer types are `fn(`, without a name
+            for (keyword, names) in [("fn ", &mut *functions), ("static ", &mut *statics)] {
+                for (i, _) in line.match_indices(keyword) {
+                    let rest = &line[i + keyword.len()..];
+                    let name: String = rest
+                        .strip_prefix("mut ")
+                        .unwrap_or(rest)
+                        .chars()
+                        .take_while(|c| c.is_ascii_alphanumeric() || *c == '_')
+                        .collect();
+                    if !name.is_empty() {
+                        names.insert(name);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Functions of the bindings also provided by the C library of the host
+const HOST_LIBC_FUNCTIONS: [&str; 2] = ["setjmp", "longjmp"];
+
+/// Build for the machine running the SDK, with the `host` feature: the C
+/// SDK is replaced by src/host.rs, and by weak stubs for the functions of
+/// the OS it does not emulate, which stop the test calling them. The
+/// globals of the C SDK are zeroed buffers.
+fn build_host(bolos_sdk: &str) -> Result<(), Box<dyn Error>> {
+    let out_dir = PathBuf::from(env::var_os("OUT_DIR").unwrap());
+    let (mut functions, mut statics) = (BTreeSet::new(), BTreeSet::new());
+    let mut dirs = vec![PathBuf::from("src")];
+    while let Some(dir) = dirs.pop() {
+        for entry in std::fs::read_dir(dir)? {
+            let path = entry?.path();
+            if path.is_dir() {
+                dirs.push(path);
+            } else if path.extension().is_some_and(|e| e == "rs") && !path.ends_with("host.rs") {
+                // The declarations of src/host.rs are those of the C library
+                let src = std::fs::read_to_string(&path)?;
+                extern_symbols(&src, &mut functions, &mut statics);
+            }
+        }
+    }
+    let mut stubs = String::from(
+        "// Generated by build.rs: weak stubs of the functions of the OS\n\
+         __attribute__((noreturn)) void host_unsupported(const char *name);\n\
+         #define STUB(name) __attribute__((weak)) void name(void) { host_unsupported(#name); }\n\
+         // Large enough for the structures of the bindings\n\
+         #define GLOBAL(name) __attribute__((weak, aligned(16))) unsigned char name[1024];\n",
+    );
+    for name in functions
+        .iter()
+        .filter(|n| !HOST_LIBC_FUNCTIONS.contains(&n.as_str()))
+    {
+        stubs += &format!("STUB({name})\n");
+    }
+    for name in &statics {
+        stubs += &format!("GLOBAL({name})\n");
+    }
+    std::fs::write(out_dir.join("host_stubs.c"), stubs)?;
+    cc::Build::new()
+        .file("src/c/host.c")
+        .file(out_dir.join("host_stubs.c"))
+        .compile("host-stubs");
+
+    let product = env::var("USB_PRODUCT").unwrap_or_else(|_| String::from("Nano S Plus"));
+    println!("cargo:rustc-env=USB_PRODUCT={product}");
+    println!("cargo:rerun-if-env-changed=USB_PRODUCT");
+    for input in [
+        "build.rs",
+        "nanosplus_layout.ld",
+        "src",
+        "ledger-secure-sdk",
+    ] {
+        println!("cargo:rerun-if-changed={input}");
+    }
+    export_rust_sources(bolos_sdk, &out_dir, "nanosplus_layout.ld", "nanosplus")
+}
+
 fn main() -> Result<(), Box<dyn Error>> {
     let bolos_sdk = "./ledger-secure-sdk".to_string();
+    // The devices are custom targets, unknown to rustc
+    println!("cargo::rustc-check-cfg=cfg(target_os, values(\"nanos\", \"nanox\", \"nanosplus\"))");
+
+    if env::var_os("CARGO_FEATURE_HOST").is_some() {
+        return build_host(&bolos_sdk);
+    }
 
     let output = Command::new("arm-none-eabi-gcc")
         .arg("-print-sysroot")
@@ -163,20 +688,6 @@ fn main() -> Result<(), Box<dyn Error>> {
         .file(format!("{bolos_sdk}/src/os.c"))
         .file(format!("{bolos_sdk}/src/svc_call.s"))
         .file(format!("{bolos_sdk}/src/svc_cx_call.s"))
-        .file(format!("{bolos_sdk}/lib_stusb/usbd_conf.c"))
-        .file(format!(
-            "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_core.c"
-        ))
-        .file(format!(
-            "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_ctlreq.c"
-        ))
-        .file(format!(
-            "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_ioreq.c"
-        ))
-        .file(format!("{bolos_sdk}/lib_stusb_impl/usbd_impl.c"))
-        .file(format!(
-            "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/HID/Src/usbd_hid.c"
-        ))
         .define("HAVE_LOCAL_APDU_BUFFER", None)
         .define("IO_HID_EP_LENGTH", Some("64"))
         .define("USB_SEGMENT_SIZE", Some("64"))
@@ -209,27 +720,61 @@ fn main() -> Result<(), Box<dyn Error>> {
         .flag("-mno-unaligned-access")
         .flag("-Wno-unused-command-line-argument");
 
-    #[cfg(feature = "ccid")]
+    // Replaced by src/usbd.rs
+    #[cfg(not(feature = "native_usb"))]
     {
         command = command
+            .file(format!("{bolos_sdk}/lib_stusb/usbd_conf.c"))
             .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_cmd.c"
+                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_core.c"
             ))
             .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_core.c"
+                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_ctlreq.c"
             ))
             .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_if.c"
+                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Core/Src/usbd_ioreq.c"
             ))
+            .file(format!("{bolos_sdk}/lib_stusb_impl/usbd_impl.c"))
             .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_cmd.c"
-            ))
-            .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_core.c"
-            ))
-            .file(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_if.c"
+                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/HID/Src/usbd_hid.c"
             ))
+            .clone();
+    }
+
+    #[cfg(feature = "webusb")]
+    {
+        // No landing page URL advertised
+        command = command
+            .define("HAVE_WEBUSB", None)
+            .define("WEBUSB_URL_SIZE_B", Some("0"))
+            .define("WEBUSB_URL", Some(""))
+            .clone();
+    }
+
+    #[cfg(feature = "webusb_bulk")]
+    {
+        command = command.define("HAVE_WEBUSB_BULK", None).clone();
+    }
+
+    #[cfg(feature = "hid_keyboard")]
+    {
+        // The HID interface is a boot keyboard, driven by src/keyboard.rs
+        command = command.define("HAVE_USB_HIDKBD", None).clone();
+    }
+
+    #[cfg(feature = "u2f")]
+    {
+        // The lib_u2f headers included by the SDK, for a transport
+        // implemented in src/u2f.rs
+        command = command
+            .define("HAVE_IO_U2F", None)
+            .include("./src/c/u2f")
+            .clone();
+    }
+
+    #[cfg(feature = "ccid")]
+    {
+        command = command
             .file(format!(
                 "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/src/usbd_ccid_cmd.c"
             ))
@@ -244,12 +789,6 @@ fn main() -> Result<(), Box<dyn Error>> {
             .include(format!(
                 "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/inc"
             ))
-            .include(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/inc"
-            ))
-            .include(format!(
-                "{bolos_sdk}/lib_stusb/STM32_USB_Device_Library/Class/CCID/inc"
-            ))
             .clone();
     }
 
@@ -266,7 +805,7 @@ fn main() -> Result<(), Box<dyn Error>> {
         "nanosplus" => NanoSPlus,
         "nanox" => NanoX,
         target_name => panic!(
-            "invalid target `{target_name}`, expected one of `nanos`, `nanox`, `nanosplus`. Run with `-Z build-std=core --target=./<target name>.json`"
+            "invalid target `{target_name}`, expected one of `nanos`, `nanox`, `nanosplus`. Run with `-Z build-std=core --target=./<target name>.json`, or natively with the `host` feature"
         ),
     };
 
@@ -276,10 +815,32 @@ fn main() -> Result<(), Box<dyn Error>> {
         NanoSPlus => finalize_nanosplus_configuration(&mut command, &bolos_sdk),
     };
 
+    let device_name = match device {
+        NanoS => "Nano S",
+        NanoX => "Nano X",
+        NanoSPlus => "Nano S Plus",
+    };
+    configure_usb_product(&mut command, device_name);
+
     if env::var_os("CARGO_FEATURE_PENDING_REVIEW_SCREEN").is_some() {
         command.define("HAVE_PENDING_REVIEW_SCREEN", None);
     }
 
+    if env::var_os("CARGO_FEATURE_NO_THROW").is_some() {
+        command.define("HAVE_NO_THROW", None);
+    }
+
+    // Emit LLVM bitcode instead of object files, so that the C code is
+    // optimized with the Rust code when the app is linked with
+    // `-C linker-plugin-lto`. clang must use the LLVM version of rustc, and
+    // the archive needs a bitcode-aware symbol index.
+    if env::var_os("CARGO_FEATURE_C_LTO").is_some() {
+        command.flag("-flto=thin");
+        if env::var_os("AR").is_none() {
+            command.archiver("llvm-ar");
+        }
+    }
+
     // all 'finalize_...' functions also declare a new 'cfg' variable corresponding
     // to the name of the target (as #[cfg(target = "nanox")] does not work, for example)
     // this allows code to easily import things depending on the target
@@ -322,5 +883,28 @@ fn main() -> Result<(), Box<dyn Error>> {
     };
     std::fs::copy(linkerscript, out_dir.join(linkerscript))?;
     std::fs::copy("link.ld", out_dir.join("link.ld"))?;
-    Ok(())
+    let stubs_dir = match device {
+        NanoS => "nanos",
+        NanoX => "nanox",
+        NanoSPlus => "nanosplus",
+    };
+
+    // Watching an environment variable disables the default of rerunning on
+    // any change in the package, so list the build inputs as well.
+    println!("cargo:rerun-if-env-changed=BAGL_FONTS");
+    println!("cargo:rerun-if-env-changed=BAGL_ATLAS");
+    println!("cargo:rerun-if-env-changed=USB_PRODUCT");
+    for input in [
+        "build.rs",
+        "link.ld",
+        "nanos_layout.ld",
+        "nanox_layout.ld",
+        "nanosplus_layout.ld",
+        "src/c",
+        "ledger-secure-sdk",
+    ] {
+        println!("cargo:rerun-if-changed={input}");
+    }
+
+    export_rust_sources(&bolos_sdk, &out_dir, linkerscript, stubs_dir)
 }
@@ -0,0 +1,142 @@
+//! APDU throughput benchmark
+//!
+//! The host sends `START`, then a sequence of `ECHO` commands, then `REPORT`,
+//! over any transport (HID, WebUSB, BLE, raw or CCID):
+//!
+//! * `ECHO` (INS 0x01): replies with the command data, or with a payload of
+//!   `P1 << 8 | P2` bytes when non-zero, so command and response sizes can be
+//!   set independently.
+//! * `START` (INS 0x02): resets the counters and starts timing.
+//! * `REPORT` (INS 0x03): stops timing and returns, big endian:
+//!   `media (1) | exchanges (4) | bytes in (4) | bytes out (4) |
+//!   elapsed ms (4) | bytes per second (4) | latency per exchange in us (4)`.
+//!
+//! Time is measured by counting ticker events, so its resolution is
+//! `TICK_MS`: sequences should last at least a few hundred milliseconds.
+
+#![no_std]
+#![no_main]
+
+use core::panic::PanicInfo;
+
+#[panic_handler]
+fn panic(_info: &PanicInfo) -> ! {
+    loop {}
+}
+
+use nanos_sdk::bindings::{io_seproxyhal_setup_ticker, G_io_app};
+use nanos_sdk::io::{Comm, Event, StatusWords};
+
+/// Ticker period, in milliseconds
+const TICK_MS: u32 = 10;
+
+/// Large enough for extended APDUs
+const BUFFER_SIZE: usize = 1024;
+
+enum Ins {
+    Echo,
+    Start,
+    Report,
+}
+
+impl TryFrom<u8> for Ins {
+    type Error = ();
+    fn try_from(ins: u8) -> Result<Self, Self::Error> {
+        match ins {
+            0x01 => Ok(Ins::Echo),
+            0x02 => Ok(Ins::Start),
+            0x03 => Ok(Ins::Report),
+            _ => Err(()),
+        }
+    }
+}
+
+#[derive(Default)]
+struct Bench {
+    running: bool,
+    ticks: u32,
+    exchanges: u32,
+    bytes_in: u32,
+    bytes_out: u32,
+}
+
+impl Bench {
+    fn report(&self, media: u8, comm: &mut Comm<BUFFER_SIZE>) {
+        let elapsed_ms = self.ticks * TICK_MS;
+        let bytes = (self.bytes_in + self.bytes_out) as u64;
+        let (rate, latency_us) = match (elapsed_ms, self.exchanges) {
+            (0, _) | (_, 0) => (0, 0),
+            (ms, n) => (
+                (bytes * 1000 / ms as u64) as u32,
+                (ms as u64 * 1000 / n as u64) as u32,
+            ),
+        };
+        comm.append(&[media]);
+        for v in [
+            self.exchanges,
+            self.bytes_in,
+            self.bytes_out,
+            elapsed_ms,
+            rate,
+            latency_us,
+        ] {
+            comm.append(&v.to_be_bytes());
+        }
+    }
+}
+
+/// Reply to `ECHO`, returning the number of response bytes
+fn echo(comm: &mut Comm<BUFFER_SIZE>) -> Result<usize, StatusWords> {
+    let requested = u16::from_be_bytes([comm.get_p1(), comm.get_p2()]) as usize;
+    let data = comm.get_data()?;
+    let len = data.len();
+    let offset = data.as_ptr() as usize - comm.apdu_buffer.as_ptr() as usize;
+    comm.apdu_buffer.copy_within(offset..offset + len, 0);
+    // Room is kept for the status word
+    comm.tx = match requested {
+        0 => len,
+        n => n.min(BUFFER_SIZE - 2),
+    };
+    Ok(comm.tx)
+}
+
+#[no_mangle]
+fn sample_main() {
+    let mut comm = Comm::<BUFFER_SIZE>::new_with_buffer_size();
+    let mut bench = Bench::default();
+    unsafe { io_seproxyhal_setup_ticker(TICK_MS) };
+
+    loop {
+        match comm.next_event() {
+            Event::Ticker if bench.running => bench.ticks += 1,
+            Event::Command(ins) => {
+                let media = unsafe { G_io_app.apdu_media };
+                let rx = comm.rx as u32;
+                match ins {
+                    Ins::Echo => match echo(&mut comm) {
+                        Ok(tx) => {
+                            bench.exchanges += 1;
+                            bench.bytes_in += rx;
+                            bench.bytes_out += tx as u32 + 2;
+                            comm.reply_ok();
+                        }
+                        Err(sw) => comm.reply(sw),
+                    },
+                    Ins::Start => {
+                        bench = Bench {
+                            running: true,
+                            ..Default::default()
+                        };
+                        comm.reply_ok();
+                    }
+                    Ins::Report => {
+                        bench.running = false;
+                        bench.report(media, &mut comm);
+                        comm.reply_ok();
+                    }
+                }
+            }
+            _ => (),
+        }
+    }
+}
@@ -156,6 +156,21 @@ extern const bagl_font_t *const C_bagl_fonts[];
 #define PIC_FONT(x) ((bagl_font_t const *)PIC(x))
 extern const unsigned int C_bagl_fonts_count;
 
+#ifdef HAVE_BAGL_ATLAS
+// 1 bpp glyphs of a font, pre-rendered at build time with byte-aligned rows
+// (LSB first), so that a run of characters can be drawn in a single call
+typedef struct {
+  unsigned int font_id;
+  unsigned short first_char;
+  unsigned short last_char;
+  const unsigned short *offsets; // of each glyph in rows, last_char-first_char+2 entries
+  const unsigned char *rows;
+} bagl_atlas_t;
+
+extern const bagl_atlas_t C_bagl_atlases[];
+extern const unsigned int C_bagl_atlases_count;
+#endif // HAVE_BAGL_ATLAS
+
 #define BAGL_ENCODING_LATIN1 0
 
 #define BAGL_FONT_OPEN_SANS_LIGHT_14px BAGL_FONT_OPEN_SANS_REGULAR_11_14PX
@@ -0,0 +1,72 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2022 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * APDU framing engine shared by the HID and BLE transports, implemented by
+ * the Rust SDK (src/framing.rs). Frames are laid out as:
+ *   <channel-U16><tag=0x05><sequence-idx-U16><seq==0?totallength-U16:NONE><apducontent>
+ * Control tags are left to the transports.
+ */
+
+enum {
+  LEDGER_FRAMING_RESET,
+  LEDGER_FRAMING_MORE_DATA,
+  LEDGER_FRAMING_RECEIVED,
+};
+
+// Layout of framing::Framer
+typedef struct ledger_framing_s {
+  uint16_t channel;
+  uint16_t rx_sequence;
+  uint16_t rx_length;
+  uint16_t rx_offset;
+  uint16_t tx_sequence;
+  uint16_t tx_length;
+  uint16_t tx_offset;
+} ledger_framing_t;
+
+/**
+ * Append the data of an APDU frame to apdu, returns LEDGER_FRAMING_RECEIVED
+ * once rx_length bytes have been received.
+ */
+uint8_t ledger_framing_receive(ledger_framing_t *framing,
+                               const uint8_t *frame,
+                               uint16_t frame_length,
+                               uint8_t *apdu,
+                               uint16_t apdu_length);
+
+/**
+ * Start sending a length bytes APDU on the channel of the last command
+ */
+void ledger_framing_send(ledger_framing_t *framing, uint16_t length);
+
+/**
+ * Build the next frame of the APDU being sent into frame, returns its length
+ * (at most packet_size), or 0 once the whole APDU has been framed.
+ */
+uint16_t ledger_framing_next_frame(ledger_framing_t *framing,
+                                   const uint8_t *apdu,
+                                   uint8_t *frame,
+                                   uint16_t packet_size);
+
+static inline int ledger_framing_tx_pending(const ledger_framing_t *framing) {
+  return framing->tx_offset < framing->tx_length;
+}
@@ -121,6 +121,8 @@ void io_usb_send_ep(unsigned int ep, unsigned char *buffer,
                     unsigned short length, unsigned int timeout);
 
 void io_usb_ccid_reply(unsigned char *buffer, unsigned short length);
+// reply in place with the first length bytes of the ccid data buffer
+void io_usb_ccid_reply_bare(unsigned short length);
 
 #define NO_TIMEOUT (0UL)
 // Function that allow applications to modulate the APDU handling timeout
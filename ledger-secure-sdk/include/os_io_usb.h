@@ -46,6 +46,10 @@ void io_usb_hid_init(void);
  * Receive next HID transport packet, returns IO_USB_APDU_RECEIVED when a
  * complete APDU has been received in the G_io_apdu_buffer To be called
  * typically upon USB OUT event
+ * Control commands (version, channel allocation, ping) are answered on any
+ * channel without disturbing the APDU being received or sent. APDU chunks
+ * are dropped while an APDU has not been replied yet, and while another
+ * channel is receiving one.
  */
 io_usb_hid_receive_status_t
 io_usb_hid_receive(io_send_t sndfct, unsigned char *buffer, unsigned short l, apdu_buffer_t * apdu_buffer);
@@ -78,6 +78,40 @@ Y axis  |   #####
  // 'Magic' number for x & y to mutualise code from bagl_draw_string
 #define MAGIC_XY  12345
 
+// Number of entries of the direct-mapped font lookup cache (power of 2)
+#ifndef BAGL_FONT_CACHE_SIZE
+#define BAGL_FONT_CACHE_SIZE 4
+#endif // !BAGL_FONT_CACHE_SIZE
+
+// Number of entries of the direct-mapped unicode glyph cache (power of 2)
+#ifndef BAGL_GLYPH_CACHE_SIZE
+#define BAGL_GLYPH_CACHE_SIZE 16
+#endif // !BAGL_GLYPH_CACHE_SIZE
+
+// Number of line widths remembered by bagl_compute_line_width
+#ifndef BAGL_LINE_WIDTH_CACHE_SIZE
+#define BAGL_LINE_WIDTH_CACHE_SIZE 4
+#endif // !BAGL_LINE_WIDTH_CACHE_SIZE
+
+// Bytes of the 1 bpp rendering of the text scrolled by bagl_animate. 0 draws
+// the text again at each frame instead.
+#ifndef BAGL_ANIM_STRIP_SIZE
+#define BAGL_ANIM_STRIP_SIZE 512
+#endif // !BAGL_ANIM_STRIP_SIZE
+
+// Bytes of the visible part of the strip, copied out at each frame
+#ifndef BAGL_ANIM_WINDOW_SIZE
+#define BAGL_ANIM_WINDOW_SIZE 256
+#endif // !BAGL_ANIM_WINDOW_SIZE
+
+#ifdef HAVE_BAGL_ATLAS
+// Bytes of the 1 bpp bitmap of a run of characters taken from the atlas,
+// drawn in a single call
+#ifndef BAGL_RUN_BUFFER_SIZE
+#define BAGL_RUN_BUFFER_SIZE 192
+#endif // !BAGL_RUN_BUFFER_SIZE
+#endif // HAVE_BAGL_ATLAS
+
 // --------------------------------------------------------------------------------------
 // Variables
 // --------------------------------------------------------------------------------------
@@ -89,8 +123,54 @@ unsigned int                    G_glyph_count;
 
 #ifdef HAVE_BOLOS
 static const bagl_font_unicode_t *font_unicode;
+
+static struct {
+  const bagl_font_unicode_t *font;
+  unsigned int unicode;
+  const bagl_font_unicode_character_t *character;
+} glyph_cache[BAGL_GLYPH_CACHE_SIZE];
 #endif //HAVE_BOLOS
 
+static const bagl_font_t *font_cache[BAGL_FONT_CACHE_SIZE];
+
+// Line widths are keyed by the text pointer, and by a hash of the text in
+// case the same buffer is reused for another string.
+static struct {
+  const void *text;
+  unsigned int hash;
+  unsigned short font_id;
+  unsigned short req_width;
+  unsigned char text_length;
+  unsigned char text_encoding;
+  unsigned short width;
+} line_width_cache[BAGL_LINE_WIDTH_CACHE_SIZE];
+static unsigned int line_width_cache_next;
+
+#if BAGL_ANIM_STRIP_SIZE
+// Text of the last animated label, rendered once and keyed like the line
+// widths. While strip_target is set, bagl_draw_string draws into the strip
+// instead of the screen, and sets strip_failed for glyphs it cannot render.
+static struct {
+  const void *text;
+  unsigned int hash;
+  unsigned short font_id;
+  unsigned short text_length;
+  unsigned char text_encoding;
+  unsigned short width;
+  unsigned char height;
+  unsigned char valid;
+} anim_strip;
+static unsigned char anim_strip_bits[BAGL_ANIM_STRIP_SIZE];
+static unsigned char anim_window_bits[BAGL_ANIM_WINDOW_SIZE];
+static unsigned char strip_target;
+static unsigned char strip_failed;
+#endif // BAGL_ANIM_STRIP_SIZE
+
+#ifdef HAVE_BAGL_ATLAS
+// one more byte for the shifted glyph bytes spilling over the last one
+static unsigned char run_bits[BAGL_RUN_BUFFER_SIZE+1];
+#endif // HAVE_BAGL_ATLAS
+
 // --------------------------------------------------------------------------------------
 // API
 // --------------------------------------------------------------------------------------
@@ -135,10 +215,17 @@ const bagl_font_t* bagl_get_font(unsigned int font_id) {
   unsigned int i=C_bagl_fonts_count;
   font_id &= BAGL_FONT_ID_MASK;
 
+  // the text font and the symbols fonts are looked up for each string
+  const bagl_font_t **cached = &font_cache[font_id & (BAGL_FONT_CACHE_SIZE-1)];
+  if (*cached && (*cached)->font_id == font_id) {
+    return *cached;
+  }
+
   while(i--) {
     // font id match this entry (non indexed array)
     if (PIC_FONT(C_bagl_fonts[i])->font_id == font_id) {
-      return PIC_FONT(C_bagl_fonts[i]);
+      *cached = PIC_FONT(C_bagl_fonts[i]);
+      return *cached;
     }
   }
 
@@ -168,19 +255,37 @@ const bagl_font_unicode_t* bagl_get_font_unicode(unsigned int font_id) {
 
 // ----------------------------------------------------------------------------
 const bagl_font_unicode_character_t *get_unicode_character(unsigned int unicode) {
+  unsigned int slot = unicode & (BAGL_GLYPH_CACHE_SIZE-1);
+  if (glyph_cache[slot].font == font_unicode && glyph_cache[slot].unicode == unicode) {
+    return glyph_cache[slot].character;
+  }
+
   const bagl_font_unicode_character_t *characters = PIC_CHARU(font_unicode->characters);
   unsigned int n = C_unicode_characters_count;
-  // For the moment, let just parse the full array, but at the end let use
-  // binary search as data are sorted by unicode value !
-  for (unsigned i=0; i < n; i++, characters++) {
-    if ((PIC_CHARU(characters))->char_unicode == unicode) {
-      return (PIC_CHARU(characters));
-    }
-  }
   // By default, let's use the last Unicode character, which should be the
   // 0x00FFFD one, used to replace unrecognized or unrepresentable character.
-  --characters;
-  return (PIC_CHARU(characters));
+  const bagl_font_unicode_character_t *character = PIC_CHARU(&characters[n-1]);
+  // data are sorted by unicode value: binary search
+  unsigned int lo = 0, hi = n;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    unsigned int mid_unicode = PIC_CHARU(&characters[mid])->char_unicode;
+    if (mid_unicode == unicode) {
+      character = PIC_CHARU(&characters[mid]);
+      break;
+    }
+    if (mid_unicode < unicode) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  glyph_cache[slot].font = font_unicode;
+  glyph_cache[slot].unicode = unicode;
+  glyph_cache[slot].character = character;
+  return character;
 }
 
 // ----------------------------------------------------------------------------
@@ -214,14 +319,178 @@ bagl_font_t const *toggle_bold(unsigned short *font_id) {
 }
 #endif //HAVE_BOLOS
 
+// --------------------------------------------------------------------------------------
+// FNV-1a of a text, to tell apart strings reusing the same buffer
+static unsigned int text_hash(const void *text, unsigned int text_length) {
+  unsigned int hash = 2166136261U;
+  for (unsigned int i = 0; i < text_length; i++) {
+    hash = (hash ^ ((const unsigned char *)text)[i]) * 16777619U;
+  }
+  return hash;
+}
+
 // --------------------------------------------------------------------------------------
 // return the width of a text (first line only) for alignment processing
 unsigned short bagl_compute_line_width(unsigned short font_id, unsigned short width, const void * text, unsigned char text_length, unsigned char text_encoding) {
+  unsigned int hash = text_hash(text, text_length);
+
+  for (unsigned int i = 0; i < BAGL_LINE_WIDTH_CACHE_SIZE; i++) {
+    if (line_width_cache[i].text == text
+        && line_width_cache[i].hash == hash
+        && line_width_cache[i].font_id == font_id
+        && line_width_cache[i].req_width == width
+        && line_width_cache[i].text_length == text_length
+        && line_width_cache[i].text_encoding == text_encoding) {
+      return line_width_cache[i].width;
+    }
+  }
 
   // We will mutualise code from bagl_draw_string(smaller, easier to maintain):
-  return (unsigned short)bagl_draw_string(font_id, 0, 0, MAGIC_XY, MAGIC_XY, width, 0, text, text_length, text_encoding);
+  unsigned short line_width = (unsigned short)bagl_draw_string(font_id, 0, 0, MAGIC_XY, MAGIC_XY, width, 0, text, text_length, text_encoding);
+
+  unsigned int i = line_width_cache_next;
+  line_width_cache_next = (i + 1) % BAGL_LINE_WIDTH_CACHE_SIZE;
+  line_width_cache[i].text = text;
+  line_width_cache[i].hash = hash;
+  line_width_cache[i].font_id = font_id;
+  line_width_cache[i].req_width = width;
+  line_width_cache[i].text_length = text_length;
+  line_width_cache[i].text_encoding = text_encoding;
+  line_width_cache[i].width = line_width;
+  return line_width;
 }
 
+#if BAGL_ANIM_STRIP_SIZE
+// --------------------------------------------------------------------------------------
+// copy a w x h area of a 1 bpp bitmap (packed, LSB first, horizontal scan) of
+// width src_w, starting at column src_x, to (dst_x, dst_y) in a dst_w x dst_h
+// bitmap. Pixels outside of either one are skipped.
+static void bitmap_copy(unsigned char *dst, unsigned int dst_w, unsigned int dst_h, int dst_x, int dst_y,
+                        const unsigned char *src, unsigned int src_w, unsigned int src_x,
+                        unsigned int w, unsigned int h) {
+  for (unsigned int row = 0; row < h; row++) {
+    int dy = dst_y + (int)row;
+    if (dy < 0 || dy >= (int)dst_h) {
+      continue;
+    }
+    for (unsigned int col = 0; col < w && src_x + col < src_w; col++) {
+      int dx = dst_x + (int)col;
+      if (dx < 0 || dx >= (int)dst_w) {
+        continue;
+      }
+      unsigned int s = row * src_w + src_x + col;
+      if (src[s / 8] & (1 << (s % 8))) {
+        unsigned int d = dy * dst_w + dx;
+        dst[d / 8] |= 1 << (d % 8);
+      }
+    }
+  }
+}
+#endif // BAGL_ANIM_STRIP_SIZE
+
+#ifdef HAVE_BAGL_ATLAS
+// --------------------------------------------------------------------------------------
+// get the pre-rendered glyphs of a font, if any
+static const bagl_atlas_t *bagl_get_atlas(unsigned int font_id) {
+  for (unsigned int i = 0; i < C_bagl_atlases_count; i++) {
+    const bagl_atlas_t *atlas = (const bagl_atlas_t *)PIC(&C_bagl_atlases[i]);
+    if (atlas->font_id == font_id) {
+      return atlas;
+    }
+  }
+  return NULL;
+}
+
+// --------------------------------------------------------------------------------------
+// draw a string whose characters are all in the atlas of its 1 bpp font, one
+// call per line segment instead of one per character. Lines are wrapped as in
+// bagl_draw_string, which passes width and height already offset by x and y.
+// Returns 0 if the string has to be drawn character by character.
+static unsigned int draw_string_atlas(const bagl_font_t *font, const unsigned int *colors, int x, int y,
+                                      unsigned int width, unsigned int height,
+                                      const unsigned char *txt, unsigned int text_length, int *pos) {
+  const bagl_atlas_t *atlas = bagl_get_atlas(font->font_id);
+  if (atlas == NULL) {
+    return 0;
+  }
+  for (unsigned int i = 0; i < text_length; i++) {
+    // escape sequences, symbols and UTF-8 sequences take the generic path
+    if (txt[i] < atlas->first_char || txt[i] > atlas->last_char || txt[i] >= 0x80) {
+      return 0;
+    }
+  }
+
+  const bagl_font_character_t *characters = PIC_CHAR(font->characters);
+  const unsigned short *offsets = (const unsigned short *)PIC(atlas->offsets);
+  const unsigned char *rows = (const unsigned char *)PIC(atlas->rows);
+  unsigned int h = font->char_height;
+  unsigned int kerning = font->char_kerning;
+  int xx = x;
+
+  while (text_length) {
+    // go to next line if needed
+    if (xx + characters[*txt - font->first_char].char_width > (int)width) {
+      y += h;
+      // IGNORED for first line
+      if (y + (int)h > (int)height) {
+        *pos = (y<<16)|(xx&0xFFFF);
+        return 1;
+      }
+      xx = x;
+    }
+
+    // characters fitting on the line and in the run, the first one anyway
+    unsigned int count = 0;
+    unsigned int run_w = 0;
+    unsigned int advance = 0;
+    while (count < text_length) {
+      unsigned int w = characters[txt[count] - font->first_char].char_width;
+      if (count
+          && (xx + (int)(advance + w) > (int)width || (advance + w) * h > BAGL_RUN_BUFFER_SIZE * 8)) {
+        break;
+      }
+      run_w = advance + w;
+      advance = run_w + kerning;
+      count++;
+    }
+
+    if (run_w * h > BAGL_RUN_BUFFER_SIZE * 8) {
+      // a single character too large for the run
+      const bagl_font_character_t *character = &characters[*txt - font->first_char];
+      bagl_hal_draw_bitmap_within_rect(xx, y, run_w, h, 2, colors, 1,
+                                       &PIC_BMP(font->bitmap)[character->bitmap_offset], run_w * h);
+    } else {
+      // OR the byte-aligned rows of each glyph in the packed run bitmap
+      memset(run_bits, 0, (run_w * h + 7) / 8 + 1);
+      unsigned int cx = 0;
+      for (unsigned int i = 0; i < count; i++) {
+        unsigned int w = characters[txt[i] - font->first_char].char_width;
+        unsigned int stride = (w + 7) / 8;
+        const unsigned char *glyph = &rows[offsets[txt[i] - atlas->first_char]];
+        for (unsigned int r = 0; r < h; r++) {
+          for (unsigned int b = 0; b < stride; b++) {
+            unsigned int bits = glyph[r * stride + b];
+            unsigned int p = r * run_w + cx + 8 * b;
+            run_bits[p / 8] |= bits << (p % 8);
+            run_bits[p / 8 + 1] |= bits >> (8 - p % 8);
+          }
+        }
+        cx += w + kerning;
+      }
+      bagl_hal_draw_bitmap_within_rect(xx, y, run_w, h, 2, colors, 1, run_bits, run_w * h);
+    }
+
+    // prepare for next run
+    xx += advance;
+    txt += count;
+    text_length -= count;
+  }
+
+  *pos = (y<<16)|(xx&0xFFFF);
+  return 1;
+}
+#endif // HAVE_BAGL_ATLAS
+
 // --------------------------------------------------------------------------------------
 // draw char until a char fit before reaching width
 // TODO support hyphenation ??
@@ -302,6 +571,19 @@ int bagl_draw_string(unsigned short font_id, unsigned int fgcolor, unsigned int
   // initialize first index
   xx = x;
 
+#ifdef HAVE_BAGL_ATLAS
+  if (!dont_draw && bpp == 1
+#if BAGL_ANIM_STRIP_SIZE
+      && !strip_target
+#endif // BAGL_ANIM_STRIP_SIZE
+     ) {
+    int pos;
+    if (draw_string_atlas(font, colors, x, y, width, height, txt, text_length, &pos)) {
+      return pos;
+    }
+  }
+#endif // HAVE_BAGL_ATLAS
+
   // depending on encoding
   while (text_length--) {
 
@@ -424,6 +706,17 @@ int bagl_draw_string(unsigned short font_id, unsigned int fgcolor, unsigned int
       */
 
       // chars are storred LSB to MSB in each char, packed chars. horizontal scan
+#if BAGL_ANIM_STRIP_SIZE
+      if (strip_target) {
+        if (ch_bitmap && bpp == 1) {
+          bitmap_copy(anim_strip_bits, anim_strip.width, anim_strip.height, xx, ch_y,
+                      ch_bitmap, ch_width, 0, ch_width, ch_height);
+        } else if (ch_bitmap) {
+          strip_failed = 1;
+        }
+      }
+      else
+#endif // BAGL_ANIM_STRIP_SIZE
       if (ch_bitmap) {
         bagl_hal_draw_bitmap_within_rect(xx, ch_y, ch_width, ch_height, (1<<bpp), colors, bpp, ch_bitmap, bpp*ch_width*ch_height); // note, last parameter is computable could be avoided
       }
@@ -981,6 +1274,48 @@ void bagl_draw_glyph(const bagl_component_t* component, const bagl_icon_details_
 }
 
 
+#if BAGL_ANIM_STRIP_SIZE
+// --------------------------------------------------------------------------------------
+// render the text of anim in the strip, unless it is already there. Returns 0
+// when the text does not fit or uses glyphs of more than 1 bpp.
+static unsigned int anim_strip_render(const bagl_animated_t *anim, const bagl_font_t *font, unsigned int totalwidth) {
+  unsigned int hash = text_hash(anim->text, anim->text_length);
+  if (anim_strip.valid
+      && anim_strip.text == anim->text
+      && anim_strip.hash == hash
+      && anim_strip.font_id == anim->c.font_id
+      && anim_strip.text_length == anim->text_length
+      && anim_strip.text_encoding == anim->text_encoding) {
+    return 1;
+  }
+
+  // line widths leave kerning out
+  unsigned int width = totalwidth + font->char_kerning * anim->text_length;
+  unsigned int height = font->char_height;
+  anim_strip.valid = 0;
+  if (font->bpp != 1
+      || (width * height + 7) / 8 > sizeof(anim_strip_bits)
+      || (anim->c.width * height + 7) / 8 > sizeof(anim_window_bits)) {
+    return 0;
+  }
+  memset(anim_strip_bits, 0, (width * height + 7) / 8);
+  anim_strip.text = anim->text;
+  anim_strip.hash = hash;
+  anim_strip.font_id = anim->c.font_id;
+  anim_strip.text_length = anim->text_length;
+  anim_strip.text_encoding = anim->text_encoding;
+  anim_strip.width = width;
+  anim_strip.height = height;
+
+  strip_target = 1;
+  strip_failed = 0;
+  bagl_draw_string(anim->c.font_id, 1, 0, 0, 0, width, height, anim->text, anim->text_length, anim->text_encoding);
+  strip_target = 0;
+  anim_strip.valid = !strip_failed;
+  return anim_strip.valid;
+}
+#endif // BAGL_ANIM_STRIP_SIZE
+
 // --------------------------------------------------------------------------------------
 
 void bagl_animate(bagl_animated_t* anim, unsigned int timestamp_ms, unsigned int interval_ms) {
@@ -1057,6 +1392,21 @@ void bagl_animate(bagl_animated_t* anim, unsigned int timestamp_ms, unsigned int
 
     a = anim->c.y + (type==BAGL_LABELINE?-(baseline):valignment);
     b = anim->c.height- (type==BAGL_LABELINE?0/*-char_height*/:valignment);
+#if BAGL_ANIM_STRIP_SIZE
+    // the text is rendered once, then each frame is a single blit of the
+    // visible part of it
+    if (anim_strip_render(anim, font, totalwidth)) {
+      unsigned int colors[2] = {anim->c.bgcolor, anim->c.fgcolor};
+      unsigned int offset = totalwidth - remwidth + font->char_kerning * anim->current_char_idx + current_char_displayed_width;
+      unsigned int h = anim_strip.height;
+      memset(anim_window_bits, 0, (anim->c.width * h + 7) / 8);
+      bitmap_copy(anim_window_bits, anim->c.width, h, 0, 0,
+                  anim_strip_bits, anim_strip.width, offset, anim->c.width, h);
+      bagl_hal_draw_bitmap_within_rect(anim->c.x, a, anim->c.width, h, 2, colors, 1, anim_window_bits, anim->c.width * h);
+    }
+    else
+#endif // BAGL_ANIM_STRIP_SIZE
+    {
     bagl_draw_string(anim->c.font_id,
                      anim->c.fgcolor,
                      anim->c.bgcolor,
@@ -1077,6 +1427,7 @@ void bagl_animate(bagl_animated_t* anim, unsigned int timestamp_ms, unsigned int
                        a,
                        maxcharwidth,
                        b);
+    }
 
   // report on screen
     screen_update();
@@ -196,6 +196,13 @@ typedef struct usb_class_ccid_s {
   //Ccid_bulk_data_t Ccid_bulk_data;
   ccid_bulk_header_t bulk_header;
 
+  // extended APDU level chaining (wLevelParameter / bChainParameter):
+  // offset of the current block in the data buffer, length of the response
+  // block in flight and response bytes left after it
+  uint32_t chain_offset;
+  uint32_t chain_block_length;
+  uint32_t chain_remaining;
+
   SC_Param_t SC_Param;
 } usb_class_ccid_t;
 extern usb_class_ccid_t G_io_ccid;
@@ -222,6 +229,8 @@ void Transfer_Data_Request(void);
 void Set_CSW (uint8_t CSW_Status, uint8_t Send_Permission);
 
 void io_usb_ccid_set_card_inserted(unsigned int inserted);
+void io_usb_ccid_reply_continue(void);
+void io_usb_ccid_reply_next_block(void);
 
 #endif // HAVE_USB_CLASS_CCID
 
@@ -220,7 +220,8 @@ uint8_t  PC_to_RDR_GetSlotStatus(void)
   */
 uint8_t  PC_to_RDR_XfrBlock(void)
 {
-  uint16_t expectedLength, reqlen;
+  uint16_t expectedLength;
+  uint32_t reqlen;
   
       uint8_t error;
 
@@ -232,21 +233,43 @@ uint8_t  PC_to_RDR_XfrBlock(void)
   if (error != 0) 
     return error;
     
-  if (G_io_ccid.bulk_header.bulkout.dwLength > IO_CCID_DATA_BUFFER_SIZE)
+  if (G_io_ccid.bulk_header.bulkout.dwLength > IO_CCID_DATA_BUFFER_SIZE - G_io_ccid.chain_offset)
   { /* Check amount of Data Sent by Host is > than memory allocated ? */
     
     return SLOTERROR_BAD_DWLENGTH;
   }
 
 
-  /* wLevelParameter = Size of expected data to be returned by the 
-                        bulk-IN endpoint */
+  /* wLevelParameter = chaining of the abData field at the extended APDU
+                        level of exchange. The blocks of a chained command
+                        APDU are received one after the other in the data
+                        buffer (see CCID_BulkMessage_Out) */
   expectedLength = (G_io_ccid.bulk_header.bulkout.bSpecific_2 << 8) | 
                     G_io_ccid.bulk_header.bulkout.bSpecific_1;   
 
   reqlen = G_io_ccid.bulk_header.bulkout.dwLength;
-  
-  G_io_ccid.bulk_header.bulkin.dwLength = (uint16_t)expectedLength;  
+
+  switch (expectedLength) {
+  case 0x0001: /* the command APDU begins with this block and continues */
+  case 0x0003: /* this block continues the command APDU, another one follows */
+    G_io_ccid.chain_offset += reqlen;
+    CCID_UpdateCommandStatus(BM_COMMAND_STATUS_NO_ERROR, BM_ICC_PRESENT_ACTIVE);
+    io_usb_ccid_reply_continue();
+    return SLOT_NO_ERROR;
+
+  case 0x0010: /* empty block, the next block of the response is expected */
+    CCID_UpdateCommandStatus(BM_COMMAND_STATUS_NO_ERROR, BM_ICC_PRESENT_ACTIVE);
+    io_usb_ccid_reply_next_block();
+    return SLOT_NO_ERROR;
+
+  case 0x0002: /* this block continues and ends the command APDU */
+    reqlen += G_io_ccid.chain_offset;
+    G_io_ccid.chain_offset = 0;
+    break;
+
+  default: /* 0x0000: the command APDU begins and ends with this block */
+    break;
+  }
 
 
   error = SC_XferBlock(&G_io_ccid_data_buffer[0], 
@@ -257,10 +257,13 @@ uint8_t  USBD_CCID_DataIn (USBD_HandleTypeDef  *pdev,
 uint8_t  USBD_CCID_DataOut (USBD_HandleTypeDef  *pdev, 
                                uint8_t epnum, uint8_t* buffer, apdu_buffer_t * apdu_buffer)
 {
-  UNUSED(apdu_buffer);
   uint16_t rlen = io_seproxyhal_get_ep_rx_size(CCID_BULK_OUT_EP);
+  // receive straight into the apdu buffer of the application, whatever the
+  // length of the command
+  if (apdu_buffer != NULL) {
+    io_usb_ccid_set_buffer(apdu_buffer->buf, apdu_buffer->len);
+  }
   CCID_BulkMessage_Out(pdev , epnum, buffer, rlen);
-  memcpy(apdu_buffer->buf, G_io_apdu_buffer, rlen);
   return USBD_OK;
 }
 
@@ -41,6 +41,8 @@
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 usb_class_ccid_t G_io_ccid;
+unsigned char *G_io_ccid_app_buffer;
+unsigned short G_io_ccid_app_buffer_size;
 
 /* Private function prototypes -----------------------------------------------*/
 static void CCID_Response_SendData (USBD_HandleTypeDef  *pdev, 
@@ -108,7 +110,7 @@ void CCID_BulkMessage_In (USBD_HandleTypeDef  *pdev,
       if (G_io_ccid.pUsbMessageBuffer == (uint8_t *)&G_io_ccid.bulk_header) {
         // first part of the bulk in sent.
         // advance in the data buffer to transmit. (mixed source leap)
-        G_io_ccid.pUsbMessageBuffer = G_io_ccid_data_buffer+MIN(CCID_BULK_EPIN_SIZE, G_io_ccid.UsbMessageLength)-CCID_HEADER_SIZE;
+        G_io_ccid.pUsbMessageBuffer = G_io_ccid_data_buffer+G_io_ccid.chain_offset+MIN(CCID_BULK_EPIN_SIZE, G_io_ccid.UsbMessageLength)-CCID_HEADER_SIZE;
       }
       else {
         G_io_ccid.pUsbMessageBuffer += MIN(CCID_BULK_EPIN_SIZE, G_io_ccid.UsbMessageLength);
@@ -178,7 +180,7 @@ void CCID_Send_Reply(USBD_HandleTypeDef  *pdev) {
     memcpy(G_io_usb_ep_buffer, &G_io_ccid.bulk_header, CCID_HEADER_SIZE);
     if (G_io_ccid.UsbMessageLength>CCID_HEADER_SIZE) {
       // copy start of data if bigger size than a header
-      memmove(G_io_usb_ep_buffer+CCID_HEADER_SIZE, G_io_ccid_data_buffer, MIN(CCID_BULK_EPIN_SIZE, G_io_ccid.UsbMessageLength)-CCID_HEADER_SIZE);
+      memmove(G_io_usb_ep_buffer+CCID_HEADER_SIZE, G_io_ccid_data_buffer+G_io_ccid.chain_offset, MIN(CCID_BULK_EPIN_SIZE, G_io_ccid.UsbMessageLength)-CCID_HEADER_SIZE);
     }
     // send the first mixed source chunk
     CCID_Response_SendData(pdev, G_io_usb_ep_buffer, 
@@ -224,20 +226,32 @@ void CCID_BulkMessage_Out (USBD_HandleTypeDef  *pdev,
         
         // copy the ccid bulk header only
         memcpy(G_io_ccid.pUsbMessageBuffer, buffer, CCID_HEADER_SIZE); 
-        // copy remaining part in the data buffer (split from the ccid to allow for overlaying with another ressource buffer)
-        if (dataLen>CCID_HEADER_SIZE) {
-          memmove(G_io_ccid_data_buffer, buffer+CCID_HEADER_SIZE, dataLen-CCID_HEADER_SIZE);
-          // we're now receiving in the data buffer (all subsequent calls)
-          G_io_ccid.pUsbMessageBuffer = G_io_ccid_data_buffer;
+
+        // the blocks of a chained command apdu are appended to the previous
+        // ones, any other message is received at the start of the data buffer
+        if (G_io_ccid.bulk_header.bulkout.bMessageType != PC_TO_RDR_XFRBLOCK
+            || (G_io_ccid.bulk_header.bulkout.bSpecific_1 != 0x02
+                && G_io_ccid.bulk_header.bulkout.bSpecific_1 != 0x03
+                && G_io_ccid.bulk_header.bulkout.bSpecific_1 != 0x10)
+            || G_io_ccid.bulk_header.bulkout.bSpecific_2 != 0) {
+          G_io_ccid.chain_offset = 0;
         }
-        
-        if (G_io_ccid.bulk_header.bulkout.dwLength > IO_CCID_DATA_BUFFER_SIZE)
+
+        if (G_io_ccid.bulk_header.bulkout.dwLength > IO_CCID_DATA_BUFFER_SIZE - G_io_ccid.chain_offset)
         { /* Check if length of data to be sent by host is > buffer size */
           
           /* Too long data received.... Error ! */
           G_io_ccid.Ccid_BulkState = CCID_STATE_UNCORRECT_LENGTH;
+          break;
         }
-        else
+
+        // copy remaining part in the data buffer (split from the ccid to allow for overlaying with another ressource buffer)
+        if (dataLen>CCID_HEADER_SIZE) {
+          memmove(G_io_ccid_data_buffer+G_io_ccid.chain_offset, buffer+CCID_HEADER_SIZE, dataLen-CCID_HEADER_SIZE);
+          // we're now receiving in the data buffer (all subsequent calls)
+          G_io_ccid.pUsbMessageBuffer = G_io_ccid_data_buffer+G_io_ccid.chain_offset;
+        }
+        
         // everything received in the first packet
         if (G_io_ccid.UsbMessageLength == (G_io_ccid.bulk_header.bulkout.dwLength + CCID_HEADER_SIZE)) {
           /* Short message, less than the EP Out Size, execute the command,
@@ -259,38 +273,27 @@ void CCID_BulkMessage_Out (USBD_HandleTypeDef  *pdev,
       
       G_io_ccid.UsbMessageLength += dataLen;
       
-      if (dataLen < CCID_BULK_EPOUT_SIZE)
-      {/* Short message, less than the EP Out Size, execute the command,
-          if parameter like dwLength is too big, the appropriate command will 
-          give an error */
-        
-        /* Full command is received, process the Command */
-        memcpy(G_io_ccid.pUsbMessageBuffer, buffer, dataLen); 
-        CCID_CmdDecode(pdev); 
+      if (G_io_ccid.UsbMessageLength > (G_io_ccid.bulk_header.bulkout.dwLength + CCID_HEADER_SIZE))
+      {
+        /* Too long data received.... Error ! (checked before the copy, the
+           data buffer is sized after dwLength) */
+        G_io_ccid.Ccid_BulkState = CCID_STATE_UNCORRECT_LENGTH;
+        break;
       }
-      else //if (dataLen == CCID_BULK_EPOUT_SIZE)
-      {  
-        if (G_io_ccid.UsbMessageLength < (G_io_ccid.bulk_header.bulkout.dwLength + CCID_HEADER_SIZE))
-        {
-          memmove(G_io_ccid.pUsbMessageBuffer, buffer, dataLen); 
-          G_io_ccid.pUsbMessageBuffer += dataLen; 
-          /* Increment the pointer to receive more data */
-          
-          /* Prepare EP to Receive next Cmd */
-          // not timeout compliant // USBD_LL_PrepareReceive(pdev, CCID_BULK_OUT_EP, CCID_BULK_EPOUT_SIZE);
-        }
-        else if (G_io_ccid.UsbMessageLength == (G_io_ccid.bulk_header.bulkout.dwLength + CCID_HEADER_SIZE))
-        { 
-          /* Full command is received, process the Command */
-          memmove(G_io_ccid.pUsbMessageBuffer, buffer, dataLen); 
-          CCID_CmdDecode(pdev);
-        }
-        else
-        {
-          /* Too long data received.... Error ! */
-          G_io_ccid.Ccid_BulkState = CCID_STATE_UNCORRECT_LENGTH;
-        }
+
+      memmove(G_io_ccid.pUsbMessageBuffer, buffer, dataLen); 
+      /* Increment the pointer to receive more data */
+      G_io_ccid.pUsbMessageBuffer += dataLen; 
+
+      if (dataLen < CCID_BULK_EPOUT_SIZE
+          || G_io_ccid.UsbMessageLength == (G_io_ccid.bulk_header.bulkout.dwLength + CCID_HEADER_SIZE))
+      {/* Short message, less than the EP Out Size, or full command received:
+          execute the command, if parameter like dwLength is too big, the
+          appropriate command will give an error */
+        CCID_CmdDecode(pdev); 
       }
+      /* else: prepare EP to Receive next Cmd */
+      // not timeout compliant // USBD_LL_PrepareReceive(pdev, CCID_BULK_OUT_EP, CCID_BULK_EPOUT_SIZE);
       
       break;
     
@@ -535,7 +538,7 @@ uint8_t SC_Secure(uint32_t dwLength, uint8_t bBWI, uint16_t wLevelParameter,
   switch(pbuf[0]) {
     case 0: // verify pin
       ret_len = dwLength - 15;
-      memmove(G_io_apdu_buffer, pbuf+15, dwLength-15);
+      memmove(G_io_ccid_data_buffer, pbuf+15, dwLength-15);
       break;
     case 1: // modify pin
       switch(pbuf[11]) {
@@ -553,7 +556,7 @@ uint8_t SC_Secure(uint32_t dwLength, uint8_t bBWI, uint16_t wLevelParameter,
       }
       ret_len = dwLength-off;
       // provide with the complete apdu
-      memmove(G_io_apdu_buffer, pbuf+off, dwLength-off);
+      memmove(G_io_ccid_data_buffer, pbuf+off, dwLength-off);
       break;
     default: // unsupported
       G_io_ccid.bulk_header.bulkin.dwLength = 0;
@@ -561,7 +564,7 @@ uint8_t SC_Secure(uint32_t dwLength, uint8_t bBWI, uint16_t wLevelParameter,
       CCID_Send_Reply(&USBD_Device);
       return SLOTERROR_CMD_NOT_SUPPORTED;
   }
-  return SC_XferBlock(G_io_apdu_buffer, ret_len, &ret_len);
+  return SC_XferBlock(G_io_ccid_data_buffer, ret_len, &ret_len);
 }
 
 // prepare the apdu to be processed by the application
@@ -569,12 +572,12 @@ uint8_t SC_XferBlock (uint8_t* ptrBlock, uint32_t blockLen, uint16_t* expectedLe
   UNUSED(expectedLen);
 
   // check for overflow
-  if (blockLen > IO_APDU_BUFFER_SIZE) {
+  if (blockLen > IO_CCID_DATA_BUFFER_SIZE) {
     return SLOTERROR_BAD_LENTGH;
   }
   
-  // copy received apdu // if G_io_ccid_data_buffer is the buffer apdu, then the memmove will do nothing
-  memmove(G_io_apdu_buffer, ptrBlock, blockLen);
+  // copy received apdu // if ptrBlock is the data buffer, then the memmove will do nothing
+  memmove(G_io_ccid_data_buffer, ptrBlock, blockLen);
   G_io_app.apdu_length = blockLen;
   G_io_app.apdu_media = IO_APDU_MEDIA_USB_CCID;  // for application code
   G_io_app.apdu_state = APDU_USB_CCID; // for next call to io_exchange
@@ -589,22 +592,64 @@ void io_usb_ccid_reply(unsigned char* buffer, unsigned short length) {
   }
   // copy the responde apdu
   memmove(G_io_ccid_data_buffer, buffer, length);
+  io_usb_ccid_reply_bare(length);
+}
+
+// send the response block at chain_offset in the data buffer, chained with
+// the next ones when the response does not fit in a single message
+static void CCID_Reply_Block(void) {
+  unsigned int first = (G_io_ccid.chain_offset == 0);
+  uint32_t length = MIN(G_io_ccid.chain_remaining, CCID_MAX_BLOCK_SIZE);
+
+  G_io_ccid.chain_block_length = length;
+  G_io_ccid.chain_remaining -= length;
   G_io_ccid.bulk_header.bulkin.dwLength = length;
   // forge reply
   RDR_to_PC_DataBlock(SLOT_NO_ERROR);
-
+  // bChainParameter
+  if (G_io_ccid.chain_remaining) {
+    G_io_ccid.bulk_header.bulkin.bSpecific = first ? 0x01 : 0x03;
+  }
+  else {
+    G_io_ccid.bulk_header.bulkin.bSpecific = first ? 0x00 : 0x02;
+  }
   // start sending rpely
   CCID_Send_Reply(&USBD_Device);
 }
 
 void io_usb_ccid_reply_bare(unsigned short length) {
-  G_io_ccid.bulk_header.bulkin.dwLength = length;
-  // forge reply
+  // the response is sent in place from the start of the data buffer
+  G_io_ccid.chain_offset = 0;
+  G_io_ccid.chain_remaining = length;
+  CCID_Reply_Block();
+}
+
+// a block of a chained command apdu has been received, ask for the next one
+void io_usb_ccid_reply_continue(void) {
+  G_io_ccid.bulk_header.bulkin.dwLength = 0;
   RDR_to_PC_DataBlock(SLOT_NO_ERROR);
-  // start sending rpely
+  G_io_ccid.bulk_header.bulkin.bSpecific = 0x10;
   CCID_Send_Reply(&USBD_Device);
 }
 
+// the host asks for the next block of a chained response
+void io_usb_ccid_reply_next_block(void) {
+  if (G_io_ccid.chain_remaining == 0) {
+    RDR_to_PC_DataBlock(SLOTERROR_BAD_LEVELPARAMETER);
+    CCID_Send_Reply(&USBD_Device);
+    return;
+  }
+  G_io_ccid.chain_offset += G_io_ccid.chain_block_length;
+  CCID_Reply_Block();
+}
+
+// receive commands and send responses straight from the given buffer instead
+// of G_io_apdu_buffer
+void io_usb_ccid_set_buffer(unsigned char *buffer, unsigned short size) {
+  G_io_ccid_app_buffer = buffer;
+  G_io_ccid_app_buffer_size = size;
+}
+
 // ask for power on
 void io_usb_ccid_set_card_inserted(unsigned int inserted) {
   G_io_ccid.ccid_card_inserted = inserted;
@@ -29,7 +29,11 @@
 #define EXTENDED_APDU_EXCHANGE         0x04
 #define CHARACTER_EXCHANGE             0x00
 
-#define EXCHANGE_LEVEL_FEATURE         SHORT_APDU_EXCHANGE
+#define EXCHANGE_LEVEL_FEATURE         EXTENDED_APDU_EXCHANGE
+
+// Largest abData block of a single CCID message (dwMaxCCIDMessageLength
+// minus the header). Longer APDUs are chained over several messages.
+#define CCID_MAX_BLOCK_SIZE            261
   
 #define CCID_INTF 2
 #define CCID_BULK_IN_EP       0x83
@@ -42,8 +46,17 @@
 #define CCID_INTR_EPIN_SIZE   16
 #endif // HAVE_CCID_INTERRUPT
 
-#define IO_CCID_DATA_BUFFER_SIZE IO_APDU_BUFFER_SIZE
-#define G_io_ccid_data_buffer G_io_apdu_buffer
+// The data buffer is the apdu buffer of the application when it provides one
+// (see io_usb_ccid_set_buffer), G_io_apdu_buffer otherwise. Commands are
+// received and responses sent from it in place, without intermediate copy.
+extern unsigned char *G_io_ccid_app_buffer;
+extern unsigned short G_io_ccid_app_buffer_size;
+#define IO_CCID_DATA_BUFFER_SIZE \
+  (G_io_ccid_app_buffer ? G_io_ccid_app_buffer_size : IO_APDU_BUFFER_SIZE)
+#define G_io_ccid_data_buffer \
+  (G_io_ccid_app_buffer ? G_io_ccid_app_buffer : G_io_apdu_buffer)
+
+void io_usb_ccid_set_buffer(unsigned char *buffer, unsigned short size);
 
 #endif // HAVE_USB_CLASS_CCID
 
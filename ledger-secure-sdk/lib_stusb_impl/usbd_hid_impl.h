@@ -51,6 +51,18 @@
 #define WEBUSB_EPOUT_ADDR                0x03
 #define WEBUSB_EPOUT_SIZE                0x40
 
+#ifdef HAVE_WEBUSB_BULK
+// Bulk endpoints may carry several packets per frame when the bus is idle,
+// instead of a single one per polling interval
+#define WEBUSB_EP_TYPE                   USBD_EP_TYPE_BULK
+#define WEBUSB_EP_ATTRIBUTES             0x02
+#define WEBUSB_EP_INTERVAL               0x00
+#else // HAVE_WEBUSB_BULK
+#define WEBUSB_EP_TYPE                   USBD_EP_TYPE_INTR
+#define WEBUSB_EP_ATTRIBUTES             0x03
+#define WEBUSB_EP_INTERVAL               0x01
+#endif // HAVE_WEBUSB_BULK
+
 #ifdef HAVE_USB_CLASS_CCID
 	#error Unsupported CCID+WEBUSB, not enough endpoints
 #endif // HAVE_USB_CLASS_CCID
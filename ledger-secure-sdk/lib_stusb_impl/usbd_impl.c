@@ -124,6 +124,7 @@
 #ifdef HAVE_VID_PID_PROBER
 #define USBD_VID                      0x2581
 #define USBD_PID                      0xf1d1
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   10*2+2,
   USB_DESC_TYPE_STRING,
@@ -138,10 +139,12 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   '-', 0,
   'P', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 #else
 #define USBD_VID                      0x2C97
 #if defined(TARGET_BLUE)
 #define USBD_PID                      0x0000
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   4*2+2,
   USB_DESC_TYPE_STRING,
@@ -150,6 +153,7 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   'u', 0,
   'e', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 
 #elif defined(TARGET_NANOS)
 #ifndef HAVE_LEGACY_PID
@@ -157,6 +161,7 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
 #else // HAVE_LEGACY_PID
 #define USBD_PID                      0x0001
 #endif // HAVE_LEGACY_PID
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   6*2+2,
   USB_DESC_TYPE_STRING,
@@ -167,12 +172,14 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   ' ', 0,
   'S', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 #elif defined(TARGET_HW2)
 #ifndef HAVE_LEGACY_PID
 #define USBD_PID                      0x3000
 #else // HAVE_LEGACY_PID
 #define USBD_PID                      0x0003
 #endif // HAVE_LEGACY_PID
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   3*2+2,
   USB_DESC_TYPE_STRING,
@@ -180,12 +187,14 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   'W', 0,
   '2', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 #elif defined(TARGET_NANOX)
 #ifndef HAVE_LEGACY_PID
 #define USBD_PID                      0x4000
 #else // HAVE_LEGACY_PID
 #define USBD_PID                      0x0004
 #endif // HAVE_LEGACY_PID
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   6*2+2,
   USB_DESC_TYPE_STRING,
@@ -196,12 +205,14 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   ' ', 0,
   'X', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 #elif defined(TARGET_NANOS2)
 #ifndef HAVE_LEGACY_PID
 #define USBD_PID                      0x5000
 #else // HAVE_LEGACY_PID
 #define USBD_PID                      0x0005
 #endif // HAVE_LEGACY_PID
+#ifndef HAVE_USBD_PRODUCT_H
 static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   11*2+2,
   USB_DESC_TYPE_STRING,
@@ -217,11 +228,17 @@ static uint8_t const USBD_PRODUCT_FS_STRING[] = {
   'u', 0,
   's', 0,
 };
+#endif // HAVE_USBD_PRODUCT_H
 #else
 #error unknown TARGET_ID
 #endif
 #endif
 
+#ifdef HAVE_USBD_PRODUCT_H
+// Product string descriptor generated at build time, in Flash as is
+#include "usbd_product.h"
+#endif // HAVE_USBD_PRODUCT_H
+
 /* USB Standard Device Descriptor */
 static uint8_t const USBD_LangIDDesc[]= 
 {
@@ -560,7 +577,7 @@ static __ALIGN_BEGIN uint8_t const USBD_CfgDesc[] __ALIGN_END =
   0x00,0x00,0x00,0x00,   /* dwSynchProtocols  */
   0x00,0x00,0x00,0x00,   /* dwMechanical: no special characteristics */
   
-  0xBA, 0x06, 0x02, 0x00,
+  0xBA, 0x06, EXCHANGE_LEVEL_FEATURE, 0x00,
   //0x38,0x00,EXCHANGE_LEVEL_FEATURE,0x00,   
                          /* dwFeatures: clk, baud rate, voltage : automatic */
                          /* 00000008h Automatic ICC voltage selection 
@@ -621,18 +638,18 @@ static __ALIGN_BEGIN uint8_t const USBD_CfgDesc[] __ALIGN_END =
   0x07,          /*bLength: Endpoint Descriptor size*/
   USB_DESC_TYPE_ENDPOINT, /*bDescriptorType:*/
   WEBUSB_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
-  0x03,          /*bmAttributes: Interrupt endpoint*/
+  WEBUSB_EP_ATTRIBUTES, /*bmAttributes: Interrupt or bulk endpoint*/
   WEBUSB_EPIN_SIZE, /*wMaxPacketSize: */
   0x00,
-  0x01,          /*bInterval: Polling Interval */
+  WEBUSB_EP_INTERVAL, /*bInterval: Polling Interval */
 
   0x07,          /* bLength: Endpoint Descriptor size */
   USB_DESC_TYPE_ENDPOINT, /* bDescriptorType: */
   WEBUSB_EPOUT_ADDR,  /*bEndpointAddress: Endpoint Address (OUT)*/
-  0x03, /* bmAttributes: Interrupt endpoint */
+  WEBUSB_EP_ATTRIBUTES, /* bmAttributes: Interrupt or bulk endpoint */
   WEBUSB_EPOUT_SIZE,  /* wMaxPacketSize: */
   0x00,
-  0x01,/* bInterval: Polling Interval */
+  WEBUSB_EP_INTERVAL, /* bInterval: Polling Interval */
 #endif // HAVE_WEBUSB
 } ;
 
@@ -1027,19 +1044,17 @@ uint8_t  USBD_HID_DataOut_impl (USBD_HandleTypeDef *pdev,
     USBD_LL_PrepareReceive(pdev, HID_EPOUT_ADDR , HID_EPOUT_SIZE);
 
 #ifndef HAVE_USB_HIDKBD
-    // avoid troubles when an apdu has not been replied yet
-    if (G_io_app.apdu_media == IO_APDU_MEDIA_NONE) {      
-      // add to the hid transport
-      switch(io_usb_hid_receive(io_usb_send_apdu_data, buffer, io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR), apdu_buf)) {
-        default:
-          break;
-
-        case IO_USB_APDU_RECEIVED:
-          G_io_app.apdu_media = IO_APDU_MEDIA_USB_HID; // for application code
-          G_io_app.apdu_state = APDU_USB_HID; // for next call to io_exchange
-          G_io_app.apdu_length = G_io_usb_hid_total_length;
-          break;
-      }
+    // add to the hid transport, which leaves the apdu buffer alone while
+    // an apdu has not been replied yet, but still answers control commands
+    switch(io_usb_hid_receive(io_usb_send_apdu_data, buffer, io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR), apdu_buf)) {
+      default:
+        break;
+
+      case IO_USB_APDU_RECEIVED:
+        G_io_app.apdu_media = IO_APDU_MEDIA_USB_HID; // for application code
+        G_io_app.apdu_state = APDU_USB_HID; // for next call to io_exchange
+        G_io_app.apdu_length = G_io_usb_hid_total_length;
+        break;
     }
 #endif // HAVE_USB_HIDKBD
     break;
@@ -1058,13 +1073,13 @@ uint8_t  USBD_WEBUSB_Init (USBD_HandleTypeDef *pdev,
   /* Open EP IN */
   USBD_LL_OpenEP(pdev,
                  WEBUSB_EPIN_ADDR,
-                 USBD_EP_TYPE_INTR,
+                 WEBUSB_EP_TYPE,
                  WEBUSB_EPIN_SIZE);
   
   /* Open EP OUT */
   USBD_LL_OpenEP(pdev,
                  WEBUSB_EPOUT_ADDR,
-                 USBD_EP_TYPE_INTR,
+                 WEBUSB_EP_TYPE,
                  WEBUSB_EPOUT_SIZE);
 
         /* Prepare Out endpoint to receive 1st packet */ 
@@ -1102,7 +1117,7 @@ uint8_t  USBD_WEBUSB_DataIn (USBD_HandleTypeDef *pdev,
 }
 
 uint8_t USBD_WEBUSB_DataOut (USBD_HandleTypeDef *pdev, 
-                              uint8_t epnum, uint8_t* buffer)
+                              uint8_t epnum, uint8_t* buffer, apdu_buffer_t * apdu_buf)
 {
   // only the data hid endpoint will receive data
   switch (epnum) {
@@ -1112,19 +1127,16 @@ uint8_t USBD_WEBUSB_DataOut (USBD_HandleTypeDef *pdev,
     // prepare receiving the next chunk (masked time)
     USBD_LL_PrepareReceive(pdev, WEBUSB_EPOUT_ADDR, WEBUSB_EPOUT_SIZE);
 
-    // avoid troubles when an apdu has not been replied yet
-    if (G_io_app.apdu_media == IO_APDU_MEDIA_NONE) {      
-      // add to the hid transport
-      switch(io_usb_hid_receive(io_usb_send_apdu_data_ep0x83, buffer, io_seproxyhal_get_ep_rx_size(WEBUSB_EPOUT_ADDR))) {
-        default:
-          break;
-
-        case IO_USB_APDU_RECEIVED:
-          G_io_app.apdu_media = IO_APDU_MEDIA_USB_WEBUSB; // for application code
-          G_io_app.apdu_state = APDU_USB_WEBUSB; // for next call to io_exchange
-          G_io_app.apdu_length = G_io_usb_hid_total_length;
-          break;
-      }
+    // add to the hid transport, as for the HID endpoint
+    switch(io_usb_hid_receive(io_usb_send_apdu_data_ep0x83, buffer, io_seproxyhal_get_ep_rx_size(WEBUSB_EPOUT_ADDR), apdu_buf)) {
+      default:
+        break;
+
+      case IO_USB_APDU_RECEIVED:
+        G_io_app.apdu_media = IO_APDU_MEDIA_USB_WEBUSB; // for application code
+        G_io_app.apdu_state = APDU_USB_WEBUSB; // for next call to io_exchange
+        G_io_app.apdu_length = G_io_usb_hid_total_length;
+        break;
     }
     break;
   }
@@ -344,7 +344,8 @@ static void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
 /**
  * @brief   Compress chunks.
  *
- * @details In contrary to the reference implementation, it compresses one chunk at a time.
+ * @details Up to BLAKE3_BATCH_CHUNKS whole chunks are compressed with a single
+ *          call to blake3_hash_many.
  *
  * @param[in]  input         One or several chunks.
  *
@@ -365,7 +366,7 @@ static size_t blake3_compress_chunks(const uint8_t *input, size_t input_len,
                                      const uint32_t *key, uint64_t chunk_counter,
                                      uint8_t flags, uint8_t *out) {
 
-  const uint8_t        *chunks_array[1];
+  const uint8_t        *chunks_array[BLAKE3_BATCH_CHUNKS];
   size_t                input_position   = 0;
   size_t                chunks_array_len = 0;
   cx_blake3_state_out_t output;
@@ -417,7 +418,7 @@ static size_t blake3_compress_parents(const uint8_t *child_chaining_values,
                                       const uint32_t *key, uint8_t flags,
                                       uint8_t *out) {
 
-  const uint8_t *parents_array[2];
+  const uint8_t *parents_array[BLAKE3_BATCH_CHUNKS_OR_2];
   size_t         parents_array_len = 0;
 
   while (num_chaining_values - (2 * parents_array_len) >= 2) {
@@ -465,8 +466,8 @@ static size_t blake3_compress_subtree(const uint8_t *input, size_t input_len,
                                       const uint32_t *key, uint64_t chunk_counter,
                                       uint8_t flags, uint8_t *out) {
 
-  // One chunk
-  if (input_len <= BLAKE3_CHUNK_LEN) {
+  // At most one batch of chunks
+  if (input_len <= BLAKE3_BATCH_CHUNKS * BLAKE3_CHUNK_LEN) {
     return blake3_compress_chunks(input, input_len, key, chunk_counter, flags, out);
   }
 
@@ -479,12 +480,13 @@ static size_t blake3_compress_subtree(const uint8_t *input, size_t input_len,
   const uint8_t *right_input   = &input[left_input_len];
   uint64_t right_chunk_counter = chunk_counter + (uint64_t)(left_input_len / BLAKE3_CHUNK_LEN);
 
-  uint8_t  cv_array[2 * 2 * BLAKE3_OUT_LEN];
-  size_t   degree = 1;
+  uint8_t  cv_array[2 * BLAKE3_BATCH_CHUNKS_OR_2 * BLAKE3_OUT_LEN];
+  size_t   degree = BLAKE3_BATCH_CHUNKS;
   uint8_t *right_cvs;
   size_t   left_n, right_n;
 
-  if (left_input_len > BLAKE3_CHUNK_LEN) {
+  // The left subtree outputs `degree` chaining values
+  if ((left_input_len > BLAKE3_CHUNK_LEN) && (1 == degree)) {
     degree = 2;
   }
   right_cvs = &cv_array[degree * BLAKE3_OUT_LEN];
@@ -494,6 +496,8 @@ static size_t blake3_compress_subtree(const uint8_t *input, size_t input_len,
   right_n   = blake3_compress_subtree(right_input, right_input_len, key,
                                       right_chunk_counter, flags, right_cvs);
 
+  // With batches of one chunk, always return at least two outputs
+  // rather than compressing them into a single one.
   if (1 == left_n) {
     memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
     return 2;
@@ -507,11 +511,11 @@ static size_t blake3_compress_subtree(const uint8_t *input, size_t input_len,
 void blake3_compress_subtree_to_parent(const uint8_t *input, size_t input_len, const uint32_t *key,
                                        uint64_t chunk_counter, uint8_t flags, uint8_t *out) {
 
-  uint8_t cv_array[2 * BLAKE3_OUT_LEN];
+  uint8_t cv_array[BLAKE3_BATCH_CHUNKS_OR_2 * BLAKE3_OUT_LEN];
   size_t  num_cvs = blake3_compress_subtree(input, input_len, key,
                                            chunk_counter, flags, cv_array);
 
-  uint8_t out_array[BLAKE3_OUT_LEN];
+  uint8_t out_array[BLAKE3_BATCH_CHUNKS_OR_2 * BLAKE3_OUT_LEN / 2];
   while (num_cvs > 2) {
     num_cvs = blake3_compress_parents(cv_array, num_cvs, key, flags, out_array);
     memcpy(cv_array, out_array, num_cvs * BLAKE3_OUT_LEN);
@@ -10,6 +10,19 @@
 
 #define INLINE static inline __attribute__((always_inline))
 
+// Number of whole chunks hashed by a single call to blake3_hash_many at the
+// leaves of a subtree. Must be a power of two. Larger batches mean fewer
+// recursion levels and parent merges for long inputs, at the cost of
+// 2 * BLAKE3_OUT_LEN bytes of stack per chunk and per recursion level.
+#ifndef BLAKE3_BATCH_CHUNKS
+#define BLAKE3_BATCH_CHUNKS         4
+#endif
+#if BLAKE3_BATCH_CHUNKS > 2
+#define BLAKE3_BATCH_CHUNKS_OR_2    BLAKE3_BATCH_CHUNKS
+#else
+#define BLAKE3_BATCH_CHUNKS_OR_2    2
+#endif
+
 INLINE uint32_t load32(const void *src) {
 #if defined(NATIVE_LITTLE_ENDIAN)
   uint32_t w;
@@ -59,58 +59,38 @@ static ledger_protocol_t *ledger_protocol;
 /* Private functions ---------------------------------------------------------*/
 static void process_apdu_chunk(uint8_t* buffer, uint16_t length)
 {
-	// Check the sequence number
-	if (   (length < 2)
-	    || ((uint16_t)U2BE(buffer, 0) != ledger_protocol->rx_apdu_sequence_number)
-	   ) {
-		ledger_protocol->rx_apdu_status = APDU_STATUS_WAITING;
-		return;
-	}
-	// Check total length presence
-	if (   (length < 4)
-	    && (ledger_protocol->rx_apdu_sequence_number == 0)
-	   ) {
-		ledger_protocol->rx_apdu_status = APDU_STATUS_WAITING;
-		return;
-	}
-
-	if (ledger_protocol->rx_apdu_sequence_number == 0) {
-		// First chunk
+	ledger_framing_t *framing = &ledger_protocol->framing;
+	// Offset of the data of this chunk in the apdu, a first chunk starting
+	// the reception over
+	uint16_t offset = (length >= 5 && U2BE(buffer, 3)) ? framing->rx_offset : 0;
+
+	switch (ledger_framing_receive(framing,
+	                               buffer, length,
+	                               ledger_protocol->rx_apdu_buffer,
+	                               ledger_protocol->rx_apdu_buffer_max_length)) {
+	case LEDGER_FRAMING_MORE_DATA:
 		ledger_protocol->rx_apdu_status = APDU_STATUS_NEED_MORE_DATA;
-		ledger_protocol->rx_apdu_length = (uint16_t)U2BE(buffer, 2);
-		// Check if we have enough space to store the apdu
-		if (ledger_protocol->rx_apdu_length > ledger_protocol->rx_apdu_buffer_max_length) {
-			LOG_BLE_PROTOCOL("APDU WAITING - %d\n", ledger_protocol->rx_apdu_length);
-			ledger_protocol->rx_apdu_status = APDU_STATUS_WAITING;
-			return;
-		}
-		ledger_protocol->rx_apdu_offset = 0;
-		buffer = &buffer[4];
-		length -= 4;
-	}
-	else {
-		// Next chunk
-		buffer = &buffer[2];
-		length -= 2;
-	}
-
-	if ((ledger_protocol->rx_apdu_offset+length) > ledger_protocol->rx_apdu_length) {
-		length = ledger_protocol->rx_apdu_length-ledger_protocol->rx_apdu_offset;
-	}
-
-	memcpy(&ledger_protocol->rx_apdu_buffer[ledger_protocol->rx_apdu_offset],
-	       buffer, length);
-	ledger_protocol->rx_apdu_offset += length;
+		LOG_BLE_PROTOCOL("APDU NEED MORE DATA\n");
+		break;
 
-	if (ledger_protocol->rx_apdu_offset == ledger_protocol->rx_apdu_length) {
-		ledger_protocol->rx_apdu_sequence_number = 0;
+	case LEDGER_FRAMING_RECEIVED:
 		ledger_protocol->rx_apdu_status = APDU_STATUS_COMPLETE;
 		LOG_BLE_PROTOCOL("APDU COMPLETE\n");
+		break;
+
+	default:
+		LOG_BLE_PROTOCOL("APDU WAITING - %d\n", framing->rx_length);
+		ledger_protocol->rx_apdu_status = APDU_STATUS_WAITING;
+		return;
 	}
-	else {
-		ledger_protocol->rx_apdu_sequence_number++;
-		ledger_protocol->rx_apdu_status = APDU_STATUS_NEED_MORE_DATA;
-		LOG_BLE_PROTOCOL("APDU NEED MORE DATA\n");
+
+	ledger_protocol->rx_apdu_length = framing->rx_length;
+	if (ledger_protocol->rx_sink) {
+		ledger_protocol->rx_sink(ledger_protocol->rx_sink_context,
+		                         offset,
+		                         framing->rx_length,
+		                         &ledger_protocol->rx_apdu_buffer[offset],
+		                         framing->rx_offset - offset);
 	}
 }
 
@@ -118,8 +98,8 @@ static void process_apdu_chunk(uint8_t* buffer, uint16_t length)
 void LEDGER_PROTOCOL_init(ledger_protocol_t *data)
 {
 	ledger_protocol = data;
-	ledger_protocol->rx_apdu_status          = APDU_STATUS_WAITING;
-	ledger_protocol->rx_apdu_sequence_number = 0;
+	ledger_protocol->rx_apdu_status = APDU_STATUS_WAITING;
+	memset(&ledger_protocol->framing, 0, sizeof(ledger_protocol->framing));
 }
 
 void LEDGER_PROTOCOL_rx(uint8_t  *buffer,
@@ -162,7 +142,7 @@ void LEDGER_PROTOCOL_rx(uint8_t  *buffer,
 
 	case TAG_APDU:
 		LOG_BLE_PROTOCOL("TAG_APDU\n");
-		process_apdu_chunk(&buffer[3], length-3);
+		process_apdu_chunk(buffer, length);
 		break;
 
 	case TAG_MTU:
@@ -190,49 +170,22 @@ void LEDGER_PROTOCOL_tx(uint8_t  *buffer,
 	}
 	if (buffer) {
 		LOG_BLE_PROTOCOL("FIRST CHUNK");
-		ledger_protocol->tx_apdu_buffer          = buffer;
-		ledger_protocol->tx_apdu_length          = length;
-		ledger_protocol->tx_apdu_sequence_number = 0;
-		ledger_protocol->tx_apdu_offset          = 0;
+		ledger_protocol->tx_apdu_buffer = buffer;
+		ledger_protocol->tx_apdu_length = length;
+		ledger_framing_send(&ledger_protocol->framing, length);
 		memset(ledger_protocol->tx_chunk, 0, sizeof(ledger_protocol->tx_chunk));
 	}
 	else {
 		LOG_BLE_PROTOCOL("NEXT CHUNK");
 	}
 
-	uint16_t tx_chunk_offset = 2; // Because channel id has been already filled beforehand
-
-	ledger_protocol->tx_chunk[tx_chunk_offset++] = TAG_APDU;
-
-	U2BE_ENCODE(ledger_protocol->tx_chunk,
-	            tx_chunk_offset,
-	            ledger_protocol->tx_apdu_sequence_number);
-	tx_chunk_offset += 2;
-
-	if (ledger_protocol->tx_apdu_sequence_number == 0) {
-		U2BE_ENCODE(ledger_protocol->tx_chunk,
-		            tx_chunk_offset,
-		            ledger_protocol->tx_apdu_length);
-		tx_chunk_offset += 2;
-	}
-	if ((ledger_protocol->tx_apdu_length+tx_chunk_offset) >= (ledger_protocol->mtu+ledger_protocol->tx_apdu_offset)) {
-		// Remaining buffer length doesn't fit the chunk
-		memcpy(&ledger_protocol->tx_chunk[tx_chunk_offset],
-		       &ledger_protocol->tx_apdu_buffer[ledger_protocol->tx_apdu_offset],
-		       ledger_protocol->mtu-tx_chunk_offset);
-		ledger_protocol->tx_apdu_offset += ledger_protocol->mtu-tx_chunk_offset;
-		ledger_protocol->tx_apdu_sequence_number++;
-		tx_chunk_offset = ledger_protocol->mtu;
-	}
-	else {
-		// Remaining buffer fits the chunk TODO pad for usb
-		memcpy(&ledger_protocol->tx_chunk[tx_chunk_offset],
-		       &ledger_protocol->tx_apdu_buffer[ledger_protocol->tx_apdu_offset],
-		       ledger_protocol->tx_apdu_length-ledger_protocol->tx_apdu_offset);
-		tx_chunk_offset += (ledger_protocol->tx_apdu_length-ledger_protocol->tx_apdu_offset);
-		ledger_protocol->tx_apdu_offset = ledger_protocol->tx_apdu_length;
+	// The channel identifier of the command is kept for the response
+	ledger_protocol->tx_chunk_length = ledger_framing_next_frame(&ledger_protocol->framing,
+	                                                             ledger_protocol->tx_apdu_buffer,
+	                                                             ledger_protocol->tx_chunk,
+	                                                             ledger_protocol->mtu);
+	if (!ledger_framing_tx_pending(&ledger_protocol->framing)) {
 		ledger_protocol->tx_apdu_buffer = NULL;
 	}
-	ledger_protocol->tx_chunk_length = tx_chunk_offset;
 	LOG_BLE_PROTOCOL(" %d\n", ledger_protocol->tx_chunk_length);
 }
\ No newline at end of file
@@ -21,7 +21,13 @@
 /* Includes ------------------------------------------------------------------*/
 #include <stdint.h>
 
+#include "os_io_framing.h"
+
 /* Exported enumerations -----------------------------------------------------*/
+
+// Largest chunk payload: ATT MTU of 247 (a 251-byte link-layer PDU minus the
+// L2CAP header) minus the 3-byte ATT header of a notification
+#define LEDGER_PROTOCOL_MAX_MTU 244
 enum {
   APDU_STATUS_WAITING,
   APDU_STATUS_NEED_MORE_DATA,
@@ -29,21 +35,29 @@ enum {
 };
 
 /* Exported types, structures, unions ----------------------------------------*/
+// Called with each chunk of a command APDU once it has been copied at offset
+// in rx_apdu_buffer, so the APDU can be consumed before its last chunk lands
+typedef void (*ledger_protocol_rx_sink_t)(void *context,
+                                          uint16_t offset,
+                                          uint16_t total_length,
+                                          const uint8_t *data,
+                                          uint16_t length);
+
 typedef struct ledger_protocol_s {
+  ledger_framing_t framing;
+
   uint8_t *tx_apdu_buffer;
   uint16_t tx_apdu_length;
-  uint16_t tx_apdu_sequence_number;
-  uint16_t tx_apdu_offset;
 
-  uint8_t tx_chunk[156 + 2];
+  uint8_t tx_chunk[LEDGER_PROTOCOL_MAX_MTU + 2];
   uint8_t tx_chunk_length;
 
   uint8_t *rx_apdu_buffer;
   uint16_t rx_apdu_buffer_max_length;
   uint8_t rx_apdu_status;
-  uint16_t rx_apdu_sequence_number;
   uint16_t rx_apdu_length;
-  uint16_t rx_apdu_offset;
+  ledger_protocol_rx_sink_t rx_sink;
+  void *rx_sink_context;
 
   uint16_t mtu;
   uint8_t mtu_negotiated;
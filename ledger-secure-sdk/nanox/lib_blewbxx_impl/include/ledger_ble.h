@@ -39,6 +39,10 @@ void LEDGER_BLE_send(uint8_t* packet, uint16_t packet_length);
 void LEDGER_BLE_receive(uint8_t * spi_buffer);
 void LEDGER_BLE_enable_advertising(uint8_t enable);
 void LEDGER_BLE_reset_pairings(void);
+// Ask the master for new connection parameters: intervals in 1.25 ms units,
+// latency in connection events and supervision timeout in 10 ms units
+void LEDGER_BLE_set_connection_params(uint16_t interval_min, uint16_t interval_max,
+                                      uint16_t latency, uint16_t timeout);
 
 #define LEDGER_BLE_get_mac_address(address) { \
 	unsigned char se_serial[8] = {0}; \
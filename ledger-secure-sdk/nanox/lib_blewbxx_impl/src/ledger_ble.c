@@ -26,6 +26,7 @@
 #include "ble_hal_aci.h"
 #include "ble_gap_aci.h"
 #include "ble_gatt_aci.h"
+#include "ble_l2cap_aci.h"
 #include "ble_legacy.h"
 
 #include "lcx_rng.h"
@@ -56,7 +57,12 @@ typedef enum {
 	BLE_INIT_STEP_ADD_NOTIFICATION_CHARACTERISTIC,
 	BLE_INIT_STEP_ADD_WRITE_CHARACTERISTIC,
 	BLE_INIT_STEP_ADD_WRITE_COMMAND_CHARACTERISTIC,
+	BLE_INIT_STEP_SET_DATA_LENGTH,
+	BLE_INIT_STEP_SET_DEFAULT_PHY,
 	BLE_INIT_STEP_SET_TX_POWER_LEVEL,
+	BLE_INIT_STEP_SET_GATT_EVENT_MASK,
+	BLE_INIT_STEP_SET_GAP_EVENT_MASK,
+	BLE_INIT_STEP_SET_LE_EVENT_MASK,
 	BLE_INIT_STEP_CONFIGURE_ADVERTISING,
 	BLE_INIT_STEP_END,
 } ble_init_step_t;
@@ -103,6 +109,9 @@ typedef struct {
 	// Advertising configuration
 	ble_config_adv_step_t adv_step;
 	uint8_t               adv_enable;
+	// Directed advertising to the last peer wanted, and set in the controller
+	uint8_t               directed_advertising;
+	uint8_t               adv_params_directed;
 
 	// HCI
 	uint16_t hci_cmd_opcode;
@@ -129,6 +138,7 @@ typedef struct {
 
 	// APDU
 	uint8_t  wait_write_resp_ack;
+	uint8_t  wait_tx_pool;
 
 	// TRANSFER MODE
 	uint8_t  transfer_mode_enable;
@@ -138,7 +148,12 @@ typedef struct {
 } ledger_ble_data_t;
 
 /* Private defines------------------------------------------------------------*/
-#define MAX_MTU_SIZE 156
+#define MAX_MTU_SIZE LEDGER_PROTOCOL_MAX_MTU
+
+// Data Length Extension: largest link-layer payload, and the time it takes
+// on the 1M PHY
+#define BLE_MAX_TX_OCTETS 251
+#define BLE_MAX_TX_TIME   2120 // us
 
 #define BLE_SLAVE_CONN_INTERVAL_MIN 12  // 15ms
 #define BLE_SLAVE_CONN_INTERVAL_MAX 24  // 30ms
@@ -146,6 +161,18 @@ typedef struct {
 #define BLE_ADVERTISING_INTERVAL_MIN 48 // 30ms
 #define BLE_ADVERTISING_INTERVAL_MAX 96 // 60ms
 
+// Events forwarded by the controller, all of them being by default: only
+// those handled below, so that the others cost no SPI transfer or SE wakeup.
+// ATTRIBUTE_MODIFIED, PROC_TIMEOUT, EXCHANGE_MTU_RESP, INDICATION,
+// PROC_COMPLETE and TX_POOL_AVAILABLE
+#define BLE_GATT_EVENT_MASK 0x00052007
+// PAIRING_COMPLETE, PASS_KEY_REQ, AUTHORIZATION_REQ and BOND_LOST, kept for
+// the pairing done by the OS, and L2CAP_CONNECTION_UPDATE_RESP
+#define BLE_GAP_EVENT_MASK 0x022E
+// CONNECTION_COMPLETE, CONNECTION_UPDATE_COMPLETE, DATA_LENGTH_CHANGE and
+// PHY_UPDATE_COMPLETE
+#define BLE_LE_EVENT_MASK 0x0845
+
 #ifdef HAVE_PRINTF
 #define LOG_BLE PRINTF
 #else // !HAVE_PRINTF
@@ -268,17 +295,30 @@ static void configure_advertising_mngr(uint16_t opcode)
 		                           (uint8_t*)ledger_ble_data.device_name);
 		break;
 
-	case BLE_CONFIG_ADV_STEP_SET_ADV_PARAMETERS: {
-		ledger_ble_data.hci_cmd_opcode = 0x2006;
-		uint8_t fake_direct_advertising_peer_addr[6];
-		hci_le_set_advertising_parameters(BLE_ADVERTISING_INTERVAL_MIN,
-		                                  BLE_ADVERTISING_INTERVAL_MAX,
-		                                  ADV_IND,
-		                                  RANDOM_ADDR,
-		                                  PUBLIC_ADDR,
-		                                  fake_direct_advertising_peer_addr,
-		                                  ADV_CH_37 | ADV_CH_38 | ADV_CH_39,
-		                                  NO_WHITE_LIST_USE);
+	case BLE_CONFIG_ADV_STEP_SET_ADV_PARAMETERS:
+		ledger_ble_data.hci_cmd_opcode      = 0x2006;
+		ledger_ble_data.adv_params_directed = ledger_ble_data.directed_advertising;
+		if (ledger_ble_data.directed_advertising) {
+			// High duty cycle, for 1.28 s at most: the intervals are ignored
+			hci_le_set_advertising_parameters(BLE_ADVERTISING_INTERVAL_MIN,
+			                                  BLE_ADVERTISING_INTERVAL_MAX,
+			                                  HIGH_DUTY_CYCLE_DIRECTED_ADV,
+			                                  RANDOM_ADDR,
+			                                  ledger_ble_data.connection.peer_address_random,
+			                                  ledger_ble_data.connection.peer_address,
+			                                  ADV_CH_37 | ADV_CH_38 | ADV_CH_39,
+			                                  NO_WHITE_LIST_USE);
+		}
+		else {
+			uint8_t fake_direct_advertising_peer_addr[6];
+			hci_le_set_advertising_parameters(BLE_ADVERTISING_INTERVAL_MIN,
+			                                  BLE_ADVERTISING_INTERVAL_MAX,
+			                                  ADV_IND,
+			                                  RANDOM_ADDR,
+			                                  PUBLIC_ADDR,
+			                                  fake_direct_advertising_peer_addr,
+			                                  ADV_CH_37 | ADV_CH_38 | ADV_CH_39,
+			                                  NO_WHITE_LIST_USE);
 		}
 		break;
 
@@ -443,12 +483,42 @@ static void init_mngr(uint16_t opcode, uint8_t *buffer, uint16_t length)
 		                  &ledger_ble_data.ledger_gatt_write_cmd_characteristic_handle);
 		break;
 
+	case BLE_INIT_STEP_SET_DATA_LENGTH:
+		ledger_ble_data.hci_cmd_opcode = 0x2024;
+		hci_le_write_suggested_default_data_length(BLE_MAX_TX_OCTETS,
+		                                           BLE_MAX_TX_TIME);
+		break;
+
+	case BLE_INIT_STEP_SET_DEFAULT_PHY:
+		ledger_ble_data.hci_cmd_opcode = 0x2031;
+		hci_le_set_default_phy(0x00, // TX and RX preferences below
+		                       HCI_TX_PHYS_LE_2M_PREF,
+		                       HCI_RX_PHYS_LE_2M_PREF);
+		break;
+
 	case BLE_INIT_STEP_SET_TX_POWER_LEVEL:
 		ledger_ble_data.hci_cmd_opcode = 0xfc0f;
 		aci_hal_set_tx_power_level(1,  // High power
 		                           7); // -14.1 dBm
 		break;
 
+	case BLE_INIT_STEP_SET_GATT_EVENT_MASK:
+		ledger_ble_data.hci_cmd_opcode = 0xfd0a;
+		aci_gatt_set_event_mask(BLE_GATT_EVENT_MASK);
+		break;
+
+	case BLE_INIT_STEP_SET_GAP_EVENT_MASK:
+		ledger_ble_data.hci_cmd_opcode = 0xfc91;
+		aci_gap_set_event_mask(BLE_GAP_EVENT_MASK);
+		break;
+
+	case BLE_INIT_STEP_SET_LE_EVENT_MASK: {
+		uint8_t le_event_mask[8] = {BLE_LE_EVENT_MASK & 0xff, BLE_LE_EVENT_MASK >> 8};
+		ledger_ble_data.hci_cmd_opcode = 0x2001;
+		hci_le_set_event_mask(le_event_mask);
+		break;
+	}
+
 	case BLE_INIT_STEP_CONFIGURE_ADVERTISING:
 		ledger_ble_data.hci_cmd_opcode = 0xFFFF;
 		ledger_ble_data.adv_step       = BLE_CONFIG_ADV_STEP_IDLE;
@@ -497,6 +567,16 @@ static void hci_evt_cmd_complete(uint8_t *buffer, uint16_t length)
 	}
 	else if (opcode == 0xfd06) {
 		// ACI_GATT_UPDATE_CHAR_VALUE
+		// The notification is queued in the controller as soon as this command
+		// completes, so the next chunk is sent right away and several chunks can
+		// go out in the same connection event. When the controller TX pool is
+		// full, the chunk is kept and sent again on ACI_GATT_TX_POOL_AVAILABLE.
+		if (  (length >= 4)
+		    &&(buffer[3] == BLE_STATUS_INSUFFICIENT_RESOURCES)
+		   ) {
+			ledger_ble_data.wait_tx_pool = 1;
+			return;
+		}
 		ledger_protocol_data.tx_chunk_length = 0;
 		if (ledger_ble_data.transfer_mode_enable) {
 			G_io_app.apdu_length = ledger_protocol_data.rx_apdu_length;
@@ -537,6 +617,15 @@ static void hci_evt_cmd_complete(uint8_t *buffer, uint16_t length)
 		G_io_app.disabling_advertising = 0;
 		G_io_app.enabling_advertising  = 0;
 	}
+	else if (opcode == 0x2022) {
+		// HCI_LE_SET_DATA_LENGTH, then ask for the 2M PHY on the new connection
+		LOG_BLE("HCI_LE_SET_DATA_LENGTH\n");
+		hci_le_set_phy(ledger_ble_data.connection.connection_handle,
+		               0x00,
+		               HCI_TX_PHYS_LE_2M_PREF,
+		               HCI_RX_PHYS_LE_2M_PREF,
+		               0);
+	}
 	else if (opcode == 0xfca5) {
 		LOG_BLE("ACI_GAP_NUMERIC_COMPARISON_VALUE_CONFIRM_YESNO\n");
 	}
@@ -560,6 +649,19 @@ static void hci_evt_le_meta_evt(uint8_t *buffer, uint16_t length)
 	switch (buffer[0]) {
 
 	case HCI_LE_CONNECTION_COMPLETE_SUBEVT_CODE:
+		if (buffer[1] == HCI_ADVERTISING_TIMEOUT_ERR_CODE) {
+			// The last peer did not reconnect, advertise to all again
+			LOG_BLE("LE DIRECTED ADVERTISING TIMEOUT\n");
+			ledger_ble_data.directed_advertising = 0;
+			ledger_ble_data.advertising_enabled  = 0;
+			start_advertising();
+			break;
+		}
+		if (buffer[1] != HCI_SUCCESS_ERR_CODE) {
+			LOG_BLE("LE CONNECTION FAILED %02X\n", buffer[1]);
+			break;
+		}
+		ledger_ble_data.directed_advertising             = 0;
 		ledger_ble_data.connection.connection_handle     = U2LE(buffer, 2);
 		ledger_ble_data.connection.role_slave            = buffer[4];
 		ledger_ble_data.connection.peer_address_random   = buffer[5];
@@ -578,7 +680,13 @@ static void hci_evt_le_meta_evt(uint8_t *buffer, uint16_t length)
 		ledger_ble_data.mtu                   = ATT_MTU;
 		ledger_ble_data.notifications_enabled = 0;
 		ledger_ble_data.advertising_enabled   = 0;
+		ledger_ble_data.wait_tx_pool          = 0;
 		ledger_protocol_data.mtu_negotiated   = 0;
+		// Larger link-layer PDUs for this connection, the 2M PHY is
+		// requested once this command completes
+		hci_le_set_data_length(ledger_ble_data.connection.connection_handle,
+		                       BLE_MAX_TX_OCTETS,
+		                       BLE_MAX_TX_TIME);
 		break;
 
 	case HCI_LE_CONNECTION_UPDATE_COMPLETE_SUBEVT_CODE:
@@ -671,7 +779,7 @@ static void hci_evt_vendor(uint8_t *buffer, uint16_t length)
 		break;
 
 	case ACI_ATT_EXCHANGE_MTU_RESP_VSEVT_CODE:
-		ledger_ble_data.mtu                 = U2LE(buffer, 4)-3;
+		ledger_ble_data.mtu                 = MIN(U2LE(buffer, 4)-3, MAX_MTU_SIZE);
 		ledger_protocol_data.mtu            = ledger_ble_data.mtu;
 		ledger_protocol_data.mtu_negotiated = 1;
 		LOG_BLE("MTU : %d\n", ledger_ble_data.mtu);
@@ -686,6 +794,17 @@ static void hci_evt_vendor(uint8_t *buffer, uint16_t length)
 		aci_gatt_confirm_indication(ledger_ble_data.connection.connection_handle);
 		break;
 
+	case ACI_GATT_TX_POOL_AVAILABLE_VSEVT_CODE:
+		if (ledger_ble_data.wait_tx_pool) {
+			ledger_ble_data.wait_tx_pool = 0;
+			notify_chunk();
+		}
+		break;
+
+	case ACI_L2CAP_CONNECTION_UPDATE_RESP_VSEVT_CODE:
+		LOG_BLE("L2CAP CONNECTION UPDATE RESP\n");
+		break;
+
 	case ACI_GATT_PROC_COMPLETE_VSEVT_CODE:
 		LOG_BLE("PROCEDURE COMPLETE\n");
 		break;
@@ -797,6 +916,9 @@ static void attribute_modified(uint8_t *buffer, uint16_t length)
 	         &&(ledger_ble_data.connection.encrypted)
 	         &&(att_data_length)
 	   ) {
+		// Write command: no ATT response to wait for, so hosts can send the
+		// chunks of an APDU back to back. A chunk out of sequence drops the
+		// APDU, which the host then sends again from its first chunk.
 		LOG_BLE("WRITE CMD %d\n", length-4);
 		buffer[4] = 0xDE;
 		buffer[5] = 0xF1;
@@ -890,6 +1012,11 @@ static void start_advertising(void)
 		ledger_ble_data.state    = BLE_STATE_CONFIGURE_ADVERTISING;
 		ledger_ble_data.adv_step = BLE_CONFIG_ADV_STEP_IDLE;
 	}
+	else if (ledger_ble_data.directed_advertising != ledger_ble_data.adv_params_directed) {
+		// The advertising data is kept, only the parameters change
+		ledger_ble_data.state    = BLE_STATE_CONFIGURE_ADVERTISING;
+		ledger_ble_data.adv_step = BLE_CONFIG_ADV_STEP_SET_ADV_PARAMETERS-1;
+	}
 	else {
 		ledger_ble_data.state    = BLE_STATE_CONFIGURE_ADVERTISING;
 		ledger_ble_data.adv_step = BLE_CONFIG_ADV_STEP_START-1;
@@ -945,9 +1072,14 @@ void LEDGER_BLE_init(void)
 	ledger_ble_data.state          = BLE_STATE_INITIALIZING;
 	ledger_ble_data.init_step      = BLE_INIT_STEP_IDLE;
 
+	// The sink outlives a restart of the BLE stack
+	ledger_protocol_rx_sink_t rx_sink = ledger_protocol_data.rx_sink;
+	void *rx_sink_context             = ledger_protocol_data.rx_sink_context;
 	memset(&ledger_protocol_data, 0, sizeof(ledger_protocol_data));
 	ledger_protocol_data.rx_apdu_buffer            = NULL;
 	ledger_protocol_data.rx_apdu_buffer_max_length = 0;
+	ledger_protocol_data.rx_sink                   = rx_sink;
+	ledger_protocol_data.rx_sink_context           = rx_sink_context;
 	LEDGER_PROTOCOL_init(&ledger_protocol_data);
 
 	init_mngr(0, NULL, 0);
@@ -958,6 +1090,11 @@ void LEDGER_BLE_set_recv_buffer(uint8_t * buffer, uint16_t buffer_length) {
 	ledger_protocol_data.rx_apdu_buffer_max_length = buffer_length;
 }
 
+void LEDGER_BLE_set_recv_sink(ledger_protocol_rx_sink_t sink, void *context) {
+	ledger_protocol_data.rx_sink         = sink;
+	ledger_protocol_data.rx_sink_context = context;
+}
+
 void LEDGER_BLE_send(uint8_t* packet, uint16_t packet_length)
 {
 	if (  (ledger_ble_data.transfer_mode_enable != 0)
@@ -992,6 +1129,9 @@ void LEDGER_BLE_receive(uint8_t * spi_buffer)
 
 		case HCI_DISCONNECTION_COMPLETE_EVT_CODE:
 			LOG_BLE("HCI DISCONNECTION COMPLETE code %02X\n", spi_buffer[9]);
+			// A bonded peer, which the link was encrypted with, is invited to
+			// reconnect first: it does so without scanning for the device
+			ledger_ble_data.directed_advertising         = ledger_ble_data.connection.encrypted;
 			ledger_ble_data.connection.connection_handle = 0xFFFF;
 			ledger_ble_data.advertising_enabled          = 0;
 			ledger_ble_data.connection.encrypted         = 0;
@@ -1059,6 +1199,20 @@ void LEDGER_BLE_enable_advertising(uint8_t enable)
 	}
 }
 
+void LEDGER_BLE_set_connection_params(uint16_t interval_min, uint16_t interval_max,
+                                      uint16_t latency, uint16_t timeout)
+{
+	if (ledger_ble_data.connection.connection_handle != 0xFFFF) {
+		// The new interval is reported by HCI_LE_CONNECTION_UPDATE_COMPLETE
+		// if the master accepts it
+		aci_l2cap_connection_parameter_update_req(ledger_ble_data.connection.connection_handle,
+		                                          interval_min,
+		                                          interval_max,
+		                                          latency,
+		                                          timeout);
+	}
+}
+
 void LEDGER_BLE_reset_pairings(void)
 {
 	if (G_io_app.ble_ready) {
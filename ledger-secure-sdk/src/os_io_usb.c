@@ -17,6 +17,7 @@
 ********************************************************************************/
 
 #include "os_io_usb.h"
+#include "os_io_framing.h"
 #include "os_utils.h"
 #include "lcx_rng.h"
 #include <string.h>
@@ -63,6 +64,13 @@ void io_usb_send_apdu_data(unsigned char* buffer, unsigned short length) {
   io_usb_send_ep(0x82, buffer, length, 20);
 }
 
+#ifdef HAVE_WEBUSB
+void io_usb_send_apdu_data_ep0x83(unsigned char* buffer, unsigned short length) {
+  // wait for 20 events before hanging up and timeout (~2 seconds of timeout)
+  io_usb_send_ep(0x83, buffer, length, 20);
+}
+#endif // HAVE_WEBUSB
+
 /**
  *  Ledger Protocol 
  *  HID Report Content
@@ -94,10 +102,43 @@ void io_usb_send_apdu_data(unsigned char* buffer, unsigned short length) {
  */
 
 volatile unsigned int   G_io_usb_hid_total_length;
-volatile unsigned int   G_io_usb_hid_channel;
-volatile unsigned int   G_io_usb_hid_remaining_length;
-volatile unsigned int   G_io_usb_hid_sequence_number;
-volatile unsigned char* G_io_usb_hid_current_buffer;
+static ledger_framing_t G_io_usb_hid_framing;
+// Response being sent
+static const unsigned char* G_io_usb_hid_tx_buffer;
+
+// Next IN chunk of the response, prepared while the previous one is in flight
+static unsigned char  G_io_usb_hid_staged_chunk[IO_HID_EP_LENGTH];
+static unsigned char  G_io_usb_hid_chunk_staged;
+
+#ifndef IO_USB_HID_CHANNEL_TIMEOUT_MS
+#define IO_USB_HID_CHANNEL_TIMEOUT_MS 2000UL
+#endif // IO_USB_HID_CHANNEL_TIMEOUT_MS
+
+// Time of the last chunk of the APDU being received, after which another
+// channel may take over the reception
+static unsigned int   G_io_usb_hid_rx_ms;
+
+// Reply to a control command received while a response is being sent, sent
+// in between two chunks of the response
+static unsigned char  G_io_usb_hid_control_reply[IO_HID_EP_LENGTH];
+static io_send_t      G_io_usb_hid_control_sndfct;
+
+/**
+ * Reply to a control command, whose request and reply are in
+ * G_io_usb_ep_buffer. The current APDU reception and transmission, if any,
+ * go on.
+ */
+static io_usb_hid_receive_status_t io_usb_hid_control_reply(io_send_t sndfct) {
+  if (G_io_usb_hid_tx_buffer != NULL) {
+    // the endpoint may hold a chunk of the response
+    memmove(G_io_usb_hid_control_reply, G_io_usb_ep_buffer, IO_HID_EP_LENGTH);
+    G_io_usb_hid_control_sndfct = sndfct;
+  }
+  else {
+    sndfct(G_io_usb_ep_buffer, IO_HID_EP_LENGTH);
+  }
+  return IO_USB_APDU_MORE_DATA;
+}
 
 io_usb_hid_receive_status_t io_usb_hid_receive (io_send_t sndfct, unsigned char* buffer, unsigned short l, apdu_buffer_t * apdu_buffer) {
   uint8_t * apdu_buf;
@@ -114,156 +155,127 @@ io_usb_hid_receive_status_t io_usb_hid_receive (io_send_t sndfct, unsigned char*
     apdu_buf_len = apdu_buffer->len;
   }
     
-  // avoid over/under flows
-  if (buffer != G_io_usb_ep_buffer) {
-    memset(G_io_usb_ep_buffer, 0, sizeof(G_io_usb_ep_buffer));
-    memmove(G_io_usb_ep_buffer, buffer, MIN(l, sizeof(G_io_usb_ep_buffer)));
+  // Fast path: a data chunk holding its whole header is parsed in place, so
+  // that its payload is copied only once, straight into the apdu buffer.
+  // Other chunks are copied and zero padded in the endpoint buffer, where
+  // the replies to control commands are built.
+  const unsigned char * chunk = buffer;
+  if (l < 7 || l > sizeof(G_io_usb_ep_buffer) || buffer[2] != 0x05) {
+    // avoid over/under flows
+    if (buffer != G_io_usb_ep_buffer) {
+      memset(G_io_usb_ep_buffer, 0, sizeof(G_io_usb_ep_buffer));
+      memmove(G_io_usb_ep_buffer, buffer, MIN(l, sizeof(G_io_usb_ep_buffer)));
+    }
+    chunk = G_io_usb_ep_buffer;
   }
 
   // process the chunk content
-  switch(G_io_usb_ep_buffer[2]) {
+  switch(chunk[2]) {
   case 0x05:
-    // ensure sequence idx is 0 for the first chunk ! 
-    if ((unsigned int)U2BE(G_io_usb_ep_buffer, 3) != (unsigned int)G_io_usb_hid_sequence_number) {
-      // ignore packet
-      goto apdu_reset;
+    // an apdu has not been replied yet
+    if (G_io_app.apdu_media != IO_APDU_MEDIA_NONE) {
+      return IO_USB_APDU_MORE_DATA;
     }
-    // cid, tag, seq
-    l -= 2+1+2;
-    
-    // append the received chunk to the current command apdu
-    if (G_io_usb_hid_sequence_number == 0) {
-      /// This is the apdu first chunk
-      // total apdu size to receive
-      G_io_usb_hid_total_length = U2BE(G_io_usb_ep_buffer, 5); //(G_io_usb_ep_buffer[5]<<8)+(G_io_usb_ep_buffer[6]&0xFF);
-      // check for invalid length encoding (more data in chunk that announced in the total apdu)
-      if (G_io_usb_hid_total_length > (uint32_t)apdu_buf_len) {
-        goto apdu_reset;
-      }
-      // seq and total length
-      l -= 2;
-      // compute remaining size to receive
-      G_io_usb_hid_remaining_length = G_io_usb_hid_total_length;
-      G_io_usb_hid_current_buffer = apdu_buf;
-
-      // retain the channel id to use for the reply
-      G_io_usb_hid_channel = U2BE(G_io_usb_ep_buffer, 0);
-
-      if (l > G_io_usb_hid_remaining_length) {
-        l = G_io_usb_hid_remaining_length;
-      }
-
-      if (l > sizeof(G_io_usb_ep_buffer) - 7) {
-        l = sizeof(G_io_usb_ep_buffer) - 7;
+    // while an apdu is being received, chunks of other channels are dropped
+    // (their host retries) unless it has been abandoned
+    if (G_io_usb_hid_framing.rx_sequence != 0
+        && U2BE(chunk, 0) != G_io_usb_hid_framing.channel) {
+      if (G_io_app.ms - G_io_usb_hid_rx_ms < IO_USB_HID_CHANNEL_TIMEOUT_MS) {
+        return IO_USB_APDU_MORE_DATA;
       }
-
-      // copy data
-      memmove((void*)G_io_usb_hid_current_buffer, G_io_usb_ep_buffer+7, l);
+      G_io_usb_hid_framing.rx_sequence = 0;
     }
-    else {
-      // check for invalid length encoding (more data in chunk that announced in the total apdu)
-      if (l > G_io_usb_hid_remaining_length) {
-        l = G_io_usb_hid_remaining_length;
-      }
-
-      if (l > sizeof(G_io_usb_ep_buffer) - 5) {
-        l = sizeof(G_io_usb_ep_buffer) - 5;
-      }
-
-      /// This is a following chunk
-      // append content
-      memmove((void*)G_io_usb_hid_current_buffer, G_io_usb_ep_buffer+5, l);
+    G_io_usb_hid_rx_ms = G_io_app.ms;
+    // the sequence, the announced length and the apdu buffer size are
+    // checked by the framing engine
+    switch (ledger_framing_receive(&G_io_usb_hid_framing, chunk, MIN(l, sizeof(G_io_usb_ep_buffer)), apdu_buf, apdu_buf_len)) {
+    case LEDGER_FRAMING_MORE_DATA:
+      G_io_usb_hid_total_length = G_io_usb_hid_framing.rx_length;
+      return IO_USB_APDU_MORE_DATA;
+
+    case LEDGER_FRAMING_RECEIVED:
+      G_io_usb_hid_total_length = G_io_usb_hid_framing.rx_length;
+      // reset sequence number for next exchange
+      io_usb_hid_init();
+      return IO_USB_APDU_RECEIVED;
+
+    default:
+      // ignore packet
+      goto apdu_reset;
     }
-    // factorize (f)
-    G_io_usb_hid_current_buffer += l;
-    G_io_usb_hid_remaining_length -= l;
-    G_io_usb_hid_sequence_number++;
-    break;
 
   case 0x00: // get version ID
-    // do not reset the current apdu reception if any
     memset(G_io_usb_ep_buffer+3, 0, 4); // PROTOCOL VERSION is 0
-    // send the response
-    sndfct(G_io_usb_ep_buffer, IO_HID_EP_LENGTH);
-    // await for the next chunk
-    goto apdu_reset;
+    return io_usb_hid_control_reply(sndfct);
 
   case 0x01: // ALLOCATE CHANNEL
-    // do not reset the current apdu reception if any
     cx_rng_no_throw(G_io_usb_ep_buffer+3, 4);
-    // send the response
-    sndfct(G_io_usb_ep_buffer, IO_HID_EP_LENGTH);
-    // await for the next chunk
-    goto apdu_reset;
+    return io_usb_hid_control_reply(sndfct);
 
   case 0x02: // ECHO|PING
-    // do not reset the current apdu reception if any
-    // send the response
-    sndfct(G_io_usb_ep_buffer, IO_HID_EP_LENGTH);
-    // await for the next chunk
-    goto apdu_reset;
-  }
-
-  // if more data to be received, notify it
-  if (G_io_usb_hid_remaining_length) {
-    return IO_USB_APDU_MORE_DATA;
+    return io_usb_hid_control_reply(sndfct);
   }
 
-  // reset sequence number for next exchange
-  io_usb_hid_init();
-  return IO_USB_APDU_RECEIVED;
-
 apdu_reset:
-  io_usb_hid_init();
+  // a response being sent goes on
+  G_io_usb_hid_framing.rx_sequence = 0;
   return IO_USB_APDU_RESET;
 }
 
 void io_usb_hid_init(void) {
-  G_io_usb_hid_sequence_number = 0; 
-  G_io_usb_hid_remaining_length = 0;
-  G_io_usb_hid_current_buffer = NULL;
+  // the channel is kept for the reply
+  G_io_usb_hid_framing.rx_sequence = 0;
+  ledger_framing_send(&G_io_usb_hid_framing, 0);
+  G_io_usb_hid_tx_buffer = NULL;
+  G_io_usb_hid_chunk_staged = 0;
+  G_io_usb_hid_control_sndfct = NULL;
+}
+
+/**
+ * build the next io_usb_hid transport chunk of the response into the staging buffer
+ */
+static void io_usb_hid_stage_chunk(void) {
+  unsigned int l = ledger_framing_next_frame(&G_io_usb_hid_framing, G_io_usb_hid_tx_buffer,
+                                             G_io_usb_hid_staged_chunk, IO_HID_EP_LENGTH);
+  // always padded (USB HID transport) :)
+  memset(G_io_usb_hid_staged_chunk+l, 0, IO_HID_EP_LENGTH-l);
+  G_io_usb_hid_chunk_staged = 1;
 }
 
 /**
  * sent the next io_usb_hid transport chunk (rx on the host, tx on the device)
  */
 void io_usb_hid_sent(io_send_t sndfct) {
-  unsigned int l;
-
-  // only prepare next chunk if some data to be sent remain
-  if (G_io_usb_hid_remaining_length && G_io_usb_hid_current_buffer) {
-    // fill the chunk
-    memset(G_io_usb_ep_buffer, 0, sizeof(G_io_usb_ep_buffer));
-
-    // keep the channel identifier
-    G_io_usb_ep_buffer[0] = (G_io_usb_hid_channel>>8)&0xFF;
-    G_io_usb_ep_buffer[1] = G_io_usb_hid_channel&0xFF;
-    G_io_usb_ep_buffer[2] = 0x05;
-    G_io_usb_ep_buffer[3] = G_io_usb_hid_sequence_number>>8;
-    G_io_usb_ep_buffer[4] = G_io_usb_hid_sequence_number;
-
-    if (G_io_usb_hid_sequence_number == 0) {
-      l = ((G_io_usb_hid_remaining_length>IO_HID_EP_LENGTH-7) ? IO_HID_EP_LENGTH-7 : G_io_usb_hid_remaining_length);
-      G_io_usb_ep_buffer[5] = G_io_usb_hid_remaining_length>>8;
-      G_io_usb_ep_buffer[6] = G_io_usb_hid_remaining_length;
-      memmove(G_io_usb_ep_buffer+7, (const void*)G_io_usb_hid_current_buffer, l);
-      G_io_usb_hid_current_buffer += l;
-      G_io_usb_hid_remaining_length -= l;
+  if (G_io_usb_hid_control_sndfct != NULL) {
+    io_send_t control_sndfct = G_io_usb_hid_control_sndfct;
+    G_io_usb_hid_control_sndfct = NULL;
+    control_sndfct(G_io_usb_hid_control_reply, IO_HID_EP_LENGTH);
+    // the next chunk goes once the reply has been acknowledged
+    if (control_sndfct == sndfct) {
+      return;
     }
-    else {
-      l = ((G_io_usb_hid_remaining_length>IO_HID_EP_LENGTH-5) ? IO_HID_EP_LENGTH-5 : G_io_usb_hid_remaining_length);
-      memmove(G_io_usb_ep_buffer+5, (const void*)G_io_usb_hid_current_buffer, l);
-      G_io_usb_hid_current_buffer += l;
-      G_io_usb_hid_remaining_length -= l;   
+  }
+
+  // the first chunk of a response has not been staged yet
+  if (!G_io_usb_hid_chunk_staged && ledger_framing_tx_pending(&G_io_usb_hid_framing) && G_io_usb_hid_tx_buffer) {
+    io_usb_hid_stage_chunk();
+  }
+
+  if (G_io_usb_hid_chunk_staged) {
+    // send the chunk (the endpoint holds a single IN packet: the host must
+    // acknowledge it before the next one can be sent)
+    sndfct(G_io_usb_hid_staged_chunk, sizeof(G_io_usb_hid_staged_chunk));
+    G_io_usb_hid_chunk_staged = 0;
+
+    // then prepare the next one while this one is transferred, so it can be
+    // sent as soon as the acknowledgement is received
+    if (ledger_framing_tx_pending(&G_io_usb_hid_framing) && G_io_usb_hid_tx_buffer) {
+      io_usb_hid_stage_chunk();
     }
-    // prepare next chunk numbering
-    G_io_usb_hid_sequence_number++;
-    // send the chunk
-    // always padded (USB HID transport) :)
-    sndfct(G_io_usb_ep_buffer, sizeof(G_io_usb_ep_buffer));
   }
-  // cleanup when everything has been sent (ack for the last sent usb in packet)
-  else {
+  // cleanup when everything has been sent (ack for the last sent usb in packet),
+  // not after the reply to a control command
+  else if (G_io_usb_hid_tx_buffer != NULL) {
     io_usb_hid_init();
 
     // we sent the whole response
@@ -274,10 +286,10 @@ void io_usb_hid_sent(io_send_t sndfct) {
 void io_usb_hid_send(io_send_t sndfct, unsigned short sndlength, unsigned char * apdu_buffer) {
   // perform send
   if (sndlength) {
-    G_io_usb_hid_sequence_number = 0; 
-    G_io_usb_hid_current_buffer = apdu_buffer;
-    G_io_usb_hid_remaining_length = sndlength;
+    ledger_framing_send(&G_io_usb_hid_framing, sndlength);
+    G_io_usb_hid_tx_buffer = apdu_buffer;
     G_io_usb_hid_total_length = sndlength;
+    G_io_usb_hid_chunk_staged = 0;
     io_usb_hid_sent(sndfct);
   }
 }
@@ -0,0 +1,250 @@
+//! Authenticated encryption, only available on Nano S+ where the cxlib AEAD
+//! functions of lcx_aead.h are linked into the app
+//!
+//! An [`Aead`] context is keyed once, and then encrypts or decrypts any
+//! number of messages: the key schedule is kept across messages and only
+//! the nonce changes. Messages are processed in place, typically directly in
+//! the APDU buffer, either at once or in chunks as they are received.
+//!
+//! # Examples
+//!
+//! ```
+//! let mut channel = Aead::new(AeadAlgorithm::ChaCha20Poly1305, &key)?;
+//! let tag = channel.encrypt_in_place(&nonce, &header, &mut comm.apdu_buffer[..len])?;
+//! ```
+
+use crate::bindings::*;
+use crate::ecc::CxError;
+
+/// `cx_aead_type_t` from lcx_aead.h
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub enum AeadAlgorithm {
+    Aes128Gcm = 0,
+    Aes192Gcm = 1,
+    Aes256Gcm = 2,
+    ChaCha20Poly1305 = 3,
+}
+
+impl AeadAlgorithm {
+    /// Key size in bytes
+    pub const fn key_size(self) -> usize {
+        match self {
+            AeadAlgorithm::Aes128Gcm => 16,
+            AeadAlgorithm::Aes192Gcm => 24,
+            AeadAlgorithm::Aes256Gcm | AeadAlgorithm::ChaCha20Poly1305 => 32,
+        }
+    }
+}
+
+/// Size of the authentication tags
+pub const TAG_SIZE: usize = 16;
+
+/// Storage for `cx_aes_gcm_context_t` (120 bytes) or
+/// `cx_chachapoly_context_t` (224 bytes)
+#[repr(C, align(8))]
+struct BaseContext([u8; 256]);
+
+// Layout of `cx_aead_context_t` from lcx_aead.h
+#[repr(C)]
+struct Context {
+    info: *const core::ffi::c_void,
+    mode: u32,
+    base_ctx: *mut BaseContext,
+}
+
+extern "C" {
+    fn cx_aead_init(ctx: *mut Context) -> cx_err_t;
+    fn cx_aead_setup(ctx: *mut Context, ty: AeadAlgorithm) -> cx_err_t;
+    fn cx_aead_set_key(ctx: *mut Context, key: *const u8, key_len: size_t, mode: u32) -> cx_err_t;
+    fn cx_aead_set_iv(ctx: *mut Context, iv: *const u8, iv_len: size_t) -> cx_err_t;
+    fn cx_aead_update_ad(ctx: *mut Context, ad: *const u8, ad_len: size_t) -> cx_err_t;
+    fn cx_aead_update(
+        ctx: *mut Context,
+        input: *mut u8,
+        in_len: size_t,
+        out: *mut u8,
+        out_len: *mut size_t,
+    ) -> cx_err_t;
+    fn cx_aead_write_tag(ctx: *mut Context, tag: *mut u8, tag_len: size_t) -> cx_err_t;
+    fn cx_aead_check_tag(ctx: *mut Context, tag: *const u8, tag_len: size_t) -> cx_err_t;
+}
+
+fn check(err: cx_err_t) -> Result<(), CxError> {
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(())
+    }
+}
+
+/// Direction of the message being processed
+#[derive(Copy, Clone)]
+pub enum Direction {
+    Encrypt,
+    Decrypt,
+}
+
+/// Keyed AEAD context
+pub struct Aead {
+    ctx: Context,
+    base: BaseContext,
+}
+
+impl Aead {
+    /// Context of `algorithm` keyed with `key`
+    pub fn new(algorithm: AeadAlgorithm, key: &[u8]) -> Result<Self, CxError> {
+        if key.len() != algorithm.key_size() {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let mut aead = Aead {
+            ctx: Context {
+                info: core::ptr::null(),
+                mode: 0,
+                base_ctx: core::ptr::null_mut(),
+            },
+            base: BaseContext([0u8; 256]),
+        };
+        unsafe {
+            check(cx_aead_init(aead.ctx()))?;
+            check(cx_aead_setup(aead.ctx(), algorithm))?;
+            check(cx_aead_set_key(
+                aead.ctx(),
+                key.as_ptr(),
+                key.len() as size_t,
+                CX_ENCRYPT,
+            ))?;
+        }
+        Ok(aead)
+    }
+
+    /// Pointer to the context, whose base context pointer is refreshed as
+    /// `self` may have moved since the last call
+    fn ctx(&mut self) -> *mut Context {
+        self.ctx.base_ctx = &mut self.base;
+        &mut self.ctx
+    }
+
+    /// Start processing a message with `nonce`, authenticating the
+    /// additional data `ad`, which is not encrypted
+    pub fn start(&mut self, direction: Direction, nonce: &[u8], ad: &[u8]) -> Result<(), CxError> {
+        self.ctx.mode = match direction {
+            Direction::Encrypt => CX_ENCRYPT,
+            Direction::Decrypt => CX_DECRYPT,
+        };
+        unsafe {
+            check(cx_aead_set_iv(
+                self.ctx(),
+                nonce.as_ptr(),
+                nonce.len() as size_t,
+            ))?;
+            if !ad.is_empty() {
+                check(cx_aead_update_ad(
+                    self.ctx(),
+                    ad.as_ptr(),
+                    ad.len() as size_t,
+                ))?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Encrypt or decrypt in place the next `chunk` of the message
+    pub fn update_in_place(&mut self, chunk: &mut [u8]) -> Result<(), CxError> {
+        let mut out_len = chunk.len() as size_t;
+        check(unsafe {
+            cx_aead_update(
+                self.ctx(),
+                chunk.as_mut_ptr(),
+                chunk.len() as size_t,
+                chunk.as_mut_ptr(),
+                &mut out_len,
+            )
+        })
+    }
+
+    /// End the encryption of the message, returning its tag
+    pub fn finish_encrypt(&mut self) -> Result<[u8; TAG_SIZE], CxError> {
+        let mut tag = [0u8; TAG_SIZE];
+        check(unsafe { cx_aead_write_tag(self.ctx(), tag.as_mut_ptr(), TAG_SIZE as size_t) })?;
+        Ok(tag)
+    }
+
+    /// End the decryption of the message, checking its `tag`. The decrypted
+    /// data must be discarded on error.
+    pub fn finish_decrypt(&mut self, tag: &[u8; TAG_SIZE]) -> Result<(), CxError> {
+        check(unsafe { cx_aead_check_tag(self.ctx(), tag.as_ptr(), TAG_SIZE as size_t) })
+    }
+
+    /// Encrypt `buf` in place, returning the tag
+    pub fn encrypt_in_place(
+        &mut self,
+        nonce: &[u8],
+        ad: &[u8],
+        buf: &mut [u8],
+    ) -> Result<[u8; TAG_SIZE], CxError> {
+        self.start(Direction::Encrypt, nonce, ad)?;
+        self.update_in_place(buf)?;
+        self.finish_encrypt()
+    }
+
+    /// Decrypt `buf` in place and check its `tag`. `buf` is cleared if the
+    /// tag does not match.
+    pub fn decrypt_in_place(
+        &mut self,
+        nonce: &[u8],
+        ad: &[u8],
+        buf: &mut [u8],
+        tag: &[u8; TAG_SIZE],
+    ) -> Result<(), CxError> {
+        self.start(Direction::Decrypt, nonce, ad)?;
+        self.update_in_place(buf)?;
+        let res = self.finish_decrypt(tag);
+        if res.is_err() {
+            buf.fill(0);
+        }
+        res
+    }
+}
+
+/// The base context holds the key schedule: clear it
+impl Drop for Aead {
+    #[inline(never)]
+    fn drop(&mut self) {
+        self.base.0.fill(0);
+        self.base.0 = core::hint::black_box(self.base.0);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn aes_gcm() {
+        // GCM specification, test case 2
+        let expected = [
+            0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2,
+            0xfe, 0x78,
+        ];
+        let expected_tag = [
+            0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd, 0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57,
+            0xbd, 0xdf,
+        ];
+        let mut aead = Aead::new(AeadAlgorithm::Aes128Gcm, &[0u8; 16]).map_err(|_| ())?;
+        let nonce = [0u8; 12];
+        let mut buf = [0u8; 16];
+        let tag = aead
+            .encrypt_in_place(&nonce, &[], &mut buf)
+            .map_err(|_| ())?;
+        assert_eq!(buf, expected);
+        assert_eq!(tag, expected_tag);
+
+        aead.decrypt_in_place(&nonce, &[], &mut buf, &tag)
+            .map_err(|_| ())?;
+        assert_eq!(buf, [0u8; 16]);
+    }
+}
@@ -0,0 +1,339 @@
+//! AES in ECB, CBC and CTR modes over the AES engine of the chip
+//!
+//! The block functions of the cxlib load the key into the AES engine for each
+//! block. An [`Aes`] context loads it once, for encryption or decryption, and
+//! then processes buffers of any number of blocks in place, with one inline
+//! system call per block. The OS has no multi-block AES syscall, so this is
+//! the shortest path to the engine: no key reload, no parameter marshalling
+//! out of line, and no copy out of the caller's buffer.
+//!
+//! The engine holds a single key: no other AES operation, including those of
+//! the cxlib, may run while a context is alive. It is reset when the context
+//! is dropped.
+//!
+//! [`Cmac`] computes AES-CMAC (NIST SP 800-38B) over data fed in pieces.
+//!
+//! # Examples
+//!
+//! ```
+//! let mut aes = Aes::new(&key, Direction::Encrypt)?;
+//! let mut iv = [0u8; BLOCK_SIZE];
+//! for chunk in backup.chunks_mut(1024) {
+//!     aes.cbc_encrypt_in_place(&mut iv, chunk)?;
+//! }
+//! ```
+
+use crate::bindings::{cx_aes_key_t, CX_DECRYPT, CX_ENCRYPT, CX_OK};
+use crate::ecc::CxError;
+use crate::svc::{cx_aes_block_hw, cx_aes_reset_hw, cx_aes_set_key_hw};
+
+/// Size of an AES block, in bytes
+pub const BLOCK_SIZE: usize = 16;
+
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub enum Direction {
+    Encrypt,
+    Decrypt,
+}
+
+/// Key loaded into the AES engine, until dropped
+pub struct Aes {
+    direction: Direction,
+}
+
+fn check(err: u32) -> Result<(), CxError> {
+    match err {
+        CX_OK => Ok(()),
+        err => Err(err.into()),
+    }
+}
+
+impl Aes {
+    /// Load a 16, 24 or 32-byte `key` for `direction`. CTR mode and CBC
+    /// encryption need [`Direction::Encrypt`], CBC decryption
+    /// [`Direction::Decrypt`].
+    pub fn new(key: &[u8], direction: Direction) -> Result<Aes, CxError> {
+        if !matches!(key.len(), 16 | 24 | 32) {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let mut aes_key = cx_aes_key_t {
+            size: key.len() as _,
+            keys: [0; 32],
+        };
+        aes_key.keys[..key.len()].copy_from_slice(key);
+        let mode = match direction {
+            Direction::Encrypt => CX_ENCRYPT,
+            Direction::Decrypt => CX_DECRYPT,
+        };
+        let err = unsafe { cx_aes_set_key_hw(&aes_key, mode) };
+        aes_key.keys.fill(0);
+        check(err)?;
+        Ok(Aes { direction })
+    }
+
+    /// Process `block` in place
+    #[inline(always)]
+    fn block(&mut self, block: &mut [u8]) -> Result<(), CxError> {
+        let mut input = [0u8; BLOCK_SIZE];
+        input.copy_from_slice(block);
+        check(unsafe { cx_aes_block_hw(input.as_ptr(), block.as_mut_ptr()) })
+    }
+
+    fn expect(&self, direction: Direction, data: &[u8]) -> Result<(), CxError> {
+        if self.direction != direction {
+            Err(CxError::InvalidParameter)
+        } else if data.len() % BLOCK_SIZE != 0 {
+            Err(CxError::InvalidParameterSize)
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Encrypt or decrypt `data`, a whole number of blocks, in ECB mode
+    pub fn ecb_in_place(&mut self, data: &mut [u8]) -> Result<(), CxError> {
+        self.expect(self.direction, data)?;
+        for block in data.chunks_exact_mut(BLOCK_SIZE) {
+            self.block(block)?;
+        }
+        Ok(())
+    }
+
+    /// Encrypt `data`, a whole number of blocks, in CBC mode. `iv` is updated
+    /// to the last block, so that the next call continues the chain.
+    pub fn cbc_encrypt_in_place(
+        &mut self,
+        iv: &mut [u8; BLOCK_SIZE],
+        data: &mut [u8],
+    ) -> Result<(), CxError> {
+        self.expect(Direction::Encrypt, data)?;
+        for block in data.chunks_exact_mut(BLOCK_SIZE) {
+            block.iter_mut().zip(iv.iter()).for_each(|(b, v)| *b ^= v);
+            self.block(block)?;
+            iv.copy_from_slice(block);
+        }
+        Ok(())
+    }
+
+    /// Decrypt `data`, a whole number of blocks, in CBC mode. `iv` is updated
+    /// to the last block, so that the next call continues the chain.
+    pub fn cbc_decrypt_in_place(
+        &mut self,
+        iv: &mut [u8; BLOCK_SIZE],
+        data: &mut [u8],
+    ) -> Result<(), CxError> {
+        self.expect(Direction::Decrypt, data)?;
+        for block in data.chunks_exact_mut(BLOCK_SIZE) {
+            let mut next = [0u8; BLOCK_SIZE];
+            next.copy_from_slice(block);
+            self.block(block)?;
+            block.iter_mut().zip(iv.iter()).for_each(|(b, v)| *b ^= v);
+            *iv = next;
+        }
+        Ok(())
+    }
+
+    /// Encrypt or decrypt `data` in CTR mode, `counter` being the first
+    /// counter block, incremented as a 128-bit big-endian integer. `counter`
+    /// is left at the next block, so that the next call continues the stream
+    /// as long as all the chunks but the last one are whole blocks.
+    pub fn ctr_in_place(
+        &mut self,
+        counter: &mut [u8; BLOCK_SIZE],
+        data: &mut [u8],
+    ) -> Result<(), CxError> {
+        self.expect(Direction::Encrypt, &[])?;
+        for chunk in data.chunks_mut(BLOCK_SIZE) {
+            let mut keystream = *counter;
+            self.block(&mut keystream)?;
+            chunk
+                .iter_mut()
+                .zip(keystream.iter())
+                .for_each(|(b, k)| *b ^= k);
+            *counter = (u128::from_be_bytes(*counter).wrapping_add(1)).to_be_bytes();
+        }
+        Ok(())
+    }
+}
+
+impl Drop for Aes {
+    fn drop(&mut self) {
+        unsafe { cx_aes_reset_hw() };
+    }
+}
+
+/// Double `block` in GF(2^128), to derive the CMAC subkeys
+fn double(block: &[u8; BLOCK_SIZE]) -> [u8; BLOCK_SIZE] {
+    let v = u128::from_be_bytes(*block);
+    let carry = (v >> 127) as u8;
+    ((v << 1) ^ (0x87 * carry as u128)).to_be_bytes()
+}
+
+/// AES-CMAC computation, holding the key in the AES engine until it is
+/// finalized
+pub struct Cmac {
+    aes: Aes,
+    k1: [u8; BLOCK_SIZE],
+    k2: [u8; BLOCK_SIZE],
+    state: [u8; BLOCK_SIZE],
+    /// Last block fed, processed once the next data comes, as the final
+    /// block is mixed with a subkey
+    last: [u8; BLOCK_SIZE],
+    last_len: usize,
+}
+
+impl Cmac {
+    pub fn new(key: &[u8]) -> Result<Cmac, CxError> {
+        let mut aes = Aes::new(key, Direction::Encrypt)?;
+        let mut l = [0u8; BLOCK_SIZE];
+        aes.block(&mut l)?;
+        let k1 = double(&l);
+        Ok(Cmac {
+            aes,
+            k1,
+            k2: double(&k1),
+            state: [0u8; BLOCK_SIZE],
+            last: [0u8; BLOCK_SIZE],
+            last_len: 0,
+        })
+    }
+
+    pub fn update(&mut self, mut data: &[u8]) -> Result<(), CxError> {
+        while !data.is_empty() {
+            if self.last_len == BLOCK_SIZE {
+                self.state
+                    .iter_mut()
+                    .zip(self.last.iter())
+                    .for_each(|(s, b)| *s ^= b);
+                self.aes.block(&mut self.state)?;
+                self.last_len = 0;
+            }
+            let n = data.len().min(BLOCK_SIZE - self.last_len);
+            self.last[self.last_len..self.last_len + n].copy_from_slice(&data[..n]);
+            self.last_len += n;
+            data = &data[n..];
+        }
+        Ok(())
+    }
+
+    pub fn finalize(mut self) -> Result<[u8; BLOCK_SIZE], CxError> {
+        let subkey = if self.last_len == BLOCK_SIZE {
+            self.k1
+        } else {
+            // Padded with 0x80 then zeros
+            self.last[self.last_len] = 0x80;
+            self.last[self.last_len + 1..].fill(0);
+            self.k2
+        };
+        for ((s, b), k) in self.state.iter_mut().zip(self.last).zip(subkey) {
+            *s ^= b ^ k;
+        }
+        self.aes.block(&mut self.state)?;
+        Ok(self.state)
+    }
+
+    /// CMAC of `data` under `key`
+    pub fn mac(key: &[u8], data: &[u8]) -> Result<[u8; BLOCK_SIZE], CxError> {
+        let mut cmac = Cmac::new(key)?;
+        cmac.update(data)?;
+        cmac.finalize()
+    }
+}
+
+impl Drop for Cmac {
+    fn drop(&mut self) {
+        self.k1.fill(0);
+        self.k2.fill(0);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // NIST SP 800-38A, F.1.1, F.2.1 and F.5.1
+    const KEY: [u8; 16] = [
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f,
+        0x3c,
+    ];
+    const PLAINTEXT: [u8; 16] = [
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17,
+        0x2a,
+    ];
+
+    #[test]
+    fn modes() {
+        let mut data = PLAINTEXT;
+        Aes::new(&KEY, Direction::Encrypt)
+            .and_then(|mut aes| aes.ecb_in_place(&mut data))
+            .map_err(|_| ())?;
+        assert_eq!(
+            data,
+            [
+                0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60, 0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66,
+                0xef, 0x97
+            ]
+        );
+
+        let iv: [u8; 16] = core::array::from_fn(|i| i as u8);
+        let mut data = PLAINTEXT;
+        let mut chain = iv;
+        Aes::new(&KEY, Direction::Encrypt)
+            .and_then(|mut aes| aes.cbc_encrypt_in_place(&mut chain, &mut data))
+            .map_err(|_| ())?;
+        assert_eq!(
+            data,
+            [
+                0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9,
+                0x19, 0x7d
+            ]
+        );
+        let mut chain = iv;
+        Aes::new(&KEY, Direction::Decrypt)
+            .and_then(|mut aes| aes.cbc_decrypt_in_place(&mut chain, &mut data))
+            .map_err(|_| ())?;
+        assert_eq!(data, PLAINTEXT);
+
+        let mut counter: [u8; 16] = core::array::from_fn(|i| 0xf0 + i as u8);
+        let mut data = PLAINTEXT;
+        Aes::new(&KEY, Direction::Encrypt)
+            .and_then(|mut aes| aes.ctr_in_place(&mut counter, &mut data[..15]))
+            .map_err(|_| ())?;
+        assert_eq!(
+            &data[..15],
+            &[
+                0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d,
+                0xb6
+            ]
+        );
+        assert_eq!(counter[15], 0x00);
+    }
+
+    // RFC 4493, 4.
+    #[test]
+    fn cmac() {
+        let mut message = [0u8; 40];
+        message[..16].copy_from_slice(&PLAINTEXT);
+        message[16..].copy_from_slice(&[
+            0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf,
+            0x8e, 0x51, 0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+        ]);
+        let empty = Cmac::mac(&KEY, &[]).map_err(|_| ())?;
+        assert_eq!(empty[..4], [0xbb, 0x1d, 0x69, 0x29]);
+        let block = Cmac::mac(&KEY, &PLAINTEXT).map_err(|_| ())?;
+        assert_eq!(block[12..], [0xd0, 0x4a, 0x28, 0x7c]);
+        let mut cmac = Cmac::new(&KEY).map_err(|_| ())?;
+        for piece in message.chunks(7) {
+            cmac.update(piece).map_err(|_| ())?;
+        }
+        assert_eq!(
+            cmac.finalize().map_err(|_| ())?,
+            [
+                0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97,
+                0xc8, 0x27
+            ]
+        );
+    }
+}
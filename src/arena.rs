@@ -0,0 +1,276 @@
+//! Bump allocator over a RAM region reserved by the linker script
+//!
+//! link.ld reserves `HEAP_SIZE` bytes of `.bss` between `_heap` and
+//! `_eheap`. The size is 0 unless the app defines `heap_size` when linking,
+//! for instance in its `.cargo/config.toml`:
+//!
+//! ```toml
+//! rustflags = ["-C", "link-arg=--defsym=heap_size=4096"]
+//! ```
+//!
+//! The [`Arena`] hands out this region from the bottom up. Temporaries live
+//! within a [`Arena::scope`], typically one per APDU, and are all released
+//! at once when it returns, so that they can be sized to the actual payload
+//! instead of its maximum:
+//!
+//! ```
+//! static ARENA: Arena = Arena::new();
+//!
+//! ARENA.scope(|scope| {
+//!     let buf = scope.alloc_slice(payload_len, 0u8)?;
+//!     ...
+//! });
+//! ```
+//!
+//! Scopes nest, and only the innermost one allocates: an outer [`Scope`]
+//! used while a nested one is open returns `None`, as its allocations would
+//! be released with the nested scope.
+//!
+//! An `Arena` can also be the `#[global_allocator]` of apps using the
+//! `alloc` crate. Freeing only reclaims the most recent allocation, and a
+//! scope keeps the memory below the global allocations still alive, so that
+//! nothing escaping the scope is ever overwritten.
+
+use core::alloc::{GlobalAlloc, Layout};
+use core::cell::Cell;
+use core::marker::PhantomData;
+use core::ptr::{addr_of_mut, null_mut};
+
+extern "C" {
+    // Bounds of the heap region, in .bss: reached through the static base
+    static mut _heap: u8;
+    static mut _eheap: u8;
+}
+
+fn heap_start() -> usize {
+    addr_of_mut!(_heap) as usize
+}
+
+fn heap_end() -> usize {
+    addr_of_mut!(_eheap) as usize
+}
+
+/// Allocator over the heap region. There must be a single one, as they
+/// would all share the region.
+pub struct Arena {
+    /// Offset of the first free byte in the region
+    offset: Cell<usize>,
+    /// Number of global allocations not freed yet
+    live: Cell<usize>,
+    /// End offset of the highest global allocation which may still be alive
+    global_end: Cell<usize>,
+    /// Number of scopes open
+    depth: Cell<usize>,
+}
+
+// Apps are single-threaded
+unsafe impl Sync for Arena {}
+
+impl Default for Arena {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Arena {
+    pub const fn new() -> Self {
+        Arena {
+            offset: Cell::new(0),
+            live: Cell::new(0),
+            global_end: Cell::new(0),
+            depth: Cell::new(0),
+        }
+    }
+
+    /// Size of the heap region in bytes
+    pub fn capacity(&self) -> usize {
+        heap_end() - heap_start()
+    }
+
+    /// Bytes currently allocated
+    pub fn used(&self) -> usize {
+        self.offset.get()
+    }
+
+    fn bump(&self, layout: Layout) -> *mut u8 {
+        let start = heap_start();
+        let Some(addr) = (start + self.offset.get()).checked_next_multiple_of(layout.align())
+        else {
+            return null_mut();
+        };
+        match addr.checked_add(layout.size()) {
+            Some(end) if end <= heap_end() => {
+                self.offset.set(end - start);
+                addr as *mut u8
+            }
+            _ => null_mut(),
+        }
+    }
+
+    /// Run `f` with a [`Scope`] allocating from the arena. Everything
+    /// allocated through it during `f` is released when it returns, up to
+    /// the global allocations still alive.
+    pub fn scope<R>(&self, f: impl for<'s> FnOnce(&Scope<'s>) -> R) -> R {
+        let offset = self.offset.get();
+        let depth = self.depth.get() + 1;
+        self.depth.set(depth);
+        let r = f(&Scope {
+            arena: self,
+            depth,
+            _scope: PhantomData,
+        });
+        self.depth.set(depth - 1);
+        // Above the highest global allocation alive, everything allocated
+        // since `offset` belongs to this scope or to scopes nested in it
+        self.offset.set(offset.max(self.global_end.get()));
+        r
+    }
+}
+
+/// Allocation handle of an [`Arena::scope`], handing out references which
+/// cannot outlive it
+pub struct Scope<'s> {
+    arena: &'s Arena,
+    /// Nesting level of the scope, starting at 1
+    depth: usize,
+    _scope: PhantomData<&'s mut &'s ()>,
+}
+
+impl<'s> Scope<'s> {
+    /// Bump allocation, unless a nested scope is open
+    fn bump(&self, layout: Layout) -> *mut u8 {
+        if self.depth != self.arena.depth.get() {
+            return null_mut();
+        }
+        self.arena.bump(layout)
+    }
+
+    /// Slice of `len` copies of `value`, or `None` if the arena is full or a
+    /// nested scope is open
+    pub fn alloc_slice<T: Copy>(&self, len: usize, value: T) -> Option<&'s mut [T]> {
+        let layout = Layout::array::<T>(len).ok()?;
+        let p = self.bump(layout) as *mut T;
+        if p.is_null() {
+            return None;
+        }
+        unsafe {
+            for i in 0..len {
+                p.add(i).write(value);
+            }
+            Some(core::slice::from_raw_parts_mut(p, len))
+        }
+    }
+
+    /// `value` moved into the arena, or `None` if the arena is full or a
+    /// nested scope is open. It is not dropped when the scope ends.
+    pub fn alloc<T>(&self, value: T) -> Option<&'s mut T> {
+        let p = self.bump(Layout::new::<T>()) as *mut T;
+        if p.is_null() {
+            return None;
+        }
+        unsafe {
+            p.write(value);
+            Some(&mut *p)
+        }
+    }
+
+    /// Bytes left in the arena
+    pub fn remaining(&self) -> usize {
+        self.arena.capacity() - self.arena.used()
+    }
+}
+
+unsafe impl GlobalAlloc for Arena {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let p = self.bump(layout);
+        if !p.is_null() {
+            self.live.set(self.live.get() + 1);
+            self.global_end.set(self.offset.get());
+        }
+        p
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        self.live.set(self.live.get() - 1);
+        // Only the last allocation can be given back
+        if ptr as usize + layout.size() == heap_start() + self.offset.get() {
+            self.offset.set(ptr as usize - heap_start());
+        }
+        if self.live.get() == 0 {
+            self.global_end.set(0);
+        } else {
+            self.global_end
+                .set(self.global_end.get().min(self.offset.get()));
+        }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        // The last allocation grows or shrinks in place
+        let start = heap_start();
+        if ptr as usize + layout.size() == start + self.offset.get() {
+            let end = ptr as usize + new_size;
+            if end <= heap_end() {
+                self.offset.set(end - start);
+                self.global_end.set(end - start);
+                return ptr;
+            }
+            return null_mut();
+        }
+        let new = self.bump(Layout::from_size_align_unchecked(new_size, layout.align()));
+        if !new.is_null() {
+            self.global_end.set(self.offset.get());
+            core::ptr::copy_nonoverlapping(ptr, new, layout.size().min(new_size));
+        }
+        new
+    }
+}
+
+// The heap of the tests is reserved by the host backend
+#[cfg(all(test, feature = "host"))]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn global_alloc_in_scope() {
+        let arena = Arena::new();
+        let layout = Layout::new::<u64>();
+        let a = unsafe { arena.alloc(layout) };
+        let kept = arena.scope(|scope| {
+            scope.alloc(1u32).ok_or(())?;
+            let b = unsafe { arena.alloc(layout) };
+            // a is freed but not reclaimed: as many global allocations are
+            // alive as when the scope started, and b lies above its start
+            unsafe { arena.dealloc(a, layout) };
+            Ok::<_, ()>(b)
+        })?;
+        assert_eq!(arena.used(), kept as usize + 8 - heap_start());
+        arena.scope(|scope| scope.alloc(0u64).map(|_| ()).ok_or(()))?;
+        assert_eq!(arena.used(), kept as usize + 8 - heap_start());
+        unsafe { arena.dealloc(kept, layout) };
+        arena.scope(|scope| scope.alloc(0u8).map(|_| ()).ok_or(()))?;
+        assert_eq!(arena.used(), kept as usize - heap_start());
+    }
+
+    #[test]
+    fn nested_scopes() {
+        let arena = Arena::new();
+        arena.scope(|outer| {
+            let a = outer.alloc(1u32).ok_or(())?;
+            let used = arena.used();
+            let b = arena.scope(|inner| {
+                // The outer scope cannot allocate in the inner one
+                assert_eq!(outer.alloc(2u32).is_none(), true);
+                assert_eq!(outer.alloc_slice(4, 0u8).is_none(), true);
+                inner.alloc(3u32).map(|b| *b).ok_or(())
+            })?;
+            assert_eq!(arena.used(), used);
+            let c = outer.alloc(4u32).ok_or(())?;
+            assert_eq!((*a, b, *c), (1, 3, 4));
+            Ok::<_, ()>(())
+        })?;
+        assert_eq!(arena.used(), 0);
+    }
+}
@@ -1,8 +1,31 @@
+//! BLE transport of the Nano X
+//!
+//! APDUs are exchanged over the Ledger GATT service of `ledger_ble.c`, with
+//! the framing of [`crate::framing`]. Pairing is left to the OS and to the
+//! BLE controller: LE Secure Connections keys are generated and used inside
+//! the controller, whose ACI has no command to load a key pair computed in
+//! advance by the app (`aci_gap_set_oob_data` only takes the data of an
+//! out-of-band pairing), so there is nothing the SDK can precompute to
+//! shorten a first pairing.
+
+use core::ffi::c_void;
+
+/// `ledger_protocol_rx_sink_t` from ledger_protocol.h
+type RxSink =
+    unsafe extern "C" fn(context: *mut c_void, offset: u16, total: u16, data: *const u8, len: u16);
+
 extern "C" {
     pub fn LEDGER_BLE_init();
     pub fn LEDGER_BLE_send(packet: *const u8, packet_length: u16);
     pub fn LEDGER_BLE_receive(spi_buffer: *const u8);
     pub fn LEDGER_BLE_set_recv_buffer(buffer: *mut u8, buffer_length: u16);
+    fn LEDGER_BLE_set_recv_sink(sink: Option<RxSink>, context: *mut c_void);
+    pub fn LEDGER_BLE_set_connection_params(
+        interval_min: u16,
+        interval_max: u16,
+        latency: u16,
+        timeout: u16,
+    );
 }
 
 pub fn receive(apdu_buffer: &mut [u8], spi_buffer: &[u8]) {
@@ -12,8 +35,95 @@ pub fn receive(apdu_buffer: &mut [u8], spi_buffer: &[u8]) {
     }
 }
 
+/// Consumer of the chunks of BLE commands, called with the offset of the
+/// chunk in the APDU, the total length of the APDU and the chunk data
+pub type ChunkSink<'a> = dyn FnMut(usize, usize, &[u8]) + 'a;
+
+unsafe extern "C" fn call_sink(
+    context: *mut c_void,
+    offset: u16,
+    total: u16,
+    data: *const u8,
+    len: u16,
+) {
+    let sink = &mut *(context as *mut &mut ChunkSink);
+    sink(
+        offset as usize,
+        total as usize,
+        core::slice::from_raw_parts(data, len as usize),
+    );
+}
+
+/// Run `f`, passing each chunk of the BLE commands received meanwhile to
+/// `sink` as soon as it has been reassembled in the APDU buffer.
+///
+/// A large payload can be hashed or parsed while its last chunks are still
+/// on the air, instead of once the whole APDU has been received.
+///
+/// # Examples
+///
+/// ```
+/// let mut hasher = Sha256::new();
+/// let ins = ble::with_chunk_sink(
+///     &mut |_offset, _total, chunk| {
+///         let _ = hasher.update(chunk);
+///     },
+///     || comm.next_command::<Ins>(),
+/// );
+/// ```
+pub fn with_chunk_sink<R>(sink: &mut ChunkSink, f: impl FnOnce() -> R) -> R {
+    let mut sink = sink;
+    unsafe {
+        LEDGER_BLE_set_recv_sink(
+            Some(call_sink),
+            &mut sink as *mut &mut ChunkSink as *mut c_void,
+        );
+    }
+    let res = f();
+    unsafe {
+        LEDGER_BLE_set_recv_sink(None, core::ptr::null_mut());
+    }
+    res
+}
+
 pub fn send(buffer: &[u8]) {
     unsafe {
         LEDGER_BLE_send(buffer.as_ptr(), buffer.len() as u16);
     }
 }
+
+/// Connection parameter presets, to trade latency for battery life
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum ConnectionMode {
+    /// Shortest interval (7.5 to 15 ms), for bursts of APDUs such as bulk
+    /// signing
+    Bulk,
+    /// The interval range advertised at connection time (15 to 30 ms)
+    Interactive,
+    /// Long interval (100 to 200 ms) with slave latency, while waiting for
+    /// the user or the host
+    Idle,
+}
+
+impl ConnectionMode {
+    /// Minimum and maximum connection intervals (1.25 ms units), slave
+    /// latency (connection events) and supervision timeout (10 ms units)
+    const fn params(self) -> (u16, u16, u16, u16) {
+        match self {
+            ConnectionMode::Bulk => (6, 12, 0, 200),
+            ConnectionMode::Interactive => (12, 24, 0, 400),
+            ConnectionMode::Idle => (80, 160, 4, 600),
+        }
+    }
+}
+
+/// Ask the connected host to switch to the connection parameters of `mode`.
+///
+/// The host may reject or adjust the request, and nothing is sent when no
+/// host is connected.
+pub fn set_connection_mode(mode: ConnectionMode) {
+    let (interval_min, interval_max, latency, timeout) = mode.params();
+    unsafe {
+        LEDGER_BLE_set_connection_params(interval_min, interval_max, latency, timeout);
+    }
+}
@@ -0,0 +1,420 @@
+//! Big numbers held by the cryptographic engine
+//!
+//! The legacy `cx_math_*` functions take byte arrays, and each call locks the
+//! bignum engine, imports its operands, computes and exports the result
+//! before unlocking. A [`BnArena`] locks the engine once for a whole
+//! computation: the [`Bn`] it allocates stay in the engine memory between
+//! operations and are only exported when needed.
+//! Repeated modular multiplications and exponentiations by the same modulus
+//! can share a [`MontCtx`].
+//!
+//! # Examples
+//!
+//! ```
+//! let arena = BnArena::lock(32)?;
+//! let n = arena.alloc_init(32, &ORDER)?;
+//! let a = arena.alloc_init(32, &a_bytes)?;
+//! let b = arena.alloc_init(32, &b_bytes)?;
+//! let mut r = arena.alloc(32)?;
+//! r.mod_mul(&a, &b, &n)?;
+//! r.export(&mut out)?;
+//! ```
+//!
+//! Legacy `cx_math_*` functions and functions built on them (signatures, key
+//! derivation) fail with [`CxError::Locked`] while an arena is alive.
+
+use crate::bindings::*;
+use crate::ecc::CxError;
+use crate::svc::{cx_bn_mod_add, cx_bn_mod_mul, cx_bn_mod_sub, cx_bn_reduce, cx_mont_mul};
+use core::cmp::Ordering;
+use core::marker::PhantomData;
+
+fn check(err: cx_err_t) -> Result<(), CxError> {
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(())
+    }
+}
+
+/// Exclusive access to the bignum engine, released on drop
+pub struct BnArena {
+    // The engine is a global resource: forbid building one outside `lock`
+    _private: (),
+}
+
+impl BnArena {
+    /// Lock the engine. Big numbers are allocated by multiples of
+    /// `word_nbytes` bytes, usually the size of the modulus.
+    pub fn lock(word_nbytes: usize) -> Result<Self, CxError> {
+        check(unsafe { cx_bn_lock(word_nbytes as size_t, 0) })?;
+        Ok(BnArena { _private: () })
+    }
+
+    /// Allocate a `nbytes` big number, initialized to zero
+    pub fn alloc(&self, nbytes: usize) -> Result<Bn<'_>, CxError> {
+        let mut handle: cx_bn_t = 0;
+        check(unsafe { cx_bn_alloc(&mut handle, nbytes as size_t) })?;
+        Ok(Bn {
+            handle,
+            _arena: PhantomData,
+        })
+    }
+
+    /// Allocate a `nbytes` big number, initialized with the big endian
+    /// `value`
+    pub fn alloc_init(&self, nbytes: usize, value: &[u8]) -> Result<Bn<'_>, CxError> {
+        let mut handle: cx_bn_t = 0;
+        check(unsafe {
+            cx_bn_alloc_init(
+                &mut handle,
+                nbytes as size_t,
+                value.as_ptr(),
+                value.len() as size_t,
+            )
+        })?;
+        Ok(Bn {
+            handle,
+            _arena: PhantomData,
+        })
+    }
+}
+
+impl Drop for BnArena {
+    fn drop(&mut self) {
+        // Also wipes the engine memory
+        unsafe { cx_bn_unlock() };
+    }
+}
+
+/// Big number allocated in a [`BnArena`], which it cannot outlive.
+/// Operations write their result into `self`.
+pub struct Bn<'a> {
+    handle: cx_bn_t,
+    _arena: PhantomData<&'a BnArena>,
+}
+
+impl Drop for Bn<'_> {
+    fn drop(&mut self) {
+        unsafe { cx_bn_destroy(&mut self.handle) };
+    }
+}
+
+impl Bn<'_> {
+    /// Raw handle, for the `cx_bn_*` functions not wrapped here
+    pub fn handle(&self) -> cx_bn_t {
+        self.handle
+    }
+
+    /// Size in bytes
+    pub fn nbytes(&self) -> Result<usize, CxError> {
+        let mut nbytes: size_t = 0;
+        check(unsafe { cx_bn_nbytes(self.handle, &mut nbytes) })?;
+        Ok(nbytes as usize)
+    }
+
+    /// Set from the big endian `value`
+    pub fn set_bytes(&mut self, value: &[u8]) -> Result<(), CxError> {
+        check(unsafe { cx_bn_init(self.handle, value.as_ptr(), value.len() as size_t) })
+    }
+
+    /// Export as big endian into `out`, which holds at least `nbytes()` bytes
+    pub fn export(&self, out: &mut [u8]) -> Result<(), CxError> {
+        check(unsafe { cx_bn_export(self.handle, out.as_mut_ptr(), out.len() as size_t) })
+    }
+
+    pub fn set_u32(&mut self, n: u32) -> Result<(), CxError> {
+        check(unsafe { cx_bn_set_u32(self.handle, n) })
+    }
+
+    pub fn get_u32(&self) -> Result<u32, CxError> {
+        let mut n = 0;
+        check(unsafe { cx_bn_get_u32(self.handle, &mut n) })?;
+        Ok(n)
+    }
+
+    pub fn copy_from(&mut self, a: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_copy(self.handle, a.handle) })
+    }
+
+    /// Swap `a` and `b` if `swap`, without branching on it, as in a
+    /// Montgomery ladder over a secret scalar. Only the handles are swapped.
+    pub fn cswap(a: &mut Self, b: &mut Self, swap: bool) {
+        let mask = core::hint::black_box(0u32.wrapping_sub(swap as u32));
+        let t = (a.handle ^ b.handle) & mask;
+        a.handle ^= t;
+        b.handle ^= t;
+    }
+
+    pub fn compare(&self, b: &Bn) -> Result<Ordering, CxError> {
+        let mut diff = 0;
+        check(unsafe { cx_bn_cmp(self.handle, b.handle, &mut diff) })?;
+        Ok(diff.cmp(&0))
+    }
+
+    pub fn compare_u32(&self, b: u32) -> Result<Ordering, CxError> {
+        let mut diff = 0;
+        check(unsafe { cx_bn_cmp_u32(self.handle, b, &mut diff) })?;
+        Ok(diff.cmp(&0))
+    }
+
+    pub fn is_odd(&self) -> Result<bool, CxError> {
+        let mut odd = false;
+        check(unsafe { cx_bn_is_odd(self.handle, &mut odd) })?;
+        Ok(odd)
+    }
+
+    pub fn tst_bit(&self, pos: u32) -> Result<bool, CxError> {
+        let mut set = false;
+        check(unsafe { cx_bn_tst_bit(self.handle, pos, &mut set) })?;
+        Ok(set)
+    }
+
+    /// Number of significant bits
+    pub fn cnt_bits(&self) -> Result<u32, CxError> {
+        let mut nbits = 0;
+        check(unsafe { cx_bn_cnt_bits(self.handle, &mut nbits) })?;
+        Ok(nbits)
+    }
+
+    pub fn shr(&mut self, n: u32) -> Result<(), CxError> {
+        check(unsafe { cx_bn_shr(self.handle, n) })
+    }
+
+    pub fn shl(&mut self, n: u32) -> Result<(), CxError> {
+        check(unsafe { cx_bn_shl(self.handle, n) })
+    }
+
+    /// `self = a + b`, returns whether a carry occurred
+    pub fn add(&mut self, a: &Bn, b: &Bn) -> Result<bool, CxError> {
+        match unsafe { cx_bn_add(self.handle, a.handle, b.handle) } {
+            CX_CARRY => Ok(true),
+            err => check(err).map(|_| false),
+        }
+    }
+
+    /// `self = a - b`, returns whether a borrow occurred
+    pub fn sub(&mut self, a: &Bn, b: &Bn) -> Result<bool, CxError> {
+        match unsafe { cx_bn_sub(self.handle, a.handle, b.handle) } {
+            CX_CARRY => Ok(true),
+            err => check(err).map(|_| false),
+        }
+    }
+
+    /// `self = a * b`, `self` being twice as large as `a` and `b`
+    pub fn mul(&mut self, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mul(self.handle, a.handle, b.handle) })
+    }
+
+    /// `self = a + b mod n`
+    pub fn mod_add(&mut self, a: &Bn, b: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_add(self.handle, a.handle, b.handle, n.handle) })
+    }
+
+    /// `self = a - b mod n`
+    pub fn mod_sub(&mut self, a: &Bn, b: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_sub(self.handle, a.handle, b.handle, n.handle) })
+    }
+
+    /// `self = a * b mod n`
+    pub fn mod_mul(&mut self, a: &Bn, b: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_mul(self.handle, a.handle, b.handle, n.handle) })
+    }
+
+    /// `self = d mod n`, `d` being of any size
+    pub fn reduce(&mut self, d: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_reduce(self.handle, d.handle, n.handle) })
+    }
+
+    /// `self = a^e mod n`
+    pub fn mod_pow_bn(&mut self, a: &Bn, e: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_pow_bn(self.handle, a.handle, e.handle, n.handle) })
+    }
+
+    /// `self = a^e mod n`, with the big endian exponent `e`
+    pub fn mod_pow(&mut self, a: &Bn, e: &[u8], n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_pow(self.handle, a.handle, e.as_ptr(), e.len() as u32, n.handle) })
+    }
+
+    /// `self = a^-1 mod n`, `a` being coprime to `n`
+    pub fn mod_u32_invert(&mut self, a: u32, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_u32_invert(self.handle, a, n.handle) })
+    }
+
+    /// `self = a^-1 mod n`, `n` being prime
+    pub fn mod_invert_nprime(&mut self, a: &Bn, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_invert_nprime(self.handle, a.handle, n.handle) })
+    }
+
+    /// `self` = square root of `a` mod the prime `n`, the one with the
+    /// parity of `sign`
+    pub fn mod_sqrt(&mut self, a: &Bn, n: &Bn, sign: u32) -> Result<(), CxError> {
+        check(unsafe { cx_bn_mod_sqrt(self.handle, a.handle, n.handle, sign) })
+    }
+
+    /// Uniformly random number in `[0, n)`
+    pub fn rng(&mut self, n: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_bn_rng(self.handle, n.handle) })
+    }
+
+    pub fn is_prime(&self) -> Result<bool, CxError> {
+        crate::cx_profile!("cx_bn_is_prime");
+        let mut prime = false;
+        check(unsafe { cx_bn_is_prime(self.handle, &mut prime) })?;
+        Ok(prime)
+    }
+}
+
+/// Montgomery context of an odd modulus, allocated in a [`BnArena`].
+///
+/// Setting it up computes `R^2 mod n`, which `cx_bn_mod_pow*` and
+/// `cx_bn_mod_mul` redo at each call: build it once per modulus (curve order,
+/// field prime, RSA modulus) and run repeated multiplications and
+/// exponentiations on Montgomery representations instead. `R^2 mod n` can
+/// also be exported with [`MontCtx::export_h`] and given back to
+/// [`MontCtx::with_h`] in a later arena session to skip the setup entirely.
+///
+/// # Examples
+///
+/// ```
+/// let arena = BnArena::lock(32)?;
+/// let mont = MontCtx::new(&arena, &arena.alloc_init(32, &P)?)?;
+/// let mut x = arena.alloc(32)?;
+/// mont.to_montgomery(&mut x, &arena.alloc_init(32, &x_bytes)?)?;
+/// let mut r = arena.alloc(32)?;
+/// mont.pow(&mut r, &x, &e_bytes)?;
+/// mont.from_montgomery(&mut x, &r)?;
+/// ```
+pub struct MontCtx<'a> {
+    ctx: cx_bn_mont_ctx_t,
+    _arena: PhantomData<&'a BnArena>,
+}
+
+impl<'a> MontCtx<'a> {
+    fn alloc(_arena: &'a BnArena, n: &Bn) -> Result<Self, CxError> {
+        let mut mont = MontCtx {
+            ctx: cx_bn_mont_ctx_t::default(),
+            _arena: PhantomData,
+        };
+        check(unsafe { cx_mont_alloc(&mut mont.ctx, n.nbytes()? as size_t) })?;
+        Ok(mont)
+    }
+
+    /// Set up the context of the modulus `n`, computing `R^2 mod n`
+    pub fn new(arena: &'a BnArena, n: &Bn) -> Result<Self, CxError> {
+        let mut mont = Self::alloc(arena, n)?;
+        check(unsafe { cx_mont_init(&mut mont.ctx, n.handle) })?;
+        Ok(mont)
+    }
+
+    /// Set up the context of the modulus `n` from a previously computed
+    /// `h = R^2 mod n`
+    pub fn with_h(arena: &'a BnArena, n: &Bn, h: &Bn) -> Result<Self, CxError> {
+        let mut mont = Self::alloc(arena, n)?;
+        check(unsafe { cx_mont_init2(&mut mont.ctx, n.handle, h.handle) })?;
+        Ok(mont)
+    }
+
+    /// Export `R^2 mod n` as big endian into `out`
+    pub fn export_h(&self, out: &mut [u8]) -> Result<(), CxError> {
+        check(unsafe { cx_bn_export(self.ctx.h, out.as_mut_ptr(), out.len() as size_t) })
+    }
+
+    /// `x` = Montgomery representation of `z`
+    pub fn to_montgomery(&self, x: &mut Bn, z: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_mont_to_montgomery(x.handle, z.handle, &self.ctx) })
+    }
+
+    /// `z` = value of the Montgomery representation `x`
+    pub fn from_montgomery(&self, z: &mut Bn, x: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_mont_from_montgomery(z.handle, x.handle, &self.ctx) })
+    }
+
+    /// `r = a * b`, all in Montgomery representation
+    pub fn mul(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_mont_mul(r.handle, a.handle, b.handle, &self.ctx) })
+    }
+
+    /// `r = a^e`, `a` and `r` in Montgomery representation, with the big
+    /// endian exponent `e`
+    pub fn pow(&self, r: &mut Bn, a: &Bn, e: &[u8]) -> Result<(), CxError> {
+        check(unsafe { cx_mont_pow(r.handle, a.handle, e.as_ptr(), e.len() as u32, &self.ctx) })
+    }
+
+    /// `r = a^e`, `a` and `r` in Montgomery representation
+    pub fn pow_bn(&self, r: &mut Bn, a: &Bn, e: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_mont_pow_bn(r.handle, a.handle, e.handle, &self.ctx) })
+    }
+
+    /// `r = a^-1`, in Montgomery representation, the modulus being prime
+    pub fn invert_nprime(&self, r: &mut Bn, a: &Bn) -> Result<(), CxError> {
+        check(unsafe { cx_mont_invert_nprime(r.handle, a.handle, &self.ctx) })
+    }
+}
+
+impl Drop for MontCtx<'_> {
+    fn drop(&mut self) {
+        unsafe {
+            cx_bn_destroy(&mut self.ctx.n);
+            cx_bn_destroy(&mut self.ctx.h);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn arena() {
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        // Engine is already locked
+        assert_eq!(BnArena::lock(32).is_err(), true);
+
+        let n = arena.alloc_init(32, &[101]).map_err(|_| ())?;
+        let a = arena.alloc_init(32, &[50]).map_err(|_| ())?;
+        let b = arena.alloc_init(32, &[70]).map_err(|_| ())?;
+        let mut r = arena.alloc(32).map_err(|_| ())?;
+        r.mod_add(&a, &b, &n).map_err(|_| ())?;
+        assert_eq!(r.get_u32().map_err(|_| ())?, 19);
+        r.mod_mul(&a, &b, &n).map_err(|_| ())?;
+        assert_eq!(r.get_u32().map_err(|_| ())?, 3500 % 101);
+        r.mod_invert_nprime(&a, &n).map_err(|_| ())?;
+        let mut one = arena.alloc(32).map_err(|_| ())?;
+        one.mod_mul(&r, &a, &n).map_err(|_| ())?;
+        assert_eq!(one.compare_u32(1).map_err(|_| ())?, Ordering::Equal);
+
+        let mut out = [0u8; 32];
+        r.export(&mut out).map_err(|_| ())?;
+        assert_eq!(out[31] as u32, r.get_u32().map_err(|_| ())?);
+    }
+
+    #[test]
+    fn montgomery() {
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let n = arena.alloc_init(32, &[101]).map_err(|_| ())?;
+        let mont = MontCtx::new(&arena, &n).map_err(|_| ())?;
+        let mut h = [0u8; 32];
+        mont.export_h(&mut h).map_err(|_| ())?;
+        let h = arena.alloc_init(32, &h).map_err(|_| ())?;
+        let cached = MontCtx::with_h(&arena, &n, &h).map_err(|_| ())?;
+
+        let a = arena.alloc_init(32, &[50]).map_err(|_| ())?;
+        let mut am = arena.alloc(32).map_err(|_| ())?;
+        let mut rm = arena.alloc(32).map_err(|_| ())?;
+        let mut r = arena.alloc(32).map_err(|_| ())?;
+        for ctx in [&mont, &cached] {
+            ctx.to_montgomery(&mut am, &a).map_err(|_| ())?;
+            // 50^3 mod 101
+            ctx.pow(&mut rm, &am, &[3]).map_err(|_| ())?;
+            ctx.from_montgomery(&mut r, &rm).map_err(|_| ())?;
+            assert_eq!(r.get_u32().map_err(|_| ())?, 125000 % 101);
+            ctx.mul(&mut rm, &am, &am).map_err(|_| ())?;
+            ctx.from_montgomery(&mut r, &rm).map_err(|_| ())?;
+            assert_eq!(r.get_u32().map_err(|_| ())?, 2500 % 101);
+        }
+    }
+}
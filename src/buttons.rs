@@ -1,9 +1,22 @@
+use crate::timer::{Timers, TICK_MS};
+
+/// Time a button is held before a long press is reported
+pub const LONG_PRESS_MS: u32 = 600;
+/// Interval between the long press and the first repeat of a held button.
+/// Each repeat comes a quarter sooner than the previous one, down to
+/// [`TICK_MS`].
+pub const REPEAT_START_MS: u32 = 400;
+
 /// Structure keeping track of button pushes
 /// 1 -> left button, 2 -> right button
 #[derive(Default)]
 pub struct ButtonsState {
     pub button_mask: u8,
     pub cmd_buffer: [u8; 4],
+    /// Expiry of the long press, then of the next repeat
+    timers: Timers<1>,
+    /// Interval until the next repeat, 0 until a long press is reported
+    repeat_ms: u32,
 }
 
 impl ButtonsState {
@@ -11,6 +24,8 @@ impl ButtonsState {
         ButtonsState {
             button_mask: 0,
             cmd_buffer: [0; 4],
+            timers: Timers::new(),
+            repeat_ms: 0,
         }
     }
 }
@@ -25,18 +40,31 @@ pub enum ButtonEvent {
     LeftButtonRelease,
     RightButtonRelease,
     BothButtonsRelease,
+    /// Buttons held for [`LONG_PRESS_MS`]. No release is reported for them
+    /// afterwards.
+    LeftButtonLongPress,
+    RightButtonLongPress,
+    BothButtonsLongPress,
+    /// Button still held after a long press, reported more and more often
+    LeftButtonRepeat,
+    RightButtonRepeat,
 }
 
 /// Distinguish between button press and button release
 pub fn get_button_event(buttons: &mut ButtonsState, new: u8) -> Option<ButtonEvent> {
     let old = buttons.button_mask;
     buttons.button_mask |= new;
-    match (old, new) {
+    let event = match (old, new) {
         (0, 1) => Some(ButtonEvent::LeftButtonPress),
         (0, 2) => Some(ButtonEvent::RightButtonPress),
         (_, 3) => Some(ButtonEvent::BothButtonsPress),
         (b, 0) => {
             buttons.button_mask = 0; // reset state on release
+            buttons.timers.cancel(0);
+            if core::mem::take(&mut buttons.repeat_ms) != 0 {
+                // already reported as a long press
+                return None;
+            }
             match b {
                 1 => Some(ButtonEvent::LeftButtonRelease),
                 2 => Some(ButtonEvent::RightButtonRelease),
@@ -45,5 +73,76 @@ pub fn get_button_event(buttons: &mut ButtonsState, new: u8) -> Option<ButtonEve
             }
         }
         _ => None,
+    };
+    if event.is_some() && new != 0 {
+        buttons.timers.start(0, LONG_PRESS_MS);
+        buttons.repeat_ms = 0;
+    }
+    event
+}
+
+/// Long press or repeat of the buttons held, if due. Called on each ticker
+/// event, so lengthening the ticker interval delays them.
+pub fn get_held_button_event(buttons: &mut ButtonsState) -> Option<ButtonEvent> {
+    if !buttons.timers.poll().contains(0) {
+        return None;
+    }
+    let first = buttons.repeat_ms == 0;
+    buttons.repeat_ms = match first {
+        true => REPEAT_START_MS,
+        false => (buttons.repeat_ms * 3 / 4).max(TICK_MS),
+    };
+    let event = match (buttons.button_mask, first) {
+        (1, true) => ButtonEvent::LeftButtonLongPress,
+        (2, true) => ButtonEvent::RightButtonLongPress,
+        (3, true) => ButtonEvent::BothButtonsLongPress,
+        (1, false) => ButtonEvent::LeftButtonRepeat,
+        (2, false) => ButtonEvent::RightButtonRepeat,
+        _ => return None,
+    };
+    // Both buttons held are not repeated
+    if buttons.button_mask != 3 {
+        buttons.timers.start(0, buttons.repeat_ms);
+    }
+    Some(event)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use crate::timer::on_tick;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn long_press() {
+        let mut buttons = ButtonsState::new();
+        assert_eq!(
+            get_button_event(&mut buttons, 2) == Some(ButtonEvent::RightButtonPress),
+            true
+        );
+        // Ticks elapsed before each event
+        let mut events = [0u32; 5];
+        for event in events.iter_mut() {
+            while *event < 10 {
+                on_tick();
+                *event += 1;
+                if get_held_button_event(&mut buttons).is_some() {
+                    break;
+                }
+            }
+        }
+        assert_eq!(events, [6, 4, 3, 3, 2]);
+        assert_eq!(get_button_event(&mut buttons, 0) == None, true);
+
+        // Short press
+        get_button_event(&mut buttons, 1);
+        on_tick();
+        assert_eq!(get_held_button_event(&mut buttons) == None, true);
+        assert_eq!(
+            get_button_event(&mut buttons, 0) == Some(ButtonEvent::LeftButtonRelease),
+            true
+        );
     }
 }
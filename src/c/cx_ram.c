@@ -0,0 +1,6 @@
+// Scratch RAM of the cxlib parts linked into the app (Groestl uses it for
+// its permutation temporaries), the OS one not being reachable from user
+// space.
+#include "cx_ram.h"
+
+union cx_u G_cx;
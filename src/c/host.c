@@ -0,0 +1,21 @@
+// Symbols of link.ld for host builds (the `host` feature): the heap region
+// of src/arena.rs, and the bounds read by src/memory.rs. There is no .bss
+// of the app to measure, nor a stack canary to watch.
+
+#define HOST_HEAP_SIZE 8192
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+__asm__(
+    "  .bss\n"
+    "  .balign 16\n"
+    "  .globl _heap, _eheap, _bss, _ebss, app_stack_canary\n"
+    "_heap:\n"
+    "  .skip " XSTR(HOST_HEAP_SIZE) "\n"
+    "_eheap:\n"
+    "_bss:\n"
+    "_ebss:\n"
+    "app_stack_canary:\n"
+    "  .skip 4\n"
+    "  .text\n");
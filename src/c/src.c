@@ -11,65 +11,106 @@
 
 extern void sample_main();
 
+#ifdef HAVE_NO_THROW
+// There is no try context to unwind to: exceptions raised by the OS are
+// fatal, and setjmp/longjmp are not linked
+void os_longjmp(unsigned int exception) {
+  os_sched_exit((bolos_task_status_t) exception);
+  for(;;);
+}
+#else
 void os_longjmp(unsigned int exception) {
   longjmp(try_context_get()->jmp_buf, exception);
 }
+#endif
 
 io_seph_app_t G_io_app;
 
+// Callback of the asynchronous modal of the OS UX being displayed, such as a
+// BLE pairing request, called by the Rust UX event forwarding once it closes
+bolos_ux_asynch_callback_t G_io_asynch_ux_callback;
+
 #ifdef HAVE_CCID
  #include "usbd_ccid_if.h"
-uint8_t G_io_apdu_buffer[260];
 #endif
 
+// Only referenced by the C USB classes: every transport receives into the
+// buffer of Comm, which CCID is pointed at once Comm waits for a command.
+// CCID only falls back to this one for the answer to reset of a card power
+// on coming before, and u2f_transport_init is given it but ignores it.
+#if defined(HAVE_CCID) || defined(HAVE_IO_U2F)
+uint8_t G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+#endif
+
+// below is a 'manual' implementation of `io_seproxyhal_init`. The USB and
+// BLE links are only brought up if `init_links` is set: when looping back
+// after an EXCEPTION_IO_RESET, they stay up and only the APDU state is reset,
+// so that hosts do not see the device re-enumerate
+static void io_init(unsigned char init_links) {
+  check_api_level(CX_COMPAT_APILEVEL);
+#ifdef HAVE_MCU_PROTECT 
+  unsigned char c[4];
+  c[0] = SEPROXYHAL_TAG_MCU;
+  c[1] = 0;
+  c[2] = 1;
+  c[3] = SEPROXYHAL_TAG_MCU_TYPE_PROTECT;
+  io_seproxyhal_spi_send(c, 4);
+#endif
+  if (init_links) {
+#ifdef HAVE_BLE
+    unsigned int plane = G_io_app.plane_mode;
+#endif
+    memset(&G_io_app, 0, sizeof(G_io_app));
+#ifdef HAVE_BLE
+    G_io_app.plane_mode = plane;
+#endif
+  }
+
+  G_io_app.apdu_state = APDU_IDLE;
+  G_io_app.apdu_length = 0;
+  G_io_app.apdu_media = IO_APDU_MEDIA_NONE;
+
+  G_io_app.ms = 0;
+  io_usb_hid_init();
+
+  if (init_links) {
+    USB_power(0);
+    USB_power(1);
+#ifdef HAVE_CCID
+    io_usb_ccid_set_card_inserted(1);
+#endif
+
+#ifdef HAVE_BLE
+    LEDGER_BLE_init();
+#endif
+  }
+
+#if !defined(HAVE_BOLOS) && defined(HAVE_PENDING_REVIEW_SCREEN)
+  check_audited_app();
+#endif // !defined(HAVE_BOLOS) && defined(HAVE_PENDING_REVIEW_SCREEN)
+}
+
 int c_main(void) {
   __asm volatile("cpsie i");
 
   // formerly known as 'os_boot()'
   try_context_set(NULL);
 
+#ifdef HAVE_NO_THROW
+  // The Rust API only uses the _no_throw functions: run the app without
+  // setting up a try context
+  io_init(1);
+  sample_main();
+#else
+  // Set once the IO stack has been brought up (volatile as it is modified
+  // between setjmp and longjmp)
+  volatile unsigned char io_initialized = 0;
+
   for(;;) {
     BEGIN_TRY {
       TRY {
-        // below is a 'manual' implementation of `io_seproxyhal_init`
-        check_api_level(CX_COMPAT_APILEVEL);
-    #ifdef HAVE_MCU_PROTECT 
-        unsigned char c[4];
-        c[0] = SEPROXYHAL_TAG_MCU;
-        c[1] = 0;
-        c[2] = 1;
-        c[3] = SEPROXYHAL_TAG_MCU_TYPE_PROTECT;
-        io_seproxyhal_spi_send(c, 4);
-    #ifdef HAVE_BLE
-        unsigned int plane = G_io_app.plane_mode;
-    #endif
-    #endif
-        memset(&G_io_app, 0, sizeof(G_io_app));
-
-    #ifdef HAVE_BLE
-        G_io_app.plane_mode = plane;
-    #endif
-        G_io_app.apdu_state = APDU_IDLE;
-        G_io_app.apdu_length = 0;
-        G_io_app.apdu_media = IO_APDU_MEDIA_NONE;
-
-        G_io_app.ms = 0;
-        io_usb_hid_init();
-
-        USB_power(0);
-        USB_power(1);
-    #ifdef HAVE_CCID
-        io_usb_ccid_set_card_inserted(1);
-    #endif
-        
-    #ifdef HAVE_BLE 
-        LEDGER_BLE_init();
-    #endif
-
-    #if !defined(HAVE_BOLOS) && defined(HAVE_PENDING_REVIEW_SCREEN)
-        check_audited_app();
-    #endif // !defined(HAVE_BOLOS) && defined(HAVE_PENDING_REVIEW_SCREEN)
-
+        io_init(!io_initialized);
+        io_initialized = 1;
         sample_main();
       }
       CATCH(EXCEPTION_IO_RESET) {
@@ -83,5 +124,6 @@ int c_main(void) {
     }
     END_TRY;
   }
+#endif
   return 0;
 }
@@ -0,0 +1,3 @@
+#pragma once
+
+// Nothing beyond u2f_transport.h is needed by usbd_impl.c
@@ -0,0 +1,4 @@
+#pragma once
+
+// State of the FIDO transport, defined in src/u2f.rs
+typedef struct u2f_service_s u2f_service_t;
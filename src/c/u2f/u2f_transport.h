@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include "u2f_service.h"
+
+typedef enum {
+  U2F_MEDIA_NONE,
+  U2F_MEDIA_USB,
+  U2F_MEDIA_NFC,
+  U2F_MEDIA_BLE,
+} u2f_transport_media_t;
+
+// Implemented in src/u2f.rs
+void u2f_transport_init(u2f_service_t *service, uint8_t *message_buffer, uint16_t message_buffer_length);
+void u2f_transport_received(u2f_service_t *service, uint8_t *buffer, uint16_t size, u2f_transport_media_t media);
+void u2f_transport_sent(u2f_service_t *service, u2f_transport_media_t media);
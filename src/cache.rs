@@ -0,0 +1,197 @@
+//! Cache of the responses to idempotent commands
+//!
+//! Hosts send the same commands over and over when connecting, such as
+//! the version or the configuration of the app, or the public key of an
+//! account. Once a [`ResponseCache`] is attached to a
+//! [`Comm`](crate::io::Comm), the successful responses to the
+//! instructions marked as cacheable are kept, and a command identical to
+//! one of them is answered while receiving it, without being returned to
+//! the app:
+//!
+//! ```
+//! static mut CACHE: ResponseCache<4, 96> = ResponseCache::new();
+//!
+//! let cache = unsafe { &mut *core::ptr::addr_of_mut!(CACHE) };
+//! cache.set_cacheable(INS_GET_VERSION);
+//! cache.set_cacheable(INS_GET_PUBKEY);
+//! comm.set_response_cache(cache);
+//! ```
+//!
+//! Only instructions whose response depends on nothing but the command, and
+//! which do not ask the user for approval, may be cached. Apps must call
+//! [`Comm::clear_response_cache`](crate::io::Comm::clear_response_cache)
+//! when this is no longer true, for instance when a setting changes.
+
+/// Response lookups done by [`Comm`](crate::io::Comm) when a cache is
+/// attached to it
+pub trait ResponseStore {
+    /// Called when the `command` held in the first `rx` bytes of `apdu` has
+    /// been received. Returns the length of the cached response written to
+    /// `apdu`, if any.
+    fn on_command(&mut self, apdu: &mut [u8], rx: usize) -> Option<usize>;
+
+    /// Called with the response to the last command before it is sent,
+    /// status word included
+    fn on_reply(&mut self, response: &[u8]);
+
+    /// Drop all the responses
+    fn clear(&mut self);
+}
+
+const NONE: u8 = u8::MAX;
+
+/// FNV-1a, to compare commands quickly
+fn fnv1a(data: &[u8]) -> u32 {
+    data.iter()
+        .fold(0x811c9dc5, |h, &b| (h ^ b as u32).wrapping_mul(0x01000193))
+}
+
+#[derive(Copy, Clone)]
+struct Entry<const S: usize> {
+    hash: u32,
+    command_len: u16,
+    /// 0 while the entry is empty or its command is being processed
+    response_len: u16,
+    /// Command followed by the response
+    data: [u8; S],
+}
+
+/// Up to `E` responses, stored along with their command in `S` bytes each.
+/// Once they are all used, entries are replaced in a round-robin fashion.
+pub struct ResponseCache<const E: usize, const S: usize> {
+    /// Bit set of the cacheable instructions
+    cacheable: [u32; 8],
+    entries: [Entry<S>; E],
+    /// Entry holding the command being processed, if it is cacheable
+    pending: u8,
+    /// Next entry to replace
+    next: u8,
+}
+
+impl<const E: usize, const S: usize> Default for ResponseCache<E, S> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const E: usize, const S: usize> ResponseCache<E, S> {
+    pub const fn new() -> Self {
+        assert!(E < NONE as usize && S <= u16::MAX as usize);
+        ResponseCache {
+            cacheable: [0; 8],
+            entries: [Entry {
+                hash: 0,
+                command_len: 0,
+                response_len: 0,
+                data: [0; S],
+            }; E],
+            pending: NONE,
+            next: 0,
+        }
+    }
+
+    /// Cache the responses to instruction `ins`
+    pub fn set_cacheable(&mut self, ins: u8) {
+        self.cacheable[ins as usize / 32] |= 1 << (ins % 32);
+    }
+
+    fn is_cacheable(&self, ins: u8) -> bool {
+        self.cacheable[ins as usize / 32] & (1 << (ins % 32)) != 0
+    }
+}
+
+impl<const E: usize, const S: usize> ResponseStore for ResponseCache<E, S> {
+    fn on_command(&mut self, apdu: &mut [u8], rx: usize) -> Option<usize> {
+        self.pending = NONE;
+        if E == 0 || rx < 2 || rx >= S || !self.is_cacheable(apdu[1]) {
+            return None;
+        }
+        let command = &apdu[..rx];
+        let hash = fnv1a(command);
+        for e in self.entries.iter() {
+            let (c, r) = (e.command_len as usize, e.response_len as usize);
+            if r != 0 && e.hash == hash && c == rx && &e.data[..c] == command {
+                if r > apdu.len() {
+                    return None;
+                }
+                apdu[..r].copy_from_slice(&e.data[c..c + r]);
+                return Some(r);
+            }
+        }
+        // Keep the command until its response is known, in a free entry if
+        // there is one
+        let i = match self.entries.iter().position(|e| e.response_len == 0) {
+            Some(i) => i,
+            None => {
+                let i = self.next as usize;
+                self.next = ((i + 1) % E) as u8;
+                i
+            }
+        };
+        let e = &mut self.entries[i];
+        e.hash = hash;
+        e.command_len = rx as u16;
+        e.response_len = 0;
+        e.data[..rx].copy_from_slice(command);
+        self.pending = i as u8;
+        None
+    }
+
+    fn on_reply(&mut self, response: &[u8]) {
+        let i = core::mem::replace(&mut self.pending, NONE);
+        if i == NONE || !response.ends_with(&[0x90, 0x00]) {
+            return;
+        }
+        let e = &mut self.entries[i as usize];
+        let c = e.command_len as usize;
+        if c + response.len() <= S {
+            e.data[c..c + response.len()].copy_from_slice(response);
+            e.response_len = response.len() as u16;
+        }
+    }
+
+    fn clear(&mut self) {
+        for e in self.entries.iter_mut() {
+            e.response_len = 0;
+        }
+        self.pending = NONE;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn cached_responses() {
+        let mut cache = ResponseCache::<2, 32>::new();
+        cache.set_cacheable(0x02);
+        let mut apdu = [0u8; 32];
+        let command = [0xe0, 0x02, 0, 0, 1, 7];
+        apdu[..6].copy_from_slice(&command);
+
+        // Miss, then the response is stored
+        assert_eq!(cache.on_command(&mut apdu, 6), None);
+        cache.on_reply(&[0xaa, 0xbb, 0x90, 0x00]);
+        apdu[..6].copy_from_slice(&command);
+        assert_eq!(cache.on_command(&mut apdu, 6), Some(4));
+        assert_eq!(&apdu[..4], &[0xaa, 0xbb, 0x90, 0x00]);
+
+        // Other data, errors and other instructions are not served
+        apdu[..6].copy_from_slice(&[0xe0, 0x02, 0, 0, 1, 8]);
+        assert_eq!(cache.on_command(&mut apdu, 6), None);
+        cache.on_reply(&[0x6e, 0x01]);
+        apdu[..6].copy_from_slice(&[0xe0, 0x02, 0, 0, 1, 8]);
+        assert_eq!(cache.on_command(&mut apdu, 6), None);
+        apdu[..4].copy_from_slice(&[0xe0, 0x04, 0, 0]);
+        assert_eq!(cache.on_command(&mut apdu, 4), None);
+        cache.on_reply(&[0x90, 0x00]);
+
+        cache.clear();
+        apdu[..6].copy_from_slice(&command);
+        assert_eq!(cache.on_command(&mut apdu, 6), None);
+    }
+}
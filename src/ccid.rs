@@ -1,11 +1,16 @@
 extern "C" {
-    pub static mut G_io_apdu_buffer: [u8; 260];
+    pub fn io_usb_ccid_set_buffer(buffer: *mut u8, size: u16);
     pub fn io_usb_ccid_reply_bare(length: u16);
 }
 
-pub fn send(buf: &[u8]) {
+/// Send the response held in the first `len` bytes of `buf`.
+///
+/// The response is streamed from `buf` in place, and chained over several
+/// CCID messages when it is longer than a single block. `buf` is also where
+/// the next command is received.
+pub fn send(buf: &mut [u8], len: usize) {
     unsafe {
-        G_io_apdu_buffer[..buf.len()].copy_from_slice(buf);
-        io_usb_ccid_reply_bare(buf.len() as u16);
+        io_usb_ccid_set_buffer(buf.as_mut_ptr(), buf.len() as u16);
+        io_usb_ccid_reply_bare(len as u16);
     }
 }
@@ -0,0 +1,121 @@
+//! Responses longer than the APDU buffer, chained with GET RESPONSE
+//!
+//! As per ISO 7816-4, a response which does not fit in one exchange is
+//! sent a page at a time: each page but the last one ends with the status
+//! word `61xx`, `xx` being the number of bytes left (`00` for 256 or more),
+//! and the host asks for the next one with the GET RESPONSE command,
+//! `CLA C0 00 00 Le`.
+//!
+//! The app hands the whole response over to
+//! [`Comm::reply_chained`](crate::io::Comm::reply_chained), as a
+//! [`ResponseSource`], and the following GET RESPONSE commands are answered
+//! by [`Comm`](crate::io::Comm) while receiving them, without being
+//! returned to the app. Any other command drops what is left of the
+//! response.
+//!
+//! ```
+//! static mut CHAIN: SliceSource = SliceSource::new(&[]);
+//!
+//! let chain = unsafe { &mut *core::ptr::addr_of_mut!(CHAIN) };
+//! *chain = SliceSource::new(CERTIFICATES);
+//! comm.reply_chained(chain, StatusWords::Ok);
+//! ```
+
+/// Instruction byte of GET RESPONSE
+pub const INS_GET_RESPONSE: u8 = 0xc0;
+
+/// Data of a chained response, read a page at a time
+pub trait ResponseSource {
+    /// Write the next bytes of the response into `out`, as many as fit or
+    /// are left, and return their number
+    fn read(&mut self, out: &mut [u8]) -> usize;
+
+    /// Number of bytes of the response which have not been read yet
+    fn remaining(&self) -> usize;
+}
+
+/// Response held in a slice, such as certificates stored in flash
+pub struct SliceSource {
+    data: &'static [u8],
+}
+
+impl SliceSource {
+    pub const fn new(data: &'static [u8]) -> Self {
+        SliceSource { data }
+    }
+}
+
+impl ResponseSource for SliceSource {
+    fn read(&mut self, out: &mut [u8]) -> usize {
+        let n = out.len().min(self.data.len());
+        out[..n].copy_from_slice(&self.data[..n]);
+        self.data = &self.data[n..];
+        n
+    }
+
+    fn remaining(&self) -> usize {
+        self.data.len()
+    }
+}
+
+/// Status word of a page followed by `remaining` more bytes
+pub(crate) fn more_data(remaining: usize) -> u16 {
+    0x6100 | remaining.min(256) as u8 as u16
+}
+
+/// Number of response bytes expected by the GET RESPONSE command held in
+/// the first `rx` bytes of `apdu`, or `None` if it is another command
+pub(crate) fn get_response_le(apdu: &[u8], rx: usize) -> Option<usize> {
+    if rx < 4 || apdu[1] != INS_GET_RESPONSE || apdu[2] != 0 || apdu[3] != 0 {
+        return None;
+    }
+    Some(match rx {
+        // Short Le, 0 standing for 256
+        5 if apdu[4] != 0 => apdu[4] as usize,
+        // Extended Le, 0 standing for 65536
+        7 if apdu[4] == 0 => match u16::from_be_bytes([apdu[5], apdu[6]]) {
+            0 => 65536,
+            le => le as usize,
+        },
+        _ => 256,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn pages() {
+        static DATA: [u8; 600] = [0x5a; 600];
+        let mut source = SliceSource::new(&DATA);
+        let mut page = [0u8; 256];
+        assert_eq!(source.read(&mut page), 256);
+        assert_eq!(more_data(source.remaining()), 0x6100);
+        assert_eq!(source.read(&mut page), 256);
+        assert_eq!(more_data(source.remaining()), 0x6158);
+        assert_eq!(source.read(&mut page), 88);
+        assert_eq!(source.remaining(), 0);
+        assert_eq!(source.read(&mut page), 0);
+    }
+
+    #[test]
+    fn get_response() {
+        let mut apdu = [0x00, INS_GET_RESPONSE, 0, 0, 0x40, 0, 0];
+        assert_eq!(get_response_le(&apdu, 5), Some(0x40));
+        assert_eq!(get_response_le(&apdu, 4), Some(256));
+        apdu[4] = 0;
+        assert_eq!(get_response_le(&apdu, 5), Some(256));
+        assert_eq!(get_response_le(&apdu, 7), Some(65536));
+        apdu[5] = 0x04;
+        assert_eq!(get_response_le(&apdu, 7), Some(1024));
+        apdu[2] = 1;
+        assert_eq!(get_response_le(&apdu, 5), None);
+        apdu[2] = 0;
+        apdu[1] = 0xb0;
+        assert_eq!(get_response_le(&apdu, 5), None);
+    }
+}
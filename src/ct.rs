@@ -0,0 +1,133 @@
+//! Constant-time comparison, XOR and clearing of byte strings
+//!
+//! `os_secure_memcmp` and the cxlib helpers go through the data one byte at
+//! a time. The functions below process 32-bit words instead, aligned on the
+//! first operand, with the unaligned head and tail handled byte by byte.
+//! Loads from the second operand are unaligned: single instructions on
+//! Cortex-M33 and M3, split into byte loads by the compiler on Cortex-M0.
+
+use core::hint::black_box;
+use core::ptr::write_volatile;
+use core::sync::atomic::{compiler_fence, Ordering};
+
+const WORD: usize = core::mem::size_of::<u32>();
+
+#[inline(always)]
+fn load(b: &[u8]) -> u32 {
+    u32::from_ne_bytes([b[0], b[1], b[2], b[3]])
+}
+
+/// Whether `a` and `b` are equal, in a time which only depends on their
+/// lengths
+#[optimize(speed)]
+pub fn ct_eq(a: &[u8], b: &[u8]) -> bool {
+    if a.len() != b.len() {
+        return false;
+    }
+    // Any bit pattern is a valid u32
+    let (head, words, tail) = unsafe { a.align_to::<u32>() };
+    let (b_head, rest) = b.split_at(head.len());
+    let (b_words, b_tail) = rest.split_at(words.len() * WORD);
+
+    let mut diff = head
+        .iter()
+        .zip(b_head)
+        .chain(tail.iter().zip(b_tail))
+        .fold(0u32, |diff, (x, y)| diff | (x ^ y) as u32);
+    for (w, c) in words.iter().zip(b_words.chunks_exact(WORD)) {
+        diff |= w ^ load(c);
+    }
+    // Keep the compiler from turning the accumulation into early exits
+    black_box(diff) == 0
+}
+
+/// Whether `a < b`, both being big-endian integers of the same length, in a
+/// time which only depends on their length
+pub fn ct_lt(a: &[u8], b: &[u8]) -> bool {
+    assert_eq!(a.len(), b.len());
+    // Borrow of `a - b`, from the least significant byte up
+    let borrow = a.iter().zip(b).rev().fold(0u32, |borrow, (&x, &y)| {
+        ((x as u32).wrapping_sub(y as u32).wrapping_sub(borrow) >> 8) & 1
+    });
+    black_box(borrow) == 1
+}
+
+/// `dst ^= src`, over the length of the shorter of the two
+#[optimize(speed)]
+pub fn xor_into(dst: &mut [u8], src: &[u8]) {
+    let n = dst.len().min(src.len());
+    // Any bit pattern is a valid u32
+    let (head, words, tail) = unsafe { dst[..n].align_to_mut::<u32>() };
+    let (src_head, rest) = src[..n].split_at(head.len());
+    let (src_words, src_tail) = rest.split_at(words.len() * WORD);
+
+    head.iter_mut().zip(src_head).for_each(|(d, s)| *d ^= s);
+    words
+        .iter_mut()
+        .zip(src_words.chunks_exact(WORD))
+        .for_each(|(d, s)| *d ^= load(s));
+    tail.iter_mut().zip(src_tail).for_each(|(d, s)| *d ^= s);
+}
+
+/// Clear `buf`, which holds a secret, with volatile stores the compiler
+/// cannot remove even though the buffer is not read afterwards
+pub fn zeroize(buf: &mut [u8]) {
+    // Any bit pattern is a valid u32
+    let (head, words, tail) = unsafe { buf.align_to_mut::<u32>() };
+    unsafe {
+        head.iter_mut()
+            .chain(tail.iter_mut())
+            .for_each(|b| write_volatile(b, 0));
+        words.iter_mut().for_each(|w| write_volatile(w, 0));
+    }
+    // Nor move the stores after whatever reuses the memory
+    compiler_fence(Ordering::SeqCst);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn unaligned() {
+        let mut a = [0u8; 40];
+        a.iter_mut().enumerate().for_each(|(i, b)| *b = i as u8);
+        let mut b = [0u8; 41];
+        b[1..].copy_from_slice(&a);
+
+        // Every alignment of each operand, and every word boundary of a diff
+        for off in 0..4 {
+            assert_eq!(ct_eq(&a[off..], &b[off + 1..]), true);
+            for i in off..a.len() {
+                b[i + 1] ^= 0x80;
+                assert_eq!(ct_eq(&a[off..], &b[off + 1..]), false);
+                b[i + 1] ^= 0x80;
+            }
+        }
+        assert_eq!(ct_eq(&a, &b[..40]), false);
+        assert_eq!(ct_eq(&a, &b), false);
+
+        assert_eq!(ct_lt(&[1, 0xff], &[2, 0]), true);
+        assert_eq!(ct_lt(&[2, 0], &[2, 0]), false);
+        assert_eq!(ct_lt(&[2, 1], &[1, 0xff]), false);
+
+        let mut c = a;
+        xor_into(&mut c[3..], &b[1..]);
+        assert_eq!(&c[..3], &a[..3]);
+        for (i, &x) in c[3..].iter().enumerate() {
+            assert_eq!(x, a[i + 3] ^ a[i]);
+        }
+    }
+
+    #[test]
+    fn clear() {
+        let mut buf = [0xa5u8; 23];
+        zeroize(&mut buf[1..22]);
+        assert_eq!(buf[0], 0xa5);
+        assert_eq!(buf[1..22].iter().all(|&b| b == 0), true);
+        assert_eq!(buf[22], 0xa5);
+    }
+}
@@ -1,7 +1,43 @@
 use crate::bindings::*;
-use core::hint::black_box;
-
+use crate::bn::BnArena;
+use crate::ct::zeroize;
+use crate::hash::{HashFn, Ripemd160, Sha256};
+
+mod addresses;
+mod batch;
+mod bls12381;
+mod ed25519;
+mod hash_to_curve;
+mod musig2;
+mod nonce_pool;
+mod pasta;
+mod path;
+mod point;
+mod prepared;
+mod rfc6979;
 mod stark;
+mod verified;
+mod x25519;
+
+pub use addresses::{hash160_address, keccak_address, AddressStream};
+pub use batch::{EcdsaBatchItem, EddsaBatchItem};
+pub use bls12381::{bls_public_key, bls_sign, BLS_DST_POP, BLS_PK_LEN, BLS_SIG_LEN};
+pub use ed25519::{ExpandedEd25519Key, SignStream, ED25519_SIG_LEN};
+pub use hash_to_curve::{expand_message_xmd, HashToCurveSuite, XmdHash};
+pub use musig2::{nonce_agg, KeyAggContext, PubNonce, SecNonce, Session};
+pub use nonce_pool::NoncePool;
+pub use pasta::{
+    sinsemilla_hash, sinsemilla_hash_to_point, Pallas, PastaCurve, PastaFe, PastaField, PastaFp,
+    PastaFq, PastaPoint, Poseidon, PoseidonParams, Vesta, POSEIDON_WIDTH, SINSEMILLA_K,
+    SINSEMILLA_MAX_BITS,
+};
+pub use path::{Bip32Path, PathError, PathPolicy, MAX_BIP32_PATH};
+pub use point::{EcPoint, FixedBaseTable, COMB_POINTS};
+pub use prepared::PreparedPublicKey;
+pub use rfc6979::Rfc6979Nonce;
+pub use stark::{Felt, PedersenHash, STARK_FIELD_PRIME};
+pub use verified::VerifiedCache;
+pub use x25519::{X25519, X448};
 
 #[repr(u8)]
 #[derive(Copy, Clone)]
@@ -192,11 +228,16 @@ impl<const N: usize, const TY: char> Default for ECPrivateKey<N, TY> {
 impl<const N: usize, const TY: char> Drop for ECPrivateKey<N, TY> {
     #[inline(never)]
     fn drop(&mut self) {
-        self.key.fill_with(|| 0);
-        self.key = black_box(self.key);
+        zeroize(&mut self.key);
     }
 }
 
+/// Size of the DER encoding of an ECDSA signature with `n`-byte scalars
+const fn der_signature_len(n: usize) -> usize {
+    let content = 2 * (2 + n + 1);
+    content + if content > 127 { 3 } else { 2 }
+}
+
 /// This is the most generic implementation for ECPrivateKey.
 /// It provides a way to create a new private key structure
 /// by specifying its length (const parameter `N`), and its
@@ -207,8 +248,13 @@ impl<const N: usize, const TY: char> ECPrivateKey<N, TY> {
     /// Size of the public key relative to the private key's size
     pub const P: usize = 2 * N + 1;
 
-    /// Size of the encoded signature relative to the private key's size
-    pub const S: usize = 6 + 2 * (N + 1);
+    /// Size of the encoded signature relative to the private key's size:
+    /// two DER integers of up to `N + 1` bytes, in a sequence whose length
+    /// takes a second byte above 127 (P-521, 512-bit Brainpool curves)
+    pub const S: usize = der_signature_len(N);
+
+    /// Size of the compressed public key relative to the private key's size
+    pub const C: usize = N + 1;
 
     /// Create a new private key from a curve identifier and with a given
     /// length and type. The preferred way to create a key is by using
@@ -240,6 +286,7 @@ impl<const N: usize, const TY: char> ECPrivateKey<N, TY> {
         [(); Self::P]:,
     {
         let mut pubkey = ECPublicKey::<{ Self::P }, TY>::new(self.curve);
+        crate::cx_profile!("cx_ecfp_generate_pair");
         let err = unsafe {
             cx_ecfp_generate_pair_no_throw(
                 self.curve as u8,
@@ -269,7 +316,25 @@ impl<const N: usize> ECPrivateKey<N, 'W'> {
         mode: u32,
     ) -> Result<([u8; Self::S], u32, u32), CxError> {
         let mut sig = [0u8; Self::S];
-        let mut sig_len = Self::S as u32;
+        let (sig_len, parity) = self.ecdsa_sign_into(hash, hash_id, mode, &mut sig)?;
+        Ok((sig, sig_len, parity))
+    }
+
+    /// Same as `ecdsa_sign`, writing the signature into `sig`, which holds
+    /// at least `Self::S` bytes. Returns the signature length and parity.
+    fn ecdsa_sign_into(
+        &self,
+        hash: &[u8],
+        hash_id: u8,
+        mode: u32,
+        sig: &mut [u8],
+    ) -> Result<(u32, u32), CxError> {
+        if sig.len() < Self::S {
+            return Err(CxError::InvalidParameterSize);
+        }
+        crate::trace_span!("cx_ecdsa_sign");
+        crate::cx_profile!("cx_ecdsa_sign");
+        let mut sig_len = sig.len() as u32;
         let mut info = 0;
         let len = unsafe {
             cx_ecdsa_sign_no_throw(
@@ -286,21 +351,59 @@ impl<const N: usize> ECPrivateKey<N, 'W'> {
         if len != CX_OK {
             Err(len.into())
         } else {
-            Ok((sig, sig_len, info & CX_ECCINFO_PARITY_ODD))
+            Ok((sig_len, info & CX_ECCINFO_PARITY_ODD))
         }
     }
 
+    /// Hash function used to compute RFC6979 nonces for this key size,
+    /// resolved at compile time as `keylength` is always `N`
+    const RFC6979_HASH_ID: u8 = match N {
+        0..=32 => CX_SHA256,
+        33..=48 => CX_SHA384,
+        _ => CX_SHA512,
+    };
+
     /// Sign a message/hash using ECDSA with RFC6979, which provides a deterministic nonce rather than
     /// a random one. This nonce is computed using a hash function, hence this function uses an
     /// additional parameter `hash_id` that specifies which one it should use.
     pub fn deterministic_sign(&self, hash: &[u8]) -> Result<([u8; Self::S], u32, u32), CxError> {
-        let hash_id = match self.keylength {
-            x if x <= 32 => CX_SHA256,
-            x if x <= 48 => CX_SHA384,
-            x if x <= 64 => CX_SHA512,
-            _ => CX_BLAKE2B,
-        };
-        self.ecdsa_sign(hash, hash_id, CX_RND_RFC6979 | CX_LAST)
+        self.ecdsa_sign(hash, Self::RFC6979_HASH_ID, CX_RND_RFC6979 | CX_LAST)
+    }
+
+    /// Same as [`deterministic_sign`], writing the DER signature straight into
+    /// `out`, typically the APDU buffer, which holds at least `Self::S` bytes.
+    /// Returns the signature length and parity.
+    pub fn deterministic_sign_into(
+        &self,
+        hash: &[u8],
+        out: &mut [u8],
+    ) -> Result<(u32, u32), CxError> {
+        self.ecdsa_sign_into(hash, Self::RFC6979_HASH_ID, CX_RND_RFC6979 | CX_LAST, out)
+    }
+
+    /// Sign each of `hashes` with [`deterministic_sign`], writing the
+    /// signatures (DER signature, length, parity) into the corresponding
+    /// entries of `out`, which must be at least as long as `hashes`.
+    ///
+    /// This avoids moving a fresh signature buffer for each hash when signing
+    /// many inputs of a transaction with the same key. Signing stops at the
+    /// first error.
+    pub fn sign_many(
+        &self,
+        hashes: &[&[u8]],
+        out: &mut [([u8; Self::S], u32, u32)],
+    ) -> Result<(), CxError> {
+        if out.len() < hashes.len() {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let hash_id = Self::RFC6979_HASH_ID;
+        for (hash, sig) in hashes.iter().zip(out.iter_mut()) {
+            let (len, parity) =
+                self.ecdsa_sign_into(hash, hash_id, CX_RND_RFC6979 | CX_LAST, &mut sig.0)?;
+            sig.1 = len;
+            sig.2 = parity;
+        }
+        Ok(())
     }
 
     /// Sign a message/hash using ECDSA in its original form
@@ -308,26 +411,199 @@ impl<const N: usize> ECPrivateKey<N, 'W'> {
         self.ecdsa_sign(hash, 0, CX_RND_TRNG | CX_LAST)
     }
 
-    /// Perform a Diffie-Hellman key exchange using the given uncompressed point `p`.
+    /// Same as [`sign`], writing the DER signature into `out`
+    pub fn sign_into(&self, hash: &[u8], out: &mut [u8]) -> Result<(u32, u32), CxError> {
+        self.ecdsa_sign_into(hash, 0, CX_RND_TRNG | CX_LAST, out)
+    }
+
+    /// Write the uncompressed public key `04 || x || y` into `out`, which
+    /// holds at least `Self::P` bytes, without building an [`ECPublicKey`].
+    /// Returns its length.
+    pub fn public_key_into(&self, out: &mut [u8]) -> Result<usize, CxError> {
+        if out.len() < Self::P {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let arena = BnArena::lock(N)?;
+        let mut point = EcPoint::generator(&arena, self.curve)?;
+        point.scalarmul(&self.key)?;
+        let (x, y) = out[1..Self::P].split_at_mut(N);
+        point.export(x, y)?;
+        out[0] = 0x04;
+        Ok(Self::P)
+    }
+
+    /// Retrieve the public key corresponding to the private key, in the
+    /// SEC1 compressed form `02|03 || x`
+    pub fn public_key_compressed(&self) -> Result<[u8; Self::C], CxError>
+    where
+        [(); Self::P]:,
+        [(); Self::C]:,
+    {
+        let pk = self.public_key()?;
+        let mut compressed = [0u8; Self::C];
+        compressed[0] = 0x02 | (pk.pubkey[2 * N] & 1);
+        compressed[1..].copy_from_slice(&pk.pubkey[1..N + 1]);
+        Ok(compressed)
+    }
+
+    /// Perform a Diffie-Hellman key exchange using the given point `p`,
+    /// uncompressed or compressed.
     /// Return the generated shared secret.
     /// We suppose the group size `N` is the same as the shared secret size.
-    pub fn ecdh(&self, p: &[u8]) -> Result<[u8; N], CxError> {
+    pub fn ecdh(&self, p: &[u8]) -> Result<[u8; N], CxError>
+    where
+        [(); Self::P]:,
+    {
+        let uncompressed;
+        let p = if p.len() == Self::C {
+            uncompressed = ECPublicKey::<{ Self::P }, 'W'>::from_compressed(self.curve, p)?;
+            &uncompressed.pubkey[..]
+        } else {
+            p
+        };
         let mut secret = [0u8; N];
+        self.ecdh_into(p, &mut secret)?;
+        Ok(secret)
+    }
+
+    /// Same as [`ecdh`] for an uncompressed point `p`, writing the shared
+    /// secret into the first `N` bytes of `out`
+    pub fn ecdh_into(&self, p: &[u8], out: &mut [u8]) -> Result<(), CxError> {
+        if out.len() < N {
+            return Err(CxError::InvalidParameterSize);
+        }
+        crate::cx_profile!("cx_ecdh");
         let len = unsafe {
             cx_ecdh_no_throw(
                 self as *const ECPrivateKey<N, 'W'> as *const ECCKeyRaw,
                 CX_ECDH_X,
                 p.as_ptr(),
                 p.len() as u32,
-                secret.as_mut_ptr(),
+                out.as_mut_ptr(),
                 N as u32,
             )
         };
         if len != CX_OK {
             Err(len.into())
         } else {
-            Ok(secret)
+            Ok(())
+        }
+    }
+}
+
+/// Length of a BIP340 Schnorr signature
+pub const SCHNORR_SIG_LEN: usize = 64;
+
+/// BIP340 Schnorr signatures and BIP341 key tweaking, for secp256k1 keys
+impl ECPrivateKey<32, 'W'> {
+    fn schnorr_sign_into(
+        &self,
+        msg: &[u8],
+        mode: u32,
+        sig: &mut [u8; SCHNORR_SIG_LEN],
+    ) -> Result<(), CxError> {
+        let mut sig_len = SCHNORR_SIG_LEN as size_t;
+        crate::cx_profile!("cx_ecschnorr_sign");
+        let err = unsafe {
+            cx_ecschnorr_sign_no_throw(
+                self as *const ECPrivateKey<32, 'W'> as *const cx_ecfp_private_key_t,
+                CX_ECSCHNORR_BIP0340 | mode,
+                CX_SHA256,
+                msg.as_ptr(),
+                msg.len() as size_t,
+                sig.as_mut_ptr(),
+                &mut sig_len,
+            )
+        };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Sign the 32-byte message `msg` with BIP340, using random auxiliary
+    /// data. Returns the 64-byte `r || s` signature.
+    pub fn schnorr_sign(&self, msg: &[u8]) -> Result<[u8; SCHNORR_SIG_LEN], CxError> {
+        let mut sig = [0u8; SCHNORR_SIG_LEN];
+        self.schnorr_sign_into(msg, CX_RND_TRNG, &mut sig)?;
+        Ok(sig)
+    }
+
+    /// Same as [`schnorr_sign`] with the given auxiliary data `aux`
+    pub fn schnorr_sign_with_aux(
+        &self,
+        msg: &[u8],
+        aux: &[u8; 32],
+    ) -> Result<[u8; SCHNORR_SIG_LEN], CxError> {
+        // The auxiliary data is given in the signature buffer
+        let mut sig = [0u8; SCHNORR_SIG_LEN];
+        sig[..32].copy_from_slice(aux);
+        self.schnorr_sign_into(msg, CX_RND_PROVIDED, &mut sig)?;
+        Ok(sig)
+    }
+
+    /// Sign each of `msgs` with [`schnorr_sign`], writing the signatures
+    /// into the corresponding entries of `out`, which must be at least as
+    /// long as `msgs`. Signing stops at the first error.
+    ///
+    /// Taproot inputs spent with the same key are signed with the tweaked
+    /// key computed once by [`taproot_tweak`].
+    pub fn schnorr_sign_many(
+        &self,
+        msgs: &[&[u8]],
+        out: &mut [[u8; SCHNORR_SIG_LEN]],
+    ) -> Result<(), CxError> {
+        if out.len() < msgs.len() {
+            return Err(CxError::InvalidParameterSize);
+        }
+        for (msg, sig) in msgs.iter().zip(out.iter_mut()) {
+            self.schnorr_sign_into(msg, CX_RND_TRNG, sig)?;
+        }
+        Ok(())
+    }
+
+    /// BIP341 tweaked key, for the key path spend of an output committing
+    /// to the script tree `merkle_root`, or to no script at all.
+    ///
+    /// The key is negated first if its public key has an odd `y`, so that
+    /// signatures verify against the x-only output key.
+    pub fn taproot_tweak(&self, merkle_root: Option<&[u8; 32]>) -> Result<Self, CxError> {
+        if !matches!(self.curve, CurvesId::Secp256k1) {
+            return Err(CxError::InvalidCurve);
+        }
+        let pk = self.public_key()?;
+
+        // t = tagged_hash("TapTweak", x || merkle_root)
+        let mut h = Sha256::tagged(b"TapTweak")?;
+        h.update(&pk.pubkey[1..33])?;
+        if let Some(root) = merkle_root {
+            h.update(root)?;
+        }
+        let t = h.finalize()?;
+
+        let mut tweaked = ECPrivateKey::<32, 'W'>::new(self.curve);
+        {
+            let arena = BnArena::lock(32)?;
+            let n = arena.alloc_init(32, &SECP256K1_ORDER)?;
+            let t = arena.alloc_init(32, &t)?;
+            if t.compare(&n)? != core::cmp::Ordering::Less {
+                return Err(CxError::InvalidParameterValue);
+            }
+            let mut d = arena.alloc_init(32, &self.key)?;
+            if pk.pubkey[64] & 1 == 1 {
+                let mut neg = arena.alloc(32)?;
+                neg.sub(&n, &d)?;
+                d = neg;
+            }
+            let mut r = arena.alloc(32)?;
+            r.mod_add(&d, &t, &n)?;
+            r.export(&mut tweaked.key)?;
+        }
+        if tweaked.key.iter().all(|&b| b == 0) {
+            return Err(CxError::InvalidParameterValue);
         }
+        Ok(tweaked)
     }
 }
 
@@ -336,35 +612,47 @@ impl<const N: usize> ECPrivateKey<N, 'E'> {
     /// Size of an Edwards curve public key relative to the private key size
     pub const EP: usize = 2 * N;
 
+    /// Hash function of EdDSA for this key size: SHA-512 for Ed25519,
+    /// SHAKE256 for Ed448 (RFC 8032)
+    const EDDSA_HASH_ID: u8 = if N <= 32 { CX_SHA512 } else { CX_SHAKE256 };
+
     pub fn sign(&self, hash: &[u8]) -> Result<([u8; Self::EP], u32), CxError> {
         let mut sig = [0u8; Self::EP];
+        let sig_len = self.sign_into(hash, &mut sig)?;
+        Ok((sig, sig_len))
+    }
+
+    /// Same as [`sign`](ECPrivateKey::sign), writing the signature into
+    /// `out`, which holds at least `Self::EP` bytes. Returns its length.
+    pub fn sign_into(&self, hash: &[u8], out: &mut [u8]) -> Result<u32, CxError> {
+        if out.len() < Self::EP {
+            return Err(CxError::InvalidParameterSize);
+        }
         let sig_len = Self::EP as u32;
-        let hash_id = match self.keylength {
-            x if x <= 32 => CX_SHA512,
-            _ => CX_BLAKE2B,
-        };
+        crate::cx_profile!("cx_eddsa_sign");
         let len = unsafe {
             cx_eddsa_sign_no_throw(
                 self as *const ECPrivateKey<N, 'E'> as *const ECCKeyRaw,
-                hash_id,
+                Self::EDDSA_HASH_ID,
                 hash.as_ptr(),
                 hash.len() as u32,
-                sig.as_mut_ptr(),
+                out.as_mut_ptr(),
                 sig_len,
             )
         };
         if len != CX_OK {
             Err(len.into())
         } else {
-            Ok((sig, sig_len))
+            Ok(sig_len)
         }
     }
 }
 
 /// General implementation for a public key.
 impl<const P: usize, const TY: char> ECPublicKey<P, TY> {
-    /// Size of a signature relative to the public key's size
-    pub const S: usize = 7 + P; // 6 + 2*(N+1)  and S = 2*N + 1
+    /// Size of a signature relative to the public key's size, `P` being
+    /// `2 * N + 1`
+    pub const S: usize = der_signature_len((P - 1) / 2);
 
     /// Creates a new ECPublicKey structure from a curve identifier
     pub fn new(curve_id: CurvesId) -> ECPublicKey<P, TY> {
@@ -393,7 +681,44 @@ impl<const P: usize, const TY: char> From<ECPublicKey<P, TY>> for [u8; P] {
 /// Specific signature verification for Weierstrass curves, which
 /// all use ECDSA.
 impl<const P: usize> ECPublicKey<P, 'W'> {
+    /// Size of the compressed public key
+    pub const C: usize = P / 2 + 1;
+
+    /// Public key of `curve` from its SEC1 compressed form `02|03 || x`.
+    /// Signatures can then be verified and key exchanges performed against
+    /// public keys received compressed.
+    pub fn from_compressed(curve: CurvesId, compressed: &[u8]) -> Result<Self, CxError> {
+        let n = P / 2;
+        if compressed.len() != n + 1 {
+            return Err(CxError::InvalidParameterSize);
+        }
+        if compressed[0] & 0xfe != 0x02 {
+            return Err(CxError::InvalidParameterValue);
+        }
+        let mut pk = Self::new(curve);
+        let arena = BnArena::lock(n)?;
+        let mut point = EcPoint::new(&arena, curve)?;
+        point.decompress(&compressed[1..], (compressed[0] & 1) as u32)?;
+        let (x, y) = pk.pubkey[1..].split_at_mut(n);
+        point.export(x, y)?;
+        pk.pubkey[0] = 0x04;
+        Ok(pk)
+    }
+
+    /// SEC1 compressed form `02|03 || x` of the public key
+    pub fn compressed(&self) -> [u8; Self::C]
+    where
+        [(); Self::C]:,
+    {
+        let n = P / 2;
+        let mut compressed = [0u8; Self::C];
+        compressed[0] = 0x02 | (self.pubkey[2 * n] & 1);
+        compressed[1..].copy_from_slice(&self.pubkey[1..n + 1]);
+        compressed
+    }
+
     pub fn verify(&self, signature: (&[u8], u32), hash: &[u8]) -> bool {
+        crate::cx_profile!("cx_ecdsa_verify");
         unsafe {
             cx_ecdsa_verify_no_throw(
                 self as *const ECPublicKey<P, 'W'> as *const ECCKeyRaw,
@@ -404,6 +729,21 @@ impl<const P: usize> ECPublicKey<P, 'W'> {
             )
         }
     }
+
+    /// Verify a BIP340 Schnorr signature of the 32-byte message `msg`
+    pub fn schnorr_verify(&self, signature: &[u8; SCHNORR_SIG_LEN], msg: &[u8]) -> bool {
+        unsafe {
+            cx_ecschnorr_verify(
+                self as *const ECPublicKey<P, 'W'> as *const cx_ecfp_public_key_t,
+                CX_ECSCHNORR_BIP0340,
+                CX_SHA256,
+                msg.as_ptr(),
+                msg.len() as size_t,
+                signature.as_ptr(),
+                SCHNORR_SIG_LEN as size_t,
+            )
+        }
+    }
 }
 
 /// Specific signature verification for Edwards curves, which all use EdDSA
@@ -427,6 +767,25 @@ impl<const P: usize> ECPublicKey<P, 'E'> {
 /// Checks consistency of curve choice and key length
 /// in order to prevent the underlying syscall from throwing
 pub fn bip32_derive(curve: CurvesId, path: &[u32], key: &mut [u8]) -> Result<(), CxError> {
+    bip32_derive_node(curve, path, key, core::ptr::null_mut())
+}
+
+/// Same as [`bip32_derive`], also retrieving the chain code of the derived node
+pub fn bip32_derive_with_chain_code(
+    curve: CurvesId,
+    path: &[u32],
+    key: &mut [u8],
+    chain_code: &mut [u8; 32],
+) -> Result<(), CxError> {
+    bip32_derive_node(curve, path, key, chain_code.as_mut_ptr())
+}
+
+fn bip32_derive_node(
+    curve: CurvesId,
+    path: &[u32],
+    key: &mut [u8],
+    chain_code: *mut u8,
+) -> Result<(), CxError> {
     match curve {
         CurvesId::Secp256k1 | CurvesId::Secp256r1 => {
             if key.len() < 64 {
@@ -440,18 +799,90 @@ pub fn bip32_derive(curve: CurvesId, path: &[u32], key: &mut [u8]) -> Result<(),
         }
         _ => return Err(CxError::InvalidParameter),
     }
+    crate::cx_profile!("os_perso_derive_node_bip32");
     unsafe {
         os_perso_derive_node_bip32(
             curve as u8,
             path.as_ptr(),
             path.len() as u32,
             key.as_mut_ptr(),
-            core::ptr::null_mut(),
+            chain_code,
         )
     };
     Ok(())
 }
 
+/// Derivation scheme of [`derive_node`]
+#[repr(u32)]
+#[derive(Copy, Clone)]
+pub enum DeriveMode {
+    /// BIP32, or BIP32-Ed25519 on Ed25519
+    Bip32 = HDW_NORMAL,
+    /// SLIP-10 on Ed25519, all the components of the path being hardened
+    Slip10 = HDW_ED25519_SLIP10,
+}
+
+/// Wrapper for `os_perso_derive_node_with_seed_key`
+///
+/// Derives the node of `path` on `curve` with `mode`, the master node being
+/// computed from the seed with `seed_key` as the HMAC-SHA512 key, such as
+/// `b"ed25519 seed"`, instead of the default key of the curve. The OS writes
+/// up to 64 bytes of key, hence the size of `key`, which holds the extended
+/// key of BIP32-Ed25519. As with [`bip32_derive`], the curve must be
+/// Secp256k1, Secp256r1 or Ed25519, and SLIP-10 is only available on Ed25519.
+pub fn derive_node(
+    mode: DeriveMode,
+    curve: CurvesId,
+    path: &[u32],
+    seed_key: Option<&[u8]>,
+    key: &mut [u8; 64],
+    chain_code: Option<&mut [u8; 32]>,
+) -> Result<(), CxError> {
+    let supported = match mode {
+        DeriveMode::Bip32 => matches!(
+            curve,
+            CurvesId::Secp256k1 | CurvesId::Secp256r1 | CurvesId::Ed25519
+        ),
+        DeriveMode::Slip10 => matches!(curve, CurvesId::Ed25519),
+    };
+    if !supported {
+        return Err(CxError::InvalidParameter);
+    }
+    let (seed_key, seed_key_len) = match seed_key {
+        Some(k) => (k.as_ptr() as *mut u8, k.len() as u32),
+        None => (core::ptr::null_mut(), 0),
+    };
+    let chain_code = chain_code.map_or(core::ptr::null_mut(), |c| c.as_mut_ptr());
+    crate::cx_profile!("os_perso_derive_node_with_seed_key");
+    unsafe {
+        os_perso_derive_node_with_seed_key(
+            mode as u32,
+            curve as u8,
+            path.as_ptr(),
+            path.len() as u32,
+            key.as_mut_ptr(),
+            chain_code,
+            seed_key,
+            seed_key_len,
+        )
+    };
+    Ok(())
+}
+
+/// Wrapper for `os_perso_derive_eip2333`
+///
+/// BLS12-381 private key of `path`, derived as specified by EIP-2333.
+pub fn eip2333_derive(path: &[u32], key: &mut [u8; 32]) {
+    unsafe {
+        os_perso_derive_eip2333(
+            CurvesId::Bls12381G1 as u8,
+            path.as_ptr(),
+            path.len() as u32,
+            key.as_mut_ptr(),
+        )
+    };
+}
+
 /// Helper buffer that stores secrets that need to be cleared after use
 pub struct Secret<const N: usize>([u8; N]);
 
@@ -464,6 +895,25 @@ impl<const N: usize> Secret<N> {
     pub fn new() -> Secret<N> {
         Secret::default()
     }
+
+    /// Buffer to write the next secret to, in a loop deriving one secret
+    /// after the other: the previous one is not cleared, the next one
+    /// overwrites it, and the buffer is cleared once, on drop.
+    ///
+    /// ```
+    /// let mut node = Secret::<64>::new();
+    /// for i in 0..20 {
+    ///     let path = [0x8000_002c, 0x8000_0000, 0x8000_0000, 0, i];
+    ///     bip32_derive(CurvesId::Secp256k1, &path, node.reuse())?;
+    ///     // ...
+    /// }
+    /// ```
+    ///
+    /// The bytes the next secret does not overwrite still hold the previous
+    /// one.
+    pub fn reuse(&mut self) -> &mut [u8; N] {
+        &mut self.0
+    }
 }
 
 impl<const N: usize> AsRef<[u8]> for Secret<N> {
@@ -481,8 +931,7 @@ impl<const N: usize> AsMut<[u8]> for Secret<N> {
 impl<const N: usize> Drop for Secret<N> {
     #[inline(never)]
     fn drop(&mut self) {
-        self.0.fill_with(|| 0);
-        self.0 = black_box(self.0);
+        zeroize(&mut self.0);
     }
 }
 
@@ -497,73 +946,505 @@ pub trait SeedDerive {
     fn derive_from_path(path: &[u32]) -> Self::Target;
 }
 
+/// Compile time check of the parameters of [`seed_derive`]
+struct SeedDeriveCheck<C, const N: usize, const TY: char>(core::marker::PhantomData<C>);
+
+impl<C: Curve, const N: usize, const TY: char> SeedDeriveCheck<C, N, TY> {
+    const VALID: () = assert!(
+        C::DERIVE_LEN >= N && C::DERIVE_LEN <= 96 && C::N == N && C::TY == TY,
+        "curve not supported by the seed derivation"
+    );
+}
+
+/// Private key of curve `C` derived from the seed on `path`.
+///
+/// The curve is checked at compile time: the OS must support its derivation,
+/// and `N` and `TY` must be its key length and type. No runtime dispatch on
+/// the curve is left, unlike with [`bip32_derive`].
+fn seed_derive<C: Curve, const N: usize, const TY: char>(path: &[u32]) -> ECPrivateKey<N, TY> {
+    let () = SeedDeriveCheck::<C, N, TY>::VALID;
+    let mut tmp = Secret::<96>::new();
+    crate::cx_profile!("os_perso_derive_node_bip32");
+    unsafe {
+        os_perso_derive_node_bip32(
+            C::ID as u8,
+            path.as_ptr(),
+            path.len() as u32,
+            tmp.0.as_mut_ptr(),
+            core::ptr::null_mut(),
+        )
+    };
+    let mut sk = ECPrivateKey::new(C::ID);
+    sk.key.copy_from_slice(&tmp.0[..N]);
+    sk
+}
+
 impl SeedDerive for Secp256k1 {
     type Target = ECPrivateKey<32, 'W'>;
     fn derive_from_path(path: &[u32]) -> Self::Target {
-        let mut tmp = Secret::<64>::new();
-        // Ignoring 'Result' here because known to be valid
-        let _ = bip32_derive(CurvesId::Secp256k1, path, tmp.as_mut());
-        let mut sk = Self::Target::new(CurvesId::Secp256k1);
-        let keylen = sk.key.len();
-        sk.key.copy_from_slice(&tmp.0[..keylen]);
-        sk
+        seed_derive::<Self, 32, 'W'>(path)
     }
 }
 
 impl SeedDerive for Secp256r1 {
     type Target = ECPrivateKey<32, 'W'>;
     fn derive_from_path(path: &[u32]) -> Self::Target {
-        let mut tmp = Secret::<64>::new();
-        // Ignoring 'Result' here because known to be valid
-        let _ = bip32_derive(CurvesId::Secp256r1, path, tmp.as_mut());
-        let mut sk = Self::Target::new(CurvesId::Secp256r1);
-        let keylen = sk.key.len();
-        sk.key.copy_from_slice(&tmp.0[..keylen]);
-        sk
+        seed_derive::<Self, 32, 'W'>(path)
     }
 }
 
 impl SeedDerive for Ed25519 {
     type Target = ECPrivateKey<32, 'E'>;
     fn derive_from_path(path: &[u32]) -> Self::Target {
-        let mut tmp = Secret::<96>::new();
-        // Ignoring 'Result' here because known to be valid
-        let _ = bip32_derive(CurvesId::Ed25519, path, tmp.as_mut());
-        let mut sk = Self::Target::new(CurvesId::Ed25519);
-        let keylen = sk.key.len();
-        sk.key.copy_from_slice(&tmp.0[..keylen]);
-        sk
+        seed_derive::<Self, 32, 'E'>(path)
     }
 }
 
 impl SeedDerive for Stark256 {
     type Target = ECPrivateKey<32, 'W'>;
     fn derive_from_path(path: &[u32]) -> Self::Target {
-        let mut sk = Self::Target::new(CurvesId::Stark256);
-        stark::eip2645_derive(path, &mut sk.key);
+        let mut sk = Self::Target::new(Self::ID);
+        // The derivation of the other curves raises an exception on failure
+        if stark::eip2645_derive(path, &mut sk.key).is_err() {
+            crate::fatal(crate::Fatal::KeyDerivation);
+        }
         sk
     }
 }
 
+/// Order of the Secp256k1 group
+const SECP256K1_ORDER: [u8; 32] = [
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+    0xba, 0xae, 0xdc, 0xe6, 0xaf, 0x48, 0xa0, 0x3b, 0xbf, 0xd2, 0x5e, 0x8c, 0xd0, 0x36, 0x41, 0x41,
+];
+
+/// Order of the Secp256r1 group
+const SECP256R1_ORDER: [u8; 32] = [
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xbc, 0xe6, 0xfa, 0xad, 0xa7, 0x17, 0x9e, 0x84, 0xf3, 0xb9, 0xca, 0xc2, 0xfc, 0x63, 0x25, 0x51,
+];
+
+/// Extended private key (private key and chain code) of a BIP32 node,
+/// zeroized on drop.
+///
+/// One seed derivation gives the node of a hardened prefix, from which
+/// unhardened children are computed locally with a HMAC-SHA512 and a modular
+/// addition each. Scanning addresses `m/44'/x'/0'/0/i` then costs a single
+/// seed derivation:
+///
+/// ```
+/// let account = Bip32Node::derive(CurvesId::Secp256k1, &make_bip32_path::<3>(b"m/44'/0'/0'"))?;
+/// let receive = account.child(0)?;
+/// for i in 0..20 {
+///     let sk = receive.child(i)?.private_key();
+/// }
+/// ```
+///
+/// Only Weierstrass curves support unhardened derivation, hence only
+/// Secp256k1 and Secp256r1 are accepted.
+pub struct Bip32Node {
+    curve: CurvesId,
+    // private key || chain code
+    node: Secret<64>,
+}
+
+impl Bip32Node {
+    /// Derive the node at `path` from the seed
+    pub fn derive(curve: CurvesId, path: &[u32]) -> Result<Bip32Node, CxError> {
+        Self::order(curve)?;
+        let mut tmp = Secret::<64>::new();
+        let mut node = Bip32Node {
+            curve,
+            node: Secret::new(),
+        };
+        let mut chain_code = [0u8; 32];
+        bip32_derive_with_chain_code(curve, path, tmp.as_mut(), &mut chain_code)?;
+        node.node.0[..32].copy_from_slice(&tmp.0[..32]);
+        node.node.0[32..].copy_from_slice(&chain_code);
+        Ok(node)
+    }
+
+    fn order(curve: CurvesId) -> Result<&'static [u8; 32], CxError> {
+        match curve {
+            CurvesId::Secp256k1 => Ok(&SECP256K1_ORDER),
+            CurvesId::Secp256r1 => Ok(&SECP256R1_ORDER),
+            _ => Err(CxError::InvalidParameter),
+        }
+    }
+
+    /// Compute the unhardened child node of index `index` (BIP32 CKDpriv).
+    ///
+    /// Hardened indices need the seed and are rejected: derive the full path
+    /// with [`Bip32Node::derive`] instead. In the unlikely case the child key
+    /// is invalid, `CxError::InvalidParameterValue` is returned and BIP32
+    /// mandates the caller proceeds with the next index.
+    pub fn child(&self, index: u32) -> Result<Bip32Node, CxError> {
+        let pk = self.private_key().public_key()?;
+        self.child_with_public_key(&pk.compressed(), index)
+    }
+
+    /// Same as [`Bip32Node::child`], given the compressed public key of this
+    /// node, to derive several children with one scalar multiplication less
+    /// each
+    pub(crate) fn child_with_public_key(
+        &self,
+        public_key: &[u8; 33],
+        index: u32,
+    ) -> Result<Bip32Node, CxError> {
+        if index & 0x80000000 != 0 {
+            return Err(CxError::InvalidParameter);
+        }
+        let order = Self::order(self.curve)?;
+
+        // data = compressed parent public key || index
+        let mut data = [0u8; 37];
+        data[..33].copy_from_slice(public_key);
+        data[33..].copy_from_slice(&index.to_be_bytes());
+
+        let mut i = Secret::<64>::new();
+        unsafe {
+            cx_hmac_sha512(
+                self.node.0[32..].as_ptr(),
+                32,
+                data.as_ptr(),
+                data.len() as u32,
+                i.0.as_mut_ptr(),
+                64,
+            )
+        };
+
+        let mut diff = 0;
+        let err = unsafe { cx_math_cmp_no_throw(i.0.as_ptr(), order.as_ptr(), 32, &mut diff) };
+        if err != CX_OK {
+            return Err(err.into());
+        }
+        if diff >= 0 {
+            return Err(CxError::InvalidParameterValue);
+        }
+
+        let mut child = Bip32Node {
+            curve: self.curve,
+            node: Secret::new(),
+        };
+        let err = unsafe {
+            cx_math_addm_no_throw(
+                child.node.0.as_mut_ptr(),
+                i.0.as_ptr(),
+                self.node.0.as_ptr(),
+                order.as_ptr(),
+                32,
+            )
+        };
+        if err != CX_OK {
+            return Err(err.into());
+        }
+        if child.node.0[..32].iter().all(|&b| b == 0) {
+            return Err(CxError::InvalidParameterValue);
+        }
+        child.node.0[32..].copy_from_slice(&i.0[32..]);
+        Ok(child)
+    }
+
+    /// Follow an unhardened `path` from this node
+    pub fn derive_unhardened(&self, path: &[u32]) -> Result<Bip32Node, CxError> {
+        let mut node = Bip32Node {
+            curve: self.curve,
+            node: Secret::new(),
+        };
+        node.node.0 = self.node.0;
+        for &index in path {
+            node = node.child(index)?;
+        }
+        Ok(node)
+    }
+
+    /// Private key of this node
+    pub fn private_key(&self) -> ECPrivateKey<32, 'W'> {
+        let mut sk = ECPrivateKey::<32, 'W'>::new(self.curve);
+        sk.key.copy_from_slice(&self.node.0[..32]);
+        sk
+    }
+
+    /// Chain code of this node
+    pub fn chain_code(&self) -> &[u8] {
+        &self.node.0[32..]
+    }
+}
+
+/// Length of the public keys held by a [`PublicKeyCache`]: uncompressed
+/// SEC1 points `04 || x || y` with 32-byte coordinates, the form in which
+/// the cxlib returns them for every curve of BIP32 derivation.
+pub const CACHED_PUBKEY_LEN: usize = 65;
+
+/// One slot of a [`PublicKeyCache`]. Only made of plain bytes so an empty
+/// cache is all zeroes and can be placed in `.bss`.
+struct CachedPublicKey {
+    used: bool,
+    curve: u8,
+    path_hash: [u8; 32],
+    pubkey: [u8; CACHED_PUBKEY_LEN],
+    chain_code: [u8; 32],
+    fingerprint: [u8; 4],
+}
+
+/// Length of a serialized extended public key
+pub const XPUB_LEN: usize = 78;
+
+/// Serialize an extended public key as per BIP32: `version`, `depth`, the
+/// fingerprint of the parent key, the index of the key, its chain code and
+/// its compressed form. The result is usually Base58Check encoded.
+pub fn xpub_serialize(
+    version: u32,
+    depth: u8,
+    parent_fingerprint: [u8; 4],
+    child_number: u32,
+    chain_code: &[u8; 32],
+    public_key: &[u8; 33],
+) -> [u8; XPUB_LEN] {
+    let mut xpub = [0u8; XPUB_LEN];
+    xpub[..4].copy_from_slice(&version.to_be_bytes());
+    xpub[4] = depth;
+    xpub[5..9].copy_from_slice(&parent_fingerprint);
+    xpub[9..13].copy_from_slice(&child_number.to_be_bytes());
+    xpub[13..45].copy_from_slice(chain_code);
+    xpub[45..].copy_from_slice(public_key);
+    xpub
+}
+
+/// First 4 bytes of the HASH160 of the compressed Weierstrass public key
+/// `04 || x || y`, which identify it in BIP32 and PSBTs
+fn key_fingerprint(pubkey: &[u8; CACHED_PUBKEY_LEN]) -> Result<[u8; 4], CxError> {
+    let mut compressed = [0u8; 33];
+    compressed[0] = 0x02 | (pubkey[64] & 1);
+    compressed[1..].copy_from_slice(&pubkey[1..33]);
+    let hash160 = Ripemd160::hash(&Sha256::hash(&compressed)?)?;
+    let mut fingerprint = [0u8; 4];
+    fingerprint.copy_from_slice(&hash160[..4]);
+    Ok(fingerprint)
+}
+
+/// Opt-in RAM cache of public keys derived from the seed, holding up to `E`
+/// entries keyed by curve and path hash, and evicted in a round-robin fashion.
+///
+/// Deriving a public key from the seed costs a BIP32 derivation and a scalar
+/// multiplication; apps which repeatedly display addresses or export keys for
+/// the same few paths can instead keep a cache in a static:
+///
+/// ```
+/// static mut PK_CACHE: PublicKeyCache<4> = PublicKeyCache::new();
+///
+/// let (pk, chain_code) = unsafe { PK_CACHE.public_key::<'W'>(CurvesId::Secp256k1, &path)? };
+/// ```
+///
+/// Entries of Weierstrass curves also hold the fingerprint of their key, so
+/// that [`PublicKeyCache::xpub`] and [`PublicKeyCache::fingerprint`] do not
+/// derive the parent keys again and again, when matching the
+/// `BIP32_DERIVATION` fields of every input of a PSBT for instance.
+///
+/// The cache is flushed by any lookup done while the PIN is not validated,
+/// and nothing is cached in that state. Apps which want keys forgotten as soon
+/// as the device locks should register [`PublicKeyCache::clear`] with
+/// [`crate::lock::register`].
+pub struct PublicKeyCache<const E: usize> {
+    entries: [CachedPublicKey; E],
+    next: usize,
+}
+
+impl<const E: usize> Default for PublicKeyCache<E> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const E: usize> PublicKeyCache<E> {
+    pub const fn new() -> Self {
+        const EMPTY: CachedPublicKey = CachedPublicKey {
+            used: false,
+            curve: 0,
+            path_hash: [0u8; 32],
+            pubkey: [0u8; CACHED_PUBKEY_LEN],
+            chain_code: [0u8; 32],
+            fingerprint: [0u8; 4],
+        };
+        PublicKeyCache {
+            entries: [EMPTY; E],
+            next: 0,
+        }
+    }
+
+    /// Drop all cached entries
+    pub fn clear(&mut self) {
+        for entry in self.entries.iter_mut() {
+            entry.used = false;
+            entry.pubkey.fill(0);
+            entry.chain_code.fill(0);
+        }
+        self.next = 0;
+    }
+
+    /// Return the public key and chain code derived from the seed on `path`
+    /// for the given curve, deriving it only if it is not already cached.
+    ///
+    /// `TY` must match the type of `curve`: 'W' for Secp256k1 and Secp256r1,
+    /// 'E' for Ed25519.
+    pub fn public_key<const TY: char>(
+        &mut self,
+        curve: CurvesId,
+        path: &[u32],
+    ) -> Result<(ECPublicKey<CACHED_PUBKEY_LEN, TY>, [u8; 32]), CxError> {
+        let (pk, chain_code, _) = self.lookup::<TY>(curve, path)?;
+        Ok((pk, chain_code))
+    }
+
+    /// Fingerprint of the Secp256k1 or Secp256r1 key derived on `path`: that
+    /// of the master key for an empty path
+    pub fn fingerprint(&mut self, curve: CurvesId, path: &[u32]) -> Result<[u8; 4], CxError> {
+        let (_, _, fingerprint) = self.lookup::<'W'>(curve, path)?;
+        Ok(fingerprint)
+    }
+
+    /// Extended public key, serialized with [`xpub_serialize`], of the
+    /// Secp256k1 key derived on `path`, `version` being `0x0488B21E` for a
+    /// mainnet xpub for instance
+    pub fn xpub(&mut self, version: u32, path: &[u32]) -> Result<[u8; XPUB_LEN], CxError> {
+        let depth = u8::try_from(path.len()).map_err(|_| CxError::InvalidParameter)?;
+        let (parent_fingerprint, child_number) = match path.split_last() {
+            Some((&index, parent)) => (self.fingerprint(CurvesId::Secp256k1, parent)?, index),
+            None => ([0u8; 4], 0),
+        };
+        let (pk, chain_code, _) = self.lookup::<'W'>(CurvesId::Secp256k1, path)?;
+        let mut compressed = [0u8; 33];
+        compressed[0] = 0x02 | (pk.pubkey[64] & 1);
+        compressed[1..].copy_from_slice(&pk.pubkey[1..33]);
+        Ok(xpub_serialize(
+            version,
+            depth,
+            parent_fingerprint,
+            child_number,
+            &chain_code,
+            &compressed,
+        ))
+    }
+
+    /// Public key, chain code and fingerprint (zero for Ed25519) of `path`
+    fn lookup<const TY: char>(
+        &mut self,
+        curve: CurvesId,
+        path: &[u32],
+    ) -> Result<(ECPublicKey<CACHED_PUBKEY_LEN, TY>, [u8; 32], [u8; 4]), CxError> {
+        match (curve, TY) {
+            (CurvesId::Secp256k1 | CurvesId::Secp256r1, 'W') | (CurvesId::Ed25519, 'E') => (),
+            _ => return Err(CxError::InvalidParameter),
+        }
+
+        let validated = unsafe { os_global_pin_is_validated() } as u8 == BOLOS_TRUE as u8;
+        if !validated {
+            self.clear();
+        }
+
+        let mut path_hash = [0u8; 32];
+        unsafe {
+            cx_hash_sha256(
+                path.as_ptr() as *const u8,
+                (path.len() * 4) as u32,
+                path_hash.as_mut_ptr(),
+                32,
+            )
+        };
+
+        let mut pk = ECPublicKey::<CACHED_PUBKEY_LEN, TY>::new(curve);
+        if let Some(entry) = self
+            .entries
+            .iter()
+            .find(|e| e.used && e.curve == curve as u8 && e.path_hash == path_hash)
+        {
+            pk.pubkey = entry.pubkey;
+            return Ok((pk, entry.chain_code, entry.fingerprint));
+        }
+
+        let mut tmp = Secret::<96>::new();
+        let mut chain_code = [0u8; 32];
+        bip32_derive_with_chain_code(curve, path, tmp.as_mut(), &mut chain_code)?;
+        let mut sk = ECPrivateKey::<32, TY>::new(curve);
+        sk.key.copy_from_slice(&tmp.0[..32]);
+        // Generated in place: going through `ECPrivateKey::public_key` would
+        // require `TY` to be known here.
+        let err = unsafe {
+            cx_ecfp_generate_pair_no_throw(
+                curve as u8,
+                &mut pk as *mut ECPublicKey<CACHED_PUBKEY_LEN, TY> as *mut ECCKeyRaw,
+                &sk as *const ECPrivateKey<32, TY> as *const ECCKeyRaw,
+                true,
+            )
+        };
+        if err != CX_OK {
+            return Err(err.into());
+        }
+        let fingerprint = match TY {
+            'W' => key_fingerprint(&pk.pubkey)?,
+            _ => [0u8; 4],
+        };
+
+        if validated && E > 0 {
+            let entry = &mut self.entries[self.next];
+            entry.used = true;
+            entry.curve = curve as u8;
+            entry.path_hash = path_hash;
+            entry.pubkey = pk.pubkey;
+            entry.chain_code = chain_code;
+            entry.fingerprint = fingerprint;
+            self.next = (self.next + 1) % E;
+        }
+        Ok((pk, chain_code, fingerprint))
+    }
+}
+
+/// Curve known at compile time, implemented by the zero-sized structures
+/// generated by `impl_curve!`. Code generic over a `Curve` gets its
+/// parameters as constants, and the checks on them are resolved during
+/// monomorphization instead of matching a `CurvesId` at runtime.
+///
+/// The identifier and length are still stored in [`ECPrivateKey`] and
+/// [`ECPublicKey`], whose layouts are the ones the syscalls expect.
+pub trait Curve {
+    const ID: CurvesId;
+    /// Length of the private keys, in bytes
+    const N: usize;
+    /// Curve type: 'W' (Weierstrass), 'M' (Montgomery) or 'E' (Edwards)
+    const TY: char;
+    /// Length of the key material written by `os_perso_derive_node_bip32`,
+    /// 0 if the OS cannot derive keys of this curve
+    const DERIVE_LEN: usize;
+}
+
 /// This macro is used to easily generate zero-sized structures named after a Curve.
 /// Each curve has a method `new()` that takes no arguments and returns the correctly
 /// const-typed `ECPrivateKey`.
 macro_rules! impl_curve {
     ($typename:ident, $size:expr, $curvetype:expr) => {
+        impl_curve!($typename, $size, $curvetype, 0);
+    };
+    ($typename:ident, $size:expr, $curvetype:expr, $derive_len:expr) => {
         pub struct $typename {}
+        impl Curve for $typename {
+            const ID: CurvesId = CurvesId::$typename;
+            const N: usize = $size;
+            const TY: char = $curvetype;
+            const DERIVE_LEN: usize = $derive_len;
+        }
         impl $typename {
             #[allow(clippy::new_ret_no_self)]
             pub fn new() -> ECPrivateKey<$size, $curvetype> {
-                ECPrivateKey::<$size, $curvetype>::new(CurvesId::$typename)
+                ECPrivateKey::<$size, $curvetype>::new(Self::ID)
             }
         }
     };
 }
 
-impl_curve!(Secp256k1, 32, 'W');
-impl_curve!(Secp256r1, 32, 'W');
+impl_curve!(Secp256k1, 32, 'W', 64);
+impl_curve!(Secp256r1, 32, 'W', 64);
 impl_curve!(Secp384r1, 48, 'W');
-// impl_curve!( Secp521r1, 66, 'W' );
+impl_curve!(Secp521r1, 66, 'W');
 impl_curve!(BrainpoolP256R1, 32, 'W');
 impl_curve!(BrainpoolP256T1, 32, 'W');
 impl_curve!(BrainpoolP320R1, 40, 'W');
@@ -573,9 +1454,9 @@ impl_curve!(BrainpoolP384T1, 48, 'W');
 impl_curve!(BrainpoolP512R1, 64, 'W');
 impl_curve!(BrainpoolP512T1, 64, 'W');
 impl_curve!(Stark256, 32, 'W');
-impl_curve!(Ed25519, 32, 'E');
+impl_curve!(Ed25519, 32, 'E', 96);
 // impl_curve!( FRP256v1, 32, 'W' );
-// impl_curve!( Ed448, 57, 'E' );
+impl_curve!(Ed448, 57, 'E');
 
 /// Creates at compile time an array from the ASCII values of a correctly
 /// formatted derivation path.
@@ -681,7 +1562,7 @@ pub const fn make_bip32_path<const N: usize>(bytes: &[u8]) -> [u32; N] {
 mod tests {
     use super::*;
     use crate::assert_eq_err as assert_eq;
-    use crate::testing::TestType;
+    use crate::testing::{bench, TestType};
     use testmacro::test_item as test;
 
     trait ConstantFill {
@@ -707,6 +1588,73 @@ mod tests {
 
     const TEST_HASH: &[u8; 13] = b"test_message1";
 
+    #[test]
+    fn compressed_secp256k1() {
+        let sk = Secp256k1::derive_from_path(&PATH0);
+        let pk = sk.public_key().map_err(display_error_code)?;
+        let compressed = sk.public_key_compressed().map_err(display_error_code)?;
+        assert_eq!(compressed, pk.compressed());
+        let decompressed =
+            ECPublicKey::<65, 'W'>::from_compressed(CurvesId::Secp256k1, &compressed)
+                .map_err(display_error_code)?;
+        assert_eq!(decompressed.pubkey, pk.pubkey);
+        let mut out = [0u8; 80];
+        let len = sk.public_key_into(&mut out).map_err(display_error_code)?;
+        assert_eq!(&out[..len], &pk.pubkey[..]);
+
+        let sk2 = Secp256k1::derive_from_path(&PATH1);
+        let pk2 = sk2.public_key().map_err(display_error_code)?;
+        let shared = sk.ecdh(pk2.as_ref()).map_err(display_error_code)?;
+        let shared2 = sk.ecdh(&pk2.compressed()).map_err(display_error_code)?;
+        assert_eq!(shared, shared2);
+    }
+
+    #[test]
+    fn derive_node_seed_key() {
+        let (mut key, mut chain_code) = ([0u8; 64], [0u8; 32]);
+        bip32_derive_with_chain_code(CurvesId::Secp256k1, &PATH0, &mut key, &mut chain_code)
+            .map_err(display_error_code)?;
+        let (mut key2, mut chain_code2) = ([0u8; 64], [0u8; 32]);
+        derive_node(
+            DeriveMode::Bip32,
+            CurvesId::Secp256k1,
+            &PATH0,
+            Some(b"Bitcoin seed"),
+            &mut key2,
+            Some(&mut chain_code2),
+        )
+        .map_err(display_error_code)?;
+        assert_eq!((&key[..32], chain_code), (&key2[..32], chain_code2));
+        assert_eq!(
+            derive_node(
+                DeriveMode::Slip10,
+                CurvesId::Secp256k1,
+                &PATH0,
+                None,
+                &mut key2,
+                None
+            )
+            .is_err(),
+            true
+        );
+    }
+
+    #[test]
+    fn schnorr_secp256k1() {
+        let msg = [0x42u8; 32];
+        let sk = Secp256k1::derive_from_path(&PATH0);
+        let pk = sk.public_key().map_err(display_error_code)?;
+        let sig = sk.schnorr_sign(&msg).map_err(display_error_code)?;
+        assert_eq!(pk.schnorr_verify(&sig, &msg), true);
+
+        let tweaked = sk.taproot_tweak(None).map_err(display_error_code)?;
+        let pk = tweaked.public_key().map_err(display_error_code)?;
+        let sig = tweaked
+            .schnorr_sign_with_aux(&msg, &[0u8; 32])
+            .map_err(display_error_code)?;
+        assert_eq!(pk.schnorr_verify(&sig, &msg), true);
+    }
+
     #[test]
     fn ecdsa_secp256k1() {
         let sk = Secp256k1::derive_from_path(&PATH0);
@@ -717,6 +1665,26 @@ mod tests {
         assert_eq!(pk.verify((&s.0, s.1), TEST_HASH), true);
         let s = sk.sign(TEST_HASH).map_err(display_error_code)?;
         assert_eq!(pk.verify((&s.0, s.1), TEST_HASH), true);
+        let mut out = [0u8; 80];
+        let (len, _) = sk
+            .deterministic_sign_into(TEST_HASH, &mut out)
+            .map_err(display_error_code)?;
+        assert_eq!(pk.verify((&out, len), TEST_HASH), true);
+    }
+
+    #[test]
+    fn bench_secp256k1() {
+        let sk = Secp256k1::derive_from_path(&PATH0);
+        let pk = sk.public_key().map_err(display_error_code)?;
+        let s = sk
+            .deterministic_sign(TEST_HASH)
+            .map_err(display_error_code)?;
+        bench("secp256k1 deterministic_sign", 10, || {
+            core::hint::black_box(sk.deterministic_sign(TEST_HASH).ok());
+        });
+        bench("secp256k1 verify", 10, || {
+            core::hint::black_box(pk.verify((&s.0, s.1), TEST_HASH));
+        });
     }
 
     #[test]
@@ -731,6 +1699,16 @@ mod tests {
         assert_eq!(pk.verify((&s.0, s.1), TEST_HASH), true);
     }
 
+    #[test]
+    fn key_sizes() {
+        assert_eq!(ECPrivateKey::<32, 'W'>::S, 72);
+        assert_eq!(ECPrivateKey::<64, 'W'>::S, 137);
+        assert_eq!(ECPrivateKey::<66, 'W'>::S, 141);
+        assert_eq!(ECPublicKey::<133, 'W'>::S, 141);
+        assert_eq!(ECPrivateKey::<66, 'W'>::P, 133);
+        assert_eq!(ECPrivateKey::<57, 'E'>::EP, 114);
+    }
+
     #[test]
     fn ecdsa_secp384r1() {
         let mut sk = Secp384r1::new();
@@ -816,6 +1794,63 @@ mod tests {
         assert_eq!(pk.verify((&s.0, s.1), TEST_HASH, CX_SHA512), true);
     }
 
+    #[test]
+    fn bip32_node_child() {
+        const PREFIX: [u32; 3] = make_bip32_path(b"m/44'/535348'/0'");
+        let account =
+            Bip32Node::derive(CurvesId::Secp256k1, &PREFIX).map_err(display_error_code)?;
+        let receive = account.child(0).map_err(display_error_code)?;
+        for (i, path) in [PATH0, PATH1].iter().enumerate() {
+            let sk = receive
+                .child(i as u32)
+                .map_err(display_error_code)?
+                .private_key();
+            assert_eq!(sk.key, Secp256k1::derive_from_path(path).key);
+        }
+    }
+
+    #[test]
+    fn pubkey_cache() {
+        let mut cache = PublicKeyCache::<2>::new();
+        let pk = Secp256k1::derive_from_path(&PATH0)
+            .public_key()
+            .map_err(display_error_code)?;
+        for _ in 0..2 {
+            let (cached, _) = cache
+                .public_key::<'W'>(CurvesId::Secp256k1, &PATH0)
+                .map_err(display_error_code)?;
+            assert_eq!(cached.pubkey, pk.pubkey);
+        }
+        let (other, _) = cache
+            .public_key::<'W'>(CurvesId::Secp256k1, &PATH1)
+            .map_err(display_error_code)?;
+        assert_eq!(other.pubkey == pk.pubkey, false);
+    }
+
+    #[test]
+    fn xpub() {
+        let mut cache = PublicKeyCache::<2>::new();
+        let xpub = cache.xpub(0x0488b21e, &PATH0).map_err(display_error_code)?;
+        let parent = Secp256k1::derive_from_path(&PATH0[..PATH0.len() - 1])
+            .public_key()
+            .map_err(display_error_code)?;
+        let hash160 =
+            Ripemd160::hash(&Sha256::hash(&parent.compressed()).map_err(display_error_code)?)
+                .map_err(display_error_code)?;
+        let pk = Secp256k1::derive_from_path(&PATH0)
+            .public_key()
+            .map_err(display_error_code)?;
+        assert_eq!(&xpub[..5], &[0x04, 0x88, 0xb2, 0x1e, PATH0.len() as u8]);
+        assert_eq!(&xpub[5..9], &hash160[..4]);
+        assert_eq!(&xpub[9..13], &PATH0[PATH0.len() - 1].to_be_bytes());
+        assert_eq!(&xpub[45..], &pk.compressed()[..]);
+        // The parent is now cached
+        assert_eq!(
+            cache.fingerprint(CurvesId::Secp256k1, &PATH0[..PATH0.len() - 1]),
+            Ok([hash160[0], hash160[1], hash160[2], hash160[3]])
+        );
+    }
+
     #[test]
     fn test_make_bip32_path() {
         {
@@ -0,0 +1,160 @@
+//! Consecutive addresses of an account, for wallet discovery
+//!
+//! Hosts scanning an account for used addresses ask for 20 to 100 of them
+//! in a row. An [`AddressStream`] derives them from the parent node, whose
+//! public key it computes once, and encodes them back-to-back as the
+//! response is read, so that the whole range is sent as one response
+//! chained with GET RESPONSE (see [`crate::chain`]):
+//!
+//! ```
+//! static mut ADDRESSES: Option<AddressStream<20>> = None;
+//!
+//! let receive = Bip32Node::derive(CurvesId::Secp256k1, &make_bip32_path::<4>(b"m/44'/0'/0'/0"))?;
+//! let addresses = unsafe { &mut *core::ptr::addr_of_mut!(ADDRESSES) };
+//! let stream = addresses.insert(AddressStream::new(receive, start, count, hash160_address)?);
+//! comm.reply_chained(stream, StatusWords::Ok);
+//! ```
+//!
+//! All the addresses are `A` bytes long, so the host finds address `i` at
+//! offset `i * A`. Encodings of variable length must be padded by the
+//! encoder. Should the derivation of an address fail, which takes a child
+//! key out of the range of the curve (with a probability below 2^-127),
+//! the response is cut short before it: hosts check its length.
+
+use super::{Bip32Node, CxError, ECPublicKey};
+use crate::chain::ResponseSource;
+use crate::hash::{HashFn, Keccak256, Ripemd160, Sha256};
+
+/// Encoder of an address of `A` bytes from the public key `04 || x || y`
+pub type AddressEncoder<const A: usize> =
+    fn(&ECPublicKey<65, 'W'>, &mut [u8; A]) -> Result<(), CxError>;
+
+/// RIPEMD-160 of the SHA-256 of the compressed public key, as used by
+/// Bitcoin P2PKH and P2WPKH addresses
+pub fn hash160_address(pk: &ECPublicKey<65, 'W'>, out: &mut [u8; 20]) -> Result<(), CxError> {
+    let sha = Sha256::hash(&pk.compressed())?;
+    *out = Ripemd160::hash(&sha)?;
+    Ok(())
+}
+
+/// Last 20 bytes of the Keccak-256 of `x || y`, as used by Ethereum
+pub fn keccak_address(pk: &ECPublicKey<65, 'W'>, out: &mut [u8; 20]) -> Result<(), CxError> {
+    let mut h = Keccak256::new();
+    h.update(&pk.pubkey[1..])?;
+    out.copy_from_slice(&h.finalize()?[12..]);
+    Ok(())
+}
+
+/// Addresses of the children `start..start + count` of a node, encoded as
+/// they are read
+pub struct AddressStream<const A: usize> {
+    parent: Bip32Node,
+    parent_key: [u8; 33],
+    next: u32,
+    end: u32,
+    encode: AddressEncoder<A>,
+    address: [u8; A],
+    /// Bytes of `address` not read yet, at its end
+    pending: usize,
+}
+
+impl<const A: usize> AddressStream<A> {
+    /// Stream the addresses of the unhardened children `start` to
+    /// `start + count - 1` of `parent`, encoded with `encode`
+    pub fn new(
+        parent: Bip32Node,
+        start: u32,
+        count: u32,
+        encode: AddressEncoder<A>,
+    ) -> Result<Self, CxError> {
+        let end = start.checked_add(count).ok_or(CxError::InvalidParameter)?;
+        if end > 0x80000000 {
+            return Err(CxError::InvalidParameter);
+        }
+        let parent_key = parent.private_key().public_key()?.compressed();
+        Ok(AddressStream {
+            parent,
+            parent_key,
+            next: start,
+            end,
+            encode,
+            address: [0; A],
+            pending: 0,
+        })
+    }
+
+    /// Derive and encode the next address
+    fn encode_next(&mut self) -> Result<(), CxError> {
+        let child = self
+            .parent
+            .child_with_public_key(&self.parent_key, self.next)?;
+        let pk = child.private_key().public_key()?;
+        (self.encode)(&pk, &mut self.address)
+    }
+}
+
+impl<const A: usize> ResponseSource for AddressStream<A> {
+    fn read(&mut self, out: &mut [u8]) -> usize {
+        let mut n = 0;
+        while n < out.len() {
+            if self.pending == 0 {
+                if self.next == self.end {
+                    break;
+                }
+                if self.encode_next().is_err() {
+                    self.end = self.next;
+                    break;
+                }
+                self.next += 1;
+                self.pending = A;
+            }
+            let from = A - self.pending;
+            let len = self.pending.min(out.len() - n);
+            out[n..n + len].copy_from_slice(&self.address[from..from + len]);
+            self.pending -= len;
+            n += len;
+        }
+        n
+    }
+
+    fn remaining(&self) -> usize {
+        self.pending + (self.end - self.next) as usize * A
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, CurvesId, Secp256k1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn address_stream() {
+        const RECEIVE: [u32; 4] = make_bip32_path(b"m/44'/60'/0'/0");
+        let node = Bip32Node::derive(CurvesId::Secp256k1, &RECEIVE).map_err(|_| ())?;
+        let mut stream = AddressStream::new(node, 5, 3, keccak_address).map_err(|_| ())?;
+        assert_eq!(stream.remaining(), 60);
+
+        // Pages cutting the addresses
+        let mut out = [0u8; 60];
+        assert_eq!(stream.read(&mut out[..25]), 25);
+        assert_eq!(stream.remaining(), 35);
+        assert_eq!(stream.read(&mut out[25..]), 35);
+        assert_eq!(stream.remaining(), 0);
+        assert_eq!(stream.read(&mut out), 0);
+
+        let mut path = [0u32; 5];
+        path[..4].copy_from_slice(&RECEIVE);
+        for (i, address) in out.chunks(20).enumerate() {
+            path[4] = 5 + i as u32;
+            let pk = Secp256k1::derive_from_path(&path)
+                .public_key()
+                .map_err(|_| ())?;
+            let mut expected = [0u8; 20];
+            keccak_address(&pk, &mut expected).map_err(|_| ())?;
+            assert_eq!(address, &expected[..]);
+        }
+    }
+}
@@ -0,0 +1,347 @@
+//! Batch signature verification
+//!
+//! Checking many signatures in a row with `verify` locks the bignum engine
+//! and loads the curve domain for each of them. The `verify_batch`
+//! functions below do it once for the whole batch.
+//!
+//! ECDSA signatures are checked one by one within the session, with one
+//! `cx_ecpoint_double_scalarmul` each. Ed25519 signatures are checked all
+//! at once, with a random linear combination of their verification
+//! equations.
+
+use super::ed25519::{encode_point, reduce_digest, ED25519_ORDER, ED25519_SIG_LEN};
+use super::{CurvesId, CxError, ECPublicKey, EcPoint};
+use crate::bindings::*;
+use crate::bn::{Bn, BnArena};
+use crate::hash::{HashFn, Sha512};
+use crate::random::rand_bytes;
+use core::cmp::Ordering;
+
+/// Key, DER signature and its length, and hash of one ECDSA signature
+pub type EcdsaBatchItem<'a, const P: usize> = (&'a ECPublicKey<P, 'W'>, (&'a [u8], u32), &'a [u8]);
+
+/// Key, signature and message of one Ed25519 signature
+pub type EddsaBatchItem<'a> = (&'a ECPublicKey<65, 'E'>, &'a [u8], &'a [u8]);
+
+/// Split a DER encoded ECDSA signature into `r` and `s`, without their
+/// leading zeros
+pub(super) fn parse_der(sig: &[u8]) -> Option<(&[u8], &[u8])> {
+    fn integer(b: &[u8]) -> Option<(&[u8], &[u8])> {
+        let (&tag, b) = b.split_first()?;
+        let (&len, b) = b.split_first()?;
+        if tag != 0x02 || len as usize > b.len() {
+            return None;
+        }
+        let (mut int, rest) = b.split_at(len as usize);
+        while let [0, tail @ ..] = int {
+            int = tail;
+        }
+        Some((int, rest))
+    }
+    match sig {
+        [0x30, len, body @ ..] if *len as usize == body.len() => {
+            let (r, body) = integer(body)?;
+            let (s, body) = integer(body)?;
+            body.is_empty().then_some((r, s))
+        }
+        _ => None,
+    }
+}
+
+/// Whether `0 < x < n`
+pub(super) fn in_range(x: &Bn, n: &Bn) -> Result<bool, CxError> {
+    Ok(x.compare_u32(0)? == Ordering::Greater && x.compare(n)? == Ordering::Less)
+}
+
+impl<const P: usize> ECPublicKey<P, 'W'> {
+    /// Verify the ECDSA `signature` (DER, length) of each `hash`, under its
+    /// own key, all keys being on the same curve. Returns `Ok(false)` when
+    /// any signature is invalid.
+    pub fn verify_batch(items: &[EcdsaBatchItem<P>]) -> Result<bool, CxError> {
+        let Some((first, ..)) = items.first() else {
+            return Ok(true);
+        };
+        let curve = first.curve;
+        let len = P / 2;
+
+        let arena = BnArena::lock(len)?;
+        let n = arena.alloc(len)?;
+        let err = unsafe {
+            cx_ecdomain_parameter_bn(curve as cx_curve_t, CX_CURVE_PARAM_Order, n.handle())
+        };
+        if err != CX_OK {
+            return Err(err.into());
+        }
+        let mut g = EcPoint::generator(&arena, curve)?;
+        let (mut gx, mut gy) = ([0u8; P], [0u8; P]);
+        g.export(&mut gx[..len], &mut gy[..len])?;
+
+        let mut q = EcPoint::new(&arena, curve)?;
+        let mut sum = EcPoint::new(&arena, curve)?;
+        let mut r = arena.alloc(len)?;
+        let mut s = arena.alloc(len)?;
+        let mut e = arena.alloc(len)?;
+        let mut tmp = arena.alloc(len)?;
+        let mut w = arena.alloc(len)?;
+        let mut u1 = arena.alloc(len)?;
+        let mut u2 = arena.alloc(len)?;
+        let (mut k1, mut k2) = ([0u8; P], [0u8; P]);
+
+        for (key, (sig, sig_len), hash) in items {
+            if key.curve as u8 != curve as u8 {
+                return Err(CxError::InvalidCurve);
+            }
+            let sig = &sig[..(*sig_len as usize).min(sig.len())];
+            let Some((r_bytes, s_bytes)) = parse_der(sig) else {
+                return Ok(false);
+            };
+            if r_bytes.len() > len || s_bytes.len() > len {
+                return Ok(false);
+            }
+            r.set_bytes(r_bytes)?;
+            s.set_bytes(s_bytes)?;
+            if !in_range(&r, &n)? || !in_range(&s, &n)? {
+                return Ok(false);
+            }
+
+            // e is the leftmost bytes of the hash, reduced
+            tmp.set_bytes(&hash[..hash.len().min(len)])?;
+            e.reduce(&tmp, &n)?;
+            // u1 = e / s, u2 = r / s
+            w.mod_invert_nprime(&s, &n)?;
+            u1.mod_mul(&e, &w, &n)?;
+            u2.mod_mul(&r, &w, &n)?;
+            u1.export(&mut k1[..len])?;
+            u2.export(&mut k2[..len])?;
+
+            g.set_coordinates(&gx[..len], &gy[..len])?;
+            q.set_coordinates(&key.pubkey[1..len + 1], &key.pubkey[len + 1..2 * len + 1])?;
+            match sum.double_scalarmul(&mut g, &mut q, &k1[..len], &k2[..len]) {
+                Ok(()) => (),
+                Err(CxError::PointAtInfinity) => return Ok(false),
+                Err(err) => return Err(err),
+            }
+            // The x coordinate of u1 * G + u2 * Q must be r, mod n
+            sum.export(&mut k1[..len], &mut k2[..len])?;
+            tmp.set_bytes(&k1[..len])?;
+            e.reduce(&tmp, &n)?;
+            if e.compare(&r)? != Ordering::Equal {
+                return Ok(false);
+            }
+        }
+        Ok(true)
+    }
+}
+
+impl ECPublicKey<65, 'E'> {
+    /// Verify the Ed25519 `signature` of each message, under its own key.
+    ///
+    /// With random 128-bit `z_i`, the batch is valid when
+    /// `(sum z_i * S_i) * B = sum (z_i * R_i + z_i * k_i * A_i)` and every
+    /// `R_i` and `A_i` is of prime order: components of small order could
+    /// otherwise cancel out between signatures. If it is not, signatures are
+    /// verified one by one, so that the result is always the same as with
+    /// [`verify`](ECPublicKey::verify).
+    pub fn verify_batch(items: &[EddsaBatchItem]) -> Result<bool, CxError> {
+        if items.is_empty() {
+            return Ok(true);
+        }
+        if items.iter().any(|(_, sig, _)| sig.len() != ED25519_SIG_LEN) {
+            return Ok(false);
+        }
+        if combined_check(items)? {
+            return Ok(true);
+        }
+        // The engine is unlocked here, as cx_eddsa_verify_no_throw locks it
+        Ok(items
+            .iter()
+            .all(|(key, sig, msg)| key.verify((sig, ED25519_SIG_LEN as u32), msg, CX_SHA512)))
+    }
+}
+
+/// `Ok(false)` when an operation of [`combined_check`] gives the point at
+/// infinity, which valid signatures may do: they are then checked one by one
+fn finite(res: Result<(), CxError>) -> Result<bool, CxError> {
+    match res {
+        Ok(()) => Ok(true),
+        Err(CxError::PointAtInfinity) => Ok(false),
+        Err(err) => Err(err),
+    }
+}
+
+/// Whether `[L] p` is the neutral element, `p` having no component of small
+/// order. `tmp` receives `[L] p`.
+fn is_torsion_free(p: &EcPoint, tmp: &mut EcPoint) -> Result<bool, CxError> {
+    tmp.copy_from(p)?;
+    match finite(tmp.scalarmul_public(&ED25519_ORDER))? {
+        true => tmp.is_at_infinity(),
+        false => Ok(true),
+    }
+}
+
+/// Check the random linear combination of the Ed25519 verification
+/// equations of `items`
+fn combined_check(items: &[EddsaBatchItem]) -> Result<bool, CxError> {
+    let curve = CurvesId::Ed25519;
+    let arena = BnArena::lock(32)?;
+    let n = arena.alloc_init(32, &ED25519_ORDER)?;
+    let mut s = arena.alloc(32)?;
+    let mut z = arena.alloc(32)?;
+    let mut k = arena.alloc(32)?;
+    let mut zk = arena.alloc(32)?;
+    let mut zs = arena.alloc(32)?;
+    let mut s_sum = arena.alloc(32)?;
+    let mut tmp = arena.alloc(32)?;
+
+    let mut r = EcPoint::new(&arena, curve)?;
+    let mut a = EcPoint::new(&arena, curve)?;
+    let mut t = EcPoint::new(&arena, curve)?;
+    let mut acc = EcPoint::new(&arena, curve)?;
+    let mut next = EcPoint::new(&arena, curve)?;
+
+    let mut buf = [0u8; 32];
+    let mut z_bytes = [0u8; 32];
+    let mut zk_bytes = [0u8; 32];
+    for (i, (key, sig, msg)) in items.iter().enumerate() {
+        if !matches!(key.curve, CurvesId::Ed25519) {
+            return Err(CxError::InvalidCurve);
+        }
+        // S < L
+        buf.copy_from_slice(&sig[32..]);
+        buf.reverse();
+        s.set_bytes(&buf)?;
+        if s.compare(&n)? != Ordering::Less {
+            return Ok(false);
+        }
+
+        // R from its encoding, the little endian y and the parity of x
+        buf.copy_from_slice(&sig[..32]);
+        buf.reverse();
+        let sign = (buf[0] >> 7) as u32;
+        buf[0] &= 0x7f;
+        if r.decompress(&buf, sign).is_err() {
+            return Ok(false);
+        }
+
+        // k = SHA512(R || A || M) mod L
+        let (x, y) = key.pubkey[1..].split_at(32);
+        a.set_coordinates(x, y)?;
+        if !is_torsion_free(&r, &mut t)? || !is_torsion_free(&a, &mut t)? {
+            return Ok(false);
+        }
+        let mut h = Sha512::new();
+        h.update(&sig[..32])?;
+        h.update(&encode_point(x, y))?;
+        h.update(msg)?;
+        let mut digest = [0u8; 64];
+        h.finalize_into(&mut digest)?;
+        reduce_digest(&arena, &digest, &mut buf)?;
+        k.set_bytes(&buf)?;
+
+        rand_bytes(&mut z_bytes[16..]);
+        z.set_bytes(&z_bytes)?;
+        zk.mod_mul(&z, &k, &n)?;
+        zk.export(&mut zk_bytes)?;
+        zs.mod_mul(&z, &s, &n)?;
+        tmp.mod_add(&s_sum, &zs, &n)?;
+        s_sum.copy_from(&tmp)?;
+
+        // acc += z * R + z * k * A
+        if !finite(t.double_scalarmul(&mut r, &mut a, &z_bytes, &zk_bytes))? {
+            return Ok(false);
+        }
+        if i == 0 {
+            acc.copy_from(&t)?;
+        } else {
+            if !finite(next.add(&acc, &t))? {
+                return Ok(false);
+            }
+            core::mem::swap(&mut acc, &mut next);
+        }
+    }
+
+    s_sum.export(&mut buf)?;
+    let mut lhs = EcPoint::generator(&arena, curve)?;
+    if !finite(lhs.scalarmul_public(&buf))? {
+        return Ok(false);
+    }
+    lhs.equals(&acc)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, Ed25519, Secp256k1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PATH0: [u32; 5] = make_bip32_path(b"m/44'/535348'/0'/0/0");
+    const PATH1: [u32; 5] = make_bip32_path(b"m/44'/535348'/0'/0/1");
+
+    #[test]
+    fn batch_ecdsa() {
+        let hash = [0x5au8; 32];
+        let sk0 = Secp256k1::derive_from_path(&PATH0);
+        let sk1 = Secp256k1::derive_from_path(&PATH1);
+        let pk0 = sk0.public_key().map_err(|_| ())?;
+        let pk1 = sk1.public_key().map_err(|_| ())?;
+        let s0 = sk0.deterministic_sign(&hash).map_err(|_| ())?;
+        let s1 = sk1.deterministic_sign(&hash).map_err(|_| ())?;
+        let items = [
+            (&pk0, (&s0.0[..], s0.1), &hash[..]),
+            (&pk1, (&s1.0[..], s1.1), &hash[..]),
+        ];
+        assert_eq!(ECPublicKey::<65, 'W'>::verify_batch(&items), Ok(true));
+        let items = [
+            (&pk0, (&s0.0[..], s0.1), &hash[..]),
+            (&pk0, (&s1.0[..], s1.1), &hash[..]),
+        ];
+        assert_eq!(ECPublicKey::<65, 'W'>::verify_batch(&items), Ok(false));
+    }
+
+    #[test]
+    fn batch_eddsa() {
+        let msg = b"attestation";
+        let sk0 = Ed25519::derive_from_path(&PATH0);
+        let sk1 = Ed25519::derive_from_path(&PATH1);
+        let pk0 = sk0.public_key().map_err(|_| ())?;
+        let pk1 = sk1.public_key().map_err(|_| ())?;
+        let s0 = sk0.sign(msg).map_err(|_| ())?;
+        let s1 = sk1.sign(msg).map_err(|_| ())?;
+        let items = [(&pk0, &s0.0[..], &msg[..]), (&pk1, &s1.0[..], &msg[..])];
+        assert_eq!(
+            ECPublicKey::<65, 'E'>::verify_batch(&items).map_err(|_| ())?,
+            true
+        );
+        let items = [(&pk0, &s0.0[..], &msg[..]), (&pk1, &s0.0[..], &msg[..])];
+        assert_eq!(
+            ECPublicKey::<65, 'E'>::verify_batch(&items).map_err(|_| ())?,
+            false
+        );
+
+        // R + T, T = (0, -1) of order 2: (-x, -y), encoded as p - y with
+        // the sign of x flipped
+        let mut mixed = s0;
+        let p: [u8; 32] = core::array::from_fn(|i| match i {
+            0 => 0xed,
+            31 => 0x7f,
+            _ => 0xff,
+        });
+        let sign = mixed.0[31] & 0x80;
+        mixed.0[31] &= 0x7f;
+        let mut borrow = 0i16;
+        for i in 0..32 {
+            let d = p[i] as i16 - mixed.0[i] as i16 - borrow;
+            mixed.0[i] = d as u8;
+            borrow = (d < 0) as i16;
+        }
+        mixed.0[31] |= sign ^ 0x80;
+        let single = pk0.verify((&mixed.0[..], ED25519_SIG_LEN as u32), msg, CX_SHA512);
+        let items = [(&pk0, &mixed.0[..], &msg[..]), (&pk1, &s1.0[..], &msg[..])];
+        assert_eq!(
+            ECPublicKey::<65, 'E'>::verify_batch(&items).map_err(|_| ())?,
+            single
+        );
+    }
+}
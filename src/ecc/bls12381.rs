@@ -0,0 +1,1198 @@
+//! BLS12-381 signatures
+//!
+//! Signatures of the proof of possession scheme of the IETF BLS draft, with
+//! public keys in G1 and signatures in G2, as used by the Ethereum
+//! consensus layer. Keys from the seed are derived with
+//! [`eip2333_derive`](super::eip2333_derive).
+//!
+//! The OS has no support for this curve beyond key derivation, so the curve
+//! arithmetic is built here on the bignum engine: the field elements stay
+//! in the engine, in Montgomery representation, for the whole signature,
+//! and the curve code is generic over the field, specialized at compile
+//! time for G1 over `Fp` and G2 over `Fp2`. Signing does not need a
+//! pairing. Its cost is the hash of the message to G2, with a cofactor
+//! clearing through the `psi` endomorphism, and a Montgomery ladder over the
+//! key.
+//!
+//! # Examples
+//!
+//! ```
+//! let mut sk = [0u8; 32];
+//! eip2333_derive(&path, &mut sk);
+//! let pk = bls_public_key(&sk)?;
+//! let sig = bls_sign(&sk, &signing_root, BLS_DST_POP)?;
+//! ```
+
+use super::{expand_message_xmd, CxError};
+use crate::bindings::CX_BN_WORD_ALIGNEMENT;
+use crate::bn::{Bn, BnArena, MontCtx};
+use crate::ct::ct_lt;
+use crate::hash::Sha256;
+use core::cmp::Ordering;
+
+/// Size of a compressed public key, a point of G1
+pub const BLS_PK_LEN: usize = 48;
+/// Size of a compressed signature, a point of G2
+pub const BLS_SIG_LEN: usize = 96;
+/// Domain separation tag of the proof of possession scheme
+pub const BLS_DST_POP: &[u8] = b"BLS_SIG_BLS12381G2_XMD:SHA-256_SSWU_RO_POP_";
+
+const FP_LEN: usize = 48;
+
+/// Element of `Fp`, big endian
+type Fe = [u8; FP_LEN];
+
+/// Order of G1 and G2
+const R: [u8; 32] = [
+    0x73, 0xed, 0xa7, 0x53, 0x29, 0x9d, 0x7d, 0x48, 0x33, 0x39, 0xd8, 0x08, 0x09, 0xa1, 0xd8, 0x05,
+    0x53, 0xbd, 0xa4, 0x02, 0xff, 0xfe, 0x5b, 0xfe, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01,
+];
+
+/// `-x`, `x` being the parameter of the curve
+const MINUS_X: u64 = 0xd201000000010000;
+
+/// Field prime
+const P: Fe = [
+    0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b, 0xac, 0xd7,
+    0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0, 0xf6, 0xb0, 0xf6, 0x24,
+    0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xaa, 0xab,
+];
+
+/// `(p + 1) / 4`, the exponent of the square roots, `p` being 3 mod 4
+const P_PLUS_1_DIV_4: Fe = [
+    0x06, 0x80, 0x44, 0x7a, 0x8e, 0x5f, 0xf9, 0xa6, 0x92, 0xc6, 0xe9, 0xed, 0x90, 0xd2, 0xeb, 0x35,
+    0xd9, 0x1d, 0xd2, 0xe1, 0x3c, 0xe1, 0x44, 0xaf, 0xd9, 0xcc, 0x34, 0xa8, 0x3d, 0xac, 0x3d, 0x89,
+    0x07, 0xaa, 0xff, 0xff, 0xac, 0x54, 0xff, 0xff, 0xee, 0x7f, 0xbf, 0xff, 0xff, 0xff, 0xea, 0xab,
+];
+
+/// `(p - 1) / 2`, the exponent of the Legendre symbol, and the largest
+/// "lexicographically smallest" value of the point encoding
+const P_MINUS_1_DIV_2: Fe = [
+    0x0d, 0x00, 0x88, 0xf5, 0x1c, 0xbf, 0xf3, 0x4d, 0x25, 0x8d, 0xd3, 0xdb, 0x21, 0xa5, 0xd6, 0x6b,
+    0xb2, 0x3b, 0xa5, 0xc2, 0x79, 0xc2, 0x89, 0x5f, 0xb3, 0x98, 0x69, 0x50, 0x7b, 0x58, 0x7b, 0x12,
+    0x0f, 0x55, 0xff, 0xff, 0x58, 0xa9, 0xff, 0xff, 0xdc, 0xff, 0x7f, 0xff, 0xff, 0xff, 0xd5, 0x55,
+];
+
+/// 1 / 2
+const INV_2: Fe = [
+    0x0d, 0x00, 0x88, 0xf5, 0x1c, 0xbf, 0xf3, 0x4d, 0x25, 0x8d, 0xd3, 0xdb, 0x21, 0xa5, 0xd6, 0x6b,
+    0xb2, 0x3b, 0xa5, 0xc2, 0x79, 0xc2, 0x89, 0x5f, 0xb3, 0x98, 0x69, 0x50, 0x7b, 0x58, 0x7b, 0x12,
+    0x0f, 0x55, 0xff, 0xff, 0x58, 0xa9, 0xff, 0xff, 0xdc, 0xff, 0x7f, 0xff, 0xff, 0xff, 0xd5, 0x56,
+];
+
+/// Generator of G1
+const G1_X: Fe = [
+    0x17, 0xf1, 0xd3, 0xa7, 0x31, 0x97, 0xd7, 0x94, 0x26, 0x95, 0x63, 0x8c, 0x4f, 0xa9, 0xac, 0x0f,
+    0xc3, 0x68, 0x8c, 0x4f, 0x97, 0x74, 0xb9, 0x05, 0xa1, 0x4e, 0x3a, 0x3f, 0x17, 0x1b, 0xac, 0x58,
+    0x6c, 0x55, 0xe8, 0x3f, 0xf9, 0x7a, 0x1a, 0xef, 0xfb, 0x3a, 0xf0, 0x0a, 0xdb, 0x22, 0xc6, 0xbb,
+];
+
+const G1_Y: Fe = [
+    0x08, 0xb3, 0xf4, 0x81, 0xe3, 0xaa, 0xa0, 0xf1, 0xa0, 0x9e, 0x30, 0xed, 0x74, 0x1d, 0x8a, 0xe4,
+    0xfc, 0xf5, 0xe0, 0x95, 0xd5, 0xd0, 0x0a, 0xf6, 0x00, 0xdb, 0x18, 0xcb, 0x2c, 0x04, 0xb3, 0xed,
+    0xd0, 0x3c, 0xc7, 0x44, 0xa2, 0x88, 0x8a, 0xe4, 0x0c, 0xaa, 0x23, 0x29, 0x46, 0xc5, 0xe7, 0xe1,
+];
+
+/// `1 / (1 + u)^((p - 1) / 3)`, the factor of `x` in the endomorphism `psi`
+const PSI_X: [Fe; 2] = [
+    [
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00,
+    ],
+    [
+        0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x99, 0xec, 0x02, 0x40, 0x86, 0x63, 0xd4, 0xde,
+        0x85, 0xaa, 0x0d, 0x85, 0x7d, 0x89, 0x75, 0x9a, 0xd4, 0x89, 0x7d, 0x29, 0x65, 0x0f, 0xb8,
+        0x5f, 0x9b, 0x40, 0x94, 0x27, 0xeb, 0x4f, 0x49, 0xff, 0xfd, 0x8b, 0xfd, 0x00, 0x00, 0x00,
+        0x00, 0xaa, 0xad,
+    ],
+];
+
+/// `1 / (1 + u)^((p - 1) / 2)`, the factor of `y` in `psi`
+const PSI_Y: [Fe; 2] = [
+    [
+        0x13, 0x52, 0x03, 0xe6, 0x01, 0x80, 0xa6, 0x8e, 0xe2, 0xe9, 0xc4, 0x48, 0xd7, 0x7a, 0x2c,
+        0xd9, 0x1c, 0x3d, 0xed, 0xd9, 0x30, 0xb1, 0xcf, 0x60, 0xef, 0x39, 0x64, 0x89, 0xf6, 0x1e,
+        0xb4, 0x5e, 0x30, 0x44, 0x66, 0xcf, 0x3e, 0x67, 0xfa, 0x0a, 0xf1, 0xee, 0x7b, 0x04, 0x12,
+        0x1b, 0xde, 0xa2,
+    ],
+    [
+        0x06, 0xaf, 0x0e, 0x04, 0x37, 0xff, 0x40, 0x0b, 0x68, 0x31, 0xe3, 0x6d, 0x6b, 0xd1, 0x7f,
+        0xfe, 0x48, 0x39, 0x5d, 0xab, 0xc2, 0xd3, 0x43, 0x5e, 0x77, 0xf7, 0x6e, 0x17, 0x00, 0x92,
+        0x41, 0xc5, 0xee, 0x67, 0x99, 0x2f, 0x72, 0xec, 0x05, 0xf4, 0xc8, 0x10, 0x84, 0xfb, 0xed,
+        0xe3, 0xcc, 0x09,
+    ],
+];
+
+/// Curve isogenous to E2 of the simplified SWU map: `y^2 = x^3 + A x + B`
+const SSWU_A: [Fe; 2] = [
+    [
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00,
+    ],
+    [
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0xf0,
+    ],
+];
+
+const SSWU_B: [Fe; 2] = [
+    [
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x03, 0xf4,
+    ],
+    [
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x03, 0xf4,
+    ],
+];
+
+/// Non-square of the map
+const SSWU_Z: [Fe; 2] = [
+    [
+        0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b, 0xac,
+        0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0, 0xf6, 0xb0,
+        0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe, 0xff, 0xff, 0xff,
+        0xff, 0xaa, 0xa9,
+    ],
+    [
+        0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b, 0xac,
+        0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0, 0xf6, 0xb0,
+        0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe, 0xff, 0xff, 0xff,
+        0xff, 0xaa, 0xaa,
+    ],
+];
+
+/// `-B / A`
+const SSWU_MINUS_B_DIV_A: [Fe; 2] = [
+    [
+        0x08, 0x3c, 0x12, 0x79, 0x1a, 0xbd, 0xd5, 0xd2, 0xfe, 0x2f, 0x28, 0x4f, 0x0c, 0xc6, 0xe5,
+        0xaa, 0x9b, 0x8c, 0x2d, 0x3f, 0x6f, 0x3f, 0x79, 0x23, 0x02, 0xcf, 0x75, 0xe6, 0x2b, 0xfc,
+        0x4d, 0xf1, 0xd6, 0x83, 0x44, 0x43, 0xda, 0x49, 0x88, 0x88, 0x72, 0x5d, 0x8c, 0xcc, 0xcc,
+        0xcc, 0xb1, 0xc3,
+    ],
+    [
+        0x11, 0xc4, 0xff, 0x71, 0x1e, 0xc2, 0x10, 0xc7, 0x4c, 0xec, 0x7f, 0x67, 0x36, 0x84, 0xc7,
+        0x2c, 0xc8, 0xeb, 0x1e, 0x45, 0x84, 0x45, 0x99, 0x9c, 0x64, 0x61, 0x5c, 0xba, 0xca, 0xb4,
+        0xa8, 0x32, 0x48, 0x28, 0xbb, 0xba, 0xd7, 0x0a, 0x77, 0x77, 0x47, 0xa1, 0x73, 0x33, 0x33,
+        0x32, 0xf8, 0xe8,
+    ],
+];
+
+/// `B / (Z A)`
+const SSWU_B_DIV_ZA: [Fe; 2] = [
+    [
+        0x01, 0xa5, 0x9d, 0x4b, 0x6b, 0xbf, 0x91, 0x2a, 0x32, 0xd6, 0x3b, 0x43, 0x02, 0x8e, 0x2d,
+        0xee, 0xeb, 0xe8, 0xd5, 0xd9, 0x7c, 0xa6, 0x4b, 0x6d, 0x66, 0xf6, 0x4a, 0xc7, 0xa2, 0x65,
+        0xa9, 0x30, 0x5e, 0x1a, 0x40, 0xda, 0x5e, 0xdb, 0x81, 0xb4, 0xe3, 0xac, 0x4f, 0x5c, 0x28,
+        0xf5, 0xbd, 0x27,
+    ],
+    [
+        0x15, 0x10, 0x3a, 0x07, 0xf6, 0x41, 0x33, 0x1b, 0xb2, 0x98, 0xf5, 0xed, 0x3b, 0xa1, 0x23,
+        0x0a, 0xa0, 0xbc, 0xc9, 0xf8, 0x7d, 0x92, 0x30, 0x77, 0x32, 0x4d, 0xf2, 0x4a, 0x0f, 0x7f,
+        0xfa, 0x93, 0x04, 0x5d, 0x3d, 0x6f, 0x94, 0xc1, 0x7a, 0xe1, 0x0e, 0xfa, 0x11, 0xeb, 0x85,
+        0x1e, 0x73, 0x36,
+    ],
+];
+
+/// Coefficients of the 3-isogeny to E2, constant term first. The
+/// denominators are monic, their leading coefficient is left out.
+const ISO_X_NUM: [[Fe; 2]; 4] = [
+    [
+        [
+            0x05, 0xc7, 0x59, 0x50, 0x7e, 0x8e, 0x33, 0x3e, 0xbb, 0x5b, 0x7a, 0x9a, 0x47, 0xd7,
+            0xed, 0x85, 0x32, 0xc5, 0x2d, 0x39, 0xfd, 0x3a, 0x04, 0x2a, 0x88, 0xb5, 0x84, 0x23,
+            0xc5, 0x0a, 0xe1, 0x5d, 0x5c, 0x26, 0x38, 0xe3, 0x43, 0xd9, 0xc7, 0x1c, 0x62, 0x38,
+            0xaa, 0xaa, 0xaa, 0xaa, 0x97, 0xd6,
+        ],
+        [
+            0x05, 0xc7, 0x59, 0x50, 0x7e, 0x8e, 0x33, 0x3e, 0xbb, 0x5b, 0x7a, 0x9a, 0x47, 0xd7,
+            0xed, 0x85, 0x32, 0xc5, 0x2d, 0x39, 0xfd, 0x3a, 0x04, 0x2a, 0x88, 0xb5, 0x84, 0x23,
+            0xc5, 0x0a, 0xe1, 0x5d, 0x5c, 0x26, 0x38, 0xe3, 0x43, 0xd9, 0xc7, 0x1c, 0x62, 0x38,
+            0xaa, 0xaa, 0xaa, 0xaa, 0x97, 0xd6,
+        ],
+    ],
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+        [
+            0x11, 0x56, 0x0b, 0xf1, 0x7b, 0xaa, 0x99, 0xbc, 0x32, 0x12, 0x6f, 0xce, 0xd7, 0x87,
+            0xc8, 0x8f, 0x98, 0x4f, 0x87, 0xad, 0xf7, 0xae, 0x0c, 0x7f, 0x9a, 0x20, 0x8c, 0x6b,
+            0x4f, 0x20, 0xa4, 0x18, 0x14, 0x72, 0xaa, 0xa9, 0xcb, 0x8d, 0x55, 0x55, 0x26, 0xa9,
+            0xff, 0xff, 0xff, 0xff, 0xc7, 0x1a,
+        ],
+    ],
+    [
+        [
+            0x11, 0x56, 0x0b, 0xf1, 0x7b, 0xaa, 0x99, 0xbc, 0x32, 0x12, 0x6f, 0xce, 0xd7, 0x87,
+            0xc8, 0x8f, 0x98, 0x4f, 0x87, 0xad, 0xf7, 0xae, 0x0c, 0x7f, 0x9a, 0x20, 0x8c, 0x6b,
+            0x4f, 0x20, 0xa4, 0x18, 0x14, 0x72, 0xaa, 0xa9, 0xcb, 0x8d, 0x55, 0x55, 0x26, 0xa9,
+            0xff, 0xff, 0xff, 0xff, 0xc7, 0x1e,
+        ],
+        [
+            0x08, 0xab, 0x05, 0xf8, 0xbd, 0xd5, 0x4c, 0xde, 0x19, 0x09, 0x37, 0xe7, 0x6b, 0xc3,
+            0xe4, 0x47, 0xcc, 0x27, 0xc3, 0xd6, 0xfb, 0xd7, 0x06, 0x3f, 0xcd, 0x10, 0x46, 0x35,
+            0xa7, 0x90, 0x52, 0x0c, 0x0a, 0x39, 0x55, 0x54, 0xe5, 0xc6, 0xaa, 0xaa, 0x93, 0x54,
+            0xff, 0xff, 0xff, 0xff, 0xe3, 0x8d,
+        ],
+    ],
+    [
+        [
+            0x17, 0x1d, 0x65, 0x41, 0xfa, 0x38, 0xcc, 0xfa, 0xed, 0x6d, 0xea, 0x69, 0x1f, 0x5f,
+            0xb6, 0x14, 0xcb, 0x14, 0xb4, 0xe7, 0xf4, 0xe8, 0x10, 0xaa, 0x22, 0xd6, 0x10, 0x8f,
+            0x14, 0x2b, 0x85, 0x75, 0x70, 0x98, 0xe3, 0x8d, 0x0f, 0x67, 0x1c, 0x71, 0x88, 0xe2,
+            0xaa, 0xaa, 0xaa, 0xaa, 0x5e, 0xd1,
+        ],
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+    ],
+];
+
+const ISO_X_DEN: [[Fe; 2]; 2] = [
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xaa, 0x63,
+        ],
+    ],
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x0c,
+        ],
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xaa, 0x9f,
+        ],
+    ],
+];
+
+const ISO_Y_NUM: [[Fe; 2]; 4] = [
+    [
+        [
+            0x15, 0x30, 0x47, 0x7c, 0x7a, 0xb4, 0x11, 0x3b, 0x59, 0xa4, 0xc1, 0x8b, 0x07, 0x6d,
+            0x11, 0x93, 0x0f, 0x7d, 0xa5, 0xd4, 0xa0, 0x7f, 0x64, 0x9b, 0xf5, 0x44, 0x39, 0xd8,
+            0x7d, 0x27, 0xe5, 0x00, 0xfc, 0x8c, 0x25, 0xeb, 0xf8, 0xc9, 0x2f, 0x68, 0x12, 0xcf,
+            0xc7, 0x1c, 0x71, 0xc6, 0xd7, 0x06,
+        ],
+        [
+            0x15, 0x30, 0x47, 0x7c, 0x7a, 0xb4, 0x11, 0x3b, 0x59, 0xa4, 0xc1, 0x8b, 0x07, 0x6d,
+            0x11, 0x93, 0x0f, 0x7d, 0xa5, 0xd4, 0xa0, 0x7f, 0x64, 0x9b, 0xf5, 0x44, 0x39, 0xd8,
+            0x7d, 0x27, 0xe5, 0x00, 0xfc, 0x8c, 0x25, 0xeb, 0xf8, 0xc9, 0x2f, 0x68, 0x12, 0xcf,
+            0xc7, 0x1c, 0x71, 0xc6, 0xd7, 0x06,
+        ],
+    ],
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+        [
+            0x05, 0xc7, 0x59, 0x50, 0x7e, 0x8e, 0x33, 0x3e, 0xbb, 0x5b, 0x7a, 0x9a, 0x47, 0xd7,
+            0xed, 0x85, 0x32, 0xc5, 0x2d, 0x39, 0xfd, 0x3a, 0x04, 0x2a, 0x88, 0xb5, 0x84, 0x23,
+            0xc5, 0x0a, 0xe1, 0x5d, 0x5c, 0x26, 0x38, 0xe3, 0x43, 0xd9, 0xc7, 0x1c, 0x62, 0x38,
+            0xaa, 0xaa, 0xaa, 0xaa, 0x97, 0xbe,
+        ],
+    ],
+    [
+        [
+            0x11, 0x56, 0x0b, 0xf1, 0x7b, 0xaa, 0x99, 0xbc, 0x32, 0x12, 0x6f, 0xce, 0xd7, 0x87,
+            0xc8, 0x8f, 0x98, 0x4f, 0x87, 0xad, 0xf7, 0xae, 0x0c, 0x7f, 0x9a, 0x20, 0x8c, 0x6b,
+            0x4f, 0x20, 0xa4, 0x18, 0x14, 0x72, 0xaa, 0xa9, 0xcb, 0x8d, 0x55, 0x55, 0x26, 0xa9,
+            0xff, 0xff, 0xff, 0xff, 0xc7, 0x1c,
+        ],
+        [
+            0x08, 0xab, 0x05, 0xf8, 0xbd, 0xd5, 0x4c, 0xde, 0x19, 0x09, 0x37, 0xe7, 0x6b, 0xc3,
+            0xe4, 0x47, 0xcc, 0x27, 0xc3, 0xd6, 0xfb, 0xd7, 0x06, 0x3f, 0xcd, 0x10, 0x46, 0x35,
+            0xa7, 0x90, 0x52, 0x0c, 0x0a, 0x39, 0x55, 0x54, 0xe5, 0xc6, 0xaa, 0xaa, 0x93, 0x54,
+            0xff, 0xff, 0xff, 0xff, 0xe3, 0x8f,
+        ],
+    ],
+    [
+        [
+            0x12, 0x4c, 0x9a, 0xd4, 0x3b, 0x6c, 0xf7, 0x9b, 0xfb, 0xf7, 0x04, 0x3d, 0xe3, 0x81,
+            0x1a, 0xd0, 0x76, 0x1b, 0x0f, 0x37, 0xa1, 0xe2, 0x62, 0x86, 0xb0, 0xe9, 0x77, 0xc6,
+            0x9a, 0xa2, 0x74, 0x52, 0x4e, 0x79, 0x09, 0x7a, 0x56, 0xdc, 0x4b, 0xd9, 0xe1, 0xb3,
+            0x71, 0xc7, 0x1c, 0x71, 0x8b, 0x10,
+        ],
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+    ],
+];
+
+const ISO_Y_DEN: [[Fe; 2]; 3] = [
+    [
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xa8, 0xfb,
+        ],
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xa8, 0xfb,
+        ],
+    ],
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        ],
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xa9, 0xd3,
+        ],
+    ],
+    [
+        [
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x12,
+        ],
+        [
+            0x1a, 0x01, 0x11, 0xea, 0x39, 0x7f, 0xe6, 0x9a, 0x4b, 0x1b, 0xa7, 0xb6, 0x43, 0x4b,
+            0xac, 0xd7, 0x64, 0x77, 0x4b, 0x84, 0xf3, 0x85, 0x12, 0xbf, 0x67, 0x30, 0xd2, 0xa0,
+            0xf6, 0xb0, 0xf6, 0x24, 0x1e, 0xab, 0xff, 0xfe, 0xb1, 0x53, 0xff, 0xff, 0xb9, 0xfe,
+            0xff, 0xff, 0xff, 0xff, 0xaa, 0x99,
+        ],
+    ],
+];
+
+/// Engine state of the field operations: the prime, its Montgomery context
+/// and the temporaries of the `Fp2` operations. Field elements are held in
+/// Montgomery representation.
+struct Engine<'a> {
+    arena: &'a BnArena,
+    p: Bn<'a>,
+    mont: MontCtx<'a>,
+    zero: Bn<'a>,
+    one: Bn<'a>,
+    tmp: [Bn<'a>; 3],
+}
+
+impl<'a> Engine<'a> {
+    fn new(arena: &'a BnArena) -> Result<Self, CxError> {
+        let p = arena.alloc_init(FP_LEN, &P)?;
+        let mont = MontCtx::new(arena, &p)?;
+        let mut e = Engine {
+            arena,
+            p,
+            mont,
+            zero: arena.alloc(FP_LEN)?,
+            one: arena.alloc(FP_LEN)?,
+            tmp: [
+                arena.alloc(FP_LEN)?,
+                arena.alloc(FP_LEN)?,
+                arena.alloc(FP_LEN)?,
+            ],
+        };
+        e.tmp[0].set_u32(1)?;
+        e.mont.to_montgomery(&mut e.one, &e.tmp[0])?;
+        Ok(e)
+    }
+
+    /// `r` = the big endian value `v`, below `p`
+    fn load(&mut self, r: &mut Bn, v: &[u8]) -> Result<(), CxError> {
+        self.tmp[0].set_bytes(v)?;
+        self.mont.to_montgomery(r, &self.tmp[0])
+    }
+
+    /// `out` = value of `a`, big endian
+    fn store(&mut self, out: &mut Fe, a: &Bn) -> Result<(), CxError> {
+        self.mont.from_montgomery(&mut self.tmp[0], a)?;
+        self.tmp[0].export(out)
+    }
+
+    /// `r` = the big endian value `d` of any length, modulo `p`
+    fn reduce(&mut self, r: &mut Bn, d: &[u8]) -> Result<(), CxError> {
+        let d = self.arena.alloc_init(d.len(), d)?;
+        self.tmp[0].reduce(&d, &self.p)?;
+        self.mont.to_montgomery(r, &self.tmp[0])
+    }
+
+    fn is_square(&mut self, a: &Bn) -> Result<bool, CxError> {
+        // Legendre symbol: 1 or 0 for a square, -1 otherwise
+        self.mont.pow(&mut self.tmp[0], a, &P_MINUS_1_DIV_2)?;
+        Ok(self.tmp[0].compare(&self.one)? == Ordering::Equal
+            || self.tmp[0].compare(&self.zero)? == Ordering::Equal)
+    }
+
+    /// `r` = a square root of `a`. Returns whether `a` is a square.
+    fn sqrt(&mut self, r: &mut Bn, a: &Bn) -> Result<bool, CxError> {
+        self.mont.pow(r, a, &P_PLUS_1_DIV_4)?;
+        self.mont.mul(&mut self.tmp[0], r, r)?;
+        Ok(self.tmp[0].compare(a)? == Ordering::Equal)
+    }
+
+    /// Parity of the value of `a`
+    fn is_odd(&mut self, a: &Bn) -> Result<bool, CxError> {
+        self.mont.from_montgomery(&mut self.tmp[0], a)?;
+        self.tmp[0].is_odd()
+    }
+}
+
+/// Field arithmetic of the curve operations, implemented for `Fp` and
+/// `Fp2`. Results are never written over an operand, which the borrows
+/// enforce, and operands are never the temporaries of the engine.
+trait Field<'a>: Sized {
+    fn alloc(e: &Engine<'a>) -> Result<Self, CxError>;
+    /// `r` = the big endian value `v`, `[c0, c1]` for `Fp2`
+    fn load(e: &mut Engine<'a>, r: &mut Self, v: &[Fe]) -> Result<(), CxError>;
+    fn copy(r: &mut Self, a: &Self) -> Result<(), CxError>;
+    fn add(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError>;
+    fn sub(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError>;
+    fn neg(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError>;
+    fn mul(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError>;
+    fn sqr(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError>;
+    fn inv(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError>;
+    fn eq(a: &Self, b: &Self) -> Result<bool, CxError>;
+    fn is_zero(e: &Engine<'a>, a: &Self) -> Result<bool, CxError>;
+    fn set_zero(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError>;
+    fn set_one(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError>;
+    /// Swap `a` and `b` if `swap`, without branching on it
+    fn cswap(a: &mut Self, b: &mut Self, swap: bool);
+    /// Write the big endian value into `out`, `c1` first for `Fp2`. Returns
+    /// whether the value is greater than its opposite, the sign of the point
+    /// encoding.
+    fn store(e: &mut Engine<'a>, out: &mut [u8], a: &Self) -> Result<bool, CxError>;
+}
+
+impl<'a> Field<'a> for Bn<'a> {
+    fn alloc(e: &Engine<'a>) -> Result<Self, CxError> {
+        e.arena.alloc(FP_LEN)
+    }
+
+    fn load(e: &mut Engine<'a>, r: &mut Self, v: &[Fe]) -> Result<(), CxError> {
+        e.load(r, &v[0])
+    }
+
+    fn copy(r: &mut Self, a: &Self) -> Result<(), CxError> {
+        r.copy_from(a)
+    }
+
+    fn add(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        r.mod_add(a, b, &e.p)
+    }
+
+    fn sub(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        r.mod_sub(a, b, &e.p)
+    }
+
+    fn neg(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        r.mod_sub(&e.zero, a, &e.p)
+    }
+
+    fn mul(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        e.mont.mul(r, a, b)
+    }
+
+    fn sqr(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        e.mont.mul(r, a, a)
+    }
+
+    fn inv(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        e.mont.invert_nprime(r, a)
+    }
+
+    fn eq(a: &Self, b: &Self) -> Result<bool, CxError> {
+        Ok(a.compare(b)? == Ordering::Equal)
+    }
+
+    fn is_zero(e: &Engine<'a>, a: &Self) -> Result<bool, CxError> {
+        Self::eq(a, &e.zero)
+    }
+
+    fn set_zero(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError> {
+        r.copy_from(&e.zero)
+    }
+
+    fn set_one(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError> {
+        r.copy_from(&e.one)
+    }
+
+    fn cswap(a: &mut Self, b: &mut Self, swap: bool) {
+        Bn::cswap(a, b, swap)
+    }
+
+    fn store(e: &mut Engine<'a>, out: &mut [u8], a: &Self) -> Result<bool, CxError> {
+        let out: &mut Fe = out.try_into().map_err(|_| CxError::InvalidParameterSize)?;
+        e.store(out, a)?;
+        Ok(*out > P_MINUS_1_DIV_2)
+    }
+}
+
+/// Element `c0 + c1 u` of `Fp2 = Fp[u] / (u^2 + 1)`
+struct Fp2<'a> {
+    c0: Bn<'a>,
+    c1: Bn<'a>,
+}
+
+impl<'a> Field<'a> for Fp2<'a> {
+    fn alloc(e: &Engine<'a>) -> Result<Self, CxError> {
+        Ok(Fp2 {
+            c0: Bn::alloc(e)?,
+            c1: Bn::alloc(e)?,
+        })
+    }
+
+    fn load(e: &mut Engine<'a>, r: &mut Self, v: &[Fe]) -> Result<(), CxError> {
+        e.load(&mut r.c0, &v[0])?;
+        e.load(&mut r.c1, &v[1])
+    }
+
+    fn copy(r: &mut Self, a: &Self) -> Result<(), CxError> {
+        r.c0.copy_from(&a.c0)?;
+        r.c1.copy_from(&a.c1)
+    }
+
+    fn add(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        r.c0.mod_add(&a.c0, &b.c0, &e.p)?;
+        r.c1.mod_add(&a.c1, &b.c1, &e.p)
+    }
+
+    fn sub(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        r.c0.mod_sub(&a.c0, &b.c0, &e.p)?;
+        r.c1.mod_sub(&a.c1, &b.c1, &e.p)
+    }
+
+    fn neg(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        r.c0.mod_sub(&e.zero, &a.c0, &e.p)?;
+        r.c1.mod_sub(&e.zero, &a.c1, &e.p)
+    }
+
+    fn mul(e: &mut Engine<'a>, r: &mut Self, a: &Self, b: &Self) -> Result<(), CxError> {
+        // Karatsuba: 3 multiplications in Fp
+        let [t0, t1, t2] = &mut e.tmp;
+        e.mont.mul(t0, &a.c0, &b.c0)?;
+        e.mont.mul(t1, &a.c1, &b.c1)?;
+        t2.mod_add(&a.c0, &a.c1, &e.p)?;
+        r.c0.mod_add(&b.c0, &b.c1, &e.p)?;
+        e.mont.mul(&mut r.c1, t2, &r.c0)?;
+        t2.mod_add(t0, t1, &e.p)?;
+        // c1 = (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, computed into c0 first
+        r.c0.mod_sub(&r.c1, t2, &e.p)?;
+        core::mem::swap(&mut r.c0, &mut r.c1);
+        r.c0.mod_sub(t0, t1, &e.p)
+    }
+
+    fn sqr(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        // (a0 + a1)(a0 - a1) + 2 a0 a1 u
+        let [t0, t1, t2] = &mut e.tmp;
+        t0.mod_add(&a.c0, &a.c1, &e.p)?;
+        t1.mod_sub(&a.c0, &a.c1, &e.p)?;
+        e.mont.mul(&mut r.c0, t0, t1)?;
+        e.mont.mul(t2, &a.c0, &a.c1)?;
+        r.c1.mod_add(t2, t2, &e.p)
+    }
+
+    fn inv(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        // conj(a) / (a0^2 + a1^2)
+        Self::norm(e, &mut r.c0, a)?;
+        e.mont.invert_nprime(&mut r.c1, &r.c0)?;
+        e.mont.mul(&mut r.c0, &a.c0, &r.c1)?;
+        e.mont.mul(&mut e.tmp[0], &a.c1, &r.c1)?;
+        r.c1.mod_sub(&e.zero, &e.tmp[0], &e.p)
+    }
+
+    fn eq(a: &Self, b: &Self) -> Result<bool, CxError> {
+        Ok(Bn::eq(&a.c0, &b.c0)? && Bn::eq(&a.c1, &b.c1)?)
+    }
+
+    fn is_zero(e: &Engine<'a>, a: &Self) -> Result<bool, CxError> {
+        Ok(Bn::is_zero(e, &a.c0)? && Bn::is_zero(e, &a.c1)?)
+    }
+
+    fn set_zero(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError> {
+        r.c0.copy_from(&e.zero)?;
+        r.c1.copy_from(&e.zero)
+    }
+
+    fn set_one(e: &Engine<'a>, r: &mut Self) -> Result<(), CxError> {
+        r.c0.copy_from(&e.one)?;
+        r.c1.copy_from(&e.zero)
+    }
+
+    fn cswap(a: &mut Self, b: &mut Self, swap: bool) {
+        Bn::cswap(&mut a.c0, &mut b.c0, swap);
+        Bn::cswap(&mut a.c1, &mut b.c1, swap);
+    }
+
+    fn store(e: &mut Engine<'a>, out: &mut [u8], a: &Self) -> Result<bool, CxError> {
+        if out.len() != 2 * FP_LEN {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let (c1, c0) = out.split_at_mut(FP_LEN);
+        let sign1 = Bn::store(e, c1, &a.c1)?;
+        let sign0 = Bn::store(e, c0, &a.c0)?;
+        Ok(match c1.iter().all(|&b| b == 0) {
+            true => sign0,
+            false => sign1,
+        })
+    }
+}
+
+impl<'a> Fp2<'a> {
+    /// `r = a0^2 + a1^2`
+    fn norm(e: &mut Engine<'a>, r: &mut Bn<'a>, a: &Self) -> Result<(), CxError> {
+        let [_, t1, t2] = &mut e.tmp;
+        e.mont.mul(t1, &a.c0, &a.c0)?;
+        e.mont.mul(t2, &a.c1, &a.c1)?;
+        r.mod_add(t1, t2, &e.p)
+    }
+
+    /// `r = conj(a)`
+    fn conj(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        r.c0.copy_from(&a.c0)?;
+        r.c1.mod_sub(&e.zero, &a.c1, &e.p)
+    }
+
+    /// Whether `a` is a square, which is whether its norm is a square in `Fp`
+    fn is_square(e: &mut Engine<'a>, a: &Self) -> Result<bool, CxError> {
+        let mut norm = Bn::alloc(e)?;
+        Self::norm(e, &mut norm, a)?;
+        e.is_square(&norm)
+    }
+
+    /// `r` = a square root of `a`, computed in `Fp` from a square root of
+    /// the norm of `a`
+    fn sqrt(e: &mut Engine<'a>, r: &mut Self, a: &Self) -> Result<(), CxError> {
+        let mut t = Bn::alloc(e)?;
+        let ok = if Bn::is_zero(e, &a.c1)? {
+            // The root of an element of `Fp` is in `Fp` or in `u Fp`
+            if e.sqrt(&mut r.c0, &a.c0)? {
+                r.c1.copy_from(&e.zero)?;
+                true
+            } else {
+                r.c0.copy_from(&e.zero)?;
+                Bn::neg(e, &mut t, &a.c0)?;
+                e.sqrt(&mut r.c1, &t)?
+            }
+        } else {
+            // r0^2 = (a0 +- sqrt(a0^2 + a1^2)) / 2 and r1 = a1 / (2 r0)
+            let (mut alpha, mut delta) = (Bn::alloc(e)?, Bn::alloc(e)?);
+            Self::norm(e, &mut t, a)?;
+            let mut ok = e.sqrt(&mut alpha, &t)?;
+            e.load(&mut t, &INV_2)?;
+            r.c1.mod_add(&a.c0, &alpha, &e.p)?;
+            e.mont.mul(&mut delta, &r.c1, &t)?;
+            if !e.is_square(&delta)? {
+                r.c1.mod_sub(&a.c0, &alpha, &e.p)?;
+                e.mont.mul(&mut delta, &r.c1, &t)?;
+            }
+            ok &= e.sqrt(&mut r.c0, &delta)?;
+            alpha.mod_add(&r.c0, &r.c0, &e.p)?;
+            e.mont.invert_nprime(&mut t, &alpha)?;
+            e.mont.mul(&mut r.c1, &a.c1, &t)?;
+            ok
+        };
+        match ok {
+            true => Ok(()),
+            false => Err(CxError::NoResidue),
+        }
+    }
+
+    /// `sgn0` of the hash to curve specification: parity of `c0`, or of
+    /// `c1` if `c0` is zero
+    fn sgn0(e: &mut Engine<'a>, a: &Self) -> Result<bool, CxError> {
+        let sign0 = e.is_odd(&a.c0)?;
+        Ok(sign0 || (Bn::is_zero(e, &a.c0)? && e.is_odd(&a.c1)?))
+    }
+}
+
+/// Point `(x / z^2, y / z^3)` of `y^2 = x^3 + b` in Jacobian coordinates, at
+/// infinity when `z` is zero
+struct Point<F> {
+    x: F,
+    y: F,
+    z: F,
+}
+
+/// Temporaries of the point operations
+struct Scratch<F>([F; 7]);
+
+impl<'a, F: Field<'a>> Scratch<F> {
+    fn new(e: &Engine<'a>) -> Result<Self, CxError> {
+        Ok(Scratch([
+            F::alloc(e)?,
+            F::alloc(e)?,
+            F::alloc(e)?,
+            F::alloc(e)?,
+            F::alloc(e)?,
+            F::alloc(e)?,
+            F::alloc(e)?,
+        ]))
+    }
+}
+
+impl<'a, F: Field<'a>> Point<F> {
+    fn alloc(e: &Engine<'a>) -> Result<Self, CxError> {
+        Ok(Point {
+            x: F::alloc(e)?,
+            y: F::alloc(e)?,
+            z: F::alloc(e)?,
+        })
+    }
+
+    fn copy(&mut self, a: &Self) -> Result<(), CxError> {
+        F::copy(&mut self.x, &a.x)?;
+        F::copy(&mut self.y, &a.y)?;
+        F::copy(&mut self.z, &a.z)
+    }
+
+    fn cswap(a: &mut Self, b: &mut Self, swap: bool) {
+        F::cswap(&mut a.x, &mut b.x, swap);
+        F::cswap(&mut a.y, &mut b.y, swap);
+        F::cswap(&mut a.z, &mut b.z, swap);
+    }
+
+    fn neg(&mut self, e: &mut Engine<'a>, s: &mut Scratch<F>) -> Result<(), CxError> {
+        F::neg(e, &mut s.0[0], &self.y)?;
+        core::mem::swap(&mut self.y, &mut s.0[0]);
+        Ok(())
+    }
+
+    /// `self = 2 self`, with the `dbl-2009-l` formulas
+    fn double(&mut self, e: &mut Engine<'a>, s: &mut Scratch<F>) -> Result<(), CxError> {
+        let [t0, t1, t2, t3, t4, t5, t6] = &mut s.0;
+        F::sqr(e, t0, &self.x)?; // A
+        F::sqr(e, t1, &self.y)?; // B
+        F::sqr(e, t2, t1)?; // C
+        F::add(e, t3, &self.x, t1)?;
+        F::sqr(e, t4, t3)?;
+        F::sub(e, t3, t4, t0)?;
+        F::sub(e, t4, t3, t2)?;
+        F::add(e, t3, t4, t4)?; // D
+        F::add(e, t4, t0, t0)?;
+        F::add(e, t5, t4, t0)?; // E
+        F::sqr(e, t6, t5)?; // F
+        F::mul(e, t4, &self.y, &self.z)?;
+        F::add(e, &mut self.z, t4, t4)?;
+        F::add(e, t4, t3, t3)?;
+        F::sub(e, &mut self.x, t6, t4)?;
+        F::sub(e, t4, t3, &self.x)?;
+        F::mul(e, t6, t5, t4)?;
+        F::add(e, t0, t2, t2)?;
+        F::add(e, t2, t0, t0)?;
+        F::add(e, t0, t2, t2)?; // 8 C
+        F::sub(e, &mut self.y, t6, t0)
+    }
+
+    /// `self = self + b`, with the `add-2007-bl` formulas
+    fn add_assign(
+        &mut self,
+        e: &mut Engine<'a>,
+        b: &Self,
+        s: &mut Scratch<F>,
+    ) -> Result<(), CxError> {
+        if F::is_zero(e, &b.z)? {
+            return Ok(());
+        }
+        if F::is_zero(e, &self.z)? {
+            return self.copy(b);
+        }
+        let [t0, t1, t2, t3, t4, t5, t6] = &mut s.0;
+        F::sqr(e, t0, &self.z)?; // Z1Z1
+        F::sqr(e, t1, &b.z)?; // Z2Z2
+        F::mul(e, t2, &self.x, t1)?; // U1
+        F::mul(e, t3, &b.x, t0)?; // U2
+        F::mul(e, t4, &b.z, t1)?;
+        F::mul(e, t5, &self.y, t4)?; // S1
+        F::mul(e, t4, &self.z, t0)?;
+        F::mul(e, t6, &b.y, t4)?; // S2
+        if F::eq(t2, t3)? {
+            return match F::eq(t5, t6)? {
+                true => self.double(e, s),
+                false => F::set_zero(e, &mut self.z),
+            };
+        }
+        F::sub(e, t4, t3, t2)?; // H
+        F::add(e, t3, &self.z, &b.z)?;
+        F::sqr(e, &mut self.x, t3)?;
+        F::sub(e, t3, &self.x, t0)?;
+        F::sub(e, &mut self.x, t3, t1)?;
+        F::mul(e, &mut self.z, &self.x, t4)?;
+        F::add(e, t0, t4, t4)?;
+        F::sqr(e, t1, t0)?; // I
+        F::mul(e, t3, t4, t1)?; // J
+        F::sub(e, t0, t6, t5)?;
+        F::add(e, t6, t0, t0)?; // r
+        F::mul(e, t0, t2, t1)?; // V
+        F::sqr(e, t1, t6)?;
+        F::sub(e, t2, t1, t3)?;
+        F::add(e, t1, t0, t0)?;
+        F::sub(e, &mut self.x, t2, t1)?;
+        F::sub(e, t1, t0, &self.x)?;
+        F::mul(e, t2, t6, t1)?;
+        F::mul(e, t1, t5, t3)?;
+        F::add(e, t4, t1, t1)?;
+        F::sub(e, &mut self.y, t2, t4)
+    }
+
+    /// `self = k b`, for a public `k`
+    fn mul_u64(
+        &mut self,
+        e: &mut Engine<'a>,
+        b: &Self,
+        k: u64,
+        s: &mut Scratch<F>,
+    ) -> Result<(), CxError> {
+        self.copy(b)?;
+        for i in (0..63 - k.leading_zeros()).rev() {
+            self.double(e, s)?;
+            if (k >> i) & 1 == 1 {
+                self.add_assign(e, b, s)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// `self = k self`, `k` being a big endian secret below the order of the
+    /// group, which `self` must be in. The sequence of operations of the
+    /// Montgomery ladder only depends on the bit length of `k`.
+    fn mul_secret(
+        &mut self,
+        e: &mut Engine<'a>,
+        k: &[u8],
+        s: &mut Scratch<F>,
+    ) -> Result<(), CxError> {
+        let bit = |i: usize| (k[k.len() - 1 - i / 8] >> (i % 8)) & 1 == 1;
+        let top = match (0..k.len() * 8).rev().find(|&i| bit(i)) {
+            Some(top) => top,
+            None => return F::set_zero(e, &mut self.z),
+        };
+        let mut r1 = Self::alloc(e)?;
+        r1.copy(self)?;
+        r1.double(e, s)?;
+        for i in (0..top).rev() {
+            Self::cswap(self, &mut r1, bit(i));
+            r1.add_assign(e, self, s)?;
+            self.double(e, s)?;
+            Self::cswap(self, &mut r1, bit(i));
+        }
+        Ok(())
+    }
+
+    /// Compressed encoding of the point into `out`, of twice the size of a
+    /// coordinate
+    fn compress(
+        &self,
+        e: &mut Engine<'a>,
+        out: &mut [u8],
+        s: &mut Scratch<F>,
+    ) -> Result<(), CxError> {
+        out.fill(0);
+        if F::is_zero(e, &self.z)? {
+            out[0] = 0xc0;
+            return Ok(());
+        }
+        let [t0, t1, t2, t3, ..] = &mut s.0;
+        F::inv(e, t0, &self.z)?;
+        F::sqr(e, t1, t0)?;
+        F::mul(e, t2, &self.x, t1)?;
+        F::store(e, out, t2)?;
+        F::mul(e, t2, t1, t0)?;
+        F::mul(e, t3, &self.y, t2)?;
+        let mut y = [0u8; 2 * FP_LEN];
+        let sign = F::store(e, &mut y[..out.len()], t3)?;
+        out[0] |= 0x80 | ((sign as u8) << 5);
+        Ok(())
+    }
+}
+
+impl<'a> Point<Fp2<'a>> {
+    /// `self = psi(self)`, the endomorphism `(x, y) -> (PSI_X conj(x),
+    /// PSI_Y conj(y))` of E2
+    fn psi(&mut self, e: &mut Engine<'a>, s: &mut Scratch<Fp2<'a>>) -> Result<(), CxError> {
+        let [t0, t1, ..] = &mut s.0;
+        Fp2::conj(e, t0, &self.x)?;
+        Fp2::load(e, t1, &PSI_X)?;
+        Fp2::mul(e, &mut self.x, t0, t1)?;
+        Fp2::conj(e, t0, &self.y)?;
+        Fp2::load(e, t1, &PSI_Y)?;
+        Fp2::mul(e, &mut self.y, t0, t1)?;
+        Fp2::conj(e, t0, &self.z)?;
+        core::mem::swap(&mut self.z, t0);
+        Ok(())
+    }
+
+    /// Multiply by the effective cofactor of G2, as
+    /// `[x^2 - x - 1] P + [x - 1] psi(P) + psi^2(2 P)`
+    fn clear_cofactor(
+        &mut self,
+        e: &mut Engine<'a>,
+        s: &mut Scratch<Fp2<'a>>,
+    ) -> Result<(), CxError> {
+        let (mut a, mut b) = (Self::alloc(e)?, Self::alloc(e)?);
+        // a = x P, b = x^2 P - x P + psi(x P)
+        a.mul_u64(e, self, MINUS_X, s)?;
+        a.neg(e, s)?;
+        b.mul_u64(e, &a, MINUS_X, s)?;
+        b.neg(e, s)?;
+        a.neg(e, s)?;
+        b.add_assign(e, &a, s)?;
+        a.neg(e, s)?;
+        a.psi(e, s)?;
+        b.add_assign(e, &a, s)?;
+        // + psi^2(2 P)
+        a.copy(self)?;
+        a.double(e, s)?;
+        a.psi(e, s)?;
+        a.psi(e, s)?;
+        b.add_assign(e, &a, s)?;
+        // - psi(P) - P
+        a.copy(self)?;
+        a.psi(e, s)?;
+        a.add_assign(e, self, s)?;
+        a.neg(e, s)?;
+        b.add_assign(e, &a, s)?;
+        core::mem::swap(self, &mut b);
+        Ok(())
+    }
+}
+
+/// `r = v[n-1] x^(n-1) + ... + v[0]`, plus `x^n` if `monic`
+fn horner<'a>(
+    e: &mut Engine<'a>,
+    r: &mut Fp2<'a>,
+    v: &[[Fe; 2]],
+    monic: bool,
+    x: &Fp2<'a>,
+    [t0, t1]: [&mut Fp2<'a>; 2],
+) -> Result<(), CxError> {
+    let (last, rest) = v.split_last().ok_or(CxError::InvalidParameter)?;
+    if monic {
+        Fp2::load(e, t0, last)?;
+        Fp2::add(e, r, x, t0)?;
+    } else {
+        Fp2::load(e, r, last)?;
+    }
+    for c in rest.iter().rev() {
+        Fp2::mul(e, t0, r, x)?;
+        Fp2::load(e, t1, c)?;
+        Fp2::add(e, r, t0, t1)?;
+    }
+    Ok(())
+}
+
+/// `r = x^3 + A x + B`, the right-hand side of the SSWU curve
+fn sswu_rhs<'a>(
+    e: &mut Engine<'a>,
+    r: &mut Fp2<'a>,
+    x: &Fp2<'a>,
+    [t0, t1]: [&mut Fp2<'a>; 2],
+) -> Result<(), CxError> {
+    Fp2::sqr(e, t0, x)?;
+    Fp2::load(e, r, &SSWU_A)?;
+    Fp2::add(e, t1, t0, r)?;
+    Fp2::mul(e, t0, t1, x)?;
+    Fp2::load(e, t1, &SSWU_B)?;
+    Fp2::add(e, r, t0, t1)
+}
+
+/// `q = map_to_curve(u)`: the simplified SWU map to the isogenous curve,
+/// then the 3-isogeny to E2. The isogeny is evaluated in Jacobian
+/// coordinates, `z` being the product of the denominators, so that no
+/// inversion is needed.
+fn map_to_g2<'a>(
+    e: &mut Engine<'a>,
+    u: &Fp2<'a>,
+    q: &mut Point<Fp2<'a>>,
+    s: &mut Scratch<Fp2<'a>>,
+) -> Result<(), CxError> {
+    let [t0, t1, t2, t3, t4, t5, t6] = &mut s.0;
+    // tv1 = Z^2 u^4 + Z u^2
+    Fp2::load(e, t0, &SSWU_Z)?;
+    Fp2::sqr(e, t1, u)?;
+    Fp2::mul(e, t2, t0, t1)?;
+    Fp2::sqr(e, t3, t2)?;
+    Fp2::add(e, t4, t3, t2)?;
+    // x1 = -B / A (1 + 1 / tv1), or B / (Z A) if tv1 is zero
+    if Fp2::is_zero(e, t4)? {
+        Fp2::load(e, &mut q.x, &SSWU_B_DIV_ZA)?;
+    } else {
+        Fp2::inv(e, t3, t4)?;
+        Fp2::set_one(e, t5)?;
+        Fp2::add(e, t6, t3, t5)?;
+        Fp2::load(e, t5, &SSWU_MINUS_B_DIV_A)?;
+        Fp2::mul(e, &mut q.x, t5, t6)?;
+    }
+    // x2 = Z u^2 x1
+    Fp2::mul(e, t1, t2, &q.x)?;
+    sswu_rhs(e, &mut q.y, &q.x, [t2, t3])?;
+    if Fp2::is_square(e, &q.y)? {
+        Fp2::sqrt(e, t4, &q.y)?;
+    } else {
+        sswu_rhs(e, t5, t1, [t2, t3])?;
+        Fp2::sqrt(e, t4, t5)?;
+        Fp2::copy(&mut q.x, t1)?;
+    }
+    if Fp2::sgn0(e, u)? != Fp2::sgn0(e, t4)? {
+        Fp2::neg(e, &mut q.y, t4)?;
+    } else {
+        Fp2::copy(&mut q.y, t4)?;
+    }
+
+    horner(e, t0, &ISO_X_NUM, false, &q.x, [t1, t2])?;
+    horner(e, t3, &ISO_X_DEN, true, &q.x, [t1, t2])?;
+    horner(e, t4, &ISO_Y_NUM, false, &q.x, [t1, t2])?;
+    horner(e, t5, &ISO_Y_DEN, true, &q.x, [t1, t2])?;
+    // z = xd yd, x = xn xd yd^2 and y = y yn xd^3 yd^2
+    Fp2::mul(e, &mut q.z, t3, t5)?;
+    Fp2::sqr(e, t1, t5)?;
+    Fp2::mul(e, t2, t0, t3)?;
+    Fp2::mul(e, &mut q.x, t2, t1)?;
+    Fp2::sqr(e, t2, t3)?;
+    Fp2::mul(e, t0, t2, t3)?;
+    Fp2::mul(e, t2, t0, t1)?;
+    Fp2::mul(e, t0, t4, t2)?;
+    Fp2::mul(e, t6, &q.y, t0)?;
+    core::mem::swap(&mut q.y, t6);
+    Ok(())
+}
+
+/// `q = hash_to_curve(msg)` of the `BLS12381G2_XMD:SHA-256_SSWU_RO_` suite
+fn hash_to_g2<'a>(
+    e: &mut Engine<'a>,
+    msg: &[u8],
+    dst: &[u8],
+    q: &mut Point<Fp2<'a>>,
+    s: &mut Scratch<Fp2<'a>>,
+) -> Result<(), CxError> {
+    // Two elements of Fp2, each coordinate from 64 bytes
+    let mut uniform = [0u8; 256];
+    expand_message_xmd::<Sha256>(&[msg], dst, &mut uniform)?;
+    let mut u = Fp2::alloc(e)?;
+    let mut q1 = Point::alloc(e)?;
+    let (u0, u1) = uniform.split_at(128);
+    for (u_bytes, p) in [(u0, &mut *q), (u1, &mut q1)] {
+        e.reduce(&mut u.c0, &u_bytes[..64])?;
+        e.reduce(&mut u.c1, &u_bytes[64..])?;
+        map_to_g2(e, &u, p, s)?;
+    }
+    q.add_assign(e, &q1, s)?;
+    q.clear_cofactor(e, s)
+}
+
+/// Check that the secret key is in `[1, r - 1]`
+fn check_key(sk: &[u8; 32]) -> Result<(), CxError> {
+    match sk.iter().any(|&b| b != 0) && ct_lt(sk, &R) {
+        true => Ok(()),
+        false => Err(CxError::InvalidParameterValue),
+    }
+}
+
+/// Sign `msg` with the secret key `sk`, big endian, under the domain
+/// separation tag `dst`, such as [`BLS_DST_POP`]. Returns the compressed
+/// signature.
+pub fn bls_sign(sk: &[u8; 32], msg: &[u8], dst: &[u8]) -> Result<[u8; BLS_SIG_LEN], CxError> {
+    check_key(sk)?;
+    let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+    let mut e = Engine::new(&arena)?;
+    let mut s = Scratch::new(&e)?;
+    let mut q = Point::alloc(&e)?;
+    hash_to_g2(&mut e, msg, dst, &mut q, &mut s)?;
+    q.mul_secret(&mut e, sk, &mut s)?;
+    let mut sig = [0u8; BLS_SIG_LEN];
+    q.compress(&mut e, &mut sig, &mut s)?;
+    Ok(sig)
+}
+
+/// Compressed public key of the secret key `sk`, big endian
+pub fn bls_public_key(sk: &[u8; 32]) -> Result<[u8; BLS_PK_LEN], CxError> {
+    check_key(sk)?;
+    let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+    let mut e = Engine::new(&arena)?;
+    let mut s = Scratch::new(&e)?;
+    let mut q = Point::<Bn>::alloc(&e)?;
+    e.load(&mut q.x, &G1_X)?;
+    e.load(&mut q.y, &G1_Y)?;
+    Bn::set_one(&e, &mut q.z)?;
+    q.mul_secret(&mut e, sk, &mut s)?;
+    let mut pk = [0u8; BLS_PK_LEN];
+    q.compress(&mut e, &mut pk, &mut s)?;
+    Ok(pk)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // Ethereum consensus specs test vectors, sign_case_0 with a zero
+    // message
+    const SK: [u8; 32] = [
+        0x26, 0x3d, 0xbd, 0x79, 0x2f, 0x5b, 0x1b, 0xe4, 0x7e, 0xd8, 0x5f, 0x89, 0x38, 0xc0, 0xf2,
+        0x95, 0x86, 0xaf, 0x0d, 0x3a, 0xc7, 0xb9, 0x77, 0xf2, 0x1c, 0x27, 0x8f, 0xe1, 0x46, 0x20,
+        0x40, 0xe3,
+    ];
+
+    const PK: [u8; 48] = [
+        0xa4, 0x91, 0xd1, 0xb0, 0xec, 0xd9, 0xbb, 0x91, 0x79, 0x89, 0xf0, 0xe7, 0x4f, 0x0d, 0xea,
+        0x04, 0x22, 0xea, 0xc4, 0xa8, 0x73, 0xe5, 0xe2, 0x64, 0x4f, 0x36, 0x8d, 0xff, 0xb9, 0xa6,
+        0xe2, 0x0f, 0xd6, 0xe1, 0x0c, 0x1b, 0x77, 0x65, 0x4d, 0x06, 0x7c, 0x06, 0x18, 0xf6, 0xe5,
+        0xa7, 0xf7, 0x9a,
+    ];
+    const SIG: [u8; 96] = [
+        0xb6, 0xed, 0x93, 0x67, 0x46, 0xe0, 0x1f, 0x8e, 0xcf, 0x28, 0x1f, 0x02, 0x09, 0x53, 0xfb,
+        0xf1, 0xf0, 0x1d, 0xeb, 0xd5, 0x65, 0x7c, 0x4a, 0x38, 0x39, 0x40, 0xb0, 0x20, 0xb2, 0x65,
+        0x07, 0xf6, 0x07, 0x63, 0x34, 0xf9, 0x1e, 0x23, 0x66, 0xc9, 0x6e, 0x9a, 0xb2, 0x79, 0xfb,
+        0x51, 0x58, 0x09, 0x03, 0x52, 0xea, 0x1c, 0x5b, 0x0c, 0x92, 0x74, 0x50, 0x4f, 0x4f, 0x0e,
+        0x70, 0x53, 0xaf, 0x24, 0x80, 0x2e, 0x51, 0xe4, 0x56, 0x8d, 0x16, 0x4f, 0xe9, 0x86, 0x83,
+        0x4f, 0x41, 0xe5, 0x5c, 0x8e, 0x85, 0x0c, 0xe1, 0xf9, 0x84, 0x58, 0xc0, 0xcf, 0xc9, 0xab,
+        0x38, 0x0b, 0x55, 0x28, 0x5a, 0x55,
+    ];
+
+    #[test]
+    fn sign() {
+        assert_eq!(bls_public_key(&SK), Ok(PK));
+        assert_eq!(bls_sign(&SK, &[0; 32], BLS_DST_POP), Ok(SIG));
+        assert_eq!(
+            bls_sign(&R, &[], BLS_DST_POP),
+            Err(CxError::InvalidParameterValue)
+        );
+    }
+}
@@ -0,0 +1,244 @@
+//! Ed25519 signatures from an expanded key
+//!
+//! `cx_eddsa_sign_no_throw` expands the private key with SHA-512 on every
+//! signature. An [`ExpandedEd25519Key`] keeps the secret scalar and the
+//! nonce prefix instead, so that a session signing many messages only
+//! expands its key once.
+//!
+//! Ed25519 hashes the message twice, first for the nonce and then for the
+//! challenge. A [`SignStream`] takes the message in chunks for each of the
+//! two passes, so large messages never have to be buffered: the host sends
+//! the message once, the app calls [`SignStream::commit`], then the host
+//! sends it a second time.
+
+use crate::bn::BnArena;
+use crate::ecc::{CurvesId, CxError, ECPrivateKey, EcPoint, Secret};
+use crate::hash::{HashFn, Sha512};
+
+/// Length of an Ed25519 signature
+pub const ED25519_SIG_LEN: usize = 64;
+
+// L: 0x1000000000000000000000000000000014def9dea2f79cd65812631a5cf5d3ed
+pub(super) const ED25519_ORDER: [u8; 32] = [
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x14, 0xde, 0xf9, 0xde, 0xa2, 0xf7, 0x9c, 0xd6, 0x58, 0x12, 0x63, 0x1a, 0x5c, 0xf5, 0xd3, 0xed,
+];
+
+/// `digest mod L`, `digest` being a little endian SHA-512 output, as a big
+/// endian scalar
+pub(super) fn reduce_digest(
+    arena: &BnArena,
+    digest: &[u8; 64],
+    out: &mut [u8; 32],
+) -> Result<(), CxError> {
+    let mut be = Secret::<64>::new();
+    be.as_mut().copy_from_slice(digest);
+    be.as_mut().reverse();
+    let d = arena.alloc_init(64, be.as_ref())?;
+    let n = arena.alloc_init(32, &ED25519_ORDER)?;
+    let mut r = arena.alloc(32)?;
+    r.reduce(&d, &n)?;
+    r.export(out)
+}
+
+/// Encoding of the point of big endian affine coordinates (`x`, `y`): the
+/// little endian `y` with the parity of `x` in the top bit
+pub(super) fn encode_point(x: &[u8], y: &[u8]) -> [u8; 32] {
+    let mut encoded = [0u8; 32];
+    encoded.copy_from_slice(y);
+    encoded.reverse();
+    encoded[31] |= (x[31] & 1) << 7;
+    encoded
+}
+
+/// Encoded `k * B`
+fn mul_base(arena: &BnArena, k: &[u8; 32]) -> Result<[u8; 32], CxError> {
+    let mut p = EcPoint::generator(arena, CurvesId::Ed25519)?;
+    p.scalarmul(k)?;
+    let mut x = [0u8; 32];
+    let mut y = [0u8; 32];
+    p.export(&mut x, &mut y)?;
+    Ok(encode_point(&x, &y))
+}
+
+/// Ed25519 private key expanded once, zeroized on drop
+pub struct ExpandedEd25519Key {
+    /// Secret scalar `a mod L`, big endian
+    scalar: Secret<32>,
+    /// Second half of the expanded key, hashed with the message for nonces
+    prefix: Secret<32>,
+    /// Encoded public key `A = a * B`
+    public_key: [u8; 32],
+}
+
+impl ExpandedEd25519Key {
+    /// Expand `key`, computing its public key
+    pub fn new(key: &ECPrivateKey<32, 'E'>) -> Result<Self, CxError> {
+        if !matches!(key.curve, CurvesId::Ed25519) {
+            return Err(CxError::InvalidCurve);
+        }
+        let mut h = Secret::<64>::new();
+        let mut sha = Sha512::new();
+        sha.update(&key.key)?;
+        sha.finalize_into(h.as_mut())?;
+
+        let mut expanded = ExpandedEd25519Key {
+            scalar: Secret::new(),
+            prefix: Secret::new(),
+            public_key: [0u8; 32],
+        };
+        expanded.prefix.as_mut().copy_from_slice(&h.as_ref()[32..]);
+
+        let mut a = Secret::<64>::new();
+        a.as_mut()[..32].copy_from_slice(&h.as_ref()[..32]);
+        a.as_mut()[0] &= 248;
+        a.as_mut()[31] &= 127;
+        a.as_mut()[31] |= 64;
+
+        let arena = BnArena::lock(32)?;
+        let mut scalar = [0u8; 32];
+        reduce_digest(&arena, a.as_ref().try_into().unwrap(), &mut scalar)?;
+        expanded.scalar.as_mut().copy_from_slice(&scalar);
+        scalar.fill(0);
+        expanded.public_key = mul_base(&arena, expanded.scalar())?;
+        Ok(expanded)
+    }
+
+    fn scalar(&self) -> &[u8; 32] {
+        self.scalar.as_ref().try_into().unwrap()
+    }
+
+    /// Encoded public key, as used in signatures
+    pub fn public_key(&self) -> &[u8; 32] {
+        &self.public_key
+    }
+
+    /// Sign `msg`, returning the `R || S` signature. Signatures are the same
+    /// as the ones of [`ECPrivateKey::sign`].
+    pub fn sign(&self, msg: &[u8]) -> Result<[u8; ED25519_SIG_LEN], CxError> {
+        let mut stream = self.sign_stream();
+        stream.update(msg)?;
+        stream.commit()?;
+        stream.update(msg)?;
+        stream.finalize()
+    }
+
+    /// Start signing a message given in chunks
+    pub fn sign_stream(&self) -> SignStream<'_> {
+        let mut h = Sha512::new();
+        // Cannot fail on a freshly initialized context
+        let _ = h.update(self.prefix.as_ref());
+        SignStream {
+            key: self,
+            h,
+            r: Secret::new(),
+            encoded_r: [0u8; 32],
+            committed: false,
+        }
+    }
+}
+
+/// Signature of a message fed twice in chunks, see the module documentation
+pub struct SignStream<'a> {
+    key: &'a ExpandedEd25519Key,
+    h: Sha512,
+    /// Nonce, big endian
+    r: Secret<32>,
+    /// Encoded `R = r * B`
+    encoded_r: [u8; 32],
+    committed: bool,
+}
+
+impl SignStream<'_> {
+    /// Hash the next chunk of the message, for the current pass
+    pub fn update(&mut self, chunk: &[u8]) -> Result<(), CxError> {
+        self.h.update(chunk)
+    }
+
+    /// End the first pass, computing the nonce. The whole message must then
+    /// be fed again.
+    pub fn commit(&mut self) -> Result<(), CxError> {
+        if self.committed {
+            return Err(CxError::InvalidParameter);
+        }
+        let mut digest = Secret::<64>::new();
+        self.h.finalize_into(digest.as_mut())?;
+        {
+            let arena = BnArena::lock(32)?;
+            let mut r = [0u8; 32];
+            reduce_digest(&arena, digest.as_ref().try_into().unwrap(), &mut r)?;
+            self.r.as_mut().copy_from_slice(&r);
+            self.encoded_r = mul_base(&arena, &r)?;
+            r.fill(0);
+        }
+        self.h.reset()?;
+        self.h.update(&self.encoded_r)?;
+        self.h.update(&self.key.public_key)?;
+        self.committed = true;
+        Ok(())
+    }
+
+    /// End the second pass, returning the `R || S` signature
+    pub fn finalize(mut self) -> Result<[u8; ED25519_SIG_LEN], CxError> {
+        if !self.committed {
+            return Err(CxError::InvalidParameter);
+        }
+        let mut digest = [0u8; 64];
+        self.h.finalize_into(&mut digest)?;
+
+        let mut sig = [0u8; ED25519_SIG_LEN];
+        sig[..32].copy_from_slice(&self.encoded_r);
+        {
+            let arena = BnArena::lock(32)?;
+            let mut k = [0u8; 32];
+            reduce_digest(&arena, &digest, &mut k)?;
+            let n = arena.alloc_init(32, &ED25519_ORDER)?;
+            let k = arena.alloc_init(32, &k)?;
+            let a = arena.alloc_init(32, self.key.scalar.as_ref())?;
+            let r = arena.alloc_init(32, self.r.as_ref())?;
+            // S = r + k * a mod L
+            let mut s = arena.alloc(32)?;
+            s.mod_mul(&k, &a, &n)?;
+            let mut t = arena.alloc(32)?;
+            t.mod_add(&s, &r, &n)?;
+            t.export(&mut sig[32..])?;
+        }
+        sig[32..].reverse();
+        Ok(sig)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, Ed25519, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PATH: [u32; 5] = make_bip32_path(b"m/44'/535348'/0'/0/0");
+
+    #[test]
+    fn expanded_sign() {
+        let sk = Ed25519::derive_from_path(&PATH);
+        let expanded = ExpandedEd25519Key::new(&sk).map_err(|_| ())?;
+        let mut msg = [0u8; 300];
+        msg.iter_mut().enumerate().for_each(|(i, b)| *b = i as u8);
+
+        // cx_eddsa_sign_no_throw is deterministic: signatures must match
+        let expected = sk.sign(&msg).map_err(|_| ())?;
+        let sig = expanded.sign(&msg).map_err(|_| ())?;
+        assert_eq!(&sig[..], &expected.0[..]);
+
+        let mut stream = expanded.sign_stream();
+        for chunk in msg.chunks(128) {
+            stream.update(chunk).map_err(|_| ())?;
+        }
+        stream.commit().map_err(|_| ())?;
+        for chunk in msg.chunks(100) {
+            stream.update(chunk).map_err(|_| ())?;
+        }
+        let sig = stream.finalize().map_err(|_| ())?;
+        assert_eq!(&sig[..], &expected.0[..]);
+    }
+}
@@ -0,0 +1,881 @@
+//! Hashing to elliptic curves (RFC 9380)
+//!
+//! The suites `secp256k1_XMD:SHA-256_SSWU_`, `P256_XMD:SHA-256_SSWU_` and
+//! `edwards25519_XMD:SHA-512_ELL2_`, in their random oracle (`hash`) and
+//! nonuniform (`encode`) flavors, for VRFs, OPRFs and other protocols
+//! hashing their inputs to points.
+//!
+//! The mappings run on the bignum engine in the arena given by the caller,
+//! which can go on with the resulting [`EcPoint`] under the same lock. The
+//! field elements stay in Montgomery representation, and the mappings use
+//! the same sequence of operations whatever their input, the choices
+//! between candidates being made with [`Bn::cswap`]. The arena must be
+//! locked with words of 32 bytes.
+//!
+//! ```
+//! let arena = BnArena::lock(32)?;
+//! let mut h = HashToCurveSuite::Secp256k1Sha256Sswu.hash_to_curve(&arena, &[pk, alpha], DST)?;
+//! h.scalarmul(&sk)?;
+//! ```
+//!
+//! [`expand_message_xmd`] is also available on its own, over the
+//! streaming hashes of [`crate::hash`].
+
+use super::{CurvesId, CxError, EcPoint};
+use crate::bn::{Bn, BnArena, MontCtx};
+use crate::hash::{HashFn, Sha256, Sha384, Sha512};
+use core::cmp::Ordering;
+
+/// Hash function usable by [`expand_message_xmd`], a Merkle-Damgård hash
+/// whose input block size is needed to pad the message
+pub trait XmdHash: HashFn {
+    /// Input block size, in bytes
+    const BLOCK_LEN: usize;
+
+    fn new() -> Self;
+}
+
+impl XmdHash for Sha256 {
+    const BLOCK_LEN: usize = 64;
+
+    fn new() -> Self {
+        Sha256::new()
+    }
+}
+
+impl XmdHash for Sha384 {
+    const BLOCK_LEN: usize = 128;
+
+    fn new() -> Self {
+        Sha384::new()
+    }
+}
+
+impl XmdHash for Sha512 {
+    const BLOCK_LEN: usize = 128;
+
+    fn new() -> Self {
+        Sha512::new()
+    }
+}
+
+/// `expand_message_xmd` of RFC 9380, section 5.3.1: fill `out` (up to 255
+/// digests) with uniform bytes from the message, the concatenation of
+/// `msg`, under the domain separation tag `dst` of at most 255 bytes
+pub fn expand_message_xmd<H: XmdHash>(
+    msg: &[&[u8]],
+    dst: &[u8],
+    out: &mut [u8],
+) -> Result<(), CxError> {
+    let dst_len = [u8::try_from(dst.len()).map_err(|_| CxError::InvalidParameterSize)?];
+    let out_len = u16::try_from(out.len()).map_err(|_| CxError::InvalidParameterSize)?;
+    let mut h = H::new();
+    let b = h.digest_size();
+    if b > 64 || out.len().div_ceil(b) > 255 {
+        return Err(CxError::InvalidParameterSize);
+    }
+    h.update(&[0; 128][..H::BLOCK_LEN])?;
+    for part in msg {
+        h.update(part)?;
+    }
+    // Output length, then a zero byte
+    h.update(&out_len.to_be_bytes())?;
+    h.update(&[0])?;
+    h.update(dst)?;
+    h.update(&dst_len)?;
+    let mut b0 = [0u8; 64];
+    h.finalize_into(&mut b0)?;
+
+    // b_i = H((b_0 ^ b_(i-1)) || i || DST'), b_0 ^ b_0 being zero
+    let mut chain = [0u8; 64];
+    for (i, block) in out.chunks_mut(b).enumerate() {
+        chain.iter_mut().zip(&b0[..b]).for_each(|(c, b)| *c ^= b);
+        h.reset()?;
+        h.update(&chain[..b])?;
+        h.update(&[i as u8 + 1])?;
+        h.update(dst)?;
+        h.update(&dst_len)?;
+        h.finalize_into(&mut chain)?;
+        block.copy_from_slice(&chain[..block.len()]);
+    }
+    Ok(())
+}
+
+/// Field element, big endian
+type Fe = [u8; 32];
+
+/// Bytes of uniform data reduced to each field element, `L` of the suites
+const FIELD_BYTES: usize = 48;
+
+/// Parameters of the simplified SWU map to `y^2 = x^3 + A x + B`
+struct Sswu {
+    a: &'static Fe,
+    b: &'static Fe,
+    z: &'static Fe,
+    minus_b_div_a: &'static Fe,
+    b_div_za: &'static Fe,
+    sqrt_exp: &'static Fe,
+    legendre_exp: &'static Fe,
+}
+
+/// 3-isogeny from the SSWU curve to secp256k1, as the coefficients of its
+/// rational maps, lowest degree first, the denominators being monic
+struct Isogeny {
+    x_num: &'static [Fe],
+    x_den: &'static [Fe],
+    y_num: &'static [Fe],
+    y_den: &'static [Fe],
+}
+
+/// Field prime of secp256k1
+const SECP256K1_P: Fe = [
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xfc, 0x2f,
+];
+
+/// `A'` of the curve 3-isogenous to secp256k1
+const SECP256K1_ISO_A: Fe = [
+    0x3f, 0x87, 0x31, 0xab, 0xdd, 0x66, 0x1a, 0xdc, 0xa0, 0x8a, 0x55, 0x58, 0xf0, 0xf5, 0xd2, 0x72,
+    0xe9, 0x53, 0xd3, 0x63, 0xcb, 0x6f, 0x0e, 0x5d, 0x40, 0x54, 0x47, 0xc0, 0x1a, 0x44, 0x45, 0x33,
+];
+
+/// `B'` of the curve 3-isogenous to secp256k1
+const SECP256K1_ISO_B: Fe = [
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xeb,
+];
+
+/// `Z = -11`
+const SECP256K1_Z: Fe = [
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xfc, 0x24,
+];
+
+/// `-B' / A'`
+const SECP256K1_MINUS_B_DIV_A: Fe = [
+    0x0b, 0xc5, 0x6c, 0xee, 0x71, 0x85, 0x38, 0xb2, 0xa0, 0x0c, 0x4d, 0xf5, 0xd3, 0xe8, 0x7b, 0x0c,
+    0x6d, 0xf4, 0xff, 0x98, 0xe8, 0x2d, 0x74, 0xfd, 0xaa, 0x01, 0xd5, 0x8e, 0x8d, 0x23, 0x45, 0xc3,
+];
+
+/// `B' / (Z A')`
+const SECP256K1_B_DIV_ZA: Fe = [
+    0xbb, 0x40, 0x7e, 0x44, 0x38, 0xdd, 0x90, 0xca, 0x6b, 0xa4, 0x07, 0x16, 0x59, 0x15, 0x22, 0x75,
+    0x7e, 0x5c, 0x17, 0x3c, 0x72, 0x32, 0xad, 0x8b, 0x6c, 0x8b, 0xcd, 0x97, 0xde, 0x49, 0x03, 0x91,
+];
+
+/// `(p + 1) / 4`
+const SECP256K1_SQRT_EXP: Fe = [
+    0x3f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xbf, 0xff, 0xff, 0x0c,
+];
+
+/// `(p - 1) / 2`
+const SECP256K1_LEGENDRE_EXP: Fe = [
+    0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xfe, 0x17,
+];
+
+const SECP256K1_ISO_X_NUM: [Fe; 4] = [
+    [
+        0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3,
+        0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8d, 0xaa, 0xaa,
+        0xa8, 0xc7,
+    ],
+    [
+        0x07, 0xd3, 0xd4, 0xc8, 0x0b, 0xc3, 0x21, 0xd5, 0xb9, 0xf3, 0x15, 0xce, 0xa7, 0xfd, 0x44,
+        0xc5, 0xd5, 0x95, 0xd2, 0xfc, 0x0b, 0xf6, 0x3b, 0x92, 0xdf, 0xff, 0x10, 0x44, 0xf1, 0x7c,
+        0x65, 0x81,
+    ],
+    [
+        0x53, 0x4c, 0x32, 0x8d, 0x23, 0xf2, 0x34, 0xe6, 0xe2, 0xa4, 0x13, 0xde, 0xca, 0x25, 0xca,
+        0xec, 0xe4, 0x50, 0x61, 0x44, 0x03, 0x7c, 0x40, 0x31, 0x4e, 0xcb, 0xd0, 0xb5, 0x3d, 0x9d,
+        0xd2, 0x62,
+    ],
+    [
+        0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3,
+        0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8e, 0x38, 0xe3, 0x8d, 0xaa, 0xaa,
+        0xa8, 0x8c,
+    ],
+];
+
+const SECP256K1_ISO_X_DEN: [Fe; 2] = [
+    [
+        0xd3, 0x57, 0x71, 0x19, 0x3d, 0x94, 0x91, 0x8a, 0x9c, 0xa3, 0x4c, 0xcb, 0xb7, 0xb6, 0x40,
+        0xdd, 0x86, 0xcd, 0x40, 0x95, 0x42, 0xf8, 0x48, 0x7d, 0x9f, 0xe6, 0xb7, 0x45, 0x78, 0x1e,
+        0xb4, 0x9b,
+    ],
+    [
+        0xed, 0xad, 0xc6, 0xf6, 0x43, 0x83, 0xdc, 0x1d, 0xf7, 0xc4, 0xb2, 0xd5, 0x1b, 0x54, 0x22,
+        0x54, 0x06, 0xd3, 0x6b, 0x64, 0x1f, 0x5e, 0x41, 0xbb, 0xc5, 0x2a, 0x56, 0x61, 0x2a, 0x8c,
+        0x6d, 0x14,
+    ],
+];
+
+const SECP256K1_ISO_Y_NUM: [Fe; 4] = [
+    [
+        0x4b, 0xda, 0x12, 0xf6, 0x84, 0xbd, 0xa1, 0x2f, 0x68, 0x4b, 0xda, 0x12, 0xf6, 0x84, 0xbd,
+        0xa1, 0x2f, 0x68, 0x4b, 0xda, 0x12, 0xf6, 0x84, 0xbd, 0xa1, 0x2f, 0x68, 0x4b, 0x8e, 0x38,
+        0xe2, 0x3c,
+    ],
+    [
+        0xc7, 0x5e, 0x0c, 0x32, 0xd5, 0xcb, 0x7c, 0x0f, 0xa9, 0xd0, 0xa5, 0x4b, 0x12, 0xa0, 0xa6,
+        0xd5, 0x64, 0x7a, 0xb0, 0x46, 0xd6, 0x86, 0xda, 0x6f, 0xdf, 0xfc, 0x90, 0xfc, 0x20, 0x1d,
+        0x71, 0xa3,
+    ],
+    [
+        0x29, 0xa6, 0x19, 0x46, 0x91, 0xf9, 0x1a, 0x73, 0x71, 0x52, 0x09, 0xef, 0x65, 0x12, 0xe5,
+        0x76, 0x72, 0x28, 0x30, 0xa2, 0x01, 0xbe, 0x20, 0x18, 0xa7, 0x65, 0xe8, 0x5a, 0x9e, 0xce,
+        0xe9, 0x31,
+    ],
+    [
+        0x2f, 0x68, 0x4b, 0xda, 0x12, 0xf6, 0x84, 0xbd, 0xa1, 0x2f, 0x68, 0x4b, 0xda, 0x12, 0xf6,
+        0x84, 0xbd, 0xa1, 0x2f, 0x68, 0x4b, 0xda, 0x12, 0xf6, 0x84, 0xbd, 0xa1, 0x2f, 0x38, 0xe3,
+        0x8d, 0x84,
+    ],
+];
+
+const SECP256K1_ISO_Y_DEN: [Fe; 3] = [
+    [
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+        0xf9, 0x3b,
+    ],
+    [
+        0x7a, 0x06, 0x53, 0x4b, 0xb8, 0xbd, 0xb4, 0x9f, 0xd5, 0xe9, 0xe6, 0x63, 0x27, 0x22, 0xc2,
+        0x98, 0x94, 0x67, 0xc1, 0xbf, 0xc8, 0xe8, 0xd9, 0x78, 0xdf, 0xb4, 0x25, 0xd2, 0x68, 0x5c,
+        0x25, 0x73,
+    ],
+    [
+        0x64, 0x84, 0xaa, 0x71, 0x65, 0x45, 0xca, 0x2c, 0xf3, 0xa7, 0x0c, 0x3f, 0xa8, 0xfe, 0x33,
+        0x7e, 0x0a, 0x3d, 0x21, 0x16, 0x2f, 0x0d, 0x62, 0x99, 0xa7, 0xbf, 0x81, 0x92, 0xbf, 0xd2,
+        0xa7, 0x6f,
+    ],
+];
+
+/// Field prime of P-256
+const P256_P: Fe = [
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+];
+
+/// `A = -3`
+const P256_A: Fe = [
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfc,
+];
+
+/// `B`
+const P256_B: Fe = [
+    0x5a, 0xc6, 0x35, 0xd8, 0xaa, 0x3a, 0x93, 0xe7, 0xb3, 0xeb, 0xbd, 0x55, 0x76, 0x98, 0x86, 0xbc,
+    0x65, 0x1d, 0x06, 0xb0, 0xcc, 0x53, 0xb0, 0xf6, 0x3b, 0xce, 0x3c, 0x3e, 0x27, 0xd2, 0x60, 0x4b,
+];
+
+/// `Z = -10`
+const P256_Z: Fe = [
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf5,
+];
+
+/// `-B / A`
+const P256_MINUS_B_DIV_A: Fe = [
+    0x73, 0x97, 0x67, 0x47, 0xe3, 0x68, 0xdb, 0xf8, 0x3b, 0xf9, 0x3f, 0x1c, 0x7c, 0xdd, 0x82, 0x3e,
+    0xcc, 0x5f, 0x02, 0x3b, 0x44, 0x1b, 0xe5, 0xa7, 0x69, 0x44, 0xbe, 0xbf, 0x62, 0x9b, 0x75, 0x6e,
+];
+
+/// `B / (Z A)`
+const P256_B_DIV_ZA: Fe = [
+    0xa5, 0x28, 0xbd, 0x86, 0x96, 0xbd, 0xaf, 0x99, 0x6c, 0x65, 0xb9, 0x82, 0xd9, 0x49, 0x59, 0xd3,
+    0x14, 0x6f, 0xe6, 0xa0, 0x20, 0x69, 0x30, 0x90, 0xbd, 0xba, 0x13, 0x13, 0x23, 0x75, 0xf2, 0x24,
+];
+
+/// `(p + 1) / 4`
+const P256_SQRT_EXP: Fe = [
+    0x3f, 0xff, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+];
+
+/// `(p - 1) / 2`
+const P256_LEGENDRE_EXP: Fe = [
+    0x7f, 0xff, 0xff, 0xff, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+];
+
+/// Field prime of Curve25519
+const P25519: Fe = [
+    0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xed,
+];
+
+/// `(p + 3) / 8`
+const P25519_SQRT_EXP: Fe = [
+    0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+];
+
+/// `(p - 1) / 2`
+const P25519_LEGENDRE_EXP: Fe = [
+    0x3f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf6,
+];
+
+/// `sqrt(-1)`
+const P25519_SQRT_M1: Fe = [
+    0x2b, 0x83, 0x24, 0x80, 0x4f, 0xc1, 0xdf, 0x0b, 0x2b, 0x4d, 0x00, 0x99, 0x3d, 0xfb, 0xd7, 0xa7,
+    0x2f, 0x43, 0x18, 0x06, 0xad, 0x2f, 0xe4, 0x78, 0xc4, 0xee, 0x1b, 0x27, 0x4a, 0x0e, 0xa0, 0xb0,
+];
+
+/// `sqrt(-486664)`, the even one, of the map to edwards25519
+const ED25519_MAP_C1: Fe = [
+    0x0f, 0x26, 0xed, 0xf4, 0x60, 0xa0, 0x06, 0xbb, 0xd2, 0x7b, 0x08, 0xdc, 0x03, 0xfc, 0x4f, 0x7e,
+    0xc5, 0xa1, 0xd3, 0xd1, 0x4b, 0x7d, 0x1a, 0x82, 0xcc, 0x6e, 0x04, 0xaa, 0xff, 0x45, 0x7e, 0x06,
+];
+
+const SECP256K1_SSWU: Sswu = Sswu {
+    a: &SECP256K1_ISO_A,
+    b: &SECP256K1_ISO_B,
+    z: &SECP256K1_Z,
+    minus_b_div_a: &SECP256K1_MINUS_B_DIV_A,
+    b_div_za: &SECP256K1_B_DIV_ZA,
+    sqrt_exp: &SECP256K1_SQRT_EXP,
+    legendre_exp: &SECP256K1_LEGENDRE_EXP,
+};
+
+const SECP256K1_ISOGENY: Isogeny = Isogeny {
+    x_num: &SECP256K1_ISO_X_NUM,
+    x_den: &SECP256K1_ISO_X_DEN,
+    y_num: &SECP256K1_ISO_Y_NUM,
+    y_den: &SECP256K1_ISO_Y_DEN,
+};
+
+const P256_SSWU: Sswu = Sswu {
+    a: &P256_A,
+    b: &P256_B,
+    z: &P256_Z,
+    minus_b_div_a: &P256_MINUS_B_DIV_A,
+    b_div_za: &P256_B_DIV_ZA,
+    sqrt_exp: &P256_SQRT_EXP,
+    legendre_exp: &P256_LEGENDRE_EXP,
+};
+
+/// Field operations in Montgomery representation
+struct Field<'a> {
+    arena: &'a BnArena,
+    p: Bn<'a>,
+    mont: MontCtx<'a>,
+    zero: Bn<'a>,
+    one: Bn<'a>,
+    tmp: Bn<'a>,
+}
+
+impl<'a> Field<'a> {
+    fn new(arena: &'a BnArena, p: &Fe) -> Result<Self, CxError> {
+        let p = arena.alloc_init(32, p)?;
+        let mont = MontCtx::new(arena, &p)?;
+        let mut f = Field {
+            arena,
+            p,
+            mont,
+            zero: arena.alloc(32)?,
+            one: arena.alloc(32)?,
+            tmp: arena.alloc(32)?,
+        };
+        f.tmp.set_u32(1)?;
+        f.mont.to_montgomery(&mut f.one, &f.tmp)?;
+        Ok(f)
+    }
+
+    fn alloc(&self) -> Result<Bn<'a>, CxError> {
+        self.arena.alloc(32)
+    }
+
+    /// `r` = the constant `v`, below `p`
+    fn constant(&mut self, r: &mut Bn, v: &Fe) -> Result<(), CxError> {
+        self.tmp.set_bytes(v)?;
+        self.mont.to_montgomery(r, &self.tmp)
+    }
+
+    /// `r` = the big endian `d`, of `FIELD_BYTES`, modulo `p`
+    fn reduce(&mut self, r: &mut Bn, d: &[u8]) -> Result<(), CxError> {
+        let d = self.arena.alloc_init(2 * 32, d)?;
+        self.tmp.reduce(&d, &self.p)?;
+        self.mont.to_montgomery(r, &self.tmp)
+    }
+
+    fn store(&mut self, out: &mut Fe, a: &Bn) -> Result<(), CxError> {
+        self.mont.from_montgomery(&mut self.tmp, a)?;
+        self.tmp.export(out)
+    }
+
+    fn add(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        r.mod_add(a, b, &self.p)
+    }
+
+    fn sub(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        r.mod_sub(a, b, &self.p)
+    }
+
+    fn neg(&self, r: &mut Bn, a: &Bn) -> Result<(), CxError> {
+        r.mod_sub(&self.zero, a, &self.p)
+    }
+
+    fn mul(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        self.mont.mul(r, a, b)
+    }
+
+    fn sqr(&self, r: &mut Bn, a: &Bn) -> Result<(), CxError> {
+        self.mont.mul(r, a, a)
+    }
+
+    fn inv(&self, r: &mut Bn, a: &Bn) -> Result<(), CxError> {
+        self.mont.invert_nprime(r, a)
+    }
+
+    fn eq(a: &Bn, b: &Bn) -> Result<bool, CxError> {
+        Ok(a.compare(b)? == Ordering::Equal)
+    }
+
+    fn is_zero(&self, a: &Bn) -> Result<bool, CxError> {
+        Self::eq(a, &self.zero)
+    }
+
+    /// Whether `a` is a square, zero included, `legendre_exp` being
+    /// `(p - 1) / 2`
+    fn is_square(&mut self, a: &Bn, legendre_exp: &Fe) -> Result<bool, CxError> {
+        self.mont.pow(&mut self.tmp, a, legendre_exp)?;
+        Ok(Self::eq(&self.tmp, &self.one)? | Self::eq(&self.tmp, &self.zero)?)
+    }
+
+    /// Parity of the value of `a`
+    fn sgn0(&mut self, a: &Bn) -> Result<bool, CxError> {
+        self.mont.from_montgomery(&mut self.tmp, a)?;
+        self.tmp.is_odd()
+    }
+
+    /// `r = 1` if `a` is zero, `a` otherwise. Returns whether `a` is zero.
+    fn or_one(&self, r: &mut Bn<'a>, a: &Bn, t: &mut Bn<'a>) -> Result<bool, CxError> {
+        let zero = self.is_zero(a)?;
+        r.copy_from(a)?;
+        t.copy_from(&self.one)?;
+        Bn::cswap(r, t, zero);
+        Ok(zero)
+    }
+
+    /// `r = v[n-1] x^(n-1) + ... + v[0]`, plus `x^n` if `monic`
+    fn horner(
+        &mut self,
+        r: &mut Bn,
+        v: &[Fe],
+        monic: bool,
+        x: &Bn,
+        t0: &mut Bn,
+        t1: &mut Bn,
+    ) -> Result<(), CxError> {
+        let (last, rest) = v.split_last().ok_or(CxError::InvalidParameter)?;
+        if monic {
+            self.constant(t0, last)?;
+            self.add(r, x, t0)?;
+        } else {
+            self.constant(r, last)?;
+        }
+        for c in rest.iter().rev() {
+            self.mul(t0, r, x)?;
+            self.constant(t1, c)?;
+            self.add(r, t0, t1)?;
+        }
+        Ok(())
+    }
+}
+
+/// `r = x^3 + A x + B`
+fn sswu_rhs(
+    f: &mut Field,
+    c: &Sswu,
+    r: &mut Bn,
+    x: &Bn,
+    t0: &mut Bn,
+    t1: &mut Bn,
+) -> Result<(), CxError> {
+    f.sqr(t0, x)?;
+    f.constant(t1, c.a)?;
+    f.add(r, t0, t1)?;
+    f.mul(t0, r, x)?;
+    f.constant(t1, c.b)?;
+    f.add(r, t0, t1)
+}
+
+/// `(x, y)` = simplified SWU map of `u` (RFC 9380, section 6.6.2), for
+/// `p = 3 mod 4`
+fn map_sswu<'a>(
+    f: &mut Field<'a>,
+    c: &Sswu,
+    u: &Bn,
+    x: &mut Bn<'a>,
+    y: &mut Bn<'a>,
+    [t0, t1, t2, t3, t4, t5]: &mut [Bn<'a>; 6],
+) -> Result<(), CxError> {
+    f.sqr(t0, u)?;
+    f.constant(t5, c.z)?;
+    f.mul(t1, t5, t0)?; // Z u^2
+    f.sqr(t2, t1)?;
+    f.add(t3, t2, t1)?; // Z^2 u^4 + Z u^2
+                        // x1 = -B / A (1 + 1 / (Z^2 u^4 + Z u^2)), or B / (Z A) if the
+                        // denominator is zero
+    let exceptional = f.or_one(t2, t3, t4)?;
+    f.inv(t3, t2)?;
+    f.add(t2, t3, &f.one)?;
+    f.constant(t4, c.minus_b_div_a)?;
+    f.mul(x, t4, t2)?;
+    f.constant(t4, c.b_div_za)?;
+    Bn::cswap(x, t4, exceptional);
+    sswu_rhs(f, c, t2, x, t3, t4)?; // g(x1)
+    f.mul(t3, t1, x)?; // x2 = Z u^2 x1
+    sswu_rhs(f, c, t4, t3, t0, t5)?; // g(x2)
+    let not_square = !f.is_square(t2, c.legendre_exp)?;
+    Bn::cswap(x, t3, not_square);
+    Bn::cswap(t2, t4, not_square);
+    f.mont.pow(y, t2, c.sqrt_exp)?;
+    let flip = f.sgn0(u)? != f.sgn0(y)?;
+    f.neg(t0, y)?;
+    Bn::cswap(y, t0, flip);
+    Ok(())
+}
+
+/// `(x, y)` = image of `(x, y)` by the isogeny
+fn map_isogeny<'a>(
+    f: &mut Field<'a>,
+    iso: &Isogeny,
+    x: &mut Bn<'a>,
+    y: &mut Bn<'a>,
+    [t0, t1, t2, t3, t4, t5]: &mut [Bn<'a>; 6],
+) -> Result<(), CxError> {
+    f.horner(t0, iso.x_num, false, x, t4, t5)?;
+    f.horner(t1, iso.x_den, true, x, t4, t5)?;
+    f.horner(t2, iso.y_num, false, x, t4, t5)?;
+    f.horner(t3, iso.y_den, true, x, t4, t5)?;
+    // One inversion for both denominators, which cannot be zero on the
+    // image of the SSWU map
+    f.mul(t4, t1, t3)?;
+    f.inv(t5, t4)?;
+    f.mul(t4, t0, t3)?;
+    f.mul(x, t4, t5)?;
+    f.mul(t4, t2, t1)?;
+    f.mul(t0, t4, t5)?;
+    f.mul(t4, y, t0)?;
+    core::mem::swap(y, t4);
+    Ok(())
+}
+
+/// `r = x^3 + J x^2 + x`, the right-hand side of Curve25519
+fn ell2_rhs(f: &mut Field, r: &mut Bn, x: &Bn, t0: &mut Bn, t1: &mut Bn) -> Result<(), CxError> {
+    t1.set_u32(MONT_J)?;
+    f.mont.to_montgomery(t0, t1)?;
+    f.add(t1, x, t0)?;
+    f.mul(t0, t1, x)?;
+    f.add(t1, t0, &f.one)?;
+    f.mul(r, t1, x)
+}
+
+/// `A` of Curve25519
+const MONT_J: u32 = 486662;
+
+/// `(x, y)` = Elligator 2 map of `u` to Curve25519, then the rational map
+/// to edwards25519 (RFC 9380, sections 6.7.1 and 6.8.2)
+fn map_ell2<'a>(
+    f: &mut Field<'a>,
+    u: &Bn,
+    x: &mut Bn<'a>,
+    y: &mut Bn<'a>,
+    [t0, t1, t2, t3, t4, t5]: &mut [Bn<'a>; 6],
+) -> Result<(), CxError> {
+    // x1 = -J / (1 + 2 u^2), or -J if the denominator is zero
+    f.sqr(t0, u)?;
+    f.add(t1, t0, t0)?;
+    f.add(t0, t1, &f.one)?;
+    f.or_one(t2, t0, t1)?;
+    f.inv(t3, t2)?;
+    t1.set_u32(MONT_J)?;
+    f.mont.to_montgomery(t0, t1)?;
+    f.neg(t1, t0)?;
+    f.mul(x, t1, t3)?;
+    ell2_rhs(f, t2, x, t0, t1)?; // g(x1)
+    t1.set_u32(MONT_J)?;
+    f.mont.to_montgomery(t0, t1)?;
+    f.add(t1, x, t0)?;
+    f.neg(t4, t1)?; // x2 = -x1 - J
+    ell2_rhs(f, t5, t4, t0, t1)?; // g(x2)
+    let square = f.is_square(t2, &P25519_LEGENDRE_EXP)?;
+    Bn::cswap(x, t4, !square);
+    Bn::cswap(t2, t5, !square);
+    // Square root for p = 5 mod 8
+    f.mont.pow(y, t2, &P25519_SQRT_EXP)?;
+    f.sqr(t0, y)?;
+    let root = Field::eq(t0, t2)?;
+    f.constant(t1, &P25519_SQRT_M1)?;
+    f.mul(t0, y, t1)?;
+    Bn::cswap(y, t0, !root);
+    let flip = square ^ f.sgn0(y)?;
+    f.neg(t0, y)?;
+    Bn::cswap(y, t0, flip);
+
+    // (v, w) = (c1 s / t, (s - 1) / (s + 1)), or (0, 1) on the exceptional
+    // cases, with one inversion
+    f.add(t0, x, &f.one)?;
+    f.mul(t1, t0, y)?;
+    let exceptional = f.or_one(t2, t1, t3)?;
+    f.inv(t1, t2)?;
+    f.constant(t2, &ED25519_MAP_C1)?;
+    f.mul(t3, t2, x)?;
+    f.mul(t2, t3, t0)?;
+    f.mul(t5, t2, t1)?; // v
+    f.sub(t0, x, &f.one)?;
+    f.mul(t2, t0, y)?;
+    f.mul(t4, t2, t1)?; // w
+    t0.copy_from(&f.zero)?;
+    Bn::cswap(t5, t0, exceptional);
+    t0.copy_from(&f.one)?;
+    Bn::cswap(t4, t0, exceptional);
+    core::mem::swap(x, t5);
+    core::mem::swap(y, t4);
+    Ok(())
+}
+
+/// Suite of RFC 9380, as `<curve>_XMD:<hash>_<map>_`, the `RO_` or `NU_`
+/// suffix being the choice between [`HashToCurveSuite::hash_to_curve`] and
+/// [`HashToCurveSuite::encode_to_curve`]
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub enum HashToCurveSuite {
+    /// `secp256k1_XMD:SHA-256_SSWU_`
+    Secp256k1Sha256Sswu,
+    /// `P256_XMD:SHA-256_SSWU_`
+    P256Sha256Sswu,
+    /// `edwards25519_XMD:SHA-512_ELL2_`
+    Edwards25519Sha512Ell2,
+}
+
+impl HashToCurveSuite {
+    /// Curve of the points
+    pub fn curve(self) -> CurvesId {
+        match self {
+            Self::Secp256k1Sha256Sswu => CurvesId::Secp256k1,
+            Self::P256Sha256Sswu => CurvesId::Secp256r1,
+            Self::Edwards25519Sha512Ell2 => CurvesId::Ed25519,
+        }
+    }
+
+    fn prime(self) -> &'static Fe {
+        match self {
+            Self::Secp256k1Sha256Sswu => &SECP256K1_P,
+            Self::P256Sha256Sswu => &P256_P,
+            Self::Edwards25519Sha512Ell2 => &P25519,
+        }
+    }
+
+    /// `hash_to_curve` of the message, the concatenation of `msg`, under the
+    /// domain separation tag `dst`: a point indistinguishable from a random
+    /// oracle, of the prime order subgroup
+    pub fn hash_to_curve<'a>(
+        self,
+        arena: &'a BnArena,
+        msg: &[&[u8]],
+        dst: &[u8],
+    ) -> Result<EcPoint<'a>, CxError> {
+        self.map(arena, msg, dst, 2)
+    }
+
+    /// `encode_to_curve` of the message, the concatenation of `msg`, under
+    /// the domain separation tag `dst`: cheaper than
+    /// [`hash_to_curve`](Self::hash_to_curve), with a nonuniform output
+    pub fn encode_to_curve<'a>(
+        self,
+        arena: &'a BnArena,
+        msg: &[&[u8]],
+        dst: &[u8],
+    ) -> Result<EcPoint<'a>, CxError> {
+        self.map(arena, msg, dst, 1)
+    }
+
+    /// Sum of the maps of `count` field elements hashed from the message,
+    /// with the cofactor cleared
+    fn map<'a>(
+        self,
+        arena: &'a BnArena,
+        msg: &[&[u8]],
+        dst: &[u8],
+        count: usize,
+    ) -> Result<EcPoint<'a>, CxError> {
+        let mut uniform = [0u8; 2 * FIELD_BYTES];
+        let uniform = &mut uniform[..count * FIELD_BYTES];
+        match self {
+            Self::Edwards25519Sha512Ell2 => expand_message_xmd::<Sha512>(msg, dst, uniform)?,
+            _ => expand_message_xmd::<Sha256>(msg, dst, uniform)?,
+        }
+
+        let mut f = Field::new(arena, self.prime())?;
+        let mut t = [
+            f.alloc()?,
+            f.alloc()?,
+            f.alloc()?,
+            f.alloc()?,
+            f.alloc()?,
+            f.alloc()?,
+        ];
+        let (mut u, mut x, mut y) = (f.alloc()?, f.alloc()?, f.alloc()?);
+        let mut q = [
+            EcPoint::new(arena, self.curve())?,
+            EcPoint::new(arena, self.curve())?,
+        ];
+        let (mut xb, mut yb) = ([0u8; 32], [0u8; 32]);
+        for (u_bytes, q) in uniform.chunks(FIELD_BYTES).zip(q.iter_mut()) {
+            f.reduce(&mut u, u_bytes)?;
+            match self {
+                Self::Secp256k1Sha256Sswu => {
+                    map_sswu(&mut f, &SECP256K1_SSWU, &u, &mut x, &mut y, &mut t)?;
+                    map_isogeny(&mut f, &SECP256K1_ISOGENY, &mut x, &mut y, &mut t)?;
+                }
+                Self::P256Sha256Sswu => map_sswu(&mut f, &P256_SSWU, &u, &mut x, &mut y, &mut t)?,
+                Self::Edwards25519Sha512Ell2 => map_ell2(&mut f, &u, &mut x, &mut y, &mut t)?,
+            }
+            f.store(&mut xb, &x)?;
+            f.store(&mut yb, &y)?;
+            q.set_coordinates(&xb, &yb)?;
+        }
+        let mut sum = EcPoint::new(arena, self.curve())?;
+        match count {
+            1 => sum.copy_from(&q[0])?,
+            _ => sum.add(&q[0], &q[1])?,
+        }
+        if self == Self::Edwards25519Sha512Ell2 {
+            let mut cofactor = [0u8; 32];
+            cofactor[31] = 8;
+            sum.scalarmul_public(&cofactor)?;
+        }
+        Ok(sum)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn expand_message() {
+        // RFC 9380, appendix K.1
+        let dst = b"QUUX-V01-CS02-with-expander-SHA256-128";
+        let mut out = [0u8; 32];
+        expand_message_xmd::<Sha256>(&[b"a", b"bc"], dst, &mut out).map_err(|_| ())?;
+        assert_eq!(
+            out,
+            [
+                0xd8, 0xcc, 0xab, 0x23, 0xb5, 0x98, 0x5c, 0xce, 0xa8, 0x65, 0xc6, 0xc9, 0x7b, 0x6e,
+                0x5b, 0x83, 0x50, 0xe7, 0x94, 0xe6, 0x03, 0xb4, 0xb9, 0x79, 0x02, 0xf5, 0x3a, 0x8a,
+                0x0d, 0x60, 0x56, 0x15,
+            ]
+        );
+    }
+
+    /// Check the coordinates of `suite` to curve of the empty message
+    fn check(suite: HashToCurveSuite, dst: &[u8], expected: (&Fe, &Fe)) -> Result<(), ()> {
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let p = suite.hash_to_curve(&arena, &[], dst).map_err(|_| ())?;
+        let (mut x, mut y) = ([0u8; 32], [0u8; 32]);
+        p.export(&mut x, &mut y).map_err(|_| ())?;
+        assert_eq!((&x, &y), expected);
+        Ok(())
+    }
+
+    #[test]
+    fn hash_to_secp256k1() {
+        // RFC 9380, appendix J, empty message
+        check(
+            HashToCurveSuite::Secp256k1Sha256Sswu,
+            b"QUUX-V01-CS02-with-secp256k1_XMD:SHA-256_SSWU_RO_",
+            (
+                &[
+                    0xc1, 0xca, 0xe2, 0x90, 0xe2, 0x91, 0xae, 0xe6, 0x17, 0xeb, 0xae, 0xf1, 0xbe,
+                    0x6d, 0x73, 0x86, 0x14, 0x79, 0xc4, 0x8b, 0x84, 0x1e, 0xab, 0xa9, 0xb7, 0xb5,
+                    0x85, 0x2d, 0xdf, 0xeb, 0x13, 0x46,
+                ],
+                &[
+                    0x64, 0xfa, 0x67, 0x8e, 0x07, 0xae, 0x11, 0x61, 0x26, 0xf0, 0x8b, 0x02, 0x2a,
+                    0x94, 0xaf, 0x6d, 0xe1, 0x59, 0x85, 0xc9, 0x96, 0xc3, 0xa9, 0x1b, 0x64, 0xc4,
+                    0x06, 0xa9, 0x60, 0xe5, 0x10, 0x67,
+                ],
+            ),
+        )?;
+    }
+
+    #[test]
+    fn hash_to_p256() {
+        // RFC 9380, appendix J, empty message
+        check(
+            HashToCurveSuite::P256Sha256Sswu,
+            b"QUUX-V01-CS02-with-P256_XMD:SHA-256_SSWU_RO_",
+            (
+                &[
+                    0x2c, 0x15, 0x23, 0x0b, 0x26, 0xdb, 0xc6, 0xfc, 0x9a, 0x37, 0x05, 0x11, 0x58,
+                    0xc9, 0x5b, 0x79, 0x65, 0x6e, 0x17, 0xa1, 0xa9, 0x20, 0xb1, 0x13, 0x94, 0xca,
+                    0x91, 0xc4, 0x42, 0x47, 0xd3, 0xe4,
+                ],
+                &[
+                    0x8a, 0x7a, 0x74, 0x98, 0x5c, 0xc5, 0xc7, 0x76, 0xcd, 0xfe, 0x4b, 0x1f, 0x19,
+                    0x88, 0x49, 0x70, 0x45, 0x39, 0x12, 0xe9, 0xd3, 0x15, 0x28, 0xc0, 0x60, 0xbe,
+                    0x9a, 0xb5, 0xc4, 0x3e, 0x84, 0x15,
+                ],
+            ),
+        )?;
+    }
+
+    #[test]
+    fn hash_to_edwards25519() {
+        // RFC 9380, appendix J, empty message
+        check(
+            HashToCurveSuite::Edwards25519Sha512Ell2,
+            b"QUUX-V01-CS02-with-edwards25519_XMD:SHA-512_ELL2_RO_",
+            (
+                &[
+                    0x3c, 0x3d, 0xa6, 0x92, 0x5a, 0x3c, 0x3c, 0x26, 0x84, 0x48, 0xdc, 0xab, 0xb4,
+                    0x7c, 0xcd, 0xe5, 0x43, 0x95, 0x59, 0xd9, 0x59, 0x96, 0x46, 0xa8, 0x26, 0x0e,
+                    0x47, 0xb1, 0xe4, 0x82, 0x2f, 0xc6,
+                ],
+                &[
+                    0x09, 0xa6, 0xc8, 0x56, 0x1a, 0x0b, 0x22, 0xbe, 0xf6, 0x31, 0x24, 0xc5, 0x88,
+                    0xce, 0x4c, 0x62, 0xea, 0x83, 0xa3, 0xc8, 0x99, 0x76, 0x3a, 0xf2, 0x6d, 0x79,
+                    0x53, 0x02, 0xe1, 0x15, 0xdc, 0x21,
+                ],
+            ),
+        )?;
+    }
+
+    #[test]
+    fn encode_to_p256() {
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let p = HashToCurveSuite::P256Sha256Sswu
+            .encode_to_curve(
+                &arena,
+                &[b"abc"],
+                b"QUUX-V01-CS02-with-P256_XMD:SHA-256_SSWU_NU_",
+            )
+            .map_err(|_| ())?;
+        let (mut x, mut y) = ([0u8; 32], [0u8; 32]);
+        p.export(&mut x, &mut y).map_err(|_| ())?;
+        assert_eq!(
+            &x,
+            &[
+                0xfc, 0x3f, 0x5d, 0x73, 0x4e, 0x8d, 0xce, 0x41, 0xdd, 0xac, 0x49, 0xf4, 0x7d, 0xd2,
+                0xb8, 0xa5, 0x72, 0x57, 0x52, 0x2a, 0x86, 0x5c, 0x12, 0x4e, 0xd0, 0x2b, 0x92, 0xb5,
+                0x23, 0x7b, 0xef, 0xa4
+            ]
+        );
+        assert_eq!(
+            &y,
+            &[
+                0xfe, 0x4d, 0x19, 0x7e, 0xcf, 0x5a, 0x62, 0x64, 0x5b, 0x96, 0x90, 0x59, 0x9e, 0x1d,
+                0x80, 0xe8, 0x2c, 0x50, 0x0b, 0x22, 0xac, 0x70, 0x5a, 0x0b, 0x42, 0x1f, 0xac, 0x7b,
+                0x47, 0x15, 0x78, 0x66
+            ]
+        );
+    }
+}
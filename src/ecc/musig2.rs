@@ -0,0 +1,511 @@
+//! MuSig2 multi-signatures for Taproot (BIP327)
+//!
+//! The aggregation of the keys of the signers is the costly part shared by
+//! all the signatures of a session: a [`KeyAggContext`] computes it once,
+//! with its tweaks, and is then used for every input signed. Each operation
+//! locks the bignum engine once, for all its point and scalar computations.
+//!
+//! ```
+//! let mut ctx = KeyAggContext::new(&signers)?;
+//! ctx.apply_tweak(&taptweak, true)?;
+//!
+//! // First round: exchange the public nonces
+//! let (secnonce, pubnonce) = SecNonce::generate(&sk)?;
+//! let aggnonce = nonce_agg(&pubnonces)?;
+//!
+//! // Second round: exchange the partial signatures
+//! let session = Session::new(&ctx, &aggnonce, &sighash)?;
+//! let psig = session.partial_sign(secnonce, &sk, &ctx)?;
+//! let sig = session.partial_sig_agg(&psigs, &ctx)?;
+//! ```
+//!
+//! Nonces are drawn from the TRNG rather than derived as the NonceGen
+//! algorithm of the BIP, which only hardens weak randomness sources. A
+//! [`SecNonce`] is consumed by the signature it is used for.
+
+use super::{CxError, ECPrivateKey, EcPoint, Secret, SECP256K1_ORDER};
+use crate::bn::{Bn, BnArena};
+use crate::ecc::CurvesId;
+use crate::hash::{HashFn, Sha256};
+use core::cmp::Ordering;
+
+/// Compressed public key
+pub type PublicKey = [u8; 33];
+/// Public nonce, two compressed points
+pub type PubNonce = [u8; 66];
+
+const TWO: [u8; 32] = {
+    let mut two = [0u8; 32];
+    two[31] = 2;
+    two
+};
+
+/// Scalar operations modulo the order of secp256k1, in one arena
+struct Scalars<'a> {
+    arena: &'a BnArena,
+    n: Bn<'a>,
+}
+
+impl<'a> Scalars<'a> {
+    fn new(arena: &'a BnArena) -> Result<Self, CxError> {
+        Ok(Scalars {
+            arena,
+            n: arena.alloc_init(32, &SECP256K1_ORDER)?,
+        })
+    }
+
+    fn op<F>(&self, a: &[u8; 32], b: &[u8; 32], f: F) -> Result<[u8; 32], CxError>
+    where
+        F: FnOnce(&mut Bn, &Bn, &Bn, &Bn) -> Result<(), CxError>,
+    {
+        let a = self.arena.alloc_init(32, a)?;
+        let b = self.arena.alloc_init(32, b)?;
+        let mut r = self.arena.alloc(32)?;
+        f(&mut r, &a, &b, &self.n)?;
+        let mut out = [0u8; 32];
+        r.export(&mut out)?;
+        Ok(out)
+    }
+
+    /// `v mod n`
+    fn reduce(&self, v: &[u8; 32]) -> Result<[u8; 32], CxError> {
+        self.op(v, v, |r, v, _, n| r.reduce(v, n))
+    }
+
+    fn add(&self, a: &[u8; 32], b: &[u8; 32]) -> Result<[u8; 32], CxError> {
+        self.op(a, b, |r, a, b, n| r.mod_add(a, b, n))
+    }
+
+    fn mul(&self, a: &[u8; 32], b: &[u8; 32]) -> Result<[u8; 32], CxError> {
+        self.op(a, b, |r, a, b, n| r.mod_mul(a, b, n))
+    }
+
+    fn neg(&self, a: &[u8; 32]) -> Result<[u8; 32], CxError> {
+        self.op(&[0; 32], a, |r, zero, a, n| r.mod_sub(zero, a, n))
+    }
+
+    /// Whether `v` is in `[1, n)`
+    fn is_valid(&self, v: &[u8; 32]) -> Result<bool, CxError> {
+        let v = self.arena.alloc_init(32, v)?;
+        Ok(v.compare_u32(0)? != Ordering::Equal && v.compare(&self.n)? == Ordering::Less)
+    }
+}
+
+/// Sum of points, which can be the point at infinity
+struct PointSum<'a> {
+    acc: EcPoint<'a>,
+    tmp: EcPoint<'a>,
+    infinity: bool,
+}
+
+impl<'a> PointSum<'a> {
+    fn new(arena: &'a BnArena) -> Result<Self, CxError> {
+        Ok(PointSum {
+            acc: EcPoint::new(arena, CurvesId::Secp256k1)?,
+            tmp: EcPoint::new(arena, CurvesId::Secp256k1)?,
+            infinity: true,
+        })
+    }
+
+    fn add(&mut self, p: &EcPoint) -> Result<(), CxError> {
+        if self.infinity {
+            self.infinity = false;
+            return self.acc.copy_from(p);
+        }
+        if self.acc.equals(p)? {
+            return self.acc.scalarmul_public(&TWO);
+        }
+        self.tmp.copy_from(p)?;
+        self.tmp.neg()?;
+        if self.acc.equals(&self.tmp)? {
+            self.infinity = true;
+            return Ok(());
+        }
+        self.tmp.add(&self.acc, p)?;
+        self.acc.copy_from(&self.tmp)
+    }
+}
+
+fn lift<'a>(arena: &'a BnArena, key: &PublicKey) -> Result<EcPoint<'a>, CxError> {
+    if key[0] & 0xfe != 0x02 {
+        return Err(CxError::InvalidPoint);
+    }
+    let mut p = EcPoint::new(arena, CurvesId::Secp256k1)?;
+    p.decompress(&key[1..], (key[0] & 1) as u32)?;
+    Ok(p)
+}
+
+/// Compressed form of `p`
+fn cbytes(p: &EcPoint) -> Result<PublicKey, CxError> {
+    let (mut x, mut y) = ([0u8; 32], [0u8; 32]);
+    p.export(&mut x, &mut y)?;
+    let mut c = [0u8; 33];
+    c[0] = 0x02 | (y[31] & 1);
+    c[1..].copy_from_slice(&x);
+    Ok(c)
+}
+
+fn tagged_hash(tag: &[u8], parts: &[&[u8]]) -> Result<[u8; 32], CxError> {
+    let mut h = Sha256::tagged(tag)?;
+    for part in parts {
+        h.update(part)?;
+    }
+    h.finalize()
+}
+
+/// Aggregated key of a set of signers, with its tweaks
+pub struct KeyAggContext {
+    /// Hash of the list of the keys
+    list_hash: [u8; 32],
+    /// First key different from the first one, whose coefficient is 1
+    second: Option<PublicKey>,
+    q: PublicKey,
+    /// Whether gacc is -1 mod n rather than 1
+    gacc_neg: bool,
+    tacc: [u8; 32],
+}
+
+impl KeyAggContext {
+    /// Aggregate `keys`, in the order given
+    pub fn new(keys: &[PublicKey]) -> Result<Self, CxError> {
+        let first = keys.first().ok_or(CxError::InvalidParameter)?;
+        let mut h = Sha256::tagged(b"KeyAgg list")?;
+        for key in keys {
+            h.update(key)?;
+        }
+        let mut ctx = KeyAggContext {
+            list_hash: h.finalize()?,
+            second: keys.iter().find(|&key| key != first).copied(),
+            q: [0; 33],
+            gacc_neg: false,
+            tacc: [0; 32],
+        };
+
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        let mut sum = PointSum::new(&arena)?;
+        for key in keys {
+            let mut p = lift(&arena, key)?;
+            let a = ctx.coefficient(&scalars, key)?;
+            p.scalarmul_public(&a)?;
+            sum.add(&p)?;
+        }
+        if sum.infinity {
+            return Err(CxError::PointAtInfinity);
+        }
+        ctx.q = cbytes(&sum.acc)?;
+        Ok(ctx)
+    }
+
+    /// KeyAgg coefficient of `key`
+    fn coefficient(&self, scalars: &Scalars, key: &PublicKey) -> Result<[u8; 32], CxError> {
+        if self.second.as_ref() == Some(key) {
+            let mut one = [0u8; 32];
+            one[31] = 1;
+            return Ok(one);
+        }
+        scalars.reduce(&tagged_hash(
+            b"KeyAgg coefficient",
+            &[&self.list_hash[..], key],
+        )?)
+    }
+
+    /// Aggregated public key, tweaked
+    pub fn aggregated_key(&self) -> &PublicKey {
+        &self.q
+    }
+
+    /// x-only aggregated key, such as the output key of a Taproot output
+    pub fn xonly(&self) -> [u8; 32] {
+        let mut x = [0u8; 32];
+        x.copy_from_slice(&self.q[1..]);
+        x
+    }
+
+    fn has_even_y(&self) -> bool {
+        self.q[0] == 0x02
+    }
+
+    /// Add `tweak` times the generator to the key, after negating the key
+    /// if `xonly` and it has an odd `y`, as the TapTweak of BIP341 does
+    pub fn apply_tweak(&mut self, tweak: &[u8; 32], xonly: bool) -> Result<(), CxError> {
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        let t = arena.alloc_init(32, tweak)?;
+        if t.compare(&scalars.n)? != Ordering::Less {
+            return Err(CxError::InvalidParameterValue);
+        }
+        let negate = xonly && !self.has_even_y();
+        let mut q = lift(&arena, &self.q)?;
+        if negate {
+            q.neg()?;
+        }
+        let mut sum = PointSum::new(&arena)?;
+        sum.add(&q)?;
+        if tweak.iter().any(|&b| b != 0) {
+            let mut tg = EcPoint::generator(&arena, CurvesId::Secp256k1)?;
+            tg.scalarmul_public(tweak)?;
+            sum.add(&tg)?;
+        }
+        if sum.infinity {
+            return Err(CxError::PointAtInfinity);
+        }
+        self.q = cbytes(&sum.acc)?;
+        // gacc = g * gacc, tacc = t + g * tacc
+        self.tacc = if negate {
+            scalars.neg(&self.tacc)?
+        } else {
+            self.tacc
+        };
+        self.tacc = scalars.add(tweak, &self.tacc)?;
+        self.gacc_neg ^= negate;
+        Ok(())
+    }
+}
+
+/// Secret nonce of a signer, wiped once used or dropped
+pub struct SecNonce {
+    k: Secret<64>,
+    pk: PublicKey,
+}
+
+impl SecNonce {
+    /// Draw the secret nonce of the signer of key `sk`, and compute the
+    /// public nonce to send to the other signers
+    pub fn generate(sk: &ECPrivateKey<32, 'W'>) -> Result<(SecNonce, PubNonce), CxError> {
+        let pk = sk.public_key()?.compressed();
+        let mut nonce = SecNonce {
+            k: Secret::new(),
+            pk,
+        };
+        let mut pubnonce = [0u8; 66];
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        let mut k = arena.alloc(32)?;
+        for (i, r) in pubnonce.chunks_mut(33).enumerate() {
+            loop {
+                k.rng(&scalars.n)?;
+                if k.compare_u32(0)? != Ordering::Equal {
+                    break;
+                }
+            }
+            let ki = &mut nonce.k.0[32 * i..32 * (i + 1)];
+            k.export(ki)?;
+            let mut p = EcPoint::generator(&arena, CurvesId::Secp256k1)?;
+            p.scalarmul(ki)?;
+            r.copy_from_slice(&cbytes(&p)?);
+        }
+        Ok((nonce, pubnonce))
+    }
+}
+
+/// Aggregate the public nonces of all the signers
+pub fn nonce_agg(pubnonces: &[PubNonce]) -> Result<PubNonce, CxError> {
+    let arena = BnArena::lock(32)?;
+    let mut aggnonce = [0u8; 66];
+    for j in 0..2 {
+        let mut sum = PointSum::new(&arena)?;
+        for pubnonce in pubnonces {
+            let mut key = [0u8; 33];
+            key.copy_from_slice(&pubnonce[33 * j..33 * (j + 1)]);
+            sum.add(&lift(&arena, &key)?)?;
+        }
+        // The point at infinity is encoded as zeroes
+        if !sum.infinity {
+            aggnonce[33 * j..33 * (j + 1)].copy_from_slice(&cbytes(&sum.acc)?);
+        }
+    }
+    Ok(aggnonce)
+}
+
+/// Signing of one message with an aggregated nonce
+pub struct Session {
+    b: [u8; 32],
+    e: [u8; 32],
+    r: PublicKey,
+}
+
+impl Session {
+    /// Session of the signature of `msg` by the signers of `ctx`, with the
+    /// aggregated nonce `aggnonce`
+    pub fn new(ctx: &KeyAggContext, aggnonce: &PubNonce, msg: &[u8]) -> Result<Self, CxError> {
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        let qx = ctx.xonly();
+        let b = scalars.reduce(&tagged_hash(
+            b"MuSig/noncecoef",
+            &[&aggnonce[..], &qx, msg],
+        )?)?;
+
+        // R = R1 + b * R2, or G if it is the point at infinity
+        let mut sum = PointSum::new(&arena)?;
+        for (j, coef) in [None, Some(&b)].into_iter().enumerate() {
+            let mut key = [0u8; 33];
+            key.copy_from_slice(&aggnonce[33 * j..33 * (j + 1)]);
+            if key.iter().all(|&b| b == 0) {
+                continue;
+            }
+            let mut p = lift(&arena, &key)?;
+            if let Some(coef) = coef {
+                if coef.iter().all(|&b| b == 0) {
+                    continue;
+                }
+                p.scalarmul_public(coef)?;
+            }
+            sum.add(&p)?;
+        }
+        let r = if sum.infinity {
+            cbytes(&EcPoint::generator(&arena, CurvesId::Secp256k1)?)?
+        } else {
+            cbytes(&sum.acc)?
+        };
+        let e = scalars.reduce(&tagged_hash(b"BIP0340/challenge", &[&r[1..], &qx, msg])?)?;
+        Ok(Session { b, e, r })
+    }
+
+    /// Partial signature of the signer of key `sk`, with the nonce
+    /// `secnonce` it generated for this session
+    pub fn partial_sign(
+        &self,
+        secnonce: SecNonce,
+        sk: &ECPrivateKey<32, 'W'>,
+        ctx: &KeyAggContext,
+    ) -> Result<[u8; 32], CxError> {
+        let pk = sk.public_key()?.compressed();
+        if pk != secnonce.pk {
+            return Err(CxError::InvalidParameter);
+        }
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        let mut k1 = Secret::<32>::new();
+        let mut k2 = Secret::<32>::new();
+        k1.0.copy_from_slice(&secnonce.k.0[..32]);
+        k2.0.copy_from_slice(&secnonce.k.0[32..]);
+        drop(secnonce);
+        if !scalars.is_valid(&k1.0)? || !scalars.is_valid(&k2.0)? {
+            return Err(CxError::InvalidParameterValue);
+        }
+        if self.r[0] != 0x02 {
+            k1.0 = scalars.neg(&k1.0)?;
+            k2.0 = scalars.neg(&k2.0)?;
+        }
+        // d = g * gacc * d'
+        let mut d = Secret::<32>::new();
+        d.0 = sk.key;
+        if ctx.has_even_y() == ctx.gacc_neg {
+            d.0 = scalars.neg(&d.0)?;
+        }
+        let a = ctx.coefficient(&scalars, &pk)?;
+        // s = k1 + b * k2 + e * a * d
+        let mut s = Secret::<32>::new();
+        s.0 = scalars.mul(&self.b, &k2.0)?;
+        s.0 = scalars.add(&k1.0, &s.0)?;
+        let mut ead = Secret::<32>::new();
+        ead.0 = scalars.mul(&a, &d.0)?;
+        ead.0 = scalars.mul(&self.e, &ead.0)?;
+        scalars.add(&s.0, &ead.0)
+    }
+
+    /// BIP340 signature aggregating the partial signatures `psigs` of all
+    /// the signers
+    pub fn partial_sig_agg(
+        &self,
+        psigs: &[[u8; 32]],
+        ctx: &KeyAggContext,
+    ) -> Result<[u8; 64], CxError> {
+        let arena = BnArena::lock(32)?;
+        let scalars = Scalars::new(&arena)?;
+        // s = sum(s_i) + e * g * tacc
+        let mut s = scalars.mul(&self.e, &ctx.tacc)?;
+        if !ctx.has_even_y() {
+            s = scalars.neg(&s)?;
+        }
+        for psig in psigs {
+            if scalars.reduce(psig)? != *psig {
+                return Err(CxError::InvalidParameterValue);
+            }
+            s = scalars.add(&s, psig)?;
+        }
+        let mut sig = [0u8; 64];
+        sig[..32].copy_from_slice(&self.r[1..]);
+        sig[32..].copy_from_slice(&s);
+        Ok(sig)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, ECPublicKey, Secp256k1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const X1: PublicKey = [
+        0x02, 0xf9, 0x30, 0x8a, 0x01, 0x92, 0x58, 0xc3, 0x10, 0x49, 0x34, 0x4f, 0x85, 0xf8, 0x9d,
+        0x52, 0x29, 0xb5, 0x31, 0xc8, 0x45, 0x83, 0x6f, 0x99, 0xb0, 0x86, 0x01, 0xf1, 0x13, 0xbc,
+        0xe0, 0x36, 0xf9,
+    ];
+    const X2: PublicKey = [
+        0x03, 0xdf, 0xf1, 0xd7, 0x7f, 0x2a, 0x67, 0x1c, 0x5f, 0x36, 0x18, 0x37, 0x26, 0xdb, 0x23,
+        0x41, 0xbe, 0x58, 0xfe, 0xae, 0x1d, 0xa2, 0xde, 0xce, 0xd8, 0x43, 0x24, 0x0f, 0x7b, 0x50,
+        0x2b, 0xa6, 0x59,
+    ];
+    const X3: PublicKey = [
+        0x02, 0x35, 0x90, 0xa9, 0x4e, 0x76, 0x8f, 0x8e, 0x18, 0x15, 0xc2, 0xf2, 0x4b, 0x4d, 0x80,
+        0xa8, 0xe3, 0x14, 0x93, 0x16, 0xc3, 0x51, 0x8c, 0xe7, 0xb7, 0xad, 0x33, 0x83, 0x68, 0xd0,
+        0x38, 0xca, 0x66,
+    ];
+    const AGG_123: [u8; 32] = [
+        0x90, 0x53, 0x9e, 0xed, 0xe5, 0x65, 0xf5, 0xd0, 0x54, 0xf3, 0x2c, 0xc0, 0xc2, 0x20, 0x12,
+        0x68, 0x89, 0xed, 0x1e, 0x5d, 0x19, 0x3b, 0xaf, 0x15, 0xae, 0xf3, 0x44, 0xfe, 0x59, 0xd4,
+        0x61, 0x0c,
+    ];
+    const AGG_111: [u8; 32] = [
+        0xb4, 0x36, 0xe3, 0xba, 0xd6, 0x2b, 0x8c, 0xd4, 0x09, 0x96, 0x9a, 0x22, 0x47, 0x31, 0xc1,
+        0x93, 0xd0, 0x51, 0x16, 0x2d, 0x8c, 0x5a, 0xe8, 0xb1, 0x09, 0x30, 0x61, 0x27, 0xda, 0x3a,
+        0xa9, 0x35,
+    ];
+
+    #[test]
+    fn musig2_key_agg() {
+        // Vectors of BIP327
+        let ctx = KeyAggContext::new(&[X1, X2, X3]).map_err(|_| ())?;
+        assert_eq!(ctx.xonly(), AGG_123);
+        let ctx = KeyAggContext::new(&[X1, X1, X1]).map_err(|_| ())?;
+        assert_eq!(ctx.xonly(), AGG_111);
+    }
+
+    #[test]
+    fn musig2_sign() {
+        let sks = [
+            Secp256k1::derive_from_path(&make_bip32_path::<5>(b"m/86'/0'/0'/0/0")),
+            Secp256k1::derive_from_path(&make_bip32_path::<5>(b"m/86'/0'/0'/0/1")),
+        ];
+        let mut keys = [[0u8; 33]; 2];
+        for (key, sk) in keys.iter_mut().zip(sks.iter()) {
+            *key = sk.public_key().map_err(|_| ())?.compressed();
+        }
+        let mut ctx = KeyAggContext::new(&keys).map_err(|_| ())?;
+        ctx.apply_tweak(&[0x11; 32], true).map_err(|_| ())?;
+        let mut even = [0u8; 33];
+        even[0] = 0x02;
+        even[1..].copy_from_slice(&ctx.xonly());
+        let output_key =
+            ECPublicKey::<65, 'W'>::from_compressed(CurvesId::Secp256k1, &even).map_err(|_| ())?;
+
+        // Two inputs signed with the same aggregated key
+        for msg in [[0x42u8; 32], [0x43u8; 32]] {
+            let (n0, p0) = SecNonce::generate(&sks[0]).map_err(|_| ())?;
+            let (n1, p1) = SecNonce::generate(&sks[1]).map_err(|_| ())?;
+            let aggnonce = nonce_agg(&[p0, p1]).map_err(|_| ())?;
+            let session = Session::new(&ctx, &aggnonce, &msg).map_err(|_| ())?;
+            let psigs = [
+                session.partial_sign(n0, &sks[0], &ctx).map_err(|_| ())?,
+                session.partial_sign(n1, &sks[1], &ctx).map_err(|_| ())?,
+            ];
+            let sig = session.partial_sig_agg(&psigs, &ctx).map_err(|_| ())?;
+            assert_eq!(output_key.schnorr_verify(&sig, &msg), true);
+        }
+    }
+}
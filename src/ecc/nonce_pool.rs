@@ -0,0 +1,280 @@
+//! ECDSA nonces computed ahead of the signatures
+//!
+//! The costly part of an ECDSA signature is the scalar multiplication
+//! `k·G`, which does not depend on the message. A [`NoncePool`] computes
+//! (`1/k`, `r = (k·G).x`) pairs while the app is idle, and
+//! [`ECPrivateKey::sign_with_pool`] consumes one, leaving only a few
+//! modular operations on the path of the signature request:
+//!
+//! ```
+//! static mut POOL: NoncePool<32, 8> = NoncePool::new(CurvesId::Secp256k1);
+//!
+//! let pool = unsafe { &mut *core::ptr::addr_of_mut!(POOL) };
+//! loop {
+//!     match comm.next_event::<Ins>() {
+//!         io::Event::Ticker => {
+//!             pool.refill_one()?;
+//!         }
+//!         io::Event::Command(Ins::Sign) => {
+//!             let (len, parity) = sk.sign_with_pool(pool, &hash, &mut sig)?;
+//!             ...
+//!         }
+//!         ...
+//!     }
+//! }
+//! ```
+//!
+//! The pairs are secrets as much as the key: each one is used only once,
+//! they are only held in RAM, and they are wiped when the pool is dropped.
+//! Apps must also call [`NoncePool::wipe`] when they lock themselves.
+
+use super::{CurvesId, CxError, ECPrivateKey, EcPoint};
+use crate::bindings::*;
+use crate::bn::{Bn, BnArena};
+use crate::ct::zeroize;
+use core::cmp::Ordering;
+
+fn check(err: cx_err_t) -> Result<(), CxError> {
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(())
+    }
+}
+
+fn curve_order<'a>(arena: &'a BnArena, curve: CurvesId, len: usize) -> Result<Bn<'a>, CxError> {
+    let n = arena.alloc(len)?;
+    check(unsafe {
+        cx_ecdomain_parameter_bn(curve as cx_curve_t, CX_CURVE_PARAM_Order, n.handle())
+    })?;
+    Ok(n)
+}
+
+/// Write the DER encoding of the signature (`r`, `s`) into `out`, as
+/// `cx_ecdsa_sign` does, and return its length
+fn encode_der(r: &[u8], s: &[u8], out: &mut [u8]) -> Result<usize, CxError> {
+    fn integer(int: &[u8], out: &mut [u8]) -> usize {
+        let start = int.iter().position(|&b| b != 0).unwrap_or(int.len() - 1);
+        let int = &int[start..];
+        let pad = (int[0] & 0x80 != 0) as usize;
+        out[0] = 0x02;
+        out[1] = (pad + int.len()) as u8;
+        out[2] = 0;
+        out[2 + pad..2 + pad + int.len()].copy_from_slice(int);
+        2 + pad + int.len()
+    }
+    // Room for both integers padded
+    if out.len() < 8 + r.len() + s.len() {
+        return Err(CxError::InvalidParameterSize);
+    }
+    let r_len = integer(r, &mut out[2..]);
+    let s_len = integer(s, &mut out[2 + r_len..]);
+    out[0] = 0x30;
+    out[1] = (r_len + s_len) as u8;
+    Ok(2 + r_len + s_len)
+}
+
+/// Precomputed nonce: inverse of `k`, and `r` with the parity of the `y`
+/// coordinate of `k·G`
+#[derive(Copy, Clone)]
+struct Nonce<const N: usize> {
+    k_inv: [u8; N],
+    r: [u8; N],
+    parity: u32,
+}
+
+/// Up to `E` ECDSA nonces for keys of `N` bytes on `curve`
+pub struct NoncePool<const N: usize, const E: usize> {
+    curve: CurvesId,
+    nonces: [Nonce<N>; E],
+    len: usize,
+}
+
+impl<const N: usize, const E: usize> NoncePool<N, E> {
+    pub const fn new(curve: CurvesId) -> Self {
+        NoncePool {
+            curve,
+            nonces: [Nonce {
+                k_inv: [0; N],
+                r: [0; N],
+                parity: 0,
+            }; E],
+            len: 0,
+        }
+    }
+
+    /// Number of nonces ready
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub fn is_full(&self) -> bool {
+        self.len == E
+    }
+
+    /// Compute one more nonce, one scalar multiplication, unless the pool is
+    /// full. Returns whether one was added.
+    pub fn refill_one(&mut self) -> Result<bool, CxError> {
+        if self.is_full() {
+            return Ok(false);
+        }
+        let arena = BnArena::lock(N)?;
+        let n = curve_order(&arena, self.curve, N)?;
+        let mut k = arena.alloc(N)?;
+        let mut x = arena.alloc(N)?;
+        let mut r = arena.alloc(N)?;
+        let mut kb = [0u8; N];
+        let (mut xb, mut yb) = ([0u8; N], [0u8; N]);
+        // k uniform in [1, n), and r != 0
+        loop {
+            k.rng(&n)?;
+            if k.compare_u32(0)? == Ordering::Equal {
+                continue;
+            }
+            k.export(&mut kb)?;
+            let mut p = EcPoint::generator(&arena, self.curve)?;
+            let res = p.scalarmul(&kb);
+            zeroize(&mut kb);
+            res?;
+            p.export(&mut xb, &mut yb)?;
+            x.set_bytes(&xb)?;
+            r.reduce(&x, &n)?;
+            if r.compare_u32(0)? != Ordering::Equal {
+                break;
+            }
+        }
+        let nonce = &mut self.nonces[self.len];
+        let mut k_inv = arena.alloc(N)?;
+        k_inv.mod_invert_nprime(&k, &n)?;
+        k_inv.export(&mut nonce.k_inv)?;
+        r.export(&mut nonce.r)?;
+        nonce.parity = (yb[N - 1] & 1) as u32 * CX_ECCINFO_PARITY_ODD;
+        self.len += 1;
+        zeroize(&mut yb);
+        Ok(true)
+    }
+
+    /// Compute nonces until the pool is full
+    pub fn fill(&mut self) -> Result<(), CxError> {
+        while self.refill_one()? {}
+        Ok(())
+    }
+
+    /// Take the last nonce computed
+    fn pop(&mut self) -> Option<&mut Nonce<N>> {
+        self.len = self.len.checked_sub(1)?;
+        Some(&mut self.nonces[self.len])
+    }
+
+    /// Erase all the nonces
+    pub fn wipe(&mut self) {
+        for nonce in self.nonces.iter_mut() {
+            zeroize(&mut nonce.k_inv);
+            zeroize(&mut nonce.r);
+        }
+        self.len = 0;
+    }
+}
+
+impl<const N: usize, const E: usize> Drop for NoncePool<N, E> {
+    fn drop(&mut self) {
+        self.wipe();
+    }
+}
+
+impl<const N: usize> ECPrivateKey<N, 'W'> {
+    /// Same as [`ECPrivateKey::sign_into`], with a nonce of `pool`, which
+    /// must be on the curve of the key: `s = (e + r·d) / k`. Falls back to
+    /// [`ECPrivateKey::sign_into`] when the pool is empty.
+    pub fn sign_with_pool<const E: usize>(
+        &self,
+        pool: &mut NoncePool<N, E>,
+        hash: &[u8],
+        out: &mut [u8],
+    ) -> Result<(u32, u32), CxError> {
+        if pool.curve as u8 != self.curve as u8 {
+            return Err(CxError::InvalidCurve);
+        }
+        let nonce = match pool.pop() {
+            Some(nonce) => nonce,
+            None => return self.sign_into(hash, out),
+        };
+        let mut s = [0u8; N];
+        let res = self.pool_s(nonce, hash, &mut s);
+        zeroize(&mut nonce.k_inv);
+        let len = res.and_then(|()| encode_der(&nonce.r, &s, out));
+        zeroize(&mut nonce.r);
+        Ok((len? as u32, nonce.parity))
+    }
+
+    /// `s` of the signature of `hash` with `nonce`
+    fn pool_s(&self, nonce: &Nonce<N>, hash: &[u8], s: &mut [u8; N]) -> Result<(), CxError> {
+        let arena = BnArena::lock(N)?;
+        let n = curve_order(&arena, self.curve, N)?;
+        let r = arena.alloc_init(N, &nonce.r)?;
+        let k_inv = arena.alloc_init(N, &nonce.k_inv)?;
+        let d = arena.alloc_init(N, &self.key)?;
+        // e is the leftmost bytes of the hash, reduced
+        let h = arena.alloc_init(N, &hash[..hash.len().min(N)])?;
+        let mut e = arena.alloc(N)?;
+        e.reduce(&h, &n)?;
+        let mut t = arena.alloc(N)?;
+        t.mod_mul(&r, &d, &n)?;
+        let mut u = arena.alloc(N)?;
+        u.mod_add(&e, &t, &n)?;
+        t.mod_mul(&k_inv, &u, &n)?;
+        if t.compare_u32(0)? == Ordering::Equal {
+            return Err(CxError::InvalidParameterValue);
+        }
+        t.export(s)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, Secp256k1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PATH: [u32; 5] = make_bip32_path(b"m/44'/0'/0'/0/0");
+
+    #[test]
+    fn der() {
+        let mut out = [0u8; 72];
+        let r = [0x80u8; 32];
+        let mut s = [0u8; 32];
+        s[31] = 1;
+        let len = encode_der(&r, &s, &mut out).map_err(|_| ())?;
+        assert_eq!(len, 2 + 35 + 3);
+        assert_eq!(&out[..5], &[0x30, 38, 0x02, 33, 0x00]);
+        assert_eq!(&out[37..40], &[0x02, 1, 1]);
+    }
+
+    #[test]
+    fn pool_sign() {
+        let sk = Secp256k1::derive_from_path(&PATH);
+        let pk = sk.public_key().map_err(|_| ())?;
+        let hash = [0x42u8; 32];
+        let mut pool = NoncePool::<32, 2>::new(CurvesId::Secp256k1);
+        pool.fill().map_err(|_| ())?;
+        assert_eq!(pool.len(), 2);
+        let mut sig = [0u8; 72];
+        for _ in 0..3 {
+            // The last one falls back to a regular signature
+            let (len, _) = sk
+                .sign_with_pool(&mut pool, &hash, &mut sig)
+                .map_err(|_| ())?;
+            assert_eq!(pk.verify((&sig, len), &hash), true);
+        }
+        assert_eq!(pool.is_empty(), true);
+        pool.refill_one().map_err(|_| ())?;
+        pool.wipe();
+        assert_eq!(pool.len(), 0);
+    }
+}
@@ -0,0 +1,882 @@
+//! Pallas and Vesta, the Pasta curves of Zcash Orchard and Mina
+//!
+//! Both curves are `y^2 = x^3 + 5`, Pallas over `Fp` with a group of order
+//! `q`, Vesta over `Fq` with a group of order `p`. The OS knows neither, so
+//! their arithmetic is built here on the bignum engine. The field is a type
+//! parameter, so the code is specialized at compile time for each modulus:
+//! the elements stay in the engine, in Montgomery representation, for a
+//! whole scalar multiplication, permutation or hash.
+//!
+//! Besides the group operations, the module provides the Poseidon sponge of
+//! width 3 used by both chains, its round constants given by the app, and
+//! the Sinsemilla hash of Orchard, over a table of `2^10` points the app
+//! stores in flash.
+//!
+//! Field elements and coordinates are big endian. Compressed points are
+//! encoded as in Orchard: `x` little endian, with the parity of `y` as the
+//! most significant bit.
+//!
+//! # Examples
+//!
+//! ```
+//! let pk = Pallas::public_key(&sk)?;
+//! let shared = Pallas::scalar_mul(&sk, &Pallas::decompress(&peer)?)?;
+//! let h = Poseidon::<PastaFp>::hash(&MINA_POSEIDON, &[0; 32], &[a, b])?;
+//! ```
+
+use super::CxError;
+use crate::bindings::CX_BN_WORD_ALIGNEMENT;
+use crate::bn::{Bn, BnArena, MontCtx};
+use crate::ct::ct_lt;
+use core::cmp::Ordering;
+use core::marker::PhantomData;
+
+const FE_LEN: usize = 32;
+
+/// Element of a Pasta field, big endian
+pub type PastaFe = [u8; FE_LEN];
+
+/// Affine point `x || y`, big endian, all zero for the identity (`(0, 0)`
+/// is not on the curves)
+pub type PastaPoint = [u8; 2 * FE_LEN];
+
+/// Prime field of the Pasta curves
+pub trait PastaField {
+    /// Modulus, big endian
+    const MODULUS: PastaFe;
+}
+
+/// Base field of Pallas, scalar field of Vesta
+pub struct PastaFp;
+
+/// Base field of Vesta, scalar field of Pallas
+pub struct PastaFq;
+
+impl PastaField for PastaFp {
+    const MODULUS: PastaFe = [
+        0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x22, 0x46, 0x98, 0xfc, 0x09, 0x4c, 0xf9, 0x1b, 0x99, 0x2d, 0x30, 0xed, 0x00, 0x00,
+        0x00, 0x01,
+    ];
+}
+
+impl PastaField for PastaFq {
+    const MODULUS: PastaFe = [
+        0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x22, 0x46, 0x98, 0xfc, 0x09, 0x94, 0xa8, 0xdd, 0x8c, 0x46, 0xeb, 0x21, 0x00, 0x00,
+        0x00, 0x01,
+    ];
+}
+
+/// Generator `(-1, 2)` of the curve over `F`
+const fn generator<F: PastaField>() -> PastaPoint {
+    let mut g = [0u8; 2 * FE_LEN];
+    let mut i = 0;
+    while i < FE_LEN {
+        g[i] = F::MODULUS[i];
+        i += 1;
+    }
+    // The moduli end with 0x01
+    g[FE_LEN - 1] = 0;
+    g[2 * FE_LEN - 1] = 2;
+    g
+}
+
+/// Engine state of the operations of the field `F`. Field elements are
+/// held in Montgomery representation.
+struct Engine<'a, F> {
+    arena: &'a BnArena,
+    p: Bn<'a>,
+    mont: MontCtx<'a>,
+    zero: Bn<'a>,
+    one: Bn<'a>,
+    /// Constant `b = 5` of the curve
+    b: Bn<'a>,
+    tmp: Bn<'a>,
+    _field: PhantomData<F>,
+}
+
+impl<'a, F: PastaField> Engine<'a, F> {
+    fn new(arena: &'a BnArena) -> Result<Self, CxError> {
+        let p = arena.alloc_init(FE_LEN, &F::MODULUS)?;
+        let mont = MontCtx::new(arena, &p)?;
+        let mut e = Engine {
+            arena,
+            p,
+            mont,
+            zero: arena.alloc(FE_LEN)?,
+            one: arena.alloc(FE_LEN)?,
+            b: arena.alloc(FE_LEN)?,
+            tmp: arena.alloc(FE_LEN)?,
+            _field: PhantomData,
+        };
+        e.tmp.set_u32(1)?;
+        e.mont.to_montgomery(&mut e.one, &e.tmp)?;
+        e.tmp.set_u32(5)?;
+        e.mont.to_montgomery(&mut e.b, &e.tmp)?;
+        Ok(e)
+    }
+
+    fn alloc(&self) -> Result<Bn<'a>, CxError> {
+        self.arena.alloc(FE_LEN)
+    }
+
+    /// `r` = the big endian value `v`, which must be below the modulus
+    fn load(&mut self, r: &mut Bn, v: &PastaFe) -> Result<(), CxError> {
+        if !ct_lt(v, &F::MODULUS) {
+            return Err(CxError::InvalidParameterValue);
+        }
+        self.tmp.set_bytes(v)?;
+        self.mont.to_montgomery(r, &self.tmp)
+    }
+
+    /// `out` = value of `a`, big endian
+    fn store(&mut self, out: &mut PastaFe, a: &Bn) -> Result<(), CxError> {
+        self.mont.from_montgomery(&mut self.tmp, a)?;
+        self.tmp.export(out)
+    }
+
+    fn add(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        r.mod_add(a, b, &self.p)
+    }
+
+    fn sub(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        r.mod_sub(a, b, &self.p)
+    }
+
+    fn mul(&self, r: &mut Bn, a: &Bn, b: &Bn) -> Result<(), CxError> {
+        self.mont.mul(r, a, b)
+    }
+
+    fn sqr(&self, r: &mut Bn, a: &Bn) -> Result<(), CxError> {
+        self.mont.mul(r, a, a)
+    }
+
+    fn is_zero(&self, a: &Bn) -> Result<bool, CxError> {
+        Ok(a.compare(&self.zero)? == Ordering::Equal)
+    }
+
+    /// `r = x^3 + b`
+    fn rhs(&self, r: &mut Bn, x: &Bn, t: &mut Bn) -> Result<(), CxError> {
+        self.sqr(r, x)?;
+        self.mul(t, r, x)?;
+        self.add(r, t, &self.b)
+    }
+}
+
+/// Point `(x / z^2, y / z^3)` in Jacobian coordinates, at infinity when `z`
+/// is zero
+struct Point<'a> {
+    x: Bn<'a>,
+    y: Bn<'a>,
+    z: Bn<'a>,
+}
+
+/// Temporaries of the point operations
+struct Scratch<'a>([Bn<'a>; 7]);
+
+impl<'a> Scratch<'a> {
+    fn new<F: PastaField>(e: &Engine<'a, F>) -> Result<Self, CxError> {
+        Ok(Scratch([
+            e.alloc()?,
+            e.alloc()?,
+            e.alloc()?,
+            e.alloc()?,
+            e.alloc()?,
+            e.alloc()?,
+            e.alloc()?,
+        ]))
+    }
+}
+
+impl<'a> Point<'a> {
+    fn alloc<F: PastaField>(e: &Engine<'a, F>) -> Result<Self, CxError> {
+        Ok(Point {
+            x: e.alloc()?,
+            y: e.alloc()?,
+            z: e.alloc()?,
+        })
+    }
+
+    fn copy(&mut self, a: &Self) -> Result<(), CxError> {
+        self.x.copy_from(&a.x)?;
+        self.y.copy_from(&a.y)?;
+        self.z.copy_from(&a.z)
+    }
+
+    fn cswap(a: &mut Self, b: &mut Self, swap: bool) {
+        Bn::cswap(&mut a.x, &mut b.x, swap);
+        Bn::cswap(&mut a.y, &mut b.y, swap);
+        Bn::cswap(&mut a.z, &mut b.z, swap);
+    }
+
+    /// `self` = the affine point `v`, checked to be on the curve
+    fn load<F: PastaField>(
+        &mut self,
+        e: &mut Engine<'a, F>,
+        v: &PastaPoint,
+        s: &mut Scratch<'a>,
+    ) -> Result<(), CxError> {
+        if v.iter().all(|&b| b == 0) {
+            return self.z.copy_from(&e.zero);
+        }
+        let mut c = [0u8; FE_LEN];
+        c.copy_from_slice(&v[..FE_LEN]);
+        e.load(&mut self.x, &c).map_err(|_| CxError::InvalidPoint)?;
+        c.copy_from_slice(&v[FE_LEN..]);
+        e.load(&mut self.y, &c).map_err(|_| CxError::InvalidPoint)?;
+        self.z.copy_from(&e.one)?;
+        let [t0, t1, t2, ..] = &mut s.0;
+        e.rhs(t0, &self.x, t1)?;
+        e.sqr(t2, &self.y)?;
+        match t0.compare(t2)? {
+            Ordering::Equal => Ok(()),
+            _ => Err(CxError::InvalidPoint),
+        }
+    }
+
+    /// Affine encoding of the point into `out`
+    fn store<F: PastaField>(
+        &self,
+        e: &mut Engine<'a, F>,
+        out: &mut PastaPoint,
+        s: &mut Scratch<'a>,
+    ) -> Result<(), CxError> {
+        out.fill(0);
+        if e.is_zero(&self.z)? {
+            return Ok(());
+        }
+        let [t0, t1, t2, t3, ..] = &mut s.0;
+        e.mont.invert_nprime(t0, &self.z)?;
+        e.sqr(t1, t0)?;
+        let mut c = [0u8; FE_LEN];
+        e.mul(t2, &self.x, t1)?;
+        e.store(&mut c, t2)?;
+        out[..FE_LEN].copy_from_slice(&c);
+        e.mul(t2, t1, t0)?;
+        e.mul(t3, &self.y, t2)?;
+        e.store(&mut c, t3)?;
+        out[FE_LEN..].copy_from_slice(&c);
+        Ok(())
+    }
+
+    /// `self = 2 self`, with the `dbl-2009-l` formulas
+    fn double<F: PastaField>(
+        &mut self,
+        e: &Engine<'a, F>,
+        s: &mut Scratch<'a>,
+    ) -> Result<(), CxError> {
+        let [t0, t1, t2, t3, t4, t5, t6] = &mut s.0;
+        e.sqr(t0, &self.x)?; // A
+        e.sqr(t1, &self.y)?; // B
+        e.sqr(t2, t1)?; // C
+        e.add(t3, &self.x, t1)?;
+        e.sqr(t4, t3)?;
+        e.sub(t3, t4, t0)?;
+        e.sub(t4, t3, t2)?;
+        e.add(t3, t4, t4)?; // D
+        e.add(t4, t0, t0)?;
+        e.add(t5, t4, t0)?; // E
+        e.sqr(t6, t5)?; // F
+        e.mul(t4, &self.y, &self.z)?;
+        e.add(&mut self.z, t4, t4)?;
+        e.add(t4, t3, t3)?;
+        e.sub(&mut self.x, t6, t4)?;
+        e.sub(t4, t3, &self.x)?;
+        e.mul(t6, t5, t4)?;
+        e.add(t0, t2, t2)?;
+        e.add(t2, t0, t0)?;
+        e.add(t0, t2, t2)?; // 8 C
+        e.sub(&mut self.y, t6, t0)
+    }
+
+    /// `self = self + b`, with the `add-2007-bl` formulas. With `incomplete`,
+    /// the cases the generic formulas do not cover (an operand at infinity,
+    /// `self = ±b`) fail with `CxError::InvalidPoint` instead, as the
+    /// incomplete addition of Sinsemilla does.
+    fn add_assign<F: PastaField>(
+        &mut self,
+        e: &Engine<'a, F>,
+        b: &Self,
+        s: &mut Scratch<'a>,
+        incomplete: bool,
+    ) -> Result<(), CxError> {
+        if e.is_zero(&b.z)? || e.is_zero(&self.z)? {
+            if incomplete {
+                return Err(CxError::InvalidPoint);
+            }
+            return match e.is_zero(&b.z)? {
+                true => Ok(()),
+                false => self.copy(b),
+            };
+        }
+        let [t0, t1, t2, t3, t4, t5, t6] = &mut s.0;
+        e.sqr(t0, &self.z)?; // Z1Z1
+        e.sqr(t1, &b.z)?; // Z2Z2
+        e.mul(t2, &self.x, t1)?; // U1
+        e.mul(t3, &b.x, t0)?; // U2
+        e.mul(t4, &b.z, t1)?;
+        e.mul(t5, &self.y, t4)?; // S1
+        e.mul(t4, &self.z, t0)?;
+        e.mul(t6, &b.y, t4)?; // S2
+        if t2.compare(t3)? == Ordering::Equal {
+            if incomplete {
+                return Err(CxError::InvalidPoint);
+            }
+            return match t5.compare(t6)? == Ordering::Equal {
+                true => self.double(e, s),
+                false => self.z.copy_from(&e.zero),
+            };
+        }
+        e.sub(t4, t3, t2)?; // H
+        e.add(t3, &self.z, &b.z)?;
+        e.sqr(&mut self.x, t3)?;
+        e.sub(t3, &self.x, t0)?;
+        e.sub(&mut self.x, t3, t1)?;
+        e.mul(&mut self.z, &self.x, t4)?;
+        e.add(t0, t4, t4)?;
+        e.sqr(t1, t0)?; // I
+        e.mul(t3, t4, t1)?; // J
+        e.sub(t0, t6, t5)?;
+        e.add(t6, t0, t0)?; // r
+        e.mul(t0, t2, t1)?; // V
+        e.sqr(t1, t6)?;
+        e.sub(t2, t1, t3)?;
+        e.add(t1, t0, t0)?;
+        e.sub(&mut self.x, t2, t1)?;
+        e.sub(t1, t0, &self.x)?;
+        e.mul(t2, t6, t1)?;
+        e.mul(t1, t5, t3)?;
+        e.add(t4, t1, t1)?;
+        e.sub(&mut self.y, t2, t4)
+    }
+
+    /// `self = k self`, `k` being a big endian scalar. The sequence of
+    /// operations of the Montgomery ladder only depends on the bit length of
+    /// `k`.
+    fn mul_secret<F: PastaField>(
+        &mut self,
+        e: &Engine<'a, F>,
+        k: &PastaFe,
+        s: &mut Scratch<'a>,
+    ) -> Result<(), CxError> {
+        let bit = |i: usize| (k[FE_LEN - 1 - i / 8] >> (i % 8)) & 1 == 1;
+        let top = match (0..FE_LEN * 8).rev().find(|&i| bit(i)) {
+            Some(top) => top,
+            None => return self.z.copy_from(&e.zero),
+        };
+        let mut r1 = Self::alloc(e)?;
+        r1.copy(self)?;
+        r1.double(e, s)?;
+        for i in (0..top).rev() {
+            Self::cswap(self, &mut r1, bit(i));
+            r1.add_assign(e, self, s, false)?;
+            self.double(e, s)?;
+            Self::cswap(self, &mut r1, bit(i));
+        }
+        Ok(())
+    }
+}
+
+/// Group operations of a Pasta curve, on affine points
+pub trait PastaCurve {
+    /// Field of the coordinates
+    type Base: PastaField;
+    /// Field of the scalars, of the order of the group
+    type Scalar: PastaField;
+    /// Generator `(-1, 2)`
+    const GENERATOR: PastaPoint;
+
+    /// Whether `p` is a point of the curve, or the identity
+    fn is_on_curve(p: &PastaPoint) -> Result<bool, CxError> {
+        let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+        let mut e = Engine::<Self::Base>::new(&arena)?;
+        let mut s = Scratch::new(&e)?;
+        let mut a = Point::alloc(&e)?;
+        match a.load(&mut e, p, &mut s) {
+            Ok(()) => Ok(true),
+            Err(CxError::InvalidPoint) => Ok(false),
+            Err(err) => Err(err),
+        }
+    }
+
+    /// `a + b`. Points off the curve are rejected with
+    /// `CxError::InvalidPoint`.
+    fn add(a: &PastaPoint, b: &PastaPoint) -> Result<PastaPoint, CxError> {
+        let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+        let mut e = Engine::<Self::Base>::new(&arena)?;
+        let mut s = Scratch::new(&e)?;
+        let (mut pa, mut pb) = (Point::alloc(&e)?, Point::alloc(&e)?);
+        pa.load(&mut e, a, &mut s)?;
+        pb.load(&mut e, b, &mut s)?;
+        pa.add_assign(&e, &pb, &mut s, false)?;
+        let mut out = [0u8; 2 * FE_LEN];
+        pa.store(&mut e, &mut out, &mut s)?;
+        Ok(out)
+    }
+
+    /// `k p`, `k` being below the order of the group. Points off the curve
+    /// are rejected with `CxError::InvalidPoint`.
+    fn scalar_mul(k: &PastaFe, p: &PastaPoint) -> Result<PastaPoint, CxError> {
+        if !ct_lt(k, &Self::Scalar::MODULUS) {
+            return Err(CxError::InvalidParameterValue);
+        }
+        let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+        let mut e = Engine::<Self::Base>::new(&arena)?;
+        let mut s = Scratch::new(&e)?;
+        let mut a = Point::alloc(&e)?;
+        a.load(&mut e, p, &mut s)?;
+        a.mul_secret(&e, k, &mut s)?;
+        let mut out = [0u8; 2 * FE_LEN];
+        a.store(&mut e, &mut out, &mut s)?;
+        Ok(out)
+    }
+
+    /// Public key `sk G` of the secret key `sk`, in `[1, order - 1]`
+    fn public_key(sk: &PastaFe) -> Result<PastaPoint, CxError> {
+        if sk.iter().all(|&b| b == 0) {
+            return Err(CxError::InvalidParameterValue);
+        }
+        Self::scalar_mul(sk, &Self::GENERATOR)
+    }
+
+    /// Compressed encoding of the affine point `p`, taken as is
+    fn compress(p: &PastaPoint) -> [u8; FE_LEN] {
+        let mut out = [0u8; FE_LEN];
+        for (o, &x) in out.iter_mut().zip(p[..FE_LEN].iter().rev()) {
+            *o = x;
+        }
+        out[FE_LEN - 1] |= (p[2 * FE_LEN - 1] & 1) << 7;
+        out
+    }
+
+    /// Point of the compressed encoding `c`. Encodings of no point fail with
+    /// `CxError::InvalidPoint`.
+    fn decompress(c: &[u8; FE_LEN]) -> Result<PastaPoint, CxError> {
+        let mut out = [0u8; 2 * FE_LEN];
+        if c.iter().all(|&b| b == 0) {
+            return Ok(out);
+        }
+        let sign = (c[FE_LEN - 1] >> 7) as u32;
+        let (x, y) = out.split_at_mut(FE_LEN);
+        for (o, &b) in x.iter_mut().zip(c.iter().rev()) {
+            *o = b;
+        }
+        x[0] &= 0x7f;
+        if !ct_lt(x, &Self::Base::MODULUS) {
+            return Err(CxError::InvalidPoint);
+        }
+        let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+        let e = Engine::<Self::Base>::new(&arena)?;
+        let bx = arena.alloc_init(FE_LEN, x)?;
+        let (mut t0, mut t1) = (e.alloc()?, e.alloc()?);
+        // y^2 = x^3 + 5, out of Montgomery representation
+        t0.mod_mul(&bx, &bx, &e.p)?;
+        t1.mod_mul(&t0, &bx, &e.p)?;
+        t0.set_u32(5)?;
+        let mut rhs = e.alloc()?;
+        rhs.mod_add(&t1, &t0, &e.p)?;
+        // No point has y = 0, the groups being of odd order
+        t0.mod_sqrt(&rhs, &e.p, sign)
+            .map_err(|_| CxError::InvalidPoint)?;
+        t0.export(y)?;
+        Ok(out)
+    }
+}
+
+/// Pallas, over `Fp`, of order `q`
+pub struct Pallas;
+
+/// Vesta, over `Fq`, of order `p`
+pub struct Vesta;
+
+impl PastaCurve for Pallas {
+    type Base = PastaFp;
+    type Scalar = PastaFq;
+    const GENERATOR: PastaPoint = generator::<PastaFp>();
+}
+
+impl PastaCurve for Vesta {
+    type Base = PastaFq;
+    type Scalar = PastaFp;
+    const GENERATOR: PastaPoint = generator::<PastaFq>();
+}
+
+/// Width of the Poseidon permutation, two elements of rate and one of
+/// capacity
+pub const POSEIDON_WIDTH: usize = 3;
+
+/// Instance of the Poseidon permutation
+pub struct PoseidonParams {
+    /// Number of full rounds, half of them before the partial rounds
+    pub full_rounds: usize,
+    /// Number of partial rounds, applying the S-box to the first element
+    /// only
+    pub partial_rounds: usize,
+    /// Exponent of the S-box: 5 for Orchard, 7 for Mina
+    pub alpha: u32,
+    /// Round constants, one row per round
+    pub round_constants: &'static [[PastaFe; POSEIDON_WIDTH]],
+    /// MDS matrix, by rows
+    pub mds: [[PastaFe; POSEIDON_WIDTH]; POSEIDON_WIDTH],
+    /// Whether the round constants are added at the end of the rounds, as in
+    /// the Kimchi instance of Mina, rather than at their start
+    pub ark_last: bool,
+}
+
+/// Poseidon sponge over the field `F`. The capacity element is the last one
+/// of the state, and each permutation locks the bignum engine.
+pub struct Poseidon<'p, F> {
+    params: &'p PoseidonParams,
+    state: [PastaFe; POSEIDON_WIDTH],
+    /// Elements absorbed since the last permutation, added at the next one
+    pending: [PastaFe; POSEIDON_WIDTH - 1],
+    absorbed: usize,
+    _field: PhantomData<F>,
+}
+
+impl<'p, F: PastaField> Poseidon<'p, F> {
+    /// Sponge of the state `[0, 0, capacity]`: the domain of the hash, such
+    /// as `2^64 L` for the constant length hash of `L` elements of Orchard,
+    /// or zero for Mina
+    pub fn new(params: &'p PoseidonParams, capacity: &PastaFe) -> Self {
+        Poseidon {
+            params,
+            state: [[0; FE_LEN], [0; FE_LEN], *capacity],
+            pending: [[0; FE_LEN]; POSEIDON_WIDTH - 1],
+            absorbed: 0,
+            _field: PhantomData,
+        }
+    }
+
+    /// Absorb the element `x`, below the modulus
+    pub fn absorb(&mut self, x: &PastaFe) -> Result<(), CxError> {
+        if !ct_lt(x, &F::MODULUS) {
+            return Err(CxError::InvalidParameterValue);
+        }
+        if self.absorbed == POSEIDON_WIDTH - 1 {
+            self.permute()?;
+        }
+        self.pending[self.absorbed] = *x;
+        self.absorbed += 1;
+        Ok(())
+    }
+
+    /// Permute the state and return its first element
+    pub fn squeeze(&mut self) -> Result<PastaFe, CxError> {
+        self.permute()?;
+        Ok(self.state[0])
+    }
+
+    /// Hash of `inputs`, from the state `[0, 0, capacity]`
+    pub fn hash(
+        params: &'p PoseidonParams,
+        capacity: &PastaFe,
+        inputs: &[PastaFe],
+    ) -> Result<PastaFe, CxError> {
+        let mut sponge = Self::new(params, capacity);
+        for x in inputs {
+            sponge.absorb(x)?;
+        }
+        sponge.squeeze()
+    }
+
+    fn permute(&mut self) -> Result<(), CxError> {
+        let params = self.params;
+        let rounds = params.full_rounds + params.partial_rounds;
+        if params.round_constants.len() < rounds {
+            return Err(CxError::InvalidParameter);
+        }
+        let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+        let mut e = Engine::<F>::new(&arena)?;
+        let mut st = [e.alloc()?, e.alloc()?, e.alloc()?];
+        let mut next = [e.alloc()?, e.alloc()?, e.alloc()?];
+        let (mut c, mut t) = (e.alloc()?, e.alloc()?);
+        let mut mds = [
+            [e.alloc()?, e.alloc()?, e.alloc()?],
+            [e.alloc()?, e.alloc()?, e.alloc()?],
+            [e.alloc()?, e.alloc()?, e.alloc()?],
+        ];
+        for (row, values) in mds.iter_mut().zip(params.mds.iter()) {
+            for (m, v) in row.iter_mut().zip(values.iter()) {
+                e.load(m, v)?;
+            }
+        }
+        for (i, s) in st.iter_mut().enumerate() {
+            e.load(&mut t, &self.state[i])?;
+            if i < self.absorbed {
+                e.load(&mut c, &self.pending[i])?;
+                e.add(s, &t, &c)?;
+            } else {
+                s.copy_from(&t)?;
+            }
+        }
+        self.absorbed = 0;
+
+        let alpha = params.alpha.to_be_bytes();
+        let half = params.full_rounds / 2;
+        for (r, constants) in params.round_constants[..rounds].iter().enumerate() {
+            if !params.ark_last {
+                for (s, v) in st.iter_mut().zip(constants.iter()) {
+                    e.load(&mut c, v)?;
+                    e.add(&mut t, s, &c)?;
+                    core::mem::swap(s, &mut t);
+                }
+            }
+            let full = r < half || r >= half + params.partial_rounds;
+            for s in st.iter_mut().take(if full { POSEIDON_WIDTH } else { 1 }) {
+                e.mont.pow(&mut t, s, &alpha)?;
+                core::mem::swap(s, &mut t);
+            }
+            for (n, row) in next.iter_mut().zip(mds.iter()) {
+                n.copy_from(&e.zero)?;
+                for (m, s) in row.iter().zip(st.iter()) {
+                    e.mul(&mut c, m, s)?;
+                    e.add(&mut t, n, &c)?;
+                    core::mem::swap(n, &mut t);
+                }
+            }
+            core::mem::swap(&mut st, &mut next);
+            if params.ark_last {
+                for (s, v) in st.iter_mut().zip(constants.iter()) {
+                    e.load(&mut c, v)?;
+                    e.add(&mut t, s, &c)?;
+                    core::mem::swap(s, &mut t);
+                }
+            }
+        }
+
+        for (out, s) in self.state.iter_mut().zip(st.iter()) {
+            e.store(out, s)?;
+        }
+        Ok(())
+    }
+}
+
+/// Number of message bits consumed by each step of Sinsemilla
+pub const SINSEMILLA_K: usize = 10;
+
+/// Maximum number of message bits of Sinsemilla
+pub const SINSEMILLA_MAX_BITS: usize = 253 * SINSEMILLA_K;
+
+/// Sinsemilla hash to Pallas of the `nbits` first bits of `msg`, bits being
+/// taken from the least significant bit of each byte. `q` is the point of
+/// the domain, and `s` the table of the points `S(j)` for `j` below
+/// `2^SINSEMILLA_K`: the app precomputes both and stores them in flash.
+/// Fails with `CxError::InvalidPoint` when the incomplete additions hit
+/// an exceptional case, which Orchard treats as a failure of the hash.
+pub fn sinsemilla_hash_to_point(
+    q: &PastaPoint,
+    s: &[PastaPoint],
+    msg: &[u8],
+    nbits: usize,
+) -> Result<PastaPoint, CxError> {
+    if nbits > SINSEMILLA_MAX_BITS || nbits > 8 * msg.len() {
+        return Err(CxError::InvalidParameterValue);
+    }
+    let arena = BnArena::lock(CX_BN_WORD_ALIGNEMENT as usize)?;
+    let mut e = Engine::<PastaFp>::new(&arena)?;
+    let mut sc = Scratch::new(&e)?;
+    let (mut acc, mut sum, mut point) = (Point::alloc(&e)?, Point::alloc(&e)?, Point::alloc(&e)?);
+    acc.load(&mut e, q, &mut sc)?;
+    let bit = |i: usize| match i < nbits {
+        true => ((msg[i / 8] >> (i % 8)) & 1) as usize,
+        false => 0,
+    };
+    for chunk in (0..nbits).step_by(SINSEMILLA_K) {
+        let m = (0..SINSEMILLA_K).fold(0, |m, b| m | bit(chunk + b) << b);
+        let entry = s.get(m).ok_or(CxError::InvalidParameterValue)?;
+        point.load(&mut e, entry, &mut sc)?;
+        // acc = (acc + S(m)) + acc
+        sum.copy(&acc)?;
+        sum.add_assign(&e, &point, &mut sc, true)?;
+        sum.add_assign(&e, &acc, &mut sc, true)?;
+        core::mem::swap(&mut acc, &mut sum);
+    }
+    let mut out = [0u8; 2 * FE_LEN];
+    acc.store(&mut e, &mut out, &mut sc)?;
+    Ok(out)
+}
+
+/// Sinsemilla hash, the `x` coordinate of [`sinsemilla_hash_to_point`]
+pub fn sinsemilla_hash(
+    q: &PastaPoint,
+    s: &[PastaPoint],
+    msg: &[u8],
+    nbits: usize,
+) -> Result<PastaFe, CxError> {
+    let p = sinsemilla_hash_to_point(q, s, msg, nbits)?;
+    let mut x = [0u8; FE_LEN];
+    x.copy_from_slice(&p[..FE_LEN]);
+    Ok(x)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const fn fe(v: u64) -> PastaFe {
+        let mut out = [0u8; FE_LEN];
+        let bytes = v.to_be_bytes();
+        let mut i = 0;
+        while i < 8 {
+            out[FE_LEN - 8 + i] = bytes[i];
+            i += 1;
+        }
+        out
+    }
+
+    const fn point(x: PastaFe, y: PastaFe) -> PastaPoint {
+        let mut out = [0u8; 2 * FE_LEN];
+        let mut i = 0;
+        while i < FE_LEN {
+            out[i] = x[i];
+            out[FE_LEN + i] = y[i];
+            i += 1;
+        }
+        out
+    }
+
+    const SK: PastaFe = [
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd,
+        0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab,
+        0xcd, 0xef,
+    ];
+
+    const PALLAS_PK: PastaPoint = point(
+        [
+            0x33, 0x2d, 0xb8, 0x93, 0xd5, 0xe0, 0x6f, 0xdc, 0x4a, 0x52, 0x8e, 0x8a, 0x44, 0x8b,
+            0x15, 0xf9, 0x62, 0x10, 0xcb, 0x51, 0x20, 0x14, 0x77, 0x2a, 0x11, 0x37, 0xda, 0xec,
+            0x98, 0xdd, 0x16, 0xd2,
+        ],
+        [
+            0x1b, 0xf5, 0xf2, 0xbf, 0x88, 0xfe, 0xd7, 0x2c, 0x8e, 0x0b, 0x6a, 0x21, 0x59, 0x38,
+            0xb9, 0x6b, 0x80, 0xf3, 0xc4, 0x6a, 0x3b, 0x2a, 0x4d, 0xed, 0xfe, 0xf2, 0x0e, 0xbc,
+            0x69, 0x92, 0xfa, 0xa3,
+        ],
+    );
+
+    const VESTA_PK: PastaPoint = point(
+        [
+            0x12, 0x0b, 0xc8, 0x34, 0x9c, 0xb1, 0xe4, 0x96, 0x67, 0x0f, 0xf5, 0x16, 0x15, 0x72,
+            0x50, 0xc1, 0x67, 0xe0, 0xa2, 0xc0, 0x65, 0x83, 0x22, 0xc4, 0x8f, 0x80, 0xa9, 0xb7,
+            0x26, 0x45, 0x16, 0x11,
+        ],
+        [
+            0x35, 0xa5, 0x58, 0xf5, 0xa5, 0x4f, 0xdb, 0x12, 0xa7, 0x1b, 0x17, 0xe2, 0xbc, 0xb4,
+            0x8e, 0x3b, 0xc6, 0x10, 0xe0, 0x41, 0x80, 0x51, 0xa6, 0xf2, 0x40, 0xe7, 0x93, 0x0b,
+            0x97, 0x8a, 0x1e, 0x26,
+        ],
+    );
+
+    #[test]
+    fn pasta_keys() {
+        assert_eq!(Pallas::public_key(&SK), Ok(PALLAS_PK));
+        assert_eq!(Vesta::public_key(&SK), Ok(VESTA_PK));
+        assert_eq!(Pallas::is_on_curve(&PALLAS_PK), Ok(true));
+        assert_eq!(Pallas::is_on_curve(&VESTA_PK), Ok(false));
+        assert_eq!(
+            Pallas::public_key(&PastaFq::MODULUS),
+            Err(CxError::InvalidParameterValue)
+        );
+
+        // 2 G + 3 G = 5 G, G + G = 2 G
+        let g = Pallas::GENERATOR;
+        let two = Pallas::scalar_mul(&fe(2), &g).map_err(|_| ())?;
+        let three = Pallas::scalar_mul(&fe(3), &g).map_err(|_| ())?;
+        assert_eq!(Pallas::add(&two, &three), Pallas::public_key(&fe(5)));
+        assert_eq!(Pallas::add(&g, &g), Ok(two));
+        assert_eq!(Pallas::add(&g, &[0; 64]), Ok(g));
+
+        let c = Pallas::compress(&PALLAS_PK);
+        assert_eq!(c[0], 0xd2);
+        assert_eq!(c[31], 0x33 | 0x80);
+        assert_eq!(Pallas::decompress(&c), Ok(PALLAS_PK));
+        assert_eq!(Vesta::decompress(&Vesta::compress(&VESTA_PK)), Ok(VESTA_PK));
+    }
+
+    // Toy instance, checked against a reference implementation
+    const ROUND_CONSTANTS: [[PastaFe; 3]; 7] = {
+        let mut rc = [[[0; FE_LEN]; 3]; 7];
+        let mut i = 0;
+        while i < 21 {
+            rc[i / 3][i % 3] = fe(i as u64 + 1);
+            i += 1;
+        }
+        rc
+    };
+
+    const TOY: PoseidonParams = PoseidonParams {
+        full_rounds: 4,
+        partial_rounds: 3,
+        alpha: 5,
+        round_constants: &ROUND_CONSTANTS,
+        mds: [
+            [fe(2), fe(1), fe(1)],
+            [fe(1), fe(2), fe(1)],
+            [fe(1), fe(1), fe(3)],
+        ],
+        ark_last: false,
+    };
+
+    const TOY_ARK_LAST: PoseidonParams = PoseidonParams {
+        ark_last: true,
+        ..TOY
+    };
+
+    #[test]
+    fn poseidon() {
+        let inputs = [fe(1), fe(2), fe(3)];
+        // Constant length domain, 2^64 * 3
+        let mut capacity = [0u8; FE_LEN];
+        capacity[23] = 3;
+        assert_eq!(
+            Poseidon::<PastaFp>::hash(&TOY, &capacity, &inputs),
+            Ok([
+                0x1c, 0xbd, 0x11, 0x84, 0x73, 0xd8, 0xca, 0x2a, 0x32, 0xe5, 0x53, 0xe4, 0x46, 0x0d,
+                0x89, 0xdd, 0xc0, 0x7e, 0xfa, 0xcb, 0xeb, 0x4f, 0x90, 0xe5, 0x47, 0xa9, 0xee, 0xd4,
+                0xf1, 0xcf, 0x5b, 0xbc,
+            ])
+        );
+        assert_eq!(
+            Poseidon::<PastaFp>::hash(&TOY_ARK_LAST, &[0; FE_LEN], &inputs),
+            Ok([
+                0x1b, 0x14, 0xb3, 0xf0, 0x8a, 0xf1, 0xc2, 0x0f, 0x13, 0x23, 0xeb, 0xc2, 0xca, 0x81,
+                0xe1, 0xfd, 0x5e, 0xcf, 0x64, 0x1a, 0x2f, 0xe9, 0x5a, 0x18, 0x86, 0xa0, 0xc7, 0x8c,
+                0xef, 0xad, 0x86, 0x3a,
+            ])
+        );
+        let mut sponge = Poseidon::<PastaFp>::new(&TOY, &capacity);
+        assert_eq!(
+            sponge.absorb(&PastaFp::MODULUS),
+            Err(CxError::InvalidParameterValue)
+        );
+    }
+
+    #[test]
+    fn sinsemilla() {
+        // S(j) = (j + 2) G and Q = 7 G, on a table cut to 4 points
+        let mut s = [[0u8; 64]; 4];
+        for (j, p) in s.iter_mut().enumerate() {
+            *p = Pallas::public_key(&fe(j as u64 + 2)).map_err(|_| ())?;
+        }
+        let q = Pallas::public_key(&fe(7)).map_err(|_| ())?;
+        // Chunks 1 and 3
+        let msg = [0x01, 0x0c, 0x00];
+        assert_eq!(
+            sinsemilla_hash(&q, &s, &msg, 20),
+            Ok([
+                0x29, 0x87, 0xb3, 0x84, 0x62, 0xa9, 0xbf, 0xea, 0xb3, 0x7f, 0x06, 0xd1, 0x31, 0x42,
+                0x9e, 0x1e, 0x5e, 0xdc, 0x62, 0xa3, 0x17, 0x34, 0x70, 0x40, 0x33, 0xe2, 0x94, 0x6c,
+                0xf9, 0x9a, 0x23, 0xa5,
+            ])
+        );
+        assert_eq!(
+            sinsemilla_hash(&q, &s, &[0xff, 0x03], 10),
+            Err(CxError::InvalidParameterValue)
+        );
+    }
+}
@@ -0,0 +1,351 @@
+//! Derivation path restrictions
+//!
+//! A [`PathPolicy`] holds the path prefixes an app may derive keys from,
+//! usually the derivation path restrictions of its install parameters, as a
+//! trie. Prefixes sharing their first components, such as `44'/60'/...` and
+//! `44'/1'/...`, share their nodes, so a path is checked by following it down
+//! the trie once rather than comparing it with each prefix in turn.
+//!
+//! [`PathPolicy::parse`] decodes a path in the usual APDU encoding, one byte
+//! for the number of components followed by the components, big-endian,
+//! into a `[u32; N]` and checks it in the same pass:
+//!
+//! ```
+//! let policy = PathPolicy::<16>::from_install_params(&params)?;
+//! loop {
+//!     let data = comm.get_data()?;
+//!     let mut path = [0u32; 10];
+//!     let len = policy.parse(data, &mut path).map_err(|_| StatusWords::BadP1P2)?;
+//!     let key = Secp256k1::derive_from_path(&path[..len]);
+//!     // ...
+//! }
+//! ```
+//!
+//! Without a policy, [`Bip32Path::from_apdu`] decodes and validates a path
+//! in place, and the result is passed as is to the derivation functions:
+//!
+//! ```
+//! // m/44'/coin'/account' at least
+//! let path = Bip32Path::from_apdu(data, 3).map_err(|_| StatusWords::BadP1P2)?;
+//! let sk = Secp256k1::derive_from_path(&path);
+//! let payload = &data[path.encoded_len()..];
+//! ```
+
+use crate::install_params::InstallParams;
+
+/// Maximum number of components of a [`Bip32Path`], as in the C SDK
+pub const MAX_BIP32_PATH: usize = 10;
+
+const HARDENED: u32 = 0x8000_0000;
+
+const NONE: u8 = u8::MAX;
+
+#[derive(Copy, Clone)]
+struct Node {
+    component: u32,
+    /// First node of the next component, or `NONE`
+    child: u8,
+    /// Next node of the same component, or `NONE`
+    sibling: u8,
+    /// Whether a prefix ends at this node
+    end: bool,
+}
+
+#[derive(Debug, PartialEq, Eq)]
+pub enum PathError {
+    /// The path encoding is truncated, empty or has more components than
+    /// the output can hold
+    Malformed,
+    /// The path does not start with any of the prefixes
+    NotAllowed,
+    /// More than the `N` nodes of the policy are needed
+    PolicyFull,
+    /// One of the components expected hardened is not
+    NotHardened,
+}
+
+/// Derivation path of up to [`MAX_BIP32_PATH`] components, held inline.
+/// Dereferences to the `&[u32]` expected by [`bip32_derive`](super::bip32_derive),
+/// [`SeedDerive::derive_from_path`](super::SeedDerive::derive_from_path) or
+/// [`PublicKeyCache`](super::PublicKeyCache).
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Bip32Path {
+    components: [u32; MAX_BIP32_PATH],
+    len: u8,
+}
+
+impl Bip32Path {
+    /// Decode the path at the start of `data`, one byte for the number of
+    /// components followed by the components, big-endian, checking in the
+    /// same pass that there are between 1 and [`MAX_BIP32_PATH`] of them
+    /// and that the first `hardened` ones are hardened. Bytes after the path
+    /// are ignored, see [`Bip32Path::encoded_len`].
+    pub fn from_apdu(data: &[u8], hardened: usize) -> Result<Self, PathError> {
+        let (&len, bytes) = data.split_first().ok_or(PathError::Malformed)?;
+        let len = len as usize;
+        if len == 0 || len > MAX_BIP32_PATH || bytes.len() < len * 4 || hardened > len {
+            return Err(PathError::Malformed);
+        }
+        let mut path = Bip32Path {
+            components: [0; MAX_BIP32_PATH],
+            len: len as u8,
+        };
+        // Hardened bit missing from one of the first components
+        let mut unhardened = 0;
+        for (i, (out, c)) in path
+            .components
+            .iter_mut()
+            .zip(bytes.chunks_exact(4))
+            .take(len)
+            .enumerate()
+        {
+            *out = u32::from_be_bytes([c[0], c[1], c[2], c[3]]);
+            if i < hardened {
+                unhardened |= !*out & HARDENED;
+            }
+        }
+        match unhardened {
+            0 => Ok(path),
+            _ => Err(PathError::NotHardened),
+        }
+    }
+
+    /// Number of bytes of the APDU encoding of the path
+    pub fn encoded_len(&self) -> usize {
+        1 + 4 * self.len as usize
+    }
+}
+
+impl core::ops::Deref for Bip32Path {
+    type Target = [u32];
+
+    fn deref(&self) -> &[u32] {
+        &self.components[..self.len as usize]
+    }
+}
+
+/// Path prefixes allowed, stored in a trie of up to `N` nodes, one node per
+/// component not shared with another prefix
+pub struct PathPolicy<const N: usize> {
+    nodes: [Node; N],
+    count: u8,
+    /// Whether an empty prefix has been added
+    any_path: bool,
+}
+
+impl<const N: usize> Default for PathPolicy<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const N: usize> PathPolicy<N> {
+    /// Policy allowing any path, until a prefix is added
+    pub const fn new() -> Self {
+        assert!(N < NONE as usize);
+        PathPolicy {
+            nodes: [Node {
+                component: 0,
+                child: NONE,
+                sibling: NONE,
+                end: false,
+            }; N],
+            count: 0,
+            any_path: false,
+        }
+    }
+
+    /// Policy of the derivation path restrictions of the install parameters,
+    /// allowing any path if there are none
+    pub fn from_install_params(params: &InstallParams) -> Result<Self, PathError> {
+        let mut policy = Self::new();
+        for prefix in params.derivation_paths().into_iter().flatten() {
+            policy.add(prefix.components())?;
+        }
+        Ok(policy)
+    }
+
+    /// Allow the paths starting with `prefix`. An empty prefix allows any
+    /// path.
+    pub fn add(&mut self, prefix: impl IntoIterator<Item = u32>) -> Result<(), PathError> {
+        let mut prefix = prefix.into_iter().peekable();
+        if prefix.peek().is_none() {
+            self.any_path = true;
+            return Ok(());
+        }
+        // Link of the parent to the nodes of the current component
+        let mut parent: Option<usize> = None;
+        for component in prefix {
+            let first = match parent {
+                None if self.count == 0 => NONE,
+                None => 0,
+                Some(p) => self.nodes[p].child,
+            };
+            let mut i = first;
+            while i != NONE && self.nodes[i as usize].component != component {
+                i = self.nodes[i as usize].sibling;
+            }
+            if i == NONE {
+                if self.count as usize == N {
+                    return Err(PathError::PolicyFull);
+                }
+                i = self.count;
+                self.count += 1;
+                self.nodes[i as usize] = Node {
+                    component,
+                    child: NONE,
+                    sibling: NONE,
+                    end: false,
+                };
+                // Append to the siblings, the first node of the first
+                // component being the root of the trie
+                if first != NONE {
+                    let mut last = first as usize;
+                    while self.nodes[last].sibling != NONE {
+                        last = self.nodes[last].sibling as usize;
+                    }
+                    self.nodes[last].sibling = i;
+                } else if let Some(p) = parent {
+                    self.nodes[p].child = i;
+                }
+            }
+            parent = Some(i as usize);
+        }
+        if let Some(p) = parent {
+            self.nodes[p].end = true;
+        }
+        Ok(())
+    }
+
+    /// Whether `path` starts with one of the prefixes
+    pub fn allows(&self, path: &[u32]) -> bool {
+        let mut matcher = self.matcher();
+        path.iter().any(|&c| matcher.push(self, c)) || matcher.allowed
+    }
+
+    /// Decode the path at the start of `data` into `path`, checking it
+    /// against the prefixes. Returns the number of components.
+    pub fn parse<const M: usize>(
+        &self,
+        data: &[u8],
+        path: &mut [u32; M],
+    ) -> Result<usize, PathError> {
+        let (&len, components) = data.split_first().ok_or(PathError::Malformed)?;
+        let len = len as usize;
+        if len == 0 || len > M || components.len() < len * 4 {
+            return Err(PathError::Malformed);
+        }
+        let mut matcher = self.matcher();
+        for (out, c) in path.iter_mut().zip(components.chunks_exact(4)).take(len) {
+            *out = u32::from_be_bytes([c[0], c[1], c[2], c[3]]);
+            matcher.push(self, *out);
+        }
+        match matcher.allowed {
+            true => Ok(len),
+            false => Err(PathError::NotAllowed),
+        }
+    }
+
+    fn matcher(&self) -> Matcher {
+        Matcher {
+            next: if self.count == 0 { NONE } else { 0 },
+            allowed: self.any_path || self.count == 0,
+        }
+    }
+}
+
+/// Position in the trie of the components seen so far
+struct Matcher {
+    /// Nodes of the next component, `NONE` once no prefix matches
+    next: u8,
+    /// Whether a prefix has been matched
+    allowed: bool,
+}
+
+impl Matcher {
+    /// Follow `component`. Returns whether the path is allowed, whatever the
+    /// components after this one are.
+    fn push<const N: usize>(&mut self, policy: &PathPolicy<N>, component: u32) -> bool {
+        let mut i = self.next;
+        while !self.allowed && i != NONE {
+            let node = &policy.nodes[i as usize];
+            if node.component == component {
+                self.allowed = node.end;
+                self.next = node.child;
+                return self.allowed;
+            }
+            i = node.sibling;
+        }
+        self.next = NONE;
+        self.allowed
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::make_bip32_path;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn policy() {
+        let mut policy = PathPolicy::<4>::new();
+        assert_eq!(policy.allows(&[1, 2]), true);
+        policy
+            .add(make_bip32_path::<2>(b"m/44'/60'"))
+            .map_err(|_| ())?;
+        policy
+            .add(make_bip32_path::<3>(b"m/44'/1'/0'"))
+            .map_err(|_| ())?;
+        assert_eq!(policy.count, 4);
+        assert_eq!(
+            policy.allows(&make_bip32_path::<5>(b"m/44'/60'/0'/0/1")),
+            true
+        );
+        assert_eq!(policy.allows(&make_bip32_path::<3>(b"m/44'/1'/0'")), true);
+        assert_eq!(policy.allows(&make_bip32_path::<2>(b"m/44'/1'")), false);
+        assert_eq!(policy.allows(&make_bip32_path::<2>(b"m/44'/0'")), false);
+        assert_eq!(
+            policy.add(make_bip32_path::<1>(b"m/49'")),
+            Err(PathError::PolicyFull)
+        );
+
+        let mut path = [0u32; 3];
+        let data = [2, 0x80, 0, 0, 44, 0x80, 0, 0, 60, 0xff];
+        assert_eq!(policy.parse(&data, &mut path), Ok(2));
+        assert_eq!(path[1], 0x8000_003c);
+        assert_eq!(
+            policy.parse(&[2, 0x80, 0, 0, 44, 0x80, 0, 0, 1], &mut path),
+            Err(PathError::NotAllowed)
+        );
+        assert_eq!(
+            policy.parse(&data[..8], &mut path),
+            Err(PathError::Malformed)
+        );
+        assert_eq!(policy.parse(&[4], &mut path), Err(PathError::Malformed));
+    }
+
+    #[test]
+    fn apdu_path() {
+        let data = [3, 0x80, 0, 0, 44, 0x80, 0, 0, 60, 0, 0, 0, 1, 0xab];
+        let path = Bip32Path::from_apdu(&data, 2).map_err(|_| ())?;
+        assert_eq!(&path[..], &make_bip32_path::<3>(b"m/44'/60'/1")[..]);
+        assert_eq!(path.encoded_len(), 13);
+        assert_eq!(Bip32Path::from_apdu(&data, 3), Err(PathError::NotHardened));
+        assert_eq!(
+            Bip32Path::from_apdu(&data[..12], 0),
+            Err(PathError::Malformed)
+        );
+        assert_eq!(Bip32Path::from_apdu(&[0], 0), Err(PathError::Malformed));
+        let mut deep = [0u8; 1 + 4 * (MAX_BIP32_PATH + 1)];
+        deep[0] = MAX_BIP32_PATH as u8 + 1;
+        assert_eq!(Bip32Path::from_apdu(&deep, 0), Err(PathError::Malformed));
+        deep[0] = MAX_BIP32_PATH as u8;
+        assert_eq!(
+            Bip32Path::from_apdu(&deep, 0).map(|p| p.len()),
+            Ok(MAX_BIP32_PATH)
+        );
+    }
+}
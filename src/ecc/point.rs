@@ -0,0 +1,321 @@
+//! Elliptic curve points held by the cryptographic engine
+//!
+//! An [`EcPoint`] lives in a [`BnArena`], like the big numbers its
+//! coordinates are made of, so that chains of point operations run with a
+//! single lock of the engine.
+//!
+//! Protocols multiplying the same base points over and over (Pedersen
+//! commitments, Stark hashes) can precompute a [`FixedBaseTable`] once for
+//! each base, kept in RAM or built ahead of time into a `const` in flash,
+//! instead of running a full double-and-add for each multiplication.
+
+use super::{CurvesId, CxError};
+use crate::bindings::*;
+use crate::bn::BnArena;
+use core::marker::PhantomData;
+
+fn check(err: cx_err_t) -> Result<(), CxError> {
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(())
+    }
+}
+
+/// Point of a curve, allocated in a [`BnArena`] which it cannot outlive.
+/// Operations write their result into `self`.
+pub struct EcPoint<'a> {
+    p: cx_ecpoint_t,
+    _arena: PhantomData<&'a BnArena>,
+}
+
+impl Drop for EcPoint<'_> {
+    fn drop(&mut self) {
+        unsafe { cx_ecpoint_destroy(&mut self.p) };
+    }
+}
+
+impl<'a> EcPoint<'a> {
+    /// Allocate a point of `curve`, with all its coordinates set to zero
+    pub fn new(_arena: &'a BnArena, curve: CurvesId) -> Result<Self, CxError> {
+        let mut p = cx_ecpoint_t::default();
+        check(unsafe { cx_ecpoint_alloc(&mut p, curve as cx_curve_t) })?;
+        Ok(EcPoint {
+            p,
+            _arena: PhantomData,
+        })
+    }
+
+    /// Generator of `curve`
+    pub fn generator(arena: &'a BnArena, curve: CurvesId) -> Result<Self, CxError> {
+        let mut g = Self::new(arena, curve)?;
+        check(unsafe { cx_ecdomain_generator_bn(curve as cx_curve_t, &mut g.p) })?;
+        Ok(g)
+    }
+
+    /// Point of affine coordinates (`x`, `y`), big endian
+    pub fn from_coordinates(
+        arena: &'a BnArena,
+        curve: CurvesId,
+        x: &[u8],
+        y: &[u8],
+    ) -> Result<Self, CxError> {
+        let mut p = Self::new(arena, curve)?;
+        p.set_coordinates(x, y)?;
+        Ok(p)
+    }
+
+    pub fn set_coordinates(&mut self, x: &[u8], y: &[u8]) -> Result<(), CxError> {
+        check(unsafe {
+            cx_ecpoint_init(
+                &mut self.p,
+                x.as_ptr(),
+                x.len() as size_t,
+                y.as_ptr(),
+                y.len() as size_t,
+            )
+        })
+    }
+
+    /// Export the affine coordinates as big endian into `x` and `y`, which
+    /// hold at least the domain length
+    pub fn export(&self, x: &mut [u8], y: &mut [u8]) -> Result<(), CxError> {
+        check(unsafe {
+            cx_ecpoint_export(
+                &self.p,
+                x.as_mut_ptr(),
+                x.len() as size_t,
+                y.as_mut_ptr(),
+                y.len() as size_t,
+            )
+        })
+    }
+
+    /// Export the compressed form of the point into `x`, returning the
+    /// parity of `y`
+    pub fn compress(&self, x: &mut [u8]) -> Result<u32, CxError> {
+        let mut sign = 0;
+        check(unsafe {
+            cx_ecpoint_compress(&self.p, x.as_mut_ptr(), x.len() as size_t, &mut sign)
+        })?;
+        Ok(sign)
+    }
+
+    /// Recover the point from its compressed form: the `x` coordinate, big
+    /// endian, and the parity `sign` of `y`
+    pub fn decompress(&mut self, x: &[u8], sign: u32) -> Result<(), CxError> {
+        check(unsafe { cx_ecpoint_decompress(&mut self.p, x.as_ptr(), x.len() as size_t, sign) })
+    }
+
+    pub fn copy_from(&mut self, p: &EcPoint) -> Result<(), CxError> {
+        if self.p.curve != p.p.curve {
+            return Err(CxError::InvalidCurve);
+        }
+        unsafe {
+            check(cx_bn_copy(self.p.x, p.p.x))?;
+            check(cx_bn_copy(self.p.y, p.p.y))?;
+            check(cx_bn_copy(self.p.z, p.p.z))
+        }
+    }
+
+    /// `self = p + q`. Neither `p` nor `q` can be the point at infinity.
+    pub fn add(&mut self, p: &EcPoint, q: &EcPoint) -> Result<(), CxError> {
+        check(unsafe { cx_ecpoint_add(&mut self.p, &p.p, &q.p) })
+    }
+
+    pub fn neg(&mut self) -> Result<(), CxError> {
+        check(unsafe { cx_ecpoint_neg(&mut self.p) })
+    }
+
+    /// `self = k * self`, with side-channel protections. `k` is big endian
+    /// and as long as the domain.
+    pub fn scalarmul(&mut self, k: &[u8]) -> Result<(), CxError> {
+        check(unsafe { cx_ecpoint_rnd_fixed_scalarmul(&mut self.p, k.as_ptr(), k.len() as size_t) })
+    }
+
+    /// `self = k * self`, without side-channel protections: `k` must not be
+    /// secret.
+    pub fn scalarmul_public(&mut self, k: &[u8]) -> Result<(), CxError> {
+        check(unsafe { cx_ecpoint_scalarmul(&mut self.p, k.as_ptr(), k.len() as size_t) })
+    }
+
+    /// `self = k * p + r * q`, for public scalars (signature verification)
+    pub fn double_scalarmul(
+        &mut self,
+        p: &mut EcPoint,
+        q: &mut EcPoint,
+        k: &[u8],
+        r: &[u8],
+    ) -> Result<(), CxError> {
+        check(unsafe {
+            cx_ecpoint_double_scalarmul(
+                &mut self.p,
+                &mut p.p,
+                &mut q.p,
+                k.as_ptr(),
+                k.len() as size_t,
+                r.as_ptr(),
+                r.len() as size_t,
+            )
+        })
+    }
+
+    pub fn equals(&self, q: &EcPoint) -> Result<bool, CxError> {
+        let mut equal = false;
+        check(unsafe { cx_ecpoint_cmp(&self.p, &q.p, &mut equal) })?;
+        Ok(equal)
+    }
+
+    pub fn is_on_curve(&self) -> Result<bool, CxError> {
+        let mut on_curve = false;
+        check(unsafe { cx_ecpoint_is_on_curve(&self.p, &mut on_curve) })?;
+        Ok(on_curve)
+    }
+
+    pub fn is_at_infinity(&self) -> Result<bool, CxError> {
+        let mut infinity = false;
+        check(unsafe { cx_ecpoint_is_at_infinity(&self.p, &mut infinity) })?;
+        Ok(infinity)
+    }
+}
+
+/// Number of teeth of the comb: the scalar is processed 4 bits at a time
+const COMB_TEETH: usize = 4;
+/// Number of precomputed points, all the non-zero combinations of the teeth
+pub const COMB_POINTS: usize = (1 << COMB_TEETH) - 1;
+
+/// Precomputed multiples of a fixed base point `B`, for a curve whose
+/// domain is `L` bytes long, to compute `k * B` with a comb method.
+///
+/// The `8 * L` bit scalar is split into 4 teeth of `d = 2 * L` bits. Entry
+/// `j - 1` holds `sum(2^(i * d) * B)` over the bits `i` set in `j`, so that
+/// `k * B` takes `d` doublings and at most `d` additions, against `8 * L`
+/// doublings for double-and-add. The table takes `15 * 2 * L` bytes: 960
+/// bytes for a 256-bit curve.
+///
+/// Multiplications are not protected against side channels, and are
+/// meant for public scalars (hashing, commitments to public values).
+/// Secret scalars must go through [`EcPoint::scalarmul`].
+pub struct FixedBaseTable<const L: usize> {
+    curve: CurvesId,
+    x: [[u8; L]; COMB_POINTS],
+    y: [[u8; L]; COMB_POINTS],
+}
+
+impl<const L: usize> FixedBaseTable<L> {
+    /// Table from the affine coordinates of its points, as returned by
+    /// [`FixedBaseTable::points`], so it can be stored in flash
+    pub const fn from_points(
+        curve: CurvesId,
+        x: [[u8; L]; COMB_POINTS],
+        y: [[u8; L]; COMB_POINTS],
+    ) -> Self {
+        FixedBaseTable { curve, x, y }
+    }
+
+    /// Affine coordinates of the precomputed points
+    pub fn points(&self) -> (&[[u8; L]; COMB_POINTS], &[[u8; L]; COMB_POINTS]) {
+        (&self.x, &self.y)
+    }
+
+    /// Precompute the table of `base`
+    pub fn precompute(arena: &BnArena, curve: CurvesId, base: &EcPoint) -> Result<Self, CxError> {
+        let mut table = FixedBaseTable {
+            curve,
+            x: [[0u8; L]; COMB_POINTS],
+            y: [[0u8; L]; COMB_POINTS],
+        };
+        let d = 2 * L;
+        let mut p = EcPoint::new(arena, curve)?;
+        let mut sum = EcPoint::new(arena, curve)?;
+        let mut r = EcPoint::new(arena, curve)?;
+        // Single teeth, 2^(i * d) * base
+        for i in 0..COMB_TEETH {
+            let mut k = [0u8; L];
+            let bit = i * d;
+            k[L - 1 - bit / 8] = 1 << (bit % 8);
+            p.copy_from(base)?;
+            p.scalarmul_public(&k)?;
+            let j = (1 << i) - 1;
+            p.export(&mut table.x[j], &mut table.y[j])?;
+        }
+        // Combinations, adding the highest tooth to the rest
+        for j in 1..=COMB_POINTS {
+            let high = 1 << (usize::BITS - 1 - j.leading_zeros());
+            if j == high {
+                continue;
+            }
+            p.set_coordinates(&table.x[high - 1], &table.y[high - 1])?;
+            let rest = j - high;
+            sum.set_coordinates(&table.x[rest - 1], &table.y[rest - 1])?;
+            r.add(&p, &sum)?;
+            r.export(&mut table.x[j - 1], &mut table.y[j - 1])?;
+        }
+        Ok(table)
+    }
+
+    /// `r = k * B`, `k` being a big endian public scalar
+    pub fn mul<'a>(
+        &self,
+        arena: &'a BnArena,
+        r: &mut EcPoint<'a>,
+        k: &[u8; L],
+    ) -> Result<(), CxError> {
+        let d = 2 * L;
+        let bit = |pos: usize| (k[L - 1 - pos / 8] >> (pos % 8)) & 1;
+        let mut tooth = EcPoint::new(arena, self.curve)?;
+        let mut tmp = EcPoint::new(arena, self.curve)?;
+        // r holds the point at infinity until the first non-zero column
+        let mut infinity = true;
+        for col in (0..d).rev() {
+            if !infinity {
+                tmp.add(r, r)?;
+                core::mem::swap(r, &mut tmp);
+            }
+            let j = (0..COMB_TEETH).fold(0, |j, i| j | (bit(i * d + col) as usize) << i);
+            if j == 0 {
+                continue;
+            }
+            if infinity {
+                r.set_coordinates(&self.x[j - 1], &self.y[j - 1])?;
+                infinity = false;
+            } else {
+                tooth.set_coordinates(&self.x[j - 1], &self.y[j - 1])?;
+                tmp.add(r, &tooth)?;
+                core::mem::swap(r, &mut tmp);
+            }
+        }
+        if infinity {
+            // k = 0
+            return Err(CxError::PointAtInfinity);
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn fixed_base() {
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let g = EcPoint::generator(&arena, CurvesId::Secp256k1).map_err(|_| ())?;
+        let table =
+            FixedBaseTable::<32>::precompute(&arena, CurvesId::Secp256k1, &g).map_err(|_| ())?;
+
+        let mut k = [0u8; 32];
+        k.iter_mut()
+            .enumerate()
+            .for_each(|(i, b)| *b = (i as u8).wrapping_mul(37));
+        let mut r = EcPoint::new(&arena, CurvesId::Secp256k1).map_err(|_| ())?;
+        table.mul(&arena, &mut r, &k).map_err(|_| ())?;
+
+        let mut expected = EcPoint::generator(&arena, CurvesId::Secp256k1).map_err(|_| ())?;
+        expected.scalarmul(&k).map_err(|_| ())?;
+        assert_eq!(r.equals(&expected).map_err(|_| ())?, true);
+    }
+}
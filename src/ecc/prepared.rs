@@ -0,0 +1,229 @@
+//! Public keys verified against many times
+//!
+//! Apps check the metadata signed by a few trusted keys (token
+//! information, plugin descriptors, domain names) over and over. A
+//! [`PreparedPublicKey`] decodes and validates such a key once, and can
+//! keep a [`FixedBaseTable`] of its point, so that each verification runs
+//! two comb multiplications with the table of the generator instead of a
+//! full double scalar multiplication:
+//!
+//! ```
+//! let arena = BnArena::lock(32)?;
+//! let g = EcPoint::generator(&arena, CurvesId::Secp256r1)?;
+//! let g_table = FixedBaseTable::<32>::precompute(&arena, CurvesId::Secp256r1, &g)?;
+//! drop(arena);
+//!
+//! let signer = PreparedPublicKey::<32>::new(CurvesId::Secp256r1, &TRUSTED_KEY)?.with_table()?;
+//! if !signer.verify_with(&g_table, (&sig, sig.len() as u32), &hash)? {
+//!     return Err(StatusWords::BadLen);
+//! }
+//! ```
+//!
+//! The table of the generator can be shared by all the keys of a curve,
+//! or built ahead of time into flash (see [`FixedBaseTable::from_points`]).
+
+use super::batch::{in_range, parse_der};
+use super::{CurvesId, CxError, EcPoint, FixedBaseTable};
+use crate::bindings::*;
+use crate::bn::BnArena;
+use core::cmp::Ordering;
+
+/// Validated public key of a Weierstrass curve whose domain is `L` bytes
+/// long, for ECDSA verifications
+pub struct PreparedPublicKey<const L: usize> {
+    curve: CurvesId,
+    x: [u8; L],
+    y: [u8; L],
+    table: Option<FixedBaseTable<L>>,
+}
+
+impl<const L: usize> PreparedPublicKey<L> {
+    /// Decode the SEC1 public key `key` of `curve`, compressed `02|03 || x`
+    /// or not `04 || x || y`, and check that it is a point of the curve
+    pub fn new(curve: CurvesId, key: &[u8]) -> Result<Self, CxError> {
+        let arena = BnArena::lock(L)?;
+        let mut p = EcPoint::new(&arena, curve)?;
+        match key {
+            [0x02 | 0x03, x @ ..] if x.len() == L => p.decompress(x, (key[0] & 1) as u32)?,
+            [0x04, xy @ ..] if xy.len() == 2 * L => p.set_coordinates(&xy[..L], &xy[L..])?,
+            _ => return Err(CxError::InvalidParameterSize),
+        }
+        if p.is_at_infinity()? || !p.is_on_curve()? {
+            return Err(CxError::InvalidPoint);
+        }
+        let mut prepared = PreparedPublicKey {
+            curve,
+            x: [0; L],
+            y: [0; L],
+            table: None,
+        };
+        p.export(&mut prepared.x, &mut prepared.y)?;
+        Ok(prepared)
+    }
+
+    /// Precompute the comb table of the point, 30 * `L` bytes, for
+    /// [`PreparedPublicKey::verify_with`]
+    pub fn with_table(mut self) -> Result<Self, CxError> {
+        let arena = BnArena::lock(L)?;
+        let q = EcPoint::from_coordinates(&arena, self.curve, &self.x, &self.y)?;
+        self.table = Some(FixedBaseTable::precompute(&arena, self.curve, &q)?);
+        Ok(self)
+    }
+
+    /// Uncompressed SEC1 form `04 || x || y` of the key, in `out` of
+    /// `2 * L + 1` bytes
+    pub fn export(&self, out: &mut [u8]) -> Result<(), CxError> {
+        if out.len() != 2 * L + 1 {
+            return Err(CxError::InvalidParameterSize);
+        }
+        out[0] = 0x04;
+        out[1..L + 1].copy_from_slice(&self.x);
+        out[L + 1..].copy_from_slice(&self.y);
+        Ok(())
+    }
+
+    /// Verify the ECDSA `signature` (DER, length) of `hash`, with a double
+    /// scalar multiplication
+    pub fn verify(&self, signature: (&[u8], u32), hash: &[u8]) -> Result<bool, CxError> {
+        self.check(None, signature, hash)
+    }
+
+    /// Same as [`PreparedPublicKey::verify`], multiplying the generator with
+    /// its table `g_table` and the key with its own, when it has been
+    /// computed with [`PreparedPublicKey::with_table`]
+    pub fn verify_with(
+        &self,
+        g_table: &FixedBaseTable<L>,
+        signature: (&[u8], u32),
+        hash: &[u8],
+    ) -> Result<bool, CxError> {
+        match &self.table {
+            Some(q_table) => self.check(Some((g_table, q_table)), signature, hash),
+            None => self.check(None, signature, hash),
+        }
+    }
+
+    fn check(
+        &self,
+        tables: Option<(&FixedBaseTable<L>, &FixedBaseTable<L>)>,
+        signature: (&[u8], u32),
+        hash: &[u8],
+    ) -> Result<bool, CxError> {
+        let sig = &signature.0[..(signature.1 as usize).min(signature.0.len())];
+        let Some((r_bytes, s_bytes)) = parse_der(sig) else {
+            return Ok(false);
+        };
+        if r_bytes.len() > L || s_bytes.len() > L {
+            return Ok(false);
+        }
+
+        let arena = BnArena::lock(L)?;
+        let n = arena.alloc(L)?;
+        let err = unsafe {
+            cx_ecdomain_parameter_bn(self.curve as cx_curve_t, CX_CURVE_PARAM_Order, n.handle())
+        };
+        if err != CX_OK {
+            return Err(err.into());
+        }
+        let r = arena.alloc_init(L, r_bytes)?;
+        let s = arena.alloc_init(L, s_bytes)?;
+        if !in_range(&r, &n)? || !in_range(&s, &n)? {
+            return Ok(false);
+        }
+        // e is the leftmost bytes of the hash, reduced
+        let tmp = arena.alloc_init(L, &hash[..hash.len().min(L)])?;
+        let mut e = arena.alloc(L)?;
+        e.reduce(&tmp, &n)?;
+        // u1 = e / s, u2 = r / s
+        let mut w = arena.alloc(L)?;
+        w.mod_invert_nprime(&s, &n)?;
+        let mut u1 = arena.alloc(L)?;
+        let mut u2 = arena.alloc(L)?;
+        u1.mod_mul(&e, &w, &n)?;
+        u2.mod_mul(&r, &w, &n)?;
+        let (mut k1, mut k2) = ([0u8; L], [0u8; L]);
+        u1.export(&mut k1)?;
+        u2.export(&mut k2)?;
+
+        let mut sum = EcPoint::new(&arena, self.curve)?;
+        let res = match tables {
+            Some((g_table, q_table)) => {
+                let mut a = EcPoint::new(&arena, self.curve)?;
+                let mut b = EcPoint::new(&arena, self.curve)?;
+                // A zero scalar gives the point at infinity, which cannot be
+                // added
+                match (
+                    g_table.mul(&arena, &mut a, &k1),
+                    q_table.mul(&arena, &mut b, &k2),
+                ) {
+                    (Ok(()), Ok(())) => sum.add(&a, &b),
+                    (Ok(()), Err(CxError::PointAtInfinity)) => sum.copy_from(&a),
+                    (Err(CxError::PointAtInfinity), Ok(())) => sum.copy_from(&b),
+                    (Err(err), _) | (_, Err(err)) => Err(err),
+                }
+            }
+            None => {
+                let mut g = EcPoint::generator(&arena, self.curve)?;
+                let mut q = EcPoint::from_coordinates(&arena, self.curve, &self.x, &self.y)?;
+                sum.double_scalarmul(&mut g, &mut q, &k1, &k2)
+            }
+        };
+        match res {
+            Ok(()) => (),
+            Err(CxError::PointAtInfinity) => return Ok(false),
+            Err(err) => return Err(err),
+        }
+        if sum.is_at_infinity()? {
+            return Ok(false);
+        }
+        // The x coordinate of u1 * G + u2 * Q must be r, mod n
+        sum.export(&mut k1, &mut k2)?;
+        let x = arena.alloc_init(L, &k1)?;
+        e.reduce(&x, &n)?;
+        Ok(e.compare(&r)? == Ordering::Equal)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, Secp256r1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PATH: [u32; 5] = make_bip32_path(b"m/44'/535348'/0'/0/2");
+
+    #[test]
+    fn prepared_verify() {
+        let hash = [0x37u8; 32];
+        let sk = Secp256r1::derive_from_path(&PATH);
+        let pk = sk.public_key().map_err(|_| ())?;
+        let (sig, len, _) = sk.deterministic_sign(&hash).map_err(|_| ())?;
+
+        let key =
+            PreparedPublicKey::<32>::new(CurvesId::Secp256r1, &pk.compressed()).map_err(|_| ())?;
+        let mut uncompressed = [0u8; 65];
+        key.export(&mut uncompressed).map_err(|_| ())?;
+        assert_eq!(&uncompressed[..], pk.as_ref());
+        assert_eq!(key.verify((&sig, len), &hash), Ok(true));
+
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let g = EcPoint::generator(&arena, CurvesId::Secp256r1).map_err(|_| ())?;
+        let g_table =
+            FixedBaseTable::<32>::precompute(&arena, CurvesId::Secp256r1, &g).map_err(|_| ())?;
+        drop(g);
+        drop(arena);
+        let key = key.with_table().map_err(|_| ())?;
+        assert_eq!(key.verify_with(&g_table, (&sig, len), &hash), Ok(true));
+        let other = [0x38u8; 32];
+        assert_eq!(key.verify_with(&g_table, (&sig, len), &other), Ok(false));
+
+        // Not on the curve
+        uncompressed[64] ^= 1;
+        assert_eq!(
+            PreparedPublicKey::<32>::new(CurvesId::Secp256r1, &uncompressed).is_err(),
+            true
+        );
+    }
+}
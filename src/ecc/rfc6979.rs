@@ -0,0 +1,263 @@
+//! Deterministic ECDSA nonces (RFC 6979) computed outside of the signature
+//!
+//! [`ECPrivateKey::deterministic_sign`] leaves the nonce to
+//! `cx_ecdsa_sign_no_throw`, which looks up the curve domain and sets up its
+//! own HMAC-DRBG for each signature. An [`Rfc6979Nonce`] is bound to a key
+//! once, with the order of its curve, and then generates the nonce of each
+//! hash with the `cx_rng_rfc6979_init`/`cx_rng_rfc6979_next` functions.
+//! [`ECPrivateKey::sign_with_nonce`] signs with a nonce supplied this way.
+//!
+//! RFC 6979 keys its HMAC with both the private key and the hash, so the
+//! DRBG itself is still seeded once per hash: what is saved is the domain
+//! lookup, and the retries when a nonce is rejected only cost one
+//! `cx_rng_rfc6979_next`.
+//!
+//! # Examples
+//!
+//! ```
+//! let mut nonces = Rfc6979Nonce::new(&sk)?;
+//! for hash in hashes {
+//!     let (sig, len, parity) = sk.deterministic_sign_with(&mut nonces, hash)?;
+//! }
+//! ```
+
+use super::{CxError, ECPrivateKey, EcPoint, Secret};
+use crate::bindings::*;
+use crate::bn::BnArena;
+use core::cmp::Ordering;
+use core::hint::black_box;
+
+const RFC6979_BUFFER_LENGTH: usize = 64;
+const RFC6979_MAX_RLEN: usize = 66;
+
+// Layout of `cx_rnd_rfc6979_ctx_t` from cx_rng_rfc6979.h
+#[repr(C)]
+struct Context {
+    v: [u8; RFC6979_BUFFER_LENGTH + 1],
+    k: [u8; RFC6979_BUFFER_LENGTH],
+    q: [u8; RFC6979_MAX_RLEN],
+    q_len: u32,
+    r_len: u32,
+    tmp: [u8; RFC6979_MAX_RLEN],
+    hash_id: cx_md_t,
+    md_len: size_t,
+    hmac: cx_hmac_t,
+}
+
+extern "C" {
+    fn cx_rng_rfc6979_init(
+        ctx: *mut Context,
+        hash_id: cx_md_t,
+        x: *const u8,
+        x_len: size_t,
+        h1: *const u8,
+        h1_len: size_t,
+        q: *const u8,
+        q_len: size_t,
+    ) -> cx_err_t;
+    fn cx_rng_rfc6979_next(ctx: *mut Context, out: *mut u8, out_len: size_t) -> cx_err_t;
+}
+
+fn check(err: cx_err_t) -> Result<(), CxError> {
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(())
+    }
+}
+
+/// Order of the curve of `key`, big endian
+fn curve_order<const N: usize>(
+    arena: &BnArena,
+    key: &ECPrivateKey<N, 'W'>,
+) -> Result<[u8; N], CxError> {
+    let n = arena.alloc(N)?;
+    check(unsafe {
+        cx_ecdomain_parameter_bn(key.curve as cx_curve_t, CX_CURVE_PARAM_Order, n.handle())
+    })?;
+    let mut q = [0u8; N];
+    n.export(&mut q)?;
+    Ok(q)
+}
+
+/// Generator of the RFC 6979 nonces of a private key, cleared when dropped
+pub struct Rfc6979Nonce<'a, const N: usize> {
+    key: &'a ECPrivateKey<N, 'W'>,
+    /// Order of the curve, big endian
+    q: [u8; N],
+    ctx: Context,
+}
+
+impl<'a, const N: usize> Rfc6979Nonce<'a, N> {
+    /// Generator for the signatures of `key`
+    pub fn new(key: &'a ECPrivateKey<N, 'W'>) -> Result<Self, CxError> {
+        if N > RFC6979_MAX_RLEN {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let q = curve_order(&BnArena::lock(N)?, key)?;
+        Ok(Rfc6979Nonce {
+            key,
+            q,
+            // All-zero bytes are a valid (empty) context
+            ctx: unsafe { core::mem::zeroed() },
+        })
+    }
+
+    /// Start generating the nonces of `hash`, as `deterministic_sign` would
+    pub fn start(&mut self, hash: &[u8]) -> Result<(), CxError> {
+        check(unsafe {
+            cx_rng_rfc6979_init(
+                &mut self.ctx,
+                ECPrivateKey::<N, 'W'>::RFC6979_HASH_ID,
+                self.key.key.as_ptr(),
+                N as size_t,
+                hash.as_ptr(),
+                hash.len() as size_t,
+                self.q.as_ptr(),
+                N as size_t,
+            )
+        })
+    }
+
+    /// Next nonce for the current hash, the first one unless the previous
+    /// ones were rejected
+    pub fn next_nonce(&mut self) -> Result<Secret<N>, CxError> {
+        let mut k = Secret::<N>::new();
+        check(unsafe { cx_rng_rfc6979_next(&mut self.ctx, k.as_mut().as_mut_ptr(), N as size_t) })?;
+        Ok(k)
+    }
+}
+
+/// The context holds the DRBG state and the key of its HMAC: clear it
+impl<const N: usize> Drop for Rfc6979Nonce<'_, N> {
+    #[inline(never)]
+    fn drop(&mut self) {
+        self.ctx.v.fill(0);
+        self.ctx.k.fill(0);
+        self.ctx.tmp.fill(0);
+        self.ctx.hmac.key.fill(0);
+        self.ctx.v = black_box(self.ctx.v);
+        self.ctx.k = black_box(self.ctx.k);
+        self.ctx.tmp = black_box(self.ctx.tmp);
+        self.ctx.hmac.key = black_box(self.ctx.hmac.key);
+    }
+}
+
+/// DER encoding of the unsigned big endian integer `x` into `out`,
+/// returning its length
+fn der_integer(x: &[u8], out: &mut [u8]) -> usize {
+    let start = x.iter().position(|&b| b != 0).unwrap_or(x.len() - 1);
+    let x = &x[start..];
+    let pad = (x[0] >> 7) as usize;
+    out[0] = 0x02;
+    out[1] = (x.len() + pad) as u8;
+    out[2] = 0;
+    out[2 + pad..2 + pad + x.len()].copy_from_slice(x);
+    2 + pad + x.len()
+}
+
+impl<const N: usize> ECPrivateKey<N, 'W'> {
+    /// Sign `hash` using ECDSA with the nonce `k`, which must never be used
+    /// for another hash. Returns the same (DER signature, length, parity) as
+    /// [`sign`](ECPrivateKey::sign), or `InvalidParameterValue` when `k` is
+    /// not suitable and another one must be drawn.
+    pub fn sign_with_nonce(
+        &self,
+        hash: &[u8],
+        k: &[u8; N],
+    ) -> Result<([u8; Self::S], u32, u32), CxError> {
+        let arena = BnArena::lock(N)?;
+        let n = arena.alloc(N)?;
+        check(unsafe {
+            cx_ecdomain_parameter_bn(self.curve as cx_curve_t, CX_CURVE_PARAM_Order, n.handle())
+        })?;
+        let kb = arena.alloc_init(N, k)?;
+        if kb.compare_u32(0)? != Ordering::Greater || kb.compare(&n)? != Ordering::Less {
+            return Err(CxError::InvalidParameterValue);
+        }
+
+        // r = x(k * G) mod n
+        let mut point = EcPoint::generator(&arena, self.curve)?;
+        point.scalarmul(k)?;
+        let (mut x, mut y) = ([0u8; N], [0u8; N]);
+        point.export(&mut x, &mut y)?;
+        let parity = (y[N - 1] & 1) as u32;
+        let mut tmp = arena.alloc_init(N, &x)?;
+        let mut r = arena.alloc(N)?;
+        r.reduce(&tmp, &n)?;
+        if r.compare_u32(0)? == Ordering::Equal {
+            return Err(CxError::InvalidParameterValue);
+        }
+
+        // s = (e + r * d) / k mod n, e being the leftmost bytes of the hash
+        let mut e = arena.alloc(N)?;
+        tmp.set_bytes(&hash[..hash.len().min(N)])?;
+        e.reduce(&tmp, &n)?;
+        let d = arena.alloc_init(N, &self.key)?;
+        let mut s = arena.alloc(N)?;
+        s.mod_mul(&r, &d, &n)?;
+        tmp.mod_add(&s, &e, &n)?;
+        e.mod_invert_nprime(&kb, &n)?;
+        s.mod_mul(&tmp, &e, &n)?;
+        if s.compare_u32(0)? == Ordering::Equal {
+            return Err(CxError::InvalidParameterValue);
+        }
+
+        let mut sig = [0u8; Self::S];
+        r.export(&mut x)?;
+        let r_len = der_integer(&x, &mut sig[2..]);
+        s.export(&mut x)?;
+        let s_len = der_integer(&x, &mut sig[2 + r_len..]);
+        sig[0] = 0x30;
+        sig[1] = (r_len + s_len) as u8;
+        Ok((sig, (2 + r_len + s_len) as u32, parity))
+    }
+
+    /// Sign `hash` like [`deterministic_sign`](ECPrivateKey::deterministic_sign),
+    /// with nonces from `nonces`, bound to this key
+    pub fn deterministic_sign_with(
+        &self,
+        nonces: &mut Rfc6979Nonce<N>,
+        hash: &[u8],
+    ) -> Result<([u8; Self::S], u32, u32), CxError> {
+        if !core::ptr::eq(nonces.key, self) {
+            return Err(CxError::InvalidParameter);
+        }
+        nonces.start(hash)?;
+        loop {
+            let k = nonces.next_nonce()?;
+            match self.sign_with_nonce(hash, k.as_ref().try_into().unwrap()) {
+                Err(CxError::InvalidParameterValue) => continue,
+                res => return res,
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::ecc::{make_bip32_path, Secp256k1, SeedDerive};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PATH: [u32; 5] = make_bip32_path(b"m/44'/535348'/0'/0/0");
+
+    #[test]
+    fn rfc6979_nonces() {
+        let sk = Secp256k1::derive_from_path(&PATH);
+        let mut nonces = Rfc6979Nonce::new(&sk).map_err(|_| ())?;
+        for i in 0..3u8 {
+            let hash = [i; 32];
+            // cx_ecdsa_sign_no_throw uses the first nonce: signatures match
+            let expected = sk.deterministic_sign(&hash).map_err(|_| ())?;
+            let sig = sk
+                .deterministic_sign_with(&mut nonces, &hash)
+                .map_err(|_| ())?;
+            assert_eq!(sig.1, expected.1);
+            assert_eq!(&sig.0[..sig.1 as usize], &expected.0[..expected.1 as usize]);
+            assert_eq!(sig.2, expected.2);
+        }
+    }
+}
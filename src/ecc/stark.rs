@@ -1,5 +1,7 @@
 use crate::bindings::*;
-use crate::ecc::{CurvesId, Secret};
+use crate::bn::BnArena;
+use crate::ct::ct_lt;
+use crate::ecc::{CurvesId, CxError, EcPoint, FixedBaseTable, Secret};
 
 // C_cx_secp256k1_n - (C_cx_secp256k1_n % C_cx_Stark256_n)
 const STARK_DERIVE_BIAS: [u8; 32] = [
@@ -14,22 +16,273 @@ const C_CX_STARK256_N: [u8; 32] = [
 ];
 
 /// https://github.com/ethereum/EIPs/blob/master/EIPS/eip-2645.md
-pub fn eip2645_derive(path: &[u32], key: &mut [u8]) {
+pub fn eip2645_derive(path: &[u32], key: &mut [u8]) -> Result<(), CxError> {
     let mut x_key = Secret::<64>::new();
-    // Ignoring 'Result' here because known to be valid
-    let _ = super::bip32_derive(CurvesId::Secp256k1, path, x_key.as_mut());
+    super::bip32_derive(CurvesId::Secp256k1, path, x_key.as_mut())?;
+    grind_key(&mut x_key, key)
+}
 
+fn grind_key(x_key: &mut Secret<64>, key: &mut [u8]) -> Result<(), CxError> {
+    // The hashed 33 bytes fit in a single SHA-256 block, leaving no midstate
+    // to reuse: one syscall per iteration, and the comparison in place
     let mut index = 0;
-    let mut cmp = 0;
-
     loop {
         x_key.as_mut()[32] = index;
         unsafe { cx_hash_sha256(x_key.as_ref().as_ptr(), 33, key.as_mut_ptr(), 32) };
-        unsafe { cx_math_cmp_no_throw(key.as_ptr(), STARK_DERIVE_BIAS.as_ptr(), 32, &mut cmp) };
-        if cmp < 0 {
-            unsafe { cx_math_modm_no_throw(key.as_mut_ptr(), 32, C_CX_STARK256_N.as_ptr(), 32) };
+        if ct_lt(&key[..32], &STARK_DERIVE_BIAS) {
             break;
         }
         index += 1;
     }
+    let arena = BnArena::lock(32)?;
+    let k = arena.alloc_init(32, &key[..32])?;
+    let n = arena.alloc_init(32, &C_CX_STARK256_N)?;
+    let mut r = arena.alloc(32)?;
+    r.reduce(&k, &n)?;
+    r.export(&mut key[..32])
+}
+
+/// Stark field element, big endian
+pub type Felt = [u8; 32];
+
+/// Stark field prime, 2^251 + 17 * 2^192 + 1
+pub const STARK_FIELD_PRIME: Felt = [
+    0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+];
+
+// Shift point and P1..P4 of the StarkEx Pedersen hash, as (x, y)
+const PEDERSEN_POINTS: [(Felt, Felt); 5] = [
+    (
+        [
+            0x04, 0x9e, 0xe3, 0xeb, 0xa8, 0xc1, 0x60, 0x07, 0x00, 0xee, 0x1b, 0x87, 0xeb, 0x59,
+            0x9f, 0x16, 0x71, 0x6b, 0x0b, 0x10, 0x22, 0x94, 0x77, 0x33, 0x55, 0x1f, 0xde, 0x40,
+            0x50, 0xca, 0x68, 0x04,
+        ],
+        [
+            0x03, 0xca, 0x0c, 0xfe, 0x4b, 0x3b, 0xc6, 0xdd, 0xf3, 0x46, 0xd4, 0x9d, 0x06, 0xea,
+            0x0e, 0xd3, 0x4e, 0x62, 0x10, 0x62, 0xc0, 0xe0, 0x56, 0xc1, 0xd0, 0x40, 0x5d, 0x26,
+            0x6e, 0x10, 0x26, 0x8a,
+        ],
+    ),
+    (
+        [
+            0x02, 0x34, 0x28, 0x7d, 0xcb, 0xaf, 0xfe, 0x7f, 0x96, 0x9c, 0x74, 0x86, 0x55, 0xfc,
+            0xa9, 0xe5, 0x8f, 0xa8, 0x12, 0x0b, 0x6d, 0x56, 0xeb, 0x0c, 0x10, 0x80, 0xd1, 0x79,
+            0x57, 0xeb, 0xe4, 0x7b,
+        ],
+        [
+            0x03, 0xb0, 0x56, 0xf1, 0x00, 0xf9, 0x6f, 0xb2, 0x1e, 0x88, 0x95, 0x27, 0xd4, 0x1f,
+            0x4e, 0x39, 0x94, 0x01, 0x35, 0xdd, 0x7a, 0x6c, 0x94, 0xcc, 0x6e, 0xd0, 0x26, 0x8e,
+            0xe8, 0x9e, 0x56, 0x15,
+        ],
+    ),
+    (
+        [
+            0x04, 0xfa, 0x56, 0xf3, 0x76, 0xc8, 0x3d, 0xb3, 0x3f, 0x9d, 0xab, 0x26, 0x56, 0x55,
+            0x8f, 0x33, 0x99, 0x09, 0x9e, 0xc1, 0xde, 0x5e, 0x30, 0x18, 0xb7, 0xa6, 0x93, 0x2d,
+            0xba, 0x8a, 0xa3, 0x78,
+        ],
+        [
+            0x03, 0xfa, 0x09, 0x84, 0xc9, 0x31, 0xc9, 0xe3, 0x81, 0x13, 0xe0, 0xc0, 0xe4, 0x7e,
+            0x44, 0x01, 0x56, 0x27, 0x61, 0xf9, 0x2a, 0x7a, 0x23, 0xb4, 0x51, 0x68, 0xf4, 0xe8,
+            0x0f, 0xf5, 0xb5, 0x4d,
+        ],
+    ),
+    (
+        [
+            0x04, 0xba, 0x4c, 0xc1, 0x66, 0xbe, 0x8d, 0xec, 0x76, 0x49, 0x10, 0xf7, 0x5b, 0x45,
+            0xf7, 0x4b, 0x40, 0xc6, 0x90, 0xc7, 0x47, 0x09, 0xe9, 0x0f, 0x3a, 0xa3, 0x72, 0xf0,
+            0xbd, 0x2d, 0x69, 0x97,
+        ],
+        [
+            0x00, 0x40, 0x30, 0x1c, 0xf5, 0xc1, 0x75, 0x1f, 0x4b, 0x97, 0x1e, 0x46, 0xc4, 0xed,
+            0xe8, 0x5f, 0xca, 0xc5, 0xc5, 0x9a, 0x5c, 0xe5, 0xae, 0x7c, 0x48, 0x15, 0x1f, 0x27,
+            0xb2, 0x4b, 0x21, 0x9c,
+        ],
+    ),
+    (
+        [
+            0x05, 0x43, 0x02, 0xdc, 0xb0, 0xe6, 0xcc, 0x1c, 0x6e, 0x44, 0xcc, 0xa8, 0xf6, 0x1a,
+            0x63, 0xbb, 0x2c, 0xa6, 0x50, 0x48, 0xd5, 0x3f, 0xb3, 0x25, 0xd3, 0x6f, 0xf1, 0x2c,
+            0x49, 0xa5, 0x82, 0x02,
+        ],
+        [
+            0x01, 0xb7, 0x7b, 0x3e, 0x37, 0xd1, 0x35, 0x04, 0xb3, 0x48, 0x04, 0x62, 0x68, 0xd8,
+            0xae, 0x25, 0xce, 0x98, 0xad, 0x78, 0x3c, 0x25, 0x56, 0x1a, 0x87, 0x9d, 0xcc, 0x77,
+            0xe9, 0x9c, 0x24, 0x26,
+        ],
+    ),
+];
+
+/// StarkEx Pedersen hash.
+///
+/// [`PedersenHash::update`] and [`PedersenHash::finalize`] hash an array of
+/// field elements incrementally, as `compute_hash_on_elements`:
+/// `H(...H(H(0, e0), e1)..., n)`, while [`PedersenHash::hash_pair`] is the
+/// underlying `H(a, b)`.
+///
+/// The constant points stay in the engine for the lifetime of the hasher,
+/// which can be reused for several arrays. Given comb tables of the
+/// constant points ([`PedersenHash::precompute_tables`], or built offline
+/// and stored as constants), hashing a pair takes 4 comb multiplications
+/// instead of 4 double-and-add scalar multiplications.
+///
+/// # Examples
+///
+/// ```
+/// let arena = BnArena::lock(32)?;
+/// let mut h = PedersenHash::new(&arena)?;
+/// for felt in calldata {
+///     h.update(felt)?;
+/// }
+/// let digest = h.finalize()?;
+/// ```
+pub struct PedersenHash<'a> {
+    arena: &'a BnArena,
+    points: [EcPoint<'a>; 5],
+    tables: Option<&'a [FixedBaseTable<32>; 4]>,
+    acc: EcPoint<'a>,
+    sum: EcPoint<'a>,
+    term: EcPoint<'a>,
+    state: Felt,
+    count: u32,
+}
+
+impl<'a> PedersenHash<'a> {
+    pub fn new(arena: &'a BnArena) -> Result<Self, CxError> {
+        let point = |i: usize| {
+            let (x, y) = &PEDERSEN_POINTS[i];
+            EcPoint::from_coordinates(arena, CurvesId::Stark256, x, y)
+        };
+        Ok(PedersenHash {
+            arena,
+            points: [point(0)?, point(1)?, point(2)?, point(3)?, point(4)?],
+            tables: None,
+            acc: EcPoint::new(arena, CurvesId::Stark256)?,
+            sum: EcPoint::new(arena, CurvesId::Stark256)?,
+            term: EcPoint::new(arena, CurvesId::Stark256)?,
+            state: [0u8; 32],
+            count: 0,
+        })
+    }
+
+    /// Hasher multiplying the constant points P1 to P4 with their comb
+    /// `tables`
+    pub fn with_tables(
+        arena: &'a BnArena,
+        tables: &'a [FixedBaseTable<32>; 4],
+    ) -> Result<Self, CxError> {
+        let mut h = Self::new(arena)?;
+        h.tables = Some(tables);
+        Ok(h)
+    }
+
+    /// Comb tables of the constant points P1 to P4, 3840 bytes
+    pub fn precompute_tables(arena: &BnArena) -> Result<[FixedBaseTable<32>; 4], CxError> {
+        let table = |i: usize| {
+            let (x, y) = &PEDERSEN_POINTS[i];
+            let p = EcPoint::from_coordinates(arena, CurvesId::Stark256, x, y)?;
+            FixedBaseTable::precompute(arena, CurvesId::Stark256, &p)
+        };
+        Ok([table(1)?, table(2)?, table(3)?, table(4)?])
+    }
+
+    /// `H(a, b)`, the x coordinate of
+    /// `P0 + a_low * P1 + a_high * P2 + b_low * P3 + b_high * P4`, where
+    /// `low` is made of the 248 low bits and `high` of the 4 others.
+    pub fn hash_pair(&mut self, a: &Felt, b: &Felt) -> Result<Felt, CxError> {
+        if a >= &STARK_FIELD_PRIME || b >= &STARK_FIELD_PRIME {
+            return Err(CxError::InvalidParameterValue);
+        }
+        self.acc.copy_from(&self.points[0])?;
+        for (i, felt) in [a, b].into_iter().enumerate() {
+            let mut low = *felt;
+            low[0] = 0;
+            let mut high = [0u8; 32];
+            high[31] = felt[0];
+            for (j, k) in [(1 + 2 * i, low), (2 + 2 * i, high)] {
+                // The point at infinity cannot be added
+                if k.iter().all(|&b| b == 0) {
+                    continue;
+                }
+                match self.tables {
+                    Some(tables) => tables[j - 1].mul(self.arena, &mut self.term, &k)?,
+                    None => {
+                        self.term.copy_from(&self.points[j])?;
+                        self.term.scalarmul_public(&k)?;
+                    }
+                }
+                self.sum.add(&self.acc, &self.term)?;
+                core::mem::swap(&mut self.acc, &mut self.sum);
+            }
+        }
+        let mut x = [0u8; 32];
+        let mut y = [0u8; 32];
+        self.acc.export(&mut x, &mut y)?;
+        Ok(x)
+    }
+
+    /// Append `felt` to the array being hashed
+    pub fn update(&mut self, felt: &Felt) -> Result<(), CxError> {
+        let state = self.state;
+        self.state = self.hash_pair(&state, felt)?;
+        self.count += 1;
+        Ok(())
+    }
+
+    /// Hash of the array, followed by its length. The hasher is then reset
+    /// to hash a new array.
+    pub fn finalize(&mut self) -> Result<Felt, CxError> {
+        let mut len = [0u8; 32];
+        len[28..].copy_from_slice(&self.count.to_be_bytes());
+        let state = self.state;
+        let digest = self.hash_pair(&state, &len);
+        self.state = [0u8; 32];
+        self.count = 0;
+        digest
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn pedersen() {
+        const A: Felt = [
+            0x03, 0xd9, 0x37, 0xc0, 0x35, 0xc8, 0x78, 0x24, 0x5c, 0xaf, 0x64, 0x53, 0x1a, 0x57,
+            0x56, 0x10, 0x9c, 0x53, 0x06, 0x8d, 0xa1, 0x39, 0x36, 0x27, 0x28, 0xfe, 0xb5, 0x61,
+            0x40, 0x53, 0x71, 0xcb,
+        ];
+        const B: Felt = [
+            0x02, 0x08, 0xa0, 0xa1, 0x02, 0x50, 0xe3, 0x82, 0xe1, 0xe4, 0xbb, 0xe2, 0x88, 0x09,
+            0x06, 0xc2, 0x79, 0x1b, 0xf6, 0x27, 0x56, 0x95, 0xe0, 0x2f, 0xbb, 0xc6, 0xae, 0xff,
+            0x9c, 0xd8, 0xb3, 0x1a,
+        ];
+        const AB: Felt = [
+            0x03, 0x0e, 0x48, 0x0b, 0xed, 0x5f, 0xe5, 0x3f, 0xa9, 0x09, 0xcc, 0x0f, 0x8c, 0x4d,
+            0x99, 0xb8, 0xf9, 0xf2, 0xc0, 0x16, 0xbe, 0x4c, 0x41, 0xe1, 0x3a, 0x48, 0x48, 0x79,
+            0x79, 0x79, 0xc6, 0x62,
+        ];
+        // compute_hash_on_elements([1, 2, 3])
+        const ARRAY: Felt = [
+            0x00, 0xf9, 0xd9, 0x5f, 0xbf, 0x35, 0x6f, 0xbe, 0xda, 0x26, 0x53, 0x8c, 0x92, 0xf7,
+            0x04, 0x0a, 0xbe, 0x51, 0xbf, 0x14, 0x23, 0x50, 0xf7, 0x3c, 0x9e, 0xe5, 0xba, 0x7c,
+            0x66, 0x0b, 0xae, 0x71,
+        ];
+
+        let arena = BnArena::lock(32).map_err(|_| ())?;
+        let mut h = PedersenHash::new(&arena).map_err(|_| ())?;
+        assert_eq!(h.hash_pair(&A, &B).map_err(|_| ())?, AB);
+        for i in 1..=3u8 {
+            let mut felt = [0u8; 32];
+            felt[31] = i;
+            h.update(&felt).map_err(|_| ())?;
+        }
+        assert_eq!(h.finalize().map_err(|_| ())?, ARRAY);
+    }
 }
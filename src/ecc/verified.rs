@@ -0,0 +1,126 @@
+//! Cache of the signatures already verified in the session
+//!
+//! Hosts often resend the same signed descriptor (token information,
+//! plugin or domain name certificates) with each transaction of a batch. A
+//! [`VerifiedCache`] records the successful verifications, as the SHA-256
+//! of the key, the payload and the signature, so that checking the same
+//! signature again costs a hash and a lookup:
+//!
+//! ```
+//! static mut VERIFIED: VerifiedCache<8> = VerifiedCache::new();
+//!
+//! let verified = unsafe { &mut *core::ptr::addr_of_mut!(VERIFIED) };
+//! let hash = Sha256::hash(descriptor)?;
+//! let valid = verified.verify(signer.as_ref(), descriptor, sig, || {
+//!     signer.verify((sig, sig.len() as u32), &hash)
+//! })?;
+//! ```
+//!
+//! Failed verifications are not recorded. The cache only lives in RAM, for
+//! the life of the app; apps must call [`VerifiedCache::clear`] when the
+//! keys they trust change, and may have it called when the device locks
+//! with [`crate::lock::register`].
+
+use super::CxError;
+use crate::hash::{HashFn, Sha256};
+
+/// Up to `E` verified signatures, replaced in a round-robin fashion once
+/// they are all used
+pub struct VerifiedCache<const E: usize> {
+    digests: [[u8; 32]; E],
+    len: usize,
+    next: usize,
+}
+
+impl<const E: usize> Default for VerifiedCache<E> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const E: usize> VerifiedCache<E> {
+    pub const fn new() -> Self {
+        VerifiedCache {
+            digests: [[0; 32]; E],
+            len: 0,
+            next: 0,
+        }
+    }
+
+    /// Digest of a verification, each part prefixed with its length so that
+    /// their boundaries cannot move
+    fn digest(key_id: &[u8], payload: &[u8], signature: &[u8]) -> Result<[u8; 32], CxError> {
+        let mut h = Sha256::new();
+        for part in [key_id, payload, signature] {
+            h.update(&(part.len() as u32).to_be_bytes())?;
+            h.update(part)?;
+        }
+        h.finalize()
+    }
+
+    /// Whether `signature` of `payload` under the key identified by `key_id`
+    /// (the key itself or its hash) has been verified. Otherwise `verify`
+    /// is called, and its success recorded.
+    pub fn verify<F>(
+        &mut self,
+        key_id: &[u8],
+        payload: &[u8],
+        signature: &[u8],
+        verify: F,
+    ) -> Result<bool, CxError>
+    where
+        F: FnOnce() -> bool,
+    {
+        let digest = Self::digest(key_id, payload, signature)?;
+        if self.digests[..self.len].contains(&digest) {
+            return Ok(true);
+        }
+        if !verify() {
+            return Ok(false);
+        }
+        if E > 0 {
+            self.digests[self.next] = digest;
+            self.next = (self.next + 1) % E;
+            self.len = (self.len + 1).min(E);
+        }
+        Ok(true)
+    }
+
+    /// Forget all the verifications
+    pub fn clear(&mut self) {
+        self.len = 0;
+        self.next = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn verified_cache() {
+        let mut cache = VerifiedCache::<2>::new();
+        let mut calls = 0;
+        let mut check = |cache: &mut VerifiedCache<2>, payload: &[u8], valid: bool| {
+            cache.verify(b"key", payload, b"sig", || {
+                calls += 1;
+                valid
+            })
+        };
+        assert_eq!(check(&mut cache, b"a", true), Ok(true));
+        assert_eq!(check(&mut cache, b"a", false), Ok(true));
+        assert_eq!(check(&mut cache, b"b", false), Ok(false));
+        assert_eq!(check(&mut cache, b"b", false), Ok(false));
+        // Once full, the oldest verifications are replaced
+        assert_eq!(check(&mut cache, b"b", true), Ok(true));
+        assert_eq!(check(&mut cache, b"c", true), Ok(true));
+        assert_eq!(check(&mut cache, b"d", true), Ok(true));
+        assert_eq!(check(&mut cache, b"b", false), Ok(false));
+        cache.clear();
+        assert_eq!(check(&mut cache, b"d", false), Ok(false));
+        assert_eq!(calls, 8);
+    }
+}
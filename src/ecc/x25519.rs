@@ -0,0 +1,290 @@
+//! X25519 and X448 key agreements (RFC 7748)
+//!
+//! The Montgomery ladder runs on the bignum engine, one [`BnArena`] for the
+//! whole scalar multiplication, while the secret scalars and the shared
+//! secrets are held in [`Secret`] buffers. Keys and coordinates are little
+//! endian, as in the RFC.
+//!
+//! ```
+//! let mut sk = Secret::<32>::new();
+//! let pk = X25519::generate(&mut sk)?;
+//! // send pk, receive peer
+//! let mut shared = Secret::<32>::new();
+//! X25519::diffie_hellman(&sk, &peer, &mut shared)?;
+//! ```
+
+use crate::bn::{Bn, BnArena};
+use crate::ecc::{CxError, Secret};
+use crate::random::rand_bytes;
+use core::cmp::Ordering;
+
+/// Domain of a Montgomery curve
+struct Domain {
+    /// Prime, big endian, on the size of the bignums
+    p: &'static [u8],
+    /// (A - 2) / 4
+    a24: u32,
+    /// Number of bits of the clamped scalars
+    bits: usize,
+}
+
+/// Size of the largest bignums
+const BN_LEN: usize = 64;
+
+// 2^255 - 19
+const P25519: [u8; 32] = {
+    let mut p = [0xff; 32];
+    p[0] = 0x7f;
+    p[31] = 0xed;
+    p
+};
+
+// 2^448 - 2^224 - 1, on 64 bytes as the bignums are allocated by multiples
+// of 32 bytes
+const P448: [u8; BN_LEN] = {
+    let mut p = [0xff; BN_LEN];
+    let mut i = 0;
+    while i < 8 {
+        p[i] = 0;
+        i += 1;
+    }
+    p[8 + 27] = 0xfe;
+    p
+};
+
+const CURVE25519: Domain = Domain {
+    p: &P25519,
+    a24: 121665,
+    bits: 255,
+};
+
+const CURVE448: Domain = Domain {
+    p: &P448,
+    a24: 39081,
+    bits: 448,
+};
+
+/// `out` = u-coordinate of `k`·`u`, `k` being already clamped. Fails with
+/// `CxError::InvalidPoint` if the result is zero, `u` being of small order.
+fn ladder<const L: usize>(
+    domain: &Domain,
+    k: &[u8; L],
+    u: &[u8; L],
+    out: &mut [u8; L],
+) -> Result<(), CxError> {
+    let n = domain.p.len();
+    let arena = BnArena::lock(32)?;
+    let p = arena.alloc_init(n, domain.p)?;
+    let mut a24 = arena.alloc(n)?;
+    a24.set_u32(domain.a24)?;
+
+    let mut buf = Secret::<BN_LEN>::new();
+    let be = &mut buf.0[..n];
+    for (b, &u) in be[n - L..].iter_mut().rev().zip(u.iter()) {
+        *b = u;
+    }
+    if domain.bits % 8 != 0 {
+        // The unused most significant bits of the coordinate are masked
+        be[n - L] &= (1 << (domain.bits % 8)) - 1;
+    }
+    let raw = arena.alloc_init(n, be)?;
+    let mut x1 = arena.alloc(n)?;
+    x1.reduce(&raw, &p)?;
+
+    let mut x2 = arena.alloc(n)?;
+    x2.set_u32(1)?;
+    let mut z2 = arena.alloc(n)?;
+    let mut x3 = arena.alloc(n)?;
+    x3.copy_from(&x1)?;
+    let mut z3 = arena.alloc(n)?;
+    z3.set_u32(1)?;
+    let mut a = arena.alloc(n)?;
+    let mut aa = arena.alloc(n)?;
+    let mut b = arena.alloc(n)?;
+    let mut bb = arena.alloc(n)?;
+    let mut c = arena.alloc(n)?;
+    let mut d = arena.alloc(n)?;
+    let mut e = arena.alloc(n)?;
+    let mut da = arena.alloc(n)?;
+    let mut cb = arena.alloc(n)?;
+
+    let mut swap = false;
+    for t in (0..domain.bits).rev() {
+        let bit = (k[t / 8] >> (t % 8)) & 1 == 1;
+        swap ^= bit;
+        Bn::cswap(&mut x2, &mut x3, swap);
+        Bn::cswap(&mut z2, &mut z3, swap);
+        swap = bit;
+
+        a.mod_add(&x2, &z2, &p)?;
+        aa.mod_mul(&a, &a, &p)?;
+        b.mod_sub(&x2, &z2, &p)?;
+        bb.mod_mul(&b, &b, &p)?;
+        e.mod_sub(&aa, &bb, &p)?;
+        c.mod_add(&x3, &z3, &p)?;
+        d.mod_sub(&x3, &z3, &p)?;
+        da.mod_mul(&d, &a, &p)?;
+        cb.mod_mul(&c, &b, &p)?;
+        // x3 = (DA + CB)^2, z3 = x1 * (DA - CB)^2
+        c.mod_add(&da, &cb, &p)?;
+        x3.mod_mul(&c, &c, &p)?;
+        d.mod_sub(&da, &cb, &p)?;
+        a.mod_mul(&d, &d, &p)?;
+        z3.mod_mul(&x1, &a, &p)?;
+        // x2 = AA * BB, z2 = E * (AA + a24 * E)
+        x2.mod_mul(&aa, &bb, &p)?;
+        b.mod_mul(&a24, &e, &p)?;
+        c.mod_add(&aa, &b, &p)?;
+        z2.mod_mul(&e, &c, &p)?;
+    }
+    Bn::cswap(&mut x2, &mut x3, swap);
+    Bn::cswap(&mut z2, &mut z3, swap);
+
+    if z2.compare_u32(0)? == Ordering::Equal {
+        return Err(CxError::InvalidPoint);
+    }
+    a.mod_invert_nprime(&z2, &p)?;
+    b.mod_mul(&x2, &a, &p)?;
+    b.export(be)?;
+    let mut acc = 0;
+    for (o, &b) in out.iter_mut().zip(be[n - L..].iter().rev()) {
+        *o = b;
+        acc |= b;
+    }
+    if acc == 0 {
+        return Err(CxError::InvalidPoint);
+    }
+    Ok(())
+}
+
+macro_rules! impl_x {
+    ($(#[$doc:meta])* $name:ident, $len:expr, $domain:expr, $base:expr, $clamp:ident) => {
+        $(#[$doc])*
+        pub struct $name;
+
+        impl $name {
+            /// Length of the keys and of the shared secret
+            pub const LEN: usize = $len;
+
+            fn mul(sk: &Secret<$len>, u: &[u8; $len], out: &mut [u8; $len]) -> Result<(), CxError> {
+                let mut k = Secret::<$len>::new();
+                k.0 = sk.0;
+                $clamp(&mut k.0);
+                ladder(&$domain, &k.0, u, out)
+            }
+
+            /// Public key of the secret key `sk`
+            pub fn public_key(sk: &Secret<$len>) -> Result<[u8; $len], CxError> {
+                let mut base = [0u8; $len];
+                base[0] = $base;
+                let mut pk = [0u8; $len];
+                Self::mul(sk, &base, &mut pk)?;
+                Ok(pk)
+            }
+
+            /// Draw an ephemeral secret key into `sk`, and return its
+            /// public key
+            pub fn generate(sk: &mut Secret<$len>) -> Result<[u8; $len], CxError> {
+                rand_bytes(&mut sk.0);
+                Self::public_key(sk)
+            }
+
+            /// Shared secret of the secret key `sk` and the public key of
+            /// the peer `peer`, into `shared`. Public keys of small order,
+            /// which would give a zero secret, are rejected with
+            /// `CxError::InvalidPoint`.
+            pub fn diffie_hellman(
+                sk: &Secret<$len>,
+                peer: &[u8; $len],
+                shared: &mut Secret<$len>,
+            ) -> Result<(), CxError> {
+                Self::mul(sk, peer, &mut shared.0)
+            }
+        }
+    };
+}
+
+fn clamp25519(k: &mut [u8; 32]) {
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+}
+
+fn clamp448(k: &mut [u8; 56]) {
+    k[0] &= 252;
+    k[55] |= 128;
+}
+
+impl_x!(
+    /// X25519 key agreement, 32-byte keys
+    X25519,
+    32,
+    CURVE25519,
+    9,
+    clamp25519
+);
+
+impl_x!(
+    /// X448 key agreement, 56-byte keys
+    X448,
+    56,
+    CURVE448,
+    5,
+    clamp448
+);
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const ALICE_SK: [u8; 32] = [
+        0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d, 0x3c, 0x16, 0xc1, 0x72, 0x51, 0xb2, 0x66,
+        0x45, 0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0, 0x99, 0x2a, 0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9,
+        0x2c, 0x2a,
+    ];
+    const ALICE_PK: [u8; 32] = [
+        0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54, 0x74, 0x8b, 0x7d, 0xdc, 0xb4, 0x3e, 0xf7,
+        0x5a, 0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38, 0x1a, 0xf4, 0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b,
+        0x4e, 0x6a,
+    ];
+    const BOB_PK: [u8; 32] = [
+        0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4, 0xd3, 0x5b, 0x61, 0xc2, 0xec, 0xe4, 0x35,
+        0x37, 0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78, 0x67, 0x4d, 0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88,
+        0x2b, 0x4f,
+    ];
+    const SHARED: [u8; 32] = [
+        0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1, 0x72, 0x8e, 0x3b, 0xf4, 0x80, 0x35, 0x0f,
+        0x25, 0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1, 0x9e, 0x33, 0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16,
+        0x17, 0x42,
+    ];
+
+    #[test]
+    fn x25519() {
+        // RFC 7748, section 6.1
+        let mut sk = Secret::<32>::new();
+        sk.0 = ALICE_SK;
+        assert_eq!(X25519::public_key(&sk), Ok(ALICE_PK));
+        let mut shared = Secret::<32>::new();
+        X25519::diffie_hellman(&sk, &BOB_PK, &mut shared).map_err(|_| ())?;
+        assert_eq!(shared.0, SHARED);
+        // Small order point
+        assert_eq!(
+            X25519::diffie_hellman(&sk, &[0u8; 32], &mut shared),
+            Err(CxError::InvalidPoint)
+        );
+    }
+
+    #[test]
+    fn x448() {
+        let (mut a, mut b) = (Secret::<56>::new(), Secret::<56>::new());
+        let a_pk = X448::generate(&mut a).map_err(|_| ())?;
+        let b_pk = X448::generate(&mut b).map_err(|_| ())?;
+        let (mut ab, mut ba) = (Secret::<56>::new(), Secret::<56>::new());
+        X448::diffie_hellman(&a, &b_pk, &mut ab).map_err(|_| ())?;
+        X448::diffie_hellman(&b, &a_pk, &mut ba).map_err(|_| ())?;
+        assert_eq!(ab.0, ba.0);
+    }
+}
@@ -0,0 +1,542 @@
+//! EIP-712 hashing of typed structured data
+//!
+//! The host first sends the definitions of the struct types, which a
+//! [`TypeRegistry`] keeps for the session as their canonical encodings,
+//! `Mail(Person from,Person to,string contents)`. The hash of each type,
+//! which covers the types it references, is computed once and cached.
+//!
+//! The values are then hashed as they are received by a [`StructHasher`],
+//! which keeps one Keccak context per struct, array or dynamic value being
+//! hashed, up to `D` nested ones: arrays of nested structs are hashed
+//! without being buffered.
+//!
+//! ```
+//! static mut TYPES: TypeRegistry<1024, 16> = TypeRegistry::new();
+//!
+//! let types = unsafe { &mut *core::ptr::addr_of_mut!(TYPES) };
+//! types.define(b"Person", &[(b"string", b"name"), (b"address", b"wallet")])?;
+//! let person = types.find(b"Person").ok_or(Eip712Error::UnknownType)?;
+//!
+//! let mut hasher = StructHasher::<4>::new();
+//! hasher.begin_struct(&types.type_hash(person)?)?;
+//! hasher.begin_dynamic()?;
+//! hasher.data(b"Cow")?;
+//! hasher.end()?;
+//! hasher.atomic(&encode_atomic(b"address", &wallet)?)?;
+//! let message = hasher.end()?.ok_or(Eip712Error::Unbalanced)?;
+//! let digest = signing_hash(&domain_separator, &message)?;
+//! ```
+
+use crate::ecc::CxError;
+use crate::hash::{HashFn, Keccak256};
+use crate::io::{Reply, SyscallError};
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Eip712Error {
+    /// No room left for the definition or the nested value
+    Full,
+    /// The type is neither an atomic type nor a registered struct
+    UnknownType,
+    /// Invalid name, or value not matching its type
+    Malformed,
+    /// Value or definition ended while none was started
+    Unbalanced,
+    Hash(CxError),
+}
+
+impl From<CxError> for Eip712Error {
+    fn from(e: CxError) -> Eip712Error {
+        Eip712Error::Hash(e)
+    }
+}
+
+impl From<Eip712Error> for Reply {
+    fn from(e: Eip712Error) -> Reply {
+        match e {
+            Eip712Error::Full => SyscallError::Overflow.into(),
+            _ => SyscallError::InvalidParameter.into(),
+        }
+    }
+}
+
+/// Type of `ty` without its array dimensions, `Person` for `Person[][2]`
+fn base_type(ty: &[u8]) -> &[u8] {
+    match ty.iter().position(|&b| b == b'[') {
+        Some(i) => &ty[..i],
+        None => ty,
+    }
+}
+
+/// Whether `name` can be a type or field name
+fn valid_name(name: &[u8]) -> bool {
+    !name.is_empty()
+        && name
+            .iter()
+            .all(|&b| b.is_ascii_alphanumeric() || b == b'_' || b == b'$')
+}
+
+/// Definition of a struct type, within the bytes of the registry
+#[derive(Copy, Clone)]
+struct TypeDef {
+    start: usize,
+    name_len: usize,
+    end: usize,
+    hash: Option<[u8; 32]>,
+}
+
+/// Struct types of a session, up to `S` of them (at most 64), whose
+/// canonical encodings take up to `B` bytes in all
+pub struct TypeRegistry<const B: usize, const S: usize> {
+    bytes: [u8; B],
+    len: usize,
+    types: [TypeDef; S],
+    count: usize,
+    /// Start of the definition being built, if any
+    open: Option<usize>,
+    fields: usize,
+}
+
+impl<const B: usize, const S: usize> Default for TypeRegistry<B, S> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const B: usize, const S: usize> TypeRegistry<B, S> {
+    pub const fn new() -> Self {
+        // Sets of types are bit masks
+        assert!(S <= 64);
+        TypeRegistry {
+            bytes: [0; B],
+            len: 0,
+            types: [TypeDef {
+                start: 0,
+                name_len: 0,
+                end: 0,
+                hash: None,
+            }; S],
+            count: 0,
+            open: None,
+            fields: 0,
+        }
+    }
+
+    /// Forget all the types
+    pub fn clear(&mut self) {
+        self.len = 0;
+        self.count = 0;
+        self.open = None;
+    }
+
+    fn push(&mut self, data: &[u8]) -> Result<(), Eip712Error> {
+        let end = self.len + data.len();
+        if end > B {
+            return Err(Eip712Error::Full);
+        }
+        self.bytes[self.len..end].copy_from_slice(data);
+        self.len = end;
+        Ok(())
+    }
+
+    /// Start the definition of the struct type `name`, dropping any other
+    /// one left unfinished
+    pub fn begin_type(&mut self, name: &[u8]) -> Result<(), Eip712Error> {
+        if let Some(start) = self.open.take() {
+            self.len = start;
+        }
+        if !valid_name(name) || self.find(name).is_some() {
+            return Err(Eip712Error::Malformed);
+        }
+        if self.count == S {
+            return Err(Eip712Error::Full);
+        }
+        let start = self.len;
+        self.push(name)?;
+        self.push(b"(")?;
+        self.open = Some(start);
+        self.fields = 0;
+        Ok(())
+    }
+
+    /// Add the field `name` of type `ty` to the definition being built
+    pub fn add_field(&mut self, ty: &[u8], name: &[u8]) -> Result<(), Eip712Error> {
+        if self.open.is_none() {
+            return Err(Eip712Error::Unbalanced);
+        }
+        let dims = &ty[base_type(ty).len()..];
+        if !valid_name(base_type(ty))
+            || !valid_name(name)
+            || !dims
+                .iter()
+                .all(|&b| b.is_ascii_digit() || b == b'[' || b == b']')
+        {
+            return Err(Eip712Error::Malformed);
+        }
+        if self.fields > 0 {
+            self.push(b",")?;
+        }
+        self.push(ty)?;
+        self.push(b" ")?;
+        self.push(name)?;
+        self.fields += 1;
+        Ok(())
+    }
+
+    /// Complete the definition being built, and return the index of the
+    /// type
+    pub fn end_type(&mut self) -> Result<usize, Eip712Error> {
+        let start = self.open.ok_or(Eip712Error::Unbalanced)?;
+        self.push(b")")?;
+        self.open = None;
+        let name_len = self.bytes[start..self.len]
+            .iter()
+            .position(|&b| b == b'(')
+            .unwrap_or(0);
+        self.types[self.count] = TypeDef {
+            start,
+            name_len,
+            end: self.len,
+            hash: None,
+        };
+        // The hashes cached may cover the type, if it was referenced
+        // before being defined
+        for def in self.types[..self.count].iter_mut() {
+            def.hash = None;
+        }
+        self.count += 1;
+        Ok(self.count - 1)
+    }
+
+    /// Define the struct type `name` with its `fields`, as (type, name)
+    pub fn define(&mut self, name: &[u8], fields: &[(&[u8], &[u8])]) -> Result<usize, Eip712Error> {
+        self.begin_type(name)?;
+        for (ty, field) in fields {
+            self.add_field(ty, field)?;
+        }
+        self.end_type()
+    }
+
+    /// Index of the struct type `name`
+    pub fn find(&self, name: &[u8]) -> Option<usize> {
+        self.types[..self.count]
+            .iter()
+            .position(|def| &self.bytes[def.start..def.start + def.name_len] == name)
+    }
+
+    /// Name of the type `index`
+    pub fn name(&self, index: usize) -> &[u8] {
+        let def = &self.types[index];
+        &self.bytes[def.start..def.start + def.name_len]
+    }
+
+    /// Fields of the type `index`, as (type, name)
+    pub fn fields(&self, index: usize) -> impl Iterator<Item = (&[u8], &[u8])> {
+        let def = &self.types[index];
+        let list = &self.bytes[def.start + def.name_len + 1..def.end - 1];
+        list.split(|&b| b == b',')
+            .filter(|field| !field.is_empty())
+            .map(|field| {
+                let space = field.iter().position(|&b| b == b' ').unwrap_or(0);
+                (&field[..space], &field[space + 1..])
+            })
+    }
+
+    /// `typeHash` of the type `index`: the Keccak-256 of its encoding
+    /// followed by those of the types it references, sorted by name
+    pub fn type_hash(&mut self, index: usize) -> Result<[u8; 32], Eip712Error> {
+        if index >= self.count {
+            return Err(Eip712Error::UnknownType);
+        }
+        if let Some(hash) = self.types[index].hash {
+            return Ok(hash);
+        }
+        let mut deps = 1u64 << index;
+        loop {
+            let mut grown = deps;
+            for i in (0..self.count).filter(|i| deps & (1 << i) != 0) {
+                for (ty, _) in self.fields(i) {
+                    if let Some(j) = self.find(base_type(ty)) {
+                        grown |= 1 << j;
+                    }
+                }
+            }
+            if grown == deps {
+                break;
+            }
+            deps = grown;
+        }
+
+        let mut h = Keccak256::new();
+        let def = self.types[index];
+        h.update(&self.bytes[def.start..def.end])?;
+        deps &= !(1 << index);
+        while deps != 0 {
+            let next = (0..self.count)
+                .filter(|i| deps & (1 << i) != 0)
+                .min_by(|&a, &b| self.name(a).cmp(self.name(b)))
+                .unwrap_or(0);
+            let def = self.types[next];
+            h.update(&self.bytes[def.start..def.end])?;
+            deps &= !(1 << next);
+        }
+        let hash = h.finalize()?;
+        self.types[index].hash = Some(hash);
+        Ok(hash)
+    }
+}
+
+/// Parse the decimal size of `uint256`, `bytes32`... after `prefix`
+fn type_size(ty: &[u8], prefix: &[u8]) -> Option<usize> {
+    let digits = ty.strip_prefix(prefix)?;
+    if digits.is_empty() || digits.len() > 3 || digits[0] == b'0' {
+        return None;
+    }
+    digits.iter().try_fold(0usize, |n, &d| {
+        d.is_ascii_digit().then(|| n * 10 + (d - b'0') as usize)
+    })
+}
+
+/// 32-byte encoding of the value of the atomic type `ty`, given as the
+/// big-endian bytes of the integers, the 20 bytes of an address, a byte for
+/// a bool or the bytes of a `bytesN`
+pub fn encode_atomic(ty: &[u8], value: &[u8]) -> Result<[u8; 32], Eip712Error> {
+    let mut word = [0u8; 32];
+    let (len, fill) = match ty {
+        b"address" => (20, 0),
+        b"bool" => {
+            if value.len() != 1 || value[0] > 1 {
+                return Err(Eip712Error::Malformed);
+            }
+            (1, 0)
+        }
+        _ => {
+            if let Some(n) = type_size(ty, b"bytes").filter(|&n| n <= 32) {
+                if value.len() > n {
+                    return Err(Eip712Error::Malformed);
+                }
+                word[..value.len()].copy_from_slice(value);
+                return Ok(word);
+            }
+            let (bits, signed) = match (type_size(ty, b"uint"), type_size(ty, b"int")) {
+                (Some(bits), _) => (bits, false),
+                (_, Some(bits)) => (bits, true),
+                _ => return Err(Eip712Error::UnknownType),
+            };
+            if bits % 8 != 0 || bits > 256 {
+                return Err(Eip712Error::UnknownType);
+            }
+            let negative = signed && value.first().is_some_and(|&b| b & 0x80 != 0);
+            (bits / 8, if negative { 0xff } else { 0 })
+        }
+    };
+    if value.len() > len {
+        return Err(Eip712Error::Malformed);
+    }
+    word[..32 - value.len()].fill(fill);
+    word[32 - value.len()..].copy_from_slice(value);
+    Ok(word)
+}
+
+/// Hash of the values of a struct, as they are received, keeping a context
+/// for each of the up to `D` structs, arrays and dynamic values being
+/// hashed
+pub struct StructHasher<const D: usize> {
+    stack: [Keccak256; D],
+    depth: usize,
+}
+
+impl<const D: usize> Default for StructHasher<D> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const D: usize> StructHasher<D> {
+    pub fn new() -> Self {
+        StructHasher {
+            stack: core::array::from_fn(|_| Keccak256::new()),
+            depth: 0,
+        }
+    }
+
+    /// Number of values being hashed
+    pub fn depth(&self) -> usize {
+        self.depth
+    }
+
+    fn begin(&mut self) -> Result<&mut Keccak256, Eip712Error> {
+        if self.depth == D {
+            return Err(Eip712Error::Full);
+        }
+        let h = &mut self.stack[self.depth];
+        h.reset()?;
+        self.depth += 1;
+        Ok(h)
+    }
+
+    fn top(&mut self) -> Result<&mut Keccak256, Eip712Error> {
+        match self.depth {
+            0 => Err(Eip712Error::Unbalanced),
+            depth => Ok(&mut self.stack[depth - 1]),
+        }
+    }
+
+    /// Start a struct of type hash `type_hash`
+    pub fn begin_struct(&mut self, type_hash: &[u8; 32]) -> Result<(), Eip712Error> {
+        Ok(self.begin()?.update(type_hash)?)
+    }
+
+    /// Start an array, whose elements follow
+    pub fn begin_array(&mut self) -> Result<(), Eip712Error> {
+        self.begin().map(|_| ())
+    }
+
+    /// Start a `string` or `bytes` value, whose bytes follow
+    pub fn begin_dynamic(&mut self) -> Result<(), Eip712Error> {
+        self.begin().map(|_| ())
+    }
+
+    /// Next bytes of the dynamic value being hashed
+    pub fn data(&mut self, chunk: &[u8]) -> Result<(), Eip712Error> {
+        Ok(self.top()?.update(chunk)?)
+    }
+
+    /// Next atomic value of the struct or array being hashed, encoded by
+    /// [`encode_atomic`]
+    pub fn atomic(&mut self, word: &[u8; 32]) -> Result<(), Eip712Error> {
+        Ok(self.top()?.update(word)?)
+    }
+
+    /// Complete the value being hashed, which becomes a member of the
+    /// enclosing one. Returns the hash of the outermost struct once it is
+    /// complete.
+    pub fn end(&mut self) -> Result<Option<[u8; 32]>, Eip712Error> {
+        let mut hash = [0u8; 32];
+        self.top()?.finalize_into(&mut hash)?;
+        self.depth -= 1;
+        if self.depth == 0 {
+            return Ok(Some(hash));
+        }
+        self.atomic(&hash)?;
+        Ok(None)
+    }
+}
+
+/// Hash to sign, `keccak256(0x19 0x01 || domainSeparator || hashStruct(message))`
+pub fn signing_hash(domain_separator: &[u8; 32], message: &[u8; 32]) -> Result<[u8; 32], CxError> {
+    let mut h = Keccak256::new();
+    h.update(&[0x19, 0x01])?;
+    h.update(domain_separator)?;
+    h.update(message)?;
+    h.finalize()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // The example of EIP-712
+    const MAIL_TYPE_HASH: [u8; 32] = [
+        0xa0, 0xce, 0xde, 0xb2, 0xdc, 0x28, 0x0b, 0xa3, 0x9b, 0x85, 0x75, 0x46, 0xd7, 0x4f, 0x55,
+        0x49, 0xc3, 0xa1, 0xd7, 0xbd, 0xc2, 0xdd, 0x96, 0xbf, 0x88, 0x1f, 0x76, 0x10, 0x8e, 0x23,
+        0xda, 0xc2,
+    ];
+    const DOMAIN_SEPARATOR: [u8; 32] = [
+        0xf2, 0xce, 0xe3, 0x75, 0xfa, 0x42, 0xb4, 0x21, 0x43, 0x80, 0x40, 0x25, 0xfc, 0x44, 0x9d,
+        0xea, 0xfd, 0x50, 0xcc, 0x03, 0x1c, 0xa2, 0x57, 0xe0, 0xb1, 0x94, 0xa6, 0x50, 0xa9, 0x12,
+        0x09, 0x0f,
+    ];
+    const DIGEST: [u8; 32] = [
+        0xbe, 0x60, 0x9a, 0xee, 0x34, 0x3f, 0xb3, 0xc4, 0xb2, 0x8e, 0x1d, 0xf9, 0xe6, 0x32, 0xfc,
+        0xa6, 0x4f, 0xcf, 0xae, 0xde, 0x20, 0xf0, 0x2e, 0x86, 0x24, 0x4e, 0xfd, 0xdf, 0x30, 0x95,
+        0x7b, 0xd2,
+    ];
+    const VERIFYING_CONTRACT: [u8; 20] = [0xcc; 20];
+    const COW: [u8; 20] = [
+        0xcd, 0x2a, 0x3d, 0x9f, 0x93, 0x8e, 0x13, 0xcd, 0x94, 0x7e, 0xc0, 0x5a, 0xbc, 0x7f, 0xe7,
+        0x34, 0xdf, 0x8d, 0xd8, 0x26,
+    ];
+    const BOB: [u8; 20] = [0xbb; 20];
+
+    fn string<const D: usize>(h: &mut StructHasher<D>, s: &[u8]) -> Result<(), Eip712Error> {
+        h.begin_dynamic()?;
+        for chunk in s.chunks(4) {
+            h.data(chunk)?;
+        }
+        h.end().map(|_| ())
+    }
+
+    /// Type hash of Mail, domain separator and digest of the example
+    type MailHashes = ([u8; 32], [u8; 32], [u8; 32]);
+
+    fn mail() -> Result<MailHashes, Eip712Error> {
+        let mut types = TypeRegistry::<256, 4>::new();
+        let mail = types.define(
+            b"Mail",
+            &[
+                (b"Person", b"from"),
+                (b"Person", b"to"),
+                (b"string", b"contents"),
+            ],
+        )?;
+        let person = types.define(b"Person", &[(b"string", b"name"), (b"address", b"wallet")])?;
+        let domain = types.define(
+            b"EIP712Domain",
+            &[
+                (b"string", b"name"),
+                (b"string", b"version"),
+                (b"uint256", b"chainId"),
+                (b"address", b"verifyingContract"),
+            ],
+        )?;
+
+        let mut h = StructHasher::<3>::new();
+        h.begin_struct(&types.type_hash(domain)?)?;
+        string(&mut h, b"Ether Mail")?;
+        string(&mut h, b"1")?;
+        h.atomic(&encode_atomic(b"uint256", &[1])?)?;
+        h.atomic(&encode_atomic(b"address", &VERIFYING_CONTRACT)?)?;
+        let domain_separator = h.end()?.ok_or(Eip712Error::Unbalanced)?;
+
+        h.begin_struct(&types.type_hash(mail)?)?;
+        for (name, wallet) in [(&b"Cow"[..], COW), (b"Bob", BOB)] {
+            h.begin_struct(&types.type_hash(person)?)?;
+            string(&mut h, name)?;
+            h.atomic(&encode_atomic(b"address", &wallet)?)?;
+            h.end()?;
+        }
+        string(&mut h, b"Hello, Bob!")?;
+        let message = h.end()?.ok_or(Eip712Error::Unbalanced)?;
+        Ok((
+            types.type_hash(mail)?,
+            domain_separator,
+            signing_hash(&domain_separator, &message)?,
+        ))
+    }
+
+    #[test]
+    fn eip712_mail() {
+        let (type_hash, domain_separator, digest) = mail().map_err(|_| ())?;
+        assert_eq!(type_hash, MAIL_TYPE_HASH);
+        assert_eq!(domain_separator, DOMAIN_SEPARATOR);
+        assert_eq!(digest, DIGEST);
+    }
+
+    #[test]
+    fn eip712_atomic() {
+        let word = encode_atomic(b"int16", &[0xff, 0x38]).map_err(|_| ())?;
+        assert_eq!(&word[..30], &[0xffu8; 30][..]);
+        assert_eq!(&word[30..], &[0xff, 0x38]);
+        let word = encode_atomic(b"bytes4", b"abc").map_err(|_| ())?;
+        assert_eq!(&word[..4], b"abc\0");
+        assert_eq!(
+            encode_atomic(b"uint8", &[1, 2]),
+            Err(Eip712Error::Malformed)
+        );
+        assert_eq!(encode_atomic(b"uint7", &[1]), Err(Eip712Error::UnknownType));
+        assert_eq!(encode_atomic(b"bool", &[2]), Err(Eip712Error::Malformed));
+    }
+}
@@ -0,0 +1,349 @@
+//! Text encodings of binary data, for display and transport
+//!
+//! Hex, base58, bech32/bech32m and base32 encoders writing ASCII into a
+//! buffer of the caller, and returning the part written as a `&str`:
+//!
+//! ```
+//! let mut buf = [0u8; 64];
+//! let address = encoding::base58_encode(&payload, &mut buf).map_err(|_| StatusWords::BadLen)?;
+//! let label = Label::new(address, &fonts::OPEN_SANS_REGULAR_11PX, rect, Align::Center);
+//! ```
+//!
+//! Hex digits come two at a time from a 256-entry table. Base58 works on the
+//! number in 32-bit limbs, producing 5 digits per division pass by 58^5,
+//! instead of one digit per pass over the bytes. Bech32 checksums use a
+//! table of the generator combinations, one lookup per character.
+
+/// Largest input of [`base58_encode`], in bytes
+pub const BASE58_MAX_INPUT: usize = 128;
+
+#[derive(Debug, PartialEq, Eq)]
+pub enum EncodingError {
+    /// The output buffer is too small for the encoded text
+    BufferTooSmall,
+    /// The input is longer than [`BASE58_MAX_INPUT`]
+    InputTooLong,
+    /// The bech32 human-readable part is empty or has characters outside
+    /// of the printable ASCII range
+    InvalidHrp,
+}
+
+/// Output buffer being filled
+struct Out<'a> {
+    buf: &'a mut [u8],
+    len: usize,
+}
+
+impl<'a> Out<'a> {
+    fn new(buf: &'a mut [u8]) -> Self {
+        Out { buf, len: 0 }
+    }
+
+    fn push(&mut self, c: u8) -> Result<(), EncodingError> {
+        *self
+            .buf
+            .get_mut(self.len)
+            .ok_or(EncodingError::BufferTooSmall)? = c;
+        self.len += 1;
+        Ok(())
+    }
+
+    fn into_str(self) -> &'a str {
+        // Only ASCII characters are pushed
+        unsafe { core::str::from_utf8_unchecked(&self.buf[..self.len]) }
+    }
+}
+
+const fn hex_pairs() -> [[u8; 2]; 256] {
+    let digits = b"0123456789abcdef";
+    let mut pairs = [[0u8; 2]; 256];
+    let mut i = 0;
+    while i < 256 {
+        pairs[i] = [digits[i >> 4], digits[i & 0xf]];
+        i += 1;
+    }
+    pairs
+}
+
+/// Lowercase hex digits of each byte
+static HEX_PAIRS: [[u8; 2]; 256] = hex_pairs();
+
+/// Lowercase hex encoding of `data`, two characters per byte
+pub fn hex_encode<'a>(data: &[u8], out: &'a mut [u8]) -> Result<&'a str, EncodingError> {
+    let out = out
+        .get_mut(..2 * data.len())
+        .ok_or(EncodingError::BufferTooSmall)?;
+    for (pair, &b) in out.chunks_exact_mut(2).zip(data) {
+        pair.copy_from_slice(&HEX_PAIRS[b as usize]);
+    }
+    Ok(unsafe { core::str::from_utf8_unchecked(out) })
+}
+
+const BASE58_ALPHABET: &[u8; 58] = b"123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+/// Largest power of 58 fitting in a limb
+const BASE58_LIMB_DIVISOR: u64 = 58 * 58 * 58 * 58 * 58;
+
+/// Base58 encoding of `data` with the Bitcoin alphabet, each leading zero
+/// byte being encoded as a `1`. `data` is at most [`BASE58_MAX_INPUT`]
+/// bytes long.
+pub fn base58_encode<'a>(data: &[u8], out: &'a mut [u8]) -> Result<&'a str, EncodingError> {
+    if data.len() > BASE58_MAX_INPUT {
+        return Err(EncodingError::InputTooLong);
+    }
+    let zeros = data.iter().take_while(|&&b| b == 0).count();
+    let data = &data[zeros..];
+
+    // The number, in big-endian limbs
+    let mut limbs = [0u32; BASE58_MAX_INPUT / 4];
+    let n = data.len().div_ceil(4);
+    let limbs = &mut limbs[..n];
+    for (i, &b) in data.iter().rev().enumerate() {
+        limbs[n - 1 - i / 4] |= (b as u32) << (8 * (i % 4));
+    }
+
+    let mut out = Out::new(out);
+    for _ in 0..zeros {
+        out.push(b'1')?;
+    }
+    // Digits, least significant first, reversed below
+    let mut start = 0;
+    while start < n {
+        let mut rem = 0u64;
+        for limb in limbs[start..].iter_mut() {
+            let cur = rem << 32 | *limb as u64;
+            *limb = (cur / BASE58_LIMB_DIVISOR) as u32;
+            rem = cur % BASE58_LIMB_DIVISOR;
+        }
+        while start < n && limbs[start] == 0 {
+            start += 1;
+        }
+        // The leading zero digits of the last pass are not written
+        let mut rem = rem as u32;
+        for _ in 0..5 {
+            if start == n && rem == 0 {
+                break;
+            }
+            out.push(BASE58_ALPHABET[(rem % 58) as usize])?;
+            rem /= 58;
+        }
+    }
+    out.buf[zeros..out.len].reverse();
+    Ok(out.into_str())
+}
+
+/// Checksum constant of a bech32 variant
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Bech32Variant {
+    /// BIP 173, for segwit v0 addresses
+    Bech32 = 1,
+    /// BIP 350, for segwit v1+ addresses
+    Bech32m = 0x2bc8_30a3,
+}
+
+const BECH32_ALPHABET: &[u8; 32] = b"qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+
+const fn bech32_table() -> [u32; 32] {
+    let generator = [
+        0x3b6a_57b2,
+        0x2650_8e6d,
+        0x1ea1_19fa,
+        0x3d42_33dd,
+        0x2a14_62b3,
+    ];
+    let mut table = [0u32; 32];
+    let mut b = 0;
+    while b < 32 {
+        let mut i = 0;
+        while i < 5 {
+            if b >> i & 1 != 0 {
+                table[b] ^= generator[i];
+            }
+            i += 1;
+        }
+        b += 1;
+    }
+    table
+}
+
+/// Checksum update for each value of the top 5 bits of the checksum
+static BECH32_TABLE: [u32; 32] = bech32_table();
+
+fn polymod_step(chk: u32, value: u8) -> u32 {
+    BECH32_TABLE[(chk >> 25) as usize] ^ ((chk & 0x1ff_ffff) << 5) ^ value as u32
+}
+
+/// Bech32 or bech32m encoding of `data` with the human-readable part `hrp`,
+/// lowercase. `data` is split into 5-bit groups, after the 5-bit `version`
+/// if any, as for segwit addresses:
+///
+/// ```
+/// // bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4
+/// let address = bech32_encode("bc", Some(0), &program, Bech32Variant::Bech32, &mut buf)?;
+/// ```
+pub fn bech32_encode<'a>(
+    hrp: &str,
+    version: Option<u8>,
+    data: &[u8],
+    variant: Bech32Variant,
+    out: &'a mut [u8],
+) -> Result<&'a str, EncodingError> {
+    let hrp = hrp.as_bytes();
+    if hrp.is_empty() || hrp.iter().any(|c| !(33..=126).contains(c)) {
+        return Err(EncodingError::InvalidHrp);
+    }
+    let mut out = Out::new(out);
+    let mut chk = 1;
+    for &c in hrp {
+        chk = polymod_step(chk, c.to_ascii_lowercase() >> 5);
+    }
+    chk = polymod_step(chk, 0);
+    for &c in hrp {
+        let c = c.to_ascii_lowercase();
+        chk = polymod_step(chk, c & 0x1f);
+        out.push(c)?;
+    }
+    out.push(b'1')?;
+
+    let mut push5 = |out: &mut Out, value: u8| {
+        chk = polymod_step(chk, value);
+        out.push(BECH32_ALPHABET[value as usize])
+    };
+    if let Some(version) = version {
+        push5(&mut out, version & 0x1f)?;
+    }
+    let mut acc = 0u32;
+    let mut bits = 0;
+    for &b in data {
+        acc = acc << 8 | b as u32;
+        bits += 8;
+        while bits >= 5 {
+            bits -= 5;
+            push5(&mut out, (acc >> bits) as u8 & 0x1f)?;
+        }
+    }
+    if bits > 0 {
+        push5(&mut out, (acc << (5 - bits)) as u8 & 0x1f)?;
+    }
+
+    for _ in 0..6 {
+        chk = polymod_step(chk, 0);
+    }
+    chk ^= variant as u32;
+    for i in 0..6 {
+        out.push(BECH32_ALPHABET[(chk >> (5 * (5 - i)) & 0x1f) as usize])?;
+    }
+    Ok(out.into_str())
+}
+
+const BASE32_ALPHABET: &[u8; 32] = b"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+/// Base32 encoding of `data` with the RFC 4648 alphabet, padded with `=` to
+/// a multiple of 8 characters if `pad` is set
+pub fn base32_encode<'a>(
+    data: &[u8],
+    pad: bool,
+    out: &'a mut [u8],
+) -> Result<&'a str, EncodingError> {
+    let mut out = Out::new(out);
+    let mut acc = 0u32;
+    let mut bits = 0;
+    for &b in data {
+        acc = acc << 8 | b as u32;
+        bits += 8;
+        while bits >= 5 {
+            bits -= 5;
+            out.push(BASE32_ALPHABET[(acc >> bits & 0x1f) as usize])?;
+        }
+    }
+    if bits > 0 {
+        out.push(BASE32_ALPHABET[(acc << (5 - bits) & 0x1f) as usize])?;
+    }
+    if pad {
+        while out.len % 8 != 0 {
+            out.push(b'=')?;
+        }
+    }
+    Ok(out.into_str())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn hex() {
+        let mut buf = [0u8; 8];
+        assert_eq!(
+            hex_encode(&[0xde, 0xad, 0x0b, 0xef], &mut buf),
+            Ok("dead0bef")
+        );
+        assert_eq!(
+            hex_encode(&[0; 5], &mut buf),
+            Err(EncodingError::BufferTooSmall)
+        );
+    }
+
+    #[test]
+    fn base58() {
+        let mut buf = [0u8; 40];
+        assert_eq!(base58_encode(&[], &mut buf), Ok(""));
+        assert_eq!(base58_encode(&[0x61], &mut buf), Ok("2g"));
+        assert_eq!(base58_encode(&[0, 0, 0x61], &mut buf), Ok("112g"));
+        assert_eq!(
+            base58_encode(
+                &[0xec, 0xac, 0x89, 0xca, 0xd9, 0x39, 0x23, 0xc0, 0x23, 0x21],
+                &mut buf
+            ),
+            Ok("EJDM8drfXA6uyA")
+        );
+        let address = [
+            0x00, 0xeb, 0x15, 0x23, 0x1d, 0xfc, 0xeb, 0x60, 0x92, 0x58, 0x86, 0xb6, 0x7d, 0x06,
+            0x52, 0x99, 0x92, 0x59, 0x15, 0xae, 0xb1, 0x72, 0xc0, 0x66, 0x47,
+        ];
+        assert_eq!(
+            base58_encode(&address, &mut buf),
+            Ok("1NS17iag9jJgTHD1VXjvLCEnZuQ3rJDE9L")
+        );
+        assert_eq!(
+            base58_encode(&address, &mut buf[..33]),
+            Err(EncodingError::BufferTooSmall)
+        );
+    }
+
+    #[test]
+    fn bech32() {
+        let program = [
+            0x75, 0x1e, 0x76, 0xe8, 0x19, 0x91, 0x96, 0xd4, 0x54, 0x94, 0x1c, 0x45, 0xd1, 0xb3,
+            0xa3, 0x23, 0xf1, 0x43, 0x3b, 0xd6,
+        ];
+        let mut buf = [0u8; 90];
+        assert_eq!(
+            bech32_encode("bc", Some(0), &program, Bech32Variant::Bech32, &mut buf),
+            Ok("bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4")
+        );
+        let mut program2 = [0u8; 40];
+        program2[..20].copy_from_slice(&program);
+        program2[20..].copy_from_slice(&program);
+        assert_eq!(
+            bech32_encode("BC", Some(1), &program2, Bech32Variant::Bech32m, &mut buf),
+            Ok("bc1pw508d6qejxtdg4y5r3zarvary0c5xw7kw508d6qejxtdg4y5r3zarvary0c5xw7kt5nd6y")
+        );
+        assert_eq!(
+            bech32_encode("", None, &program, Bech32Variant::Bech32, &mut buf),
+            Err(EncodingError::InvalidHrp)
+        );
+    }
+
+    #[test]
+    fn base32() {
+        let mut buf = [0u8; 16];
+        assert_eq!(
+            base32_encode(b"foobar", true, &mut buf),
+            Ok("MZXW6YTBOI======")
+        );
+        assert_eq!(base32_encode(b"foob", false, &mut buf), Ok("MZXW6YQ"));
+    }
+}
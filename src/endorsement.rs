@@ -0,0 +1,151 @@
+//! Attestation with the endorsement keys of the device
+//!
+//! The endorsement keys are set up in the device by the Ledger manager,
+//! and certified by the issuer. [`sign`] has the OS sign data with one of
+//! them, along with the hash of the code of the app: key 1 signs
+//! `SHA-256(data || code hash)`, and key 2 is first derived from the code
+//! hash. Each signature is an ECDSA secp256k1 one, taking a syscall and
+//! most of the time of an attestation.
+//!
+//! A [`Batch`] attests many items with a single signature: their hashes
+//! are the leaves of a Merkle tree ([`crate::merkle`], RFC 6962), whose
+//! root is signed. The verifier, which knows the items, checks the
+//! signature over the root it computes, or over the root given with the
+//! proof of inclusion of one item:
+//!
+//! ```
+//! let mut batch = endorsement::Batch::new();
+//! for key in session_keys {
+//!     batch.push(&key.public_key()?.pubkey)?;
+//! }
+//! let mut sig = [0u8; endorsement::MAX_SIGNATURE_LEN];
+//! let (tree, len) = batch.sign(endorsement::Key::One, &mut sig)?;
+//! ```
+
+use crate::bindings::{
+    os_endorsement_get_code_hash, os_endorsement_key1_sign_data,
+    os_endorsement_key2_derive_sign_data,
+};
+use crate::ecc::CxError;
+use crate::merkle::{leaf_hash, MerkleTree, TreeBuilder};
+
+/// Longest DER signature of the endorsement keys
+pub const MAX_SIGNATURE_LEN: usize = 72;
+
+/// Endorsement key signing
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub enum Key {
+    /// Endorsement key 1, signing the data with the code hash
+    One,
+    /// Key derived from the endorsement key 2 and the code hash
+    Two,
+}
+
+static mut CODE_HASH: Option<[u8; 32]> = None;
+
+/// Hash of the code of the app, as signed by the endorsement keys. Read
+/// from the OS once, on first use.
+pub fn code_hash() -> &'static [u8; 32] {
+    // Apps are single-threaded
+    let cached = unsafe { &mut *core::ptr::addr_of_mut!(CODE_HASH) };
+    cached.get_or_insert_with(|| {
+        let mut hash = [0u8; 32];
+        unsafe { os_endorsement_get_code_hash(hash.as_mut_ptr()) };
+        hash
+    })
+}
+
+/// Sign `data` with the endorsement `key`, into `sig`, returning the length
+/// of the signature
+pub fn sign(key: Key, data: &[u8], sig: &mut [u8; MAX_SIGNATURE_LEN]) -> usize {
+    // The OS takes the data as mutable
+    let src = data.as_ptr() as *mut u8;
+    let len = unsafe {
+        match key {
+            Key::One => os_endorsement_key1_sign_data(src, data.len() as u32, sig.as_mut_ptr()),
+            Key::Two => {
+                os_endorsement_key2_derive_sign_data(src, data.len() as u32, sig.as_mut_ptr())
+            }
+        }
+    };
+    (len as usize).min(MAX_SIGNATURE_LEN)
+}
+
+/// Items attested together with one endorsement signature over the root
+/// of their Merkle tree
+#[derive(Default)]
+pub struct Batch {
+    tree: TreeBuilder,
+}
+
+impl Batch {
+    pub const fn new() -> Self {
+        Batch {
+            tree: TreeBuilder::new(),
+        }
+    }
+
+    /// Add `item`, as the leaf `SHA-256(0x00 || item)`
+    pub fn push(&mut self, item: &[u8]) -> Result<(), CxError> {
+        self.tree.push(leaf_hash(item)?)
+    }
+
+    /// Add an item already hashed as a leaf, for instance streamed into a
+    /// [`crate::merkle::leaf_hasher`]
+    pub fn push_leaf(&mut self, leaf_hash: [u8; 32]) -> Result<(), CxError> {
+        self.tree.push(leaf_hash)
+    }
+
+    /// Number of items added
+    pub fn len(&self) -> u32 {
+        self.tree.size()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Tree of the items added so far
+    pub fn tree(&self) -> Result<MerkleTree, CxError> {
+        self.tree.tree()
+    }
+
+    /// Sign the root of the tree of the items with `key`, into `sig`,
+    /// returning the tree and the length of the signature
+    pub fn sign(
+        &self,
+        key: Key,
+        sig: &mut [u8; MAX_SIGNATURE_LEN],
+    ) -> Result<(MerkleTree, usize), CxError> {
+        let tree = self.tree()?;
+        let len = sign(key, &tree.root, sig);
+        Ok((tree, len))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::merkle::root;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn batch_signature() {
+        let mut batch = Batch::new();
+        let items: [&[u8]; 3] = [b"key 0", b"key 1", b"key 2"];
+        let mut leaves = [[0u8; 32]; 3];
+        for (item, leaf) in items.iter().zip(leaves.iter_mut()) {
+            batch.push(item).map_err(|_| ())?;
+            *leaf = leaf_hash(item).map_err(|_| ())?;
+        }
+        let mut sig = [0u8; MAX_SIGNATURE_LEN];
+        let (tree, len) = batch.sign(Key::One, &mut sig).map_err(|_| ())?;
+        assert_eq!(Some(tree.root), root(&leaves).ok());
+        assert_eq!(tree.size, 3);
+        // A DER sequence
+        assert_eq!((len > 8, sig[0]), (true, 0x30));
+        assert_eq!(code_hash(), code_hash());
+    }
+}
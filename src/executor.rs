@@ -0,0 +1,171 @@
+//! Single-threaded executor running an APDU handler as a future
+//!
+//! [`Comm::next_event`] blocks until the MCU sends an event of interest, and
+//! the MCU is not serviced at all while a handler computes. With an
+//! [`Executor`], long computations are written as a future which awaits
+//! [`Executor::yield_now`] between chunks of work: each yield services one
+//! message from the MCU, so that USB traffic and tickers keep being
+//! processed, and returns the button presses received meanwhile.
+//!
+//! The future is polled in place within [`Executor::block_on`], without
+//! any stack or allocation of its own: it is woken whenever the executor
+//! has processed a message from the MCU.
+//!
+//! # Examples
+//!
+//! ```
+//! let exec = Executor::new(&mut comm);
+//! let digest = exec.block_on(async {
+//!     let mut h = Sha256::new();
+//!     for chunk in payload.chunks(256) {
+//!         h.update(chunk)?;
+//!         if let Some(Event::Button(ButtonEvent::BothButtonsRelease)) = exec.yield_now::<u8>().await {
+//!             return Err(CxError::GenericError);
+//!         }
+//!     }
+//!     h.finalize()
+//! });
+//! exec.with_comm(|comm| comm.append(&digest?));
+//! ```
+//!
+//! A yield only blocks when the MCU owes the app a message, until the next
+//! one is sent, which is at most one ticker period.
+
+use crate::io::{Comm, Event};
+use crate::seph;
+use core::cell::{Cell, RefCell};
+use core::future::Future;
+use core::pin::pin;
+use core::task::{Context, Poll, RawWaker, RawWakerVTable, Waker};
+
+/// What the pending future waits for
+#[derive(Copy, Clone, PartialEq)]
+enum Wait {
+    Nothing,
+    Yield,
+    Event,
+}
+
+/// Executor driving a future and the SEPH exchanges with the MCU
+pub struct Executor<'a, const N: usize> {
+    comm: RefCell<&'a mut Comm<N>>,
+    wait: Cell<Wait>,
+    /// Event received for the pending future
+    event: Cell<Option<Event<u8>>>,
+}
+
+// The executor polls again after each message: wakers are not used
+const VTABLE: RawWakerVTable = RawWakerVTable::new(|_| RAW_WAKER, |_| (), |_| (), |_| ());
+const RAW_WAKER: RawWaker = RawWaker::new(core::ptr::null(), &VTABLE);
+
+impl<'a, const N: usize> Executor<'a, N> {
+    pub fn new(comm: &'a mut Comm<N>) -> Self {
+        Executor {
+            comm: RefCell::new(comm),
+            wait: Cell::new(Wait::Nothing),
+            event: Cell::new(None),
+        }
+    }
+
+    /// Run `f` with the `Comm`, to read the APDU or write the response.
+    /// It must not be called again from within `f`.
+    pub fn with_comm<R>(&self, f: impl FnOnce(&mut Comm<N>) -> R) -> R {
+        f(&mut self.comm.borrow_mut())
+    }
+
+    /// Run `future` to completion
+    pub fn block_on<F: Future>(&self, future: F) -> F::Output {
+        let waker = unsafe { Waker::from_raw(RAW_WAKER) };
+        let mut cx = Context::from_waker(&waker);
+        let mut future = pin!(future);
+        loop {
+            if let Poll::Ready(output) = future.as_mut().poll(&mut cx) {
+                return output;
+            }
+            match self.wait.replace(Wait::Nothing) {
+                Wait::Yield => self.service(),
+                Wait::Event => self.wait_event(),
+                // Pending on something else than the executor: try again
+                Wait::Nothing => (),
+            }
+        }
+    }
+
+    /// Process one message from the MCU, or acknowledge the last one
+    fn service(&self) {
+        let mut comm = self.comm.borrow_mut();
+        if !seph::is_status_sent() {
+            seph::send_general_status();
+            return;
+        }
+        let comm = &mut *comm;
+        seph::seph_recv(&mut comm.seph_buffer, 0);
+        if seph::dispatch(&mut comm.apdu_buffer, &comm.seph_buffer) {
+            let event = seph::Events::from(comm.seph_buffer[0]);
+            self.event.set(comm.decode_event(event));
+        }
+    }
+
+    /// Process messages from the MCU until one is of interest to the app
+    fn wait_event(&self) {
+        let mut comm = self.comm.borrow_mut();
+        let comm = &mut *comm;
+        loop {
+            let event = seph::next_app_event(&mut comm.apdu_buffer, &mut comm.seph_buffer);
+            if let Some(event) = comm.decode_event(event) {
+                self.event.set(Some(event));
+                return;
+            }
+        }
+    }
+
+    /// Let the executor process one message from the MCU. Returns the event
+    /// it carried, if any.
+    pub async fn yield_now<T: TryFrom<u8>>(&self) -> Option<Event<T>> {
+        Suspend(self, Wait::Yield).await;
+        self.event.take().and_then(|event| self.convert(event))
+    }
+
+    /// Same as [`Comm::next_event`]
+    pub async fn next_event<T: TryFrom<u8>>(&self) -> Event<T> {
+        self.comm.borrow_mut().reset_apdu_state();
+        loop {
+            if let Some(event) = self.event.take().and_then(|event| self.convert(event)) {
+                return event;
+            }
+            Suspend(self, Wait::Event).await;
+        }
+    }
+
+    fn convert<T: TryFrom<u8>>(&self, event: Event<u8>) -> Option<Event<T>> {
+        Some(match event {
+            Event::Command(ins) => match T::try_from(ins) {
+                Ok(ins) => Event::Command(ins),
+                Err(_) => {
+                    // As in `Comm::decode_event`
+                    self.with_comm(|comm| comm.reply(crate::io::StatusWords::BadCla));
+                    return None;
+                }
+            },
+            Event::Button(button) => Event::Button(button),
+            Event::Ticker => Event::Ticker,
+            Event::UxEvent => Event::UxEvent,
+        })
+    }
+}
+
+/// Future pending once, telling the executor what to do before polling again
+struct Suspend<'e, 'a, const N: usize>(&'e Executor<'a, N>, Wait);
+
+impl<const N: usize> Future for Suspend<'_, '_, N> {
+    type Output = ();
+
+    fn poll(mut self: core::pin::Pin<&mut Self>, _cx: &mut Context) -> Poll<()> {
+        if self.1 == Wait::Nothing {
+            return Poll::Ready(());
+        }
+        self.0.wait.set(self.1);
+        self.1 = Wait::Nothing;
+        Poll::Pending
+    }
+}
@@ -0,0 +1,218 @@
+//! Decimal formatting of integers and fixed-point amounts
+//!
+//! Cortex-M0 has no divide instruction, so the usual `% 10` loop on a
+//! `u128` calls the runtime division once per digit. Here numbers are split
+//! into base 10^9 chunks, each one divided by 10^9 through a multiplication
+//! by its reciprocal, and the 9 digits of a chunk are taken out with
+//! multiplications by fixed-point reciprocals of 10^4, 100 and 10:
+//!
+//! ```
+//! let mut buf = [0u8; 48];
+//! // "1,234.5"
+//! let amount = format::format_amount(1_234_500_000u128, 6, Some(b','), &mut buf)?;
+//! ```
+
+/// The output buffer is too small for the formatted number
+#[derive(Debug, PartialEq, Eq)]
+pub struct FormatError;
+
+/// Digits of a `u128`
+const MAX_DIGITS: usize = 39;
+
+const CHUNK: u32 = 1_000_000_000;
+/// floor(2^64 / 10^9)
+const CHUNK_RECIPROCAL: u64 = 18_446_744_073;
+
+/// High 64 bits of `a * b`, from 32-bit products
+fn mul_high(a: u64, b: u64) -> u64 {
+    let (a1, a0) = (a >> 32, a & 0xffff_ffff);
+    let (b1, b0) = (b >> 32, b & 0xffff_ffff);
+    let mid1 = a1 * b0;
+    let mid2 = a0 * b1;
+    let low = a0 * b0;
+    let carry = ((low >> 32) + (mid1 & 0xffff_ffff) + (mid2 & 0xffff_ffff)) >> 32;
+    a1 * b1 + (mid1 >> 32) + (mid2 >> 32) + carry
+}
+
+/// Quotient and remainder of `n` by 10^9. The reciprocal being rounded
+/// down, the quotient estimate is short by at most 1.
+fn div_rem_chunk(n: u64) -> (u64, u32) {
+    let mut q = mul_high(n, CHUNK_RECIPROCAL);
+    let mut r = n - q * CHUNK as u64;
+    if r >= CHUNK as u64 {
+        q += 1;
+        r -= CHUNK as u64;
+    }
+    (q, r as u32)
+}
+
+/// Write the 9 digits of `chunk`, below 10^9, into `out`
+fn chunk_digits(chunk: u32, out: &mut [u8; 9]) {
+    // x / 10^4, exact for all u32
+    let high = ((chunk as u64 * 0xd1b7_1759) >> 45) as u32;
+    let low = chunk - high * 10_000;
+    let first = ((high as u64 * 0xd1b7_1759) >> 45) as u32;
+    out[0] = b'0' + first as u8;
+    four_digits(high - first * 10_000, &mut out[1..5]);
+    four_digits(low, &mut out[5..9]);
+}
+
+/// Write the 4 digits of `n`, below 10^4, into `out`
+fn four_digits(n: u32, out: &mut [u8]) {
+    // Exact below 43699 and 179
+    let hundreds = (n * 5243) >> 19;
+    let rest = n - hundreds * 100;
+    let d0 = (hundreds * 103) >> 10;
+    let d2 = (rest * 103) >> 10;
+    out[0] = b'0' + d0 as u8;
+    out[1] = b'0' + (hundreds - d0 * 10) as u8;
+    out[2] = b'0' + d2 as u8;
+    out[3] = b'0' + (rest - d2 * 10) as u8;
+}
+
+/// Decimal digits of `n`, without leading zeros, at the end of `buf`.
+/// Returns the offset of the first digit.
+fn digits(n: u128, buf: &mut [u8; MAX_DIGITS + 6]) -> usize {
+    // Little-endian 32-bit limbs, divided by 10^9 in turn
+    let mut limbs = [
+        n as u32,
+        (n >> 32) as u32,
+        (n >> 64) as u32,
+        (n >> 96) as u32,
+    ];
+    let mut top = limbs.iter().rposition(|&l| l != 0).map_or(0, |i| i + 1);
+    let mut end = buf.len();
+    loop {
+        let mut rem = 0u32;
+        for limb in limbs[..top].iter_mut().rev() {
+            let (q, r) = div_rem_chunk((rem as u64) << 32 | *limb as u64);
+            *limb = q as u32;
+            rem = r;
+        }
+        while top > 0 && limbs[top - 1] == 0 {
+            top -= 1;
+        }
+        let mut chunk = [0u8; 9];
+        chunk_digits(rem, &mut chunk);
+        buf[end - 9..end].copy_from_slice(&chunk);
+        end -= 9;
+        if top == 0 {
+            break;
+        }
+    }
+    // Leading zeros of the last chunk, keeping one digit
+    while end < buf.len() - 1 && buf[end] == b'0' {
+        end += 1;
+    }
+    end
+}
+
+/// Output buffer being filled
+struct Out<'a> {
+    buf: &'a mut [u8],
+    len: usize,
+}
+
+impl<'a> Out<'a> {
+    fn push(&mut self, c: u8) -> Result<(), FormatError> {
+        *self.buf.get_mut(self.len).ok_or(FormatError)? = c;
+        self.len += 1;
+        Ok(())
+    }
+
+    fn into_str(self) -> &'a str {
+        // Only ASCII characters are pushed
+        unsafe { core::str::from_utf8_unchecked(&self.buf[..self.len]) }
+    }
+}
+
+/// Decimal representation of `n`
+pub fn format_u128(n: u128, out: &mut [u8]) -> Result<&str, FormatError> {
+    format_amount(n, 0, None, out)
+}
+
+/// Decimal representation of `n`
+pub fn format_u64(n: u64, out: &mut [u8]) -> Result<&str, FormatError> {
+    format_amount(n as u128, 0, None, out)
+}
+
+/// Decimal representation of `n / 10^decimals`, with `separator` between
+/// the groups of 3 digits of the integer part if any, and the fractional
+/// part, after a `.`, without trailing zeros:
+/// `format_amount(1_500_000, 6, None, ..)` is `"1.5"`, and
+/// `format_amount(3_000_000, 6, None, ..)` is `"3"`.
+pub fn format_amount(
+    n: u128,
+    decimals: usize,
+    separator: Option<u8>,
+    out: &mut [u8],
+) -> Result<&str, FormatError> {
+    let mut buf = [0u8; MAX_DIGITS + 6];
+    let start = digits(n, &mut buf);
+    let digits = &buf[start..];
+    let (int, frac_digits, frac_zeros) = match digits.len().checked_sub(decimals) {
+        Some(0) | None => (&b"0"[..], digits, decimals - digits.len()),
+        Some(i) => (&digits[..i], &digits[i..], 0),
+    };
+    let frac_len = frac_digits
+        .iter()
+        .rposition(|&d| d != b'0')
+        .map_or(0, |i| i + 1);
+
+    let mut out = Out { buf: out, len: 0 };
+    for (i, &d) in int.iter().enumerate() {
+        if let Some(sep) = separator {
+            if i != 0 && (int.len() - i) % 3 == 0 {
+                out.push(sep)?;
+            }
+        }
+        out.push(d)?;
+    }
+    if frac_len > 0 {
+        out.push(b'.')?;
+        for _ in 0..frac_zeros {
+            out.push(b'0')?;
+        }
+        for &d in &frac_digits[..frac_len] {
+            out.push(d)?;
+        }
+    }
+    Ok(out.into_str())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn integers() {
+        let mut buf = [0u8; 40];
+        assert_eq!(format_u64(0, &mut buf), Ok("0"));
+        assert_eq!(format_u64(1_000_000_000, &mut buf), Ok("1000000000"));
+        assert_eq!(format_u64(u64::MAX, &mut buf), Ok("18446744073709551615"));
+        assert_eq!(
+            format_u128(u128::MAX, &mut buf),
+            Ok("340282366920938463463374607431768211455")
+        );
+        assert_eq!(format_u64(123_456, &mut buf[..5]), Err(FormatError));
+    }
+
+    #[test]
+    fn amounts() {
+        let mut buf = [0u8; 48];
+        assert_eq!(
+            format_amount(1_234_500_000, 6, Some(b','), &mut buf),
+            Ok("1,234.5")
+        );
+        assert_eq!(format_amount(3_000_000, 6, None, &mut buf), Ok("3"));
+        assert_eq!(format_amount(42, 6, None, &mut buf), Ok("0.000042"));
+        assert_eq!(format_amount(0, 18, None, &mut buf), Ok("0"));
+        assert_eq!(
+            format_amount(123_456_789_000_000_000_000_000, 18, Some(b' '), &mut buf),
+            Ok("123 456.789")
+        );
+    }
+}
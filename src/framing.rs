@@ -0,0 +1,332 @@
+//! APDU framing shared by the HID and BLE transports
+//!
+//! Both transports split APDUs into frames with the same layout:
+//!
+//! | channel (2) | tag (1) | sequence (2) | length (2, first frame only) | data |
+//!
+//! [`Framer`] holds the reassembly and segmentation state of one transport.
+//! Its layout matches `ledger_framing_t` from os_io_framing.h so that the C
+//! transport code can own the state and drive it through the
+//! `ledger_framing_*` functions below, while control tags (version, channel
+//! allocation, ping, MTU) and the transport I/O remain handled in C.
+
+/// Get protocol version
+pub const TAG_GET_VERSION: u8 = 0x00;
+/// Allocate channel
+pub const TAG_ALLOCATE_CHANNEL: u8 = 0x01;
+/// Ping
+pub const TAG_PING: u8 = 0x02;
+/// APDU data frame
+pub const TAG_APDU: u8 = 0x05;
+/// Get MTU (BLE only)
+pub const TAG_MTU: u8 = 0x08;
+
+/// Header length of the first frame of an APDU
+const FIRST_HEADER_LEN: usize = 7;
+/// Header length of the following frames
+const NEXT_HEADER_LEN: usize = 5;
+
+/// Result of feeding a frame to [`Framer::receive`]
+#[repr(u8)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum RxStatus {
+    /// Invalid or out of sequence frame: reception starts over
+    Reset = 0,
+    /// Valid frame, more are expected
+    MoreData = 1,
+    /// Last frame of the APDU
+    Received = 2,
+}
+
+/// Framing state of one transport
+#[repr(C)]
+#[derive(Default)]
+pub struct Framer {
+    /// Channel of the last APDU received, used for the response
+    pub channel: u16,
+    /// Sequence number of the next expected frame
+    pub rx_sequence: u16,
+    /// Total length of the APDU being received
+    pub rx_length: u16,
+    /// Length received so far
+    pub rx_offset: u16,
+    /// Sequence number of the next frame to send
+    pub tx_sequence: u16,
+    /// Total length of the APDU being sent
+    pub tx_length: u16,
+    /// Length sent so far
+    pub tx_offset: u16,
+}
+
+impl Framer {
+    pub const fn new() -> Self {
+        Framer {
+            channel: 0,
+            rx_sequence: 0,
+            rx_length: 0,
+            rx_offset: 0,
+            tx_sequence: 0,
+            tx_length: 0,
+            tx_offset: 0,
+        }
+    }
+
+    fn reset_rx(&mut self) -> RxStatus {
+        #[cfg(feature = "io_stats")]
+        crate::io_stats::dropped_frame();
+        self.rx_sequence = 0;
+        RxStatus::Reset
+    }
+
+    /// Append the data of an APDU `frame` to `apdu`.
+    ///
+    /// The first frame is rejected if the announced length does not fit in
+    /// `apdu`, and so are the following ones if `apdu` has been replaced by
+    /// a smaller buffer in between. Once the APDU is received, `rx_length`
+    /// and `rx_offset` both hold its length until the next first frame.
+    ///
+    /// A frame out of sequence resets the reception, except a first frame,
+    /// which starts it over: a host noticing a lost frame, which it has no
+    /// acknowledgement of with BLE write commands, can send the APDU again
+    /// right away.
+    #[optimize(speed)]
+    pub fn receive(&mut self, frame: &[u8], apdu: &mut [u8]) -> RxStatus {
+        if frame.len() < NEXT_HEADER_LEN || frame[2] != TAG_APDU {
+            return self.reset_rx();
+        }
+        let sequence = u16::from_be_bytes([frame[3], frame[4]]);
+        if sequence == 0 {
+            self.rx_sequence = 0;
+        } else if sequence != self.rx_sequence {
+            return self.reset_rx();
+        }
+        let data = if self.rx_sequence == 0 {
+            if frame.len() < FIRST_HEADER_LEN {
+                return self.reset_rx();
+            }
+            self.rx_length = u16::from_be_bytes([frame[5], frame[6]]);
+            self.rx_offset = 0;
+            self.channel = u16::from_be_bytes([frame[0], frame[1]]);
+            &frame[FIRST_HEADER_LEN..]
+        } else {
+            &frame[NEXT_HEADER_LEN..]
+        };
+        if self.rx_length as usize > apdu.len() {
+            return self.reset_rx();
+        }
+
+        // Padding after the end of the APDU is ignored
+        let offset = self.rx_offset as usize;
+        let len = data.len().min(self.rx_length as usize - offset);
+        apdu[offset..offset + len].copy_from_slice(&data[..len]);
+        self.rx_offset += len as u16;
+
+        if self.rx_offset == self.rx_length {
+            self.rx_sequence = 0;
+            RxStatus::Received
+        } else {
+            self.rx_sequence = self.rx_sequence.wrapping_add(1);
+            RxStatus::MoreData
+        }
+    }
+
+    /// Start sending a `len` bytes APDU on the channel of the last command
+    pub fn start_send(&mut self, len: u16) {
+        self.tx_sequence = 0;
+        self.tx_length = len;
+        self.tx_offset = 0;
+    }
+
+    /// Whether frames of the APDU remain to be built
+    pub fn tx_pending(&self) -> bool {
+        self.tx_offset < self.tx_length
+    }
+
+    /// Build the next frame of the APDU being sent from `apdu` into `frame`,
+    /// whose length is the packet size of the transport. Returns the length
+    /// of the frame, or 0 if everything has been sent.
+    #[optimize(speed)]
+    pub fn next_frame(&mut self, apdu: &[u8], frame: &mut [u8]) -> usize {
+        if !self.tx_pending() || frame.len() <= FIRST_HEADER_LEN {
+            return 0;
+        }
+        frame[..2].copy_from_slice(&self.channel.to_be_bytes());
+        frame[2] = TAG_APDU;
+        frame[3..5].copy_from_slice(&self.tx_sequence.to_be_bytes());
+        let header = if self.tx_sequence == 0 {
+            frame[5..7].copy_from_slice(&self.tx_length.to_be_bytes());
+            FIRST_HEADER_LEN
+        } else {
+            NEXT_HEADER_LEN
+        };
+
+        let offset = self.tx_offset as usize;
+        let len = (frame.len() - header).min(self.tx_length as usize - offset);
+        frame[header..header + len].copy_from_slice(&apdu[offset..offset + len]);
+        self.tx_offset += len as u16;
+        self.tx_sequence = self.tx_sequence.wrapping_add(1);
+        header + len
+    }
+}
+
+/// `ledger_framing_receive` from os_io_framing.h
+///
+/// # Safety
+///
+/// `frame` must be valid for `frame_len` bytes, and `apdu`, unless null, for
+/// `apdu_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn ledger_framing_receive(
+    framer: *mut Framer,
+    frame: *const u8,
+    frame_len: u16,
+    apdu: *mut u8,
+    apdu_len: u16,
+) -> u8 {
+    let frame = core::slice::from_raw_parts(frame, frame_len as usize);
+    // No receive buffer has been set yet
+    let apdu = if apdu.is_null() {
+        &mut [][..]
+    } else {
+        core::slice::from_raw_parts_mut(apdu, apdu_len as usize)
+    };
+    (*framer).receive(frame, apdu) as u8
+}
+
+/// `ledger_framing_send` from os_io_framing.h
+///
+/// # Safety
+///
+/// `framer` must point to a valid `ledger_framing_t`.
+#[no_mangle]
+pub unsafe extern "C" fn ledger_framing_send(framer: *mut Framer, len: u16) {
+    (*framer).start_send(len);
+}
+
+/// `ledger_framing_next_frame` from os_io_framing.h
+///
+/// # Safety
+///
+/// `apdu` must be valid for the length given to `ledger_framing_send`, and
+/// `frame` for `packet_size` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn ledger_framing_next_frame(
+    framer: *mut Framer,
+    apdu: *const u8,
+    frame: *mut u8,
+    packet_size: u16,
+) -> u16 {
+    let framer = &mut *framer;
+    if !framer.tx_pending() {
+        return 0;
+    }
+    let apdu = core::slice::from_raw_parts(apdu, framer.tx_length as usize);
+    let frame = core::slice::from_raw_parts_mut(frame, packet_size as usize);
+    framer.next_frame(apdu, frame) as u16
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::{bench, TestType};
+    use testmacro::test_item as test;
+
+    #[test]
+    fn round_trip() {
+        let mut msg = [0u8; 150];
+        msg.iter_mut().enumerate().for_each(|(i, b)| *b = i as u8);
+
+        let mut tx = Framer::new();
+        tx.channel = 0x0101;
+        tx.start_send(msg.len() as u16);
+        let mut rx = Framer::new();
+        let mut apdu = [0u8; 255];
+        let mut frame = [0u8; 64];
+        let mut status = RxStatus::Reset;
+        let mut frames = 0;
+        loop {
+            let len = tx.next_frame(&msg, &mut frame);
+            if len == 0 {
+                break;
+            }
+            frames += 1;
+            status = rx.receive(&frame[..len], &mut apdu);
+        }
+        assert_eq!(frames, 3);
+        assert_eq!(status, RxStatus::Received);
+        assert_eq!(rx.channel, 0x0101);
+        assert_eq!(rx.rx_length, 150);
+        assert_eq!(&apdu[..150], &msg[..]);
+    }
+
+    #[test]
+    fn bench_receive() {
+        let msg = [0x5au8; 255];
+        let mut tx = Framer::new();
+        let mut rx = Framer::new();
+        let mut apdu = [0u8; 255];
+        let mut frame = [0u8; 64];
+        bench("framing 255-byte APDU", 100, || {
+            tx.start_send(msg.len() as u16);
+            loop {
+                let len = tx.next_frame(&msg, &mut frame);
+                if len == 0 {
+                    break;
+                }
+                rx.receive(&frame[..len], &mut apdu);
+            }
+        });
+        assert_eq!(&apdu[..], &msg[..]);
+    }
+
+    #[test]
+    fn rejected_frames() {
+        let mut rx = Framer::new();
+        let mut apdu = [0u8; 4];
+        // Announced length larger than the buffer
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 0, 0, 5, 1], &mut apdu),
+            RxStatus::Reset
+        );
+        // Out of sequence frame
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 1, 1, 2], &mut apdu),
+            RxStatus::Reset
+        );
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 0, 0, 3, 1], &mut apdu),
+            RxStatus::MoreData
+        );
+        // Padding is ignored
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 1, 2, 3, 0, 0], &mut apdu),
+            RxStatus::Received
+        );
+        assert_eq!(&apdu[..3], &[1, 2, 3]);
+    }
+
+    #[test]
+    fn restarted_apdu() {
+        let mut rx = Framer::new();
+        let mut apdu = [0u8; 4];
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 0, 0, 4, 1, 2], &mut apdu),
+            RxStatus::MoreData
+        );
+        // Frame 1 lost, the APDU is sent again
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 2, 4], &mut apdu),
+            RxStatus::Reset
+        );
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 0, 0, 4, 5, 6], &mut apdu),
+            RxStatus::MoreData
+        );
+        assert_eq!(
+            rx.receive(&[0, 0, TAG_APDU, 0, 1, 7, 8], &mut apdu),
+            RxStatus::Received
+        );
+        assert_eq!(&apdu[..], &[5, 6, 7, 8]);
+    }
+}
@@ -0,0 +1,865 @@
+//! Streaming hash functions
+//!
+//! Each hash function has its own context type, allocated on the stack, that
+//! can be fed incrementally, for instance as APDU chunks are received, instead
+//! of buffering the whole message for a one-shot hash.
+//!
+//! # Examples
+//!
+//! ```
+//! let mut h = Sha256::new();
+//! h.update(b"first chunk")?;
+//! h.update(b"second chunk")?;
+//! let digest = h.finalize()?;
+//! ```
+//!
+//! APDU data can be hashed straight from the [`Comm`](crate::io::Comm)
+//! buffer, without copying it, with `h.update(comm.get_data()?)`.
+//!
+//! Contexts can be cloned to snapshot the state after a common prefix, and
+//! hash several messages starting with it without hashing it again, e.g.
+//! an EIP-712 struct hashed under several domains:
+//!
+//! ```
+//! let mut prefix = Keccak256::new();
+//! prefix.update(&[0x19, 0x01])?;
+//! for domain in domains {
+//!     let mut h = prefix.clone();
+//!     h.update(domain)?;
+//!     h.update(&struct_hash)?;
+//!     digests.push(h.finalize()?);
+//! }
+//! ```
+
+use crate::bindings::*;
+use crate::ecc::CxError;
+use crate::trampoline::{cx_hash_final, cx_hash_update};
+
+/// Common operations of all streaming hash contexts
+pub trait HashFn {
+    /// Size of the digest in bytes
+    fn digest_size(&self) -> usize;
+
+    /// Hash `input`, appending it to the data hashed so far
+    fn update(&mut self, input: &[u8]) -> Result<(), CxError>;
+
+    /// Write the digest of all the data hashed so far into `digest`, which
+    /// must be at least `digest_size()` bytes long. The context must be
+    /// reset before being used again.
+    fn finalize_into(&mut self, digest: &mut [u8]) -> Result<(), CxError>;
+
+    /// Start a new hash computation
+    fn reset(&mut self) -> Result<(), CxError>;
+}
+
+/// Generates a streaming hash type over a cxlib context. `$init` is the
+/// initialization function of the context, called as `$init(ctx, $($arg)?)`.
+macro_rules! impl_hash {
+    ($(#[$doc:meta])* $typename:ident, $ctx:ty, $size:expr, $init:ident $(, $arg:expr)?) => {
+        $(#[$doc])*
+        #[derive(Clone)]
+        pub struct $typename {
+            ctx: $ctx,
+        }
+
+        impl $typename {
+            /// Size of the digest in bytes
+            pub const DIGEST_SIZE: usize = $size;
+
+            pub fn new() -> Self {
+                let mut h = $typename {
+                    ctx: <$ctx>::default(),
+                };
+                // Initialization only fails on invalid parameters, which
+                // are fixed here.
+                let _ = h.reset();
+                h
+            }
+
+            /// Return the digest of all the data hashed so far
+            pub fn finalize(mut self) -> Result<[u8; $size], CxError> {
+                let mut digest = [0u8; $size];
+                self.finalize_into(&mut digest)?;
+                Ok(digest)
+            }
+
+            /// One-shot hash of `input`
+            pub fn hash(input: &[u8]) -> Result<[u8; $size], CxError> {
+                let mut h = Self::new();
+                h.update(input)?;
+                h.finalize()
+            }
+
+            /// Copy of the current state, to fork the computation after a
+            /// common prefix
+            pub fn clone_state(&self) -> Self {
+                self.clone()
+            }
+
+            /// Go back to the `state` returned by [`Self::clone_state`]
+            pub fn restore_state(&mut self, state: &Self) {
+                self.ctx = state.ctx;
+            }
+        }
+
+        impl Default for $typename {
+            fn default() -> Self {
+                Self::new()
+            }
+        }
+
+        impl HashFn for $typename {
+            fn digest_size(&self) -> usize {
+                $size
+            }
+
+            fn update(&mut self, input: &[u8]) -> Result<(), CxError> {
+                crate::trace_span!("cx_hash_update");
+                crate::cx_profile!("cx_hash_update");
+                let err = unsafe {
+                    cx_hash_update(
+                        &mut self.ctx.header,
+                        input.as_ptr(),
+                        input.len() as u32,
+                    )
+                };
+                if err != CX_OK {
+                    Err(err.into())
+                } else {
+                    Ok(())
+                }
+            }
+
+            fn finalize_into(&mut self, digest: &mut [u8]) -> Result<(), CxError> {
+                if digest.len() < $size {
+                    return Err(CxError::InvalidParameterSize);
+                }
+                crate::trace_span!("cx_hash_final");
+                crate::cx_profile!("cx_hash_final");
+                let err = unsafe { cx_hash_final(&mut self.ctx.header, digest.as_mut_ptr()) };
+                if err != CX_OK {
+                    Err(err.into())
+                } else {
+                    Ok(())
+                }
+            }
+
+            fn reset(&mut self) -> Result<(), CxError> {
+                let err = unsafe { $init(&mut self.ctx $(, $arg)?) };
+                if err != CX_OK {
+                    Err(err.into())
+                } else {
+                    Ok(())
+                }
+            }
+        }
+    };
+}
+
+impl_hash!(Sha224, cx_sha256_t, 28, cx_sha224_init_no_throw);
+impl_hash!(Sha256, cx_sha256_t, 32, cx_sha256_init_no_throw);
+
+/// SHA-256 state after a whole number of 64-byte blocks, such as a BIP341
+/// tagged hash prefix. It only holds 36 bytes, so it can be kept for a
+/// whole multi-input signing session, and each input then only hashes its
+/// own suffix.
+#[derive(Copy, Clone)]
+pub struct Sha256Midstate {
+    acc: [u8; 32],
+    blocks: u32,
+}
+
+impl Sha256 {
+    /// Midstate of the context, if the data hashed so far is a whole
+    /// number of blocks
+    pub fn midstate(&self) -> Option<Sha256Midstate> {
+        (self.ctx.blen == 0).then_some(Sha256Midstate {
+            acc: self.ctx.acc,
+            blocks: self.ctx.header.counter,
+        })
+    }
+
+    /// Context resuming from `midstate`
+    pub fn from_midstate(midstate: &Sha256Midstate) -> Self {
+        let mut h = Self::new();
+        h.ctx.acc = midstate.acc;
+        h.ctx.header.counter = midstate.blocks;
+        h
+    }
+
+    /// Context of the BIP340 tagged hash `SHA256(SHA256(tag) || SHA256(tag) || ..)`
+    /// having hashed the prefix, which is exactly one block
+    pub fn tagged(tag: &[u8]) -> Result<Self, CxError> {
+        let tag = Self::hash(tag)?;
+        let mut h = Self::new();
+        h.update(&tag)?;
+        h.update(&tag)?;
+        Ok(h)
+    }
+
+    /// Hash `input` like [`HashFn::update`], but compress its whole blocks
+    /// in the app instead of going through the OS, which is cheaper from a
+    /// few blocks on: each syscall switches to the supervisor and copies
+    /// the context back and forth.
+    pub fn update_blocks(&mut self, mut input: &[u8]) -> Result<(), CxError> {
+        // Complete the pending block, if any, through the OS
+        if self.ctx.blen != 0 {
+            let n = (64 - self.ctx.blen as usize).min(input.len());
+            self.update(&input[..n])?;
+            input = &input[n..];
+        }
+        let whole = input.len() / 64 * 64;
+        if whole > 0 && self.ctx.blen == 0 {
+            // The accumulator holds the state as native words
+            let mut state = [0u32; 8];
+            for (w, acc) in state.iter_mut().zip(self.ctx.acc.chunks_exact(4)) {
+                *w = u32::from_ne_bytes([acc[0], acc[1], acc[2], acc[3]]);
+            }
+            sha256_compress(&mut state, &input[..whole]);
+            for (w, acc) in state.iter().zip(self.ctx.acc.chunks_exact_mut(4)) {
+                acc.copy_from_slice(&w.to_ne_bytes());
+            }
+            self.ctx.header.counter += (whole / 64) as u32;
+            input = &input[whole..];
+        }
+        self.update(input)
+    }
+}
+
+const SHA256_K: [u32; 64] = [
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+];
+
+/// SHA-256 compression of `blocks`, a whole number of 64-byte blocks, into
+/// `state`. The message schedule is kept as a rolling window of 16 words,
+/// so that the whole working set stays in 96 bytes of stack.
+#[inline(never)]
+pub(crate) fn sha256_compress(state: &mut [u32; 8], blocks: &[u8]) {
+    for block in blocks.chunks_exact(64) {
+        let mut w = [0u32; 16];
+        for (w, b) in w.iter_mut().zip(block.chunks_exact(4)) {
+            *w = u32::from_be_bytes([b[0], b[1], b[2], b[3]]);
+        }
+        let [mut a, mut b, mut c, mut d, mut e, mut f, mut g, mut h] = *state;
+        for (i, k) in SHA256_K.iter().enumerate() {
+            if i >= 16 {
+                let w15 = w[(i + 1) % 16];
+                let w2 = w[(i + 14) % 16];
+                let s0 = w15.rotate_right(7) ^ w15.rotate_right(18) ^ (w15 >> 3);
+                let s1 = w2.rotate_right(17) ^ w2.rotate_right(19) ^ (w2 >> 10);
+                w[i % 16] = w[i % 16]
+                    .wrapping_add(s0)
+                    .wrapping_add(w[(i + 9) % 16])
+                    .wrapping_add(s1);
+            }
+            let s1 = e.rotate_right(6) ^ e.rotate_right(11) ^ e.rotate_right(25);
+            let ch = (e & f) ^ (!e & g);
+            let t1 = h
+                .wrapping_add(s1)
+                .wrapping_add(ch)
+                .wrapping_add(*k)
+                .wrapping_add(w[i % 16]);
+            let s0 = a.rotate_right(2) ^ a.rotate_right(13) ^ a.rotate_right(22);
+            let maj = (a & b) ^ (a & c) ^ (b & c);
+            let t2 = s0.wrapping_add(maj);
+            h = g;
+            g = f;
+            f = e;
+            e = d.wrapping_add(t1);
+            d = c;
+            c = b;
+            b = a;
+            a = t1.wrapping_add(t2);
+        }
+        for (s, v) in state.iter_mut().zip([a, b, c, d, e, f, g, h]) {
+            *s = s.wrapping_add(v);
+        }
+    }
+}
+
+impl_hash!(Sha384, cx_sha512_t, 48, cx_sha384_init_no_throw);
+impl_hash!(Sha512, cx_sha512_t, 64, cx_sha512_init_no_throw);
+impl_hash!(Sha3_224, cx_sha3_t, 28, cx_sha3_init_no_throw, 224);
+impl_hash!(Sha3_256, cx_sha3_t, 32, cx_sha3_init_no_throw, 256);
+impl_hash!(Sha3_384, cx_sha3_t, 48, cx_sha3_init_no_throw, 384);
+impl_hash!(Sha3_512, cx_sha3_t, 64, cx_sha3_init_no_throw, 512);
+impl_hash!(
+    /// Original Keccak padding, as used by Ethereum
+    Keccak256,
+    cx_sha3_t,
+    32,
+    cx_keccak_init_no_throw,
+    256
+);
+impl_hash!(Blake2b256, cx_blake2b_t, 32, cx_blake2b_init_no_throw, 256);
+impl_hash!(Blake2b512, cx_blake2b_t, 64, cx_blake2b_init_no_throw, 512);
+impl_hash!(Ripemd160, cx_ripemd160_t, 20, cx_ripemd160_init_no_throw);
+
+/// BLAKE2b with a digest of `OUT` bytes, from 1 to 64, salted and
+/// personalized with up to 16 bytes each, such as the Zcash sighashes
+/// personalized with `"ZcashSigHash" || branch id`.
+///
+/// Clones are as cheap as those of the other contexts, so that the many
+/// hashes of a transaction sharing a personalization and a prefix can
+/// start from a common state.
+#[derive(Clone)]
+pub struct Blake2b<const OUT: usize> {
+    ctx: cx_blake2b_t,
+    salt: Option<[u8; 16]>,
+    personalization: Option<[u8; 16]>,
+}
+
+impl<const OUT: usize> Blake2b<OUT> {
+    /// Size of the digest in bytes
+    pub const DIGEST_SIZE: usize = OUT;
+
+    pub fn new() -> Self {
+        Self::init(None, None)
+    }
+
+    /// Context personalized with `personalization`
+    pub fn with_personalization(personalization: &[u8; 16]) -> Self {
+        Self::init(None, Some(*personalization))
+    }
+
+    /// Context salted with `salt` and personalized with `personalization`
+    pub fn with_salt_and_personalization(salt: &[u8; 16], personalization: &[u8; 16]) -> Self {
+        Self::init(Some(*salt), Some(*personalization))
+    }
+
+    fn init(salt: Option<[u8; 16]>, personalization: Option<[u8; 16]>) -> Self {
+        assert!(OUT > 0 && OUT <= 64);
+        let mut h = Blake2b {
+            ctx: cx_blake2b_t::default(),
+            salt,
+            personalization,
+        };
+        // Initialization only fails on invalid parameters, which are
+        // checked here.
+        let _ = h.reset();
+        h
+    }
+
+    /// Return the digest of all the data hashed so far
+    pub fn finalize(mut self) -> Result<[u8; OUT], CxError> {
+        let mut digest = [0u8; OUT];
+        self.finalize_into(&mut digest)?;
+        Ok(digest)
+    }
+
+    /// Go back to the `state` previously cloned
+    pub fn restore_state(&mut self, state: &Self) {
+        self.ctx = state.ctx;
+    }
+}
+
+impl<const OUT: usize> Default for Blake2b<OUT> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const OUT: usize> HashFn for Blake2b<OUT> {
+    fn digest_size(&self) -> usize {
+        OUT
+    }
+
+    fn update(&mut self, input: &[u8]) -> Result<(), CxError> {
+        crate::trace_span!("cx_hash_update");
+        crate::cx_profile!("cx_hash_update");
+        let err =
+            unsafe { cx_hash_update(&mut self.ctx.header, input.as_ptr(), input.len() as u32) };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+
+    fn finalize_into(&mut self, digest: &mut [u8]) -> Result<(), CxError> {
+        if digest.len() < OUT {
+            return Err(CxError::InvalidParameterSize);
+        }
+        crate::trace_span!("cx_hash_final");
+        crate::cx_profile!("cx_hash_final");
+        let err = unsafe { cx_hash_final(&mut self.ctx.header, digest.as_mut_ptr()) };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+
+    fn reset(&mut self) -> Result<(), CxError> {
+        let err = match (&mut self.salt, &mut self.personalization) {
+            (None, None) => unsafe { cx_blake2b_init_no_throw(&mut self.ctx, (OUT * 8) as size_t) },
+            (salt, personalization) => {
+                let (salt, salt_len) = match salt {
+                    Some(salt) => (salt.as_mut_ptr(), salt.len()),
+                    None => (core::ptr::null_mut(), 0),
+                };
+                let (perso, perso_len) = match personalization {
+                    Some(perso) => (perso.as_mut_ptr(), perso.len()),
+                    None => (core::ptr::null_mut(), 0),
+                };
+                unsafe {
+                    cx_blake2b_init2_no_throw(
+                        &mut self.ctx,
+                        (OUT * 8) as size_t,
+                        salt,
+                        salt_len as size_t,
+                        perso,
+                        perso_len as size_t,
+                    )
+                }
+            }
+        };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+}
+
+#[cfg(target_os = "nanosplus")]
+mod blake3 {
+    use super::HashFn;
+    use crate::bindings::CX_OK;
+    use crate::ecc::CxError;
+
+    // Layout of `cx_blake3_t` from lcx_blake3.h
+    #[repr(C)]
+    #[derive(Clone)]
+    struct ChunkState {
+        cv: [u32; 8],
+        t: u64,
+        buffer: [u8; 64],
+        buffer_len: u8,
+        blocks_compressed: u8,
+        d: u8,
+    }
+
+    #[repr(C)]
+    #[derive(Clone)]
+    struct Context {
+        key: [u32; 8],
+        cv_stack: [u8; 11 * 32],
+        cv_stack_len: u8,
+        chunk: ChunkState,
+        is_init: bool,
+    }
+
+    extern "C" {
+        fn cx_blake3_init(
+            hash: *mut Context,
+            mode: u8,
+            key: *const u8,
+            context: *const u8,
+            context_len: u32,
+        ) -> u32;
+        fn cx_blake3_update(hash: *mut Context, input: *const u8, input_len: u32) -> u32;
+        fn cx_blake3_final(hash: *mut Context, output: *mut u8, out_len: u32) -> u32;
+    }
+
+    /// `KEYED_HASH` flag from cx_blake3.h
+    const KEYED_HASH: u8 = 1 << 4;
+
+    /// BLAKE3, only available on Nano S+ where it is linked into the app.
+    ///
+    /// Large inputs given to a single `update` call are hashed by whole
+    /// subtrees, so hashing a multi-kilobyte buffer at once is much cheaper
+    /// than feeding it block by block.
+    #[derive(Clone)]
+    pub struct Blake3 {
+        ctx: Context,
+        key: Option<[u8; 32]>,
+    }
+
+    impl Blake3 {
+        /// Size of the default digest in bytes
+        pub const DIGEST_SIZE: usize = 32;
+
+        pub fn new() -> Self {
+            Self::init(None)
+        }
+
+        /// Keyed hash mode, using a 32-byte key
+        pub fn new_keyed(key: &[u8; 32]) -> Self {
+            Self::init(Some(*key))
+        }
+
+        fn init(key: Option<[u8; 32]>) -> Self {
+            let mut h = Blake3 {
+                // All-zero is a valid (uninitialized) context
+                ctx: unsafe { core::mem::zeroed() },
+                key,
+            };
+            // Initialization only fails on invalid parameters, which are
+            // fixed here.
+            let _ = h.reset();
+            h
+        }
+
+        /// Return the digest of all the data hashed so far
+        pub fn finalize(mut self) -> Result<[u8; 32], CxError> {
+            let mut digest = [0u8; 32];
+            self.finalize_into(&mut digest)?;
+            Ok(digest)
+        }
+
+        /// Fill `output` with the extendable output of all the data hashed
+        /// so far, whatever its length.
+        pub fn finalize_xof(&mut self, output: &mut [u8]) -> Result<(), CxError> {
+            let err =
+                unsafe { cx_blake3_final(&mut self.ctx, output.as_mut_ptr(), output.len() as u32) };
+            if err != CX_OK {
+                Err(err.into())
+            } else {
+                Ok(())
+            }
+        }
+
+        /// One-shot hash of `input`
+        pub fn hash(input: &[u8]) -> Result<[u8; 32], CxError> {
+            let mut h = Self::new();
+            h.update(input)?;
+            h.finalize()
+        }
+    }
+
+    impl Default for Blake3 {
+        fn default() -> Self {
+            Self::new()
+        }
+    }
+
+    impl Drop for Blake3 {
+        fn drop(&mut self) {
+            if let Some(key) = self.key.as_mut() {
+                key.fill(0);
+                self.ctx.key.fill(0);
+            }
+        }
+    }
+
+    impl HashFn for Blake3 {
+        fn digest_size(&self) -> usize {
+            32
+        }
+
+        fn update(&mut self, input: &[u8]) -> Result<(), CxError> {
+            let err =
+                unsafe { cx_blake3_update(&mut self.ctx, input.as_ptr(), input.len() as u32) };
+            if err != CX_OK {
+                Err(err.into())
+            } else {
+                Ok(())
+            }
+        }
+
+        fn finalize_into(&mut self, digest: &mut [u8]) -> Result<(), CxError> {
+            if digest.len() < 32 {
+                return Err(CxError::InvalidParameterSize);
+            }
+            self.finalize_xof(&mut digest[..32])
+        }
+
+        fn reset(&mut self) -> Result<(), CxError> {
+            let (mode, key) = match &self.key {
+                Some(key) => (KEYED_HASH, key.as_ptr()),
+                None => (0, core::ptr::null()),
+            };
+            let err = unsafe { cx_blake3_init(&mut self.ctx, mode, key, core::ptr::null(), 0) };
+            if err != CX_OK {
+                Err(err.into())
+            } else {
+                Ok(())
+            }
+        }
+    }
+}
+
+#[cfg(target_os = "nanosplus")]
+pub use blake3::Blake3;
+
+/// Groestl with a digest of `OUT` bytes: 28, 32, 48 or 64. The OS exports
+/// it on Nano S, and its reference code is linked into Nano S+ apps.
+///
+/// The context holds no `cx_hash_t` header, so it is fed directly instead
+/// of through `cx_hash_update`, and like the other contexts it can be
+/// cloned after a common prefix.
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+#[derive(Clone)]
+pub struct Groestl<const OUT: usize> {
+    ctx: cx_groestl_t,
+}
+
+/// Groestl-256
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+pub type Groestl256 = Groestl<32>;
+
+/// Groestl-512, which Groestlcoin applies twice, keeping the first 32 bytes
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+pub type Groestl512 = Groestl<64>;
+
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+impl<const OUT: usize> Groestl<OUT> {
+    /// Size of the digest in bytes
+    pub const DIGEST_SIZE: usize = OUT;
+
+    pub fn new() -> Self {
+        assert!(matches!(OUT, 28 | 32 | 48 | 64));
+        let mut h = Groestl {
+            ctx: cx_groestl_t::default(),
+        };
+        // Initialization only fails on invalid sizes, which are checked
+        // here.
+        let _ = h.reset();
+        h
+    }
+
+    /// Return the digest of all the data hashed so far
+    pub fn finalize(mut self) -> Result<[u8; OUT], CxError> {
+        let mut digest = [0u8; OUT];
+        self.finalize_into(&mut digest)?;
+        Ok(digest)
+    }
+
+    /// One-shot hash of `input`
+    pub fn hash(input: &[u8]) -> Result<[u8; OUT], CxError> {
+        let mut h = Self::new();
+        h.update(input)?;
+        h.finalize()
+    }
+
+    /// Copy of the current state, to fork the computation after a common
+    /// prefix
+    pub fn clone_state(&self) -> Self {
+        self.clone()
+    }
+
+    /// Go back to the `state` returned by [`Self::clone_state`]
+    pub fn restore_state(&mut self, state: &Self) {
+        self.ctx = state.ctx;
+    }
+}
+
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+impl<const OUT: usize> Default for Groestl<OUT> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+impl<const OUT: usize> HashFn for Groestl<OUT> {
+    fn digest_size(&self) -> usize {
+        OUT
+    }
+
+    fn update(&mut self, input: &[u8]) -> Result<(), CxError> {
+        crate::trace_span!("cx_groestl_update");
+        crate::cx_profile!("cx_groestl_update");
+        let err =
+            unsafe { cx_groestl_update(&mut self.ctx, input.as_ptr(), input.len() as size_t) };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+
+    fn finalize_into(&mut self, digest: &mut [u8]) -> Result<(), CxError> {
+        if digest.len() < OUT {
+            return Err(CxError::InvalidParameterSize);
+        }
+        crate::trace_span!("cx_groestl_final");
+        crate::cx_profile!("cx_groestl_final");
+        let err = unsafe { cx_groestl_final(&mut self.ctx, digest.as_mut_ptr()) };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+
+    fn reset(&mut self) -> Result<(), CxError> {
+        let err = unsafe { cx_groestl_init_no_throw(&mut self.ctx, (OUT * 8) as size_t) };
+        if err != CX_OK {
+            Err(err.into())
+        } else {
+            Ok(())
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::{bench, TestType};
+    use testmacro::test_item as test;
+
+    #[test]
+    fn sha256_streaming() {
+        const DIGEST: [u8; 32] = [
+            0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e,
+            0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4,
+            0x19, 0xdb, 0x06, 0xc1,
+        ];
+        let msg = b"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+        let mut h = Sha256::new();
+        for chunk in msg.chunks(7) {
+            h.update(chunk).map_err(|_| ())?;
+        }
+        assert_eq!(h.finalize().map_err(|_| ())?, DIGEST);
+        assert_eq!(Sha256::hash(msg).map_err(|_| ())?, DIGEST);
+    }
+
+    #[test]
+    fn bench_sha256() {
+        let msg = [0x5au8; 256];
+        bench("sha256 256 bytes", 100, || {
+            core::hint::black_box(Sha256::hash(core::hint::black_box(&msg)).ok());
+        });
+    }
+
+    #[test]
+    fn sha256_update_blocks() {
+        let msg = [0x5au8; 300];
+        let digest = Sha256::hash(&msg).map_err(|_| ())?;
+        // Aligned and unaligned starts, and a partial last block
+        for split in [0, 5, 64] {
+            let mut h = Sha256::new();
+            h.update(&msg[..split]).map_err(|_| ())?;
+            h.update_blocks(&msg[split..]).map_err(|_| ())?;
+            assert_eq!(h.finalize().map_err(|_| ())?, digest);
+        }
+    }
+
+    #[test]
+    fn bench_sha256_blocks() {
+        let msg = [0x5au8; 1024];
+        bench("sha256 app-side 1024 bytes", 20, || {
+            let mut h = Sha256::new();
+            h.update_blocks(core::hint::black_box(&msg)).ok();
+            core::hint::black_box(h.finalize().ok());
+        });
+    }
+
+    #[test]
+    fn keccak256_snapshot() {
+        const EMPTY: [u8; 32] = [
+            0xc5, 0xd2, 0x46, 0x01, 0x86, 0xf7, 0x23, 0x3c, 0x92, 0x7e, 0x7d, 0xb2, 0xdc, 0xc7,
+            0x03, 0xc0, 0xe5, 0x00, 0xb6, 0x53, 0xca, 0x82, 0x27, 0x3b, 0x7b, 0xfa, 0xd8, 0x04,
+            0x5d, 0x85, 0xa4, 0x70,
+        ];
+        const ABC: [u8; 32] = [
+            0x4e, 0x03, 0x65, 0x7a, 0xea, 0x45, 0xa9, 0x4f, 0xc7, 0xd4, 0x7b, 0xa8, 0x26, 0xc8,
+            0xd6, 0x67, 0xc0, 0xd1, 0xe6, 0xe3, 0x3a, 0x64, 0xa0, 0x36, 0xec, 0x44, 0xf5, 0x8f,
+            0xa1, 0x2d, 0x6c, 0x45,
+        ];
+        let mut h = Keccak256::new();
+        let snapshot = h.clone();
+        h.update(b"a").map_err(|_| ())?;
+        let mut h2 = h.clone();
+        h.update(b"bc").map_err(|_| ())?;
+        h2.update(b"b").map_err(|_| ())?;
+        h2.update(b"c").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, ABC);
+        assert_eq!(h2.finalize().map_err(|_| ())?, ABC);
+        assert_eq!(snapshot.finalize().map_err(|_| ())?, EMPTY);
+    }
+
+    #[test]
+    fn sha256_midstate() {
+        let prefix = Sha256::tagged(b"TapSighash").map_err(|_| ())?;
+        let midstate = prefix.midstate().ok_or(())?;
+
+        let mut expected = prefix.clone_state();
+        expected.update(b"input 0").map_err(|_| ())?;
+        let mut h = Sha256::from_midstate(&midstate);
+        h.update(b"input 0").map_err(|_| ())?;
+        assert_eq!(
+            h.finalize().map_err(|_| ())?,
+            expected.finalize().map_err(|_| ())?
+        );
+
+        let mut h = prefix.clone_state();
+        h.update(b"x").map_err(|_| ())?;
+        assert_eq!(h.midstate().is_none(), true);
+        h.restore_state(&prefix);
+        assert_eq!(h.midstate().is_some(), true);
+    }
+
+    #[test]
+    fn blake2b_personalized() {
+        const PERSO: [u8; 16] = *b"ZcashSigHash\x5b\xa8\x1b\x19";
+        const DIGEST: [u8; 32] = [
+            0x6b, 0x33, 0x0f, 0xb5, 0x8d, 0x6a, 0xaf, 0x14, 0xac, 0xe4, 0x96, 0x02, 0xed, 0x17,
+            0x66, 0x4e, 0x8e, 0x4c, 0xda, 0x84, 0xae, 0x2c, 0xde, 0xc7, 0xfd, 0x97, 0xe8, 0xad,
+            0xa8, 0x2d, 0x64, 0xb5,
+        ];
+        const SALTED: [u8; 20] = [
+            0x56, 0xb7, 0xe0, 0xf3, 0xd4, 0x18, 0xb3, 0xe4, 0xa6, 0xa2, 0x13, 0xe0, 0x76, 0xa9,
+            0xda, 0x5e, 0x99, 0x58, 0x4b, 0x25,
+        ];
+        let prefix = Blake2b::<32>::with_personalization(&PERSO);
+        let mut h = prefix.clone();
+        h.update(b"a").map_err(|_| ())?;
+        h.update(b"bc").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, DIGEST);
+        let mut h = prefix.clone();
+        h.update(b"x").map_err(|_| ())?;
+        h.restore_state(&prefix);
+        h.update(b"abc").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, DIGEST);
+
+        let mut h = Blake2b::<20>::with_salt_and_personalization(b"0123456789abcdef", &PERSO);
+        h.update(b"abc").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, SALTED);
+
+        let mut h = Blake2b::<32>::new();
+        h.update(b"abc").map_err(|_| ())?;
+        assert_eq!(
+            h.finalize().map_err(|_| ())?,
+            Blake2b256::hash(b"abc").map_err(|_| ())?
+        );
+    }
+
+    #[cfg(any(target_os = "nanos", target_os = "nanosplus"))]
+    #[test]
+    fn groestl512_streaming() {
+        const EMPTY: [u8; 64] = [
+            0x6d, 0x3a, 0xd2, 0x9d, 0x27, 0x91, 0x10, 0xee, 0xf3, 0xad, 0xbd, 0x66, 0xde, 0x2a,
+            0x03, 0x45, 0xa7, 0x7b, 0xae, 0xde, 0x15, 0x57, 0xf5, 0xd0, 0x99, 0xfc, 0xe0, 0xc0,
+            0x3d, 0x6d, 0xc2, 0xba, 0x8e, 0x6d, 0x4a, 0x66, 0x33, 0xdf, 0xbd, 0x66, 0x05, 0x3c,
+            0x20, 0xfa, 0xa8, 0x7d, 0x1a, 0x11, 0xf3, 0x9a, 0x7f, 0xbe, 0x4a, 0x6c, 0x2f, 0x00,
+            0x98, 0x01, 0x37, 0x03, 0x08, 0xfc, 0x4a, 0xd8,
+        ];
+        const FOX: [u8; 64] = [
+            0xba, 0xdc, 0x1f, 0x70, 0xcc, 0xd6, 0x9e, 0x0c, 0xf3, 0x76, 0x0c, 0x3f, 0x93, 0x88,
+            0x42, 0x89, 0xda, 0x84, 0xec, 0x13, 0xc7, 0x0b, 0x3d, 0x12, 0xa5, 0x3a, 0x7a, 0x8a,
+            0x4a, 0x51, 0x3f, 0x99, 0x71, 0x5d, 0x46, 0x28, 0x8f, 0x55, 0xe1, 0xdb, 0xf9, 0x26,
+            0xe6, 0xd0, 0x84, 0xa0, 0x53, 0x8e, 0x4e, 0xeb, 0xfc, 0x91, 0xcf, 0x2b, 0x21, 0x45,
+            0x29, 0x21, 0xcc, 0xde, 0x91, 0x31, 0x71, 0x8d,
+        ];
+        let msg = b"The quick brown fox jumps over the lazy dog";
+        let mut h = Groestl512::new();
+        let snapshot = h.clone_state();
+        for chunk in msg.chunks(5) {
+            h.update(chunk).map_err(|_| ())?;
+        }
+        assert_eq!(h.finalize().map_err(|_| ())?, FOX);
+        assert_eq!(Groestl512::hash(msg).map_err(|_| ())?, FOX);
+        assert_eq!(snapshot.finalize().map_err(|_| ())?, EMPTY);
+    }
+}
@@ -0,0 +1,697 @@
+//! Native backend, to run the logic of the SDK on the build machine
+//!
+//! With the `host` feature, the SDK is built for the machine running it
+//! instead of a device (`cargo test --features host` on Linux), and what it
+//! needs from the OS is emulated here:
+//!
+//! - the NVM is RAM, which the `nvm_write` syscall copies to,
+//! - the SEPH is two queues: the SDK receives the events a test queued with
+//!   [`push_event`], and the packets it sends are kept for [`take_sent`],
+//! - the RNG is a xorshift generator, reproducible with [`seed_rng`] and of
+//!   course not suitable for keys,
+//! - the cxlib computes SHA-224 and SHA-256, the CRC engine CRC-32 and the
+//!   AES engine AES, in software,
+//! - the OS settings are all 0 unless set with [`set_setting`],
+//! - the UX of the OS displays nothing, unless a test holds the screen with
+//!   [`lock_screen`] to check how the app resumes.
+//!
+//! With the `seph_capture` feature, [`replay`] receives the events of a
+//! capture made on a device once the queued events are consumed.
+//!
+//! The other functions of the OS are weak stubs generated by build.rs,
+//! which stop the program. Tests are each run in a process of their own, so
+//! that those calling the OS are reported as skipped while the others run:
+//! the logic of the SDK is tested natively, and what needs the Secure
+//! Element is left to speculos. Benchmarks count nanoseconds of the host.
+//!
+//! Host builds take their Flash page size, fonts and cxlib function numbers
+//! from the Nano S Plus, and leave out the modules specific to a device.
+
+use crate::bindings::{
+    cx_aes_key_t, cx_err_t, cx_hash_info_t, cx_sha256_t, size_t, BOLOS_UX_CONTINUE, BOLOS_UX_OK,
+    BOLOS_UX_REDRAW, CX_DECRYPT, CX_INVALID_PARAMETER, CX_OK,
+};
+use crate::svc::id;
+use crate::testing::{to_hex, DebugWriter};
+use crate::trampoline::nr;
+use core::ffi::{c_char, c_int, c_long, c_uint, c_void, CStr};
+
+#[link(name = "c")]
+extern "C" {
+    fn write(fd: c_int, buf: *const c_void, count: usize) -> isize;
+    fn _exit(status: c_int) -> !;
+    #[cfg(any(test, feature = "speculos"))]
+    fn fork() -> c_int;
+    #[cfg(any(test, feature = "speculos"))]
+    fn waitpid(pid: c_int, status: *mut c_int, options: c_int) -> c_int;
+    fn clock_gettime(clock: c_int, time: *mut Timespec) -> c_int;
+}
+
+#[repr(C)]
+struct Timespec {
+    sec: c_long,
+    nsec: c_long,
+}
+
+const CLOCK_MONOTONIC: c_int = 1;
+
+/// Exit status of a test calling a function of the OS which is not
+/// emulated, as that of skipped tests under automake
+const UNSUPPORTED_EXIT: c_int = 77;
+
+/// Size of each SEPH queue, in bytes
+const SEPH_QUEUE_SIZE: usize = 1024;
+
+/// Packets in order, each prefixed with its big-endian length
+struct Queue {
+    buf: [u8; SEPH_QUEUE_SIZE],
+    len: usize,
+}
+
+impl Queue {
+    const fn new() -> Self {
+        Queue {
+            buf: [0; SEPH_QUEUE_SIZE],
+            len: 0,
+        }
+    }
+
+    fn has_room(&self, packet: &[u8]) -> bool {
+        self.len + 2 + packet.len() <= SEPH_QUEUE_SIZE
+    }
+
+    fn push(&mut self, packet: &[u8]) {
+        let end = self.len + 2 + packet.len();
+        self.buf[self.len..self.len + 2].copy_from_slice(&(packet.len() as u16).to_be_bytes());
+        self.buf[self.len + 2..end].copy_from_slice(packet);
+        self.len = end;
+    }
+
+    /// Remove the first packet, copying what fits of it into `out`
+    fn pop(&mut self, out: &mut [u8]) -> Option<usize> {
+        if self.len == 0 {
+            return None;
+        }
+        let n = u16::from_be_bytes([self.buf[0], self.buf[1]]) as usize;
+        let copied = n.min(out.len());
+        out[..copied].copy_from_slice(&self.buf[2..2 + copied]);
+        self.buf.copy_within(2 + n..self.len, 0);
+        self.len -= 2 + n;
+        Some(copied)
+    }
+}
+
+static mut EVENTS: Queue = Queue::new();
+static mut SENT: Queue = Queue::new();
+static mut NVM_WRITES: u32 = 0;
+static mut RNG_STATE: u64 = 0x853c_49e6_748f_ea9b;
+/// Integer OS settings
+static mut SETTINGS: [u32; 8] = [0; 8];
+/// Events left for the emulated lock screen to consume, and whether it
+/// must then ask for a redraw
+static mut UX_LOCK: (u32, bool) = (0, false);
+/// Capture being replayed, and offset of its next record
+#[cfg(feature = "seph_capture")]
+static mut REPLAY: (&[u8], usize) = (&[], 0);
+
+/// Queue a SEPH event, such as a button or APDU event, for the SDK to
+/// receive. Panics if the queue is full.
+pub fn push_event(packet: &[u8]) {
+    let events = unsafe { &mut *core::ptr::addr_of_mut!(EVENTS) };
+    assert!(events.has_room(packet), "SEPH event queue full");
+    events.push(packet);
+}
+
+/// Remove the oldest packet sent by the SDK to the MCU, copying what fits
+/// of it into `out`. Only the most recent packets are kept.
+pub fn take_sent(out: &mut [u8]) -> Option<usize> {
+    unsafe { (*core::ptr::addr_of_mut!(SENT)).pop(out) }
+}
+
+/// Number of NVM writes since the start of the test
+pub fn nvm_writes() -> u32 {
+    unsafe { NVM_WRITES }
+}
+
+/// Restart the random generator from `seed`. Tests start from the same
+/// seed, so each of them draws the same numbers on each run.
+pub fn seed_rng(seed: u64) {
+    // The state of xorshift must not be 0
+    unsafe { RNG_STATE = seed | 1 };
+}
+
+/// Replay the packets received in `capture`, serialized by
+/// [`crate::seph_capture::drain`], after the events queued with
+/// [`push_event`]. The packets sent and the tick counts of the capture are
+/// skipped: the SDK paces itself on what it receives.
+#[cfg(feature = "seph_capture")]
+pub fn replay(capture: &'static [u8]) {
+    unsafe { REPLAY = (capture, 0) };
+}
+
+/// Next received packet of the capture being replayed, copying what fits
+/// of it into `out`
+#[cfg(feature = "seph_capture")]
+fn replay_next(out: &mut [u8]) -> Option<usize> {
+    let (capture, pos) = unsafe { &mut *core::ptr::addr_of_mut!(REPLAY) };
+    for record in crate::seph_capture::records(&capture[*pos..]) {
+        *pos += record.serialized_len();
+        if !record.sent {
+            let copied = record.packet.len().min(out.len());
+            out[..copied].copy_from_slice(&record.packet[..copied]);
+            return Some(copied);
+        }
+    }
+    None
+}
+
+#[cfg(not(feature = "seph_capture"))]
+fn replay_next(_out: &mut [u8]) -> Option<usize> {
+    None
+}
+
+/// Display a screen of the OS which consumes the next `events` button and
+/// ticker events, then asks the app to redraw its screen
+pub fn lock_screen(events: u32) {
+    unsafe { UX_LOCK = (events, true) };
+}
+
+/// Change the integer OS setting `id`, which [`crate::settings`] sees
+/// once its cache is invalidated
+pub fn set_setting(id: u8, value: u32) {
+    unsafe { SETTINGS[id as usize] = value };
+}
+
+fn next_random() -> u64 {
+    unsafe {
+        RNG_STATE ^= RNG_STATE << 13;
+        RNG_STATE ^= RNG_STATE >> 7;
+        RNG_STATE ^= RNG_STATE << 17;
+        RNG_STATE
+    }
+}
+
+pub(crate) fn print(s: &[u8]) {
+    unsafe { write(1, s.as_ptr().cast(), s.len()) };
+}
+
+/// Nanoseconds elapsed on a monotonic clock
+pub fn ticks() -> u64 {
+    let mut time = Timespec { sec: 0, nsec: 0 };
+    unsafe { clock_gettime(CLOCK_MONOTONIC, &mut time) };
+    time.sec as u64 * 1_000_000_000 + time.nsec as u64
+}
+
+/// Frequency of [`ticks`] in Hz
+pub fn tick_frequency() -> u32 {
+    1_000_000_000
+}
+
+/// Run `f` in a child process, so that whatever it does to the emulated
+/// state or to the process stays there. Returns `None` if it called a
+/// function of the OS which is not emulated.
+#[cfg(any(test, feature = "speculos"))]
+pub(crate) fn run_isolated(f: fn() -> Result<(), ()>) -> Option<Result<(), ()>> {
+    let mut status = 0;
+    unsafe {
+        let pid = fork();
+        if pid == 0 {
+            _exit(f().is_err() as c_int);
+        }
+        if pid < 0 || waitpid(pid, &mut status, 0) != pid {
+            return Some(Err(()));
+        }
+    }
+    // WIFEXITED and WEXITSTATUS
+    let exit = (status & 0x7f == 0).then_some((status >> 8) & 0xff);
+    match exit {
+        Some(0) => Some(Ok(())),
+        Some(UNSUPPORTED_EXIT) => None,
+        _ => Some(Err(())),
+    }
+}
+
+/// Stop a test calling what is not emulated, `name` followed by `number`
+/// in hex if any
+fn unsupported(name: &str, number: Option<u32>) -> ! {
+    let mut w = DebugWriter::new();
+    w.write("not emulated on the host: ");
+    w.write(name);
+    if let Some(number) = number {
+        w.write(core::str::from_utf8(&to_hex(number)).unwrap_or(""));
+    }
+    w.write("\n");
+    w.flush();
+    unsafe { _exit(UNSUPPORTED_EXIT) }
+}
+
+/// Called by the stubs of build.rs with the name of the function stubbed
+#[no_mangle]
+extern "C" fn host_unsupported(name: *const c_char) -> ! {
+    let name = unsafe { CStr::from_ptr(name) };
+    unsupported(name.to_str().unwrap_or(""), None)
+}
+
+/// Syscalls of [`crate::svc`]
+pub(crate) unsafe fn svc(id: u32, params: &mut [usize]) -> (usize, usize) {
+    match id {
+        id::NVM_WRITE => {
+            core::ptr::copy(params[1] as *const u8, params[0] as *mut u8, params[2]);
+            NVM_WRITES += 1;
+            (0, 0)
+        }
+        id::IO_SEPH_SEND => {
+            let packet = core::slice::from_raw_parts(params[0] as *const u8, params[1]);
+            let sent = &mut *core::ptr::addr_of_mut!(SENT);
+            // Packets nobody took make room for the new ones
+            while !sent.has_room(packet) && sent.pop(&mut []).is_some() {}
+            if sent.has_room(packet) {
+                sent.push(packet);
+            }
+            (0, 0)
+        }
+        id::IO_SEPH_IS_STATUS_SENT => (0, 0),
+        id::IO_SEPH_RECV => {
+            let out = core::slice::from_raw_parts_mut(params[0] as *mut u8, params[1]);
+            match (*core::ptr::addr_of_mut!(EVENTS))
+                .pop(out)
+                .or_else(|| replay_next(out))
+            {
+                Some(len) => (len, 0),
+                None => panic!("no SEPH event queued"),
+            }
+        }
+        id::CX_AES_SET_KEY_HW => {
+            let key = &*(params[0] as *const cx_aes_key_t);
+            let len = key.size as usize;
+            if !matches!(len, 16 | 24 | 32) {
+                return (CX_INVALID_PARAMETER as usize, 0);
+            }
+            AES_KEY = Some(AesKey::expand(
+                &key.keys[..len],
+                params[1] as u32 == CX_DECRYPT,
+            ));
+            (CX_OK as usize, 0)
+        }
+        id::CX_AES_BLOCK_HW => {
+            let mut block = [0u8; 16];
+            block.copy_from_slice(core::slice::from_raw_parts(params[0] as *const u8, 16));
+            match &*core::ptr::addr_of!(AES_KEY) {
+                Some(key) => key.process(&mut block),
+                None => return (CX_INVALID_PARAMETER as usize, 0),
+            }
+            core::ptr::copy(block.as_ptr(), params[1] as *mut u8, 16);
+            (CX_OK as usize, 0)
+        }
+        id::CX_AES_RESET_HW => {
+            AES_KEY = None;
+            (0, 0)
+        }
+        _ => unsupported("syscall 0x", Some(id)),
+    }
+}
+
+/// Key loaded into the emulated AES engine
+static mut AES_KEY: Option<AesKey> = None;
+
+/// AES S-box, generated from the multiplicative inverses of GF(2^8)
+const SBOX: [u8; 256] = {
+    let mut sbox = [0x63u8; 256];
+    let (mut p, mut q) = (1u8, 1u8);
+    loop {
+        // p runs over the field with generator 3, and q over the inverses
+        p = p ^ (p << 1) ^ if p & 0x80 != 0 { 0x1b } else { 0 };
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if q & 0x80 != 0 {
+            q ^= 0x09;
+        }
+        let x = q ^ q.rotate_left(1) ^ q.rotate_left(2) ^ q.rotate_left(3) ^ q.rotate_left(4);
+        sbox[p as usize] = x ^ 0x63;
+        if p == 1 {
+            break;
+        }
+    }
+    sbox
+};
+
+const INV_SBOX: [u8; 256] = {
+    let mut inv = [0u8; 256];
+    let mut i = 0;
+    while i < 256 {
+        inv[SBOX[i] as usize] = i as u8;
+        i += 1;
+    }
+    inv
+};
+
+fn gmul(mut a: u8, mut b: u8) -> u8 {
+    let mut p = 0;
+    while b != 0 {
+        if b & 1 != 0 {
+            p ^= a;
+        }
+        a = (a << 1) ^ if a & 0x80 != 0 { 0x1b } else { 0 };
+        b >>= 1;
+    }
+    p
+}
+
+/// Expanded AES key, FIPS 197
+struct AesKey {
+    round_keys: [[u8; 16]; 15],
+    rounds: usize,
+    decrypt: bool,
+}
+
+impl AesKey {
+    fn expand(key: &[u8], decrypt: bool) -> AesKey {
+        let nk = key.len() / 4;
+        let rounds = nk + 6;
+        let mut w = [[0u8; 4]; 60];
+        for (i, word) in key.chunks_exact(4).enumerate() {
+            w[i].copy_from_slice(word);
+        }
+        let mut rcon = 1u8;
+        for i in nk..4 * (rounds + 1) {
+            let mut t = w[i - 1];
+            if i % nk == 0 {
+                t = [
+                    SBOX[t[1] as usize] ^ rcon,
+                    SBOX[t[2] as usize],
+                    SBOX[t[3] as usize],
+                    SBOX[t[0] as usize],
+                ];
+                rcon = gmul(rcon, 2);
+            } else if nk > 6 && i % nk == 4 {
+                t = t.map(|b| SBOX[b as usize]);
+            }
+            for j in 0..4 {
+                w[i][j] = w[i - nk][j] ^ t[j];
+            }
+        }
+        let mut round_keys = [[0u8; 16]; 15];
+        for (r, rk) in round_keys.iter_mut().enumerate().take(rounds + 1) {
+            for c in 0..4 {
+                rk[4 * c..4 * c + 4].copy_from_slice(&w[4 * r + c]);
+            }
+        }
+        AesKey {
+            round_keys,
+            rounds,
+            decrypt,
+        }
+    }
+
+    fn process(&self, s: &mut [u8; 16]) {
+        let add = |s: &mut [u8; 16], rk: &[u8; 16]| s.iter_mut().zip(rk).for_each(|(b, k)| *b ^= k);
+        // Bytes are in column-major order, s[r + 4 * c]
+        let mix = |s: &mut [u8; 16], m: [u8; 4]| {
+            for c in s.chunks_exact_mut(4) {
+                let a = [c[0], c[1], c[2], c[3]];
+                for (r, out) in c.iter_mut().enumerate() {
+                    *out = (0..4).fold(0, |acc, j| acc ^ gmul(a[j], m[(j + 4 - r) % 4]));
+                }
+            }
+        };
+        let shift = |s: &mut [u8; 16], dir: usize| {
+            let t = *s;
+            for r in 1..4 {
+                for c in 0..4 {
+                    s[r + 4 * c] = t[r + 4 * ((c + r * dir) % 4)];
+                }
+            }
+        };
+        if !self.decrypt {
+            add(s, &self.round_keys[0]);
+            for round in 1..=self.rounds {
+                s.iter_mut().for_each(|b| *b = SBOX[*b as usize]);
+                shift(s, 1);
+                if round != self.rounds {
+                    mix(s, [2, 3, 1, 1]);
+                }
+                add(s, &self.round_keys[round]);
+            }
+        } else {
+            add(s, &self.round_keys[self.rounds]);
+            for round in (0..self.rounds).rev() {
+                shift(s, 3);
+                s.iter_mut().for_each(|b| *b = INV_SBOX[*b as usize]);
+                add(s, &self.round_keys[round]);
+                if round != 0 {
+                    mix(s, [14, 11, 13, 9]);
+                }
+            }
+        }
+    }
+}
+
+/// CRC-32 (IEEE 802.3) of the CRC engine, computed bitwise
+#[no_mangle]
+unsafe extern "C" fn cx_crc32_hw(buf: *const c_void, len: size_t) -> u32 {
+    let data = core::slice::from_raw_parts(buf as *const u8, len as usize);
+    let mut crc = !0u32;
+    for &b in data {
+        crc ^= b as u32;
+        for _ in 0..8 {
+            crc = (crc >> 1) ^ (0xedb8_8320 & (crc & 1).wrapping_neg());
+        }
+    }
+    !crc
+}
+
+/// Markers of the SHA-224 and SHA-256 contexts, as their `header.info`,
+/// holding the digest size
+static SHA224_INFO: u8 = 28;
+static SHA256_INFO: u8 = 32;
+
+const SHA224_IV: [u32; 8] = [
+    0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+];
+const SHA256_IV: [u32; 8] = [
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+];
+
+unsafe fn sha2_init(hash: *mut cx_sha256_t, info: &'static u8, iv: &[u32; 8]) -> cx_err_t {
+    let ctx = &mut *hash;
+    *ctx = cx_sha256_t::default();
+    ctx.header.info = info as *const u8 as *const cx_hash_info_t;
+    // The accumulator holds the state as native words, as in the cxlib
+    for (acc, w) in ctx.acc.chunks_exact_mut(4).zip(iv) {
+        acc.copy_from_slice(&w.to_ne_bytes());
+    }
+    CX_OK
+}
+
+#[no_mangle]
+unsafe extern "C" fn cx_sha224_init_no_throw(hash: *mut cx_sha256_t) -> cx_err_t {
+    sha2_init(hash, &SHA224_INFO, &SHA224_IV)
+}
+
+#[no_mangle]
+unsafe extern "C" fn cx_sha256_init_no_throw(hash: *mut cx_sha256_t) -> cx_err_t {
+    sha2_init(hash, &SHA256_INFO, &SHA256_IV)
+}
+
+/// Context of `hash` and its digest size, if it was initialized by
+/// [`cx_sha224_init_no_throw`] or [`cx_sha256_init_no_throw`]
+unsafe fn sha2_context(hash: usize) -> Option<(&'static mut cx_sha256_t, usize)> {
+    let ctx = &mut *(hash as *mut cx_sha256_t);
+    let info = ctx.header.info as *const u8;
+    [&SHA224_INFO, &SHA256_INFO]
+        .into_iter()
+        .find(|&marker| core::ptr::eq(marker, info))
+        .map(|marker| (ctx, *marker as usize))
+}
+
+fn sha2_state(ctx: &cx_sha256_t) -> [u32; 8] {
+    let mut state = [0u32; 8];
+    for (w, acc) in state.iter_mut().zip(ctx.acc.chunks_exact(4)) {
+        *w = u32::from_ne_bytes([acc[0], acc[1], acc[2], acc[3]]);
+    }
+    state
+}
+
+fn sha2_update(ctx: &mut cx_sha256_t, mut input: &[u8]) {
+    let mut state = sha2_state(ctx);
+    while !input.is_empty() {
+        let blen = ctx.blen as usize;
+        let n = (64 - blen).min(input.len());
+        ctx.block[blen..blen + n].copy_from_slice(&input[..n]);
+        ctx.blen += n as size_t;
+        input = &input[n..];
+        if ctx.blen == 64 {
+            crate::hash::sha256_compress(&mut state, &ctx.block);
+            ctx.header.counter += 1;
+            ctx.blen = 0;
+        }
+    }
+    for (w, acc) in state.iter().zip(ctx.acc.chunks_exact_mut(4)) {
+        acc.copy_from_slice(&w.to_ne_bytes());
+    }
+}
+
+fn sha2_final(ctx: &mut cx_sha256_t, digest: &mut [u8]) {
+    let bits = (ctx.header.counter as u64 * 64 + ctx.blen as u64) * 8;
+    let pad = if ctx.blen < 56 { 56 } else { 120 } - ctx.blen as usize;
+    let mut padding = [0u8; 72];
+    padding[0] = 0x80;
+    sha2_update(ctx, &padding[..pad]);
+    sha2_update(ctx, &bits.to_be_bytes());
+    for (out, w) in digest.chunks_mut(4).zip(sha2_state(ctx)) {
+        out.copy_from_slice(&w.to_be_bytes()[..out.len()]);
+    }
+}
+
+/// cxlib functions of [`crate::trampoline`]
+pub(crate) unsafe fn cx_call(nr: u32, args: [usize; 4]) -> u32 {
+    match (nr, sha2_context(args[0])) {
+        (nr::cx_hash_update, Some((ctx, _))) => {
+            if args[2] > 0 {
+                sha2_update(
+                    ctx,
+                    core::slice::from_raw_parts(args[1] as *const u8, args[2]),
+                );
+            }
+            CX_OK
+        }
+        (nr::cx_hash_final, Some((ctx, size))) => {
+            sha2_final(
+                ctx,
+                core::slice::from_raw_parts_mut(args[1] as *mut u8, size),
+            );
+            CX_OK
+        }
+        _ => unsupported("cxlib function 0x", Some(nr)),
+    }
+}
+
+#[no_mangle]
+extern "C" fn pic(link_address: *mut c_void) -> *mut c_void {
+    // Nothing is relocated
+    link_address
+}
+
+#[no_mangle]
+extern "C" fn os_sched_exit(exit_code: u8) -> ! {
+    unsafe { _exit(exit_code as c_int) }
+}
+
+/// Status of the last event forwarded to [`os_ux`]
+static mut UX_STATUS: u32 = BOLOS_UX_OK;
+
+#[no_mangle]
+extern "C" fn os_ux(_params: *mut c_void) -> c_uint {
+    unsafe {
+        UX_STATUS = match UX_LOCK {
+            (0, false) => BOLOS_UX_OK,
+            (0, true) => {
+                UX_LOCK.1 = false;
+                BOLOS_UX_REDRAW
+            }
+            (n, _) => {
+                UX_LOCK.0 = n - 1;
+                BOLOS_UX_CONTINUE
+            }
+        };
+    }
+    0
+}
+
+#[no_mangle]
+extern "C" fn os_sched_last_status(_task: c_uint) -> u8 {
+    unsafe { UX_STATUS as u8 }
+}
+
+#[no_mangle]
+extern "C" fn os_setting_get(id: c_uint, _value: *mut u8, _maxlen: c_uint) -> c_uint {
+    unsafe {
+        (*core::ptr::addr_of!(SETTINGS))
+            .get(id as usize)
+            .copied()
+            .unwrap_or(0)
+    }
+}
+
+#[no_mangle]
+extern "C" fn os_longjmp(exception: c_uint) -> ! {
+    unsupported("exception 0x", Some(exception))
+}
+
+#[no_mangle]
+unsafe extern "C" fn cx_rng_no_throw(buffer: *mut u8, len: size_t) {
+    for chunk in core::slice::from_raw_parts_mut(buffer, len as usize).chunks_mut(8) {
+        chunk.copy_from_slice(&next_random().to_le_bytes()[..chunk.len()]);
+    }
+}
+
+/// Referenced by the unwinding tables of the precompiled `core` of the host,
+/// although panics abort
+#[no_mangle]
+extern "C" fn rust_eh_personality() {}
+
+/// Entry point of host programs, instead of `_start` and `c_main`: as on
+/// the devices, apps and the test binary start in `sample_main`
+#[no_mangle]
+extern "C" fn main() -> c_int {
+    extern "C" {
+        fn sample_main();
+    }
+    unsafe { sample_main() };
+    0
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::hash::{HashFn, Sha224, Sha256};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn seph_queues() {
+        push_event(&[0x05, 0x00, 0x01, 0x01]);
+        let mut event = [0u8; 8];
+        let len = crate::seph::seph_recv(&mut event, 0);
+        assert_eq!(&event[..len as usize], &[0x05, 0x00, 0x01, 0x01]);
+        crate::seph::seph_send(&[0x50, 0x00, 0x00]);
+        assert_eq!(take_sent(&mut event), Some(3));
+        assert_eq!(take_sent(&mut event), None);
+    }
+
+    #[cfg(feature = "seph_capture")]
+    #[test]
+    fn seph_replay() {
+        crate::seph_capture::clear();
+        push_event(&[0x05, 0x00, 0x01, 0x01]);
+        let mut event = [0u8; 8];
+        crate::seph::seph_recv(&mut event, 0);
+        crate::seph::seph_send(&[0x50, 0x00, 0x00]);
+        push_event(&[0x05, 0x00, 0x01, 0x02]);
+        crate::seph::seph_recv(&mut event, 0);
+        static mut CAPTURE: [u8; 64] = [0; 64];
+        let capture = unsafe { &mut *core::ptr::addr_of_mut!(CAPTURE) };
+        let n = crate::seph_capture::drain(capture);
+
+        replay(&capture[..n]);
+        let len = crate::seph::seph_recv(&mut event, 0);
+        assert_eq!(&event[..len as usize], &[0x05, 0x00, 0x01, 0x01]);
+        let len = crate::seph::seph_recv(&mut event, 0);
+        assert_eq!(&event[..len as usize], &[0x05, 0x00, 0x01, 0x02]);
+    }
+
+    #[test]
+    fn software_sha2() {
+        let digest = Sha256::hash(b"abc").map_err(|_| ())?;
+        assert_eq!(digest[..4], [0xba, 0x78, 0x16, 0xbf]);
+        assert_eq!(digest[28..], [0xf2, 0x00, 0x15, 0xad]);
+        // The padding taking a block of its own
+        let mut h = Sha224::new();
+        h.update(&[b'a'; 60]).map_err(|_| ())?;
+        h.update(&[b'a'; 40]).map_err(|_| ())?;
+        let digest = h.finalize().map_err(|_| ())?;
+        assert_eq!(digest[..4], [0x77, 0x17, 0xa7, 0xde]);
+    }
+}
@@ -0,0 +1,157 @@
+//! Work run while the app waits for events
+//!
+//! [`Comm::next_event`](crate::io::Comm::next_event) spends most of the time
+//! of an app blocked in `seph_recv`, waiting for the MCU. Jobs registered
+//! here use that time for speculative work: deriving the next public key,
+//! filling a pool of nonces, warming a cache...
+//!
+//! Each job is a function doing one small unit of work per call, and
+//! returning whether work is left; it is removed once it returns `false`.
+//! While waiting, the event loop runs one unit of one job, in turn, after
+//! acknowledging each message of the MCU and before receiving the next one:
+//!
+//! ```
+//! fn fill_pool() -> bool {
+//!     POOL.push(precompute_nonce());
+//!     !POOL.is_full()
+//! }
+//!
+//! idle::register(fill_pool)?;
+//! ```
+//!
+//! There is no way to tell whether a message is waiting without receiving
+//! it: a unit delays the next event by its own duration, which must stay
+//! within a few milliseconds. Jobs are paused while commands are being
+//! received, from the first USB, BLE or raw APDU transfer to the next
+//! message which is not one, so that multi-frame commands are not slowed
+//! down.
+
+/// Unit of work, returning `true` while the job has work left
+pub type Job = fn() -> bool;
+
+/// Number of jobs which can be registered at once
+pub const IDLE_JOB_SLOTS: usize = 4;
+
+struct Jobs {
+    slots: [Option<Job>; IDLE_JOB_SLOTS],
+    /// Slot of the job to run next
+    next: usize,
+}
+
+// Kept in RAM (.bss) as jobs are registered at runtime, with their
+// relocated addresses
+static mut JOBS: Jobs = Jobs {
+    slots: [None; IDLE_JOB_SLOTS],
+    next: 0,
+};
+
+fn jobs() -> &'static mut Jobs {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(JOBS) }
+}
+
+/// Returned when all [`IDLE_JOB_SLOTS`] are already in use
+pub struct JobSlotsFull;
+
+/// Run `job` while the app waits for events, until it returns `false`.
+/// Registering a job already registered does nothing.
+pub fn register(job: Job) -> Result<(), JobSlotsFull> {
+    let slots = &mut jobs().slots;
+    if slots
+        .iter()
+        .flatten()
+        .any(|j| core::ptr::fn_addr_eq(*j, job))
+    {
+        return Ok(());
+    }
+    let free = slots.iter_mut().find(|j| j.is_none()).ok_or(JobSlotsFull)?;
+    *free = Some(job);
+    Ok(())
+}
+
+/// Stop running `job`
+pub fn unregister(job: Job) {
+    for slot in jobs().slots.iter_mut() {
+        if matches!(slot, Some(j) if core::ptr::fn_addr_eq(*j, job)) {
+            *slot = None;
+        }
+    }
+}
+
+/// Whether some job has work left
+pub fn pending() -> bool {
+    jobs().slots.iter().any(|j| j.is_some())
+}
+
+/// Run one unit of the next job, returning whether there was one
+pub(crate) fn run_one() -> bool {
+    let jobs = jobs();
+    for i in 0..IDLE_JOB_SLOTS {
+        let slot = (jobs.next + i) % IDLE_JOB_SLOTS;
+        if let Some(job) = jobs.slots[slot] {
+            jobs.next = (slot + 1) % IDLE_JOB_SLOTS;
+            if !job() {
+                // The job may have registered others or itself again
+                if matches!(jobs.slots[slot], Some(j) if core::ptr::fn_addr_eq(j, job)) {
+                    jobs.slots[slot] = None;
+                }
+            }
+            return true;
+        }
+    }
+    false
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    static mut RUNS: [u32; 2] = [0; 2];
+
+    fn runs() -> &'static mut [u32; 2] {
+        unsafe { &mut *core::ptr::addr_of_mut!(RUNS) }
+    }
+
+    fn three_units() -> bool {
+        runs()[0] += 1;
+        runs()[0] % 3 != 0
+    }
+
+    fn endless() -> bool {
+        runs()[1] += 1;
+        true
+    }
+
+    #[test]
+    fn round_robin() {
+        *runs() = [0; 2];
+        register(three_units).map_err(|_| ())?;
+        register(endless).map_err(|_| ())?;
+        register(three_units).map_err(|_| ())?;
+        for _ in 0..8 {
+            run_one();
+        }
+        // The first job is done after its third unit
+        assert_eq!(*runs(), [3, 5]);
+        unregister(endless);
+        assert_eq!(pending(), false);
+        assert_eq!(run_one(), false);
+    }
+
+    #[cfg(feature = "host")]
+    #[test]
+    fn run_while_waiting() {
+        use crate::bindings::SEPROXYHAL_TAG_TICKER_EVENT;
+        use crate::io::{Comm, Event};
+        *runs() = [0; 2];
+        register(endless).map_err(|_| ())?;
+        let mut comm = Comm::new();
+        crate::host::push_event(&[SEPROXYHAL_TAG_TICKER_EVENT as u8, 0, 0]);
+        assert_eq!(comm.next_event::<u8>() == Event::Ticker, true);
+        unregister(endless);
+        assert_eq!(runs()[1], 1);
+    }
+}
@@ -0,0 +1,191 @@
+//! Install parameters of the app, read from Flash in place
+//!
+//! The loader writes the name, version, icon and derivation path
+//! restrictions of the app as a TLV list at `_install_parameters`, at the
+//! end of the app. [`InstallParams::new`] indexes them once, so that looking
+//! them up is a binary search returning a borrow of the Flash, instead of a
+//! call to `os_registry_get_current_app_tag` copying the value out each time:
+//!
+//! ```
+//! let params = InstallParams::new();
+//! loop {
+//!     let ins: Instruction = comm.next_command();
+//!     if !params.allows_path(&path) {
+//!         comm.reply(StatusWords::BadP1P2);
+//!     }
+//!     // ...
+//! }
+//! ```
+
+use crate::bindings::{
+    BOLOS_TAG_APPNAME, BOLOS_TAG_APPVERSION, BOLOS_TAG_DERIVEPATH, BOLOS_TAG_ICON,
+};
+use crate::nvm::PAGE_SIZE;
+use crate::tlv::{install_parameters, TlvIndex, TlvIter};
+
+/// Most parameters indexed
+pub const MAX_PARAMS: usize = 16;
+
+/// Index of the install parameters
+pub struct InstallParams {
+    index: TlvIndex<'static, MAX_PARAMS>,
+}
+
+impl InstallParams {
+    /// Index the install parameters. They start on a page boundary and the
+    /// loader pads them to a whole number of pages, so the first page is read,
+    /// up to the padding.
+    pub fn new() -> InstallParams {
+        let page = install_parameters(PAGE_SIZE).remaining();
+        let end = TlvIter::with_single_byte_tags(page)
+            .take_while(|t| t.tag != 0x00 && t.tag != 0xff)
+            .take(MAX_PARAMS)
+            .last()
+            .map_or(0, |t| t.offset + t.value.len());
+        let index = TlvIndex::new(TlvIter::with_single_byte_tags(&page[..end]));
+        InstallParams {
+            // Cannot fail, the elements up to `end` having been parsed already
+            index: index.unwrap_or_else(|_| unreachable!()),
+        }
+    }
+
+    /// Value of the first parameter with `tag`, such as
+    /// `BOLOS_TAG_USER_TAG`
+    pub fn get(&self, tag: u32) -> Option<&'static [u8]> {
+        self.index.get(tag)
+    }
+
+    pub fn app_name(&self) -> Option<&'static str> {
+        core::str::from_utf8(self.get(BOLOS_TAG_APPNAME)?).ok()
+    }
+
+    pub fn app_version(&self) -> Option<&'static str> {
+        core::str::from_utf8(self.get(BOLOS_TAG_APPVERSION)?).ok()
+    }
+
+    pub fn icon(&self) -> Option<&'static [u8]> {
+        self.get(BOLOS_TAG_ICON)
+    }
+
+    /// Derivation paths the app is restricted to, if any
+    pub fn derivation_paths(&self) -> Option<DerivationPaths> {
+        let value = self.get(BOLOS_TAG_DERIVEPATH)?;
+        let (&curves, paths) = value.split_first()?;
+        Some(DerivationPaths { curves, paths })
+    }
+
+    /// Whether `path` is allowed by the derivation path restrictions: it must
+    /// start with one of the paths if the app has any
+    pub fn allows_path(&self, path: &[u32]) -> bool {
+        match self.derivation_paths() {
+            None => true,
+            Some(paths) => paths.into_iter().any(|prefix| {
+                prefix.len() <= path.len() && prefix.components().zip(path).all(|(c, &p)| c == p)
+            }),
+        }
+    }
+}
+
+impl Default for InstallParams {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Value of the derivation path restrictions
+#[derive(Copy, Clone)]
+pub struct DerivationPaths {
+    /// Bit mask of the curves allowed
+    pub curves: u8,
+    /// Paths, each with its number of components followed by the
+    /// components, big-endian
+    paths: &'static [u8],
+}
+
+impl IntoIterator for DerivationPaths {
+    type Item = DerivationPath;
+    type IntoIter = DerivationPathIter;
+
+    fn into_iter(self) -> DerivationPathIter {
+        DerivationPathIter { paths: self.paths }
+    }
+}
+
+/// Iterator over the BIP32 paths of the restrictions. SLIP-21 paths, whose
+/// length has bit 8 set, are skipped.
+pub struct DerivationPathIter {
+    paths: &'static [u8],
+}
+
+impl Iterator for DerivationPathIter {
+    type Item = DerivationPath;
+
+    fn next(&mut self) -> Option<DerivationPath> {
+        loop {
+            let (&len, rest) = self.paths.split_first()?;
+            let slip21 = len & 0x80 != 0;
+            let size = match slip21 {
+                true => (len & 0x7f) as usize,
+                false => len as usize * 4,
+            };
+            if size > rest.len() {
+                self.paths = &[];
+                return None;
+            }
+            let (path, rest) = rest.split_at(size);
+            self.paths = rest;
+            if !slip21 {
+                return Some(DerivationPath(path));
+            }
+        }
+    }
+}
+
+/// BIP32 path of the restrictions
+#[derive(Copy, Clone)]
+pub struct DerivationPath(&'static [u8]);
+
+impl DerivationPath {
+    /// Number of components
+    pub fn len(&self) -> usize {
+        self.0.len() / 4
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.0.is_empty()
+    }
+
+    pub fn components(&self) -> impl Iterator<Item = u32> + 'static {
+        self.0
+            .chunks_exact(4)
+            .map(|c| u32::from_be_bytes([c[0], c[1], c[2], c[3]]))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // 44'/0', a SLIP-21 path, then 44'/1'/0'
+    static PATHS: [u8; 24] = [
+        2, 0x80, 0, 0, 44, 0x80, 0, 0, 0, 0x82, b'a', b'b', 3, 0x80, 0, 0, 44, 0x80, 0, 0, 1, 0x80,
+        0, 0,
+    ];
+
+    #[test]
+    fn derivation_paths() {
+        let paths = DerivationPaths {
+            curves: 0,
+            paths: &PATHS,
+        };
+        let mut iter = paths.into_iter();
+        let first = iter.next().ok_or(())?;
+        assert_eq!(first.len(), 2);
+        assert_eq!(first.components().last(), Some(0x8000_0000));
+        // The last path is truncated
+        assert_eq!(iter.next().is_none(), true);
+    }
+}
@@ -1,11 +1,20 @@
 use crate::bindings::*;
-#[cfg(target_os = "nanox")]
+#[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
 use crate::ble;
-use crate::buttons::{get_button_event, ButtonEvent, ButtonsState};
+use crate::buttons::{get_button_event, get_held_button_event, ButtonEvent, ButtonsState};
+use crate::cache::ResponseStore;
+use crate::chain::{self, ResponseSource};
+use crate::ecc::CxError;
+use crate::hash::HashFn;
+use crate::lock;
+use crate::lz4::Lz4Decoder;
 
 #[cfg(feature = "ccid")]
 use crate::ccid;
 use crate::seph;
+#[cfg(feature = "u2f")]
+use crate::u2f;
+use crate::ux;
 use core::convert::TryFrom;
 use core::ops::{Index, IndexMut};
 
@@ -18,6 +27,7 @@ pub enum StatusWords {
     BadLen = 0x6e01,
     UserCancelled = 0x6e02,
     Unknown = 0x6d00,
+    WrongP1P2 = 0x6b00,
     Panic = 0xe000,
 }
 
@@ -71,12 +81,20 @@ impl From<SyscallError> for Reply {
     }
 }
 
+impl From<CxError> for Reply {
+    fn from(_: CxError) -> Reply {
+        SyscallError::InvalidParameter.into()
+    }
+}
+
 extern "C" {
     pub fn io_usb_hid_send(
         sndfct: unsafe extern "C" fn(*mut u8, u16),
         sndlength: u16,
         apdu_buffer: *const u8,
     );
+    #[cfg(feature = "webusb")]
+    fn io_usb_send_apdu_data_ep0x83(buffer: *mut u8, length: u16);
 }
 
 /// Possible events returned by [`Comm::next_event`]
@@ -84,17 +102,138 @@ extern "C" {
 pub enum Event<T> {
     /// APDU event
     Command(T),
-    /// Button press or release event
+    /// Button press or release event, or long press and repeat of a held
+    /// button
     Button(ButtonEvent),
-    /// Ticker
+    /// Ticker, unless a held button is reported instead
     Ticker,
+    /// A screen of the OS, such as the lock screen, has been closed: the app
+    /// must redraw its own. See [`crate::ux`].
+    UxEvent,
+}
+
+/// Header of a command, decoded once when it is received
+///
+/// The length fields follow the ISO 7816-4 cases, short or extended: a
+/// command of 4 bytes has no data nor Le (case 1), a 5-byte one only a short
+/// Le (case 2S), and a 7-byte one starting with a 0 Lc byte only an extended
+/// Le (case 2E). Otherwise the data is announced by Lc, and followed by an
+/// optional Le. Bytes after the Le are ignored.
+#[derive(Copy, Clone)]
+pub struct ApduHeader {
+    pub cla: u8,
+    pub ins: u8,
+    pub p1: u8,
+    pub p2: u8,
+    /// Length of the command it was decoded from
+    rx: usize,
+    /// Offset and length of the data, or the error of a malformed Lc
+    data: Result<(u16, u16), StatusWords>,
+    /// Maximum length of the response expected, if given: 256 or 65536
+    /// for a Le of 0
+    pub le: Option<u32>,
 }
 
-pub struct Comm {
-    pub apdu_buffer: [u8; 260],
+impl ApduHeader {
+    const EMPTY: ApduHeader = ApduHeader {
+        cla: 0,
+        ins: 0,
+        p1: 0,
+        p2: 0,
+        rx: 0,
+        data: Err(StatusWords::BadLen),
+        le: None,
+    };
+
+    /// Decode the header of the command held in `apdu`, which must be at
+    /// least 4 bytes long
+    pub fn decode(apdu: &[u8]) -> ApduHeader {
+        let short_le = |b: u8| Some(if b == 0 { 256 } else { b as u32 });
+        let extended_le = |b: &[u8]| match u16::from_be_bytes([b[0], b[1]]) {
+            0 => Some(65536),
+            le => Some(le as u32),
+        };
+        let (data, le) = match (apdu.get(4), apdu.len()) {
+            (_, 4) => (Ok((4, 0)), None),
+            (Some(&le), 5) => (Ok((5, 0)), short_le(le)),
+            (Some(0), 6) => (Err(StatusWords::BadLen), None),
+            (Some(0), 7) => (Ok((7, 0)), extended_le(&apdu[5..7])),
+            (Some(0), rx) => match u16::from_be_bytes([apdu[5], apdu[6]]) as usize {
+                // Extended Lc, big endian as per ISO 7816-4
+                0 => (Err(StatusWords::BadLen), None),
+                len if 7 + len > rx => (Err(StatusWords::BadLen), None),
+                len => (
+                    Ok((7, len as u16)),
+                    apdu.get(7 + len..9 + len).and_then(extended_le),
+                ),
+            },
+            (Some(&len), rx) => match len as usize {
+                len if 5 + len > rx => (Err(StatusWords::BadLen), None),
+                len => (
+                    Ok((5, len as u16)),
+                    apdu.get(5 + len).copied().and_then(short_le),
+                ),
+            },
+            (None, _) => (Err(StatusWords::BadLen), None),
+        };
+        ApduHeader {
+            cla: apdu[0],
+            ins: apdu[1],
+            p1: apdu[2],
+            p2: apdu[3],
+            rx: apdu.len(),
+            data,
+            le,
+        }
+    }
+
+    /// Offset and length of the data field in the command, `BadLen` if Lc
+    /// does not match the length received
+    pub fn data_range(&self) -> Result<core::ops::Range<usize>, StatusWords> {
+        let (offset, len) = self.data?;
+        Ok(offset as usize..(offset + len) as usize)
+    }
+}
+
+/// Size of the APDU buffer of a default [`Comm`]: a 5-byte short header
+/// followed by up to 255 bytes of data.
+pub const DEFAULT_APDU_BUFFER_SIZE: usize = 260;
+
+/// APDU communication with the host.
+///
+/// The const parameter `N` is the size of the buffer used to receive commands
+/// and build responses. It defaults to [`DEFAULT_APDU_BUFFER_SIZE`], which only
+/// fits short APDUs. Applications receiving ISO 7816 extended APDUs (Lc and
+/// Le on 2 bytes) can allocate a larger buffer so a large payload arrives in
+/// a single exchange:
+///
+/// ```
+/// let mut comm = Comm::<1024>::new_with_buffer_size();
+/// ```
+///
+/// HID, WebUSB, U2F, BLE and CCID reassemble commands of any length fitting
+/// in `N`. CCID uses the extended APDU level of exchange, chaining commands and
+/// responses longer than a single 261-byte block.
+///
+/// `Comm` holds all the I/O buffers of the application: every transport
+/// receives commands into `apdu_buffer` and sends responses from it, and
+/// messages from the MCU are received into a single SEPH buffer, instead of
+/// one on the stack of each receive loop. `Comm` is meant to live for the
+/// whole application, usually in `sample_main` or in a static.
+pub struct Comm<const N: usize = DEFAULT_APDU_BUFFER_SIZE> {
+    pub apdu_buffer: [u8; N],
+    /// Last message received from the MCU
+    pub(crate) seph_buffer: [u8; seph::SEPH_BUFFER_SIZE],
     pub rx: usize,
     pub tx: usize,
     buttons: ButtonsState,
+    /// Button event received by [`Comm::poll_transport`]
+    deferred_button: Option<ButtonEvent>,
+    cache: Option<&'static mut dyn ResponseStore>,
+    /// Rest of the response being chained, and its final status word
+    chain: Option<(&'static mut dyn ResponseSource, u16)>,
+    /// Header of the last command received
+    header: ApduHeader,
 }
 
 impl Default for Comm {
@@ -105,25 +244,59 @@ impl Default for Comm {
 
 impl Comm {
     pub const fn new() -> Self {
+        Self::new_with_buffer_size()
+    }
+}
+
+impl<const N: usize> Comm<N> {
+    /// The transports take the length of the APDU buffer on 16 bits.
+    /// Checked when `Comm::<N>` is created, failing the build otherwise.
+    const BUFFER_SIZE_FITS: () = assert!(N <= u16::MAX as usize, "APDU buffer too large");
+
+    /// Create a `Comm` whose APDU buffer holds `N` bytes, at most 65535.
+    pub const fn new_with_buffer_size() -> Self {
+        let () = Self::BUFFER_SIZE_FITS;
         Self {
-            apdu_buffer: [0u8; 260],
+            apdu_buffer: [0u8; N],
+            seph_buffer: [0u8; seph::SEPH_BUFFER_SIZE],
             rx: 0,
             tx: 0,
             buttons: ButtonsState::new(),
+            deferred_button: None,
+            cache: None,
+            chain: None,
+            header: ApduHeader::EMPTY,
+        }
+    }
+
+    /// Answer the commands found in `cache` without returning them to the
+    /// app, and store their responses in it. See [`crate::cache`].
+    pub fn set_response_cache(&mut self, cache: &'static mut dyn ResponseStore) {
+        self.cache = Some(cache);
+    }
+
+    /// Drop the responses of the attached cache, when the state they depend
+    /// on changes
+    pub fn clear_response_cache(&mut self) {
+        if let Some(cache) = self.cache.as_mut() {
+            cache.clear();
         }
     }
 
     /// Send the currently held APDU
     // This is private. Users should call reply to set the satus word and
     // transmit the response.
+    #[optimize(speed)]
     fn apdu_send(&mut self) {
+        crate::trace_span!("apdu_send");
+        #[cfg(feature = "io_stats")]
+        crate::io_stats::response(unsafe { G_io_app.apdu_state }, self.tx);
         if !seph::is_status_sent() {
             seph::send_general_status()
         }
-        let mut spi_buffer = [0u8; 128];
         while seph::is_status_sent() {
-            seph::seph_recv(&mut spi_buffer, 0);
-            seph::handle_event(&mut self.apdu_buffer, &spi_buffer);
+            seph::seph_recv(&mut self.seph_buffer, 0);
+            seph::handle_event(&mut self.apdu_buffer, &self.seph_buffer);
         }
 
         match unsafe { G_io_app.apdu_state } {
@@ -134,16 +307,29 @@ impl Comm {
                     self.apdu_buffer.as_ptr(),
                 );
             },
+            // Same channel framing as HID, over the WebUSB endpoint
+            #[cfg(feature = "webusb")]
+            APDU_USB_WEBUSB => unsafe {
+                io_usb_hid_send(
+                    io_usb_send_apdu_data_ep0x83,
+                    self.tx as u16,
+                    self.apdu_buffer.as_ptr(),
+                );
+            },
             APDU_RAW => {
                 let len = (self.tx as u16).to_be_bytes();
                 seph::seph_send(&[seph::SephTags::RawAPDU as u8, len[0], len[1]]);
                 seph::seph_send(&self.apdu_buffer[..self.tx]);
             }
+            #[cfg(feature = "u2f")]
+            APDU_U2F => {
+                u2f::send(&self.apdu_buffer[..self.tx]);
+            }
             #[cfg(feature = "ccid")]
             APDU_USB_CCID => {
-                ccid::send(&self.apdu_buffer[..self.tx]);
+                ccid::send(&mut self.apdu_buffer, self.tx);
             }
-            #[cfg(target_os = "nanox")]
+            #[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
             APDU_BLE => {
                 ble::send(&self.apdu_buffer[..self.tx]);
             }
@@ -151,6 +337,7 @@ impl Comm {
         }
         self.tx = 0;
         self.rx = 0;
+        self.header = ApduHeader::EMPTY;
         unsafe {
             G_io_app.apdu_state = APDU_IDLE;
         }
@@ -216,86 +403,178 @@ impl Comm {
     ///
     /// In this later example, invalid instruction byte error handling is
     /// automatically performed by the `next_event` method itself.
+    #[optimize(speed)]
     pub fn next_event<T: TryFrom<u8>>(&mut self) -> Event<T> {
-        let mut spi_buffer = [0u8; 128];
+        crate::trace_span!("next_event");
+        self.reset_apdu_state();
+        if let Some(btn_evt) = self.deferred_button.take() {
+            return Event::Button(btn_evt);
+        }
+        loop {
+            // Wait for the next message from the MCU which may be of interest
+            // to the application. Every message is routed through the SEPH
+            // dispatch table: USB traffic and APDU reception are handled
+            // there, and only application events or possibly completed APDUs
+            // come back here.
+            // message = [ tag, len_hi, len_lo, ... ]
+            let event = seph::next_app_event(&mut self.apdu_buffer, &mut self.seph_buffer);
+            if let Some(event) = self.decode_event(event) {
+                return event;
+            }
+        }
+    }
 
+    /// Answer the control frames of the transports (HID and BLE pings,
+    /// version and channel requests, U2F keep-alives) while a command is
+    /// being processed, so that hosts do not give up on a long computation.
+    /// Call it every few hundred milliseconds of work, before replying.
+    ///
+    /// The MCU holds its events until the previous one is acknowledged, and
+    /// there is no way to tell whether one is waiting: this acknowledges the
+    /// last event and processes the next one, which comes at once if a frame
+    /// is queued and otherwise with the next ticker event. It thus returns
+    /// within one ticker interval. A button event received meanwhile is
+    /// returned by the next call to [`Comm::next_event`].
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// for chunk in data.chunks(64) {
+    ///     hasher.update(chunk);
+    ///     comm.poll_transport();
+    /// }
+    /// ```
+    pub fn poll_transport(&mut self) {
+        // Commands received here would be dropped by the next `next_event`
+        if unsafe { G_io_app.apdu_media } == IO_APDU_MEDIA_NONE {
+            return;
+        }
+        if !seph::is_status_sent() {
+            seph::send_general_status();
+        }
+        seph::seph_recv(&mut self.seph_buffer, 0);
+        let reported = seph::dispatch(&mut self.apdu_buffer, &self.seph_buffer);
+        if reported && self.seph_buffer[0] == seph::Events::ButtonPush as u8 {
+            let button_info = self.seph_buffer[3] >> 1;
+            if let Some(btn_evt) = get_button_event(&mut self.buttons, button_info) {
+                self.deferred_button = Some(btn_evt);
+            }
+        }
+    }
+
+    /// Get ready to receive the next APDU
+    pub(crate) fn reset_apdu_state(&mut self) {
         unsafe {
             G_io_app.apdu_state = APDU_IDLE;
             G_io_app.apdu_media = IO_APDU_MEDIA_NONE;
             G_io_app.apdu_length = 0;
         }
+        // Receive CCID commands in place from the first one, rather than
+        // into the buffer of the C class
+        #[cfg(feature = "ccid")]
+        unsafe {
+            ccid::io_usb_ccid_set_buffer(self.apdu_buffer.as_mut_ptr(), N as u16);
+        }
+    }
 
-        loop {
-            // Signal end of command stream from SE to MCU
-            // And prepare reception
-            if !seph::is_status_sent() {
-                seph::send_general_status();
-            }
-
-            // Fetch the next message from the MCU
-            let _rx = seph::seph_recv(&mut spi_buffer, 0);
+    /// Drop the caches of the app and the responses cached, once per screen
+    /// of the OS displayed over the app
+    fn lose_focus(&mut self) {
+        if lock::on_focus(false) {
+            self.clear_response_cache();
+        }
+    }
 
-            // message = [ tag, len_hi, len_lo, ... ]
-            let tag = spi_buffer[0];
-            let len = u16::from_be_bytes([spi_buffer[1], spi_buffer[2]]);
-
-            // XXX: check whether this is necessary
-            // if rx < 3 && rx != len+3 {
-            //     unsafe {
-            //        G_io_app.apdu_state = APDU_IDLE;
-            //        G_io_app.apdu_length = 0;
-            //     }
-            //     return None
-            // }
-
-            // Treat all possible events.
-            // If this is a button push, return with the associated event
-            // If this is an APDU, return with the "received command" event
-            // Any other event (usb, xfer, ticker) is silently handled
-            match seph::Events::from(tag) {
-                seph::Events::ButtonPush => {
-                    let button_info = spi_buffer[3] >> 1;
-                    if let Some(btn_evt) = get_button_event(&mut self.buttons, button_info) {
-                        return Event::Button(btn_evt);
-                    }
+    /// Application event corresponding to the SEPH message in `seph_buffer`,
+    /// once dispatched
+    #[optimize(speed)]
+    pub(crate) fn decode_event<T: TryFrom<u8>>(&mut self, event: seph::Events) -> Option<Event<T>> {
+        // If this is a button push, return with the associated event
+        // If this is an APDU, return with the "received command" event
+        if matches!(event, seph::Events::ButtonPush | seph::Events::TickerEvent) {
+            match ux::forward_event() {
+                ux::Forwarded::App => {
+                    lock::on_focus(true);
                 }
-                seph::Events::USBEvent => {
-                    if len == 1 {
-                        seph::handle_usb_event(spi_buffer[3]);
-                    }
+                ux::Forwarded::Redraw => {
+                    self.lose_focus();
+                    lock::on_focus(true);
+                    return Some(Event::UxEvent);
                 }
-                seph::Events::USBXFEREvent => {
-                    if len >= 3 {
-                        seph::handle_usb_ep_xfer_event(&mut self.apdu_buffer, &spi_buffer);
-                    }
+                ux::Forwarded::Consumed => {
+                    self.lose_focus();
+                    return None;
                 }
-                seph::Events::CAPDUEvent => {
-                    seph::handle_capdu_event(&mut self.apdu_buffer, &spi_buffer)
+            }
+        }
+        match event {
+            seph::Events::ButtonPush => {
+                let button_info = self.seph_buffer[3] >> 1;
+                if let Some(btn_evt) = get_button_event(&mut self.buttons, button_info) {
+                    return Some(Event::Button(btn_evt));
                 }
-
-                #[cfg(target_os = "nanox")]
-                seph::Events::BleReceive => ble::receive(&mut self.apdu_buffer, &spi_buffer),
-
-                seph::Events::TickerEvent => return Event::Ticker,
-                _ => (),
             }
+            seph::Events::TickerEvent => {
+                if let Some(btn_evt) = get_held_button_event(&mut self.buttons) {
+                    return Some(Event::Button(btn_evt));
+                }
+                return Some(Event::Ticker);
+            }
+            _ => (),
+        }
 
-            if unsafe { G_io_app.apdu_state } != APDU_IDLE && unsafe { G_io_app.apdu_length } > 0 {
-                self.rx = unsafe { G_io_app.apdu_length as usize };
-                let res = T::try_from(self.apdu_buffer[1]);
-                match res {
-                    Ok(ins) => {
-                        return Event::Command(ins);
-                    }
-                    Err(_) => {
-                        // Invalid Ins code. Send automatically an error, mask
-                        // the bad instruction to the application and just
-                        // discard this event.
-                        self.reply(StatusWords::BadCla);
+        if unsafe { G_io_app.apdu_state } != APDU_IDLE && unsafe { G_io_app.apdu_length } > 0 {
+            self.rx = unsafe { G_io_app.apdu_length as usize };
+            #[cfg(feature = "io_stats")]
+            {
+                crate::io_stats::command(unsafe { G_io_app.apdu_state }, self.rx);
+                if crate::io_stats::is_request(&self.apdu_buffer[..self.rx]) {
+                    self.tx = crate::io_stats::export(&mut self.apdu_buffer[..N - 2]);
+                    self.reply_ok();
+                    return None;
+                }
+            }
+            if self.chain.is_some() {
+                match chain::get_response_le(&self.apdu_buffer, self.rx) {
+                    Some(le) => {
+                        self.tx = 0;
+                        self.send_page(le);
+                        return None;
                     }
+                    None => self.chain = None,
+                }
+            }
+            if let Some(cache) = self.cache.as_mut() {
+                if let Some(len) = cache.on_command(&mut self.apdu_buffer, self.rx) {
+                    self.tx = len;
+                    self.apdu_send();
+                    return None;
+                }
+            }
+            // Malformed lengths are refused before the app sees the command
+            self.header = ApduHeader::decode(&self.apdu_buffer[..self.rx.max(4)]);
+            if let Err(sw) = self.header.data {
+                self.reply(sw);
+                return None;
+            }
+            let res = T::try_from(self.apdu_buffer[1]);
+            match res {
+                Ok(ins) => {
+                    #[cfg(feature = "io_stats")]
+                    crate::io_stats::handler_start();
+                    return Some(Event::Command(ins));
+                }
+                Err(_) => {
+                    // Invalid Ins code. Send automatically an error, mask
+                    // the bad instruction to the application and just
+                    // discard this event.
+                    #[cfg(feature = "io_stats")]
+                    crate::io_stats::rejected();
+                    self.reply(StatusWords::BadCla);
                 }
             }
         }
+        None
     }
 
     /// Wait for the next Command event. Returns the APDU Instruction byte value
@@ -339,6 +618,140 @@ impl Comm {
         }
     }
 
+    /// Receive a payload split over several APDUs with the same instruction
+    /// byte `ins`, and pass the data of each chunk to `f` as soon as it
+    /// arrives, directly from `apdu_buffer`.
+    ///
+    /// This must be called once the first chunk has been received (for
+    /// instance after `next_command` returned `ins`). A chunk is the last one
+    /// when none of the `p1_more` bits are set in its P1 parameter.
+    /// Intermediate chunks are automatically acknowledged with
+    /// `StatusWords::Ok`; replying to the last one is left to the caller, so
+    /// it can append a result to the response.
+    ///
+    /// Button and ticker events received in between are discarded. An APDU
+    /// with another instruction byte stops the stream with
+    /// `StatusWords::Unknown`, and errors returned by `f` stop it as well.
+    /// In both cases no reply is sent.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// // P1 = 0x80 announces more chunks
+    /// let res = comm.stream_payload(INS_SIGN, 0x80, |chunk| {
+    ///     hasher.update(chunk);
+    ///     Ok(())
+    /// });
+    /// match res {
+    ///     Ok(()) => { /* sign, append signature */ comm.reply_ok() }
+    ///     Err(sw) => comm.reply(sw),
+    /// }
+    /// ```
+    pub fn stream_payload<F>(&mut self, ins: u8, p1_more: u8, mut f: F) -> Result<(), Reply>
+    where
+        F: FnMut(&[u8]) -> Result<(), Reply>,
+    {
+        loop {
+            if self.apdu_buffer[1] != ins {
+                return Err(StatusWords::Unknown.into());
+            }
+            f(self.get_data()?)?;
+            if self.get_p1() & p1_more == 0 {
+                return Ok(());
+            }
+            self.reply_ok();
+            self.next_command::<u8>();
+        }
+    }
+
+    /// Same as [`stream_payload`](Self::stream_payload), absorbing each chunk
+    /// into the hash context `h`, which can be a personalized
+    /// [`Blake2b`](crate::hash::Blake2b) among others
+    pub fn hash_payload<H: HashFn>(
+        &mut self,
+        ins: u8,
+        p1_more: u8,
+        h: &mut H,
+    ) -> Result<(), Reply> {
+        self.stream_payload(ins, p1_more, |chunk| Ok(h.update(chunk)?))
+    }
+
+    /// Same as [`stream_payload`](Self::stream_payload), except that the
+    /// payload is an LZ4 block when any of the `p2_compressed` bits are set
+    /// in the P2 parameter of the first chunk: `f` then receives the
+    /// decompressed data, in slices of at most `W` bytes, as it is decoded
+    /// by `decoder`. See [`crate::lz4`].
+    ///
+    /// A malformed block stops the stream with
+    /// `SyscallError::InvalidParameter`.
+    pub fn stream_payload_decompressed<F, const W: usize>(
+        &mut self,
+        ins: u8,
+        p1_more: u8,
+        p2_compressed: u8,
+        decoder: &mut Lz4Decoder<W>,
+        mut f: F,
+    ) -> Result<(), Reply>
+    where
+        F: FnMut(&[u8]) -> Result<(), Reply>,
+    {
+        if self.get_p2() & p2_compressed == 0 {
+            return self.stream_payload(ins, p1_more, f);
+        }
+        decoder.reset();
+        self.stream_payload(ins, p1_more, |chunk| decoder.feed(chunk, &mut f))?;
+        Ok(decoder.finish()?)
+    }
+
+    /// Same as [`stream_payload`](Self::stream_payload), except that
+    /// intermediate chunks are acknowledged before they are processed: their
+    /// data is copied into `back`, which must be large enough to hold it,
+    /// and the host can transfer the next chunk while `f` runs on the copy.
+    /// The last chunk is processed in `apdu_buffer` before any reply.
+    ///
+    /// Since an intermediate chunk is already acknowledged when `f` fails,
+    /// the next chunk is received before returning the error, so that the
+    /// caller's reply goes to it. Chunks which are acknowledged early must
+    /// not need a response of their own.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// let mut back = [0u8; 255];
+    /// let res = comm.stream_payload_ack_early(INS_SIGN, 0x80, &mut back, |chunk| {
+    ///     hasher.update(chunk);
+    ///     Ok(())
+    /// });
+    /// ```
+    pub fn stream_payload_ack_early<F>(
+        &mut self,
+        ins: u8,
+        p1_more: u8,
+        back: &mut [u8],
+        mut f: F,
+    ) -> Result<(), Reply>
+    where
+        F: FnMut(&[u8]) -> Result<(), Reply>,
+    {
+        loop {
+            if self.apdu_buffer[1] != ins {
+                return Err(StatusWords::Unknown.into());
+            }
+            let data = self.get_data()?;
+            if self.get_p1() & p1_more == 0 {
+                return f(data);
+            }
+            let chunk = back.get_mut(..data.len()).ok_or(StatusWords::BadLen)?;
+            chunk.copy_from_slice(data);
+            self.reply_ok();
+            if let Err(e) = f(chunk) {
+                self.next_command::<u8>();
+                return Err(e);
+            }
+            self.next_command::<u8>();
+        }
+    }
+
     /// Set the Status Word of the response to the previous Command event, and
     /// transmit the response.
     ///
@@ -353,10 +766,49 @@ impl Comm {
         self.apdu_buffer[self.tx] = (sw >> 8) as u8;
         self.apdu_buffer[self.tx + 1] = sw as u8;
         self.tx += 2;
+        if let Some(cache) = self.cache.as_mut() {
+            cache.on_reply(&self.apdu_buffer[..self.tx]);
+        }
         // Transmit the response
         self.apdu_send();
     }
 
+    /// Transmit a response of any length: the data already appended, followed
+    /// by what `source` reads, in pages of at most 256 bytes which the host
+    /// asks for with GET RESPONSE (see [`crate::chain`]). `reply` is the
+    /// status word of the last page.
+    ///
+    /// The GET RESPONSE commands are answered without being returned by
+    /// [`Comm::next_event`]. Another command drops the rest of the response.
+    pub fn reply_chained<T: Into<Reply>>(
+        &mut self,
+        source: &'static mut dyn ResponseSource,
+        reply: T,
+    ) {
+        self.chain = Some((source, reply.into().0));
+        self.send_page(256);
+    }
+
+    /// Transmit the next page of the chained response, of at most `le` bytes
+    fn send_page(&mut self, le: usize) {
+        let (source, sw) = match self.chain.as_mut() {
+            Some(chain) => chain,
+            None => return,
+        };
+        let end = le.min(N - 2);
+        let start = self.tx.min(end);
+        self.tx = start + source.read(&mut self.apdu_buffer[start..end]);
+        let sw = match source.remaining() {
+            0 => {
+                let sw = *sw;
+                self.chain = None;
+                sw
+            }
+            remaining => chain::more_data(remaining),
+        };
+        self.reply(Reply(sw));
+    }
+
     /// Set the Status Word of the response to `StatusWords::OK` (which is equal
     /// to `0x9000`, and transmit the response.
     pub fn reply_ok(&mut self) {
@@ -378,53 +830,173 @@ impl Comm {
         self.apdu_buffer[3]
     }
 
-    pub fn get_data(&self) -> Result<&[u8], StatusWords> {
-        if self.rx == 4 {
-            Ok(&[]) // Conforming zero-data APDU
-        } else {
-            let first_len_byte = self.apdu_buffer[4] as usize;
-            let get_data_from_buffer = |len, offset| {
-                if len == 0 || len + offset > self.rx {
-                    Err(StatusWords::BadLen)
-                } else {
-                    Ok(&self.apdu_buffer[offset..offset + len])
-                }
-            };
-            match (first_len_byte, self.rx) {
-                (0, 5) => Ok(&[]), // Non-conforming zero-data APDU
-                (0, 6) => Err(StatusWords::BadLen),
-                (0, _) => {
-                    let len =
-                        u16::from_le_bytes([self.apdu_buffer[5], self.apdu_buffer[6]]) as usize;
-                    get_data_from_buffer(len, 7)
-                }
-                (len, _) => get_data_from_buffer(len, 5),
-            }
+    /// Header of the received APDU, decoded when it was received. A command
+    /// written to `apdu_buffer` by the app itself, once the previous one is
+    /// replied to, is decoded from `rx` on each call.
+    pub fn header(&self) -> ApduHeader {
+        match self.header.rx == self.rx {
+            true => self.header,
+            false => ApduHeader::decode(&self.apdu_buffer[..self.rx.max(4)]),
         }
     }
 
+    /// Returns the data field of the received APDU.
+    ///
+    /// Both short (1-byte Lc) and extended (3-byte Lc, big endian) length
+    /// encodings are supported. Commands received by [`Comm::next_event`]
+    /// with a malformed Lc are answered with `BadLen` before reaching the
+    /// app.
+    pub fn get_data(&self) -> Result<&[u8], StatusWords> {
+        Ok(&self.apdu_buffer[self.header().data_range()?])
+    }
+
     pub fn get(&self, start: usize, end: usize) -> &[u8] {
         &self.apdu_buffer[start..end]
     }
 
     pub fn append(&mut self, m: &[u8]) {
-        for c in m.iter() {
-            self.apdu_buffer[self.tx] = *c;
-            self.tx += 1;
+        self.apdu_buffer[self.tx..self.tx + m.len()].copy_from_slice(m);
+        self.tx += m.len();
+    }
+
+    /// Returns a cursor writing the response data directly after what has
+    /// already been appended to `apdu_buffer`. Room for the status word is
+    /// always kept. Written bytes are part of the response only once
+    /// [`ResponseWriter::commit`] is called.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// let mut w = comm.response_writer();
+    /// w.put_u8(pk.len() as u8)?;
+    /// w.put_slice(pk)?;
+    /// w.commit();
+    /// comm.reply_ok();
+    /// ```
+    pub fn response_writer(&mut self) -> ResponseWriter<'_> {
+        let end = N - 2;
+        ResponseWriter {
+            buf: &mut self.apdu_buffer[self.tx.min(end)..end],
+            tx: &mut self.tx,
+            pos: 0,
         }
     }
 }
 
-impl Index<usize> for Comm {
+/// Returned when a [`ResponseWriter`] runs out of space
+pub struct ResponseOverflow;
+
+impl From<ResponseOverflow> for Reply {
+    fn from(_: ResponseOverflow) -> Reply {
+        SyscallError::Overflow.into()
+    }
+}
+
+/// Bounded cursor over the unused part of a [`Comm`] APDU buffer, created by
+/// [`Comm::response_writer`].
+pub struct ResponseWriter<'a> {
+    buf: &'a mut [u8],
+    tx: &'a mut usize,
+    pos: usize,
+}
+
+impl<'a> ResponseWriter<'a> {
+    pub fn put_u8(&mut self, v: u8) -> Result<(), ResponseOverflow> {
+        self.put_slice(&[v])
+    }
+
+    pub fn put_be_u16(&mut self, v: u16) -> Result<(), ResponseOverflow> {
+        self.put_slice(&v.to_be_bytes())
+    }
+
+    pub fn put_be_u32(&mut self, v: u32) -> Result<(), ResponseOverflow> {
+        self.put_slice(&v.to_be_bytes())
+    }
+
+    pub fn put_slice(&mut self, m: &[u8]) -> Result<(), ResponseOverflow> {
+        self.remaining_mut()
+            .get_mut(..m.len())
+            .ok_or(ResponseOverflow)?
+            .copy_from_slice(m);
+        self.pos += m.len();
+        Ok(())
+    }
+
+    /// Unwritten part of the buffer, so functions such as signature
+    /// syscalls can produce their output in place. Call [`Self::advance`]
+    /// with the number of bytes produced.
+    pub fn remaining_mut(&mut self) -> &mut [u8] {
+        &mut self.buf[self.pos..]
+    }
+
+    /// Mark `n` more bytes of [`Self::remaining_mut`] as written.
+    pub fn advance(&mut self, n: usize) -> Result<(), ResponseOverflow> {
+        if n > self.buf.len() - self.pos {
+            return Err(ResponseOverflow);
+        }
+        self.pos += n;
+        Ok(())
+    }
+
+    /// Number of bytes written so far
+    pub fn len(&self) -> usize {
+        self.pos
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.pos == 0
+    }
+
+    /// Append the written bytes to the response
+    pub fn commit(self) {
+        *self.tx += self.pos;
+    }
+}
+
+impl<const N: usize> Index<usize> for Comm<N> {
     type Output = u8;
     fn index(&self, idx: usize) -> &Self::Output {
         &self.apdu_buffer[idx]
     }
 }
 
-impl IndexMut<usize> for Comm {
+impl<const N: usize> IndexMut<usize> for Comm<N> {
     fn index_mut(&mut self, idx: usize) -> &mut Self::Output {
         self.tx = idx.max(self.tx);
         &mut self.apdu_buffer[idx]
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    fn decode(apdu: &[u8]) -> (Option<core::ops::Range<usize>>, Option<u32>) {
+        let header = ApduHeader::decode(apdu);
+        (header.data_range().ok(), header.le)
+    }
+
+    #[test]
+    fn iso_cases() {
+        assert_eq!(decode(&[0xe0, 1, 0, 0]), (Some(4..4), None));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 0]), (Some(5..5), Some(256)));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 2, 7, 7]), (Some(5..7), None));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 1, 7, 0x20]), (Some(5..6), Some(32)));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 3, 7, 7]), (None, None));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 0, 0]), (None, None));
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 0, 0, 0]), (Some(7..7), Some(65536)));
+        assert_eq!(
+            decode(&[0xe0, 1, 0, 0, 0, 0, 1, 7, 1, 0]),
+            (Some(7..8), Some(256))
+        );
+        assert_eq!(decode(&[0xe0, 1, 0, 0, 0, 0, 0, 7]), (None, None));
+        let mut comm = Comm::new();
+        comm.apdu_buffer[..7].copy_from_slice(&[0xe0, 2, 0, 0, 2, 0xab, 0xcd]);
+        comm.rx = 7;
+        assert_eq!(comm.get_data().ok(), Some(&[0xab, 0xcd][..]));
+        assert_eq!(comm.header().ins, 2);
+    }
+}
@@ -0,0 +1,269 @@
+//! I/O statistics, enabled by the `io_stats` feature
+//!
+//! [`Comm`](crate::io::Comm) counts the APDUs received and sent on each
+//! transport with their bytes, the time the app takes to handle each
+//! command, and the frames the HID and BLE transports drop, so that
+//! devices in the field can tell where latency comes from.
+//!
+//! Handling times are measured from the moment a command is returned by
+//! [`Comm::next_event`](crate::io::Comm::next_event) to its reply, with the
+//! resolution of the ticker ([`crate::timer::TICK_MS`]).
+//!
+//! `Comm` answers the diagnostic command `b0 10 00 00` ([`DIAG_CLA`],
+//! [`DIAG_INS`]) itself, before the app sees it or its response cache, with
+//! the statistics serialized by [`export`]. [`dump`] prints them with
+//! semihosting.
+
+use crate::testing::{to_dec, DebugWriter};
+use crate::timer::now_ms;
+
+/// Class of the diagnostic command
+pub const DIAG_CLA: u8 = 0xb0;
+/// Instruction of the diagnostic command
+pub const DIAG_INS: u8 = 0x10;
+
+/// Number of values of `G_io_app.apdu_state`, which identifies the
+/// transport of an APDU
+const STATES: usize = 12;
+
+/// Traffic of a single transport
+#[derive(Copy, Clone)]
+pub struct MediaStats {
+    /// `APDU_*` state of the transport, such as `APDU_USB_HID`
+    pub state: u8,
+    pub commands: u32,
+    pub bytes_in: u32,
+    pub responses: u32,
+    pub bytes_out: u32,
+}
+
+struct Stats {
+    media: [MediaStats; STATES],
+    /// Commands returned to the app, and their handling times in ms
+    handled: u32,
+    min_ms: u32,
+    max_ms: u32,
+    total_ms: u32,
+    /// Start of the command being handled
+    started: Option<u32>,
+    /// Frames dropped by the HID and BLE reassembly
+    dropped_frames: u32,
+    /// Commands answered with an error, their INS being refused by the app
+    rejected: u32,
+}
+
+const EMPTY: MediaStats = MediaStats {
+    state: 0,
+    commands: 0,
+    bytes_in: 0,
+    responses: 0,
+    bytes_out: 0,
+};
+
+static mut STATS: Stats = Stats {
+    media: [EMPTY; STATES],
+    handled: 0,
+    min_ms: u32::MAX,
+    max_ms: 0,
+    total_ms: 0,
+    started: None,
+    dropped_frames: 0,
+    rejected: 0,
+};
+
+fn stats() -> &'static mut Stats {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(STATS) }
+}
+
+fn media(state: u8) -> Option<&'static mut MediaStats> {
+    let m = stats().media.get_mut(state as usize)?;
+    m.state = state;
+    Some(m)
+}
+
+/// Count a command of `len` bytes received with the transport `state`
+pub(crate) fn command(state: u8, len: usize) {
+    if let Some(m) = media(state) {
+        m.commands += 1;
+        m.bytes_in += len as u32;
+    }
+}
+
+/// Start timing the command returned to the app
+pub(crate) fn handler_start() {
+    stats().started = Some(now_ms());
+}
+
+/// Count a response of `len` bytes sent with the transport `state`, which
+/// ends the handling of the command
+pub(crate) fn response(state: u8, len: usize) {
+    if let Some(m) = media(state) {
+        m.responses += 1;
+        m.bytes_out += len as u32;
+    }
+    let stats = stats();
+    if let Some(start) = stats.started.take() {
+        let ms = now_ms().wrapping_sub(start);
+        stats.handled += 1;
+        stats.min_ms = stats.min_ms.min(ms);
+        stats.max_ms = stats.max_ms.max(ms);
+        stats.total_ms = stats.total_ms.saturating_add(ms);
+    }
+}
+
+pub(crate) fn dropped_frame() {
+    stats().dropped_frames += 1;
+}
+
+pub(crate) fn rejected() {
+    stats().rejected += 1;
+}
+
+/// Whether `apdu` is the diagnostic command
+pub(crate) fn is_request(apdu: &[u8]) -> bool {
+    apdu.len() >= 4 && apdu[0] == DIAG_CLA && apdu[1] == DIAG_INS
+}
+
+/// Traffic of the transports used, by increasing state
+pub fn media_stats() -> impl Iterator<Item = &'static MediaStats> {
+    stats()
+        .media
+        .iter()
+        .filter(|m| m.commands != 0 || m.responses != 0)
+}
+
+/// Number of commands handled by the app, and their shortest, average and
+/// longest handling times in ms
+pub fn handling_times() -> (u32, u32, u32, u32) {
+    let stats = stats();
+    match stats.handled {
+        0 => (0, 0, 0, 0),
+        n => (n, stats.min_ms, stats.total_ms / n, stats.max_ms),
+    }
+}
+
+/// Number of frames dropped by the HID and BLE transports, invalid or out
+/// of sequence
+pub fn dropped_frames() -> u32 {
+    stats().dropped_frames
+}
+
+/// Number of commands whose INS the app refused
+pub fn rejected_commands() -> u32 {
+    stats().rejected
+}
+
+/// Reset all the counters
+pub fn clear() {
+    let stats = stats();
+    stats.media = [EMPTY; STATES];
+    stats.handled = 0;
+    stats.min_ms = u32::MAX;
+    stats.max_ms = 0;
+    stats.total_ms = 0;
+    stats.started = None;
+    stats.dropped_frames = 0;
+    stats.rejected = 0;
+}
+
+/// Print the handling times and drop counts, then the traffic of each
+/// transport, one per line
+pub fn dump() {
+    let (handled, min, avg, max) = handling_times();
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    w.write("handled ");
+    w.write(to_dec(handled, &mut buf));
+    w.write(" ms min ");
+    w.write(to_dec(min, &mut buf));
+    w.write(" avg ");
+    w.write(to_dec(avg, &mut buf));
+    w.write(" max ");
+    w.write(to_dec(max, &mut buf));
+    w.write(" dropped frames ");
+    w.write(to_dec(dropped_frames(), &mut buf));
+    w.write(" rejected ");
+    w.write(to_dec(rejected_commands(), &mut buf));
+    w.write("\n");
+    for m in media_stats() {
+        w.write("  state ");
+        w.write(to_dec(m.state as u32, &mut buf));
+        w.write(" in ");
+        w.write(to_dec(m.commands, &mut buf));
+        w.write("/");
+        w.write(to_dec(m.bytes_in, &mut buf));
+        w.write(" out ");
+        w.write(to_dec(m.responses, &mut buf));
+        w.write("/");
+        w.write(to_dec(m.bytes_out, &mut buf));
+        w.write("\n");
+    }
+}
+
+/// Serialize the statistics into `out`, returning the number of bytes
+/// written: the commands handled, their minimum, average and maximum
+/// handling times in ms, the dropped frames and the rejected commands,
+/// then for as many transports used as fit, their state and their counts
+/// of commands, bytes received, responses and bytes sent, all big-endian
+/// u32.
+pub fn export(out: &mut [u8]) -> usize {
+    let (handled, min, avg, max) = handling_times();
+    let head = [
+        handled,
+        min,
+        avg,
+        max,
+        dropped_frames(),
+        rejected_commands(),
+    ];
+    let words = head.into_iter().chain(media_stats().flat_map(|m| {
+        [
+            m.state as u32,
+            m.commands,
+            m.bytes_in,
+            m.responses,
+            m.bytes_out,
+        ]
+    }));
+    let mut pos = 0;
+    for (word, dst) in words.zip(out.chunks_exact_mut(4)) {
+        dst.copy_from_slice(&word.to_be_bytes());
+        pos += 4;
+    }
+    // Do not cut a transport entry
+    if pos > 24 {
+        pos -= (pos - 24) % 20;
+    }
+    pos
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::bindings::{APDU_RAW, APDU_USB_HID};
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn counters() {
+        clear();
+        command(APDU_USB_HID, 5);
+        handler_start();
+        response(APDU_USB_HID, 34);
+        command(APDU_RAW, 260);
+        response(APDU_RAW, 2);
+        dropped_frame();
+        assert_eq!(handling_times().0, 1);
+        assert_eq!(media_stats().count(), 2);
+        let mut out = [0u8; 60];
+        // The second transport does not fit
+        assert_eq!(export(&mut out), 44);
+        assert_eq!(out[24..28], (APDU_USB_HID as u32).to_be_bytes());
+        assert_eq!(out[40..44], 34u32.to_be_bytes());
+        assert_eq!(out[16..20], 1u32.to_be_bytes());
+        assert_eq!(is_request(&[DIAG_CLA, DIAG_INS, 0, 0, 0]), true);
+        clear();
+    }
+}
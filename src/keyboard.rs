@@ -0,0 +1,262 @@
+//! USB HID keyboard output, enabled by the `hid_keyboard` feature
+//!
+//! The feature builds `usbd_impl.c` with `HAVE_USB_HIDKBD`: the generic HID
+//! interface carrying the APDUs becomes a boot keyboard, with 8-byte reports
+//! on endpoint 0x82 (modifiers, reserved, six key usages). Apps which type
+//! text for the user, such as password managers, queue a whole string:
+//!
+//! ```
+//! keyboard::type_str(&password)?;
+//! while keyboard::is_typing() {
+//!     comm.next_event::<Ins>();
+//! }
+//! ```
+//!
+//! Reports are streamed from the SEPH handler: the next one is built and
+//! sent as soon as the host has read the previous one, without going back
+//! to the app, one per USB frame. A key is released only when the next
+//! character needs the same key, the following press replacing it
+//! otherwise, so that a 64-character string takes about 70 reports, a few
+//! tens of milliseconds.
+//!
+//! Characters are mapped to the keys of the US layout: the host must use
+//! it, or the text typed differs. HID commands cannot be received with the
+//! keyboard interface; APDUs still reach the app over the other transports
+//! (`webusb`, BLE, ...).
+
+use crate::bindings::io_usb_send_ep;
+use core::ptr::addr_of_mut;
+
+/// Address of the keyboard interrupt IN endpoint
+pub const EPIN_ADDR: u8 = 0x82;
+/// Size of the boot keyboard reports
+pub const REPORT_SIZE: usize = 8;
+/// Number of characters which can be queued at once
+pub const KEYBOARD_QUEUE_LEN: usize = 128;
+
+/// Left shift, in the modifier byte of the reports
+const LEFT_SHIFT: u8 = 0x02;
+
+/// Key typing a character: modifiers and usage ID
+#[derive(Copy, Clone, PartialEq, Eq)]
+struct Key {
+    modifiers: u8,
+    usage: u8,
+}
+
+/// Usages of the keys typing `-=[]\` (0x2d to 0x31) and `;'`,./` (0x33 to
+/// 0x38) on the US layout, without and with shift
+const PUNCTUATION: [(u8, u8, u8); 11] = [
+    (b'-', b'_', 0x2d),
+    (b'=', b'+', 0x2e),
+    (b'[', b'{', 0x2f),
+    (b']', b'}', 0x30),
+    (b'\\', b'|', 0x31),
+    (b';', b':', 0x33),
+    (b'\'', b'"', 0x34),
+    (b'`', b'~', 0x35),
+    (b',', b'<', 0x36),
+    (b'.', b'>', 0x37),
+    (b'/', b'?', 0x38),
+];
+
+/// Shifted digits, from `1` to `0`
+const SHIFTED_DIGITS: &[u8; 10] = b"!@#$%^&*()";
+
+/// Key typing `c` on the US layout
+fn key(c: u8) -> Option<Key> {
+    let (modifiers, usage) = match c {
+        b'a'..=b'z' => (0, 0x04 + c - b'a'),
+        b'A'..=b'Z' => (LEFT_SHIFT, 0x04 + c - b'A'),
+        b'1'..=b'9' => (0, 0x1e + c - b'1'),
+        b'0' => (0, 0x27),
+        b'\n' => (0, 0x28),
+        b'\t' => (0, 0x2b),
+        b' ' => (0, 0x2c),
+        _ => {
+            if let Some(i) = SHIFTED_DIGITS.iter().position(|&d| d == c) {
+                (LEFT_SHIFT, 0x1e + i as u8)
+            } else {
+                let &(plain, _, usage) = PUNCTUATION
+                    .iter()
+                    .find(|&&(plain, shifted, _)| c == plain || c == shifted)?;
+                (if c == plain { 0 } else { LEFT_SHIFT }, usage)
+            }
+        }
+    };
+    Some(Key { modifiers, usage })
+}
+
+/// Returned by [`type_str`]
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub enum TypeError {
+    /// The character at this byte offset has no key on the US layout
+    Unsupported(usize),
+    /// The string does not fit in the room left in the queue
+    QueueFull,
+}
+
+/// Characters to type, and the state of the endpoint
+struct Keyboard {
+    queue: [u8; KEYBOARD_QUEUE_LEN],
+    /// Index of the next character to type
+    head: usize,
+    len: usize,
+    /// Key held down by the last report sent
+    pressed: Option<Key>,
+    /// Whether a report has been sent and not read by the host yet
+    busy: bool,
+}
+
+impl Keyboard {
+    const fn new() -> Self {
+        Keyboard {
+            queue: [0; KEYBOARD_QUEUE_LEN],
+            head: 0,
+            len: 0,
+            pressed: None,
+            busy: false,
+        }
+    }
+
+    fn push(&mut self, s: &[u8]) -> Result<(), TypeError> {
+        if let Some(i) = s.iter().position(|&c| key(c).is_none()) {
+            return Err(TypeError::Unsupported(i));
+        }
+        if s.len() > KEYBOARD_QUEUE_LEN - self.len {
+            return Err(TypeError::QueueFull);
+        }
+        for &c in s {
+            self.queue[(self.head + self.len) % KEYBOARD_QUEUE_LEN] = c;
+            self.len += 1;
+        }
+        Ok(())
+    }
+
+    fn peek(&self) -> Option<Key> {
+        (self.len > 0).then(|| key(self.queue[self.head])).flatten()
+    }
+
+    /// Build the next report into `report`, returning `false` when there is
+    /// nothing left to send: the next key is pressed right away, unless it
+    /// is the key held down, which is released first
+    fn next_report(&mut self, report: &mut [u8; REPORT_SIZE]) -> bool {
+        let next = self.peek();
+        let key = match (self.pressed, next) {
+            (None, None) => return false,
+            (Some(held), Some(next)) if held.usage != next.usage => Some(next),
+            (None, Some(next)) => Some(next),
+            (Some(_), _) => None,
+        };
+        *report = [0; REPORT_SIZE];
+        if let Some(key) = key {
+            report[0] = key.modifiers;
+            report[2] = key.usage;
+            self.head = (self.head + 1) % KEYBOARD_QUEUE_LEN;
+            self.len -= 1;
+        }
+        self.pressed = key;
+        true
+    }
+
+    /// Send the next report, unless one is in flight
+    fn flush(&mut self) {
+        let mut report = [0u8; REPORT_SIZE];
+        if !self.busy && self.next_report(&mut report) {
+            self.busy = true;
+            unsafe { io_usb_send_ep(EPIN_ADDR as u32, report.as_mut_ptr(), REPORT_SIZE as u16, 0) };
+        }
+    }
+}
+
+// Apps are single-threaded
+static mut KEYBOARD: Keyboard = Keyboard::new();
+
+fn keyboard() -> &'static mut Keyboard {
+    unsafe { &mut *addr_of_mut!(KEYBOARD) }
+}
+
+/// Queue the ASCII string `s` to be typed, and start typing it. Nothing is
+/// queued if one of its characters cannot be typed or if it does not fit.
+pub fn type_str(s: &str) -> Result<(), TypeError> {
+    let keyboard = keyboard();
+    keyboard.push(s.as_bytes())?;
+    keyboard.flush();
+    Ok(())
+}
+
+/// Whether characters are left to type, or the last key is still held
+pub fn is_typing() -> bool {
+    let keyboard = keyboard();
+    keyboard.len > 0 || keyboard.pressed.is_some()
+}
+
+/// Drop the characters not typed yet. The key held, if any, is released.
+pub fn cancel() {
+    let keyboard = keyboard();
+    keyboard.len = 0;
+    keyboard.flush();
+}
+
+/// Called for the SEPH transfer events of [`EPIN_ADDR`], instead of the C
+/// class, once the host has read a report
+pub(crate) fn sent() {
+    let keyboard = keyboard();
+    keyboard.busy = false;
+    keyboard.flush();
+}
+
+/// Forget the report in flight and the characters queued, the host having
+/// reset the device or stopped reading the reports
+pub(crate) fn abort() {
+    *keyboard() = Keyboard::new();
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn us_layout() {
+        let usage = |c| key(c).map(|k| (k.modifiers, k.usage));
+        assert_eq!(usage(b'a'), Some((0, 0x04)));
+        assert_eq!(usage(b'Z'), Some((LEFT_SHIFT, 0x1d)));
+        assert_eq!(usage(b'0'), Some((0, 0x27)));
+        assert_eq!(usage(b'@'), Some((LEFT_SHIFT, 0x1f)));
+        assert_eq!(usage(b'?'), Some((LEFT_SHIFT, 0x38)));
+        assert_eq!(usage(b'\''), Some((0, 0x34)));
+        assert_eq!(usage(0xe9), None);
+    }
+
+    #[test]
+    fn reports() {
+        let mut keyboard = Keyboard::new();
+        assert_eq!(
+            keyboard.push(b"a\xffb").err(),
+            Some(TypeError::Unsupported(1))
+        );
+        keyboard.push(b"abbA").map_err(|_| ())?;
+        let mut report = [0u8; REPORT_SIZE];
+        let mut sent = [[0u8; 3]; 8];
+        let mut n = 0;
+        while keyboard.next_report(&mut report) {
+            sent[n].copy_from_slice(&report[..3]);
+            n += 1;
+        }
+        // Released only before the same key is pressed again
+        assert_eq!(n, 6);
+        assert_eq!(sent[0], [0, 0, 0x04]);
+        assert_eq!(sent[1], [0, 0, 0x05]);
+        assert_eq!(sent[2], [0, 0, 0]);
+        assert_eq!(sent[3], [0, 0, 0x05]);
+        assert_eq!(sent[4], [LEFT_SHIFT, 0, 0x04]);
+        assert_eq!(sent[5], [0, 0, 0]);
+        assert_eq!(
+            keyboard.push(&[b'x'; KEYBOARD_QUEUE_LEN + 1]).err(),
+            Some(TypeError::QueueFull)
+        );
+    }
+}
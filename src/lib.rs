@@ -5,23 +5,112 @@
 #![test_runner(testing::sdk_test_runner)]
 #![allow(incomplete_features)]
 #![feature(generic_const_exprs)]
+#![feature(optimize_attribute)]
 
+#[cfg(all(feature = "ccid", feature = "webusb"))]
+compile_error!("the ccid and webusb features cannot be used together: not enough USB endpoints");
+#[cfg(all(feature = "native_usb", any(feature = "ccid", feature = "webusb")))]
+compile_error!("the native_usb feature only implements HID: ccid and webusb need the C USB stack");
+#[cfg(all(feature = "native_usb", feature = "u2f"))]
+compile_error!("the native_usb feature only implements HID: u2f needs the C USB stack");
+#[cfg(all(feature = "native_usb", feature = "hid_keyboard"))]
+compile_error!("the native_usb feature only implements HID: hid_keyboard needs the C USB stack");
+#[cfg(all(
+    feature = "host",
+    any(target_os = "nanos", target_os = "nanox", target_os = "nanosplus")
+))]
+compile_error!("the host feature is for native builds: build for the machine running them");
+#[cfg(all(feature = "host", feature = "stack_usage"))]
+compile_error!("the stack_usage feature paints the stack of the device: it has no host version");
+
+#[cfg(target_os = "nanosplus")]
+pub mod aead;
+pub mod aes;
+pub mod arena;
 pub mod bindings;
 
-#[cfg(target_os = "nanox")]
+#[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
 pub mod ble;
 
+pub mod bn;
 pub mod buttons;
+pub mod cache;
 #[cfg(feature = "ccid")]
 pub mod ccid;
+pub mod chain;
+pub mod ct;
 pub mod ecc;
+pub mod eip712;
+pub mod encoding;
+pub mod endorsement;
+pub mod executor;
+pub mod format;
+pub mod framing;
+pub mod hash;
+#[cfg(feature = "host")]
+pub mod host;
+pub mod idle;
+pub mod install_params;
 pub mod io;
+#[cfg(feature = "io_stats")]
+pub mod io_stats;
+#[cfg(feature = "hid_keyboard")]
+pub mod keyboard;
+pub mod libcall;
+pub mod lock;
+pub mod lz4;
+pub mod mac;
+#[cfg(not(feature = "host"))]
+mod mem;
+pub mod memory;
+pub mod merkle;
 pub mod nvm;
+#[cfg(feature = "nvm_stats")]
+pub mod nvm_stats;
+pub mod parse;
+#[cfg(feature = "cx_profile")]
+pub mod profile;
 pub mod random;
+pub mod review;
+pub mod router;
+pub mod rsa;
+pub mod scp03;
 pub mod screen;
 pub mod seph;
+#[cfg(feature = "seph_capture")]
+pub mod seph_capture;
+pub mod session;
+pub mod settings;
+#[cfg(feature = "stack_usage")]
+pub mod stack;
+mod svc;
 
 pub mod testing;
+pub mod timer;
+pub mod tlv;
+#[cfg(feature = "trace")]
+pub mod trace;
+mod trampoline;
+#[cfg(feature = "u2f")]
+pub mod u2f;
+pub mod ui;
+#[cfg(feature = "native_usb")]
+mod usbd;
+pub mod ux;
+
+/// Without the `trace` feature, spans are not recorded
+#[cfg(not(feature = "trace"))]
+#[macro_export]
+macro_rules! trace_span {
+    ($name:expr) => {};
+}
+
+/// Without the `cx_profile` feature, calls are not profiled
+#[cfg(not(feature = "cx_profile"))]
+#[macro_export]
+macro_rules! cx_profile {
+    ($name:expr) => {};
+}
 
 pub mod usbbindings;
 
@@ -37,6 +126,34 @@ pub fn exiting_panic(_info: &PanicInfo) -> ! {
     exit_app(0);
 }
 
+/// Errors of the SDK which the app cannot recover from, reported by
+/// [`fatal`] with their value as exit status
+#[repr(u8)]
+#[derive(Copy, Clone)]
+pub enum Fatal {
+    /// Both copies of an atomic NVM storage are invalid
+    InvalidatedStorage = 0xe0,
+    /// A CRC checked NVM storage is corrupted
+    CorruptedStorage = 0xe1,
+    /// Index or key out of the bounds of an NVM collection
+    OutOfRange = 0xe2,
+    /// A private key could not be derived from the seed
+    KeyDerivation = 0xe3,
+}
+
+/// Return an internal error and exit the app with the status `error`.
+///
+/// Used by the SDK instead of panicking: a panic hands a message and a
+/// location to the handler, which links `core::fmt` as soon as the handler
+/// formats or prints them, several KiB of Flash.
+#[cold]
+#[inline(never)]
+pub fn fatal(error: Fatal) -> ! {
+    let mut comm = io::Comm::new();
+    comm.reply(io::StatusWords::Panic);
+    exit_app(error as u8);
+}
+
 /// Helper macro that sets an external panic handler
 /// as the project's current panic handler
 #[macro_export]
@@ -50,21 +167,28 @@ macro_rules! set_panic {
     };
 }
 
+#[cfg(not(feature = "host"))]
 extern "C" {
     fn c_main();
 }
 
+#[cfg(not(feature = "host"))]
 #[link_section = ".boot"]
 #[no_mangle]
 pub extern "C" fn _start() -> ! {
+    #[cfg(feature = "stack_usage")]
+    stack::paint();
+    init_pic_offset();
     // Main is in C until the try_context can be set properly from Rust
     unsafe { c_main() };
     exit_app(1);
 }
 
 /// Wrapper for 'os_sched_exit'
-/// Exit application with status
+/// Exit application with status, after saving the session registered with
+/// [`session::on_exit`]
 pub fn exit_app(status: u8) -> ! {
+    session::exit();
     unsafe { os_sched_exit(status) };
     unreachable!("Did not exit properly");
 }
@@ -93,6 +217,77 @@ pub fn pic_rs_mut<T>(x: &mut T) -> &mut T {
     unsafe { &mut *ptr }
 }
 
+extern "C" {
+    // Linker script symbols bounding the relocated program, declared as
+    // functions for the same reason as `_nvram_data` below
+    fn _nvram_start();
+    fn _nvram_end();
+}
+
+/// Link addresses of the bounds of the relocated program. As data, these
+/// are not relocated: they are the addresses `pic` translates from.
+static PIC_RANGE: [unsafe extern "C" fn(); 2] = [_nvram_start, _nvram_end];
+
+/// Difference between link and run addresses of the program, constant for
+/// the whole run and computed once by `_start`
+static mut PIC_OFFSET: usize = 0;
+
+#[cfg(not(feature = "host"))]
+fn init_pic_offset() {
+    let start = PIC_RANGE[0] as usize;
+    unsafe { PIC_OFFSET = start.wrapping_sub(pic(start as *mut c_void) as usize) };
+}
+
+/// Same as `pic`, with the offset computed at boot: a range check and a
+/// subtraction, without any call
+#[inline(always)]
+pub fn pic_cached<T>(x: *const T) -> *const T {
+    let addr = x as usize;
+    if (PIC_RANGE[0] as usize..PIC_RANGE[1] as usize).contains(&addr) {
+        addr.wrapping_sub(unsafe { PIC_OFFSET }) as *const T
+    } else {
+        x
+    }
+}
+
+/// Translate a slice of relocated data at once, whatever its length
+pub fn pic_slice<T>(s: &[T]) -> &[T] {
+    unsafe { core::slice::from_raw_parts(pic_cached(s.as_ptr()), s.len()) }
+}
+
+/// Translate a relocated string, such as a `&'static str` stored in a
+/// static structure
+pub fn pic_str(s: &str) -> &str {
+    unsafe { core::str::from_utf8_unchecked(pic_slice(s.as_bytes())) }
+}
+
+/// Same as [`Pic`], for data accessed in hot paths: translations use the
+/// offset cached at boot instead of calling `pic`.
+///
+/// # Examples
+///
+/// ```
+/// static TABLE: PicCached<[u32; 256]> = PicCached::new(TABLE_VALUES);
+/// ...
+/// let table = TABLE.get_ref();
+/// for b in data { crc = table[(crc as u8 ^ b) as usize] ^ (crc >> 8); }
+/// ```
+pub struct PicCached<T> {
+    data: T,
+}
+
+impl<T> PicCached<T> {
+    pub const fn new(data: T) -> PicCached<T> {
+        PicCached { data }
+    }
+
+    /// Returns translated reference to the wrapped data.
+    #[inline(always)]
+    pub fn get_ref(&self) -> &T {
+        unsafe { &*pic_cached(&self.data) }
+    }
+}
+
 /// Data wrapper to force access through address translation with [`pic_rs`] or
 /// [`pic_rs_mut`]. This can help preventing mistakes when accessing data which
 /// has been relocated.
@@ -139,6 +334,10 @@ extern "C" {
 
 /// The following is a means to correctly access data stored in NVM
 /// through the `#[link_section = ".nvm_data"]` attribute
+///
+/// [`NVMData::get_mut`] translates the address, with a `pic` syscall, on
+/// each call: applications reading the data often should call it once at
+/// startup and keep the returned reference.
 pub struct NVMData<T> {
     data: T,
 }
@@ -148,7 +347,7 @@ impl<T> NVMData<T> {
         NVMData { data }
     }
 
-    #[cfg(target_os = "nanos")]
+    #[cfg(any(target_os = "nanos", feature = "host"))]
     pub fn get_mut(&mut self) -> &mut T {
         crate::pic_rs_mut(&mut self.data)
     }
@@ -158,7 +357,7 @@ impl<T> NVMData<T> {
     /// This is necessary when using the `rwpi` relocation model,
     /// because a static mutable will be assumed to be located in
     /// RAM, and be accessed through the static base (r9)
-    #[cfg(not(target_os = "nanos"))]
+    #[cfg(not(any(target_os = "nanos", feature = "host")))]
     pub fn get_mut(&mut self) -> &mut T {
         use core::arch::asm;
         unsafe {
@@ -0,0 +1,118 @@
+//! Calls to other apps installed as libraries
+//!
+//! `os_lib_call` runs the app `name` with a pointer to an array of
+//! parameters, and returns when that app calls `os_lib_end`. [`lib_call`]
+//! builds the array on the stack, with the usual layout of the Ethereum
+//! plugins and the other library apps:
+//!
+//! | Index | Value                                  |
+//! |-------|----------------------------------------|
+//! | 0     | Name of the library, nul-terminated    |
+//! | 1     | [`RUN_APPLICATION`]                    |
+//! | 2     | Command                                |
+//! | 3     | Address of the data                    |
+//! | 4     | Length of the data                     |
+//!
+//! and issues the system call inline. The data is a borrowed buffer the
+//! library reads and writes in place, in the RAM of the caller: arguments
+//! and results of any size go through it without being copied into a
+//! static structure first, straight from and back into the APDU buffer for
+//! instance:
+//!
+//! ```
+//! let name = CStr::from_bytes_with_nul(b"Ethereum\0").unwrap();
+//! lib_call(name, PROVIDE_PARAMETER, &mut comm.apdu_buffer[..len]);
+//! ```
+//!
+//! A library built with this SDK gets the command and the data back from
+//! the parameters with [`LibArgs::from_raw`].
+
+use core::ffi::{c_uint, CStr};
+
+/// Library call identifier of the command calls, the one at index 1
+pub const RUN_APPLICATION: u32 = 0x100;
+
+/// Parameters of a command call
+#[repr(C)]
+struct Params {
+    name: *const u8,
+    id: u32,
+    command: u32,
+    data: *mut u8,
+    len: u32,
+}
+
+impl Params {
+    fn new(name: &CStr, command: u32, data: &mut [u8]) -> Params {
+        Params {
+            name: name.as_ptr() as *const u8,
+            id: RUN_APPLICATION,
+            command,
+            data: data.as_mut_ptr(),
+            len: data.len() as u32,
+        }
+    }
+}
+
+/// Run `command` of the library app `name`, with `data` as its argument
+/// and result buffer. Returns once the library has ended.
+///
+/// The OS raises an exception if `name` is not installed.
+pub fn lib_call(name: &CStr, command: u32, data: &mut [u8]) {
+    let mut params = Params::new(name, command, data);
+    unsafe {
+        crate::svc::os_lib_call(&mut params as *mut Params as *mut c_uint);
+    }
+}
+
+/// Command and data of a call, on the library side
+pub struct LibArgs<'a> {
+    pub command: u32,
+    pub data: &'a mut [u8],
+}
+
+impl<'a> LibArgs<'a> {
+    /// Read the parameters the library app is started with. Returns `None`
+    /// if it is not a command call made by [`lib_call`] or a C app using
+    /// the same layout.
+    ///
+    /// # Safety
+    ///
+    /// `call_parameters` must be the parameters the OS started the app
+    /// with, whose data stays valid for `'a`, or null if the app was
+    /// started from the dashboard.
+    pub unsafe fn from_raw(call_parameters: *mut c_uint) -> Option<LibArgs<'a>> {
+        let params = (call_parameters as *mut Params).as_mut()?;
+        if params.id != RUN_APPLICATION || params.data.is_null() {
+            return None;
+        }
+        Some(LibArgs {
+            command: params.command,
+            data: core::slice::from_raw_parts_mut(params.data, params.len as usize),
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn args() {
+        let name = CStr::from_bytes_with_nul(b"Ethereum\0").map_err(|_| ())?;
+        let mut buffer = [1u8, 2, 3];
+        let mut params = Params::new(name, 7, &mut buffer[..2]);
+        let raw = &mut params as *mut Params as *mut c_uint;
+        let args = unsafe { LibArgs::from_raw(raw) }.ok_or(())?;
+        assert_eq!(args.command, 7);
+        args.data[1] = 0xff;
+        assert_eq!(buffer, [1, 0xff, 3]);
+        assert_eq!(
+            unsafe { LibArgs::from_raw(core::ptr::null_mut()) }.is_none(),
+            true
+        );
+    }
+}
@@ -0,0 +1,157 @@
+//! Invalidation of the caches of secrets when the app loses the screen
+//!
+//! The OS locks the device after the auto-lock delay by drawing its lock
+//! screen over the app, and the PIN is no longer validated until the user
+//! enters it again. Caches of data derived from the seed (public keys,
+//! derived nodes, nonce pools, verified signatures...) must not outlive
+//! this. Apps register a callback dropping each of them:
+//!
+//! ```
+//! static mut PK_CACHE: PublicKeyCache<4> = PublicKeyCache::new();
+//!
+//! lock::register(|| unsafe { (*core::ptr::addr_of_mut!(PK_CACHE)).clear() })?;
+//! ```
+//!
+//! [`Comm::next_event`](crate::io::Comm::next_event) calls the callbacks
+//! as soon as a screen of the OS takes the events of the app (see
+//! [`crate::ux`]): the lock screen, the PIN prompt, or a BLE pairing modal.
+//! The response cache of `Comm` is dropped along. Callbacks run once per
+//! screen of the OS, before the app sees any event again, and can be run
+//! at any other time with [`invalidate`].
+
+/// Callback dropping a cache
+pub type Invalidate = fn();
+
+/// Number of callbacks which can be registered at once
+pub const LOCK_CALLBACK_SLOTS: usize = 8;
+
+struct Callbacks {
+    slots: [Option<Invalidate>; LOCK_CALLBACK_SLOTS],
+    /// Whether the callbacks have run since the app last had the screen
+    run: bool,
+}
+
+// Kept in RAM (.bss) as callbacks are registered at runtime, with their
+// relocated addresses
+static mut CALLBACKS: Callbacks = Callbacks {
+    slots: [None; LOCK_CALLBACK_SLOTS],
+    run: false,
+};
+
+fn callbacks() -> &'static mut Callbacks {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(CALLBACKS) }
+}
+
+/// Returned when all [`LOCK_CALLBACK_SLOTS`] are already in use
+pub struct CallbackSlotsFull;
+
+/// Call `callback` whenever the app loses the screen. Registering a
+/// callback already registered does nothing.
+pub fn register(callback: Invalidate) -> Result<(), CallbackSlotsFull> {
+    let slots = &mut callbacks().slots;
+    if slots
+        .iter()
+        .flatten()
+        .any(|c| core::ptr::fn_addr_eq(*c, callback))
+    {
+        return Ok(());
+    }
+    let free = slots
+        .iter_mut()
+        .find(|c| c.is_none())
+        .ok_or(CallbackSlotsFull)?;
+    *free = Some(callback);
+    Ok(())
+}
+
+pub fn unregister(callback: Invalidate) {
+    for slot in callbacks().slots.iter_mut() {
+        if matches!(slot, Some(c) if core::ptr::fn_addr_eq(*c, callback)) {
+            *slot = None;
+        }
+    }
+}
+
+/// Call all the callbacks
+pub fn invalidate() {
+    // Copied, as callbacks may unregister themselves
+    let slots = callbacks().slots;
+    for callback in slots.iter().flatten() {
+        callback();
+    }
+}
+
+/// Called for each event forwarded to the UX of the OS, with whether the
+/// app has the screen. Returns whether the callbacks have just run.
+pub(crate) fn on_focus(focused: bool) -> bool {
+    let callbacks = callbacks();
+    match (focused, callbacks.run) {
+        (true, _) => {
+            callbacks.run = false;
+            false
+        }
+        (false, true) => false,
+        (false, false) => {
+            callbacks.run = true;
+            invalidate();
+            true
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    static mut DROPPED: u32 = 0;
+
+    fn drop_cache() {
+        unsafe { DROPPED += 1 };
+    }
+
+    fn dropped() -> u32 {
+        unsafe { core::ptr::addr_of!(DROPPED).read() }
+    }
+
+    #[test]
+    fn once_per_lock() {
+        register(drop_cache).map_err(|_| ())?;
+        register(drop_cache).map_err(|_| ())?;
+        let before = dropped();
+        assert_eq!(on_focus(true), false);
+        assert_eq!(on_focus(false), true);
+        assert_eq!(on_focus(false), false);
+        assert_eq!(dropped() - before, 1);
+        on_focus(true);
+        on_focus(false);
+        assert_eq!(dropped() - before, 2);
+        on_focus(true);
+        unregister(drop_cache);
+        invalidate();
+        assert_eq!(dropped() - before, 2);
+    }
+
+    #[cfg(feature = "host")]
+    #[test]
+    fn dropped_on_lock_screen() {
+        use crate::bindings::SEPROXYHAL_TAG_TICKER_EVENT;
+        use crate::io::{Comm, Event};
+        use crate::seph::Events;
+        register(drop_cache).map_err(|_| ())?;
+        let before = dropped();
+        let mut comm = Comm::new();
+        comm.seph_buffer[..3].copy_from_slice(&[SEPROXYHAL_TAG_TICKER_EVENT as u8, 0, 0]);
+        let mut tick = || comm.decode_event::<u8>(Events::TickerEvent);
+        crate::host::lock_screen(2);
+        tick();
+        tick();
+        assert_eq!(tick() == Some(Event::UxEvent), true);
+        assert_eq!(tick() == Some(Event::Ticker), true);
+        unregister(drop_cache);
+        assert_eq!(dropped() - before, 1);
+    }
+}
@@ -0,0 +1,412 @@
+//! Streaming decompression of LZ4 blocks
+//!
+//! Payloads such as ABI-encoded calldata or JSON documents compress several
+//! times over, which matters most over BLE. Hosts can send them as a
+//! single LZ4 block (the raw block format, without the frame header), cut
+//! at any byte into chunks. [`Lz4Decoder`] decodes it as the chunks come,
+//! and passes the decompressed data on in slices.
+//!
+//! Matches may only reach back `W` bytes, the size of the window the
+//! decoder keeps, instead of the 64 KiB of the format. Payloads of at most
+//! `W` bytes always qualify; larger ones need an encoder taking a maximum
+//! match distance.
+//!
+//! ```
+//! static mut LZ4: Lz4Decoder<1024> = Lz4Decoder::new();
+//!
+//! let lz4 = unsafe { &mut *core::ptr::addr_of_mut!(LZ4) };
+//! // P1 = 0x80 announces more chunks, P2 = 0x01 a compressed payload
+//! comm.stream_payload_decompressed(INS_SIGN, 0x80, 0x01, lz4, |data| {
+//!     hasher.update(data);
+//!     Ok(())
+//! })?;
+//! ```
+//!
+//! [`compress`] produces such blocks on the device, for instance for the
+//! metadata cached in NVM by a [`crate::nvm::CompressedBlob`].
+
+use crate::io::{Reply, SyscallError};
+
+/// The compressed data is not a valid LZ4 block for this decoder, or the
+/// data to compress is too long
+#[derive(Debug, PartialEq, Eq)]
+pub enum Lz4Error {
+    /// A match reaches before the start of the data, or further back than
+    /// the window
+    Offset,
+    /// The data ends in the middle of a sequence
+    Truncated,
+    /// The data to compress does not fit in 64 KiB
+    TooLong,
+}
+
+impl From<Lz4Error> for Reply {
+    fn from(_: Lz4Error) -> Reply {
+        SyscallError::InvalidParameter.into()
+    }
+}
+
+#[derive(Copy, Clone, PartialEq, Eq)]
+enum State {
+    Token,
+    /// Extra bytes of the literal length
+    LiteralLen,
+    Literals,
+    /// Low byte of the offset, for the first field
+    OffsetLow,
+    OffsetHigh,
+    /// Extra bytes of the match length
+    MatchLen,
+}
+
+/// Decoder of an LZ4 block fed in chunks, keeping the last `W` decoded
+/// bytes for the matches
+pub struct Lz4Decoder<const W: usize> {
+    window: [u8; W],
+    /// Where the next byte is decoded in `window`
+    pos: usize,
+    /// Start of the decoded bytes not passed on yet
+    flushed: usize,
+    /// Number of bytes decoded, up to `W`
+    available: usize,
+    state: State,
+    /// Literal or match length being decoded
+    len: usize,
+    /// Match length read in the token
+    token_match: u8,
+    offset: usize,
+}
+
+impl<const W: usize> Default for Lz4Decoder<W> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const W: usize> Lz4Decoder<W> {
+    pub const fn new() -> Self {
+        assert!(W > 0);
+        Lz4Decoder {
+            window: [0; W],
+            pos: 0,
+            flushed: 0,
+            available: 0,
+            state: State::Token,
+            len: 0,
+            token_match: 0,
+            offset: 0,
+        }
+    }
+
+    /// Get ready to decode another block
+    pub fn reset(&mut self) {
+        self.pos = 0;
+        self.flushed = 0;
+        self.available = 0;
+        self.state = State::Token;
+    }
+
+    /// Append `b` to the window, passing the window on to `sink` when it is
+    /// full
+    #[inline(always)]
+    fn put<E, F>(&mut self, b: u8, sink: &mut F) -> Result<(), E>
+    where
+        F: FnMut(&[u8]) -> Result<(), E>,
+    {
+        self.window[self.pos] = b;
+        self.pos += 1;
+        if self.pos == W {
+            sink(&self.window[self.flushed..])?;
+            self.pos = 0;
+            self.flushed = 0;
+        }
+        Ok(())
+    }
+
+    fn copy_match<E, F>(&mut self, sink: &mut F) -> Result<(), E>
+    where
+        F: FnMut(&[u8]) -> Result<(), E>,
+    {
+        // Byte by byte, as the match may overlap the bytes it produces
+        for _ in 0..self.len {
+            let from = match self.pos.checked_sub(self.offset) {
+                Some(from) => from,
+                None => self.pos + W - self.offset,
+            };
+            self.put(self.window[from], sink)?;
+        }
+        self.available = (self.available + self.len).min(W);
+        Ok(())
+    }
+
+    /// Decode the next chunk `input` of the block, passing the decompressed
+    /// data to `sink` in one or more slices
+    pub fn feed<E, F>(&mut self, mut input: &[u8], mut sink: F) -> Result<(), E>
+    where
+        E: From<Lz4Error>,
+        F: FnMut(&[u8]) -> Result<(), E>,
+    {
+        while let Some((&b, rest)) = input.split_first() {
+            match self.state {
+                State::Token => {
+                    input = rest;
+                    self.len = (b >> 4) as usize;
+                    self.token_match = b & 0xf;
+                    self.state = match self.len {
+                        15 => State::LiteralLen,
+                        0 => State::OffsetLow,
+                        _ => State::Literals,
+                    };
+                }
+                State::LiteralLen => {
+                    input = rest;
+                    self.len += b as usize;
+                    if b != 255 {
+                        self.state = State::Literals;
+                    }
+                }
+                State::Literals => {
+                    let n = self.len.min(input.len());
+                    for &b in &input[..n] {
+                        self.put(b, &mut sink)?;
+                    }
+                    input = &input[n..];
+                    self.available = (self.available + n).min(W);
+                    self.len -= n;
+                    if self.len == 0 {
+                        self.state = State::OffsetLow;
+                    }
+                }
+                State::OffsetLow => {
+                    input = rest;
+                    self.offset = b as usize;
+                    self.state = State::OffsetHigh;
+                }
+                State::OffsetHigh => {
+                    input = rest;
+                    self.offset |= (b as usize) << 8;
+                    if self.offset == 0 || self.offset > self.available {
+                        return Err(Lz4Error::Offset.into());
+                    }
+                    self.len = self.token_match as usize + 4;
+                    if self.token_match == 15 {
+                        self.state = State::MatchLen;
+                    } else {
+                        self.copy_match(&mut sink)?;
+                        self.state = State::Token;
+                    }
+                }
+                State::MatchLen => {
+                    input = rest;
+                    self.len += b as usize;
+                    if b != 255 {
+                        self.copy_match(&mut sink)?;
+                        self.state = State::Token;
+                    }
+                }
+            }
+        }
+        if self.pos > self.flushed {
+            sink(&self.window[self.flushed..self.pos])?;
+            self.flushed = self.pos;
+        }
+        Ok(())
+    }
+
+    /// Check that the block ended after its last literals, once the last
+    /// chunk has been fed
+    pub fn finish(&self) -> Result<(), Lz4Error> {
+        match self.state {
+            // The last sequence has no match
+            State::OffsetLow => Ok(()),
+            // Empty block
+            State::Token if self.available == 0 => Ok(()),
+            _ => Err(Lz4Error::Truncated),
+        }
+    }
+}
+
+/// Bits of the hash indexing the last position of each 4-byte sequence in
+/// [`compress`], whose table takes 512 bytes of stack
+const HASH_BITS: u32 = 8;
+
+/// Write the length `len` continuing a token nibble of 15
+fn put_len<E, F>(mut len: usize, sink: &mut F) -> Result<(), E>
+where
+    F: FnMut(&[u8]) -> Result<(), E>,
+{
+    while len >= 255 {
+        sink(&[255])?;
+        len -= 255;
+    }
+    sink(&[len as u8])
+}
+
+/// Write a sequence: the literals, then the match of `offset` and `len` if
+/// any
+fn put_sequence<E, F>(literals: &[u8], m: Option<(usize, usize)>, sink: &mut F) -> Result<(), E>
+where
+    F: FnMut(&[u8]) -> Result<(), E>,
+{
+    let match_len = m.map_or(0, |(_, len)| len - 4);
+    sink(&[((literals.len().min(15) as u8) << 4) | match_len.min(15) as u8])?;
+    if literals.len() >= 15 {
+        put_len(literals.len() - 15, sink)?;
+    }
+    sink(literals)?;
+    if let Some((offset, _)) = m {
+        sink(&(offset as u16).to_le_bytes())?;
+        if match_len >= 15 {
+            put_len(match_len - 15, sink)?;
+        }
+    }
+    Ok(())
+}
+
+/// Compress `input`, of less than 64 KiB, into an LZ4 block passed to
+/// `sink` in slices, with matches reaching at most `max_offset` bytes back
+/// so that an [`Lz4Decoder`] of that window decodes it.
+///
+/// The compression is greedy, with a small hash table, which suits data
+/// written once and read often, such as metadata cached in NVM: the ratio
+/// of the textbook LZ4 compressor on repetitive data, in little memory.
+pub fn compress<E, F>(input: &[u8], max_offset: usize, mut sink: F) -> Result<(), E>
+where
+    E: From<Lz4Error>,
+    F: FnMut(&[u8]) -> Result<(), E>,
+{
+    if input.len() >= u16::MAX as usize {
+        return Err(Lz4Error::TooLong.into());
+    }
+    let max_offset = max_offset.min(u16::MAX as usize);
+    // Last position + 1 of each hash, 0 when none
+    let mut table = [0u16; 1 << HASH_BITS];
+    // The block ends with at least 5 literals, and its last match starts 12
+    // bytes before the end
+    let match_end = input.len().saturating_sub(5);
+    let match_start = input.len().saturating_sub(12);
+    let mut anchor = 0;
+    let mut pos = 0;
+    while pos < match_start {
+        let seq = &input[pos..pos + 4];
+        let h = (u32::from_le_bytes([seq[0], seq[1], seq[2], seq[3]]).wrapping_mul(2654435761)
+            >> (32 - HASH_BITS)) as usize;
+        let candidate = table[h] as usize;
+        table[h] = pos as u16 + 1;
+        if candidate == 0
+            || pos + 1 - candidate > max_offset
+            || &input[candidate - 1..candidate + 3] != seq
+        {
+            pos += 1;
+            continue;
+        }
+        let from = candidate - 1;
+        let mut len = 4;
+        while pos + len < match_end && input[from + len] == input[pos + len] {
+            len += 1;
+        }
+        put_sequence(&input[anchor..pos], Some((pos - from, len)), &mut sink)?;
+        pos += len;
+        anchor = pos;
+    }
+    if !input.is_empty() {
+        put_sequence(&input[anchor..], None, &mut sink)?;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    /// "abc" 10 times, "XYZ" and 40 'z'
+    const BLOCK: [u8; 16] = [
+        0x3f, b'a', b'b', b'c', 3, 0, 8, 0x4f, b'X', b'Y', b'Z', b'z', 1, 0, 20, 0x00,
+    ];
+
+    fn expected() -> [u8; 73] {
+        let mut out = [b'z'; 73];
+        for (i, b) in out[..30].iter_mut().enumerate() {
+            *b = b"abc"[i % 3];
+        }
+        out[30..33].copy_from_slice(b"XYZ");
+        out
+    }
+
+    fn decode<const W: usize>(chunk: usize) -> Result<([u8; 80], usize), Lz4Error> {
+        let mut decoder = Lz4Decoder::<W>::new();
+        let mut out = [0u8; 80];
+        let mut len = 0;
+        for c in BLOCK.chunks(chunk) {
+            decoder.feed(c, |data: &[u8]| {
+                out[len..len + data.len()].copy_from_slice(data);
+                len += data.len();
+                Ok::<(), Lz4Error>(())
+            })?;
+        }
+        decoder.finish()?;
+        Ok((out, len))
+    }
+
+    #[test]
+    fn blocks() {
+        let (out, len) = decode::<64>(15).map_err(|_| ())?;
+        assert_eq!(&out[..len], &expected()[..]);
+        // Cut anywhere, with a window wrapping several times
+        for chunk in 1..6 {
+            let (out, len) = decode::<8>(chunk).map_err(|_| ())?;
+            assert_eq!(&out[..len], &expected()[..]);
+        }
+    }
+
+    #[test]
+    fn compress_roundtrip() {
+        let input = expected();
+        let mut block = [0u8; 80];
+        let mut len = 0;
+        compress(&input, 8, |data: &[u8]| {
+            block[len..len + data.len()].copy_from_slice(data);
+            len += data.len();
+            Ok::<(), Lz4Error>(())
+        })
+        .map_err(|_| ())?;
+        assert_eq!(len < input.len() / 2, true);
+
+        let mut decoder = Lz4Decoder::<8>::new();
+        let mut out = [0u8; 80];
+        let mut out_len = 0;
+        decoder
+            .feed(&block[..len], |data: &[u8]| {
+                out[out_len..out_len + data.len()].copy_from_slice(data);
+                out_len += data.len();
+                Ok::<(), Lz4Error>(())
+            })
+            .map_err(|_| ())?;
+        decoder.finish().map_err(|_| ())?;
+        assert_eq!(&out[..out_len], &input[..]);
+    }
+
+    #[test]
+    fn errors() {
+        let mut decoder = Lz4Decoder::<16>::new();
+        let sink = |_: &[u8]| Ok::<(), Lz4Error>(());
+        // Offset before the start
+        assert_eq!(
+            decoder.feed(&[0x10, b'a', 2, 0], sink),
+            Err(Lz4Error::Offset)
+        );
+        decoder.reset();
+        // Offset beyond the window
+        let mut long = [b'a'; 40];
+        long[0] = 0xf0;
+        long[1] = 40 - 2 - 15;
+        assert_eq!(decoder.feed(&long, sink), Ok(()));
+        assert_eq!(decoder.feed(&[17, 0], sink), Err(Lz4Error::Offset));
+        decoder.reset();
+        assert_eq!(decoder.feed(&[0x30, b'a'], sink), Ok(()));
+        assert_eq!(decoder.finish(), Err(Lz4Error::Truncated));
+    }
+}
@@ -0,0 +1,324 @@
+//! Message authentication and key derivation
+//!
+//! HMAC contexts are allocated on the stack and fed incrementally, like the
+//! hash contexts of [`crate::hash`]. Keying a context hashes the inner pad
+//! of the key: a keyed context can be cloned for each message so that this
+//! is only done once per key.
+//!
+//! # Examples
+//!
+//! ```
+//! let keyed = HmacSha256::new(&key)?;
+//! for msg in msgs {
+//!     let mut h = keyed.clone();
+//!     h.update(msg)?;
+//!     let tag = h.finalize()?;
+//! }
+//! ```
+//!
+//! HKDF and PBKDF2 write their output into [`Secret`] buffers, cleared when
+//! dropped.
+
+use crate::bindings::*;
+use crate::ct::{ct_eq, zeroize};
+use crate::ecc::{CxError, Secret};
+use crate::trampoline::{cx_hmac_final, cx_hmac_update};
+
+extern "C" {
+    // These throw on invalid parameters, checked beforehand
+    fn cx_hkdf_extract(
+        hash_id: cx_md_t,
+        ikm: *const u8,
+        ikm_len: u32,
+        salt: *mut u8,
+        salt_len: u32,
+        prk: *mut u8,
+    );
+    fn cx_hkdf_expand(
+        hash_id: cx_md_t,
+        prk: *const u8,
+        prk_len: u32,
+        info: *mut u8,
+        info_len: u32,
+        okm: *mut u8,
+        okm_len: u32,
+    );
+}
+
+/// Hash functions available for HMAC, HKDF and PBKDF2
+#[derive(Copy, Clone)]
+pub enum MacHash {
+    Sha256,
+    Sha512,
+}
+
+impl MacHash {
+    fn md(self) -> cx_md_t {
+        match self {
+            MacHash::Sha256 => CX_SHA256,
+            MacHash::Sha512 => CX_SHA512,
+        }
+    }
+
+    /// Size of the digest in bytes
+    pub const fn size(self) -> usize {
+        match self {
+            MacHash::Sha256 => 32,
+            MacHash::Sha512 => 64,
+        }
+    }
+}
+
+/// Generates an HMAC type over a cxlib context. `$init` is the keying
+/// function of the context.
+macro_rules! impl_hmac {
+    ($(#[$doc:meta])* $typename:ident, $ctx:ty, $size:expr, $init:ident) => {
+        $(#[$doc])*
+        #[derive(Clone)]
+        pub struct $typename {
+            ctx: $ctx,
+        }
+
+        impl $typename {
+            /// Size of the MAC in bytes
+            pub const MAC_SIZE: usize = $size;
+
+            /// Context keyed with `key`
+            pub fn new(key: &[u8]) -> Result<Self, CxError> {
+                let mut h = $typename {
+                    ctx: <$ctx>::default(),
+                };
+                let err = unsafe { $init(&mut h.ctx, key.as_ptr(), key.len() as size_t) };
+                if err != CX_OK {
+                    Err(err.into())
+                } else {
+                    Ok(h)
+                }
+            }
+
+            /// Authenticate `input`, appending it to the data fed so far
+            pub fn update(&mut self, input: &[u8]) -> Result<(), CxError> {
+                crate::cx_profile!("cx_hmac_update");
+                let err = unsafe {
+                    cx_hmac_update(
+                        &mut self.ctx as *mut $ctx as *mut cx_hmac_t,
+                        input.as_ptr(),
+                        input.len() as size_t,
+                    )
+                };
+                if err != CX_OK {
+                    Err(err.into())
+                } else {
+                    Ok(())
+                }
+            }
+
+            /// Write the MAC of all the data fed so far into `mac`, truncated
+            /// to its length if shorter than `MAC_SIZE`
+            pub fn finalize_into(mut self, mac: &mut [u8]) -> Result<(), CxError> {
+                let mut full = [0u8; $size];
+                let mut len = $size as size_t;
+                crate::cx_profile!("cx_hmac_final");
+                let err = unsafe {
+                    cx_hmac_final(
+                        &mut self.ctx as *mut $ctx as *mut cx_hmac_t,
+                        full.as_mut_ptr(),
+                        &mut len,
+                    )
+                };
+                if err != CX_OK {
+                    return Err(err.into());
+                }
+                let n = mac.len().min($size);
+                mac[..n].copy_from_slice(&full[..n]);
+                Ok(())
+            }
+
+            /// Return the MAC of all the data fed so far
+            pub fn finalize(self) -> Result<[u8; $size], CxError> {
+                let mut mac = [0u8; $size];
+                self.finalize_into(&mut mac)?;
+                Ok(mac)
+            }
+
+            /// Check in constant time that the MAC of all the data fed so far
+            /// is `mac`, possibly truncated
+            pub fn verify(self, mac: &[u8]) -> Result<bool, CxError> {
+                if mac.is_empty() || mac.len() > $size {
+                    return Err(CxError::InvalidParameterSize);
+                }
+                let mut full = [0u8; $size];
+                self.finalize_into(&mut full)?;
+                Ok(ct_eq(&full[..mac.len()], mac))
+            }
+
+            /// One-shot MAC of `input` under `key`
+            pub fn mac(key: &[u8], input: &[u8]) -> Result<[u8; $size], CxError> {
+                let mut h = Self::new(key)?;
+                h.update(input)?;
+                h.finalize()
+            }
+        }
+
+        /// The context holds the key: clear it
+        impl Drop for $typename {
+            #[inline(never)]
+            fn drop(&mut self) {
+                zeroize(&mut self.ctx.key);
+            }
+        }
+    };
+}
+
+impl_hmac!(
+    HmacSha256,
+    cx_hmac_sha256_t,
+    32,
+    cx_hmac_sha256_init_no_throw
+);
+impl_hmac!(
+    HmacSha512,
+    cx_hmac_sha512_t,
+    64,
+    cx_hmac_sha512_init_no_throw
+);
+
+/// HKDF-Extract: pseudorandom key from the input keying material `ikm`.
+/// `P` must be the digest size of `hash`.
+pub fn hkdf_extract<const P: usize>(
+    hash: MacHash,
+    salt: &[u8],
+    ikm: &[u8],
+) -> Result<Secret<P>, CxError> {
+    if P != hash.size() {
+        return Err(CxError::InvalidParameterSize);
+    }
+    let mut prk = Secret::<P>::new();
+    unsafe {
+        cx_hkdf_extract(
+            hash.md(),
+            ikm.as_ptr(),
+            ikm.len() as u32,
+            salt.as_ptr() as *mut u8,
+            salt.len() as u32,
+            prk.as_mut().as_mut_ptr(),
+        )
+    };
+    Ok(prk)
+}
+
+/// HKDF-Expand: `N` bytes of output keying material from the pseudorandom
+/// key `prk`, bound to `info`
+pub fn hkdf_expand<const N: usize>(
+    hash: MacHash,
+    prk: &[u8],
+    info: &[u8],
+) -> Result<Secret<N>, CxError> {
+    if prk.len() < hash.size() || N > 255 * hash.size() {
+        return Err(CxError::InvalidParameterSize);
+    }
+    let mut okm = Secret::<N>::new();
+    unsafe {
+        cx_hkdf_expand(
+            hash.md(),
+            prk.as_ptr(),
+            prk.len() as u32,
+            info.as_ptr() as *mut u8,
+            info.len() as u32,
+            okm.as_mut().as_mut_ptr(),
+            N as u32,
+        )
+    };
+    Ok(okm)
+}
+
+/// HKDF (RFC 5869): extract then expand
+pub fn hkdf<const N: usize>(
+    hash: MacHash,
+    salt: &[u8],
+    ikm: &[u8],
+    info: &[u8],
+) -> Result<Secret<N>, CxError> {
+    match hash {
+        MacHash::Sha256 => {
+            let prk = hkdf_extract::<32>(hash, salt, ikm)?;
+            hkdf_expand(hash, prk.as_ref(), info)
+        }
+        MacHash::Sha512 => {
+            let prk = hkdf_extract::<64>(hash, salt, ikm)?;
+            hkdf_expand(hash, prk.as_ref(), info)
+        }
+    }
+}
+
+/// PBKDF2 (RFC 8018) with HMAC over `hash`: `N` bytes derived from
+/// `password` and `salt`
+pub fn pbkdf2<const N: usize>(
+    hash: MacHash,
+    password: &[u8],
+    salt: &[u8],
+    iterations: u32,
+) -> Result<Secret<N>, CxError> {
+    let mut out = Secret::<N>::new();
+    let err = unsafe {
+        cx_pbkdf2_no_throw(
+            hash.md(),
+            password.as_ptr(),
+            password.len() as size_t,
+            salt.as_ptr() as *mut u8,
+            salt.len() as size_t,
+            iterations,
+            out.as_mut().as_mut_ptr(),
+            N as size_t,
+        )
+    };
+    if err != CX_OK {
+        Err(err.into())
+    } else {
+        Ok(out)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn hmac_sha256() {
+        // RFC 4231, test case 2
+        let expected = [
+            0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95,
+            0x75, 0xc7, 0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9,
+            0x64, 0xec, 0x38, 0x43,
+        ];
+        let keyed = HmacSha256::new(b"Jefe").map_err(|_| ())?;
+        let mut h = keyed.clone();
+        h.update(b"what do ya want ").map_err(|_| ())?;
+        h.update(b"for nothing?").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, expected);
+        let mut h = keyed.clone();
+        h.update(b"what do ya want for nothing?").map_err(|_| ())?;
+        assert_eq!(h.finalize().map_err(|_| ())?, expected);
+        let mut h = keyed.clone();
+        h.update(b"what do ya want for nothing?").map_err(|_| ())?;
+        assert_eq!(h.verify(&expected[..16]).map_err(|_| ())?, true);
+    }
+
+    #[test]
+    fn hkdf_sha256() {
+        // RFC 5869, test case 1
+        let ikm = [0x0bu8; 22];
+        let salt = [0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12];
+        let info = [0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9];
+        let expected = [
+            0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64, 0xd0, 0x36,
+            0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a, 0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56,
+            0xec, 0xc4, 0xc5, 0xbf, 0x34, 0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65,
+        ];
+        let okm = hkdf::<42>(MacHash::Sha256, &salt, &ikm, &info).map_err(|_| ())?;
+        assert_eq!(okm.as_ref(), &expected[..]);
+    }
+}
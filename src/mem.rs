@@ -0,0 +1,269 @@
+//! `memcpy`, `memmove` and `memset`
+//!
+//! The versions of compiler-builtins, built for size, move a byte at a time,
+//! and they are also what the C SDK objects link against. These ones move
+//! 16 bytes per LDM/STM pair when both pointers have the same alignment,
+//! words for the rest, and bytes only at the ends. They take precedence
+//! over the weak symbols of compiler-builtins, for Rust code and the C
+//! objects alike, along with the `__aeabi_mem*` variants LLVM emits calls
+//! to on ARM.
+//!
+//! Every access goes through `read_volatile` and `write_volatile`, so that
+//! LLVM does not turn the loops back into calls to these functions.
+
+use core::arch::asm;
+use core::ptr::{read_volatile, write_volatile};
+
+/// Below this length, aligning the pointers costs more than it saves
+const WORD_THRESHOLD: usize = 16;
+
+unsafe fn copy_bytes_forward(mut dest: *mut u8, mut src: *const u8, n: usize) {
+    for _ in 0..n {
+        write_volatile(dest, read_volatile(src));
+        dest = dest.add(1);
+        src = src.add(1);
+    }
+}
+
+/// Copy `n` bytes from `src` to `dest`, going up. Safe for overlapping
+/// buffers when `dest` is below `src`.
+#[optimize(speed)]
+unsafe fn copy_forward(mut dest: *mut u8, mut src: *const u8, mut n: usize) {
+    if n < WORD_THRESHOLD || (dest as usize ^ src as usize) & 3 != 0 {
+        return copy_bytes_forward(dest, src, n);
+    }
+    let head = (dest as usize).wrapping_neg() & 3;
+    copy_bytes_forward(dest, src, head);
+    dest = dest.add(head);
+    src = src.add(head);
+    n -= head;
+    while n >= 16 {
+        // A burst loaded in full before it is stored, and stored below the
+        // next one
+        asm!(
+            "ldmia r1!, {{r2, r3, r4, r5}}",
+            "stmia r0!, {{r2, r3, r4, r5}}",
+            inout("r0") dest,
+            inout("r1") src,
+            out("r2") _,
+            out("r3") _,
+            out("r4") _,
+            out("r5") _,
+            options(nostack, preserves_flags)
+        );
+        n -= 16;
+    }
+    while n >= 4 {
+        write_volatile(dest as *mut u32, read_volatile(src as *const u32));
+        dest = dest.add(4);
+        src = src.add(4);
+        n -= 4;
+    }
+    copy_bytes_forward(dest, src, n);
+}
+
+/// Copy `n` bytes from `src` to `dest`, going down from the end. Safe for
+/// overlapping buffers when `dest` is above `src`.
+#[optimize(speed)]
+unsafe fn copy_backward(dest: *mut u8, src: *const u8, mut n: usize) {
+    let (mut dest_end, mut src_end) = (dest.add(n), src.add(n));
+    if n >= WORD_THRESHOLD && (dest as usize ^ src as usize) & 3 == 0 {
+        // ldmdb and stmdb are not in Thumb-1: words only
+        let tail = dest_end as usize & 3;
+        for _ in 0..tail {
+            dest_end = dest_end.sub(1);
+            src_end = src_end.sub(1);
+            write_volatile(dest_end, read_volatile(src_end));
+        }
+        n -= tail;
+        while n >= 4 {
+            dest_end = dest_end.sub(4);
+            src_end = src_end.sub(4);
+            write_volatile(dest_end as *mut u32, read_volatile(src_end as *const u32));
+            n -= 4;
+        }
+    }
+    for _ in 0..n {
+        dest_end = dest_end.sub(1);
+        src_end = src_end.sub(1);
+        write_volatile(dest_end, read_volatile(src_end));
+    }
+}
+
+#[optimize(speed)]
+unsafe fn fill(mut dest: *mut u8, c: u8, mut n: usize) {
+    if n >= WORD_THRESHOLD {
+        let head = (dest as usize).wrapping_neg() & 3;
+        for _ in 0..head {
+            write_volatile(dest, c);
+            dest = dest.add(1);
+        }
+        n -= head;
+        let word = c as u32 * 0x0101_0101;
+        while n >= 16 {
+            asm!(
+                "stmia r0!, {{r2, r3, r4, r5}}",
+                inout("r0") dest,
+                in("r2") word,
+                in("r3") word,
+                in("r4") word,
+                in("r5") word,
+                options(nostack, preserves_flags)
+            );
+            n -= 16;
+        }
+        while n >= 4 {
+            write_volatile(dest as *mut u32, word);
+            dest = dest.add(4);
+            n -= 4;
+        }
+    }
+    for _ in 0..n {
+        write_volatile(dest, c);
+        dest = dest.add(1);
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memcpy(dest: *mut u8, src: *const u8, n: usize) -> *mut u8 {
+    copy_forward(dest, src, n);
+    dest
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memmove(dest: *mut u8, src: *const u8, n: usize) -> *mut u8 {
+    if (dest as usize).wrapping_sub(src as usize) >= n {
+        // dest is below src, or above its end
+        copy_forward(dest, src, n);
+    } else {
+        copy_backward(dest, src, n);
+    }
+    dest
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn memset(s: *mut u8, c: i32, n: usize) -> *mut u8 {
+    fill(s, c as u8, n);
+    s
+}
+
+// The C ABI of the soft-float targets is the AAPCS the `__aeabi_*`
+// functions use
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memcpy(dest: *mut u8, src: *const u8, n: usize) {
+    copy_forward(dest, src, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memcpy4(dest: *mut u8, src: *const u8, n: usize) {
+    copy_forward(dest, src, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memcpy8(dest: *mut u8, src: *const u8, n: usize) {
+    copy_forward(dest, src, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memmove(dest: *mut u8, src: *const u8, n: usize) {
+    memmove(dest, src, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memmove4(dest: *mut u8, src: *const u8, n: usize) {
+    memmove(dest, src, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memmove8(dest: *mut u8, src: *const u8, n: usize) {
+    memmove(dest, src, n);
+}
+
+// The value comes last in the EABI variants
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memset(dest: *mut u8, n: usize, c: i32) {
+    fill(dest, c as u8, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memset4(dest: *mut u8, n: usize, c: i32) {
+    fill(dest, c as u8, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memset8(dest: *mut u8, n: usize, c: i32) {
+    fill(dest, c as u8, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memclr(dest: *mut u8, n: usize) {
+    fill(dest, 0, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memclr4(dest: *mut u8, n: usize) {
+    fill(dest, 0, n);
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn __aeabi_memclr8(dest: *mut u8, n: usize) {
+    fill(dest, 0, n);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    fn pattern() -> [u8; 64] {
+        let mut buf = [0u8; 64];
+        for (i, b) in buf.iter_mut().enumerate() {
+            *b = i as u8 + 1;
+        }
+        buf
+    }
+
+    #[test]
+    fn copies() {
+        let src = pattern();
+        // Every relative alignment, with and without bursts
+        for (offset, len) in [(0, 40), (1, 40), (2, 37), (3, 20), (0, 7)] {
+            for dest_offset in 0..4 {
+                let mut dest = [0u8; 64];
+                unsafe {
+                    memcpy(
+                        dest.as_mut_ptr().add(dest_offset),
+                        src.as_ptr().add(offset),
+                        len,
+                    )
+                };
+                assert_eq!(
+                    &dest[dest_offset..dest_offset + len],
+                    &src[offset..offset + len]
+                );
+                assert_eq!(dest[dest_offset + len], 0);
+            }
+        }
+    }
+
+    #[test]
+    fn overlapping() {
+        let src = pattern();
+        for (from, to) in [(0, 4), (4, 0), (1, 6), (6, 1), (0, 20), (20, 0)] {
+            let mut buf = src;
+            unsafe { memmove(buf.as_mut_ptr().add(to), buf.as_ptr().add(from), 40) };
+            assert_eq!(&buf[to..to + 40], &src[from..from + 40]);
+        }
+    }
+
+    #[test]
+    fn fills() {
+        let mut buf = [0u8; 64];
+        unsafe { memset(buf.as_mut_ptr().add(3), 0x1a5, 50) };
+        assert_eq!(buf[..3], [0; 3]);
+        assert_eq!(buf[3..53].iter().all(|&b| b == 0xa5), true);
+        assert_eq!(buf[53..], [0; 11]);
+    }
+}
@@ -0,0 +1,115 @@
+//! Memory introspection
+//!
+//! [`info`] combines the free NVM reported by the OS with the layout of the
+//! RAM of the app set by link.ld: `.bss`, the heap of the
+//! [`Arena`](crate::arena::Arena) and the stack, which grows down towards
+//! the canary word placed after the heap. The RAM between the stack pointer
+//! and the canary is what is left for deeper calls.
+//!
+//! The three targets have very different amounts of RAM. A component whose
+//! buffer size is a trade-off, such as the chunk size of a streaming hash
+//! or the depth of a queue, can size it at startup from what is actually
+//! free instead of the value fitting the smallest target:
+//!
+//! ```
+//! let len = memory::info().buffer_len(2048, 256, 4096);
+//! HEAP.scope(|scope| {
+//!     let chunk = scope.alloc_slice(len.min(scope.remaining()), 0u8)?;
+//!     // ...
+//! });
+//! ```
+
+use crate::bindings::{meminfo_t, os_get_memory_info};
+#[cfg(not(feature = "host"))]
+use core::arch::asm;
+use core::ptr::addr_of;
+
+extern "C" {
+    // Bounds set by link.ld, in .bss: reached through the static base
+    static _bss: u8;
+    static _ebss: u8;
+    static _heap: u8;
+    static _eheap: u8;
+    static app_stack_canary: u32;
+}
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct MemoryInfo {
+    /// Free NVM, in bytes, for the installation of apps
+    pub free_nvm: usize,
+    /// Free app slots
+    pub free_slots: usize,
+    /// Size of `.bss`, the static variables
+    pub bss: usize,
+    /// Size of the heap region
+    pub heap: usize,
+    /// Bytes between the stack pointer and the canary below the stack
+    pub stack_free: usize,
+}
+
+impl MemoryInfo {
+    /// Size of a buffer to place on the stack, leaving `reserve` bytes of
+    /// stack free: what is free, clamped to `[min, max]`.
+    /// `min` must not be greater than `max`.
+    pub fn buffer_len(&self, reserve: usize, min: usize, max: usize) -> usize {
+        self.stack_free.saturating_sub(reserve).clamp(min, max)
+    }
+}
+
+#[cfg(not(feature = "host"))]
+#[inline(always)]
+fn sp() -> usize {
+    let sp: usize;
+    unsafe { asm!("mov {}, sp", out(reg) sp) };
+    sp
+}
+
+/// Address of a local, close enough to the stack pointer
+#[cfg(feature = "host")]
+#[inline(always)]
+fn sp() -> usize {
+    let local = 0u8;
+    core::hint::black_box(addr_of!(local)) as usize
+}
+
+/// Current memory usage of the app and free NVM
+pub fn info() -> MemoryInfo {
+    let mut meminfo = meminfo_t {
+        free_nvram_size: 0,
+        appMemory: 0,
+        systemSize: 0,
+        slots: 0,
+    };
+    unsafe { os_get_memory_info(&mut meminfo) };
+    let (bss, heap, stack_bottom) = unsafe {
+        (
+            addr_of!(_ebss) as usize - addr_of!(_bss) as usize,
+            addr_of!(_eheap) as usize - addr_of!(_heap) as usize,
+            addr_of!(app_stack_canary).add(1) as usize,
+        )
+    };
+    MemoryInfo {
+        free_nvm: meminfo.free_nvram_size as usize,
+        free_slots: meminfo.slots as usize,
+        bss,
+        heap,
+        stack_free: sp().saturating_sub(stack_bottom),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn layout() {
+        let info = info();
+        assert_eq!(info.bss > 0, true);
+        assert_eq!(info.stack_free > 0, true);
+        assert_eq!(info.buffer_len(info.stack_free, 16, 64), 16);
+        assert_eq!(info.buffer_len(0, 16, 64), 64);
+    }
+}
@@ -0,0 +1,419 @@
+//! Merkle trees and Merkleized maps, for structures streamed by the host
+//!
+//! Instead of sending a whole structure (a PSBT, long calldata, chain
+//! metadata), the host commits to the root of a Merkle tree of its
+//! elements, and sends each element the app asks for along with the proof
+//! that it is in the tree. The trees are those of RFC 6962: leaves are
+//! hashed as `SHA-256(0x00 || data)` and nodes as
+//! `SHA-256(0x01 || left || right)`, so that a leaf cannot pass for a node.
+//!
+//! ```
+//! let tree = MerkleTree::new(root, size);
+//! let mut leaf = leaf_hasher();
+//! comm.hash_payload(INS_LEAF, 0x80, &mut leaf)?;
+//! let leaf = leaf.finalize()?;
+//! let mut proof = tree.verifier(index, leaf);
+//! comm.stream_payload(INS_PROOF, 0x80, |chunk| Ok(proof.feed(chunk)?))?;
+//! if !proof.finish()? {
+//!     return Err(StatusWords::BadLen.into());
+//! }
+//! ```
+//!
+//! A [`NodeCache`] remembers the leaves already verified, so that an app
+//! fetching an element again can skip its proof.
+
+use crate::ecc::CxError;
+use crate::hash::{HashFn, Sha256};
+
+/// Domain tag of the leaves
+pub const LEAF_TAG: u8 = 0x00;
+/// Domain tag of the inner nodes
+pub const NODE_TAG: u8 = 0x01;
+
+/// Hash context of a leaf, having absorbed its tag: its data can then be
+/// fed as it is received
+pub fn leaf_hasher() -> Sha256 {
+    let mut h = Sha256::new();
+    // Cannot fail on a fresh context
+    let _ = h.update(&[LEAF_TAG]);
+    h
+}
+
+/// Hash of the leaf `data`
+pub fn leaf_hash(data: &[u8]) -> Result<[u8; 32], CxError> {
+    let mut h = leaf_hasher();
+    h.update(data)?;
+    h.finalize()
+}
+
+/// Hash of the node of children `left` and `right`
+pub fn node_hash(left: &[u8; 32], right: &[u8; 32]) -> Result<[u8; 32], CxError> {
+    let mut h = Sha256::new();
+    h.update(&[NODE_TAG])?;
+    h.update(left)?;
+    h.update(right)?;
+    h.finalize()
+}
+
+/// Root of the tree of the hashed `leaves`, the first `k` leaves making the
+/// left subtree, `k` being the largest power of two below their number
+pub fn root(leaves: &[[u8; 32]]) -> Result<[u8; 32], CxError> {
+    match leaves.len() {
+        0 => Sha256::hash(&[]),
+        1 => Ok(leaves[0]),
+        n => {
+            let k = 1 << (usize::BITS - 1 - (n - 1).leading_zeros());
+            node_hash(&root(&leaves[..k])?, &root(&leaves[k..])?)
+        }
+    }
+}
+
+/// Most leaves of a [`TreeBuilder`]
+pub const MAX_BUILT_LEAVES: u32 = (1 << BUILDER_DEPTH) - 1;
+
+const BUILDER_DEPTH: usize = 16;
+
+/// Tree built as its leaves are appended, keeping only the root of each of
+/// its complete subtrees, for the app to commit to a list of its own
+/// without holding it whole
+pub struct TreeBuilder {
+    /// Roots of the complete subtrees, largest first, of the sizes given
+    /// by the bits of `size`
+    subtrees: [[u8; 32]; BUILDER_DEPTH],
+    depth: usize,
+    size: u32,
+}
+
+impl Default for TreeBuilder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl TreeBuilder {
+    pub const fn new() -> Self {
+        TreeBuilder {
+            subtrees: [[0; 32]; BUILDER_DEPTH],
+            depth: 0,
+            size: 0,
+        }
+    }
+
+    /// Append the leaf of hash `leaf_hash`, failing after
+    /// [`MAX_BUILT_LEAVES`]
+    pub fn push(&mut self, leaf_hash: [u8; 32]) -> Result<(), CxError> {
+        if self.size == MAX_BUILT_LEAVES {
+            return Err(CxError::InvalidParameterSize);
+        }
+        // Merge the subtrees of the same size as the one being completed
+        let mut hash = leaf_hash;
+        let mut size = self.size;
+        while size & 1 == 1 {
+            self.depth -= 1;
+            hash = node_hash(&self.subtrees[self.depth], &hash)?;
+            size >>= 1;
+        }
+        self.subtrees[self.depth] = hash;
+        self.depth += 1;
+        self.size += 1;
+        Ok(())
+    }
+
+    /// Number of leaves appended
+    pub fn size(&self) -> u32 {
+        self.size
+    }
+
+    /// Tree of the leaves appended so far, the same as [`root`] computes
+    pub fn tree(&self) -> Result<MerkleTree, CxError> {
+        let root = match self.subtrees[..self.depth].split_last() {
+            None => Sha256::hash(&[])?,
+            Some((last, rest)) => {
+                let mut hash = *last;
+                for left in rest.iter().rev() {
+                    hash = node_hash(left, &hash)?;
+                }
+                hash
+            }
+        };
+        Ok(MerkleTree::new(root, self.size))
+    }
+}
+
+/// Commitment of the host to a list of `size` elements
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub struct MerkleTree {
+    pub root: [u8; 32],
+    pub size: u32,
+}
+
+impl MerkleTree {
+    pub fn new(root: [u8; 32], size: u32) -> Self {
+        MerkleTree { root, size }
+    }
+
+    /// Streaming verification of the proof that the leaf of hash
+    /// `leaf_hash` is at `index`
+    pub fn verifier(&self, index: u32, leaf_hash: [u8; 32]) -> ProofVerifier {
+        ProofVerifier {
+            tree: *self,
+            index: index as u64,
+            last: (self.size as u64).wrapping_sub(1),
+            hash: leaf_hash,
+            pending: [0; 32],
+            pending_len: 0,
+            valid: index < self.size,
+        }
+    }
+
+    /// Whether `proof`, the hashes of the siblings from the leaf up,
+    /// proves that the leaf of hash `leaf_hash` is at `index`
+    pub fn verify(
+        &self,
+        index: u32,
+        leaf_hash: [u8; 32],
+        proof: &[[u8; 32]],
+    ) -> Result<bool, CxError> {
+        let mut verifier = self.verifier(index, leaf_hash);
+        for sibling in proof {
+            verifier.feed(sibling)?;
+        }
+        verifier.finish()
+    }
+}
+
+/// Proof of inclusion of a leaf, checked as the hashes of the siblings are
+/// received, in chunks cut anywhere (RFC 9162, section 2.1.3.2)
+pub struct ProofVerifier {
+    tree: MerkleTree,
+    index: u64,
+    last: u64,
+    hash: [u8; 32],
+    pending: [u8; 32],
+    pending_len: usize,
+    valid: bool,
+}
+
+impl ProofVerifier {
+    /// Absorb the next bytes of the proof
+    pub fn feed(&mut self, mut data: &[u8]) -> Result<(), CxError> {
+        while !data.is_empty() {
+            let n = (32 - self.pending_len).min(data.len());
+            self.pending[self.pending_len..self.pending_len + n].copy_from_slice(&data[..n]);
+            self.pending_len += n;
+            data = &data[n..];
+            if self.pending_len == 32 {
+                self.pending_len = 0;
+                let sibling = self.pending;
+                self.step(&sibling)?;
+            }
+        }
+        Ok(())
+    }
+
+    fn step(&mut self, sibling: &[u8; 32]) -> Result<(), CxError> {
+        if !self.valid || self.last == 0 {
+            // Longer than the path to the root
+            self.valid = false;
+            return Ok(());
+        }
+        if self.index & 1 == 1 || self.index == self.last {
+            self.hash = node_hash(sibling, &self.hash)?;
+            // The last node of a level without sibling moves up as is
+            while self.index & 1 == 0 && self.index != 0 {
+                self.index >>= 1;
+                self.last >>= 1;
+            }
+        } else {
+            self.hash = node_hash(&self.hash, sibling)?;
+        }
+        self.index >>= 1;
+        self.last >>= 1;
+        Ok(())
+    }
+
+    /// Whether the proof received leads to the root of the tree
+    pub fn finish(self) -> Result<bool, CxError> {
+        Ok(self.valid && self.pending_len == 0 && self.last == 0 && self.hash == self.tree.root)
+    }
+}
+
+/// Leaves of one tree already verified, up to `E` of them, replaced in a
+/// round-robin fashion
+pub struct NodeCache<const E: usize> {
+    tree: Option<MerkleTree>,
+    leaves: [(u32, [u8; 32]); E],
+    len: usize,
+    next: usize,
+}
+
+impl<const E: usize> Default for NodeCache<E> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const E: usize> NodeCache<E> {
+    pub const fn new() -> Self {
+        NodeCache {
+            tree: None,
+            leaves: [(0, [0; 32]); E],
+            len: 0,
+            next: 0,
+        }
+    }
+
+    /// Hash of the leaf `index` of `tree`, if it has been verified
+    pub fn get(&self, tree: &MerkleTree, index: u32) -> Option<&[u8; 32]> {
+        if self.tree.as_ref() != Some(tree) {
+            return None;
+        }
+        self.leaves[..self.len]
+            .iter()
+            .find(|(i, _)| *i == index)
+            .map(|(_, hash)| hash)
+    }
+
+    /// Record that the leaf `index` of `tree` has hash `leaf_hash`, once its
+    /// proof has been verified. Entries of another tree are dropped.
+    pub fn insert(&mut self, tree: &MerkleTree, index: u32, leaf_hash: [u8; 32]) {
+        if self.tree.as_ref() != Some(tree) {
+            self.tree = Some(*tree);
+            self.len = 0;
+            self.next = 0;
+        }
+        if E == 0 || self.get(tree, index).is_some() {
+            return;
+        }
+        self.leaves[self.next] = (index, leaf_hash);
+        self.next = (self.next + 1) % E;
+        self.len = (self.len + 1).min(E);
+    }
+
+    pub fn clear(&mut self) {
+        self.tree = None;
+        self.len = 0;
+        self.next = 0;
+    }
+}
+
+/// Map committed to as the Merkle trees of its keys, sorted, and of their
+/// values, in the same order, as in the PSBT maps of the Ledger Bitcoin app
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub struct MerkleizedMap {
+    pub size: u32,
+    pub keys_root: [u8; 32],
+    pub values_root: [u8; 32],
+}
+
+impl MerkleizedMap {
+    pub fn new(size: u32, keys_root: [u8; 32], values_root: [u8; 32]) -> Self {
+        MerkleizedMap {
+            size,
+            keys_root,
+            values_root,
+        }
+    }
+
+    /// Tree of the keys
+    pub fn keys(&self) -> MerkleTree {
+        MerkleTree::new(self.keys_root, self.size)
+    }
+
+    /// Tree of the values
+    pub fn values(&self) -> MerkleTree {
+        MerkleTree::new(self.values_root, self.size)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    /// Proof of the leaf `index` of `leaves`, into `proof`, returning its
+    /// length (RFC 9162, section 2.1.3.1)
+    fn path(index: usize, leaves: &[[u8; 32]], proof: &mut [[u8; 32]]) -> Result<usize, CxError> {
+        let n = leaves.len();
+        if n <= 1 {
+            return Ok(0);
+        }
+        let k = 1 << (usize::BITS - 1 - (n - 1).leading_zeros());
+        let (len, sibling) = if index < k {
+            (path(index, &leaves[..k], proof)?, root(&leaves[k..])?)
+        } else {
+            (path(index - k, &leaves[k..], proof)?, root(&leaves[..k])?)
+        };
+        proof[len] = sibling;
+        Ok(len + 1)
+    }
+
+    #[test]
+    fn merkle_proofs() {
+        let mut leaves = [[0u8; 32]; 7];
+        for (i, leaf) in leaves.iter_mut().enumerate() {
+            *leaf = leaf_hash(&[i as u8; 3]).map_err(|_| ())?;
+        }
+        for size in 1..=leaves.len() {
+            let tree = MerkleTree::new(root(&leaves[..size]).map_err(|_| ())?, size as u32);
+            for index in 0..size {
+                let mut proof = [[0u8; 32]; 3];
+                let len = path(index, &leaves[..size], &mut proof).map_err(|_| ())?;
+                let proof = &proof[..len];
+                let leaf = leaves[index];
+                assert_eq!(tree.verify(index as u32, leaf, proof), Ok(true));
+                assert_eq!(
+                    tree.verify(index as u32, leaves[6], proof),
+                    Ok(size == 7 && index == 6)
+                );
+                assert_eq!(tree.verify(size as u32, leaf, proof), Ok(false));
+                if len > 0 {
+                    assert_eq!(tree.verify(index as u32, leaf, &proof[1..]), Ok(false));
+                }
+
+                // Streamed in chunks cut anywhere
+                let mut verifier = tree.verifier(index as u32, leaf);
+                let bytes = proof.as_flattened();
+                for chunk in bytes.chunks(7) {
+                    verifier.feed(chunk).map_err(|_| ())?;
+                }
+                assert_eq!(verifier.finish(), Ok(true));
+            }
+        }
+    }
+
+    #[test]
+    fn tree_builder() {
+        let mut builder = TreeBuilder::new();
+        assert_eq!(builder.tree().map(|t| t.root).ok(), root(&[]).ok());
+        let mut leaves = [[0u8; 32]; 7];
+        for (i, leaf) in leaves.iter_mut().enumerate() {
+            *leaf = leaf_hash(&[i as u8; 3]).map_err(|_| ())?;
+        }
+        for (i, leaf) in leaves.iter().enumerate() {
+            builder.push(*leaf).map_err(|_| ())?;
+            let tree = builder.tree().map_err(|_| ())?;
+            assert_eq!(tree.size as usize, i + 1);
+            assert_eq!(Some(tree.root), root(&leaves[..i + 1]).ok());
+        }
+    }
+
+    #[test]
+    fn node_cache() {
+        let tree = MerkleTree::new([1; 32], 4);
+        let other = MerkleTree::new([2; 32], 4);
+        let mut cache = NodeCache::<2>::new();
+        cache.insert(&tree, 0, [10; 32]);
+        cache.insert(&tree, 1, [11; 32]);
+        assert_eq!(cache.get(&tree, 1), Some(&[11; 32]));
+        assert_eq!(cache.get(&other, 1), None);
+        cache.insert(&tree, 2, [12; 32]);
+        assert_eq!(cache.get(&tree, 0), None);
+        assert_eq!(cache.get(&tree, 2), Some(&[12; 32]));
+        cache.insert(&other, 3, [13; 32]);
+        assert_eq!(cache.get(&tree, 2), None);
+        assert_eq!(cache.get(&other, 3), Some(&[13; 32]));
+    }
+}
@@ -40,12 +40,76 @@
 //! println!("counter value is {}", *counter.get_ref());
 //! ```
 
-use crate::bindings::nvm_write;
+use crate::bindings::cx_crc32_hw;
+use crate::io::Event;
+use crate::lz4::{self, Lz4Decoder, Lz4Error};
+use crate::svc::nvm_write;
+use crate::{fatal, Fatal};
 use AtomicStorageElem::{StorageA, StorageB};
 
-// Warning: currently alignment is fixed by magic values everywhere, since
-// rust does not allow using a constant in repr(align(...))
-// This code will work correctly only for the currently set page size of 64.
+/// Defines the Flash page size and the page-aligned wrapper, from the
+/// `PAGE_SIZE` of the target linker script (see build.rs), as
+/// `#[repr(align(N))]` does not accept a constant.
+macro_rules! page_layout {
+    ($n:literal) => {
+        /// Size of a Flash page, the unit erased and rewritten by each NVM write
+        pub const PAGE_SIZE: usize = $n;
+
+        /// Starts its content on a Flash page boundary, and pads it to a whole
+        /// number of pages, so that nothing else shares its pages.
+        #[repr(align($n))]
+        struct PageAligned<T>(T);
+    };
+}
+
+include!(concat!(env!("OUT_DIR"), "/page_size.rs"));
+
+fn as_bytes<T>(value: &T) -> &[u8] {
+    unsafe {
+        core::slice::from_raw_parts(value as *const T as *const u8, core::mem::size_of::<T>())
+    }
+}
+
+/// Write `src` to NVM at `dst`, skipping the Flash pages which already hold
+/// the right content. Consecutive pages to be changed are written at once.
+#[optimize(speed)]
+fn write_changed_pages(dst: *const u8, src: &[u8]) {
+    // Start offset of the pending run of changed pages
+    let mut run: Option<usize> = None;
+    let mut offset = 0;
+    while offset < src.len() {
+        let addr = dst as usize + offset;
+        let len = (PAGE_SIZE - addr % PAGE_SIZE).min(src.len() - offset);
+        let current = unsafe { core::slice::from_raw_parts(addr as *const u8, len) };
+        let changed = current != &src[offset..offset + len];
+        match (changed, run) {
+            (true, None) => run = Some(offset),
+            (false, Some(start)) => {
+                write_run(dst, src, start, offset);
+                run = None;
+            }
+            _ => (),
+        }
+        offset += len;
+    }
+    if let Some(start) = run {
+        write_run(dst, src, start, src.len());
+    }
+}
+
+#[optimize(speed)]
+fn write_run(dst: *const u8, src: &[u8], start: usize, end: usize) {
+    crate::trace_span!("nvm_write");
+    #[cfg(feature = "nvm_stats")]
+    crate::nvm_stats::record(dst as usize + start, end - start);
+    unsafe {
+        nvm_write(
+            dst.add(start) as *mut core::ffi::c_void,
+            src[start..].as_ptr() as *mut core::ffi::c_void,
+            (end - start) as u32,
+        );
+    }
+}
 
 /// Returned when trying to insert data when no more space is available
 pub struct StorageFullError;
@@ -68,10 +132,9 @@ pub trait SingleStorage<T> {
 /// Wraps a variable stored in Non-Volatile Memory to provide read and update
 /// methods.
 ///
-/// Always aligned to the beginning of a page to prevent different
-/// AlignedStorage sharing a common Flash page (this is required to implement
-/// unfinished write detection in SafeStorage and atomic operations in
-/// AtomicStorage).
+/// Aligned to 64 bytes, the smallest Flash page size, so distinct
+/// AlignedStorage never share a page on Nano S and only rewrite whole 64-byte
+/// blocks elsewhere.
 ///
 /// Warning: this wrapper does not provide any garantee about update atomicity.
 #[repr(align(64))]
@@ -100,16 +163,11 @@ impl<T> SingleStorage<T> for AlignedStorage<T> {
     }
 
     /// Update the value by writting to the NVM memory.
+    /// Only the Flash pages whose content changes are rewritten.
     /// Warning: this can be vulnerable to tearing - leading to partial write.
     fn update(&mut self, value: &T) {
-        unsafe {
-            nvm_write(
-                &self.value as *const T as *const core::ffi::c_void as *mut core::ffi::c_void,
-                value as *const T as *const core::ffi::c_void as *mut core::ffi::c_void,
-                core::mem::size_of::<T>() as u32,
-            );
-            let mut _dummy = &self.value;
-        }
+        write_changed_pages(&self.value as *const T as *const u8, as_bytes(value));
+        let mut _dummy = &self.value;
     }
 }
 
@@ -120,33 +178,52 @@ const STORAGE_VALID: u8 = 0xa5;
 /// Non-Volatile data storage, with a flag to detect corruption if the update
 /// has been interrupted somehow.
 ///
-/// During update:
+/// The flag is the byte following the value, in its last Flash page, and
+/// the storage starts on a page of its own: it takes no page more than the
+/// value needs, and shares none with other data. During update:
 /// 1. The flag is reset to 0
 /// 2. The value is updated
 /// 3. The flag is restored to STORAGE_VALID
+///
+/// A page is programmed from its start once erased, so that the flag is
+/// always written after the value bytes sharing its page: it cannot be read
+/// as valid from a page torn before them.
 pub struct SafeStorage<T> {
-    flag: AlignedStorage<u8>,
-    value: AlignedStorage<T>,
+    record: PageAligned<Flagged<T>>,
+}
+
+/// Value of a [`SafeStorage`] followed by its flag
+#[repr(C)]
+struct Flagged<T> {
+    value: T,
+    flag: u8,
 }
 
 impl<T> SafeStorage<T> {
     pub const fn new(value: T) -> SafeStorage<T> {
         SafeStorage {
-            flag: AlignedStorage::new(STORAGE_VALID),
-            value: AlignedStorage::new(value),
+            record: PageAligned(Flagged {
+                value,
+                flag: STORAGE_VALID,
+            }),
         }
     }
 
+    fn write_flag(&mut self, flag: u8) {
+        write_changed_pages(&self.record.0.flag, &[flag]);
+        let mut _dummy = &self.record.0.flag;
+    }
+
     /// Set the validation flag to zero to mark the content as invalid.
     /// This used for instance by the atomic storage management.
     pub fn invalidate(&mut self) {
-        self.flag.update(&0);
+        self.write_flag(0);
     }
 
     /// Returns true if the stored value is not corrupted, false if a previous
     /// update operation has been interrupted.
     pub fn is_valid(&self) -> bool {
-        *self.flag.get_ref() == STORAGE_VALID
+        self.record.0.flag == STORAGE_VALID
     }
 }
 
@@ -154,43 +231,40 @@ impl<T> SingleStorage<T> for SafeStorage<T> {
     /// Return non-mutable reference to the stored value.
     /// Panic if the storage is not valid (corrupted).
     fn get_ref(&self) -> &T {
-        assert_eq!(*self.flag.get_ref(), STORAGE_VALID);
-        self.value.get_ref()
+        assert_eq!(self.record.0.flag, STORAGE_VALID);
+        &self.record.0.value
     }
 
+    /// Invalidate the flag, write the value, then validate the flag, so that
+    /// a torn write never leaves a partial value flagged valid. Nothing is
+    /// written if the value is already stored.
     fn update(&mut self, value: &T) {
-        self.flag.update(&0);
-        self.value.update(value);
-        self.flag.update(&STORAGE_VALID);
+        if self.is_valid() && as_bytes(&self.record.0.value) == as_bytes(value) {
+            return;
+        }
+        self.write_flag(0);
+        write_changed_pages(
+            &self.record.0.value as *const T as *const u8,
+            as_bytes(value),
+        );
+        let mut _dummy = &self.record.0.value;
+        self.write_flag(STORAGE_VALID);
     }
 }
 
 /// Non-Volatile data storage with atomic update support.
-/// Takes at minimum twice the size of the data to be stored, plus 2 bytes.
-/// Aligning to the required page size is done through a macro
-/// as `#[repr(align(N))]` does not accept variable 'N'
-macro_rules! atomic_storage {
-    ($n:expr) => {
-        #[repr(align($n))]
-        pub struct AtomicStorage<T> {
-            // We must keep the storage B in another page, so when we update the
-            // storage A, erasing the page of A won't modify the storage for B.
-            // This is currently garanteed by the alignment of AlignedStorage.
-            storage_a: SafeStorage<T>,
-            storage_b: SafeStorage<T>, // We also accept situations where both storages are marked as valid, which
-                                       // can happen with tearing. This is not a problem, and we consider the first
-                                       // one is the "correct" one.
-        }
-    };
+/// Each of the two copies of the data lives in its own Flash pages, so that
+/// erasing the page of one copy can never modify the other one: this takes
+/// at minimum two Flash pages.
+pub struct AtomicStorage<T> {
+    storage_a: SafeStorage<T>,
+    storage_b: SafeStorage<T>,
+    // We also accept situations where both storages are marked as valid, which
+    // can happen with tearing. This is not a problem, and we consider the first
+    // one is the "correct" one.
 }
 
-#[cfg(target_os = "nanos")]
-atomic_storage!(64);
-#[cfg(target_os = "nanox")]
-atomic_storage!(256);
-#[cfg(target_os = "nanosplus")]
-atomic_storage!(512);
-
+#[derive(Copy, Clone)]
 pub enum AtomicStorageElem {
     StorageA,
     StorageB,
@@ -210,17 +284,16 @@ where
 
     /// Returns which storage contains the latest valid data.
     ///
-    /// # Panics
-    ///
-    /// Panics if both storage elements are invalid (data corrupton),
-    /// although data corruption shall not be possible with tearing.
+    /// Exits with [`Fatal::InvalidatedStorage`] if both storage elements
+    /// are invalid (data corrupton), although data corruption shall not be
+    /// possible with tearing.
     fn which(&self) -> AtomicStorageElem {
         if self.storage_a.is_valid() {
             StorageA
         } else if self.storage_b.is_valid() {
             StorageB
         } else {
-            panic!("invalidated atomic storage");
+            fatal(Fatal::InvalidatedStorage);
         }
     }
 }
@@ -240,42 +313,440 @@ where
     /// Update the value by writting to the NVM memory.
     /// Warning: this can be vulnerable to tearing - leading to partial write.
     fn update(&mut self, value: &T) {
-        match self.which() {
+        self.update_from(self.which(), value);
+    }
+}
+
+impl<T> AtomicStorage<T>
+where
+    T: Copy,
+{
+    /// Write `value` to the copy other than `active`, and return it, the
+    /// latest one
+    fn update_from(&mut self, active: AtomicStorageElem, value: &T) -> AtomicStorageElem {
+        match active {
             StorageA => {
                 self.storage_b.update(value);
                 self.storage_a.invalidate();
+                StorageB
             }
             StorageB => {
                 self.storage_a.update(value);
                 self.storage_b.invalidate();
+                StorageA
+            }
+        }
+    }
+
+    /// Handle reading the latest copy without checking the flags again, as
+    /// long as the storage is only updated through it
+    pub fn handle(&mut self) -> AtomicHandle<'_, T> {
+        AtomicHandle {
+            active: self.which(),
+            storage: self,
+        }
+    }
+}
+
+/// [`AtomicStorage`] whose latest copy is known, returned by
+/// [`AtomicStorage::handle`].
+///
+/// Together with the reference returned once by
+/// [`NVMData::get_mut`](crate::NVMData::get_mut), which is kept instead of
+/// translating the address on each access, values read on every command
+/// such as settings are plain memory reads.
+///
+/// ```
+/// let mut settings = unsafe { SETTINGS.get_mut() }.handle();
+/// loop {
+///     if settings.get_ref().blind_signing { ... }
+/// }
+/// ```
+pub struct AtomicHandle<'a, T> {
+    storage: &'a mut AtomicStorage<T>,
+    active: AtomicStorageElem,
+}
+
+impl<T> SingleStorage<T> for AtomicHandle<'_, T>
+where
+    T: Copy,
+{
+    fn get_ref(&self) -> &T {
+        match self.active {
+            StorageA => &self.storage.storage_a.record.0.value,
+            StorageB => &self.storage.storage_b.record.0.value,
+        }
+    }
+
+    fn update(&mut self, value: &T) {
+        self.active = self.storage.update_from(self.active, value);
+    }
+}
+
+impl<T> AtomicStorage<T>
+where
+    T: Copy,
+{
+    /// Update to `value` a Flash page at a time, with each call to
+    /// [`BackgroundUpdate::step`], so that an application writing several
+    /// KiB can go on answering the host between the page writes:
+    ///
+    /// ```
+    /// let mut update = storage.background_update(&book);
+    /// while !update.step() {
+    ///     comm.poll_transport();
+    /// }
+    /// ```
+    ///
+    /// The update has the same tearing safety as [`SingleStorage::update`]:
+    /// the other copy is invalidated before being written, and only marked
+    /// valid once complete. Until then, and if the update is dropped
+    /// unfinished, the storage holds the previous value.
+    pub fn background_update<'a>(&'a mut self, value: &'a T) -> BackgroundUpdate<'a, T> {
+        let (current, target) = match self.which() {
+            StorageA => (&mut self.storage_a, &mut self.storage_b),
+            StorageB => (&mut self.storage_b, &mut self.storage_a),
+        };
+        BackgroundUpdate {
+            current,
+            target,
+            value,
+            phase: UpdatePhase::Invalidate,
+        }
+    }
+}
+
+enum UpdatePhase {
+    Invalidate,
+    /// Bytes of the value written so far
+    Value(usize),
+    Validate,
+    Retire,
+    Done,
+}
+
+/// [`AtomicStorage`] update in progress, returned by
+/// [`AtomicStorage::background_update`]
+pub struct BackgroundUpdate<'a, T> {
+    current: &'a mut SafeStorage<T>,
+    target: &'a mut SafeStorage<T>,
+    value: &'a T,
+    phase: UpdatePhase,
+}
+
+impl<T> BackgroundUpdate<'_, T> {
+    /// Run the next step of the update, which writes at most one Flash
+    /// page. Returns whether the update is complete.
+    pub fn step(&mut self) -> bool {
+        self.phase = match self.phase {
+            UpdatePhase::Invalidate => {
+                self.target.invalidate();
+                UpdatePhase::Value(0)
+            }
+            UpdatePhase::Value(offset) => {
+                let src = as_bytes(self.value);
+                let dst = &self.target.record.0.value as *const T as *const u8;
+                let addr = dst as usize + offset;
+                let end = (offset + PAGE_SIZE - addr % PAGE_SIZE).min(src.len());
+                write_changed_pages(unsafe { dst.add(offset) }, &src[offset..end]);
+                let mut _dummy = &self.target.record.0.value;
+                if end == src.len() {
+                    UpdatePhase::Validate
+                } else {
+                    UpdatePhase::Value(end)
+                }
+            }
+            UpdatePhase::Validate => {
+                self.target.write_flag(STORAGE_VALID);
+                UpdatePhase::Retire
+            }
+            UpdatePhase::Retire | UpdatePhase::Done => {
+                self.current.invalidate();
+                UpdatePhase::Done
+            }
+        };
+        matches!(self.phase, UpdatePhase::Done)
+    }
+
+    /// Run the remaining steps at once
+    pub fn finish(mut self) {
+        while !self.step() {}
+    }
+}
+
+/// CRC of the records which have never been updated, whose value is the
+/// initial one set at build time, as the CRC engine is not available then.
+/// Neither erased nor zeroed Flash.
+const INITIAL_CRC: u32 = 0x5afe_c0de;
+
+/// CRC32 of `data`, computed by the CRC engine of the chip
+pub(crate) fn crc32(data: &[u8]) -> u32 {
+    unsafe { cx_crc32_hw(data.as_ptr() as *const core::ffi::c_void, data.len() as _) }
+}
+
+/// Non-Volatile record holding a CRC32 of its value, to detect corruption if
+/// an update has been interrupted.
+///
+/// Unlike [`SafeStorage`], there is no flag to clear beforehand and restore
+/// afterwards: the CRC, an update counter and the value are written at once,
+/// and are checked in a single pass over the value. The counter tells which
+/// copy of a [`CrcAtomicStorage`] is the latest.
+///
+/// The CRC of the value is mixed with the counter, so that a torn update of
+/// the same value is detected as well.
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub struct CrcStorage<T> {
+    crc: u32,
+    /// Number of updates, 0 for the initial value only
+    seq: u32,
+    value: T,
+}
+
+impl<T: Copy> CrcStorage<T> {
+    pub const fn new(value: T) -> CrcStorage<T> {
+        CrcStorage {
+            crc: INITIAL_CRC,
+            seq: 0,
+            value,
+        }
+    }
+
+    /// Returns true if the stored value is not corrupted, false if a previous
+    /// update operation has been interrupted.
+    pub fn is_valid(&self) -> bool {
+        match self.seq {
+            0 => self.crc == INITIAL_CRC,
+            seq => self.crc == crc32(as_bytes(&self.value)) ^ seq,
+        }
+    }
+
+    /// Write `value` with the update counter `seq`, in a single pass over
+    /// the Flash pages changed
+    fn write(&mut self, value: &T, seq: u32) {
+        // Skip 0 when wrapping around, which marks the initial value
+        let seq = seq.max(1);
+        let mut record = CrcStorage {
+            crc: 0,
+            seq,
+            value: *value,
+        };
+        record.crc = crc32(as_bytes(&record.value)) ^ seq;
+        write_changed_pages(self as *const Self as *const u8, as_bytes(&record));
+        let mut _dummy = &self.value;
+    }
+}
+
+impl<T: Copy> SingleStorage<T> for CrcStorage<T> {
+    /// Return non-mutable reference to the stored value.
+    /// Exits with [`Fatal::CorruptedStorage`] if the storage is not valid.
+    fn get_ref(&self) -> &T {
+        if !self.is_valid() {
+            fatal(Fatal::CorruptedStorage);
+        }
+        &self.value
+    }
+
+    fn update(&mut self, value: &T) {
+        self.write(value, self.seq.wrapping_add(1));
+    }
+}
+
+/// Non-Volatile data storage with atomic update support, as
+/// [`AtomicStorage`], made of two [`CrcStorage`] copies in their own Flash
+/// pages.
+///
+/// Updates overwrite the older copy with a newer update counter, and leave
+/// the latest one as is: there is no second write to invalidate it.
+pub struct CrcAtomicStorage<T> {
+    storage_a: PageAligned<CrcStorage<T>>,
+    storage_b: PageAligned<CrcStorage<T>>,
+}
+
+impl<T> CrcAtomicStorage<T>
+where
+    T: Copy,
+{
+    /// Create a CrcAtomicStorage<T> initialized with a given value.
+    pub const fn new(value: &T) -> CrcAtomicStorage<T> {
+        CrcAtomicStorage {
+            storage_a: PageAligned(CrcStorage::new(*value)),
+            storage_b: PageAligned(CrcStorage::new(*value)),
+        }
+    }
+
+    /// Returns which storage contains the latest valid data.
+    ///
+    /// Exits with [`Fatal::InvalidatedStorage`] if both storage elements
+    /// are invalid (data corrupton), although data corruption shall not be
+    /// possible with tearing.
+    fn which(&self) -> AtomicStorageElem {
+        let (a, b) = (&self.storage_a.0, &self.storage_b.0);
+        match (a.is_valid(), b.is_valid()) {
+            // b is newer if its counter is ahead, wrapping around
+            (true, true) if (b.seq.wrapping_sub(a.seq) as i32) > 0 => StorageB,
+            (true, _) => StorageA,
+            (false, true) => StorageB,
+            (false, false) => fatal(Fatal::InvalidatedStorage),
+        }
+    }
+}
+
+impl<T> SingleStorage<T> for CrcAtomicStorage<T>
+where
+    T: Copy,
+{
+    /// Return reference to the stored value.
+    fn get_ref(&self) -> &T {
+        match self.which() {
+            StorageA => &self.storage_a.0.value,
+            StorageB => &self.storage_b.0.value,
+        }
+    }
+
+    /// Update the value by writting the other copy
+    fn update(&mut self, value: &T) {
+        match self.which() {
+            StorageA => {
+                let seq = self.storage_a.0.seq.wrapping_add(1);
+                self.storage_b.0.write(value, seq);
+            }
+            StorageB => {
+                let seq = self.storage_b.0.seq.wrapping_add(1);
+                self.storage_a.0.write(value, seq);
             }
         }
     }
 }
+
+/// RAM copy of a value stored in NVM, an [`AtomicStorage`] by default, so
+/// that APDU handlers can change settings and counters without waiting for
+/// the Flash writes.
+///
+/// Changes mark the copy dirty, and are written to the storage on
+/// [`Shadowed::commit`], which is the durability point of the application
+/// (before replying to a command whose effect must survive a power loss),
+/// or when the event loop is idle, with [`Shadowed::on_event`] on each
+/// event. Dropping a dirty copy commits it.
+///
+/// # Examples
+///
+/// ```
+/// let mut settings = Shadowed::new(unsafe { SETTINGS.get_mut() });
+/// loop {
+///     let event = comm.next_event();
+///     settings.on_event(&event);
+///     match event {
+///         Event::Command(Ins::SetBlindSigning) => settings.modify(|s| s.blind = true),
+///         _ => (),
+///     }
+/// }
+/// ```
+pub struct Shadowed<'a, T: Copy, S: SingleStorage<T> = AtomicStorage<T>> {
+    storage: &'a mut S,
+    value: T,
+    dirty: bool,
+}
+
+impl<'a, T: Copy, S: SingleStorage<T>> Shadowed<'a, T, S> {
+    /// Shadow the value held by `storage`
+    pub fn new(storage: &'a mut S) -> Self {
+        let value = *storage.get_ref();
+        Shadowed {
+            storage,
+            value,
+            dirty: false,
+        }
+    }
+
+    /// Current value, including the changes not committed yet
+    pub fn get(&self) -> &T {
+        &self.value
+    }
+
+    /// Replace the value, marking the copy dirty if it changes
+    pub fn set(&mut self, value: &T) {
+        if as_bytes(value) != as_bytes(&self.value) {
+            self.value = *value;
+            self.dirty = true;
+        }
+    }
+
+    /// Change the value in place with `f`
+    pub fn modify(&mut self, f: impl FnOnce(&mut T)) {
+        let mut value = self.value;
+        f(&mut value);
+        self.set(&value);
+    }
+
+    /// Whether some changes have not been written to NVM yet
+    pub fn is_dirty(&self) -> bool {
+        self.dirty
+    }
+
+    /// Write the pending changes to NVM, if any
+    pub fn commit(&mut self) {
+        if self.dirty {
+            self.storage.update(&self.value);
+            self.dirty = false;
+        }
+    }
+
+    /// Commit the pending changes on ticker events, which [`Comm::next_event`]
+    /// only returns when no command is waiting for a reply
+    ///
+    /// [`Comm::next_event`]: crate::io::Comm::next_event
+    pub fn on_event<E>(&mut self, event: &Event<E>) {
+        if let Event::Ticker = event {
+            self.commit();
+        }
+    }
+}
+
+impl<T: Copy, S: SingleStorage<T>> Drop for Shadowed<'_, T, S> {
+    fn drop(&mut self) {
+        self.commit();
+    }
+}
+
 pub struct KeyOutOfRange;
 
+/// Number of bytes of the allocation bitmap of a collection of `n` items
+pub const fn bitmap_len(n: usize) -> usize {
+    n.div_ceil(8)
+}
+
 /// A Non-Volatile fixed-size collection of fixed-size items.
-/// Items insertion and deletion are atomic.
-/// Items update is not implemented because the atomicity of this operation
-/// cannot be guaranteed here.
+/// Items insertion, deletion and update are atomic.
+///
+/// Allocated slots are tracked in a bitmap (bit `key % 8` of byte `key / 8`),
+/// so counting or locating items is done a byte at a time with popcounts and
+/// flag updates rewrite N/8 bytes. For large collections, a
+/// [`RankedCollection`] caches the ranks in RAM so that lookups and
+/// counting do not scan the bitmap.
 // We use the term `index` to represent the user-facing number of an element in the collection,
 // and the term `key` to represent the underlying offset at which the element is located in the collection.
 // e.g with `[0, 0, 1, 1, 0, 1, 0]` (with 0s representing free slots and 1s representing allocated slots)
 //            ↑  ↑  ↑  ↑  ↑  ↑  ↑
 // index:     -  -  0  1  -  2  -
 // key:       0, 1, 2, 3, 4, 5, 6
-pub struct Collection<T, const N: usize> {
-    flags: AtomicStorage<[u8; N]>,
+pub struct Collection<T, const N: usize>
+where
+    [(); bitmap_len(N)]:,
+{
+    flags: AtomicStorage<[u8; bitmap_len(N)]>,
     slots: [AlignedStorage<T>; N],
 }
 
 impl<T, const N: usize> Collection<T, N>
 where
     T: Copy,
+    [(); bitmap_len(N)]:,
 {
     pub const fn new(value: T) -> Collection<T, N> {
+        assert!(N <= u16::MAX as usize, "too many slots");
         Collection {
-            flags: AtomicStorage::new(&[0; N]),
+            flags: AtomicStorage::new(&[0; bitmap_len(N)]),
             slots: [AlignedStorage::new(value); N],
         }
     }
@@ -283,10 +754,10 @@ where
     /// Finds and returns a reference to a free slot, or returns None if
     /// all slots are allocated.
     fn find_free_slot(&self) -> Option<usize> {
-        self.flags
-            .get_ref()
-            .iter()
-            .position(|&e| e != STORAGE_VALID)
+        let flags = self.flags.get_ref();
+        let byte = flags.iter().position(|&b| b != 0xff)?;
+        let key = byte * 8 + flags[byte].trailing_ones() as usize;
+        (key < N).then_some(key)
     }
 
     /// Adds an item in the collection. Returns an error if there is not free
@@ -297,7 +768,7 @@ where
             Some(i) => {
                 self.slots[i].update(value);
                 let mut new_flags = *self.flags.get_ref();
-                new_flags[i] = STORAGE_VALID;
+                new_flags[i / 8] |= 1 << (i % 8);
                 self.flags.update(&new_flags);
                 Ok(())
             }
@@ -311,16 +782,10 @@ where
     ///
     /// Returns an error if the `key` is out of range.
     fn is_allocated(&self, key: usize) -> Result<bool, KeyOutOfRange> {
-        match self.flags.get_ref().get(key) {
-            Some(&byte) => {
-                if byte == STORAGE_VALID {
-                    Ok(true)
-                } else {
-                    Ok(false)
-                }
-            }
-            None => Err(KeyOutOfRange),
+        if key >= N {
+            return Err(KeyOutOfRange);
         }
+        Ok(self.flags.get_ref()[key / 8] & (1 << (key % 8)) != 0)
     }
 
     /// Returns the number of allocated slots.
@@ -330,7 +795,7 @@ where
 
     /// Returns true if collection is empty
     pub fn is_empty(&self) -> bool {
-        !self.flags.get_ref().iter().any(|v| *v == STORAGE_VALID)
+        self.flags.get_ref().iter().all(|&b| b == 0)
     }
 
     /// Returns the maximum number of items the collection can store.
@@ -346,11 +811,14 @@ where
 
     /// Counts the number of allocated slots up until `len`.
     fn count_allocated(&self, len: usize) -> usize {
-        self.flags
-            .get_ref()
+        let flags = self.flags.get_ref();
+        let full = flags[..len / 8]
             .iter()
-            .take(len)
-            .fold(0, |acc, &byte| acc + (byte == STORAGE_VALID) as u32) as usize
+            .fold(0, |acc, &b| acc + b.count_ones() as usize);
+        match len % 8 {
+            0 => full,
+            bits => full + (flags[len / 8] & ((1 << bits) - 1)).count_ones() as usize,
+        }
     }
 
     /// Returns the `key` of an item in the internal storage, given the `index`
@@ -360,21 +828,23 @@ where
     ///
     /// * `index` - Index in the collection
     fn index_to_key(&self, index: usize) -> Option<usize> {
-        // Neat optimization: start by setting `next` to index,
-        // because we know we could not have found `index` allocated slots beforehand.
-        let mut key = index;
-        // Now count the number of allocated slots we have found up
-        // until this `index` (without including the slot at `index` itself).
-        let mut allocated_count = self.count_allocated(index);
-        loop {
-            let is_allocated = self.is_allocated(key).ok()?;
-            if is_allocated {
-                if allocated_count == index {
-                    return Some(key);
-                }
-                allocated_count += 1;
+        // Skip whole bytes of the bitmap until the one holding the item
+        let mut remaining = index;
+        for (i, &byte) in self.flags.get_ref().iter().enumerate() {
+            let count = byte.count_ones() as usize;
+            if remaining < count {
+                return Some(i * 8 + select(byte, remaining));
             }
-            key += 1;
+            remaining -= count;
+        }
+        None
+    }
+
+    /// Key of the item at `index`, which must be in bounds
+    fn key(&self, index: usize) -> usize {
+        match self.index_to_key(index) {
+            Some(key) => key,
+            None => fatal(Fatal::OutOfRange),
         }
     }
 
@@ -390,65 +860,1672 @@ where
         }
     }
 
-    /// Removes the item located at `index` from the collection.
+    /// Replaces the item located at `index` by `value`, and returns the new
+    /// index of the item.
+    /// This operation is atomic: the new value is written into a free slot,
+    /// then the flags of both slots are flipped in a single flags update.
+    ///
+    /// The index is kept whenever a slot next to the item is free. Otherwise, the item is moved to the
+    /// first free slot and its index may change.
     ///
     /// # Arguments
     ///
     /// * `index` - Item index
+    /// * `value` - New value of the item
+    ///
+    /// # Errors
+    ///
+    /// Returns an error if there is no free slot.
+    ///
+    /// Exits with [`Fatal::OutOfRange`] if `index` is out of bounds.
+    pub fn update(&mut self, index: usize, value: &T) -> Result<usize, StorageFullError> {
+        let key = self.key(index);
+        let is_free = |k: usize| matches!(self.is_allocated(k), Ok(false));
+        let new_key = [key + 1, key.wrapping_sub(1)]
+            .into_iter()
+            .find(|&k| is_free(k))
+            .or_else(|| self.find_free_slot())
+            .ok_or(StorageFullError)?;
+        self.slots[new_key].update(value);
+        let mut new_flags = *self.flags.get_ref();
+        new_flags[key / 8] &= !(1 << (key % 8));
+        new_flags[new_key / 8] |= 1 << (new_key % 8);
+        self.flags.update(&new_flags);
+        Ok(self.count_allocated(new_key))
+    }
+
+    /// Removes the item located at `index` from the collection.
+    ///
+    /// # Arguments
     ///
-    /// # Panics
+    /// * `index` - Item index
     ///
-    /// Panics if `index` is out of bounds.
+    /// Exits with [`Fatal::OutOfRange`] if `index` is out of bounds.
     pub fn remove(&mut self, index: usize) {
-        let key = self.index_to_key(index).unwrap();
+        let key = self.key(index);
         let mut new_flags = *self.flags.get_ref();
-        new_flags[key] = 0;
+        new_flags[key / 8] &= !(1 << (key % 8));
         self.flags.update(&new_flags);
     }
 
     /// Removes all the items from the collection.
     /// This operation is atomic.
     pub fn clear(&mut self) {
-        self.flags.update(&[0; N]);
+        self.flags.update(&[0; bitmap_len(N)]);
     }
 }
 
-impl<'a, T, const N: usize> IntoIterator for &'a Collection<T, N>
-where
-    T: Copy,
-{
-    type Item = &'a T;
-    type IntoIter = CollectionIterator<'a, T, N>;
-
-    fn into_iter(self) -> CollectionIterator<'a, T, N> {
-        CollectionIterator {
-            container: self,
-            next_key: 0,
-        }
+/// Position of the set bit of rank `rank` in `byte`, which must have more
+/// than `rank` bits set
+fn select(byte: u8, rank: usize) -> usize {
+    // Clear the `rank` lowest set bits
+    let mut b = byte;
+    for _ in 0..rank {
+        b &= b - 1;
     }
+    b.trailing_zeros() as usize
 }
 
-pub struct CollectionIterator<'a, T, const N: usize>
+/// A [`Collection`] along with a RAM cache of the number of items before
+/// each byte of its bitmap, so that [`RankedCollection::get`] is a binary
+/// search and [`RankedCollection::len`] a lookup instead of scans of the
+/// bitmap. The cache costs two bytes of RAM per eight slots, and is rebuilt
+/// in RAM after each change of the collection.
+///
+/// # Examples
+///
+/// ```
+/// let mut book = RankedCollection::new(unsafe { BOOK.get_mut() });
+/// let contact = book.get(index);
+/// ```
+pub struct RankedCollection<'a, T, const N: usize>
 where
-    T: Copy,
+    [(); bitmap_len(N)]:,
 {
-    container: &'a Collection<T, N>,
-    next_key: usize,
+    collection: &'a mut Collection<T, N>,
+    /// Number of items in the bytes of the bitmap before each one
+    ranks: [u16; bitmap_len(N)],
+    len: usize,
 }
 
-impl<'a, T, const N: usize> Iterator for CollectionIterator<'a, T, N>
+impl<'a, T, const N: usize> RankedCollection<'a, T, N>
 where
     T: Copy,
+    [(); bitmap_len(N)]:,
 {
-    type Item = &'a T;
+    /// Cache the ranks of the items of `collection`
+    pub fn new(collection: &'a mut Collection<T, N>) -> Self {
+        let mut ranked = RankedCollection {
+            collection,
+            ranks: [0; bitmap_len(N)],
+            len: 0,
+        };
+        ranked.refresh();
+        ranked
+    }
 
-    fn next(&mut self) -> core::option::Option<&'a T> {
-        loop {
-            let is_allocated = self.container.is_allocated(self.next_key).ok()?;
-            self.next_key += 1;
-            if is_allocated {
-                return Some(self.container.slots[self.next_key - 1].get_ref());
-            }
+    fn refresh(&mut self) {
+        let mut len = 0;
+        for (rank, &byte) in self.ranks.iter_mut().zip(self.collection.flags.get_ref()) {
+            *rank = len as u16;
+            len += byte.count_ones() as usize;
         }
+        self.len = len;
+    }
+
+    /// Returns the number of items
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns true if the collection is empty
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Returns the remaining number of items which can be added
+    pub fn remaining(&self) -> usize {
+        N - self.len
+    }
+
+    /// Returns reference to an item, or None if the index is out of bounds
+    pub fn get(&self, index: usize) -> Option<&T> {
+        if index >= self.len {
+            return None;
+        }
+        // Last byte with at most `index` items before it
+        let byte = self.ranks.partition_point(|&rank| rank as usize <= index) - 1;
+        let flags = self.collection.flags.get_ref()[byte];
+        let key = byte * 8 + select(flags, index - self.ranks[byte] as usize);
+        Some(self.collection.slots[key].get_ref())
+    }
+
+    /// Adds an item, see [`Collection::add`]
+    pub fn add(&mut self, value: &T) -> Result<(), StorageFullError> {
+        self.collection.add(value)?;
+        self.refresh();
+        Ok(())
+    }
+
+    /// Replaces the item at `index`, see [`Collection::update`]
+    pub fn update(&mut self, index: usize, value: &T) -> Result<usize, StorageFullError> {
+        let index = self.collection.update(index, value)?;
+        self.refresh();
+        Ok(index)
+    }
+
+    /// Removes the item at `index`, see [`Collection::remove`]
+    pub fn remove(&mut self, index: usize) {
+        self.collection.remove(index);
+        self.refresh();
+    }
+
+    /// Removes all the items
+    pub fn clear(&mut self) {
+        self.collection.clear();
+        self.refresh();
+    }
+
+    /// Iterates over the items
+    pub fn iter(&self) -> CollectionIterator<'_, T, N> {
+        self.collection.into_iter()
+    }
+}
+
+impl<'a, T, const N: usize> IntoIterator for &'a Collection<T, N>
+where
+    T: Copy,
+    [(); bitmap_len(N)]:,
+{
+    type Item = &'a T;
+    type IntoIter = CollectionIterator<'a, T, N>;
+
+    fn into_iter(self) -> CollectionIterator<'a, T, N> {
+        CollectionIterator {
+            container: self,
+            next_key: 0,
+        }
+    }
+}
+
+pub struct CollectionIterator<'a, T, const N: usize>
+where
+    T: Copy,
+    [(); bitmap_len(N)]:,
+{
+    container: &'a Collection<T, N>,
+    next_key: usize,
+}
+
+impl<'a, T, const N: usize> Iterator for CollectionIterator<'a, T, N>
+where
+    T: Copy,
+    [(); bitmap_len(N)]:,
+{
+    type Item = &'a T;
+
+    fn next(&mut self) -> core::option::Option<&'a T> {
+        loop {
+            let is_allocated = self.container.is_allocated(self.next_key).ok()?;
+            self.next_key += 1;
+            if is_allocated {
+                return Some(self.container.slots[self.next_key - 1].get_ref());
+            }
+        }
+    }
+}
+
+/// Key index of a [`SortedCollection`]: the keys of the items in increasing
+/// order, and the slot holding the value of each one
+#[derive(Copy, Clone)]
+struct SortedIndex<K, const N: usize> {
+    len: usize,
+    keys: [K; N],
+    slots: [u16; N],
+}
+
+/// A Non-Volatile fixed-size map from keys to values, with the items sorted
+/// by key. Insertion, replacement and removal are atomic.
+///
+/// The keys are kept in a sorted index, the only record of which slots are
+/// allocated, so finding an item by key is a binary search over the index
+/// instead of a scan of the slots, and iteration is in key order. Values
+/// are written to a free slot first, then the index is updated at once, as
+/// an [`AtomicStorage`].
+///
+/// Keys should be small, such as the hash of a registered wallet policy,
+/// as the whole index is copied to the stack on each change.
+///
+/// # Examples
+///
+/// ```
+/// #[link_section = ".nvm_data"]
+/// static mut BOOK: NVMData<SortedCollection<[u8; 20], Contact, 32>> =
+///     NVMData::new(SortedCollection::new([0; 20], Contact::EMPTY));
+///
+/// let book = unsafe { BOOK.get_mut() };
+/// book.insert(&address, &contact)?;
+/// let name = book.get(&address).map(|c| c.name);
+/// ```
+pub struct SortedCollection<K, V, const N: usize> {
+    index: AtomicStorage<SortedIndex<K, N>>,
+    slots: [AlignedStorage<V>; N],
+}
+
+impl<K, V, const N: usize> SortedCollection<K, V, N>
+where
+    K: Copy + Ord,
+    V: Copy,
+{
+    /// Empty collection, `key` and `value` filling the unused entries
+    pub const fn new(key: K, value: V) -> SortedCollection<K, V, N> {
+        assert!(N <= u16::MAX as usize, "collection too large");
+        SortedCollection {
+            index: AtomicStorage::new(&SortedIndex {
+                len: 0,
+                keys: [key; N],
+                slots: [0; N],
+            }),
+            slots: [AlignedStorage::new(value); N],
+        }
+    }
+
+    /// Position of `key` in the index, or where it would be inserted
+    fn search(&self, key: &K) -> Result<usize, usize> {
+        let index = self.index.get_ref();
+        index.keys[..index.len].binary_search(key)
+    }
+
+    /// Returns a reference to the value of `key`, if any
+    pub fn get(&self, key: &K) -> Option<&V> {
+        let pos = self.search(key).ok()?;
+        Some(self.slots[self.index.get_ref().slots[pos] as usize].get_ref())
+    }
+
+    /// Returns whether the collection holds an item with `key`
+    pub fn contains_key(&self, key: &K) -> bool {
+        self.search(key).is_ok()
+    }
+
+    /// Returns the number of items.
+    pub fn len(&self) -> usize {
+        self.index.get_ref().len
+    }
+
+    /// Returns true if collection is empty
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the maximum number of items the collection can store.
+    pub const fn capacity(&self) -> usize {
+        N
+    }
+
+    /// Finds a slot not referenced by the index
+    fn find_free_slot(&self) -> Option<usize>
+    where
+        [(); bitmap_len(N)]:,
+    {
+        let index = self.index.get_ref();
+        let mut used = [0u8; bitmap_len(N)];
+        for &slot in &index.slots[..index.len] {
+            used[slot as usize / 8] |= 1 << (slot % 8);
+        }
+        let byte = used.iter().position(|&b| b != 0xff)?;
+        let slot = byte * 8 + used[byte].trailing_ones() as usize;
+        (slot < N).then_some(slot)
+    }
+
+    /// Inserts `value` under `key`, replacing the previous value of `key`
+    /// if any.
+    /// This operation is atomic.
+    ///
+    /// # Errors
+    ///
+    /// Returns an error if there is no free slot, replacing a value needing
+    /// one as well.
+    pub fn insert(&mut self, key: &K, value: &V) -> Result<(), StorageFullError>
+    where
+        [(); bitmap_len(N)]:,
+    {
+        let slot = self.find_free_slot().ok_or(StorageFullError)?;
+        self.slots[slot].update(value);
+        let mut index = *self.index.get_ref();
+        match self.search(key) {
+            Ok(pos) => index.slots[pos] = slot as u16,
+            Err(pos) => {
+                index.keys.copy_within(pos..index.len, pos + 1);
+                index.slots.copy_within(pos..index.len, pos + 1);
+                index.keys[pos] = *key;
+                index.slots[pos] = slot as u16;
+                index.len += 1;
+            }
+        }
+        self.index.update(&index);
+        Ok(())
+    }
+
+    /// Removes the item with `key`, and returns whether there was one.
+    /// This operation is atomic.
+    pub fn remove(&mut self, key: &K) -> bool {
+        let Ok(pos) = self.search(key) else {
+            return false;
+        };
+        let mut index = *self.index.get_ref();
+        index.keys.copy_within(pos + 1..index.len, pos);
+        index.slots.copy_within(pos + 1..index.len, pos);
+        index.len -= 1;
+        self.index.update(&index);
+        true
+    }
+
+    /// Removes all the items from the collection.
+    /// This operation is atomic.
+    pub fn clear(&mut self) {
+        let mut index = *self.index.get_ref();
+        index.len = 0;
+        self.index.update(&index);
+    }
+
+    /// Iterates over the items in increasing key order
+    pub fn iter(&self) -> impl Iterator<Item = (&K, &V)> {
+        let index = self.index.get_ref();
+        index.keys[..index.len]
+            .iter()
+            .zip(&index.slots)
+            .map(|(key, &slot)| (key, self.slots[slot as usize].get_ref()))
+    }
+}
+
+/// Content of a [`CompressedBlob`]
+#[repr(C)]
+#[derive(Copy, Clone)]
+struct BlobData<const N: usize> {
+    /// Length of the LZ4 block
+    stored: u16,
+    /// Length of the data once decompressed
+    len: u16,
+    block: [u8; N],
+}
+
+/// Appends bytes to NVM from `dst`, a Flash page at a time
+struct PageWriter<'a> {
+    dst: &'a mut [u8],
+    /// Bytes written to NVM
+    written: usize,
+    page: [u8; PAGE_SIZE],
+    /// Bytes waiting in `page`
+    fill: usize,
+}
+
+impl PageWriter<'_> {
+    fn push(&mut self, mut data: &[u8]) -> Result<(), Lz4Error> {
+        if self.written + self.fill + data.len() > self.dst.len() {
+            return Err(Lz4Error::TooLong);
+        }
+        while !data.is_empty() {
+            let pos = self.dst.as_ptr() as usize + self.written + self.fill;
+            let room = PAGE_SIZE - pos % PAGE_SIZE;
+            let n = room.min(data.len());
+            self.page[self.fill..self.fill + n].copy_from_slice(&data[..n]);
+            self.fill += n;
+            data = &data[n..];
+            if n == room {
+                self.flush();
+            }
+        }
+        Ok(())
+    }
+
+    fn flush(&mut self) {
+        let dst = self.dst[self.written..].as_ptr();
+        write_changed_pages(dst, &self.page[..self.fill]);
+        let mut _dummy = &self.dst;
+        self.written += self.fill;
+        self.fill = 0;
+    }
+}
+
+/// Non-Volatile blob of `N` bytes holding data compressed with LZ4, such
+/// as token lists or ABI fragments cached on the device, decompressed on
+/// read by an [`Lz4Decoder`] of `W` bytes.
+///
+/// Data is compressed as it is written to Flash, a page at a time, without
+/// a buffer for the compressed data. The blob is marked invalid during the
+/// write, as a [`SafeStorage`], which is enough for a cache the host can
+/// send again: it is not atomic, and a torn write leaves it invalid.
+///
+/// # Examples
+///
+/// ```
+/// #[link_section = ".nvm_data"]
+/// static mut TOKENS: NVMData<CompressedBlob<8192, 1024>> = NVMData::new(CompressedBlob::new());
+/// static mut LZ4: Lz4Decoder<1024> = Lz4Decoder::new();
+///
+/// let tokens = unsafe { TOKENS.get_mut() };
+/// tokens.write(&list)?;
+/// tokens.read(unsafe { &mut *core::ptr::addr_of_mut!(LZ4) }, |data| {
+///     parser.feed(data)
+/// })?;
+/// ```
+pub struct CompressedBlob<const N: usize, const W: usize> {
+    storage: SafeStorage<BlobData<N>>,
+}
+
+impl<const N: usize, const W: usize> CompressedBlob<N, W> {
+    /// Empty blob
+    pub const fn new() -> CompressedBlob<N, W> {
+        assert!(N <= u16::MAX as usize, "blob too large");
+        CompressedBlob {
+            storage: SafeStorage::new(BlobData {
+                stored: 0,
+                len: 0,
+                block: [0; N],
+            }),
+        }
+    }
+
+    /// Returns false if the last write has been interrupted
+    pub fn is_valid(&self) -> bool {
+        self.storage.is_valid()
+    }
+
+    /// Length of the data once decompressed
+    pub fn len(&self) -> usize {
+        self.storage.record.0.value.len as usize
+    }
+
+    /// Returns true if the blob holds no data
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Length of the data as stored
+    pub fn stored_len(&self) -> usize {
+        self.storage.record.0.value.stored as usize
+    }
+
+    /// Replace the content of the blob with `data`, and return the number of
+    /// bytes it takes once compressed.
+    ///
+    /// # Errors
+    ///
+    /// Returns an error, and leaves the blob invalid, if the data does not
+    /// fit once compressed.
+    pub fn write(&mut self, data: &[u8]) -> Result<usize, StorageFullError> {
+        self.storage.invalidate();
+        let mut writer = PageWriter {
+            dst: &mut self.storage.record.0.value.block,
+            written: 0,
+            page: [0; PAGE_SIZE],
+            fill: 0,
+        };
+        lz4::compress(data, W, |block: &[u8]| writer.push(block))
+            .map_err(|_: Lz4Error| StorageFullError)?;
+        writer.flush();
+        let stored = writer.written;
+        let header = [stored as u16, data.len() as u16];
+        write_changed_pages(
+            &self.storage.record.0.value as *const BlobData<N> as *const u8,
+            as_bytes(&header),
+        );
+        let mut _dummy = &self.storage.record.0.value;
+        self.storage.write_flag(STORAGE_VALID);
+        Ok(stored)
+    }
+
+    /// Decompress the content of the blob with `decoder`, passing the data
+    /// to `sink` in one or more slices
+    pub fn read<E, F>(&self, decoder: &mut Lz4Decoder<W>, sink: F) -> Result<(), E>
+    where
+        E: From<Lz4Error>,
+        F: FnMut(&[u8]) -> Result<(), E>,
+    {
+        if !self.is_valid() {
+            return Err(Lz4Error::Truncated.into());
+        }
+        decoder.reset();
+        decoder.feed(
+            &self.storage.record.0.value.block[..self.stored_len()],
+            sink,
+        )?;
+        decoder.finish()?;
+        Ok(())
+    }
+
+    /// Decompress the content of the blob into `out`, and return its length
+    pub fn read_into(
+        &self,
+        decoder: &mut Lz4Decoder<W>,
+        out: &mut [u8],
+    ) -> Result<usize, Lz4Error> {
+        let mut len = 0;
+        self.read(decoder, |data: &[u8]| {
+            let dst = out
+                .get_mut(len..len + data.len())
+                .ok_or(Lz4Error::TooLong)?;
+            dst.copy_from_slice(data);
+            len += data.len();
+            Ok::<(), Lz4Error>(())
+        })?;
+        Ok(len)
+    }
+}
+
+impl<const N: usize, const W: usize> Default for CompressedBlob<N, W> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Marker of a key-value record in a [`KvLog`] segment
+const KV_RECORD: u8 = STORAGE_VALID;
+/// Marker of a key removal record in a [`KvLog`] segment
+const KV_TOMBSTONE: u8 = 0x5a;
+/// Magic starting the header of a [`KvLog`] segment
+const KV_SEGMENT_MAGIC: [u8; 2] = [0xa5, 0x4b];
+/// Magic starting the header of the copy of the first page of the active
+/// segment, kept in the spare segment
+const KV_MIRROR_MAGIC: [u8; 2] = [0x5a, 0x4d];
+/// Segment header: magic, big-endian generation number and big-endian CRC-16
+/// of both
+const KV_HEADER_LEN: usize = 6;
+/// Record header: marker, big-endian key and value length
+const KV_RECORD_HEADER_LEN: usize = 4;
+/// A record ends with a big-endian CRC-16 of the generation of its segment,
+/// its header and its value
+const KV_CHECK_LEN: usize = 2;
+/// Maximum length of a value in a [`KvStore`]
+pub const KV_MAX_VALUE_LEN: usize = 255;
+/// Maximum size of a record
+const KV_MAX_RECORD_LEN: usize = KV_RECORD_HEADER_LEN + KV_MAX_VALUE_LEN + KV_CHECK_LEN;
+
+/// Non-Volatile space backing a [`KvStore`], made of two segments of `N`
+/// bytes. The active segment is an append-only log of records; the other one
+/// is used when compacting the log, and otherwise holds copies of the pages
+/// being rewritten in the active segment.
+///
+/// `N` must be a multiple of the Flash page size so segments never share a
+/// page.
+pub struct KvLog<const N: usize> {
+    segments: PageAligned<[[u8; N]; 2]>,
+}
+
+impl<const N: usize> KvLog<N> {
+    pub const fn new() -> KvLog<N> {
+        assert!(
+            N % PAGE_SIZE == 0,
+            "segment size must be a multiple of the page size"
+        );
+        assert!(N <= u16::MAX as usize, "segment too large");
+        KvLog {
+            segments: PageAligned([[0; N]; 2]),
+        }
+    }
+}
+
+impl<const N: usize> Default for KvLog<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// CRC-16/CCITT-FALSE
+fn crc16(data: &[u8]) -> u16 {
+    crc16_update(0xffff, data)
+}
+
+/// Continue the CRC-16/CCITT-FALSE `crc` over `data`
+#[optimize(speed)]
+fn crc16_update(crc: u16, data: &[u8]) -> u16 {
+    data.iter().fold(crc, |crc, &b| {
+        (0..8).fold(crc ^ ((b as u16) << 8), |c, _| {
+            if c & 0x8000 != 0 {
+                (c << 1) ^ 0x1021
+            } else {
+                c << 1
+            }
+        })
+    })
+}
+
+/// Check of `record`, without its last [`KV_CHECK_LEN`] bytes, in a segment
+/// of generation `generation`. Records left over from other generations, in
+/// the copies of the spare segment, thus never pass as current ones.
+fn record_check(generation: u16, record: &[u8]) -> [u8; KV_CHECK_LEN] {
+    crc16_update(crc16(&generation.to_be_bytes()), record).to_be_bytes()
+}
+
+/// Segment header starting with `magic`
+fn segment_header(magic: [u8; 2], generation: u16) -> [u8; KV_HEADER_LEN] {
+    let g = generation.to_be_bytes();
+    let crc = crc16(&[magic[0], magic[1], g[0], g[1]]).to_be_bytes();
+    [magic[0], magic[1], g[0], g[1], crc[0], crc[1]]
+}
+
+/// Returns the generation in the header of `segment` if it starts with
+/// `magic` and is complete.
+fn segment_generation(segment: &[u8], magic: [u8; 2]) -> Option<u16> {
+    let generation = u16::from_be_bytes([segment[2], segment[3]]);
+    (segment[..KV_HEADER_LEN] == segment_header(magic, generation)).then_some(generation)
+}
+
+/// Parse the record starting `bytes`, which run to the end of a segment of
+/// generation `generation`, returning its key, marker and total size, or
+/// None at the end of the log.
+#[optimize(speed)]
+fn parse_record(bytes: &[u8], generation: u16) -> Option<(u16, u8, usize)> {
+    if bytes.len() < KV_RECORD_HEADER_LEN + KV_CHECK_LEN {
+        return None;
+    }
+    let marker = bytes[0];
+    let len = bytes[3] as usize;
+    let size = KV_RECORD_HEADER_LEN + len + KV_CHECK_LEN;
+    let valid = match marker {
+        KV_RECORD => true,
+        KV_TOMBSTONE => len == 0,
+        _ => false,
+    };
+    if !valid || size > bytes.len() {
+        return None;
+    }
+    let check = size - KV_CHECK_LEN;
+    if record_check(generation, &bytes[..check]) != bytes[check..size] {
+        return None;
+    }
+    Some((u16::from_be_bytes([bytes[1], bytes[2]]), marker, size))
+}
+
+/// Log-structured key-value store over a [`KvLog`], indexing at most `K`
+/// distinct keys.
+///
+/// Each update appends a small record to the active segment instead of
+/// rewriting a whole storage, so frequently updated values (counters,
+/// nonces...) spread the wear over the segment. When the active segment is
+/// full, live records are compacted into the other segment, which becomes
+/// active once completely written: an interrupted compaction leaves the
+/// previous segment in use.
+///
+/// An append usually rewrites a page already holding records. Its new content
+/// is first written at the same place in the spare segment, then in the
+/// active one, so an append costs two page writes. If the second write is
+/// interrupted, [`KvStore::open`] restores the page from its copy and the
+/// append is completed; if the first one is, the active segment is untouched
+/// and the append is discarded. Either way, earlier records are kept.
+///
+/// The index of the latest record of each key is kept in RAM and rebuilt by
+/// [`KvStore::open`], typically once at application startup.
+///
+/// # Examples
+///
+/// ```
+/// #[link_section = ".nvm_data"]
+/// static mut LOG: Pic<KvLog<1024>> = Pic::new(KvLog::new());
+///
+/// let mut store = KvStore::<1024, 16>::open(unsafe { LOG.get_mut() })?;
+/// store.set(1, &nonce.to_be_bytes())?;
+/// let nonce = store.get(1);
+/// ```
+pub struct KvStore<'a, const N: usize, const K: usize> {
+    log: &'a mut KvLog<N>,
+    active: usize,
+    generation: u16,
+    /// Offset of the next record in the active segment
+    end: usize,
+    /// (key, record offset) for each live key
+    index: [(u16, u16); K],
+    len: usize,
+}
+
+impl<'a, const N: usize, const K: usize> KvStore<'a, N, K> {
+    /// Open the store held by `log`, scanning the active segment to rebuild
+    /// the index and repairing a page left torn by an interrupted write.
+    /// Returns an error if it holds more than `K` distinct keys.
+    pub fn open(log: &'a mut KvLog<N>) -> Result<Self, StorageFullError> {
+        let segments = &log.segments.0;
+        let header = |i: usize| segment_generation(&segments[i], KV_SEGMENT_MAGIC);
+        let mirror = |i: usize| segment_generation(&segments[i], KV_MIRROR_MAGIC);
+        let active = match (header(0), header(1)) {
+            (Some(a), Some(b)) if (b.wrapping_sub(a) as i16) > 0 => Some((1, b, false)),
+            (Some(a), _) => Some((0, a, false)),
+            (None, Some(b)) => Some((1, b, false)),
+            // The first page of the active segment was torn: the copy of it
+            // in the spare segment tells its generation.
+            (None, None) => match (mirror(0), mirror(1)) {
+                (_, Some(g)) => Some((0, g, true)),
+                (Some(g), None) => Some((1, g, true)),
+                (None, None) => None,
+            },
+        };
+
+        let mut store = KvStore {
+            log,
+            active: 0,
+            generation: 1,
+            end: KV_HEADER_LEN,
+            index: [(0, 0); K],
+            len: 0,
+        };
+        match active {
+            Some((active, gen, torn)) => {
+                store.active = active;
+                store.generation = gen;
+                if torn {
+                    store.restore_page(0);
+                }
+            }
+            None => store.write_header(),
+        }
+
+        loop {
+            while let Some((key, marker, size)) = store.record_at(store.end) {
+                let offset = store.end;
+                store.end += size;
+                if marker == KV_TOMBSTONE {
+                    store.unindex(key);
+                } else {
+                    store.index_set(key, offset)?;
+                }
+            }
+            if !store.recover() {
+                break;
+            }
+        }
+        store.clear_tail();
+        Ok(store)
+    }
+
+    /// Zero the free space of the active segment, in case an interrupted
+    /// append left a partial record there: it could otherwise be parsed
+    /// along with the next record appended at its place.
+    fn clear_tail(&mut self) {
+        let zero = [0u8; PAGE_SIZE];
+        let mut offset = self.end;
+        while offset < N {
+            let len = (PAGE_SIZE - offset % PAGE_SIZE).min(N - offset);
+            self.write_active(offset, &zero[..len]);
+            offset += len;
+        }
+    }
+
+    /// Write `data` at `offset` of the active segment, past the end of the
+    /// log and within a page.
+    ///
+    /// Unless `offset` starts a page, the page holds records or the segment
+    /// header: its new content is first copied to the spare segment, from
+    /// which [`KvStore::recover`] restores it if the write is torn.
+    fn write_active(&mut self, offset: usize, data: &[u8]) {
+        let start = offset - offset % PAGE_SIZE;
+        let seg = &self.log.segments.0[self.active];
+        if start != offset && seg[offset..offset + data.len()] != *data {
+            let mut page = [0u8; PAGE_SIZE];
+            page.copy_from_slice(&seg[start..start + PAGE_SIZE]);
+            page[offset - start..offset - start + data.len()].copy_from_slice(data);
+            if start == 0 {
+                page[..KV_HEADER_LEN]
+                    .copy_from_slice(&segment_header(KV_MIRROR_MAGIC, self.generation));
+            }
+            let dst = self.log.segments.0[1 - self.active][start..].as_mut_ptr();
+            write_changed_pages(dst, &page);
+        }
+        let dst = self.log.segments.0[self.active][offset..].as_mut_ptr();
+        write_changed_pages(dst, data);
+    }
+
+    /// Restore the page at `start` of the active segment from its copy in
+    /// the spare segment.
+    fn restore_page(&mut self, start: usize) {
+        let mut page = [0u8; PAGE_SIZE];
+        page.copy_from_slice(&self.log.segments.0[1 - self.active][start..start + PAGE_SIZE]);
+        if start == 0 {
+            page[..KV_HEADER_LEN]
+                .copy_from_slice(&segment_header(KV_SEGMENT_MAGIC, self.generation));
+        }
+        let dst = self.log.segments.0[self.active][start..].as_mut_ptr();
+        write_changed_pages(dst, &page);
+    }
+
+    /// Look for a page overlapping the end of the log whose copy in the
+    /// spare segment completes a valid record there: the write of that page
+    /// in the active segment was torn. Restores it and returns true if found.
+    fn recover(&mut self) -> bool {
+        let seg = &self.log.segments.0[self.active];
+        let copy = &self.log.segments.0[1 - self.active];
+        let (start, end) = (self.end, (self.end + KV_MAX_RECORD_LEN).min(N));
+        let mut record = [0u8; KV_MAX_RECORD_LEN];
+        let mut page = start - start % PAGE_SIZE;
+        while page < end {
+            let (from, to) = (page.max(start), (page + PAGE_SIZE).min(end));
+            record[..end - start].copy_from_slice(&seg[start..end]);
+            record[from - start..to - start].copy_from_slice(&copy[from..to]);
+            if parse_record(&record[..end - start], self.generation).is_some() {
+                self.restore_page(page);
+                return true;
+            }
+            page += PAGE_SIZE;
+        }
+        false
+    }
+
+    /// Parse the record at `offset` in the active segment, returning its key,
+    /// marker and total size, or None at the end of the log.
+    fn record_at(&self, offset: usize) -> Option<(u16, u8, usize)> {
+        parse_record(&self.log.segments.0[self.active][offset..], self.generation)
+    }
+
+    fn position(&self, key: u16) -> Option<usize> {
+        self.index[..self.len].iter().position(|&(k, _)| k == key)
+    }
+
+    fn index_set(&mut self, key: u16, offset: usize) -> Result<(), StorageFullError> {
+        match self.position(key) {
+            Some(i) => self.index[i].1 = offset as u16,
+            None if self.len < K => {
+                self.index[self.len] = (key, offset as u16);
+                self.len += 1;
+            }
+            None => return Err(StorageFullError),
+        }
+        Ok(())
+    }
+
+    fn unindex(&mut self, key: u16) {
+        if let Some(i) = self.position(key) {
+            self.len -= 1;
+            self.index.swap(i, self.len);
+        }
+    }
+
+    /// Write the header of the active segment
+    fn write_header(&mut self) {
+        let header = segment_header(KV_SEGMENT_MAGIC, self.generation);
+        write_changed_pages(self.log.segments.0[self.active].as_mut_ptr(), &header);
+    }
+
+    /// Returns the value stored for `key`, if any
+    pub fn get(&self, key: u16) -> Option<&[u8]> {
+        let offset = self.index[self.position(key)?].1 as usize;
+        let seg = &self.log.segments.0[self.active];
+        let len = seg[offset + 3] as usize;
+        let start = offset + KV_RECORD_HEADER_LEN;
+        Some(&seg[start..start + len])
+    }
+
+    /// Returns the number of keys in the store
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns true if the store holds no key
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Store `value` for `key`, replacing the previous value if any.
+    ///
+    /// # Errors
+    ///
+    /// Returns an error if `value` is longer than [`KV_MAX_VALUE_LEN`], if
+    /// `K` keys are already stored, or if live records do not fit in a
+    /// segment.
+    pub fn set(&mut self, key: u16, value: &[u8]) -> Result<(), StorageFullError> {
+        if value.len() > KV_MAX_VALUE_LEN || (self.position(key).is_none() && self.len == K) {
+            return Err(StorageFullError);
+        }
+        if self.get(key) == Some(value) {
+            return Ok(());
+        }
+        let offset = self.append(KV_RECORD, key, value)?;
+        self.index_set(key, offset)
+    }
+
+    /// Remove `key` from the store. Removing a missing key does nothing.
+    pub fn remove(&mut self, key: u16) -> Result<(), StorageFullError> {
+        if self.position(key).is_none() {
+            return Ok(());
+        }
+        self.append(KV_TOMBSTONE, key, &[])?;
+        self.unindex(key);
+        Ok(())
+    }
+
+    /// Append a record, compacting the log first if it does not fit.
+    /// Returns the offset of the record.
+    fn append(&mut self, marker: u8, key: u16, value: &[u8]) -> Result<usize, StorageFullError> {
+        let size = KV_RECORD_HEADER_LEN + value.len() + KV_CHECK_LEN;
+        if self.end + size > N {
+            self.compact();
+            if self.end + size > N {
+                return Err(StorageFullError);
+            }
+        }
+        let mut record = [0u8; KV_MAX_RECORD_LEN];
+        record[0] = marker;
+        record[1..3].copy_from_slice(&key.to_be_bytes());
+        record[3] = value.len() as u8;
+        let check = size - KV_CHECK_LEN;
+        record[KV_RECORD_HEADER_LEN..check].copy_from_slice(value);
+        let crc = record_check(self.generation, &record[..check]);
+        record[check..size].copy_from_slice(&crc);
+
+        // Write page by page, each write covering a page of the record
+        let offset = self.end;
+        let mut pos = 0;
+        while pos < size {
+            let len = (PAGE_SIZE - (offset + pos) % PAGE_SIZE).min(size - pos);
+            self.write_active(offset + pos, &record[pos..pos + len]);
+            pos += len;
+        }
+        self.end += size;
+        Ok(offset)
+    }
+
+    /// Copy the latest record of every live key into the spare segment and
+    /// make it active.
+    ///
+    /// The spare segment is written page by page from a RAM buffer, its
+    /// header last. Records are checked against the new generation.
+    fn compact(&mut self) {
+        let generation = self.generation.wrapping_add(1);
+        let mut page = [0u8; PAGE_SIZE];
+        // Offset in the spare segment of the start of `page`
+        let mut page_start = 0;
+        let mut pos = KV_HEADER_LEN;
+        let mut index = [(0u16, 0u16); K];
+        let mut len = 0;
+
+        let (first, second) = self.log.segments.0.split_at_mut(1);
+        let (seg, spare_seg) = match self.active {
+            0 => (&first[0], &mut second[0]),
+            _ => (&second[0], &mut first[0]),
+        };
+
+        for &(key, offset) in self.index[..self.len].iter() {
+            let offset = offset as usize;
+            let size = KV_RECORD_HEADER_LEN + seg[offset + 3] as usize + KV_CHECK_LEN;
+            let mut record = [0u8; KV_MAX_RECORD_LEN];
+            record[..size].copy_from_slice(&seg[offset..offset + size]);
+            let check = size - KV_CHECK_LEN;
+            let crc = record_check(generation, &record[..check]);
+            record[check..size].copy_from_slice(&crc);
+
+            index[len] = (key, pos as u16);
+            len += 1;
+            for &b in &record[..size] {
+                if pos - page_start == PAGE_SIZE {
+                    let dst = spare_seg[page_start..].as_mut_ptr();
+                    write_changed_pages(dst, &page);
+                    page = [0u8; PAGE_SIZE];
+                    page_start += PAGE_SIZE;
+                }
+                page[pos - page_start] = b;
+                pos += 1;
+            }
+        }
+        // Flush the last page and clear the stale content of the rest of
+        // the segment.
+        while page_start < N {
+            let dst = spare_seg[page_start..].as_mut_ptr();
+            write_changed_pages(dst, &page);
+            page = [0u8; PAGE_SIZE];
+            page_start += PAGE_SIZE;
+        }
+
+        self.generation = generation;
+        self.active = 1 - self.active;
+        self.write_header();
+        self.end = pos;
+        self.index = index;
+        self.len = len;
+    }
+}
+
+/// Chunk sizes of the size classes of a [`Slab`], those of at most a page
+/// being used
+const SLAB_CLASSES: [usize; 5] = [16, 32, 64, 128, 256];
+/// Class of a [`Slab`] page holding no chunk
+const SLAB_NO_CLASS: u8 = 0xff;
+
+/// Maximum length of an item of a [`Slab`]: the largest chunk, less its
+/// length byte
+pub const SLAB_MAX_LEN: usize = match PAGE_SIZE < 256 {
+    true => PAGE_SIZE - 1,
+    false => 255,
+};
+
+/// Size class of a page of a [`Slab`], its allocated chunks (bit `i` for
+/// chunk `i`) and the Flash page holding them
+#[derive(Copy, Clone)]
+struct SlabPage {
+    class: u8,
+    used: u32,
+    frame: u16,
+}
+
+/// Location of an item in a [`Slab`]
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub struct SlabKey {
+    page: u16,
+    chunk: u8,
+}
+
+/// A Non-Volatile store of `P` pages holding variable-length items, such as
+/// labels or small descriptors. Insertion, update and removal are atomic.
+///
+/// Each page is given a size class when its first item is stored, and is
+/// split into chunks of that size: 16, 32, 64, 128 or 256 bytes, up to the
+/// page size. An item takes the smallest chunk holding it and its length
+/// byte, in a page shared with other items of the class, instead of a page
+/// aligned slot of the largest size as in a [`Collection`]. A page with no
+/// item left goes back to any class.
+///
+/// The classes and the allocated chunks of all the pages are kept in a
+/// free map, an [`AtomicStorage`], along with the Flash page holding each of
+/// them out of `P + 1`. An item is written to a free chunk first, then the
+/// map is updated at once. If the page of the chunk holds other items, the
+/// write goes to a copy of the page in the Flash page left spare, which the
+/// map update puts in its place: a torn write never reaches stored items.
+///
+/// # Examples
+///
+/// ```
+/// #[link_section = ".nvm_data"]
+/// static mut LABELS: NVMData<Slab<8>> = NVMData::new(Slab::new());
+///
+/// let labels = unsafe { LABELS.get_mut() };
+/// let key = labels.insert(b"Savings")?;
+/// let key = labels.update(key, b"Savings account")?;
+/// for (key, label) in labels.iter() {
+///     show(label);
+/// }
+/// ```
+pub struct Slab<const P: usize> {
+    map: AtomicStorage<[SlabPage; P]>,
+    pages: PageAligned<[[u8; PAGE_SIZE]; P]>,
+    spare: PageAligned<[u8; PAGE_SIZE]>,
+}
+
+impl<const P: usize> Slab<P> {
+    pub const fn new() -> Slab<P> {
+        assert!(P < u16::MAX as usize, "too many pages");
+        Slab {
+            map: AtomicStorage::new(&Self::free_map(None)),
+            pages: PageAligned([[0; PAGE_SIZE]; P]),
+            spare: PageAligned([0; PAGE_SIZE]),
+        }
+    }
+
+    /// Map with no item, keeping the Flash pages of `map`, if any
+    const fn free_map(map: Option<&[SlabPage; P]>) -> [SlabPage; P] {
+        let mut free = [SlabPage {
+            class: SLAB_NO_CLASS,
+            used: 0,
+            frame: 0,
+        }; P];
+        let mut i = 0;
+        while i < P {
+            free[i].frame = match map {
+                Some(map) => map[i].frame,
+                None => i as u16,
+            };
+            i += 1;
+        }
+        free
+    }
+
+    /// Flash page `frame`, out of the `P` pages and the spare one
+    fn frame(&self, frame: u16) -> &[u8; PAGE_SIZE] {
+        self.pages.0.get(frame as usize).unwrap_or(&self.spare.0)
+    }
+
+    /// The Flash page held by no page of `map`
+    fn spare_frame(map: &[SlabPage; P]) -> u16 {
+        (0..=P as u16)
+            .find(|&frame| map.iter().all(|page| page.frame != frame))
+            .unwrap_or(P as u16)
+    }
+
+    /// Class of the smallest chunks holding `len` bytes and their length
+    fn class_of(len: usize) -> Option<u8> {
+        SLAB_CLASSES
+            .iter()
+            .position(|&size| size > len && size <= PAGE_SIZE)
+            .map(|class| class as u8)
+    }
+
+    fn chunks(class: u8) -> usize {
+        PAGE_SIZE / SLAB_CLASSES[class as usize]
+    }
+
+    fn chunk(&self, key: SlabKey) -> &[u8] {
+        let map = self.map.get_ref();
+        let (page, size) = (
+            self.frame(map[key.page as usize].frame),
+            self.chunk_size(key),
+        );
+        &page[key.chunk as usize * size..][..size]
+    }
+
+    fn chunk_size(&self, key: SlabKey) -> usize {
+        SLAB_CLASSES[self.map.get_ref()[key.page as usize].class as usize]
+    }
+
+    fn is_allocated(&self, key: SlabKey) -> bool {
+        let map = self.map.get_ref();
+        (key.page as usize) < P && map[key.page as usize].used & (1 << key.chunk) != 0
+    }
+
+    /// First free chunk of `class`, in a page of the class or else in a
+    /// free page, which is then given the class in `map`. Chunks in `skip`
+    /// are not used.
+    fn find_free_chunk(
+        map: &mut [SlabPage; P],
+        class: u8,
+        skip: Option<SlabKey>,
+    ) -> Option<SlabKey> {
+        let chunks = Self::chunks(class);
+        let mut free_page = None;
+        for (i, page) in map.iter().enumerate() {
+            if page.class == class {
+                let mut used = page.used;
+                if let Some(skip) = skip.filter(|k| k.page as usize == i) {
+                    used |= 1 << skip.chunk;
+                }
+                let chunk = used.trailing_ones() as usize;
+                if chunk < chunks {
+                    return Some(SlabKey {
+                        page: i as u16,
+                        chunk: chunk as u8,
+                    });
+                }
+            } else if page.used == 0 && free_page.is_none() {
+                free_page = Some(i);
+            }
+        }
+        let page = free_page?;
+        map[page].class = class;
+        Some(SlabKey {
+            page: page as u16,
+            chunk: 0,
+        })
+    }
+
+    /// Write `data` and its length into the free chunk `key`, in place if
+    /// its page holds no stored item or else in a copy of the page in the
+    /// spare Flash page, which is then given to the page in `map`.
+    fn write_chunk(&mut self, map: &mut [SlabPage; P], key: SlabKey, class: u8, data: &[u8]) {
+        let offset = key.chunk as usize * SLAB_CLASSES[class as usize];
+        let current = self.map.get_ref()[key.page as usize];
+        let frame = match current.used {
+            0 => current.frame,
+            _ => Self::spare_frame(map),
+        };
+        let mut page = [0u8; PAGE_SIZE];
+        page.copy_from_slice(self.frame(current.frame));
+        page[offset] = data.len() as u8;
+        page[offset + 1..][..data.len()].copy_from_slice(data);
+        write_changed_pages(self.frame(frame).as_ptr(), &page);
+        map[key.page as usize].frame = frame;
+        let mut _dummy = (&self.pages, &self.spare);
+    }
+
+    /// Release the chunk `key` in `map`, and its page if it was the last one
+    fn release(map: &mut [SlabPage; P], key: SlabKey) {
+        let page = &mut map[key.page as usize];
+        page.used &= !(1 << key.chunk);
+        if page.used == 0 {
+            page.class = SLAB_NO_CLASS;
+        }
+    }
+
+    /// Store `data` into a free chunk `key` of `class` and flag it in the map
+    /// at once with the other changes of `map`
+    fn commit(&mut self, mut map: [SlabPage; P], key: SlabKey, class: u8, data: &[u8]) {
+        self.write_chunk(&mut map, key, class, data);
+        map[key.page as usize].used |= 1 << key.chunk;
+        self.map.update(&map);
+    }
+
+    /// Store `data`, returning the key of the item.
+    ///
+    /// # Errors
+    ///
+    /// Returns an error if `data` is longer than [`SLAB_MAX_LEN`] or if no
+    /// chunk of its class is free.
+    pub fn insert(&mut self, data: &[u8]) -> Result<SlabKey, StorageFullError> {
+        let class = Self::class_of(data.len()).ok_or(StorageFullError)?;
+        let mut map = *self.map.get_ref();
+        let key = Self::find_free_chunk(&mut map, class, None).ok_or(StorageFullError)?;
+        self.commit(map, key, class, data);
+        Ok(key)
+    }
+
+    /// Item stored under `key`, or None if it was removed
+    pub fn get(&self, key: SlabKey) -> Option<&[u8]> {
+        if !self.is_allocated(key) {
+            return None;
+        }
+        let chunk = self.chunk(key);
+        Some(&chunk[1..][..chunk[0] as usize])
+    }
+
+    /// Replace the item `key` by `data`, returning its new key. The new
+    /// value is written to another chunk, and both chunks are flipped in a
+    /// single map update.
+    ///
+    /// # Errors
+    ///
+    /// Returns an error if `data` is longer than [`SLAB_MAX_LEN`] or if no
+    /// chunk of its class is free.
+    ///
+    /// Exits with [`Fatal::OutOfRange`] if `key` is not allocated.
+    pub fn update(&mut self, key: SlabKey, data: &[u8]) -> Result<SlabKey, StorageFullError> {
+        if !self.is_allocated(key) {
+            fatal(Fatal::OutOfRange);
+        }
+        let class = Self::class_of(data.len()).ok_or(StorageFullError)?;
+        let mut map = *self.map.get_ref();
+        let new_key = Self::find_free_chunk(&mut map, class, Some(key)).ok_or(StorageFullError)?;
+        Self::release(&mut map, key);
+        // Releasing the last other chunk of the page frees it
+        map[new_key.page as usize].class = class;
+        self.commit(map, new_key, class, data);
+        Ok(new_key)
+    }
+
+    /// Remove the item `key`. Removing an item already removed does nothing.
+    pub fn remove(&mut self, key: SlabKey) {
+        if self.is_allocated(key) {
+            let mut map = *self.map.get_ref();
+            Self::release(&mut map, key);
+            self.map.update(&map);
+        }
+    }
+
+    /// Remove all the items
+    pub fn clear(&mut self) {
+        self.map.update(&Self::free_map(Some(self.map.get_ref())));
+    }
+
+    /// Returns the number of items stored
+    pub fn len(&self) -> usize {
+        self.map
+            .get_ref()
+            .iter()
+            .map(|page| page.used.count_ones() as usize)
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.map.get_ref().iter().all(|page| page.used == 0)
+    }
+
+    /// Number of pages holding no item
+    pub fn free_pages(&self) -> usize {
+        self.map
+            .get_ref()
+            .iter()
+            .filter(|page| page.used == 0)
+            .count()
+    }
+
+    /// Items with their keys, by page and chunk
+    pub fn iter(&self) -> impl Iterator<Item = (SlabKey, &[u8])> {
+        self.map
+            .get_ref()
+            .iter()
+            .enumerate()
+            .flat_map(|(page, p)| {
+                (0..32u8)
+                    .filter(move |chunk| p.used & (1 << chunk) != 0)
+                    .map(move |chunk| SlabKey {
+                        page: page as u16,
+                        chunk,
+                    })
+            })
+            .filter_map(|key| self.get(key).map(|data| (key, data)))
+    }
+}
+
+impl<const P: usize> Default for Slab<P> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::{bench, TestType};
+    use crate::NVMData;
+    use testmacro::test_item as test;
+
+    #[link_section = ".nvm_data"]
+    static mut BENCH_STORAGE: NVMData<AlignedStorage<[u8; 64]>> =
+        NVMData::new(AlignedStorage::new([0u8; 64]));
+
+    #[test]
+    fn bench_aligned_update() {
+        let storage = unsafe { (*core::ptr::addr_of_mut!(BENCH_STORAGE)).get_mut() };
+        let mut value = *storage.get_ref();
+        bench("AlignedStorage 64-byte update", 16, || {
+            value[0] = value[0].wrapping_add(1);
+            storage.update(&value);
+        });
+        assert_eq!(storage.get_ref(), &value);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut ATOMIC_BENCH_STORAGE: NVMData<AtomicStorage<[u8; 64]>> =
+        NVMData::new(AtomicStorage::new(&[0u8; 64]));
+
+    #[test]
+    fn bench_atomic_update() {
+        let storage = unsafe { (*core::ptr::addr_of_mut!(ATOMIC_BENCH_STORAGE)).get_mut() };
+        let mut value = *storage.get_ref();
+        bench("AtomicStorage 64-byte update", 16, || {
+            value[0] = value[0].wrapping_add(1);
+            storage.update(&value);
+        });
+        assert_eq!(storage.get_ref(), &value);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut SHADOWED_STORAGE: NVMData<AtomicStorage<u32>> = NVMData::new(AtomicStorage::new(&7));
+
+    #[test]
+    fn shadowed_commit() {
+        let storage = unsafe { (*core::ptr::addr_of_mut!(SHADOWED_STORAGE)).get_mut() };
+        let mut shadow = Shadowed::new(storage);
+        shadow.set(&7);
+        assert_eq!(shadow.is_dirty(), false);
+        shadow.modify(|v| *v += 1);
+        shadow.modify(|v| *v += 1);
+        assert_eq!(*shadow.get(), 9);
+        assert_eq!(shadow.is_dirty(), true);
+        shadow.on_event(&Event::<u8>::Button(
+            crate::buttons::ButtonEvent::LeftButtonPress,
+        ));
+        assert_eq!(shadow.is_dirty(), true);
+        shadow.on_event(&Event::<u8>::Ticker);
+        assert_eq!(shadow.is_dirty(), false);
+        drop(shadow);
+        let storage = unsafe { (*core::ptr::addr_of_mut!(SHADOWED_STORAGE)).get_mut() };
+        assert_eq!(*storage.get_ref(), 9);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut BACKGROUND_STORAGE: NVMData<AtomicStorage<[u8; 2 * PAGE_SIZE]>> =
+        NVMData::new(AtomicStorage::new(&[1; 2 * PAGE_SIZE]));
+
+    #[test]
+    fn background_update() {
+        let storage = unsafe { (*core::ptr::addr_of_mut!(BACKGROUND_STORAGE)).get_mut() };
+        let value = [2; 2 * PAGE_SIZE];
+        let mut update = storage.background_update(&value);
+        let mut steps = 1;
+        while !update.step() {
+            steps += 1;
+        }
+        // Clearing the flag, the two pages of the value, setting the flag and
+        // retiring the other copy
+        assert_eq!(steps, 5);
+        assert_eq!(storage.get_ref(), &value);
+
+        // An unfinished update keeps the previous value
+        {
+            let mut update = storage.background_update(&[3; 2 * PAGE_SIZE]);
+            update.step();
+            update.step();
+        }
+        assert_eq!(storage.get_ref(), &value);
+        storage.background_update(&[3; 2 * PAGE_SIZE]).finish();
+        assert_eq!(storage.get_ref(), &[3; 2 * PAGE_SIZE]);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut HANDLE_STORAGE: NVMData<AtomicStorage<u32>> = NVMData::new(AtomicStorage::new(&1));
+
+    #[test]
+    fn atomic_handle() {
+        // The flag of each copy shares the page of its value
+        assert_eq!(core::mem::size_of::<AtomicStorage<u32>>(), 2 * PAGE_SIZE);
+        let storage = unsafe { (*core::ptr::addr_of_mut!(HANDLE_STORAGE)).get_mut() };
+        let mut handle = storage.handle();
+        assert_eq!(*handle.get_ref(), 1);
+        handle.update(&2);
+        handle.update(&3);
+        assert_eq!(*handle.get_ref(), 3);
+        assert_eq!(*storage.get_ref(), 3);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut COLLECTION: NVMData<Collection<u32, 10>> = NVMData::new(Collection::new(0));
+
+    #[test]
+    fn collection() {
+        let collection = unsafe { (*core::ptr::addr_of_mut!(COLLECTION)).get_mut() };
+        collection.clear();
+        for i in 0..10 {
+            collection.add(&i).map_err(|_| ())?;
+        }
+        assert_eq!(collection.add(&10).is_err(), true);
+
+        // Removing shifts the indices of the next items
+        collection.remove(8);
+        collection.remove(2);
+        assert_eq!(collection.len(), 8);
+        assert_eq!((collection.get(2), collection.get(7)), (Some(&3), Some(&9)));
+        assert_eq!(collection.get(8), None);
+
+        // An update next to a free slot keeps the index, otherwise the item
+        // moves to the first free slot
+        assert_eq!(collection.update(1, &11).map_err(|_| ())?, 1);
+        assert_eq!(collection.update(4, &5).map_err(|_| ())?, 1);
+        let items = [0, 5, 11, 3, 4, 6, 7, 9];
+        assert_eq!(collection.into_iter().eq(items.iter()), true);
+        collection.add(&20).map_err(|_| ())?;
+        collection.add(&21).map_err(|_| ())?;
+        assert_eq!(collection.update(0, &0).is_err(), true);
+
+        // The cached ranks follow the changes of the collection
+        let mut ranked = RankedCollection::new(collection);
+        assert_eq!(
+            (ranked.len(), ranked.get(5), ranked.get(8)),
+            (10, Some(&20), Some(&21))
+        );
+        ranked.remove(0);
+        assert_eq!(ranked.update(0, &30).map_err(|_| ())?, 0);
+        ranked.remove(8);
+        assert_eq!(
+            (ranked.len(), ranked.remaining(), ranked.get(8)),
+            (8, 2, None)
+        );
+        for (i, item) in ranked.iter().enumerate() {
+            assert_eq!(ranked.get(i), Some(item));
+        }
+        let items = [30, 11, 3, 4, 20, 6, 7, 21];
+        assert_eq!(ranked.iter().eq(items.iter()), true);
+        ranked.clear();
+        assert_eq!(ranked.is_empty(), true);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut SORTED: NVMData<SortedCollection<u32, [u8; 4], 4>> =
+        NVMData::new(SortedCollection::new(0, [0; 4]));
+
+    #[test]
+    fn sorted_collection() {
+        let sorted = unsafe { (*core::ptr::addr_of_mut!(SORTED)).get_mut() };
+        sorted.clear();
+        for key in [30u32, 10, 20] {
+            sorted.insert(&key, &key.to_be_bytes()).map_err(|_| ())?;
+        }
+        assert_eq!(sorted.len(), 3);
+        assert_eq!(sorted.get(&20), Some(&20u32.to_be_bytes()));
+        assert_eq!(sorted.get(&25), None);
+
+        // Replacing a value takes the free slot, and frees the previous one
+        sorted.insert(&10, &[1; 4]).map_err(|_| ())?;
+        sorted.insert(&10, &[2; 4]).map_err(|_| ())?;
+        assert_eq!(sorted.get(&10), Some(&[2; 4]));
+        sorted.insert(&40, &[4; 4]).map_err(|_| ())?;
+        assert_eq!(sorted.insert(&50, &[5; 4]).is_err(), true);
+
+        assert_eq!(sorted.remove(&30), true);
+        assert_eq!(sorted.remove(&30), false);
+        let mut keys = sorted.iter().map(|(&k, _)| k);
+        assert_eq!(keys.next(), Some(10));
+        assert_eq!(keys.next(), Some(20));
+        assert_eq!(keys.next(), Some(40));
+        assert_eq!(keys.next(), None);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut BLOB: NVMData<CompressedBlob<256, 64>> = NVMData::new(CompressedBlob::new());
+
+    #[test]
+    fn compressed_blob() {
+        let blob = unsafe { (*core::ptr::addr_of_mut!(BLOB)).get_mut() };
+        let mut data = [0u8; 600];
+        for (i, b) in data.iter_mut().enumerate() {
+            *b = b"token list "[i % 11] ^ (i / 100) as u8;
+        }
+        let stored = blob.write(&data).map_err(|_| ())?;
+        assert_eq!(stored < 256, true);
+        assert_eq!(blob.len(), 600);
+        let mut decoder = Lz4Decoder::<64>::new();
+        let mut out = [0u8; 600];
+        assert_eq!(blob.read_into(&mut decoder, &mut out).map_err(|_| ())?, 600);
+        assert_eq!(out, data);
+        assert_eq!(
+            blob.read_into(&mut decoder, &mut out[..599]),
+            Err(Lz4Error::TooLong)
+        );
+
+        // Data not fitting leaves the blob invalid
+        let mut noise = [0u8; 300];
+        for (i, b) in noise.iter_mut().enumerate() {
+            *b = (i as u32).wrapping_mul(2654435761).to_be_bytes()[0];
+        }
+        assert_eq!(blob.write(&noise).is_err(), true);
+        assert_eq!(blob.is_valid(), false);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut KV_LOG: NVMData<KvLog<1024>> = NVMData::new(KvLog::new());
+
+    #[test]
+    fn kv_store() {
+        let log = unsafe { &mut *core::ptr::addr_of_mut!(KV_LOG) };
+        let mut store = KvStore::<1024, 4>::open(log.get_mut()).map_err(|_| ())?;
+        assert_eq!(store.is_empty(), true);
+        store.set(1, &[1, 2]).map_err(|_| ())?;
+        store.set(2, b"nonce").map_err(|_| ())?;
+        store.remove(2).map_err(|_| ())?;
+        assert_eq!(store.get(1), Some(&[1, 2][..]));
+        assert_eq!((store.get(2), store.len()), (None, 1));
+
+        // A torn page of the active segment is restored from its copy, along
+        // with the records it held before the append
+        store.set(1, &[3, 4]).map_err(|_| ())?;
+        let page = store.index[0].1 as usize / PAGE_SIZE * PAGE_SIZE;
+        let dst = store.log.segments.0[store.active][page..].as_mut_ptr();
+        write_changed_pages(dst, &[0xff; PAGE_SIZE]);
+        let mut store = KvStore::<1024, 4>::open(log.get_mut()).map_err(|_| ())?;
+        assert_eq!(store.get(1), Some(&[3, 4][..]));
+        assert_eq!((store.get(2), store.len()), (None, 1));
+
+        // An append interrupted before the active page is written is
+        // completed, one interrupted while copying the page is discarded
+        let mut saved = [0u8; PAGE_SIZE];
+        saved.copy_from_slice(&store.log.segments.0[store.active][page..page + PAGE_SIZE]);
+        store.set(1, &[5, 6]).map_err(|_| ())?;
+        let dst = store.log.segments.0[store.active][page..].as_mut_ptr();
+        write_changed_pages(dst, &saved);
+        let mut store = KvStore::<1024, 4>::open(log.get_mut()).map_err(|_| ())?;
+        assert_eq!(store.get(1), Some(&[5, 6][..]));
+        saved.copy_from_slice(&store.log.segments.0[store.active][page..page + PAGE_SIZE]);
+        store.set(1, &[7, 8]).map_err(|_| ())?;
+        let dst = store.log.segments.0[1 - store.active][page..].as_mut_ptr();
+        write_changed_pages(dst, &[0xff; PAGE_SIZE]);
+        let dst = store.log.segments.0[store.active][page..].as_mut_ptr();
+        write_changed_pages(dst, &saved);
+        let mut store = KvStore::<1024, 4>::open(log.get_mut()).map_err(|_| ())?;
+        assert_eq!(store.get(1), Some(&[5, 6][..]));
+
+        // Compacting keeps the latest value of each key
+        let generation = store.generation;
+        for i in 0..200u32 {
+            store.set(3, &i.to_be_bytes()).map_err(|_| ())?;
+        }
+        assert_eq!(store.generation != generation, true);
+        let store = KvStore::<1024, 4>::open(log.get_mut()).map_err(|_| ())?;
+        assert_eq!(store.get(1), Some(&[5, 6][..]));
+        assert_eq!(store.get(3), Some(&199u32.to_be_bytes()[..]));
+        assert_eq!(store.len(), 2);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut CRC_STORAGE: NVMData<CrcAtomicStorage<[u32; 4]>> =
+        NVMData::new(CrcAtomicStorage::new(&[1, 2, 3, 4]));
+
+    #[test]
+    fn crc_atomic_update() {
+        let storage = unsafe { (*core::ptr::addr_of_mut!(CRC_STORAGE)).get_mut() };
+        assert_eq!(storage.get_ref(), &[1, 2, 3, 4]);
+        storage.update(&[5, 6, 7, 8]);
+        storage.update(&[9, 10, 11, 12]);
+        assert_eq!(storage.get_ref(), &[9, 10, 11, 12]);
+
+        // Tear the latest copy: the previous one is returned
+        let latest = match storage.which() {
+            StorageA => &storage.storage_a.0.value[3],
+            StorageB => &storage.storage_b.0.value[3],
+        };
+        write_changed_pages(latest as *const u32 as *const u8, &[0xff]);
+        assert_eq!(storage.get_ref(), &[5, 6, 7, 8]);
+    }
+
+    #[link_section = ".nvm_data"]
+    static mut SLAB: NVMData<Slab<3>> = NVMData::new(Slab::new());
+
+    #[test]
+    fn slab() {
+        let slab = unsafe { (*core::ptr::addr_of_mut!(SLAB)).get_mut() };
+        slab.clear();
+        let short = slab.insert(b"label").map_err(|_| ())?;
+        let long = slab.insert(&[0x32; 20]).map_err(|_| ())?;
+        let other = slab.insert(b"name").map_err(|_| ())?;
+        // Items of a class share a page
+        assert_eq!((short.page, other.page, other.chunk), (0, 0, 1));
+        assert_eq!(long.page, 1);
+        assert_eq!(slab.free_pages(), 1);
+        assert_eq!(slab.get(other), Some(&b"name"[..]));
+
+        // Adding to a page holding items writes a copy of it to the spare
+        // Flash page: a torn write leaves them intact
+        let spare = Slab::<3>::spare_frame(slab.map.get_ref());
+        write_changed_pages(slab.frame(spare).as_ptr(), &[0xff; PAGE_SIZE]);
+        assert_eq!(slab.get(short), Some(&b"label"[..]));
+        assert_eq!(slab.get(other), Some(&b"name"[..]));
+
+        // A larger value moves to a chunk of its class
+        let moved = slab.update(short, &[0x40; 40]).map_err(|_| ())?;
+        assert_eq!((moved.page, slab.free_pages()), (2, 0));
+        assert_eq!(slab.get(short), None);
+        assert_eq!(slab.get(moved), Some(&[0x40; 40][..]));
+        assert_eq!(slab.insert(&[0; 100]).is_err(), true);
+
+        // Pages left empty go back to any class
+        slab.remove(long);
+        slab.remove(long);
+        assert_eq!(slab.free_pages(), 1);
+        assert_eq!(slab.insert(&[0; 100]).map(|k| k.page).ok(), Some(1));
+        assert_eq!(slab.len(), 3);
+        assert_eq!(slab.iter().map(|(_, item)| item.len()).sum::<usize>(), 144);
+        assert_eq!(slab.insert(&[0; SLAB_MAX_LEN + 1]).is_err(), true);
     }
 }
@@ -0,0 +1,181 @@
+//! NVM write statistics, enabled by the `nvm_stats` feature
+//!
+//! Every NVM write of the [`nvm`](crate::nvm) storages is counted, along
+//! with the bytes written and the number of times each Flash page is
+//! rewritten (erased and programmed), so that the cells burning Flash and
+//! adding latency can be found and moved, for instance to a
+//! [`KvStore`](crate::nvm::KvStore):
+//!
+//! ```
+//! handle_apdu(&mut comm, ins);
+//! nvm_stats::dump();
+//! ```
+//!
+//! The first [`TRACKED_PAGES`] pages written are tracked individually, and
+//! the rewrites of other pages only counted as a whole. [`dump`] prints the
+//! statistics with semihosting, and [`export`] serializes them so that an
+//! app can return them from a debug APDU of its own.
+
+use crate::nvm::PAGE_SIZE;
+use crate::testing::{to_dec, to_hex, DebugWriter};
+
+/// Number of pages whose rewrites are counted individually
+pub const TRACKED_PAGES: usize = 16;
+
+/// Rewrites of a single Flash page
+#[derive(Copy, Clone)]
+pub struct PageWrites {
+    /// Address of the page
+    pub addr: usize,
+    pub count: u32,
+}
+
+struct Stats {
+    /// Calls to `nvm_write`
+    writes: u32,
+    bytes: u32,
+    pages: [PageWrites; TRACKED_PAGES],
+    tracked: usize,
+    /// Rewrites of the pages not tracked
+    untracked: u32,
+}
+
+static mut STATS: Stats = Stats {
+    writes: 0,
+    bytes: 0,
+    pages: [PageWrites { addr: 0, count: 0 }; TRACKED_PAGES],
+    tracked: 0,
+    untracked: 0,
+};
+
+fn stats() -> &'static mut Stats {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(STATS) }
+}
+
+/// Count a write of `len` bytes at `addr`, which rewrites each page it
+/// touches
+pub(crate) fn record(addr: usize, len: usize) {
+    let stats = stats();
+    stats.writes += 1;
+    stats.bytes += len as u32;
+    if len == 0 {
+        return;
+    }
+    let last = (addr + len - 1) / PAGE_SIZE * PAGE_SIZE;
+    let mut page = addr / PAGE_SIZE * PAGE_SIZE;
+    while page <= last {
+        match stats.pages[..stats.tracked]
+            .iter_mut()
+            .find(|p| p.addr == page)
+        {
+            Some(p) => p.count += 1,
+            None if stats.tracked < TRACKED_PAGES => {
+                stats.pages[stats.tracked] = PageWrites {
+                    addr: page,
+                    count: 1,
+                };
+                stats.tracked += 1;
+            }
+            None => stats.untracked += 1,
+        }
+        page += PAGE_SIZE;
+    }
+}
+
+/// Number of `nvm_write` calls
+pub fn writes() -> u32 {
+    stats().writes
+}
+
+/// Number of bytes written
+pub fn bytes() -> u32 {
+    stats().bytes
+}
+
+/// Rewrites of the tracked pages, in the order they were first written
+pub fn pages() -> &'static [PageWrites] {
+    let stats = stats();
+    &stats.pages[..stats.tracked]
+}
+
+/// Rewrites of the pages beyond the tracked ones
+pub fn untracked() -> u32 {
+    stats().untracked
+}
+
+/// Reset all the counters
+pub fn clear() {
+    let stats = stats();
+    stats.writes = 0;
+    stats.bytes = 0;
+    stats.tracked = 0;
+    stats.untracked = 0;
+}
+
+/// Print the totals, then the address and rewrite count of each tracked
+/// page, one per line
+pub fn dump() {
+    let stats = stats();
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    w.write("nvm writes ");
+    w.write(to_dec(stats.writes, &mut buf));
+    w.write(" bytes ");
+    w.write(to_dec(stats.bytes, &mut buf));
+    w.write(" untracked page writes ");
+    w.write(to_dec(stats.untracked, &mut buf));
+    w.write("\n");
+    for p in pages() {
+        w.write("  page 0x");
+        w.write(core::str::from_utf8(&to_hex(p.addr as u32)).unwrap_or(""));
+        w.write(" ");
+        w.write(to_dec(p.count, &mut buf));
+        w.write("\n");
+    }
+}
+
+/// Serialize the statistics into `out`, returning the number of bytes
+/// written: the write count, the byte count and the untracked page writes,
+/// then the address and rewrite count of as many tracked pages as fit, all
+/// big-endian u32.
+pub fn export(out: &mut [u8]) -> usize {
+    let stats = stats();
+    let words = [stats.writes, stats.bytes, stats.untracked]
+        .into_iter()
+        .chain(pages().iter().flat_map(|p| [p.addr as u32, p.count]));
+    let mut pos = 0;
+    for (word, dst) in words.zip(out.chunks_exact_mut(4)) {
+        dst.copy_from_slice(&word.to_be_bytes());
+        pos += 4;
+    }
+    // Do not cut a page entry in half
+    if pos > 12 && (pos - 12) % 8 != 0 {
+        pos -= 4;
+    }
+    pos
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn page_counts() {
+        clear();
+        record(3 * PAGE_SIZE + 10, PAGE_SIZE);
+        record(4 * PAGE_SIZE, 1);
+        assert_eq!(writes(), 2);
+        assert_eq!(bytes() as usize, PAGE_SIZE + 1);
+        assert_eq!(pages().len(), 2);
+        assert_eq!(pages()[0].count, 1);
+        assert_eq!(pages()[1].count, 2);
+        let mut out = [0u8; 24];
+        assert_eq!(export(&mut out), 20);
+        assert_eq!(out[16..20], 2u32.to_be_bytes());
+        clear();
+    }
+}
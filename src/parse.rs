@@ -0,0 +1,534 @@
+//! Zero-copy parsing of serialized transactions
+//!
+//! A [`Reader`] decodes the common encodings of transaction fields, Bitcoin
+//! varints, LEB128, RLP, a definite-length subset of CBOR and the protobuf
+//! wire format, straight out of an APDU, returning slices of it for byte
+//! strings rather than copies. A decoding which fails leaves the reader
+//! where it was, so a field cut by the end of the data is tried again once
+//! more data is there.
+//!
+//! Payloads sent in several APDUs are parsed with a [`ChunkedParser`], which
+//! calls a closure for each item and only keeps, between chunks, the bytes
+//! of the item cut by the end of a chunk:
+//!
+//! ```
+//! let mut parser = ChunkedParser::<64>::new();
+//! comm.stream_payload(INS_SIGN, 0x80, |chunk| {
+//!     parser
+//!         .feed(chunk, |r| {
+//!             let field = r.proto_field()?;
+//!             // ...
+//!             Ok(())
+//!         })
+//!         .map_err(|_| StatusWords::BadLen.into())
+//! })?;
+//! ```
+
+#[derive(Debug, PartialEq, Eq)]
+pub enum ParseError {
+    /// The data ends before the item does
+    Incomplete,
+    /// The item is not validly encoded
+    Malformed,
+    /// A [`ChunkedParser`] item is longer than the bytes it can keep
+    TooLarge,
+}
+
+/// RLP item, with its payload
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Rlp<'a> {
+    String(&'a [u8]),
+    /// Concatenated encodings of the items of the list
+    List(&'a [u8]),
+}
+
+/// Value of a protobuf field, by wire type
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum ProtoValue<'a> {
+    Varint(u64),
+    I64(u64),
+    Len(&'a [u8]),
+    I32(u32),
+}
+
+/// Cursor over the bytes of a message
+#[derive(Clone)]
+pub struct Reader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    pub fn new(data: &'a [u8]) -> Self {
+        Reader { data, pos: 0 }
+    }
+
+    /// Number of bytes read
+    pub fn position(&self) -> usize {
+        self.pos
+    }
+
+    /// Bytes not read yet
+    pub fn remaining(&self) -> &'a [u8] {
+        &self.data[self.pos..]
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.pos == self.data.len()
+    }
+
+    /// Run `f` on the reader, putting it back where it was if `f` fails
+    pub fn attempt<T, F>(&mut self, f: F) -> Result<T, ParseError>
+    where
+        F: FnOnce(&mut Self) -> Result<T, ParseError>,
+    {
+        let start = self.pos;
+        let res = f(self);
+        if res.is_err() {
+            self.pos = start;
+        }
+        res
+    }
+
+    pub fn bytes(&mut self, len: usize) -> Result<&'a [u8], ParseError> {
+        let end = self.pos.checked_add(len).ok_or(ParseError::Malformed)?;
+        let bytes = self.data.get(self.pos..end).ok_or(ParseError::Incomplete)?;
+        self.pos = end;
+        Ok(bytes)
+    }
+
+    pub fn array<const N: usize>(&mut self) -> Result<[u8; N], ParseError> {
+        let mut array = [0u8; N];
+        array.copy_from_slice(self.bytes(N)?);
+        Ok(array)
+    }
+
+    pub fn u8(&mut self) -> Result<u8, ParseError> {
+        Ok(self.bytes(1)?[0])
+    }
+
+    pub fn be_u16(&mut self) -> Result<u16, ParseError> {
+        self.array().map(u16::from_be_bytes)
+    }
+
+    pub fn be_u32(&mut self) -> Result<u32, ParseError> {
+        self.array().map(u32::from_be_bytes)
+    }
+
+    pub fn be_u64(&mut self) -> Result<u64, ParseError> {
+        self.array().map(u64::from_be_bytes)
+    }
+
+    pub fn le_u16(&mut self) -> Result<u16, ParseError> {
+        self.array().map(u16::from_le_bytes)
+    }
+
+    pub fn le_u32(&mut self) -> Result<u32, ParseError> {
+        self.array().map(u32::from_le_bytes)
+    }
+
+    pub fn le_u64(&mut self) -> Result<u64, ParseError> {
+        self.array().map(u64::from_le_bytes)
+    }
+
+    /// Bitcoin variable length integer (CompactSize), in its shortest
+    /// encoding
+    pub fn compact_size(&mut self) -> Result<u64, ParseError> {
+        self.attempt(|r| {
+            let (value, min) = match r.u8()? {
+                0xfd => (r.le_u16()? as u64, 0xfd),
+                0xfe => (r.le_u32()? as u64, 0x1_0000),
+                0xff => (r.le_u64()?, 0x1_0000_0000),
+                b => return Ok(b as u64),
+            };
+            match value >= min {
+                true => Ok(value),
+                false => Err(ParseError::Malformed),
+            }
+        })
+    }
+
+    /// Unsigned LEB128 integer, also the varint of protobuf
+    pub fn leb128(&mut self) -> Result<u64, ParseError> {
+        self.attempt(|r| {
+            let mut value = 0u64;
+            for shift in (0..64).step_by(7) {
+                let b = r.u8()?;
+                // The 10th byte only has the top bit of a u64
+                if shift == 63 && b > 1 {
+                    return Err(ParseError::Malformed);
+                }
+                value |= ((b & 0x7f) as u64) << shift;
+                if b & 0x80 == 0 {
+                    return Ok(value);
+                }
+            }
+            Err(ParseError::Malformed)
+        })
+    }
+
+    /// Big-endian length of `len` bytes, without leading zeros, at least
+    /// `min`
+    fn be_len(&mut self, len: usize, min: usize) -> Result<usize, ParseError> {
+        let bytes = self.bytes(len)?;
+        if len > core::mem::size_of::<usize>() || bytes[0] == 0 {
+            return Err(ParseError::Malformed);
+        }
+        let value = bytes.iter().fold(0, |acc, &b| acc << 8 | b as usize);
+        match value >= min {
+            true => Ok(value),
+            false => Err(ParseError::Malformed),
+        }
+    }
+
+    /// Kind and payload length of the RLP item, whose payload follows
+    fn rlp_header(&mut self) -> Result<(bool, usize), ParseError> {
+        match self.u8()? {
+            b @ 0x80..=0xb7 => Ok((false, (b - 0x80) as usize)),
+            b @ 0xb8..=0xbf => Ok((false, self.be_len((b - 0xb7) as usize, 56)?)),
+            b @ 0xc0..=0xf7 => Ok((true, (b - 0xc0) as usize)),
+            b @ 0xf8..=0xff => Ok((true, self.be_len((b - 0xf7) as usize, 56)?)),
+            // Single byte, its own encoding
+            _ => Err(ParseError::Malformed),
+        }
+    }
+
+    /// RLP item, in its canonical encoding
+    pub fn rlp(&mut self) -> Result<Rlp<'a>, ParseError> {
+        self.attempt(|r| {
+            // A single byte below 0x80 is its own encoding
+            if let Some(0..=0x7f) = r.remaining().first() {
+                return Ok(Rlp::String(r.bytes(1)?));
+            }
+            let (list, len) = r.rlp_header()?;
+            let payload = r.bytes(len)?;
+            match (list, payload) {
+                (false, [0..=0x7f]) => Err(ParseError::Malformed),
+                (false, _) => Ok(Rlp::String(payload)),
+                (true, _) => Ok(Rlp::List(payload)),
+            }
+        })
+    }
+
+    /// Header of a RLP list, whose items follow, returning the length of
+    /// its payload. Lists too large to be held at once, such as a whole
+    /// transaction, are entered this way and their items read in turn.
+    pub fn rlp_list_header(&mut self) -> Result<usize, ParseError> {
+        self.attempt(|r| match r.rlp_header()? {
+            (true, len) => Ok(len),
+            (false, _) => Err(ParseError::Malformed),
+        })
+    }
+
+    /// Major type and argument of a CBOR data item. Indefinite lengths are
+    /// not supported.
+    pub fn cbor_header(&mut self) -> Result<(u8, u64), ParseError> {
+        self.attempt(|r| {
+            let b = r.u8()?;
+            let arg = match b & 0x1f {
+                info @ 0..=23 => info as u64,
+                24 => r.u8()? as u64,
+                25 => r.be_u16()? as u64,
+                26 => r.be_u32()? as u64,
+                27 => r.be_u64()?,
+                _ => return Err(ParseError::Malformed),
+            };
+            Ok((b >> 5, arg))
+        })
+    }
+
+    /// Argument of a CBOR data item of major type `major`
+    fn cbor_arg(&mut self, major: u8) -> Result<u64, ParseError> {
+        self.attempt(|r| match r.cbor_header()? {
+            (m, arg) if m == major => Ok(arg),
+            _ => Err(ParseError::Malformed),
+        })
+    }
+
+    /// CBOR unsigned integer
+    pub fn cbor_uint(&mut self) -> Result<u64, ParseError> {
+        self.cbor_arg(0)
+    }
+
+    /// CBOR unsigned or negative integer
+    pub fn cbor_int(&mut self) -> Result<i128, ParseError> {
+        self.attempt(|r| match r.cbor_header()? {
+            (0, arg) => Ok(arg as i128),
+            (1, arg) => Ok(-1 - arg as i128),
+            _ => Err(ParseError::Malformed),
+        })
+    }
+
+    fn cbor_payload(&mut self, major: u8) -> Result<&'a [u8], ParseError> {
+        self.attempt(|r| {
+            let len = r.cbor_arg(major)?;
+            r.bytes(usize::try_from(len).map_err(|_| ParseError::Malformed)?)
+        })
+    }
+
+    /// CBOR byte string
+    pub fn cbor_bytes(&mut self) -> Result<&'a [u8], ParseError> {
+        self.cbor_payload(2)
+    }
+
+    /// CBOR text string
+    pub fn cbor_text(&mut self) -> Result<&'a str, ParseError> {
+        self.attempt(|r| {
+            core::str::from_utf8(r.cbor_payload(3)?).map_err(|_| ParseError::Malformed)
+        })
+    }
+
+    /// Header of a CBOR array, whose items follow, returning their number
+    pub fn cbor_array(&mut self) -> Result<u64, ParseError> {
+        self.cbor_arg(4)
+    }
+
+    /// Header of a CBOR map, whose keys and values follow, returning the
+    /// number of pairs
+    pub fn cbor_map(&mut self) -> Result<u64, ParseError> {
+        self.cbor_arg(5)
+    }
+
+    /// Field number and value of a protobuf field. Groups are not
+    /// supported.
+    pub fn proto_field(&mut self) -> Result<(u32, ProtoValue<'a>), ParseError> {
+        self.attempt(|r| {
+            let key = r.leb128()?;
+            let number = u32::try_from(key >> 3).map_err(|_| ParseError::Malformed)?;
+            if number == 0 {
+                return Err(ParseError::Malformed);
+            }
+            let value = match key & 7 {
+                0 => ProtoValue::Varint(r.leb128()?),
+                1 => ProtoValue::I64(r.le_u64()?),
+                2 => {
+                    let len = r.leb128()?;
+                    ProtoValue::Len(
+                        r.bytes(usize::try_from(len).map_err(|_| ParseError::Malformed)?)?,
+                    )
+                }
+                5 => ProtoValue::I32(r.le_u32()?),
+                _ => return Err(ParseError::Malformed),
+            };
+            Ok((number, value))
+        })
+    }
+}
+
+/// Parser of a message split in chunks, keeping up to `N` bytes of the item
+/// cut by the end of a chunk until the next one. An item of more than `N`
+/// bytes can only be parsed if it is not cut.
+pub struct ChunkedParser<const N: usize> {
+    carry: [u8; N],
+    len: usize,
+}
+
+impl<const N: usize> Default for ChunkedParser<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const N: usize> ChunkedParser<N> {
+    pub const fn new() -> Self {
+        ChunkedParser {
+            carry: [0u8; N],
+            len: 0,
+        }
+    }
+
+    /// Bytes of the last item, not complete yet. Empty once the whole
+    /// message is parsed.
+    pub fn pending(&self) -> &[u8] {
+        &self.carry[..self.len]
+    }
+
+    /// Parse the items of `chunk`, preceded by the bytes kept from the
+    /// previous chunk. `f` reads one item each time it is called, and is
+    /// called again from the same position once more data is there when it
+    /// returns `ParseError::Incomplete`. After any other error the parser
+    /// should be dropped.
+    pub fn feed<F>(&mut self, chunk: &[u8], mut f: F) -> Result<(), ParseError>
+    where
+        F: FnMut(&mut Reader<'_>) -> Result<(), ParseError>,
+    {
+        let mut chunk_pos = 0;
+        // Items starting in the kept bytes, completed with bytes of the
+        // chunk copied after them
+        while self.len > 0 {
+            let kept = self.len;
+            let taken = (chunk.len() - chunk_pos).min(N - kept);
+            self.carry[kept..kept + taken].copy_from_slice(&chunk[chunk_pos..chunk_pos + taken]);
+            let mut reader = Reader::new(&self.carry[..kept + taken]);
+            while reader.position() < kept && Self::item(&mut reader, &mut f)? {}
+            let consumed = reader.position();
+            if consumed >= kept {
+                chunk_pos += consumed - kept;
+                self.len = 0;
+            } else if chunk_pos + taken == chunk.len() {
+                self.carry.copy_within(consumed..kept + taken, 0);
+                self.len = kept + taken - consumed;
+                return Ok(());
+            } else if consumed == 0 {
+                return Err(ParseError::TooLarge);
+            } else {
+                // Make room and try again
+                self.carry.copy_within(consumed..kept, 0);
+                self.len = kept - consumed;
+            }
+        }
+
+        let mut reader = Reader {
+            data: chunk,
+            pos: chunk_pos,
+        };
+        while !reader.is_empty() && Self::item(&mut reader, &mut f)? {}
+        let rest = reader.remaining();
+        self.carry
+            .get_mut(..rest.len())
+            .ok_or(ParseError::TooLarge)?
+            .copy_from_slice(rest);
+        self.len = rest.len();
+        Ok(())
+    }
+
+    /// Parse one item. Returns whether it is complete.
+    fn item<F>(reader: &mut Reader<'_>, f: &mut F) -> Result<bool, ParseError>
+    where
+        F: FnMut(&mut Reader<'_>) -> Result<(), ParseError>,
+    {
+        let start = reader.position();
+        match reader.attempt(|r| f(r)) {
+            // An item of no byte would be parsed forever
+            Ok(()) if reader.position() == start => Err(ParseError::Malformed),
+            Ok(()) => Ok(true),
+            Err(ParseError::Incomplete) => Ok(false),
+            Err(e) => Err(e),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn integers() {
+        let mut r = Reader::new(&[
+            0xfc, 0xfd, 0x34, 0x12, 0xfd, 0x10, 0x00, 0xe5, 0x8e, 0x26, 0x80,
+        ]);
+        assert_eq!(r.compact_size(), Ok(0xfc));
+        assert_eq!(r.compact_size(), Ok(0x1234));
+        assert_eq!(r.compact_size(), Err(ParseError::Malformed));
+        assert_eq!(r.position(), 4);
+        r.bytes(3).map_err(|_| ())?;
+        assert_eq!(r.leb128(), Ok(624_485));
+        assert_eq!(r.leb128(), Err(ParseError::Incomplete));
+        assert_eq!(r.remaining(), &[0x80]);
+        let mut max = [0xffu8; 10];
+        max[9] = 1;
+        assert_eq!(Reader::new(&max).leb128(), Ok(u64::MAX));
+        max[9] = 2;
+        assert_eq!(Reader::new(&max).leb128(), Err(ParseError::Malformed));
+    }
+
+    #[test]
+    fn rlp() {
+        // ["cat", "dog"], 0x0f, 0x80 encoded as 0x8180, and 0x05 as 0x8105
+        let data = [
+            0xc8, 0x83, b'c', b'a', b't', 0x83, b'd', b'o', b'g', 0x0f, 0x81, 0x80, 0x81, 0x05,
+        ];
+        let mut r = Reader::new(&data);
+        let list = match r.rlp() {
+            Ok(Rlp::List(list)) => list,
+            _ => return Err(()),
+        };
+        let mut items = Reader::new(list);
+        assert_eq!(items.rlp(), Ok(Rlp::String(b"cat")));
+        assert_eq!(items.rlp(), Ok(Rlp::String(b"dog")));
+        assert_eq!(items.is_empty(), true);
+        assert_eq!(r.rlp(), Ok(Rlp::String(&[0x0f])));
+        assert_eq!(r.rlp(), Ok(Rlp::String(&[0x80])));
+        assert_eq!(r.rlp(), Err(ParseError::Malformed));
+        assert_eq!(Reader::new(&data[..8]).rlp(), Err(ParseError::Incomplete));
+        assert_eq!(Reader::new(&data).rlp_list_header(), Ok(8));
+        // Long form for a short string
+        assert_eq!(
+            Reader::new(&[0xb8, 0x01, 0x00]).rlp(),
+            Err(ParseError::Malformed)
+        );
+    }
+
+    #[test]
+    fn cbor() {
+        // [1, -500, h'0102', "ab", {}]
+        let data = [
+            0x85, 0x01, 0x39, 0x01, 0xf3, 0x42, 0x01, 0x02, 0x62, b'a', b'b', 0xa0,
+        ];
+        let mut r = Reader::new(&data);
+        assert_eq!(r.cbor_array(), Ok(5));
+        assert_eq!(r.cbor_uint(), Ok(1));
+        assert_eq!(r.cbor_uint(), Err(ParseError::Malformed));
+        assert_eq!(r.cbor_int(), Ok(-500));
+        assert_eq!(r.cbor_bytes(), Ok(&[1u8, 2][..]));
+        assert_eq!(r.cbor_text(), Ok("ab"));
+        assert_eq!(r.cbor_map(), Ok(0));
+        assert_eq!(
+            Reader::new(&data[5..7]).cbor_bytes(),
+            Err(ParseError::Incomplete)
+        );
+    }
+
+    #[test]
+    fn proto() {
+        // 1: 150, 2: "hi", 3: fixed32 1
+        let data = [0x08, 0x96, 0x01, 0x12, 0x02, b'h', b'i', 0x1d, 1, 0, 0, 0];
+        let mut r = Reader::new(&data);
+        assert_eq!(r.proto_field(), Ok((1, ProtoValue::Varint(150))));
+        assert_eq!(r.proto_field(), Ok((2, ProtoValue::Len(b"hi"))));
+        assert_eq!(r.proto_field(), Ok((3, ProtoValue::I32(1))));
+        assert_eq!(
+            Reader::new(&[0x0b]).proto_field(),
+            Err(ParseError::Malformed)
+        );
+    }
+
+    #[test]
+    fn chunked() {
+        let data = [0x08, 0x96, 0x01, 0x12, 0x02, b'h', b'i', 0x1d, 1, 0, 0, 0];
+        let expected = [
+            (1, ProtoValue::Varint(150)),
+            (2, ProtoValue::Len(b"hi")),
+            (3, ProtoValue::I32(1)),
+        ];
+        for cut in 0..=data.len() {
+            let mut parser = ChunkedParser::<6>::new();
+            let mut count = 0;
+            for chunk in [&data[..cut], &data[cut..]] {
+                parser
+                    .feed(chunk, |r| {
+                        let field = r.proto_field()?;
+                        if expected.get(count) != Some(&field) {
+                            return Err(ParseError::Malformed);
+                        }
+                        count += 1;
+                        Ok(())
+                    })
+                    .map_err(|_| ())?;
+            }
+            assert_eq!(count, 3);
+            assert_eq!(parser.pending().is_empty(), true);
+        }
+
+        // A string of 8 bytes does not fit in 4 bytes when cut
+        let mut parser = ChunkedParser::<4>::new();
+        let data = [0x88, 1, 2, 3, 4, 5, 6, 7, 8];
+        let mut f = |r: &mut Reader<'_>| r.rlp().map(|_| ());
+        assert_eq!(parser.feed(&data, &mut f), Ok(()));
+        assert_eq!(parser.feed(&data[..3], &mut f), Ok(()));
+        assert_eq!(parser.feed(&data[3..], &mut f), Err(ParseError::TooLarge));
+    }
+}
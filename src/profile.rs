@@ -0,0 +1,187 @@
+//! Call counts and time spent per cxlib operation, enabled by the
+//! `cx_profile` feature
+//!
+//! With the feature, [`cx_profile!`](crate::cx_profile) adds the ticks
+//! spent in the rest of the enclosing scope to the entry of its name in a
+//! static table. The SDK profiles the key derivations, the ECC operations
+//! and the hash and HMAC calls of its wrappers, so that a slow flow can be
+//! broken down before optimizing it:
+//!
+//! ```
+//! bench("sign", 10, || sign(&path, &hash));
+//! ```
+//!
+//! [`crate::testing::bench`] clears the table after its warm-up run and
+//! prints it after the measure, along with the ticks per iteration. Calls
+//! nested in a profiled scope are counted in both entries: an ECDSA
+//! signature of the cxlib, for instance, hashes with its own code, which
+//! is not counted as hashing.
+//!
+//! Without the feature, `cx_profile!` expands to nothing. Ticks are read
+//! through semihosting, so profiles are taken under speculos.
+
+use crate::testing::{ticks, to_dec, DebugWriter};
+
+/// Number of distinct names profiled, later ones being counted as a whole
+pub const PROFILE_LEN: usize = 16;
+
+/// Calls and ticks spent under one name
+#[derive(Copy, Clone)]
+pub struct Entry {
+    pub name: &'static str,
+    pub calls: u32,
+    pub ticks: u64,
+}
+
+struct Table {
+    entries: [Entry; PROFILE_LEN],
+    len: usize,
+    /// Calls and ticks of the names not fitting in the table
+    others: Entry,
+}
+
+const EMPTY: Entry = Entry {
+    name: "",
+    calls: 0,
+    ticks: 0,
+};
+
+static mut TABLE: Table = Table {
+    entries: [EMPTY; PROFILE_LEN],
+    len: 0,
+    others: Entry {
+        name: "others",
+        calls: 0,
+        ticks: 0,
+    },
+};
+
+fn table() -> &'static mut Table {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(TABLE) }
+}
+
+fn add(name: &'static str, ticks: u64) {
+    let table = table();
+    let entry = match table.entries[..table.len]
+        .iter()
+        // Names are told apart by address, which needs no relocation
+        .position(|e| e.name.as_ptr() == name.as_ptr() && e.name.len() == name.len())
+    {
+        Some(i) => &mut table.entries[i],
+        None if table.len < PROFILE_LEN => {
+            table.entries[table.len] = Entry { name, ..EMPTY };
+            table.len += 1;
+            &mut table.entries[table.len - 1]
+        }
+        None => &mut table.others,
+    };
+    entry.calls += 1;
+    entry.ticks += ticks;
+}
+
+/// Scope adding its ticks to the table when dropped, created by
+/// [`cx_profile!`](crate::cx_profile)
+pub struct Span {
+    name: &'static str,
+    start: u64,
+}
+
+impl Span {
+    #[inline(always)]
+    pub fn enter(name: &'static str) -> Self {
+        Span {
+            name,
+            start: ticks(),
+        }
+    }
+}
+
+impl Drop for Span {
+    #[inline(always)]
+    fn drop(&mut self) {
+        add(self.name, ticks().wrapping_sub(self.start));
+    }
+}
+
+/// Count a call under `name`, and the ticks spent in the rest of the
+/// enclosing scope
+#[macro_export]
+macro_rules! cx_profile {
+    ($name:expr) => {
+        let _profile = $crate::profile::Span::enter($name);
+    };
+}
+
+/// Entries of the table, in the order their names were first profiled
+pub fn entries() -> &'static [Entry] {
+    let table = table();
+    &table.entries[..table.len]
+}
+
+/// Calls and ticks of the names beyond the first [`PROFILE_LEN`]
+pub fn others() -> Entry {
+    table().others
+}
+
+/// Reset the table
+pub fn clear() {
+    let table = table();
+    table.len = 0;
+    table.others.calls = 0;
+    table.others.ticks = 0;
+}
+
+/// Print the entries, one per line: the name, the number of calls and the
+/// ticks spent
+pub fn dump() {
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    let others = others();
+    let all = entries()
+        .iter()
+        .chain(Some(&others).filter(|e| e.calls != 0));
+    for e in all {
+        w.write("    ");
+        w.write(e.name);
+        w.write(": ");
+        w.write(to_dec(e.calls, &mut buf));
+        w.write(" calls ");
+        w.write(to_dec(e.ticks.min(u32::MAX as u64) as u32, &mut buf));
+        w.write(" ticks\n");
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn call_table() {
+        clear();
+        for _ in 0..3 {
+            cx_profile!("outer");
+            cx_profile!("inner");
+        }
+        for i in 0..PROFILE_LEN {
+            add(["a", "b", "c", "d", "e", "f", "g", "h"][i % 8], 0);
+        }
+        let names: [&str; 3] = core::array::from_fn(|i| entries()[i].name);
+        assert_eq!(names, ["inner", "outer", "a"]);
+        assert_eq!(entries()[1].calls, 3);
+        assert_eq!(entries().len(), 10);
+        for name in ["i", "j", "k", "l", "m", "n"] {
+            add(name, 0);
+        }
+        assert_eq!(entries().len(), PROFILE_LEN);
+        assert_eq!(others().calls, 0);
+        for name in ["o", "p", "q"] {
+            add(name, 5);
+        }
+        assert_eq!((others().calls, others().ticks), (3, 15));
+        clear();
+    }
+}
@@ -1,6 +1,7 @@
 //! Random number generation functions
 
 // use crate::bindings::{cx_rng_u32, cx_rng_u8};
+use core::hint::black_box;
 use core::ops::Range;
 
 use num_traits::{Bounded, PrimInt, Unsigned};
@@ -30,6 +31,22 @@ where
     /// Generates a random value.
     fn random() -> Self;
 
+    /// Full-width product of `self` and `rhs`, as (high, low) halves.
+    ///
+    /// By default, a schoolbook product of the halves of both operands. The
+    /// implementations below use a wider type instead when there is one.
+    fn mul_hi_lo(self, rhs: Self) -> (Self, Self) {
+        let half = (Self::zero().count_zeros() / 2) as usize;
+        let mask = Self::max_value() >> half;
+        let (a1, a0) = (self >> half, self & mask);
+        let (b1, b0) = (rhs >> half, rhs & mask);
+        let (ll, lh, hl, hh) = (a0 * b0, a0 * b1, a1 * b0, a1 * b1);
+        let mid = (ll >> half) + (lh & mask) + (hl & mask);
+        let lo = (mid << half) | (ll & mask);
+        let hi = hh + (lh >> half) + (hl >> half) + (mid >> half);
+        (hi, lo)
+    }
+
     /// Generates and returns a random number in the given range
     ///
     /// # Arguments
@@ -45,38 +62,60 @@ where
     /// ```
     ///
     fn random_from_range(range: Range<Self>) -> Self {
+        Self::sample_range(range, Self::random)
+    }
+
+    /// Maps values returned by `draw` to the given range without bias, using
+    /// Lemire's multiply-shift method: a redraw happens with probability
+    /// below `width / 2^BITS`, whatever the width of the range.
+    ///
+    /// # Arguments
+    ///
+    /// * `range` - range bounded inclusively below and exclusively above. Empty
+    ///   ranges are not allowed and will cause panic.
+    /// * `draw` - source of uniformly distributed values
+    fn sample_range(range: Range<Self>, mut draw: impl FnMut() -> Self) -> Self {
         assert!(range.end > range.start, "Invalid range");
         let width = range.end - range.start;
-
-        if width & (width - Self::one()) == Self::zero() {
-            // Special case: range is a power of 2
-            // Result is very fast to calculate.
-            range.start + Self::random() % width
-        } else {
-            let chunk_size = Self::max_value() / width;
-            let last_chunk_value = chunk_size * width;
-            let mut r = Self::random();
-            while r >= last_chunk_value {
-                r = Self::random();
+        let (mut hi, mut lo) = draw().mul_hi_lo(width);
+        if lo < width {
+            // 2^BITS mod width
+            let threshold = (Self::max_value() - width + Self::one()) % width;
+            while lo < threshold {
+                (hi, lo) = draw().mul_hi_lo(width);
             }
-            range.start + r / chunk_size
         }
+        range.start + hi
     }
 }
 
-impl Random for u8 {
-    fn random() -> Self {
-        let mut r = [0u8; 1];
-        rand_bytes(&mut r);
-        r[0]
-    }
+macro_rules! impl_random {
+    ($t:ty, $wide:ty) => {
+        impl Random for $t {
+            fn random() -> Self {
+                let mut r = [0u8; core::mem::size_of::<$t>()];
+                rand_bytes(&mut r);
+                <$t>::from_be_bytes(r)
+            }
+
+            fn mul_hi_lo(self, rhs: Self) -> (Self, Self) {
+                let p = self as $wide * rhs as $wide;
+                ((p >> <$t>::BITS) as $t, p as $t)
+            }
+        }
+    };
 }
 
-impl Random for u32 {
+impl_random!(u8, u16);
+impl_random!(u16, u32);
+impl_random!(u32, u64);
+impl_random!(u64, u128);
+
+impl Random for u128 {
     fn random() -> Self {
-        let mut r = [0u8; 4];
+        let mut r = [0u8; 16];
         rand_bytes(&mut r);
-        u32::from_be_bytes(r)
+        u128::from_be_bytes(r)
     }
 }
 
@@ -117,6 +156,117 @@ impl RngCore for LedgerRng {
 /// Mark LedgerRng as safe for cryptographic use
 impl CryptoRng for LedgerRng {}
 
+/// Size of the [`BufferedRng`] pool, filled by a single syscall
+pub const RNG_POOL_SIZE: usize = 64;
+
+/// [`RngCore`] implementation serving random bytes from a pool, refilled with
+/// a single [`rand_bytes`] syscall every [`RNG_POOL_SIZE`] bytes.
+///
+/// This is much cheaper than [`LedgerRng`] when drawing many small values,
+/// e.g. in shuffles or rejection sampling loops. Bytes are erased from the
+/// pool as soon as they are handed out, and the remaining ones when dropped.
+pub struct BufferedRng {
+    pool: [u8; RNG_POOL_SIZE],
+    /// Offset of the first unused byte of the pool
+    pos: usize,
+}
+
+impl BufferedRng {
+    /// Create an empty pool, filled on first use.
+    pub const fn new() -> Self {
+        BufferedRng {
+            pool: [0; RNG_POOL_SIZE],
+            pos: RNG_POOL_SIZE,
+        }
+    }
+
+    /// Generates a random value of any type implementing [`Random`].
+    pub fn random<T: Random>(&mut self) -> T {
+        let mut r = T::zero();
+        let mut b = [0u8; 1];
+        for _ in 0..core::mem::size_of::<T>() {
+            self.fill_bytes(&mut b);
+            // Same as a shift by 8, which would overflow for u8
+            r = r.rotate_left(8) | T::from(b[0]).unwrap();
+        }
+        r
+    }
+
+    /// Generates a random number in the given range, without bias.
+    /// See [`Random::random_from_range`].
+    pub fn random_from_range<T: Random>(&mut self, range: Range<T>) -> T {
+        T::sample_range(range, || self.random())
+    }
+
+    /// Fills `out` with random numbers in the given range, without bias.
+    /// This is typically used to generate PIN pad layouts or shuffles.
+    pub fn fill_range<T: Random>(&mut self, out: &mut [T], range: Range<T>) {
+        for x in out.iter_mut() {
+            *x = self.random_from_range(range.clone());
+        }
+    }
+}
+
+impl Default for BufferedRng {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl RngCore for BufferedRng {
+    #[inline]
+    fn next_u32(&mut self) -> u32 {
+        let mut b = [0u8; 4];
+        self.fill_bytes(&mut b);
+        u32::from_be_bytes(b)
+    }
+
+    #[inline]
+    fn next_u64(&mut self) -> u64 {
+        let mut b = [0u8; 8];
+        self.fill_bytes(&mut b);
+        u64::from_be_bytes(b)
+    }
+
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        // Large requests would only go through the pool
+        if dest.len() >= RNG_POOL_SIZE {
+            rand_bytes(dest);
+            return;
+        }
+        let mut filled = 0;
+        while filled < dest.len() {
+            if self.pos == RNG_POOL_SIZE {
+                rand_bytes(&mut self.pool);
+                self.pos = 0;
+            }
+            let n = (dest.len() - filled).min(RNG_POOL_SIZE - self.pos);
+            let src = &mut self.pool[self.pos..self.pos + n];
+            dest[filled..filled + n].copy_from_slice(src);
+            src.fill(0);
+            self.pos += n;
+            filled += n;
+        }
+    }
+
+    #[inline]
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), rand_core::Error> {
+        self.fill_bytes(dest);
+        Ok(())
+    }
+}
+
+/// The pool is filled by the same generator as [`LedgerRng`]
+impl CryptoRng for BufferedRng {}
+
+impl Drop for BufferedRng {
+    #[inline(never)]
+    fn drop(&mut self) {
+        self.pool.fill(0);
+        self.pool = black_box(self.pool);
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -131,4 +281,30 @@ mod tests {
         let r: [u8; 16] = core::array::from_fn(|_| u8::random());
         assert_eq!(u128::from_be_bytes(r) != 0, true);
     }
+
+    #[test]
+    fn range() {
+        assert_eq!(u128::MAX.mul_hi_lo(u128::MAX), (u128::MAX - 1, 1));
+        let mut rng = BufferedRng::new();
+        let mut digits = [0u8; 10];
+        rng.fill_range(&mut digits, 0..10);
+        assert_eq!(digits.iter().all(|&d| d < 10), true);
+        for _ in 0..8 {
+            let r = u64::random_from_range(1000..1003);
+            assert_eq!((1000..1003).contains(&r), true);
+        }
+    }
+
+    #[test]
+    fn buffered_rng() {
+        let mut rng = BufferedRng::new();
+        let mut r = [0u8; 16];
+        // Straddle a pool refill
+        for _ in 0..5 {
+            rng.fill_bytes(&mut r);
+        }
+        assert_eq!(u128::from_be_bytes(r) != 0, true);
+        // Consumed bytes are erased from the pool
+        assert_eq!(rng.pool[..rng.pos].iter().all(|&b| b == 0), true);
+    }
 }
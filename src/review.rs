@@ -0,0 +1,455 @@
+//! Transaction review formatted a field at a time, when it is shown
+//!
+//! Instead of formatting every field of a transaction into strings before
+//! the first screen, the app only records where each field to display is
+//! while it hashes the payload, in a [`FieldIndex`]: a label, a location,
+//! a length and a [`Format`]. A [`FieldReview`] then reads and formats
+//! the field shown, and only it, from a [`FieldSource`], when a button
+//! press brings it up:
+//!
+//! ```
+//! static mut FIELDS: FieldIndex<16> = FieldIndex::new();
+//!
+//! let fields = unsafe { &mut *core::ptr::addr_of_mut!(FIELDS) };
+//! fields.clear();
+//! comm.stream_payload(INS_SIGN, 0x80, |chunk| {
+//!     hasher.update(chunk)?;
+//!     // `offset` of the amount, as counted by the parser
+//!     fields.record("Amount", offset, 8, Format::Amount { decimals: 8, little_endian: true })?;
+//!     Ok(())
+//! })?;
+//! fields.record("Approve", 0, 0, Format::None)?;
+//!
+//! let mut review = FieldReview::new(fields.fields(), &payload[..]);
+//! review.show(&mut screen)?;
+//! loop {
+//!     if let io::Event::Button(button) = comm.next_event::<u8>() {
+//!         if review.on_button(&mut screen, button)? == Some(fields.len() - 1) {
+//!             break;
+//!         }
+//!     }
+//! }
+//! ```
+//!
+//! The location of a field is only interpreted by the source: an offset in
+//! the payload kept in Flash or RAM, which `&[u8]` implements, or the
+//! index of a leaf of a [`crate::merkle`] tree, fetched from the host and
+//! verified against the root when the field is shown. The RAM used is that
+//! of the index and of the one value formatted, whatever the size of the
+//! transaction.
+
+use crate::buttons::ButtonEvent;
+use crate::encoding::{base58_encode, hex_encode};
+use crate::format::format_amount;
+use crate::io::{Reply, SyscallError};
+use crate::screen::{Compositor, Rect, SCREEN_HEIGHT, SCREEN_WIDTH};
+use crate::ui::{draw_arrows, fonts, Align, Label, TextLayout, Widget};
+
+/// Longest field, in bytes, before it is formatted
+pub const MAX_FIELD_LEN: usize = 128;
+/// Longest formatted value, hex fields taking two characters per byte
+pub const MAX_VALUE_LEN: usize = 2 * MAX_FIELD_LEN;
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum ReviewError {
+    /// All the fields of the index are used
+    Full,
+    /// The field is longer than [`MAX_FIELD_LEN`], or than 16 bytes for an
+    /// amount
+    TooLong,
+    /// The field is not valid UTF-8 text
+    Malformed,
+}
+
+impl From<ReviewError> for Reply {
+    fn from(e: ReviewError) -> Reply {
+        match e {
+            ReviewError::Full => SyscallError::Overflow.into(),
+            _ => SyscallError::InvalidParameter.into(),
+        }
+    }
+}
+
+/// How the bytes of a field are displayed
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Format {
+    /// Unsigned integer of up to 16 bytes, divided by `10^decimals`
+    Amount {
+        decimals: u8,
+        little_endian: bool,
+    },
+    Hex,
+    Base58,
+    /// UTF-8 text
+    Text,
+    /// No value, only the label, for the pages ending a review
+    None,
+}
+
+/// Displayable field of a transaction, not formatted yet
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct Field {
+    pub label: &'static str,
+    /// Where the field is, as understood by the [`FieldSource`]
+    pub location: u32,
+    pub len: u16,
+    pub format: Format,
+}
+
+impl Field {
+    const EMPTY: Field = Field {
+        label: "",
+        location: 0,
+        len: 0,
+        format: Format::None,
+    };
+
+    /// Read the field from `source` and format it into `out`
+    pub fn format<'a, S: FieldSource>(
+        &self,
+        source: &mut S,
+        out: &'a mut [u8],
+    ) -> Result<&'a str, Reply> {
+        let len = self.len as usize;
+        if len > MAX_FIELD_LEN {
+            return Err(ReviewError::TooLong.into());
+        }
+        if self.format == Format::None {
+            return Ok("");
+        }
+        let mut data = [0u8; MAX_FIELD_LEN];
+        let data = &mut data[..len];
+        source.read(self.location, data)?;
+        match self.format {
+            Format::Amount {
+                decimals,
+                little_endian,
+            } => {
+                if len > 16 {
+                    return Err(ReviewError::TooLong.into());
+                }
+                let mut bytes = [0u8; 16];
+                if little_endian {
+                    bytes[..len].copy_from_slice(data);
+                    bytes.reverse();
+                } else {
+                    bytes[16 - len..].copy_from_slice(data);
+                }
+                let n = u128::from_be_bytes(bytes);
+                format_amount(n, decimals as usize, Some(b','), out)
+                    .map_err(|_| ReviewError::TooLong.into())
+            }
+            Format::Hex => hex_encode(data, out).map_err(|_| ReviewError::TooLong.into()),
+            Format::Base58 => base58_encode(data, out).map_err(|_| ReviewError::TooLong.into()),
+            Format::Text => {
+                let text = core::str::from_utf8(data).map_err(|_| ReviewError::Malformed)?;
+                let out = out.get_mut(..len).ok_or(ReviewError::TooLong)?;
+                out.copy_from_slice(text.as_bytes());
+                // Copied from a valid string
+                Ok(unsafe { core::str::from_utf8_unchecked(out) })
+            }
+            Format::None => Ok(""),
+        }
+    }
+}
+
+/// Fields recorded while a transaction is parsed, up to `N`, each one
+/// taking `size_of::<Field>()` bytes
+pub struct FieldIndex<const N: usize> {
+    fields: [Field; N],
+    len: usize,
+}
+
+impl<const N: usize> Default for FieldIndex<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const N: usize> FieldIndex<N> {
+    pub const fn new() -> Self {
+        FieldIndex {
+            fields: [Field::EMPTY; N],
+            len: 0,
+        }
+    }
+
+    /// Add the field of `len` bytes at `location`, displayed as `format`
+    /// under `label`
+    pub fn record(
+        &mut self,
+        label: &'static str,
+        location: u32,
+        len: usize,
+        format: Format,
+    ) -> Result<(), ReviewError> {
+        if len > MAX_FIELD_LEN {
+            return Err(ReviewError::TooLong);
+        }
+        let field = self.fields.get_mut(self.len).ok_or(ReviewError::Full)?;
+        *field = Field {
+            label,
+            location,
+            len: len as u16,
+            format,
+        };
+        self.len += 1;
+        Ok(())
+    }
+
+    pub fn fields(&self) -> &[Field] {
+        &self.fields[..self.len]
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub fn clear(&mut self) {
+        self.len = 0;
+    }
+}
+
+/// Where the bytes of the fields are read from when they are shown
+pub trait FieldSource {
+    /// Fill `out` with the bytes of the field at `location`
+    fn read(&mut self, location: u32, out: &mut [u8]) -> Result<(), Reply>;
+}
+
+/// Payload kept whole, the location of a field being its offset
+impl FieldSource for &[u8] {
+    fn read(&mut self, location: u32, out: &mut [u8]) -> Result<(), Reply> {
+        let start = location as usize;
+        let data = start
+            .checked_add(out.len())
+            .and_then(|end| self.get(start..end))
+            .ok_or(SyscallError::InvalidParameter)?;
+        out.copy_from_slice(data);
+        Ok(())
+    }
+}
+
+const LINE_HEIGHT: u32 = 12;
+const TITLE_Y: u32 = 2;
+const VALUE_Y: u32 = TITLE_Y + LINE_HEIGHT + 4;
+/// Lines of a value shown at once: 1 on Nano S, 3 on the others
+const VALUE_LINES: usize = (SCREEN_HEIGHT - VALUE_Y as usize) / LINE_HEIGHT as usize;
+/// Room left for the text between the arrows
+const TEXT_X: u32 = 10;
+const TEXT_WIDTH: u32 = SCREEN_WIDTH as u32 - 2 * TEXT_X;
+/// Lines a value is laid out on, at most
+const MAX_VALUE_LINES: usize = 32;
+
+/// Fields shown one at a time, each one over as many pages as its value
+/// takes, the left and right buttons going to the previous and next pages
+pub struct FieldReview<'a, S: FieldSource> {
+    fields: &'a [Field],
+    source: S,
+    /// Field shown, and page of its value
+    index: usize,
+    page: usize,
+    pages: usize,
+    value: [u8; MAX_VALUE_LEN],
+    value_len: usize,
+}
+
+impl<'a, S: FieldSource> FieldReview<'a, S> {
+    pub fn new(fields: &'a [Field], source: S) -> Self {
+        assert!(!fields.is_empty());
+        FieldReview {
+            fields,
+            source,
+            index: 0,
+            page: 0,
+            pages: 0,
+            value: [0; MAX_VALUE_LEN],
+            value_len: 0,
+        }
+    }
+
+    /// Index of the field shown
+    pub fn index(&self) -> usize {
+        self.index
+    }
+
+    fn value(&self) -> &str {
+        // Written by `Field::format`
+        unsafe { core::str::from_utf8_unchecked(&self.value[..self.value_len]) }
+    }
+
+    fn layout(&self) -> TextLayout<'_, MAX_VALUE_LINES> {
+        TextLayout::new(self.value(), &fonts::OPEN_SANS_REGULAR_11PX, TEXT_WIDTH)
+    }
+
+    /// Format field `index`, the pages of the one shown before being
+    /// forgotten
+    fn load(&mut self, index: usize) -> Result<(), Reply> {
+        let field = self.fields[index];
+        self.value_len = field.format(&mut self.source, &mut self.value)?.len();
+        self.index = index;
+        self.pages = self.layout().pages(VALUE_LINES);
+        Ok(())
+    }
+
+    /// Move to the page before or after the one shown, formatting the
+    /// field it belongs to if it is another one. Returns whether it moved.
+    fn step(&mut self, forward: bool) -> Result<bool, Reply> {
+        if self.pages == 0 {
+            self.load(self.index)?;
+        }
+        match forward {
+            true if self.page + 1 < self.pages => self.page += 1,
+            true if self.index + 1 < self.fields.len() => {
+                self.load(self.index + 1)?;
+                self.page = 0;
+            }
+            false if self.page > 0 => self.page -= 1,
+            false if self.index > 0 => {
+                self.load(self.index - 1)?;
+                self.page = self.pages - 1;
+            }
+            _ => return Ok(false),
+        }
+        Ok(true)
+    }
+
+    fn draw(&self, screen: &mut Compositor) {
+        screen.clear();
+        let field = self.fields[self.index];
+        let title = &fonts::OPEN_SANS_EXTRABOLD_11PX;
+        let font = &fonts::OPEN_SANS_REGULAR_11PX;
+        if field.format == Format::None {
+            let y = (SCREEN_HEIGHT as u32 - LINE_HEIGHT) / 2;
+            let rect = Rect::new(TEXT_X, y, TEXT_WIDTH, LINE_HEIGHT);
+            Widget::Label(Label::new(field.label, title, rect, Align::Center)).draw(screen);
+        } else {
+            let rect = Rect::new(TEXT_X, TITLE_Y, TEXT_WIDTH, LINE_HEIGHT);
+            Widget::Label(Label::new(field.label, title, rect, Align::Center)).draw(screen);
+            let layout = self.layout();
+            for (i, line) in layout.page(self.page, VALUE_LINES).enumerate() {
+                let y = VALUE_Y + i as u32 * LINE_HEIGHT;
+                let rect = Rect::new(TEXT_X, y, TEXT_WIDTH, LINE_HEIGHT);
+                Widget::Label(Label::new(line, font, rect, Align::Center)).draw(screen);
+            }
+        }
+        let first = self.index == 0 && self.page == 0;
+        let last = self.index + 1 == self.fields.len() && self.page + 1 == self.pages;
+        draw_arrows(screen, !first, !last);
+    }
+
+    /// Format the field shown, and draw the whole screen
+    pub fn show(&mut self, screen: &mut Compositor) -> Result<(), Reply> {
+        self.load(self.index)?;
+        self.page = self.page.min(self.pages - 1);
+        self.draw(screen);
+        screen.update();
+        Ok(())
+    }
+
+    /// Handle a button event. Holding a button scrolls through the pages.
+    /// Returns the index of the field shown when both buttons are
+    /// released, and the error of the source if the field brought up
+    /// cannot be read.
+    pub fn on_button(
+        &mut self,
+        screen: &mut Compositor,
+        event: ButtonEvent,
+    ) -> Result<Option<usize>, Reply> {
+        let forward = match event {
+            ButtonEvent::LeftButtonRelease
+            | ButtonEvent::LeftButtonLongPress
+            | ButtonEvent::LeftButtonRepeat => false,
+            ButtonEvent::RightButtonRelease
+            | ButtonEvent::RightButtonLongPress
+            | ButtonEvent::RightButtonRepeat => true,
+            ButtonEvent::BothButtonsRelease => return Ok(Some(self.index)),
+            _ => return Ok(None),
+        };
+        if self.step(forward)? {
+            self.draw(screen);
+            screen.update();
+        }
+        Ok(None)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const PAYLOAD: [u8; 12] = [
+        0x00, 0xe1, 0xf5, 0x05, 0x00, 0x00, 0x00, 0x00, b'c', b'o', b'w', 0xff,
+    ];
+
+    #[test]
+    fn format_fields() {
+        let mut fields = FieldIndex::<3>::new();
+        let amount = Format::Amount {
+            decimals: 8,
+            little_endian: true,
+        };
+        fields.record("Amount", 0, 8, amount).map_err(|_| ())?;
+        fields.record("Memo", 8, 3, Format::Text).map_err(|_| ())?;
+        fields.record("Data", 8, 4, Format::Hex).map_err(|_| ())?;
+        assert_eq!(
+            fields.record("Approve", 0, 0, Format::None),
+            Err(ReviewError::Full)
+        );
+        let mut source = &PAYLOAD[..];
+        let mut out = [0u8; MAX_VALUE_LEN];
+        let value = |i: usize, source: &mut &[u8], out: &mut [u8; MAX_VALUE_LEN]| {
+            fields.fields()[i]
+                .format(source, out)
+                .map(|s| s.len())
+                .map_err(|_| ())
+        };
+        let len = value(0, &mut source, &mut out)?;
+        assert_eq!(&out[..len], b"1");
+        let len = value(1, &mut source, &mut out)?;
+        assert_eq!(&out[..len], b"cow");
+        let len = value(2, &mut source, &mut out)?;
+        assert_eq!(&out[..len], b"636f77ff");
+        // Beyond the payload, or not UTF-8
+        let field = Field {
+            location: 10,
+            ..fields.fields()[1]
+        };
+        assert_eq!(field.format(&mut source, &mut out).is_err(), true);
+        let field = Field {
+            len: 4,
+            ..fields.fields()[1]
+        };
+        assert_eq!(field.format(&mut source, &mut out).is_err(), true);
+    }
+
+    #[test]
+    fn pages_on_demand() {
+        let mut fields = FieldIndex::<3>::new();
+        fields.record("Data", 0, 64, Format::Hex).map_err(|_| ())?;
+        fields.record("Memo", 8, 3, Format::Text).map_err(|_| ())?;
+        fields
+            .record("Approve", 0, 0, Format::None)
+            .map_err(|_| ())?;
+        let payload = [0x5au8; 64];
+        let mut review = FieldReview::new(fields.fields(), &payload[..]);
+        let mut pages = 1;
+        while review.step(true).map_err(|_| ())? {
+            pages += 1;
+        }
+        let data_pages = pages - 2;
+        assert_eq!(data_pages > 1, true);
+        assert_eq!((review.index(), review.pages), (2, 1));
+        // Back to the last page of the data
+        review.step(false).map_err(|_| ())?;
+        review.step(false).map_err(|_| ())?;
+        assert_eq!((review.index(), review.page), (0, data_pages - 1));
+        assert_eq!(review.value().len(), 128);
+    }
+}
@@ -0,0 +1,216 @@
+//! Dispatch of APDUs to handlers through a table built at compile time
+//!
+//! [`apdu_router!`](crate::apdu_router) declares a [`Router`] static
+//! mapping instruction bytes to handlers, along with the class byte of the
+//! app and the P1, P2 and data lengths each instruction accepts:
+//!
+//! ```
+//! apdu_router! {
+//!     static ROUTER: Router = cla 0xe0;
+//!     0x01 => get_version { len: 0..=0 },
+//!     0x02 => get_pubkey { p1: 0..=1, p2: 0..=0, len: 21..=21 },
+//!     0x04 => sign { p1: 0..=0x80, len: 1..=255 },
+//! }
+//!
+//! fn sign(comm: &mut Comm) -> Result<(), Reply> {
+//!     let data = comm.get_data()?;
+//!     ...
+//! }
+//!
+//! loop {
+//!     match comm.next_event::<u8>() {
+//!         io::Event::Command(_) => ROUTER.handle(&mut comm),
+//!         ...
+//!     }
+//! }
+//! ```
+//!
+//! Commands are checked once against the route of their instruction before
+//! its handler is called, which then only has to parse the data. Lookups
+//! go through a 256-byte index, and routes only take room for the
+//! instructions declared.
+
+use crate::io::{Comm, Reply, StatusWords, DEFAULT_APDU_BUFFER_SIZE};
+use core::ops::RangeInclusive;
+
+/// Handler of an instruction. The response data is appended to `comm`, and
+/// the status word is that of the returned value.
+pub type Handler<const N: usize> = fn(&mut Comm<N>) -> Result<(), Reply>;
+
+/// A handler and the parameters of the commands it accepts
+#[derive(Copy, Clone)]
+pub struct Route<const N: usize> {
+    handler: Handler<N>,
+    p1: (u8, u8),
+    p2: (u8, u8),
+    len: (usize, usize),
+}
+
+impl<const N: usize> Route<N> {
+    /// Route accepting any P1, P2 and data length
+    pub const fn new(handler: Handler<N>) -> Self {
+        Route {
+            handler,
+            p1: (0, u8::MAX),
+            p2: (0, u8::MAX),
+            len: (0, usize::MAX),
+        }
+    }
+
+    pub const fn p1(mut self, range: RangeInclusive<u8>) -> Self {
+        self.p1 = (*range.start(), *range.end());
+        self
+    }
+
+    pub const fn p2(mut self, range: RangeInclusive<u8>) -> Self {
+        self.p2 = (*range.start(), *range.end());
+        self
+    }
+
+    /// Range of the length of the data field
+    pub const fn len(mut self, range: RangeInclusive<usize>) -> Self {
+        self.len = (*range.start(), *range.end());
+        self
+    }
+}
+
+/// `R` routes for commands of class `cla`, received in a
+/// [`Comm<N>`](crate::io::Comm)
+pub struct Router<const R: usize, const N: usize = DEFAULT_APDU_BUFFER_SIZE> {
+    cla: u8,
+    /// Index in `routes` plus one of each instruction, 0 if not routed
+    index: [u8; 256],
+    routes: [(u8, Route<N>); R],
+}
+
+fn in_range<T: PartialOrd>(v: T, (min, max): (T, T)) -> bool {
+    min <= v && v <= max
+}
+
+impl<const R: usize, const N: usize> Router<R, N> {
+    /// Build the router. Fails to compile when evaluated in a const
+    /// context if an instruction is routed twice.
+    pub const fn new(cla: u8, routes: [(u8, Route<N>); R]) -> Self {
+        assert!(R < 256);
+        let mut index = [0u8; 256];
+        let mut i = 0;
+        while i < R {
+            let ins = routes[i].0 as usize;
+            assert!(index[ins] == 0, "instruction routed twice");
+            index[ins] = i as u8 + 1;
+            i += 1;
+        }
+        Router { cla, index, routes }
+    }
+
+    /// Check the command received in `comm` and call the handler of its
+    /// instruction
+    pub fn dispatch(&self, comm: &mut Comm<N>) -> Result<(), Reply> {
+        let (cla, ins) = comm.get_cla_ins();
+        if cla != self.cla {
+            return Err(StatusWords::BadCla.into());
+        }
+        let route = match self.index[ins as usize] {
+            0 => return Err(StatusWords::Unknown.into()),
+            i => &self.routes[i as usize - 1].1,
+        };
+        if !in_range(comm.get_p1(), route.p1) || !in_range(comm.get_p2(), route.p2) {
+            return Err(StatusWords::WrongP1P2.into());
+        }
+        if !in_range(comm.get_data()?.len(), route.len) {
+            return Err(StatusWords::BadLen.into());
+        }
+        // Function pointers stored in the code are link addresses
+        let handler: Handler<N> =
+            unsafe { core::mem::transmute(crate::pic_cached(route.handler as *const ())) };
+        handler(comm)
+    }
+
+    /// [`dispatch`](Self::dispatch) the command received in `comm`, and
+    /// reply with the status word returned
+    pub fn handle(&self, comm: &mut Comm<N>) {
+        match self.dispatch(comm) {
+            Ok(()) => comm.reply_ok(),
+            Err(sw) => comm.reply(sw),
+        }
+    }
+}
+
+/// Declare a [`Router`](crate::router::Router) static. Each route maps an
+/// instruction byte to a [`Handler`](crate::router::Handler), optionally
+/// restricting the `p1`, `p2` and data `len` of the commands with
+/// inclusive ranges. See the [`router`](crate::router) module.
+#[macro_export]
+macro_rules! apdu_router {
+    (@unit $ins:expr) => {
+        ()
+    };
+    (
+        $vis:vis static $name:ident : Router $(<$n:tt>)? = cla $cla:expr;
+        $($ins:expr => $handler:path $({ $($key:ident : $value:expr),* $(,)? })?),* $(,)?
+    ) => {
+        $vis static $name: $crate::router::Router<
+            { <[()]>::len(&[$($crate::apdu_router!(@unit $ins)),*]) }
+            $(, $n)?
+        > = $crate::router::Router::new(
+            $cla,
+            [$((
+                $ins,
+                $crate::router::Route::new($handler) $($(.$key($value))*)?,
+            )),*],
+        );
+    };
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    fn get_version(comm: &mut Comm) -> Result<(), Reply> {
+        comm.append(&[1, 0]);
+        Ok(())
+    }
+
+    fn sign(_comm: &mut Comm) -> Result<(), Reply> {
+        Err(StatusWords::UserCancelled.into())
+    }
+
+    apdu_router! {
+        static ROUTER: Router = cla 0xe0;
+        0x01 => get_version { len: 0..=0 },
+        0x04 => sign { p1: 0..=0x80, p2: 0..=0, len: 1..=255 },
+    }
+
+    fn command(comm: &mut Comm, apdu: &[u8]) -> Result<(), u16> {
+        comm.apdu_buffer[..apdu.len()].copy_from_slice(apdu);
+        comm.rx = apdu.len();
+        comm.tx = 0;
+        ROUTER.dispatch(comm).map_err(|sw| sw.0)
+    }
+
+    #[test]
+    fn dispatch() {
+        let mut comm = Comm::new();
+        assert_eq!(command(&mut comm, &[0xe0, 0x01, 0, 0]), Ok(()));
+        assert_eq!(comm.tx, 2);
+        assert_eq!(command(&mut comm, &[0xe0, 0x01, 0, 0, 1, 0]), Err(0x6e01));
+        assert_eq!(command(&mut comm, &[0xb0, 0x01, 0, 0]), Err(0x6e00));
+        assert_eq!(command(&mut comm, &[0xe0, 0x02, 0, 0]), Err(0x6d00));
+        assert_eq!(
+            command(&mut comm, &[0xe0, 0x04, 0x81, 0, 1, 0]),
+            Err(0x6b00)
+        );
+        assert_eq!(
+            command(&mut comm, &[0xe0, 0x04, 0x80, 1, 1, 0]),
+            Err(0x6b00)
+        );
+        assert_eq!(command(&mut comm, &[0xe0, 0x04, 0x80, 0]), Err(0x6e01));
+        assert_eq!(
+            command(&mut comm, &[0xe0, 0x04, 0x80, 0, 1, 0]),
+            Err(0x6e02)
+        );
+    }
+}
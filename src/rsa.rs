@@ -0,0 +1,828 @@
+//! RSA with private keys in CRT form
+//!
+//! The OS RSA functions work with `(d, n)`, so each private operation is a
+//! full size modular exponentiation. An [`RsaPrivateKey`] holds the CRT
+//! components `(p, q, dP, dQ, qInv)` instead and runs two half size
+//! exponentiations, about four times faster. It also keeps `R^2 mod p` and
+//! `R^2 mod q`, computed once when the key is loaded, so that the Montgomery
+//! context of each prime is set up without any division.
+//!
+//! Operations run in place on a modulus sized buffer, typically the APDU
+//! buffer, with all intermediate values held by the bignum engine. PSS and
+//! OAEP encodings are also built in place: MGF1 masks are XORed straight
+//! into the buffer one digest at a time, so that no other modulus sized
+//! buffer is needed. Moduli are expected to be exactly `8 * N` bits long.
+//!
+//! Key types are sized for their modulus only, instead of the largest one
+//! the OS supports, so that a key can be kept on the stack or in a static
+//! without reserving room for 4096 bits: an [`Rsa2048PrivateKey`] takes
+//! 896 bytes and an [`Rsa2048PublicKey`] 260. The `_into` variants of the
+//! operations read their input from one buffer, which can stay in Flash,
+//! and write the result into another one.
+//!
+//! Keys are generated by a [`KeyGen`], one step at a time, so that the app
+//! keeps servicing the MCU during the seconds a prime search takes, with
+//! an [`Executor`](crate::executor::Executor) or an [idle job](crate::idle):
+//!
+//! ```
+//! let mut keygen = KeyGen::<128>::new(65537)?;
+//! let sk = exec.block_on(async {
+//!     loop {
+//!         if let Some(sk) = keygen.step()? {
+//!             return Ok::<_, CxError>(sk);
+//!         }
+//!         exec.yield_now::<u8>().await;
+//!     }
+//! })?;
+//! ```
+
+use crate::bn::{BnArena, MontCtx};
+use crate::ct::{ct_eq, xor_into, zeroize};
+use crate::ecc::CxError;
+use crate::hash::{HashFn, Sha256};
+use crate::random::rand_bytes;
+use core::cmp::Ordering;
+
+/// `DigestInfo` prefix of a SHA-256 digest, for PKCS#1 v1.5 signatures
+pub const SHA256_DIGEST_INFO: [u8; 19] = [
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05,
+    0x00, 0x04, 0x20,
+];
+
+/// Words of the bignum engine
+const WORD_NBYTES: usize = 32;
+
+/// Size of the SHA-256 digests used by PSS and OAEP
+const HLEN: usize = 32;
+
+/// XOR `out` with MGF1-SHA256(`seed`), one digest at a time
+fn mgf1_xor(seed: &[u8], out: &mut [u8]) -> Result<(), CxError> {
+    for (counter, chunk) in out.chunks_mut(HLEN).enumerate() {
+        let mut h = Sha256::new();
+        h.update(seed)?;
+        h.update(&(counter as u32).to_be_bytes())?;
+        let mask = h.finalize()?;
+        xor_into(chunk, &mask);
+    }
+    Ok(())
+}
+
+/// `H = SHA256(00 * 8 || m_hash || salt)` of EMSA-PSS
+fn pss_hash(m_hash: &[u8; HLEN], salt: &[u8]) -> Result<[u8; HLEN], CxError> {
+    let mut h = Sha256::new();
+    h.update(&[0u8; 8])?;
+    h.update(m_hash)?;
+    h.update(salt)?;
+    h.finalize()
+}
+
+/// EMSA-PSS encoding with SHA-256 of `m_hash` into `em`, for a modulus of
+/// `8 * em.len()` bits
+pub fn emsa_pss_encode_sha256(
+    m_hash: &[u8; HLEN],
+    salt: &[u8],
+    em: &mut [u8],
+) -> Result<(), CxError> {
+    if em.len() < HLEN + salt.len() + 2 {
+        return Err(CxError::InvalidParameterSize);
+    }
+    let h = pss_hash(m_hash, salt)?;
+    // EM = maskedDB || H || BC, DB = PS || 01 || salt
+    let (db, tail) = em.split_at_mut(em.len() - HLEN - 1);
+    let ps_len = db.len() - salt.len() - 1;
+    db[..ps_len].fill(0);
+    db[ps_len] = 0x01;
+    db[ps_len + 1..].copy_from_slice(salt);
+    mgf1_xor(&h, db)?;
+    // emBits = modBits - 1
+    db[0] &= 0x7f;
+    tail[..HLEN].copy_from_slice(&h);
+    tail[HLEN] = 0xbc;
+    Ok(())
+}
+
+/// Check that `em` is a valid EMSA-PSS encoding with SHA-256 of `m_hash`,
+/// with a salt of `salt_len` bytes. `em` is unmasked in place.
+pub fn emsa_pss_verify_sha256(m_hash: &[u8; HLEN], salt_len: usize, em: &mut [u8]) -> bool {
+    if em.len() < HLEN + salt_len + 2 || em[em.len() - 1] != 0xbc || em[0] & 0x80 != 0 {
+        return false;
+    }
+    let (db, tail) = em.split_at_mut(em.len() - HLEN - 1);
+    let h = &tail[..HLEN];
+    if mgf1_xor(h, db).is_err() {
+        return false;
+    }
+    db[0] &= 0x7f;
+    let ps_len = db.len() - salt_len - 1;
+    if db[..ps_len].iter().any(|&b| b != 0) || db[ps_len] != 0x01 {
+        return false;
+    }
+    matches!(pss_hash(m_hash, &db[ps_len + 1..]), Ok(h2) if ct_eq(&h2, h))
+}
+
+/// EME-OAEP encoding with SHA-256, in place: the `msg_len` bytes message
+/// at the start of `em` is replaced by its encoding, using `seed`
+pub fn eme_oaep_encode_sha256(
+    em: &mut [u8],
+    msg_len: usize,
+    label: &[u8],
+    seed: &[u8; HLEN],
+) -> Result<(), CxError> {
+    let k = em.len();
+    if k < 2 * HLEN + 2 || msg_len > k - 2 * HLEN - 2 {
+        return Err(CxError::InvalidParameterSize);
+    }
+    // EM = 00 || maskedSeed || maskedDB, DB = lHash || PS || 01 || M
+    em.copy_within(..msg_len, k - msg_len);
+    em[0] = 0x00;
+    em[1..1 + HLEN].copy_from_slice(seed);
+    em[1 + HLEN..1 + 2 * HLEN].copy_from_slice(&Sha256::hash(label)?);
+    em[1 + 2 * HLEN..k - msg_len - 1].fill(0);
+    em[k - msg_len - 1] = 0x01;
+
+    let (masked_seed, db) = em[1..].split_at_mut(HLEN);
+    mgf1_xor(masked_seed, db)?;
+    mgf1_xor(db, masked_seed)
+}
+
+/// EME-OAEP decoding with SHA-256, in place: the message is moved to the
+/// start of `em` and its length is returned
+pub fn eme_oaep_decode_sha256(em: &mut [u8], label: &[u8]) -> Result<usize, CxError> {
+    let k = em.len();
+    if k < 2 * HLEN + 2 {
+        return Err(CxError::InvalidParameterSize);
+    }
+    let l_hash = Sha256::hash(label)?;
+    let y = em[0];
+    let (masked_seed, db) = em[1..].split_at_mut(HLEN);
+    mgf1_xor(db, masked_seed)?;
+    mgf1_xor(masked_seed, db)?;
+
+    // Checked without early exits, so that failures all look the same
+    let mut bad = y | !ct_eq(&db[..HLEN], &l_hash) as u8;
+    let mut found = 0u8;
+    let mut start = 0;
+    for (i, &b) in db[HLEN..].iter().enumerate() {
+        let is_one = (b == 0x01) as u8;
+        let first = is_one & !found & 1;
+        start |= i * first as usize;
+        bad |= (b != 0 && b != 0x01) as u8 & !found & 1;
+        found |= is_one;
+    }
+    bad |= !found & 1;
+    if bad != 0 {
+        em.fill(0);
+        return Err(CxError::InvalidParameterValue);
+    }
+    let msg_start = 1 + 2 * HLEN + start + 1;
+    let msg_len = k - msg_start;
+    em.copy_within(msg_start.., 0);
+    em[msg_len..].fill(0);
+    Ok(msg_len)
+}
+
+/// RSA public key with a modulus of `N` bytes
+pub struct RsaPublicKey<const N: usize> {
+    n: [u8; N],
+    e: [u8; 4],
+}
+
+pub type Rsa1024PublicKey = RsaPublicKey<128>;
+pub type Rsa2048PublicKey = RsaPublicKey<256>;
+pub type Rsa3072PublicKey = RsaPublicKey<384>;
+pub type Rsa4096PublicKey = RsaPublicKey<512>;
+
+impl<const N: usize> RsaPublicKey<N> {
+    /// Size of the modulus in bits
+    pub const BITS: usize = 8 * N;
+
+    pub fn new(n: &[u8; N], e: u32) -> Self {
+        RsaPublicKey {
+            n: *n,
+            e: e.to_be_bytes(),
+        }
+    }
+
+    /// RSAES-OAEP encryption with SHA-256, in place: the `msg_len` bytes
+    /// message at the start of `buf`, which is `N` bytes long, is replaced by
+    /// its ciphertext
+    pub fn encrypt_oaep_sha256(
+        &self,
+        buf: &mut [u8],
+        msg_len: usize,
+        label: &[u8],
+    ) -> Result<(), CxError> {
+        if buf.len() != N {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let mut seed = [0u8; HLEN];
+        rand_bytes(&mut seed);
+        eme_oaep_encode_sha256(buf, msg_len, label, &seed)?;
+        self.public_op(buf)
+    }
+
+    /// RSAES-OAEP encryption with SHA-256 of `msg`, into `out`, which is
+    /// `N` bytes long
+    pub fn encrypt_oaep_sha256_into(
+        &self,
+        msg: &[u8],
+        label: &[u8],
+        out: &mut [u8],
+    ) -> Result<(), CxError> {
+        if out.len() != N || msg.len() > N {
+            return Err(CxError::InvalidParameterSize);
+        }
+        out[..msg.len()].copy_from_slice(msg);
+        self.encrypt_oaep_sha256(out, msg.len(), label)
+    }
+
+    /// Check the RSASSA-PSS signature `sig` of the SHA-256 `digest`, with a
+    /// salt of `salt_len` bytes. `sig` is overwritten.
+    pub fn verify_pss_sha256(&self, digest: &[u8; 32], salt_len: usize, sig: &mut [u8]) -> bool {
+        self.public_op(sig).is_ok() && emsa_pss_verify_sha256(digest, salt_len, sig)
+    }
+
+    /// Same as [`verify_pss_sha256`](Self::verify_pss_sha256), `sig` being
+    /// left as is and `scratch`, of `N` bytes, overwritten instead
+    pub fn verify_pss_sha256_into(
+        &self,
+        digest: &[u8; 32],
+        salt_len: usize,
+        sig: &[u8],
+        scratch: &mut [u8],
+    ) -> bool {
+        self.public_op_into(sig, scratch).is_ok()
+            && emsa_pss_verify_sha256(digest, salt_len, scratch)
+    }
+
+    /// `buf = buf^e mod n`, in place
+    pub fn public_op(&self, buf: &mut [u8]) -> Result<(), CxError> {
+        if buf.len() != N {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let arena = BnArena::lock(WORD_NBYTES)?;
+        let n = arena.alloc_init(N, &self.n)?;
+        let x = arena.alloc_init(N, buf)?;
+        if x.compare(&n)? != Ordering::Less {
+            return Err(CxError::InvalidParameterValue);
+        }
+        let mut r = arena.alloc(N)?;
+        r.mod_pow(&x, &self.e, &n)?;
+        r.export(buf)
+    }
+
+    /// `out = input^e mod n`, both being `N` bytes long
+    pub fn public_op_into(&self, input: &[u8], out: &mut [u8]) -> Result<(), CxError> {
+        if input.len() != N || out.len() != N {
+            return Err(CxError::InvalidParameterSize);
+        }
+        out.copy_from_slice(input);
+        self.public_op(out)
+    }
+}
+
+/// RSA private key in CRT form, with primes of `H` bytes and thus a
+/// modulus of `2 * H` bytes. Cleared when dropped.
+pub struct RsaPrivateKey<const H: usize> {
+    p: [u8; H],
+    q: [u8; H],
+    dp: [u8; H],
+    dq: [u8; H],
+    qinv: [u8; H],
+    /// `R^2 mod p`
+    hp: [u8; H],
+    /// `R^2 mod q`
+    hq: [u8; H],
+}
+
+pub type Rsa1024PrivateKey = RsaPrivateKey<64>;
+pub type Rsa2048PrivateKey = RsaPrivateKey<128>;
+pub type Rsa3072PrivateKey = RsaPrivateKey<192>;
+pub type Rsa4096PrivateKey = RsaPrivateKey<256>;
+
+impl<const H: usize> RsaPrivateKey<H> {
+    /// Size of the modulus in bytes
+    pub const MODULUS_SIZE: usize = 2 * H;
+    /// Size of the modulus in bits
+    pub const BITS: usize = 16 * H;
+
+    /// Load a key from its CRT components, big endian
+    pub fn from_crt(
+        p: &[u8; H],
+        q: &[u8; H],
+        dp: &[u8; H],
+        dq: &[u8; H],
+        qinv: &[u8; H],
+    ) -> Result<Self, CxError> {
+        if p[H - 1] & q[H - 1] & 1 == 0 {
+            return Err(CxError::InvalidParameterValue);
+        }
+        let mut key = RsaPrivateKey {
+            p: *p,
+            q: *q,
+            dp: *dp,
+            dq: *dq,
+            qinv: *qinv,
+            hp: [0u8; H],
+            hq: [0u8; H],
+        };
+        let arena = BnArena::lock(WORD_NBYTES)?;
+        let pb = arena.alloc_init(H, p)?;
+        MontCtx::new(&arena, &pb)?.export_h(&mut key.hp)?;
+        let qb = arena.alloc_init(H, q)?;
+        MontCtx::new(&arena, &qb)?.export_h(&mut key.hq)?;
+        Ok(key)
+    }
+
+    /// `buf = buf^d mod n`, in place, `buf` being `2 * H` bytes long
+    pub fn private_op(&self, buf: &mut [u8]) -> Result<(), CxError> {
+        if buf.len() != 2 * H {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let arena = BnArena::lock(WORD_NBYTES)?;
+        let c = arena.alloc_init(2 * H, buf)?;
+        let p = arena.alloc_init(H, &self.p)?;
+        let q = arena.alloc_init(H, &self.q)?;
+
+        // m_i = c^d_i mod prime_i, with the cached Montgomery constants
+        let mut x = arena.alloc(H)?;
+        let mut xm = arena.alloc(H)?;
+        let mut rm = arena.alloc(H)?;
+        let mut m1 = arena.alloc(H)?;
+        let mut m2 = arena.alloc(H)?;
+        for (prime, d, h, m) in [
+            (&p, &self.dp, &self.hp, &mut m1),
+            (&q, &self.dq, &self.hq, &mut m2),
+        ] {
+            let h = arena.alloc_init(H, h)?;
+            let mont = MontCtx::with_h(&arena, prime, &h)?;
+            x.reduce(&c, prime)?;
+            mont.to_montgomery(&mut xm, &x)?;
+            mont.pow(&mut rm, &xm, d)?;
+            mont.from_montgomery(m, &rm)?;
+        }
+
+        // h = qInv * (m1 - m2) mod p, m2 being reduced first if q > p
+        x.reduce(&m2, &p)?;
+        let mut diff = arena.alloc(H)?;
+        diff.mod_sub(&m1, &x, &p)?;
+        let qinv = arena.alloc_init(H, &self.qinv)?;
+        let mut h = arena.alloc(H)?;
+        h.mod_mul(&qinv, &diff, &p)?;
+
+        // m = m2 + h * q
+        let mut hq = arena.alloc(2 * H)?;
+        hq.mul(&h, &q)?;
+        m2.export(&mut buf[H..])?;
+        buf[..H].fill(0);
+        let m2 = arena.alloc_init(2 * H, buf)?;
+        let mut m = arena.alloc(2 * H)?;
+        m.add(&hq, &m2)?;
+        m.export(buf)
+    }
+
+    /// `out = input^d mod n`, both being `2 * H` bytes long
+    pub fn private_op_into(&self, input: &[u8], out: &mut [u8]) -> Result<(), CxError> {
+        if input.len() != 2 * H || out.len() != 2 * H {
+            return Err(CxError::InvalidParameterSize);
+        }
+        out.copy_from_slice(input);
+        self.private_op(out)
+    }
+
+    /// Modulus `n = p * q`, into `out`, which is `2 * H` bytes long
+    pub fn modulus(&self, out: &mut [u8]) -> Result<(), CxError> {
+        if out.len() != 2 * H {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let arena = BnArena::lock(WORD_NBYTES)?;
+        let p = arena.alloc_init(H, &self.p)?;
+        let q = arena.alloc_init(H, &self.q)?;
+        let mut n = arena.alloc(2 * H)?;
+        n.mul(&p, &q)?;
+        n.export(out)
+    }
+
+    /// PKCS#1 v1.5 signature of the DER `DigestInfo` encoded digest `t`,
+    /// written into `out`, which is `2 * H` bytes long
+    pub fn sign_pkcs1v15(&self, t: &[u8], out: &mut [u8]) -> Result<(), CxError> {
+        // EM = 00 || 01 || FF .. FF || 00 || T, with at least 8 FF
+        if out.len() != 2 * H || t.len() + 11 > out.len() {
+            return Err(CxError::InvalidParameterSize);
+        }
+        let ps_end = out.len() - t.len() - 1;
+        out[0] = 0x00;
+        out[1] = 0x01;
+        out[2..ps_end].fill(0xff);
+        out[ps_end] = 0x00;
+        out[ps_end + 1..].copy_from_slice(t);
+        self.private_op(out)
+    }
+
+    /// RSASSA-PSS signature of a SHA-256 `digest` with `salt`, written into
+    /// `out`, which is `2 * H` bytes long
+    pub fn sign_pss_sha256(
+        &self,
+        digest: &[u8; 32],
+        salt: &[u8],
+        out: &mut [u8],
+    ) -> Result<(), CxError> {
+        if out.len() != 2 * H {
+            return Err(CxError::InvalidParameterSize);
+        }
+        emsa_pss_encode_sha256(digest, salt, out)?;
+        self.private_op(out)
+    }
+
+    /// RSAES-OAEP decryption with SHA-256, in place: the ciphertext `buf`,
+    /// which is `2 * H` bytes long, is replaced by the message, whose length
+    /// is returned
+    pub fn decrypt_oaep_sha256(&self, buf: &mut [u8], label: &[u8]) -> Result<usize, CxError> {
+        self.private_op(buf)?;
+        eme_oaep_decode_sha256(buf, label)
+    }
+
+    /// RSAES-OAEP decryption with SHA-256 of the ciphertext `ct` into `out`,
+    /// both being `2 * H` bytes long. The message is at the start of `out`,
+    /// and its length is returned.
+    pub fn decrypt_oaep_sha256_into(
+        &self,
+        ct: &[u8],
+        label: &[u8],
+        out: &mut [u8],
+    ) -> Result<usize, CxError> {
+        self.private_op_into(ct, out)?;
+        eme_oaep_decode_sha256(out, label)
+    }
+
+    /// PKCS#1 v1.5 signature of a SHA-256 `digest`, written into `out`
+    pub fn sign_pkcs1v15_sha256(&self, digest: &[u8; 32], out: &mut [u8]) -> Result<(), CxError> {
+        let mut t = [0u8; SHA256_DIGEST_INFO.len() + 32];
+        t[..SHA256_DIGEST_INFO.len()].copy_from_slice(&SHA256_DIGEST_INFO);
+        t[SHA256_DIGEST_INFO.len()..].copy_from_slice(digest);
+        self.sign_pkcs1v15(&t, out)
+    }
+}
+
+impl<const H: usize> Drop for RsaPrivateKey<H> {
+    #[inline(never)]
+    fn drop(&mut self) {
+        for c in [
+            &mut self.p,
+            &mut self.q,
+            &mut self.dp,
+            &mut self.dq,
+            &mut self.qinv,
+            // Either one gives the prime away, as a factor of R^2 - h
+            &mut self.hp,
+            &mut self.hq,
+        ] {
+            zeroize(c);
+        }
+    }
+}
+
+/// Odd primes below 256, dividing out most prime candidates without the
+/// bignum engine
+const SMALL_PRIMES: [u8; 53] = [
+    3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97,
+    101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193,
+    197, 199, 211, 223, 227, 229, 233, 239, 241, 251,
+];
+
+/// Candidates sieved by a [`KeyGen`] step, at most
+const SIEVED_PER_STEP: u32 = 64;
+
+/// `n mod m` of the big endian `n`
+fn residue(n: &[u8], m: u32) -> u32 {
+    n.iter().fold(0u32, |r, &b| {
+        (((r as u64) << 8 | b as u64) % m as u64) as u32
+    })
+}
+
+/// Prime candidate, odd, of `H` bytes with its two top bits set, along
+/// with its residues modulo the small primes and `e`
+struct Candidate<const H: usize> {
+    n: [u8; H],
+    residues: [u8; SMALL_PRIMES.len()],
+    residue_e: u32,
+}
+
+impl<const H: usize> Candidate<H> {
+    fn random(e: u32) -> Self {
+        let mut n = [0u8; H];
+        rand_bytes(&mut n);
+        n[0] |= 0xc0;
+        n[H - 1] |= 1;
+        let mut residues = [0u8; SMALL_PRIMES.len()];
+        for (r, &m) in residues.iter_mut().zip(SMALL_PRIMES.iter()) {
+            *r = residue(&n, m as u32) as u8;
+        }
+        Candidate {
+            n,
+            residues,
+            residue_e: residue(&n, e),
+        }
+    }
+
+    /// Move to the next odd number, returning `false` if it no longer has
+    /// the two top bits set
+    fn next(&mut self, e: u32) -> bool {
+        let mut carry = 2u16;
+        for b in self.n.iter_mut().rev() {
+            let sum = *b as u16 + carry;
+            *b = sum as u8;
+            carry = sum >> 8;
+            if carry == 0 {
+                break;
+            }
+        }
+        for (r, &m) in self.residues.iter_mut().zip(SMALL_PRIMES.iter()) {
+            *r = ((*r as u16 + 2) % m as u16) as u8;
+        }
+        self.residue_e = ((self.residue_e as u64 + 2) % e as u64) as u32;
+        carry == 0 && self.n[0] & 0xc0 == 0xc0
+    }
+
+    /// Whether the candidate may be a prime `p` with `p - 1` coprime to
+    /// `e`, as far as small divisors tell
+    fn sieved(&self) -> bool {
+        self.residues.iter().all(|&r| r != 0) && self.residue_e != 1
+    }
+}
+
+impl<const H: usize> Drop for Candidate<H> {
+    fn drop(&mut self) {
+        zeroize(&mut self.n);
+    }
+}
+
+/// Progress of a [`KeyGen`]
+#[derive(Copy, Clone, Default)]
+pub struct KeyGenProgress {
+    /// Candidates considered
+    pub candidates: u32,
+    /// Candidates left by the sieve and tested by the bignum engine
+    pub tests: u32,
+    /// Primes found, 2 once the search is over
+    pub primes: u8,
+}
+
+/// Generation of an RSA key with primes of `H` bytes, run in steps
+///
+/// `cx_rsa_generate_pair_no_throw` searches both primes in one call, for
+/// seconds during which none of the messages of the MCU are answered, and
+/// hosts drop the link. Each call to [`KeyGen::step`] instead considers at
+/// most 64 candidates, sieved by the primes below 256 and then tested by
+/// `cx_bn_is_prime` at most once, and locks the bignum engine only for
+/// that test. Call `step` until it returns the key, servicing the MCU in
+/// between. [`KeyGen::progress`] tells how far the search is, and the
+/// primality tests are counted by [`cx_profile!`](crate::cx_profile).
+pub struct KeyGen<const H: usize> {
+    e: u32,
+    candidate: Candidate<H>,
+    /// First prime found
+    p: Option<[u8; H]>,
+    progress: KeyGenProgress,
+}
+
+impl<const H: usize> KeyGen<H> {
+    /// Start the generation of a key with the public exponent `e`, an odd
+    /// prime such as 65537
+    pub fn new(e: u32) -> Result<Self, CxError> {
+        if e < 3 || e & 1 == 0 {
+            return Err(CxError::InvalidParameterValue);
+        }
+        Ok(KeyGen {
+            e,
+            candidate: Candidate::random(e),
+            p: None,
+            progress: KeyGenProgress::default(),
+        })
+    }
+
+    pub fn progress(&self) -> KeyGenProgress {
+        self.progress
+    }
+
+    /// Run one step of the search, returning the key once both primes are
+    /// found
+    pub fn step(&mut self) -> Result<Option<RsaPrivateKey<H>>, CxError> {
+        for _ in 0..SIEVED_PER_STEP {
+            self.progress.candidates += 1;
+            let sieved = self.candidate.sieved();
+            if sieved && self.p.as_ref() != Some(&self.candidate.n) {
+                self.progress.tests += 1;
+                let prime = {
+                    let arena = BnArena::lock(WORD_NBYTES)?;
+                    let n = arena.alloc_init(H, &self.candidate.n)?;
+                    n.is_prime()?
+                };
+                if prime {
+                    self.progress.primes += 1;
+                    return match self.p.take() {
+                        None => {
+                            self.p = Some(self.candidate.n);
+                            self.candidate = Candidate::random(self.e);
+                            Ok(None)
+                        }
+                        Some(mut p) => {
+                            let key = key_from_primes(&p, &self.candidate.n, self.e);
+                            zeroize(&mut p);
+                            key.map(Some)
+                        }
+                    };
+                }
+            }
+            if !self.candidate.next(self.e) {
+                self.candidate = Candidate::random(self.e);
+            }
+            if sieved {
+                return Ok(None);
+            }
+        }
+        Ok(None)
+    }
+}
+
+impl<const H: usize> Drop for KeyGen<H> {
+    fn drop(&mut self) {
+        if let Some(p) = self.p.as_mut() {
+            zeroize(p);
+        }
+    }
+}
+
+/// CRT form of the key with the primes `p` and `q` and the exponent `e`
+fn key_from_primes<const H: usize>(
+    p: &[u8; H],
+    q: &[u8; H],
+    e: u32,
+) -> Result<RsaPrivateKey<H>, CxError> {
+    let mut dp = [0u8; H];
+    let mut dq = [0u8; H];
+    let mut qinv = [0u8; H];
+    {
+        let arena = BnArena::lock(WORD_NBYTES)?;
+        let one = arena.alloc_init(H, &[1])?;
+        let pb = arena.alloc_init(H, p)?;
+        let qb = arena.alloc_init(H, q)?;
+        let mut m = arena.alloc(H)?;
+        let mut d = arena.alloc(H)?;
+        // d_i = e^-1 mod (prime_i - 1)
+        for (prime, out) in [(&pb, &mut dp), (&qb, &mut dq)] {
+            m.sub(prime, &one)?;
+            d.mod_u32_invert(e, &m)?;
+            d.export(out)?;
+        }
+        // qInv = q^-1 mod p
+        m.reduce(&qb, &pb)?;
+        d.mod_invert_nprime(&m, &pb)?;
+        d.export(&mut qinv)?;
+    }
+    let key = RsaPrivateKey::from_crt(p, q, &dp, &dq, &qinv);
+    for c in [&mut dp, &mut dq, &mut qinv] {
+        zeroize(c);
+    }
+    key
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // 1024-bit test key, e = 65537, with p < q
+    const P: [u8; 64] = [
+        0xcc, 0x22, 0x5f, 0xa1, 0x28, 0x4a, 0x6b, 0x35, 0x22, 0x99, 0xbc, 0x01, 0xc3, 0xe6, 0x16,
+        0x84, 0x63, 0x57, 0xa1, 0xff, 0xfc, 0x55, 0xf6, 0x3d, 0xe3, 0xa7, 0x7d, 0x29, 0xf1, 0x6a,
+        0x7c, 0x79, 0xc4, 0x0b, 0x90, 0x4a, 0xb6, 0x5b, 0x7a, 0xcc, 0x1b, 0x48, 0x77, 0x34, 0x2f,
+        0x3c, 0x5f, 0x88, 0xd6, 0x75, 0x71, 0xa3, 0xaf, 0x4e, 0xc3, 0x66, 0x35, 0x6f, 0x26, 0x84,
+        0x9c, 0xa4, 0x86, 0x19,
+    ];
+    const Q: [u8; 64] = [
+        0xd7, 0x69, 0xc8, 0x9f, 0x9b, 0x61, 0x24, 0xc9, 0x5d, 0x7c, 0x11, 0xc0, 0x3c, 0xc7, 0x9d,
+        0xa9, 0xa2, 0x5e, 0x9e, 0xbd, 0x59, 0xb1, 0x14, 0x69, 0x2b, 0xab, 0x73, 0xdd, 0x27, 0xbd,
+        0x5b, 0x17, 0xc4, 0x1c, 0xb6, 0xc4, 0x1d, 0x8a, 0x5b, 0x5b, 0xc7, 0x84, 0xe0, 0x04, 0x95,
+        0x26, 0x48, 0x0c, 0x00, 0xe3, 0xd1, 0xd4, 0x42, 0xc8, 0x8f, 0x9b, 0x17, 0xe3, 0xd0, 0x3e,
+        0x14, 0x4e, 0xed, 0x17,
+    ];
+    const DP: [u8; 64] = [
+        0xa5, 0x79, 0xff, 0xd7, 0x5e, 0x17, 0xe5, 0x8c, 0x2f, 0x3e, 0x3c, 0x3f, 0x9a, 0x13, 0xfc,
+        0x90, 0xd9, 0x0f, 0x02, 0xcd, 0xc6, 0x39, 0xd0, 0xe1, 0x1e, 0x98, 0x79, 0x47, 0xf4, 0xe1,
+        0x83, 0x82, 0x19, 0xbf, 0xdd, 0xfa, 0x12, 0x95, 0x59, 0x97, 0xf7, 0x4d, 0xe9, 0x03, 0xae,
+        0x7e, 0xdc, 0x5a, 0xca, 0xae, 0x6d, 0xae, 0x68, 0xc0, 0x0a, 0x79, 0xe2, 0x3a, 0xf6, 0x18,
+        0x6d, 0xfa, 0x98, 0x91,
+    ];
+    const DQ: [u8; 64] = [
+        0x7e, 0x92, 0x5d, 0x9b, 0xca, 0xc4, 0xad, 0xc4, 0xd3, 0xf5, 0x4e, 0xc8, 0xd1, 0xed, 0xc8,
+        0xaa, 0x20, 0x09, 0xd0, 0xe4, 0x19, 0x8b, 0x7f, 0x1e, 0xbc, 0xd6, 0x25, 0x62, 0x51, 0x33,
+        0x66, 0x0e, 0xf4, 0xe0, 0x9a, 0x53, 0x69, 0xb8, 0x1e, 0x2e, 0x33, 0x71, 0xd3, 0xdf, 0x5d,
+        0x73, 0xfc, 0xe9, 0x70, 0xac, 0x6c, 0x62, 0x78, 0x4b, 0x38, 0x76, 0x3c, 0xf7, 0x53, 0x28,
+        0xe6, 0xed, 0xe9, 0x49,
+    ];
+    const QINV: [u8; 64] = [
+        0x7d, 0xd5, 0x48, 0x17, 0x52, 0x5e, 0xd5, 0x0b, 0x41, 0x89, 0x73, 0x4c, 0x97, 0x74, 0x6b,
+        0x74, 0x31, 0x61, 0x76, 0x74, 0xc2, 0x14, 0x53, 0x85, 0xb4, 0x3b, 0xe9, 0x5f, 0x44, 0x0e,
+        0x47, 0x6c, 0xc1, 0xfc, 0x9d, 0x7d, 0x14, 0xec, 0xd8, 0x0b, 0xbb, 0x23, 0xd6, 0xd1, 0x4e,
+        0xb9, 0x03, 0x9a, 0x46, 0xf0, 0x37, 0x0a, 0x35, 0x85, 0x03, 0x8e, 0xbe, 0x2c, 0xf1, 0x11,
+        0x25, 0x82, 0xb4, 0x1c,
+    ];
+    const N: [u8; 128] = [
+        0xab, 0xc5, 0x38, 0x63, 0xb1, 0xe5, 0x99, 0x63, 0xf9, 0x44, 0xe4, 0xd6, 0x85, 0x7e, 0xc7,
+        0x7b, 0xc9, 0x6c, 0xa1, 0x49, 0xa5, 0xba, 0x49, 0x86, 0xcd, 0x66, 0x2f, 0x43, 0xcc, 0xc4,
+        0xf2, 0x98, 0x18, 0x94, 0x4d, 0xe0, 0xb3, 0x46, 0x9d, 0x7f, 0x3e, 0xc2, 0xa3, 0x4d, 0x4a,
+        0x2c, 0xd2, 0xa1, 0x62, 0xfa, 0xd3, 0x9a, 0xec, 0x97, 0xce, 0xea, 0xb0, 0x5e, 0xc6, 0x62,
+        0x93, 0x20, 0x10, 0x4c, 0x8f, 0x05, 0x33, 0xef, 0xbc, 0x8f, 0xf8, 0xcf, 0x0e, 0xb4, 0xdb,
+        0xec, 0x06, 0x2b, 0x82, 0x53, 0x7e, 0x29, 0x79, 0x81, 0x1f, 0xac, 0x7c, 0x27, 0x5c, 0xfa,
+        0x9c, 0x40, 0x01, 0x2c, 0x70, 0x4a, 0x9c, 0x70, 0xec, 0xbb, 0xfa, 0x90, 0x38, 0x2a, 0x43,
+        0x0b, 0x63, 0xea, 0x22, 0xab, 0x01, 0x3b, 0xf9, 0x49, 0xb3, 0x0e, 0x76, 0x38, 0x0d, 0xfc,
+        0x90, 0x41, 0x99, 0x97, 0x32, 0x8b, 0x31, 0x3f,
+    ];
+
+    #[test]
+    fn crt_sign() {
+        let sk = Rsa1024PrivateKey::from_crt(&P, &Q, &DP, &DQ, &QINV).map_err(|_| ())?;
+        let pk = Rsa1024PublicKey::new(&N, 65537);
+        assert_eq!(
+            (Rsa1024PrivateKey::BITS, Rsa1024PublicKey::BITS),
+            (1024, 1024)
+        );
+        let digest = [0xa5u8; 32];
+        let mut sig = [0u8; 128];
+        sk.sign_pkcs1v15_sha256(&digest, &mut sig).map_err(|_| ())?;
+        pk.public_op(&mut sig).map_err(|_| ())?;
+        assert_eq!(&sig[..2], &[0x00, 0x01]);
+        assert_eq!(&sig[128 - 32..], &digest[..]);
+        assert_eq!(&sig[128 - 51..128 - 32], &SHA256_DIGEST_INFO[..]);
+    }
+
+    #[test]
+    fn pss_oaep() {
+        let sk = RsaPrivateKey::from_crt(&P, &Q, &DP, &DQ, &QINV).map_err(|_| ())?;
+        let pk = RsaPublicKey::new(&N, 65537);
+        let digest = [0x3cu8; 32];
+        let mut sig = [0u8; 128];
+        sk.sign_pss_sha256(&digest, &[0x11; 32], &mut sig)
+            .map_err(|_| ())?;
+        assert_eq!(pk.verify_pss_sha256(&digest, 32, &mut sig), true);
+
+        let mut buf = [0u8; 128];
+        buf[..5].copy_from_slice(b"hello");
+        pk.encrypt_oaep_sha256(&mut buf, 5, b"label")
+            .map_err(|_| ())?;
+        let len = sk.decrypt_oaep_sha256(&mut buf, b"label").map_err(|_| ())?;
+        assert_eq!(&buf[..len], b"hello");
+
+        // The inputs are left as they are
+        let mut ct = [0u8; 128];
+        pk.encrypt_oaep_sha256_into(b"hello", b"", &mut ct)
+            .map_err(|_| ())?;
+        let len = sk
+            .decrypt_oaep_sha256_into(&ct, b"", &mut buf)
+            .map_err(|_| ())?;
+        assert_eq!(&buf[..len], b"hello");
+        sk.sign_pss_sha256(&digest, &[], &mut sig).map_err(|_| ())?;
+        assert_eq!(pk.verify_pss_sha256_into(&digest, 0, &sig, &mut buf), true);
+        assert_eq!(pk.verify_pss_sha256_into(&digest, 0, &sig, &mut buf), true);
+    }
+
+    #[test]
+    fn sieve() {
+        let mut candidate = Candidate::<64>::random(65537);
+        for _ in 0..300 {
+            if !candidate.next(65537) {
+                candidate = Candidate::random(65537);
+            }
+        }
+        for (&r, &m) in candidate.residues.iter().zip(SMALL_PRIMES.iter()) {
+            assert_eq!(r as u32, residue(&candidate.n, m as u32));
+        }
+        assert_eq!(candidate.residue_e, residue(&candidate.n, 65537));
+        assert_eq!(residue(&N, 3), 1);
+    }
+
+    #[test]
+    fn keygen() {
+        let mut keygen = KeyGen::<32>::new(65537).map_err(|_| ())?;
+        let sk = loop {
+            if let Some(sk) = keygen.step().map_err(|_| ())? {
+                break sk;
+            }
+        };
+        let progress = keygen.progress();
+        assert_eq!(progress.primes, 2);
+        assert_eq!(progress.tests < progress.candidates, true);
+        let mut n = [0u8; 64];
+        sk.modulus(&mut n).map_err(|_| ())?;
+        assert_eq!(n[0] & 0x80, 0x80);
+        let pk = RsaPublicKey::new(&n, 65537);
+        let digest = [0x5au8; 32];
+        let mut sig = [0u8; 64];
+        sk.sign_pss_sha256(&digest, &[0x22; 16], &mut sig)
+            .map_err(|_| ())?;
+        assert_eq!(pk.verify_pss_sha256(&digest, 16, &mut sig), true);
+    }
+}
@@ -0,0 +1,495 @@
+//! GlobalPlatform SCP03 secure messaging (Amendment D)
+//!
+//! A [`Session`] opens a secure channel with the INITIALIZE UPDATE and
+//! EXTERNAL AUTHENTICATE commands, and then unwraps the commands received
+//! by [`Comm`] in place in `apdu_buffer`, and wraps the responses in place
+//! before they are sent:
+//!
+//! ```
+//! static mut SESSION: Session = Session::new();
+//!
+//! match comm.next_event() {
+//!     Event::Command(INITIALIZE_UPDATE) => {
+//!         session.initialize_update(&mut comm, &KEYS, KEY_INFO, &DIVERSIFICATION)?;
+//!         comm.reply_ok();
+//!     }
+//!     Event::Command(EXTERNAL_AUTHENTICATE) => {
+//!         session.external_authenticate(&mut comm)?;
+//!         comm.reply_ok();
+//!     }
+//!     Event::Command(_) => {
+//!         session.unwrap(&mut comm)?;
+//!         let sw = handle(&mut comm);
+//!         session.reply(&mut comm, sw);
+//!     }
+//! }
+//! ```
+//!
+//! The session keys are derived once per session and kept in RAM with the
+//! MAC chaining value, until the session is closed. Commands carry an
+//! 8-byte C-MAC, and their data is encrypted if the host asked for
+//! C-DECRYPTION; responses get R-ENCRYPTION and an 8-byte R-MAC if asked.
+//! Keys are AES-128 ones. A command failing its MAC check closes the
+//! session.
+
+use crate::aes::{Aes, Cmac, Direction, BLOCK_SIZE};
+use crate::ct::ct_eq;
+use crate::ecc::CxError;
+use crate::io::{Comm, Reply, StatusWords};
+use crate::random::rand_bytes;
+
+/// Instruction of INITIALIZE UPDATE
+pub const INITIALIZE_UPDATE: u8 = 0x50;
+/// Instruction of EXTERNAL AUTHENTICATE
+pub const EXTERNAL_AUTHENTICATE: u8 = 0x82;
+
+/// Security levels, P1 of EXTERNAL AUTHENTICATE
+pub const C_MAC: u8 = 0x01;
+pub const C_DECRYPTION: u8 = 0x02;
+pub const R_MAC: u8 = 0x10;
+pub const R_ENCRYPTION: u8 = 0x20;
+
+/// Bit of the class byte of the commands with secure messaging
+const CLA_SECURE: u8 = 0x04;
+
+/// Length of the MACs and cryptograms
+const MAC_LEN: usize = 8;
+
+/// Status words of the failures
+const SECURITY_NOT_SATISFIED: Reply = Reply(0x6982);
+const CONDITIONS_NOT_SATISFIED: Reply = Reply(0x6985);
+const AUTHENTICATION_FAILED: Reply = Reply(0x6300);
+
+/// Derivation constants of the KDF
+const CARD_CRYPTOGRAM: u8 = 0x00;
+const HOST_CRYPTOGRAM: u8 = 0x01;
+const S_ENC: u8 = 0x04;
+const S_MAC: u8 = 0x06;
+const S_RMAC: u8 = 0x07;
+
+/// Static keys of the secure channel
+pub struct StaticKeys {
+    pub enc: [u8; 16],
+    pub mac: [u8; 16],
+}
+
+/// KDF of SCP03 (NIST SP 800-108 in counter mode, with AES-CMAC), for
+/// outputs of at most one block: a 64-bit cryptogram or a 128-bit key
+fn derive(
+    key: &[u8; 16],
+    constant: u8,
+    bits: u16,
+    context: &[u8; 16],
+) -> Result<[u8; 16], CxError> {
+    // 11 zero bytes and the constant as label, a zero separator, the length
+    // in bits and the counter of the block
+    let mut data = [0u8; 32];
+    data[11] = constant;
+    data[13..15].copy_from_slice(&bits.to_be_bytes());
+    data[15] = 1;
+    data[16..].copy_from_slice(context);
+    Cmac::mac(key, &data)
+}
+
+#[derive(Copy, Clone, PartialEq, Eq)]
+enum State {
+    Closed,
+    /// INITIALIZE UPDATE done, waiting for EXTERNAL AUTHENTICATE
+    Initialized,
+    Open,
+}
+
+/// Secure channel session
+pub struct Session {
+    state: State,
+    s_enc: [u8; 16],
+    s_mac: [u8; 16],
+    s_rmac: [u8; 16],
+    /// MAC chaining value: the full C-MAC of the last command
+    mcv: [u8; 16],
+    /// Host challenge followed by the card challenge
+    context: [u8; 16],
+    /// Security level
+    level: u8,
+    /// Encryption counter of the last command unwrapped, 1 for the first
+    /// one after EXTERNAL AUTHENTICATE
+    counter: u32,
+    /// Whether the response to send is to the command last unwrapped
+    wrap: bool,
+}
+
+impl Default for Session {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Session {
+    pub const fn new() -> Session {
+        Session {
+            state: State::Closed,
+            s_enc: [0; 16],
+            s_mac: [0; 16],
+            s_rmac: [0; 16],
+            mcv: [0; 16],
+            context: [0; 16],
+            level: 0,
+            counter: 0,
+            wrap: false,
+        }
+    }
+
+    /// Whether a secure channel is open
+    pub fn is_open(&self) -> bool {
+        self.state == State::Open
+    }
+
+    /// Security level of the open channel, a combination of [`C_MAC`],
+    /// [`C_DECRYPTION`], [`R_MAC`] and [`R_ENCRYPTION`]
+    pub fn level(&self) -> u8 {
+        self.level
+    }
+
+    /// Close the channel and clear the session keys
+    pub fn close(&mut self) {
+        self.s_enc.fill(0);
+        self.s_mac.fill(0);
+        self.s_rmac.fill(0);
+        self.mcv.fill(0);
+        self.state = State::Closed;
+        self.level = 0;
+        self.counter = 0;
+        self.wrap = false;
+    }
+
+    /// Answer INITIALIZE UPDATE: derive the session keys from `keys` and
+    /// the challenges, and append the response to `comm`, made of the key
+    /// `diversification` data, the `key_info` (key version, `03` and the
+    /// `i` parameter), the card challenge and the card cryptogram
+    pub fn initialize_update<const N: usize>(
+        &mut self,
+        comm: &mut Comm<N>,
+        keys: &StaticKeys,
+        key_info: [u8; 3],
+        diversification: &[u8; 10],
+    ) -> Result<(), Reply> {
+        self.close();
+        let host_challenge = comm.get_data()?;
+        if host_challenge.len() != 8 {
+            return Err(StatusWords::BadLen.into());
+        }
+        self.context[..8].copy_from_slice(host_challenge);
+        rand_bytes(&mut self.context[8..]);
+        self.s_enc = derive(&keys.enc, S_ENC, 128, &self.context)?;
+        self.s_mac = derive(&keys.mac, S_MAC, 128, &self.context)?;
+        self.s_rmac = derive(&keys.mac, S_RMAC, 128, &self.context)?;
+        let cryptogram = derive(&self.s_mac, CARD_CRYPTOGRAM, 64, &self.context)?;
+        comm.append(diversification);
+        comm.append(&key_info);
+        comm.append(&self.context[8..]);
+        comm.append(&cryptogram[..MAC_LEN]);
+        self.state = State::Initialized;
+        Ok(())
+    }
+
+    /// Check EXTERNAL AUTHENTICATE, which opens the channel with the
+    /// security level of its P1
+    pub fn external_authenticate<const N: usize>(
+        &mut self,
+        comm: &mut Comm<N>,
+    ) -> Result<(), Reply> {
+        if self.state != State::Initialized {
+            return Err(CONDITIONS_NOT_SATISFIED);
+        }
+        let level = comm.get_p1();
+        let valid_level = level & C_MAC != 0
+            && level & !(C_MAC | C_DECRYPTION | R_MAC | R_ENCRYPTION) == 0
+            && (level & R_ENCRYPTION == 0
+                || level & (C_DECRYPTION | R_MAC) == C_DECRYPTION | R_MAC);
+        if !valid_level {
+            return Err(StatusWords::WrongP1P2.into());
+        }
+        if comm.get_data()?.len() != 2 * MAC_LEN {
+            return Err(StatusWords::BadLen.into());
+        }
+        self.level = 0;
+        self.check_mac(comm)?;
+        let host = derive(&self.s_mac, HOST_CRYPTOGRAM, 64, &self.context)?;
+        if !ct_eq(&comm.get_data()?[..MAC_LEN], &host[..MAC_LEN]) {
+            self.close();
+            return Err(AUTHENTICATION_FAILED);
+        }
+        self.level = level;
+        self.counter = 0;
+        self.state = State::Open;
+        Ok(())
+    }
+
+    /// Verify the C-MAC ending the data of the command and update the MAC
+    /// chaining value, closing the session if it does not match. Returns
+    /// the offset and length of the data before the C-MAC.
+    fn check_mac<const N: usize>(&mut self, comm: &Comm<N>) -> Result<(usize, usize), Reply> {
+        let range = comm.header().data_range()?;
+        if comm.get_cla_ins().0 & CLA_SECURE == 0 || range.len() < MAC_LEN {
+            self.close();
+            return Err(SECURITY_NOT_SATISFIED);
+        }
+        let end = range.end - MAC_LEN;
+        let mut cmac = Cmac::new(&self.s_mac)?;
+        cmac.update(&self.mcv)?;
+        cmac.update(&comm.apdu_buffer[..end])?;
+        let mac = cmac.finalize()?;
+        if !ct_eq(&mac[..MAC_LEN], &comm.apdu_buffer[end..range.end]) {
+            self.close();
+            return Err(SECURITY_NOT_SATISFIED);
+        }
+        self.mcv = mac;
+        Ok((range.start, end - range.start))
+    }
+
+    /// Initial chaining value of the command (`0x00`) or response (`0x80`)
+    /// encryption, from the encryption counter
+    fn icv(&self, direction: u8) -> Result<[u8; BLOCK_SIZE], CxError> {
+        let mut icv = [0u8; BLOCK_SIZE];
+        icv[0] = direction;
+        icv[12..].copy_from_slice(&self.counter.to_be_bytes());
+        let mut aes = Aes::new(&self.s_enc, Direction::Encrypt)?;
+        aes.ecb_in_place(&mut icv)?;
+        Ok(icv)
+    }
+
+    /// Check the C-MAC of the command received by `comm` and decrypt its
+    /// data, in place. The command is then left as sent in plain, without
+    /// Le and with the secure messaging bit of its class cleared, for
+    /// [`Comm::get_data`] and the other accessors.
+    pub fn unwrap<const N: usize>(&mut self, comm: &mut Comm<N>) -> Result<(), Reply> {
+        self.wrap = false;
+        if self.state != State::Open {
+            return Err(SECURITY_NOT_SATISFIED);
+        }
+        let (offset, mut len) = self.check_mac(comm)?;
+        self.counter = self.counter.wrapping_add(1);
+        self.wrap = true;
+        if self.level & C_DECRYPTION != 0 && len > 0 {
+            if len % BLOCK_SIZE != 0 {
+                return Err(StatusWords::BadLen.into());
+            }
+            let mut icv = self.icv(0x00)?;
+            let data = &mut comm.apdu_buffer[offset..offset + len];
+            Aes::new(&self.s_enc, Direction::Decrypt)?.cbc_decrypt_in_place(&mut icv, data)?;
+            // Padded with 0x80 then zeros
+            len = data
+                .iter()
+                .rposition(|&b| b != 0)
+                .filter(|&i| data[i] == 0x80)
+                .ok_or(StatusWords::BadLen)?;
+        }
+        comm.apdu_buffer[0] &= !CLA_SECURE;
+        comm.rx = match (len, offset) {
+            (0, _) => 4,
+            (_, 5) => {
+                comm.apdu_buffer[4] = len as u8;
+                5 + len
+            }
+            _ => {
+                comm.apdu_buffer[5..7].copy_from_slice(&(len as u16).to_be_bytes());
+                7 + len
+            }
+        };
+        Ok(())
+    }
+
+    /// Encrypt the response data appended to `comm` and append its R-MAC,
+    /// as the security level asks, for the status word `sw`. Errors other
+    /// than warnings (`62xx` and `63xx`) are sent alone, without data.
+    pub fn wrap_response<const N: usize>(
+        &mut self,
+        comm: &mut Comm<N>,
+        sw: u16,
+    ) -> Result<(), Reply> {
+        if !core::mem::take(&mut self.wrap) || self.state != State::Open {
+            return Ok(());
+        }
+        if !matches!(sw >> 8, 0x90 | 0x62 | 0x63) {
+            comm.tx = 0;
+            return Ok(());
+        }
+        if self.level & R_ENCRYPTION != 0 && comm.tx > 0 {
+            let padded = (comm.tx / BLOCK_SIZE + 1) * BLOCK_SIZE;
+            if padded + MAC_LEN + 2 > N {
+                return Err(StatusWords::BadLen.into());
+            }
+            comm.apdu_buffer[comm.tx] = 0x80;
+            comm.apdu_buffer[comm.tx + 1..padded].fill(0);
+            let mut icv = self.icv(0x80)?;
+            Aes::new(&self.s_enc, Direction::Encrypt)?
+                .cbc_encrypt_in_place(&mut icv, &mut comm.apdu_buffer[..padded])?;
+            comm.tx = padded;
+        }
+        if self.level & R_MAC != 0 {
+            if comm.tx + MAC_LEN + 2 > N {
+                return Err(StatusWords::BadLen.into());
+            }
+            let mut cmac = Cmac::new(&self.s_rmac)?;
+            cmac.update(&self.mcv)?;
+            cmac.update(&comm.apdu_buffer[..comm.tx])?;
+            cmac.update(&sw.to_be_bytes())?;
+            let mac = cmac.finalize()?;
+            comm.append(&mac[..MAC_LEN]);
+        }
+        Ok(())
+    }
+
+    /// Wrap the response appended to `comm` with [`Session::wrap_response`]
+    /// and send it with the status word of `reply`
+    pub fn reply<const N: usize, T: Into<Reply>>(&mut self, comm: &mut Comm<N>, reply: T) {
+        let sw = reply.into();
+        match self.wrap_response(comm, sw.0) {
+            Ok(()) => comm.reply(sw),
+            Err(e) => {
+                comm.tx = 0;
+                comm.reply(e)
+            }
+        }
+    }
+}
+
+impl Drop for Session {
+    fn drop(&mut self) {
+        self.close();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    const KEYS: StaticKeys = StaticKeys {
+        enc: [0x40; 16],
+        mac: [0x41; 16],
+    };
+
+    fn command(comm: &mut Comm, apdu: &[u8]) {
+        comm.apdu_buffer[..apdu.len()].copy_from_slice(apdu);
+        comm.rx = apdu.len();
+        comm.tx = 0;
+    }
+
+    /// Host side of the channel: MAC `header || data` with the chaining
+    /// value, returning the command and its length
+    fn wrap(
+        mcv: &mut [u8; 16],
+        s_mac: &[u8; 16],
+        apdu: &[u8],
+    ) -> Result<([u8; 64], usize), CxError> {
+        let mut wrapped = [0u8; 64];
+        wrapped[..apdu.len()].copy_from_slice(apdu);
+        wrapped[4] += MAC_LEN as u8;
+        let mut cmac = Cmac::new(s_mac)?;
+        cmac.update(mcv)?;
+        cmac.update(&wrapped[..apdu.len()])?;
+        *mcv = cmac.finalize()?;
+        wrapped[apdu.len()..apdu.len() + MAC_LEN].copy_from_slice(&mcv[..MAC_LEN]);
+        Ok((wrapped, apdu.len() + MAC_LEN))
+    }
+
+    #[test]
+    fn secure_channel() {
+        let mut session = Session::new();
+        let mut comm = Comm::new();
+        let host_challenge = [1, 2, 3, 4, 5, 6, 7, 8];
+        command(
+            &mut comm,
+            &[0x80, INITIALIZE_UPDATE, 0x30, 0, 8, 1, 2, 3, 4, 5, 6, 7, 8],
+        );
+        session
+            .initialize_update(&mut comm, &KEYS, [0x30, 0x03, 0x70], &[0xdd; 10])
+            .map_err(|_| ())?;
+        assert_eq!(comm.tx, 29);
+        let mut context = [0u8; 16];
+        context[..8].copy_from_slice(&host_challenge);
+        context[8..].copy_from_slice(&comm.apdu_buffer[13..21]);
+        let s_mac = derive(&KEYS.mac, S_MAC, 128, &context).map_err(|_| ())?;
+        let s_enc = derive(&KEYS.enc, S_ENC, 128, &context).map_err(|_| ())?;
+        let s_rmac = derive(&KEYS.mac, S_RMAC, 128, &context).map_err(|_| ())?;
+        let card = derive(&s_mac, CARD_CRYPTOGRAM, 64, &context).map_err(|_| ())?;
+        assert_eq!(comm.apdu_buffer[21..29], card[..8]);
+
+        // EXTERNAL AUTHENTICATE, with all the security levels
+        let host = derive(&s_mac, HOST_CRYPTOGRAM, 64, &context).map_err(|_| ())?;
+        let mut apdu = [
+            0x84,
+            EXTERNAL_AUTHENTICATE,
+            0x33,
+            0,
+            8,
+            0,
+            0,
+            0,
+            0,
+            0,
+            0,
+            0,
+            0,
+        ];
+        apdu[5..].copy_from_slice(&host[..8]);
+        let mut mcv = [0u8; 16];
+        let (wrapped, len) = wrap(&mut mcv, &s_mac, &apdu).map_err(|_| ())?;
+        command(&mut comm, &wrapped[..len]);
+        session.external_authenticate(&mut comm).map_err(|_| ())?;
+        assert_eq!(session.is_open(), true);
+
+        // A command with 3 encrypted bytes
+        let mut data = [0u8; 16];
+        data[..4].copy_from_slice(&[0xaa, 0xbb, 0xcc, 0x80]);
+        let mut icv = [0u8; 16];
+        icv[15] = 1;
+        Aes::new(&s_enc, Direction::Encrypt)
+            .and_then(|mut aes| aes.ecb_in_place(&mut icv))
+            .map_err(|_| ())?;
+        Aes::new(&s_enc, Direction::Encrypt)
+            .and_then(|mut aes| aes.cbc_encrypt_in_place(&mut icv, &mut data))
+            .map_err(|_| ())?;
+        let mut apdu = [0u8; 21];
+        apdu[..5].copy_from_slice(&[0x84, 0xca, 0, 0, 16]);
+        apdu[5..].copy_from_slice(&data);
+        let (wrapped, len) = wrap(&mut mcv, &s_mac, &apdu).map_err(|_| ())?;
+        command(&mut comm, &wrapped[..len]);
+        session.unwrap(&mut comm).map_err(|_| ())?;
+        assert_eq!(comm.get_cla_ins(), (0x80, 0xca));
+        assert_eq!(comm.get_data().ok(), Some(&[0xaa, 0xbb, 0xcc][..]));
+
+        // Its encrypted and MACed response
+        comm.append(&[0x12, 0x34]);
+        session.wrap_response(&mut comm, 0x9000).map_err(|_| ())?;
+        assert_eq!(comm.tx, 24);
+        let mut cmac = Cmac::new(&s_rmac).map_err(|_| ())?;
+        cmac.update(&mcv).map_err(|_| ())?;
+        cmac.update(&comm.apdu_buffer[..16]).map_err(|_| ())?;
+        cmac.update(&[0x90, 0x00]).map_err(|_| ())?;
+        let rmac = cmac.finalize().map_err(|_| ())?;
+        assert_eq!(comm.apdu_buffer[16..24], rmac[..8]);
+        let mut icv = [0u8; 16];
+        icv[0] = 0x80;
+        icv[15] = 1;
+        let mut response = [0u8; 16];
+        response.copy_from_slice(&comm.apdu_buffer[..16]);
+        Aes::new(&s_enc, Direction::Encrypt)
+            .and_then(|mut aes| aes.ecb_in_place(&mut icv))
+            .map_err(|_| ())?;
+        Aes::new(&s_enc, Direction::Decrypt)
+            .and_then(|mut aes| aes.cbc_decrypt_in_place(&mut icv, &mut response))
+            .map_err(|_| ())?;
+        assert_eq!(response[..3], [0x12, 0x34, 0x80]);
+
+        // A wrong C-MAC closes the channel
+        let (mut wrapped, len) = wrap(&mut mcv, &s_mac, &[0x84, 0xca, 0, 0, 0]).map_err(|_| ())?;
+        wrapped[len - 1] ^= 1;
+        command(&mut comm, &wrapped[..len]);
+        assert_eq!(session.unwrap(&mut comm).map_err(|e| e.0), Err(0x6982));
+        assert_eq!(session.is_open(), false);
+    }
+}
@@ -63,3 +63,416 @@ pub fn sdk_bagl_hal_draw_rect(color: u32, x: i32, y: i32, width: u32, height: u3
         bagl_hal_draw_rect(color, x, y, width, height);
     }
 }
+
+#[cfg(target_os = "nanos")]
+pub const SCREEN_HEIGHT: usize = 32;
+#[cfg(not(target_os = "nanos"))]
+pub const SCREEN_HEIGHT: usize = 64;
+pub const SCREEN_WIDTH: usize = 128;
+
+/// Maximum number of distinct damaged regions tracked between two updates.
+/// Beyond this, regions are merged together.
+pub const MAX_DAMAGE_RECTS: usize = 4;
+
+/// Size of the buffer used to send a damaged region, in bytes. Regions are
+/// sent in horizontal strips fitting in it.
+const STRIP_LEN: usize = 128;
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct Rect {
+    pub x: u32,
+    pub y: u32,
+    pub width: u32,
+    pub height: u32,
+}
+
+impl Rect {
+    pub const fn new(x: u32, y: u32, width: u32, height: u32) -> Rect {
+        Rect {
+            x,
+            y,
+            width,
+            height,
+        }
+    }
+
+    fn is_empty(&self) -> bool {
+        self.width == 0 || self.height == 0
+    }
+
+    fn area(&self) -> u32 {
+        self.width * self.height
+    }
+
+    /// Smallest rectangle containing both `self` and `other`
+    fn union(&self, other: &Rect) -> Rect {
+        let x = self.x.min(other.x);
+        let y = self.y.min(other.y);
+        let right = (self.x + self.width).max(other.x + other.width);
+        let bottom = (self.y + self.height).max(other.y + other.height);
+        Rect::new(x, y, right - x, bottom - y)
+    }
+
+    /// True if the rectangles overlap or are adjacent
+    fn touches(&self, other: &Rect) -> bool {
+        self.x <= other.x + other.width
+            && other.x <= self.x + self.width
+            && self.y <= other.y + other.height
+            && other.y <= self.y + self.height
+    }
+
+    /// Intersection with the screen area
+    fn clip(&self) -> Rect {
+        let x = self.x.min(SCREEN_WIDTH as u32);
+        let y = self.y.min(SCREEN_HEIGHT as u32);
+        let width = self.width.min(SCREEN_WIDTH as u32 - x);
+        let height = self.height.min(SCREEN_HEIGHT as u32 - y);
+        Rect::new(x, y, width, height)
+    }
+}
+
+/// A frame sent by [`Compositor::update_async`] is still being displayed
+static mut DISPLAY_BUSY: bool = false;
+/// Tick count when the frame being displayed was sent
+static mut DISPLAY_SENT_AT: u32 = 0;
+
+/// Ticks after which a frame is assumed displayed, should the MCU never
+/// report it
+const DISPLAY_TIMEOUT_TICKS: u32 = 2;
+
+/// Account for a `DisplayProcessed` event. Called by the SDK handler.
+pub(crate) fn on_display_processed() {
+    unsafe { DISPLAY_BUSY = false };
+}
+
+/// Whether the last frame sent by [`Compositor::update_async`] is still
+/// being displayed
+pub fn display_busy() -> bool {
+    unsafe {
+        DISPLAY_BUSY && crate::timer::ticks().wrapping_sub(DISPLAY_SENT_AT) < DISPLAY_TIMEOUT_TICKS
+    }
+}
+
+/// Application-side 1 bit per pixel framebuffer, which records the regions
+/// modified by drawing operations and only sends those to the screen on
+/// [`update`](Compositor::update), instead of redrawing whole frames.
+///
+/// Pixels are stored row by row, least significant bit first, as expected by
+/// `bagl_hal_draw_bitmap_within_rect`. A set bit is a lit pixel.
+pub struct Compositor {
+    fb: [u8; SCREEN_WIDTH * SCREEN_HEIGHT / 8],
+    damage: [Rect; MAX_DAMAGE_RECTS],
+    damage_count: usize,
+}
+
+impl Compositor {
+    pub const fn new() -> Compositor {
+        Compositor {
+            fb: [0; SCREEN_WIDTH * SCREEN_HEIGHT / 8],
+            damage: [Rect::new(0, 0, 0, 0); MAX_DAMAGE_RECTS],
+            damage_count: 0,
+        }
+    }
+
+    pub fn pixel(&self, x: u32, y: u32) -> bool {
+        let i = y as usize * SCREEN_WIDTH + x as usize;
+        self.fb[i / 8] & (1 << (i % 8)) != 0
+    }
+
+    fn set_pixel(&mut self, x: u32, y: u32, on: bool) {
+        let i = y as usize * SCREEN_WIDTH + x as usize;
+        if on {
+            self.fb[i / 8] |= 1 << (i % 8);
+        } else {
+            self.fb[i / 8] &= !(1 << (i % 8));
+        }
+    }
+
+    /// Turns off all the pixels.
+    pub fn clear(&mut self) {
+        self.fb.fill(0);
+        self.damage(Rect::new(0, 0, SCREEN_WIDTH as u32, SCREEN_HEIGHT as u32));
+    }
+
+    /// Sets all the pixels of `rect` to `on`.
+    pub fn fill_rect(&mut self, rect: Rect, on: bool) {
+        let rect = rect.clip();
+        for y in rect.y..rect.y + rect.height {
+            for x in rect.x..rect.x + rect.width {
+                self.set_pixel(x, y, on);
+            }
+        }
+        self.damage(rect);
+    }
+
+    /// Draws a 1 bit per pixel `bitmap` (rows of `width` pixels, least
+    /// significant bit first) at (`x`, `y`). Pixels out of the screen are
+    /// clipped.
+    pub fn draw_bitmap(&mut self, x: u32, y: u32, width: u32, height: u32, bitmap: &[u8]) {
+        let rect = Rect::new(x, y, width, height).clip();
+        let height = height.min(((bitmap.len() * 8) as u32) / width.max(1));
+        for dy in 0..rect.height.min(height) {
+            for dx in 0..rect.width {
+                let i = (dy * width + dx) as usize;
+                self.set_pixel(x + dx, y + dy, bitmap[i / 8] & (1 << (i % 8)) != 0);
+            }
+        }
+        self.damage(rect);
+    }
+
+    /// Draws rows of up to 32 pixels, pixel `i` of a row being its bit `i`,
+    /// at (`x`, `y`): each row is merged into the framebuffer at once,
+    /// instead of pixel by pixel. Pixels out of the screen are clipped.
+    pub fn draw_rows(&mut self, x: u32, y: u32, width: u32, rows: &[u32]) {
+        if x >= SCREEN_WIDTH as u32 || width == 0 {
+            return;
+        }
+        let width = width.min(32);
+        let mask = (u32::MAX >> (32 - width)) as u128;
+        const ROW_LEN: usize = SCREEN_WIDTH / 8;
+        for (dy, &row) in rows.iter().enumerate() {
+            let line = y as usize + dy;
+            if line >= SCREEN_HEIGHT {
+                break;
+            }
+            let bytes = &mut self.fb[line * ROW_LEN..(line + 1) * ROW_LEN];
+            let mut pixels = [0u8; ROW_LEN];
+            pixels.copy_from_slice(bytes);
+            let pixels = (u128::from_le_bytes(pixels) & !(mask << x)) | ((row as u128 & mask) << x);
+            bytes.copy_from_slice(&pixels.to_le_bytes());
+        }
+        self.damage(Rect::new(x, y, width, rows.len() as u32));
+    }
+
+    /// Exchanges the pixels with those of `frame`, drawn offscreen, and
+    /// marks the whole screen as modified: the next update sends it with a
+    /// single bitmap.
+    pub fn swap_frame(&mut self, frame: &mut Compositor) {
+        core::mem::swap(&mut self.fb, &mut frame.fb);
+        self.damage(Rect::new(0, 0, SCREEN_WIDTH as u32, SCREEN_HEIGHT as u32));
+    }
+
+    /// Marks `rect` as modified, so it is sent to the screen on the next
+    /// update.
+    pub fn damage(&mut self, rect: Rect) {
+        let mut rect = rect.clip();
+        if rect.is_empty() {
+            return;
+        }
+        // Absorb all the regions touching the new one
+        let mut i = 0;
+        while i < self.damage_count {
+            if self.damage[i].touches(&rect) {
+                rect = rect.union(&self.damage[i]);
+                self.damage_count -= 1;
+                self.damage[i] = self.damage[self.damage_count];
+                i = 0;
+            } else {
+                i += 1;
+            }
+        }
+        if self.damage_count < MAX_DAMAGE_RECTS {
+            self.damage[self.damage_count] = rect;
+            self.damage_count += 1;
+        } else {
+            // Merge with the region growing the least
+            let growth = |r: &Rect| r.union(&rect).area() - r.area();
+            let best = (0..MAX_DAMAGE_RECTS)
+                .min_by_key(|&i| growth(&self.damage[i]))
+                .unwrap();
+            self.damage[best] = self.damage[best].union(&rect);
+        }
+    }
+
+    /// Sends the damaged regions to the screen and refreshes it.
+    pub fn update(&mut self) {
+        let mut strip = [0u8; STRIP_LEN];
+        for rect in &self.damage[..self.damage_count] {
+            // Whole rows are already laid out as the screen expects them
+            if rect.x == 0 && rect.width == SCREEN_WIDTH as u32 {
+                const ROW_LEN: usize = SCREEN_WIDTH / 8;
+                let rows = rect.y as usize * ROW_LEN..(rect.y + rect.height) as usize * ROW_LEN;
+                sdk_bagl_hal_draw_bitmap_within_rect(
+                    0,
+                    rect.y as i32,
+                    rect.width,
+                    rect.height,
+                    false,
+                    &self.fb[rows],
+                );
+                continue;
+            }
+            let rows_per_strip = (STRIP_LEN * 8) as u32 / rect.width;
+            let mut y = rect.y;
+            while y < rect.y + rect.height {
+                let rows = rows_per_strip.min(rect.y + rect.height - y);
+                strip.fill(0);
+                for dy in 0..rows {
+                    for dx in 0..rect.width {
+                        if self.pixel(rect.x + dx, y + dy) {
+                            let i = (dy * rect.width + dx) as usize;
+                            strip[i / 8] |= 1 << (i % 8);
+                        }
+                    }
+                }
+                let len = ((rows * rect.width) as usize).div_ceil(8);
+                sdk_bagl_hal_draw_bitmap_within_rect(
+                    rect.x as i32,
+                    y as i32,
+                    rect.width,
+                    rows,
+                    false,
+                    &strip[..len],
+                );
+                y += rows;
+            }
+        }
+        self.damage_count = 0;
+        sdk_screen_update();
+    }
+
+    /// Sends the damaged regions as [`update`](Compositor::update) does,
+    /// unless the previous frame is still being displayed: the regions are
+    /// then kept, along with the ones damaged meanwhile, and sent as a
+    /// single frame by a later call. Returns whether a frame was sent.
+    ///
+    /// The app does not wait for the MCU, and can go on with its work
+    /// (parsing the next field, hashing) as the frame is displayed, the
+    /// intermediate frames drawn meanwhile being coalesced. Call it again
+    /// after each event until [`has_pending`](Compositor::has_pending)
+    /// is false:
+    ///
+    /// ```
+    /// loop {
+    ///     let event = comm.next_event::<Ins>();
+    ///     screen.update_async();
+    ///     ...
+    /// }
+    /// ```
+    pub fn update_async(&mut self) -> bool {
+        if self.damage_count == 0 || display_busy() {
+            return false;
+        }
+        self.update();
+        unsafe {
+            DISPLAY_BUSY = true;
+            DISPLAY_SENT_AT = crate::timer::ticks();
+        }
+        true
+    }
+
+    /// Whether some damaged regions have not been sent to the screen yet
+    pub fn has_pending(&self) -> bool {
+        self.damage_count > 0
+    }
+}
+
+impl Default for Compositor {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Tallest glyph held by a [`GlyphCache`], whose glyphs are also at most
+/// 32 pixels wide
+pub const MAX_CACHED_GLYPH_HEIGHT: usize = 16;
+
+/// Glyph decoded into rows of pixels, as drawn by
+/// [`Compositor::draw_rows`], in a [`GlyphCache`]
+#[derive(Copy, Clone)]
+pub struct CachedGlyph {
+    /// Address of the source bitmap, 0 for a free slot
+    bitmap: usize,
+    width: u8,
+    height: u8,
+    rows: [u32; MAX_CACHED_GLYPH_HEIGHT],
+}
+
+impl CachedGlyph {
+    pub const EMPTY: CachedGlyph = CachedGlyph {
+        bitmap: 0,
+        width: 0,
+        height: 0,
+        rows: [0; MAX_CACHED_GLYPH_HEIGHT],
+    };
+}
+
+/// Glyphs drawn often, such as the navigation arrows, check marks and the
+/// characters of the labels, kept decoded into rows of pixels so that
+/// drawing them again merges whole rows into the framebuffer instead of
+/// extracting each pixel of their bitmap from Flash.
+///
+/// The slots are provided by the app, which can size them from the RAM
+/// actually free, each one taking `size_of::<CachedGlyph>()` bytes. When
+/// they are all used, the oldest glyph is replaced.
+///
+/// ```
+/// let len = memory::info().buffer_len(4096, 0, 1024) / size_of::<CachedGlyph>();
+/// ARENA.scope(|scope| {
+///     let mut glyphs = GlyphCache::new(scope.alloc_slice(len, CachedGlyph::EMPTY)?);
+///     glyphs.draw(&mut screen, 0, 28, 4, 7, &LEFT_ARROW);
+///     ...
+/// });
+/// ```
+pub struct GlyphCache<'a> {
+    slots: &'a mut [CachedGlyph],
+    /// Slot replaced on the next miss
+    next: usize,
+}
+
+impl<'a> GlyphCache<'a> {
+    pub fn new(slots: &'a mut [CachedGlyph]) -> Self {
+        slots.fill(CachedGlyph::EMPTY);
+        GlyphCache { slots, next: 0 }
+    }
+
+    /// Draws `bitmap`, as [`Compositor::draw_bitmap`] does, from the cache.
+    /// Glyphs too large for the cache are drawn directly.
+    pub fn draw(
+        &mut self,
+        screen: &mut Compositor,
+        x: u32,
+        y: u32,
+        width: u32,
+        height: u32,
+        bitmap: &[u8],
+    ) {
+        let height = height.min(((bitmap.len() * 8) as u32) / width.max(1));
+        if self.slots.is_empty()
+            || width == 0
+            || width > 32
+            || height as usize > MAX_CACHED_GLYPH_HEIGHT
+        {
+            screen.draw_bitmap(x, y, width, height, bitmap);
+            return;
+        }
+        let key = bitmap.as_ptr() as usize;
+        let found = self
+            .slots
+            .iter()
+            .position(|g| g.bitmap == key && g.width as u32 == width && g.height as u32 == height);
+        let slot = match found {
+            Some(slot) => slot,
+            None => {
+                let slot = self.next;
+                self.next = (self.next + 1) % self.slots.len();
+                let glyph = &mut self.slots[slot];
+                *glyph = CachedGlyph {
+                    bitmap: key,
+                    width: width as u8,
+                    height: height as u8,
+                    rows: [0; MAX_CACHED_GLYPH_HEIGHT],
+                };
+                for (dy, row) in glyph.rows[..height as usize].iter_mut().enumerate() {
+                    for dx in 0..width as usize {
+                        let i = dy * width as usize + dx;
+                        *row |= ((bitmap[i / 8] >> (i % 8)) as u32 & 1) << dx;
+                    }
+                }
+                slot
+            }
+        };
+        let glyph = &self.slots[slot];
+        screen.draw_rows(x, y, width, &glyph.rows[..height as usize]);
+    }
+}
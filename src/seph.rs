@@ -1,9 +1,12 @@
 #![allow(clippy::upper_case_acronyms)]
 
 use crate::bindings::*;
+use crate::svc::{io_seph_is_status_sent, io_seph_recv, io_seph_send};
+#[cfg(not(feature = "native_usb"))]
 use crate::usbbindings::*;
+use core::ptr::{addr_of, addr_of_mut};
 
-#[cfg(target_os = "nanox")]
+#[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
 use crate::ble;
 
 #[repr(u8)]
@@ -14,6 +17,7 @@ pub enum SephTags {
     Unknown,
 }
 #[repr(u8)]
+#[derive(Copy, Clone)]
 pub enum Events {
     USBXFEREvent = SEPROXYHAL_TAG_USB_EP_XFER_EVENT as u8,
     USBEvent = SEPROXYHAL_TAG_USB_EVENT as u8,
@@ -48,22 +52,31 @@ impl From<u8> for SephTags {
     }
 }
 
+/// Decoding table from a SEPH tag to [`Events`], generated at compile time so
+/// `Events::from` is a single lookup.
+static EVENTS: [Events; 256] = events_table();
+
+const fn events_table() -> [Events; 256] {
+    let mut table = [Events::Unknown; 256];
+    // Listed in reverse priority order: USB event codes share values with
+    // some unrelated tags, and the first entry of the original list wins.
+    table[SEPROXYHAL_TAG_BLE_RECV_EVENT as usize] = Events::BleReceive;
+    table[SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT as usize] = Events::DisplayProcessed;
+    table[SEPROXYHAL_TAG_BUTTON_PUSH_EVENT as usize] = Events::ButtonPush;
+    table[SEPROXYHAL_TAG_TICKER_EVENT as usize] = Events::TickerEvent;
+    table[SEPROXYHAL_TAG_CAPDU_EVENT as usize] = Events::CAPDUEvent;
+    table[SEPROXYHAL_TAG_USB_EVENT_RESUMED as usize] = Events::USBEventResume;
+    table[SEPROXYHAL_TAG_USB_EVENT_SUSPENDED as usize] = Events::USBEventSuspend;
+    table[SEPROXYHAL_TAG_USB_EVENT_SOF as usize] = Events::USBEventSOF;
+    table[SEPROXYHAL_TAG_USB_EVENT_RESET as usize] = Events::USBEventReset;
+    table[SEPROXYHAL_TAG_USB_EVENT as usize] = Events::USBEvent;
+    table[SEPROXYHAL_TAG_USB_EP_XFER_EVENT as usize] = Events::USBXFEREvent;
+    table
+}
+
 impl From<u8> for Events {
     fn from(v: u8) -> Events {
-        match v as u32 {
-            SEPROXYHAL_TAG_USB_EP_XFER_EVENT => Events::USBXFEREvent,
-            SEPROXYHAL_TAG_USB_EVENT => Events::USBEvent,
-            SEPROXYHAL_TAG_USB_EVENT_RESET => Events::USBEventReset,
-            SEPROXYHAL_TAG_USB_EVENT_SOF => Events::USBEventSOF,
-            SEPROXYHAL_TAG_USB_EVENT_SUSPENDED => Events::USBEventSuspend,
-            SEPROXYHAL_TAG_USB_EVENT_RESUMED => Events::USBEventResume,
-            SEPROXYHAL_TAG_CAPDU_EVENT => Events::CAPDUEvent,
-            SEPROXYHAL_TAG_TICKER_EVENT => Events::TickerEvent,
-            SEPROXYHAL_TAG_BUTTON_PUSH_EVENT => Events::ButtonPush,
-            SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT => Events::DisplayProcessed,
-            SEPROXYHAL_TAG_BLE_RECV_EVENT => Events::BleReceive,
-            _ => Events::Unknown,
-        }
+        EVENTS[v as usize]
     }
 }
 
@@ -80,16 +93,25 @@ impl From<u8> for UsbEp {
     }
 }
 
+/// Size of the buffer SEPH messages are received into. Larger payloads
+/// (raw APDUs) are read from the IO cache straight into the APDU buffer.
+pub const SEPH_BUFFER_SIZE: usize = 128;
+
 /// Wrapper for 'io_seph_send'
 /// Directly send buffer over the SPI channel to the MCU
 pub fn seph_send(buffer: &[u8]) {
+    #[cfg(feature = "seph_capture")]
+    crate::seph_capture::record(true, buffer);
     unsafe { io_seph_send(buffer.as_ptr(), buffer.len() as u16) };
 }
 
 /// Wrapper for 'io_seph_recv'
 /// Receive the next APDU into 'buffer'
 pub fn seph_recv(buffer: &mut [u8], flags: u32) -> u16 {
-    unsafe { io_seph_recv(buffer.as_mut_ptr(), buffer.len() as u16, flags) }
+    let len = unsafe { io_seph_recv(buffer.as_mut_ptr(), buffer.len() as u16, flags) };
+    #[cfg(feature = "seph_capture")]
+    crate::seph_capture::record(false, &buffer[..(len as usize).min(buffer.len())]);
+    len
 }
 
 /// Wrapper for 'io_seph_is_status_sent'
@@ -106,6 +128,7 @@ pub fn send_general_status() {
     //     return;
     //   }
     if !is_status_sent() {
+        crate::timer::send_ticker_interval();
         // The two last bytes are supposed to be
         // SEPROXYHAL_TAG_GENERAL_STATUS_LAST_COMMAND, which is 0u16
         let status = [SephTags::GeneralStatus as u8, 0, 2, 0, 0];
@@ -113,6 +136,9 @@ pub fn send_general_status() {
     }
 }
 
+#[cfg(feature = "native_usb")]
+pub use crate::usbd::{handle_usb_ep_xfer_event, handle_usb_event};
+
 /// FFI bindings to USBD functions inlined here for clarity
 /// and also because some of the generated ones are incorrectly
 /// assuming mutable pointers when they are not
@@ -128,6 +154,7 @@ impl Default for apdu_buffer_s {
     }
 }
 pub type ApduBufferT = apdu_buffer_s;
+#[cfg(not(feature = "native_usb"))]
 extern "C" {
     pub static mut USBD_Device: USBD_HandleTypeDef;
     pub fn USBD_LL_SetupStage(
@@ -152,17 +179,24 @@ extern "C" {
     ) -> USBD_StatusTypeDef;
     pub fn USBD_LL_Suspend(pdev: *mut USBD_HandleTypeDef) -> USBD_StatusTypeDef;
     pub fn USBD_LL_Resume(pdev: *mut USBD_HandleTypeDef) -> USBD_StatusTypeDef;
-    pub fn USBD_LL_SOF(pdev: *mut USBD_HandleTypeDef) -> USBD_StatusTypeDef;
+    pub fn USBD_LL_PrepareReceive(
+        pdev: *mut USBD_HandleTypeDef,
+        ep_addr: u8,
+        size: u16,
+    ) -> USBD_StatusTypeDef;
 }
 
 /// Below is a straightforward translation of the corresponding functions
 /// in the C SDK, they could be improved
+#[cfg(not(feature = "native_usb"))]
 pub fn handle_usb_event(event: u8) {
     match Events::from(event) {
         Events::USBEventReset => {
             unsafe {
-                USBD_LL_SetSpeed(&mut USBD_Device, 1 /*USBD_SPEED_FULL*/);
-                USBD_LL_Reset(&mut USBD_Device);
+                USBD_LL_SetSpeed(&mut *addr_of_mut!(USBD_Device), 1 /*USBD_SPEED_FULL*/);
+                USBD_LL_Reset(&mut *addr_of_mut!(USBD_Device));
+                #[cfg(feature = "hid_keyboard")]
+                crate::keyboard::abort();
 
                 if G_io_app.apdu_media != IO_APDU_MEDIA_NONE {
                     return;
@@ -172,30 +206,37 @@ pub fn handle_usb_event(event: u8) {
                 G_io_app.usb_ep_timeouts = core::mem::zeroed();
             }
         }
-        Events::USBEventSOF => unsafe {
-            USBD_LL_SOF(&mut USBD_Device);
-        },
         Events::USBEventSuspend => unsafe {
-            USBD_LL_Suspend(&mut USBD_Device);
+            USBD_LL_Suspend(&mut *addr_of_mut!(USBD_Device));
         },
         Events::USBEventResume => unsafe {
-            USBD_LL_Resume(&mut USBD_Device);
+            USBD_LL_Resume(&mut *addr_of_mut!(USBD_Device));
         },
         _ => (),
     }
 }
 
+#[cfg(not(feature = "native_usb"))]
+#[optimize(speed)]
 pub fn handle_usb_ep_xfer_event(apdu_buffer: &mut [u8], buffer: &[u8]) {
     let endpoint = buffer[3] & 0x7f;
     match UsbEp::from(buffer[4]) {
         UsbEp::USBEpXFERSetup => unsafe {
-            USBD_LL_SetupStage(&mut USBD_Device, &buffer[6]);
+            USBD_LL_SetupStage(&mut *addr_of_mut!(USBD_Device), &buffer[6]);
         },
         UsbEp::USBEpXFERIn => {
             if (endpoint as u32) < IO_USB_MAX_ENDPOINTS {
                 unsafe {
                     G_io_app.usb_ep_timeouts[endpoint as usize].timeout = 0;
-                    USBD_LL_DataInStage(&mut USBD_Device, endpoint, &buffer[6]);
+                }
+                // Keyboard reports are streamed from Rust, one in flight
+                #[cfg(feature = "hid_keyboard")]
+                if endpoint == crate::keyboard::EPIN_ADDR & 0x7f {
+                    crate::keyboard::sent();
+                    return;
+                }
+                unsafe {
+                    USBD_LL_DataInStage(&mut *addr_of_mut!(USBD_Device), endpoint, &buffer[6]);
                 }
             }
         }
@@ -203,11 +244,25 @@ pub fn handle_usb_ep_xfer_event(apdu_buffer: &mut [u8], buffer: &[u8]) {
             if (endpoint as u32) < IO_USB_MAX_ENDPOINTS {
                 unsafe {
                     G_io_app.usb_ep_xfer_len[endpoint as usize] = buffer[5];
+                }
+                // FIDO reports are reassembled in Rust, into the APDU buffer
+                #[cfg(feature = "u2f")]
+                if endpoint == crate::u2f::EPOUT_ADDR {
+                    let len = (buffer[5] as usize).min(buffer.len() - 6);
+                    crate::u2f::receive(apdu_buffer, &buffer[6..6 + len]);
+                    return;
+                }
+                unsafe {
                     let mut apdu_buf = ApduBufferT {
                         buf: apdu_buffer.as_mut_ptr(),
-                        len: 260,
+                        len: apdu_buffer.len() as u16,
                     };
-                    USBD_LL_DataOutStage(&mut USBD_Device, endpoint, &buffer[6], &mut apdu_buf);
+                    USBD_LL_DataOutStage(
+                        &mut *addr_of_mut!(USBD_Device),
+                        endpoint,
+                        &buffer[6],
+                        &mut apdu_buf,
+                    );
                 }
             }
         }
@@ -215,40 +270,255 @@ pub fn handle_usb_ep_xfer_event(apdu_buffer: &mut [u8], buffer: &[u8]) {
     }
 }
 
+/// Raw APDU event, from speculos. An APDU longer than `buffer` holds is
+/// received again as a whole from the cache of the OS, straight into
+/// `apdu_buffer`, so that it arrives in one exchange up to the size of
+/// `apdu_buffer`.
+#[optimize(speed)]
 pub fn handle_capdu_event(apdu_buffer: &mut [u8], buffer: &[u8]) {
-    let mut io_app = unsafe { &mut G_io_app };
+    let io_app = unsafe { &mut *addr_of_mut!(G_io_app) };
     if io_app.apdu_state == APDU_IDLE {
-        let max = (apdu_buffer.len() - 3).min(buffer.len() - 3);
         let size = u16::from_be_bytes([buffer[1], buffer[2]]) as usize;
 
         io_app.apdu_media = IO_APDU_MEDIA_RAW;
         io_app.apdu_state = APDU_RAW;
 
-        let len = size.min(max);
+        let len = if size + 3 <= buffer.len() {
+            let len = size.min(apdu_buffer.len() - 3);
+            apdu_buffer[..len].copy_from_slice(&buffer[3..len + 3]);
+            len
+        } else {
+            // No APDU is being received from another transport in the idle
+            // state: the APDU buffer can hold the whole event
+            let received = seph_recv(apdu_buffer, IO_CACHE) as usize;
+            let len = size.min(received.saturating_sub(3));
+            apdu_buffer.copy_within(3..len + 3, 0);
+            len
+        };
 
         io_app.apdu_length = len as u16;
+    }
+}
+
+/// Handler of a SEPH event, called with the received message in
+/// `spi_buffer`. Returns `true` when the event must be reported to the caller
+/// of the receive loop: it is of interest to the application, or an APDU may
+/// have been received into `apdu_buffer`.
+pub type EventHandler = fn(apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool;
 
-        apdu_buffer[..len].copy_from_slice(&buffer[3..len + 3]);
+fn on_usb_event(_apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool {
+    let len = u16::from_be_bytes([spi_buffer[1], spi_buffer[2]]);
+    // The MCU cannot be told not to send start of frame events, but no USB
+    // class has a SOF callback: they are only acknowledged
+    if len == 1 && spi_buffer[3] as u32 != SEPROXYHAL_TAG_USB_EVENT_SOF {
+        handle_usb_event(spi_buffer[3]);
     }
+    false
 }
 
-pub fn handle_event(apdu_buffer: &mut [u8], spi_buffer: &[u8]) {
+fn on_usb_ep_xfer_event(apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool {
     let len = u16::from_be_bytes([spi_buffer[1], spi_buffer[2]]);
-    match Events::from(spi_buffer[0]) {
-        Events::USBEvent => {
-            if len == 1 {
-                handle_usb_event(spi_buffer[3]);
+    if len < 3 {
+        return false;
+    }
+    handle_usb_ep_xfer_event(apdu_buffer, spi_buffer);
+    // Only OUT transfers may complete an APDU
+    matches!(UsbEp::from(spi_buffer[4]), UsbEp::USBEpXFEROut)
+}
+
+fn on_capdu_event(apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool {
+    handle_capdu_event(apdu_buffer, spi_buffer);
+    true
+}
+
+#[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
+fn on_ble_receive(apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool {
+    ble::receive(apdu_buffer, spi_buffer);
+    true
+}
+
+/// Events handled by the application itself (buttons)
+fn report(_apdu_buffer: &mut [u8], _spi_buffer: &[u8]) -> bool {
+    true
+}
+
+extern "C" {
+    fn io_usb_hid_init();
+}
+
+/// Count down the timeouts of the USB IN transfers, armed when a packet is
+/// prepared and cleared when the host reads it, by `elapsed_ms`. A
+/// response whose packets the host stops reading is dropped once one of
+/// them expires, so that the next command can be received.
+fn expire_ep_timeouts(elapsed_ms: u32) {
+    let mut expired = 0u32;
+    for ep in 0..IO_USB_MAX_ENDPOINTS as usize {
+        let timeout = unsafe { &mut G_io_app.usb_ep_timeouts[ep].timeout };
+        if *timeout != 0 {
+            *timeout = (*timeout as u32).saturating_sub(elapsed_ms) as u16;
+            if *timeout == 0 {
+                expired |= 1 << ep;
             }
         }
-        Events::USBXFEREvent => {
-            if len >= 3 {
-                handle_usb_ep_xfer_event(apdu_buffer, spi_buffer);
-            }
+    }
+    #[cfg(feature = "u2f")]
+    {
+        let u2f_ep = 1 << (crate::u2f::EPIN_ADDR & 0x7f);
+        if expired & u2f_ep != 0 {
+            crate::u2f::abort_send();
+            expired &= !u2f_ep;
         }
-        #[cfg(target_os = "nanox")]
-        Events::BleReceive => ble::receive(apdu_buffer, spi_buffer),
-        Events::CAPDUEvent => handle_capdu_event(apdu_buffer, spi_buffer),
-        Events::TickerEvent => { /* unsafe{ G_io_app.ms += 100; } */ }
-        _ => (),
     }
+    #[cfg(feature = "hid_keyboard")]
+    {
+        let keyboard_ep = 1 << (crate::keyboard::EPIN_ADDR & 0x7f);
+        if expired & keyboard_ep != 0 {
+            crate::keyboard::abort();
+            expired &= !keyboard_ep;
+        }
+    }
+    // HID and WebUSB responses share the framing of the C stack
+    if expired != 0 {
+        unsafe { io_usb_hid_init() };
+    }
+}
+
+/// Ticker events advance the SDK time, and are reported to the application
+fn on_ticker(_apdu_buffer: &mut [u8], _spi_buffer: &[u8]) -> bool {
+    crate::timer::on_tick();
+    expire_ep_timeouts(crate::timer::tick_interval_ms());
+    #[cfg(feature = "u2f")]
+    crate::u2f::on_ticker();
+    true
+}
+
+/// Status changes of the MCU may come with changes of the OS settings
+fn on_status(_apdu_buffer: &mut [u8], _spi_buffer: &[u8]) -> bool {
+    crate::settings::invalidate();
+    false
+}
+
+/// Frames sent by `Compositor::update_async` are displayed
+fn on_display_processed(_apdu_buffer: &mut [u8], _spi_buffer: &[u8]) -> bool {
+    crate::screen::on_display_processed();
+    false
+}
+
+/// Default handler of each SEPH tag, generated at compile time.
+/// Tags without a handler are acknowledged and otherwise ignored.
+static HANDLERS: [Option<EventHandler>; 256] = default_handlers();
+
+const fn default_handlers() -> [Option<EventHandler>; 256] {
+    let mut table: [Option<EventHandler>; 256] = [None; 256];
+    table[SEPROXYHAL_TAG_USB_EVENT as usize] = Some(on_usb_event);
+    table[SEPROXYHAL_TAG_USB_EP_XFER_EVENT as usize] = Some(on_usb_ep_xfer_event);
+    table[SEPROXYHAL_TAG_CAPDU_EVENT as usize] = Some(on_capdu_event);
+    #[cfg(all(target_os = "nanox", not(feature = "no_ble")))]
+    {
+        table[SEPROXYHAL_TAG_BLE_RECV_EVENT as usize] = Some(on_ble_receive);
+    }
+    table[SEPROXYHAL_TAG_BUTTON_PUSH_EVENT as usize] = Some(report);
+    table[SEPROXYHAL_TAG_TICKER_EVENT as usize] = Some(on_ticker);
+    table[SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT as usize] = Some(on_display_processed);
+    table[SEPROXYHAL_TAG_STATUS_EVENT as usize] = Some(on_status);
+    table
+}
+
+/// Number of handlers the application can register with [`register_handler`]
+pub const APP_HANDLER_SLOTS: usize = 4;
+
+// Kept in RAM (.bss) as handlers are registered at runtime: their addresses
+// are already the relocated ones, unlike the ones of the `HANDLERS` table.
+static mut APP_HANDLERS: [(u8, Option<EventHandler>); APP_HANDLER_SLOTS] =
+    [(0, None); APP_HANDLER_SLOTS];
+
+/// Returned when all [`APP_HANDLER_SLOTS`] are already in use
+pub struct HandlerSlotsFull;
+
+/// Register `handler` for SEPH messages with the given `tag`, taking
+/// precedence over the SDK default handler. Registering a tag twice replaces
+/// the previous handler.
+pub fn register_handler(tag: u8, handler: EventHandler) -> Result<(), HandlerSlotsFull> {
+    let slots = unsafe { &mut *addr_of_mut!(APP_HANDLERS) };
+    let slot = match slots.iter().position(|(t, h)| *t == tag && h.is_some()) {
+        Some(i) => i,
+        None => slots
+            .iter()
+            .position(|(_, h)| h.is_none())
+            .ok_or(HandlerSlotsFull)?,
+    };
+    slots[slot] = (tag, Some(handler));
+    Ok(())
+}
+
+/// Remove the application handler registered for `tag`, restoring the SDK
+/// default behaviour.
+pub fn unregister_handler(tag: u8) {
+    for slot in unsafe { (*addr_of_mut!(APP_HANDLERS)).iter_mut() } {
+        if slot.0 == tag {
+            *slot = (0, None);
+        }
+    }
+}
+
+/// Route the SEPH message held in `spi_buffer` to its handler.
+/// Returns `true` if the event must be reported to the caller (see
+/// [`EventHandler`]).
+#[optimize(speed)]
+pub fn dispatch(apdu_buffer: &mut [u8], spi_buffer: &[u8]) -> bool {
+    let tag = spi_buffer[0];
+    for (t, handler) in unsafe { (*addr_of!(APP_HANDLERS)).iter() } {
+        if let (true, Some(handler)) = (*t == tag, handler) {
+            return handler(apdu_buffer, spi_buffer);
+        }
+    }
+    match HANDLERS[tag as usize] {
+        Some(handler) => {
+            // Function pointers stored in the code are link addresses
+            let handler: EventHandler =
+                unsafe { core::mem::transmute(crate::pic(handler as *mut core::ffi::c_void)) };
+            handler(apdu_buffer, spi_buffer)
+        }
+        None => false,
+    }
+}
+
+/// Receive SEPH events into `spi_buffer` until one must be reported to the
+/// application, and return its type. The message itself is left in
+/// `spi_buffer`.
+///
+/// Events which can neither be reported to the application nor complete the
+/// reception of an APDU (USB control traffic, SOF, IN transfers, display
+/// processed...) are dispatched and acknowledged in this tight loop, reusing
+/// the same buffer, instead of going back through the caller's loop.
+///
+/// The jobs of [`crate::idle`] run while waiting, except between the frames
+/// of a command.
+#[optimize(speed)]
+pub fn next_app_event(apdu_buffer: &mut [u8], spi_buffer: &mut [u8]) -> Events {
+    let mut receiving = false;
+    loop {
+        if !is_status_sent() {
+            send_general_status();
+        }
+        if !receiving {
+            crate::idle::run_one();
+        }
+        seph_recv(spi_buffer, 0);
+        receiving = matches!(
+            spi_buffer[0] as u32,
+            SEPROXYHAL_TAG_USB_EP_XFER_EVENT
+                | SEPROXYHAL_TAG_BLE_RECV_EVENT
+                | SEPROXYHAL_TAG_CAPDU_EVENT
+        );
+        if dispatch(apdu_buffer, spi_buffer) {
+            return Events::from(spi_buffer[0]);
+        }
+    }
+}
+
+/// Handle a SEPH event received while the application is not waiting for
+/// one, for instance while a response is being transmitted.
+pub fn handle_event(apdu_buffer: &mut [u8], spi_buffer: &[u8]) {
+    dispatch(apdu_buffer, spi_buffer);
 }
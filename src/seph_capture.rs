@@ -0,0 +1,216 @@
+//! Capture of the SEPH traffic, enabled by the `seph_capture` feature
+//!
+//! Every packet received with [`seph_recv`](crate::seph::seph_recv) and
+//! sent with [`seph_send`](crate::seph::seph_send) is recorded with its tick
+//! count in a RAM ring of [`CAPTURE_SIZE`] bytes, the oldest records being
+//! dropped to make room for new ones. Packets the C USB stack sends by
+//! itself are not seen.
+//!
+//! [`dump`] prints the capture with semihosting, and [`drain`] serializes it
+//! so that an app can return it from a debug APDU of its own. On the host
+//! backend, [`crate::host::replay`] feeds the received packets of such a
+//! capture back to the SDK, so that changes to the transports are measured
+//! on the same traffic:
+//!
+//! ```
+//! static TRACE: &[u8] = include_bytes!("hid_pipelined.seph");
+//! host::replay(TRACE);
+//! bench("sign over HID", 1, || sign_loop(&mut comm));
+//! ```
+
+use crate::testing::{ticks, to_dec, DebugWriter};
+
+/// Size of the ring, in bytes
+pub const CAPTURE_SIZE: usize = 2048;
+
+/// Tick count (big endian u32), then the packet length (big endian u16)
+/// with the top bit set for sent packets
+const HEADER_LEN: usize = 6;
+
+/// Longest packet recorded, longer ones being truncated
+const MAX_PACKET_LEN: usize = CAPTURE_SIZE - HEADER_LEN;
+
+struct Ring {
+    buf: [u8; CAPTURE_SIZE],
+    /// Offset of the oldest record, and bytes used
+    first: usize,
+    len: usize,
+}
+
+static mut RING: Ring = Ring {
+    buf: [0; CAPTURE_SIZE],
+    first: 0,
+    len: 0,
+};
+
+fn ring() -> &'static mut Ring {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(RING) }
+}
+
+impl Ring {
+    fn byte(&self, offset: usize) -> u8 {
+        self.buf[(self.first + offset) % CAPTURE_SIZE]
+    }
+
+    /// Length of the oldest record, header included
+    fn first_len(&self) -> usize {
+        let len = u16::from_be_bytes([self.byte(4), self.byte(5)]) & 0x7fff;
+        HEADER_LEN + len as usize
+    }
+
+    fn drop_first(&mut self) {
+        let n = self.first_len();
+        self.first = (self.first + n) % CAPTURE_SIZE;
+        self.len -= n;
+    }
+
+    fn push(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.buf[(self.first + self.len) % CAPTURE_SIZE] = b;
+            self.len += 1;
+        }
+    }
+}
+
+/// Record `packet`, received from the MCU or `sent` to it
+pub(crate) fn record(sent: bool, packet: &[u8]) {
+    let ticks = ticks() as u32;
+    let packet = &packet[..packet.len().min(MAX_PACKET_LEN)];
+    let ring = ring();
+    while CAPTURE_SIZE - ring.len < HEADER_LEN + packet.len() {
+        ring.drop_first();
+    }
+    ring.push(&ticks.to_be_bytes());
+    ring.push(&(packet.len() as u16 | (sent as u16) << 15).to_be_bytes());
+    ring.push(packet);
+}
+
+/// Number of bytes captured, as [`drain`] would write them
+pub fn len() -> usize {
+    ring().len
+}
+
+/// Drop the whole capture
+pub fn clear() {
+    let ring = ring();
+    ring.first = 0;
+    ring.len = 0;
+}
+
+/// Print the capture, oldest first, one packet per line: `<` for the
+/// packets received and `>` for those sent, the tick count and the packet
+/// in hex
+pub fn dump() {
+    let ring = ring();
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    let mut offset = 0;
+    while offset < ring.len {
+        let header: [u8; HEADER_LEN] = core::array::from_fn(|i| ring.byte(offset + i));
+        let len = u16::from_be_bytes([header[4], header[5]]);
+        w.write(if len & 0x8000 != 0 { "> " } else { "< " });
+        w.write(to_dec(
+            u32::from_be_bytes([header[0], header[1], header[2], header[3]]),
+            &mut buf,
+        ));
+        w.write(" ");
+        for i in 0..(len & 0x7fff) as usize {
+            let mut hex = [0u8; 2];
+            // Cannot fail, the buffer holding the 2 digits
+            let _ = crate::encoding::hex_encode(&[ring.byte(offset + HEADER_LEN + i)], &mut hex);
+            w.write(core::str::from_utf8(&hex).unwrap_or(""));
+        }
+        w.write("\n");
+        offset += HEADER_LEN + (len & 0x7fff) as usize;
+    }
+}
+
+/// Move the oldest records into `out`, as many as fit whole, returning the
+/// number of bytes written. Each record is serialized as its tick count
+/// (big endian u32), the length of the packet (big endian u16) with the top
+/// bit set for the packets sent, and the packet.
+pub fn drain(out: &mut [u8]) -> usize {
+    let ring = ring();
+    let mut pos = 0;
+    while ring.len > 0 {
+        let n = ring.first_len();
+        if pos + n > out.len() {
+            break;
+        }
+        for (i, b) in out[pos..pos + n].iter_mut().enumerate() {
+            *b = ring.byte(i);
+        }
+        ring.drop_first();
+        pos += n;
+    }
+    pos
+}
+
+/// Packet of a capture
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub struct Record<'a> {
+    pub ticks: u32,
+    /// Sent to the MCU, rather than received from it
+    pub sent: bool,
+    pub packet: &'a [u8],
+}
+
+impl Record<'_> {
+    /// Length of the record, as serialized
+    pub fn serialized_len(&self) -> usize {
+        HEADER_LEN + self.packet.len()
+    }
+}
+
+/// Records of a capture serialized by [`drain`], stopping at the first
+/// truncated one
+pub fn records(capture: &[u8]) -> impl Iterator<Item = Record<'_>> {
+    let mut rest = capture;
+    core::iter::from_fn(move || {
+        let header = rest.get(..HEADER_LEN)?;
+        let len = u16::from_be_bytes([header[4], header[5]]);
+        let packet = rest.get(HEADER_LEN..HEADER_LEN + (len & 0x7fff) as usize)?;
+        rest = &rest[HEADER_LEN + packet.len()..];
+        Some(Record {
+            ticks: u32::from_be_bytes([header[0], header[1], header[2], header[3]]),
+            sent: len & 0x8000 != 0,
+            packet,
+        })
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn ring_buffer() {
+        clear();
+        record(false, &[0x01, 0x02]);
+        record(true, &[0x03]);
+        assert_eq!(len(), 2 * HEADER_LEN + 3);
+        // Filling the ring drops the oldest records, whole: only the first
+        // one here
+        let big = [0xaa; CAPTURE_SIZE / 2];
+        record(false, &big);
+        record(true, &big[..1000]);
+        let kept = HEADER_LEN + 1 + 2 * HEADER_LEN + big.len() + 1000;
+        assert_eq!(len(), kept);
+
+        let mut out = [0u8; CAPTURE_SIZE];
+        // Only whole records are drained
+        assert_eq!(drain(&mut out[..HEADER_LEN]), 0);
+        let n = drain(&mut out);
+        assert_eq!((n, len()), (kept, 0));
+        let mut records = records(&out[..n]);
+        let first = records.next().ok_or(())?;
+        assert_eq!((first.sent, first.packet), (true, &[0x03][..]));
+        assert_eq!(records.next().map(|r| r.packet.len()), Some(big.len()));
+        assert_eq!(records.next().map(|r| r.sent), Some(true));
+        assert_eq!(records.next().is_none(), true);
+    }
+}
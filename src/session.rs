@@ -0,0 +1,132 @@
+//! Session state kept in NVM across app switches
+//!
+//! Opening another app from the dashboard ends the app, and starting it
+//! again loses all that was cached or negotiated in RAM. A [`Snapshot`]
+//! keeps a copy of such state in NVM, saved when the app exits and
+//! restored once when it starts again:
+//!
+//! ```
+//! #[link_section = ".nvm_data"]
+//! static mut SESSION: NVMData<Snapshot<State>> = NVMData::new(Snapshot::new(State::EMPTY));
+//!
+//! fn save_session() {
+//!     unsafe { (*addr_of_mut!(SESSION)).get_mut().save(&state()) };
+//! }
+//!
+//! let session = unsafe { (*addr_of_mut!(SESSION)).get_mut() };
+//! if let Some(state) = session.restore() {
+//!     resume(state);
+//! }
+//! session::on_exit(save_session);
+//! ```
+//!
+//! [`crate::exit_app`] calls the hook registered with [`on_exit`] before
+//! leaving. An app stopped otherwise (power loss, unplugged device, crash)
+//! leaves no snapshot, and the one saved before is not restored twice, so
+//! that a stale session is never resumed.
+//!
+//! The snapshot is in clear in Flash: it must only hold state which is not
+//! secret, such as metadata caches, settings negotiated with the host or
+//! the progress of a flow. USB enumeration and the BLE setup of the MCU
+//! are done by the host and the OS on each start, and cannot be skipped.
+
+use crate::nvm::{CrcStorage, SingleStorage};
+
+/// States of a record which holds a session to restore and which does not
+const SAVED: u32 = 0x5e55_0001;
+const RESTORED: u32 = 0x5e55_0000;
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+struct Record<T> {
+    state: u32,
+    value: T,
+}
+
+/// Copy of `T` saved in NVM, checked with a CRC
+pub struct Snapshot<T: Copy> {
+    record: CrcStorage<Record<T>>,
+}
+
+impl<T: Copy> Snapshot<T> {
+    /// Snapshot holding nothing to restore, `value` filling its space
+    pub const fn new(value: T) -> Self {
+        Snapshot {
+            record: CrcStorage::new(Record {
+                state: RESTORED,
+                value,
+            }),
+        }
+    }
+
+    /// Save `value`, to be restored on the next start
+    pub fn save(&mut self, value: &T) {
+        self.record.update(&Record {
+            state: SAVED,
+            value: *value,
+        });
+    }
+
+    /// Session saved by the last run of the app, if it exited with a
+    /// snapshot and it is not corrupted. It is then marked restored.
+    pub fn restore(&mut self) -> Option<T> {
+        if !self.record.is_valid() {
+            return None;
+        }
+        let record = *self.record.get_ref();
+        if record.state != SAVED {
+            return None;
+        }
+        self.record.update(&Record {
+            state: RESTORED,
+            ..record
+        });
+        Some(record.value)
+    }
+}
+
+static mut ON_EXIT: Option<fn()> = None;
+
+/// Call `hook`, which saves the session, when the app exits with
+/// [`crate::exit_app`]. Replaces the previous hook.
+pub fn on_exit(hook: fn()) {
+    // Apps are single-threaded
+    unsafe { *core::ptr::addr_of_mut!(ON_EXIT) = Some(hook) };
+}
+
+/// Run the hook registered with [`on_exit`], once
+pub(crate) fn exit() {
+    if let Some(hook) = unsafe { (*core::ptr::addr_of_mut!(ON_EXIT)).take() } {
+        hook();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use crate::NVMData;
+    use testmacro::test_item as test;
+
+    #[link_section = ".nvm_data"]
+    static mut SESSION: NVMData<Snapshot<[u16; 3]>> = NVMData::new(Snapshot::new([0; 3]));
+
+    fn session() -> &'static mut Snapshot<[u16; 3]> {
+        unsafe { (*core::ptr::addr_of_mut!(SESSION)).get_mut() }
+    }
+
+    fn save_session() {
+        session().save(&[0x8001, 64, 7]);
+    }
+
+    #[test]
+    fn restored_once() {
+        assert_eq!(session().restore(), None);
+        on_exit(save_session);
+        exit();
+        exit();
+        assert_eq!(session().restore(), Some([0x8001, 64, 7]));
+        assert_eq!(session().restore(), None);
+    }
+}
@@ -0,0 +1,102 @@
+//! OS settings, read once and kept in RAM
+//!
+//! Each `os_setting_get` is a syscall. The integer settings (brightness,
+//! rotation, lock delays, plane mode...) are read on first use and then
+//! served from a RAM cache, so that they can be checked on hot paths:
+//!
+//! ```
+//! if settings::plane_mode() {
+//!     return Err(Reply(0x6985));
+//! }
+//! ```
+//!
+//! The settings are changed by the dashboard rather than while an app
+//! runs, but the cache is dropped on the status events of the MCU, which
+//! report power and connection changes, and apps can drop it themselves
+//! with [`invalidate`].
+
+use crate::bindings::{
+    os_setting_get, OS_SETTING_AUTO_LOCK_DELAY, OS_SETTING_LAST_INT, OS_SETTING_PLANEMODE,
+    OS_SETTING_ROTATION,
+};
+
+const INT_SETTINGS: usize = OS_SETTING_LAST_INT as usize;
+
+struct Cache {
+    values: [u32; INT_SETTINGS],
+    /// Bit `i` set once setting `i` has been read
+    loaded: u16,
+}
+
+static mut CACHE: Cache = Cache {
+    values: [0; INT_SETTINGS],
+    loaded: 0,
+};
+
+fn cache() -> &'static mut Cache {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(CACHE) }
+}
+
+/// Value of the integer setting `id`, such as `OS_SETTING_BRIGHTNESS`.
+/// Other settings, which are strings, are not cached and read 0.
+pub fn get(id: u8) -> u32 {
+    let i = id as usize;
+    if i >= INT_SETTINGS {
+        return 0;
+    }
+    let cache = cache();
+    if cache.loaded & (1 << i) == 0 {
+        cache.values[i] = unsafe { os_setting_get(id as u32, core::ptr::null_mut(), 0) };
+        cache.loaded |= 1 << i;
+    }
+    cache.values[i]
+}
+
+/// Whether plane mode is on, keeping the radios off
+pub fn plane_mode() -> bool {
+    get(OS_SETTING_PLANEMODE) != 0
+}
+
+/// Rotation of the screen
+pub fn rotation() -> u32 {
+    get(OS_SETTING_ROTATION)
+}
+
+/// Auto-lock delay set in the dashboard, 0 if the device never locks
+/// itself
+pub fn auto_lock_delay() -> u32 {
+    get(OS_SETTING_AUTO_LOCK_DELAY)
+}
+
+/// Read the settings from the OS again on their next use
+pub fn invalidate() {
+    cache().loaded = 0;
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn cached_until_invalidated() {
+        invalidate();
+        let rotation = rotation();
+        assert_eq!(get(OS_SETTING_ROTATION), rotation);
+        assert_eq!(get(OS_SETTING_LAST_INT), 0);
+        // The host backend lets settings change behind the cache
+        #[cfg(feature = "host")]
+        {
+            crate::host::set_setting(OS_SETTING_PLANEMODE, 1);
+            invalidate();
+            assert_eq!(plane_mode(), true);
+            crate::host::set_setting(OS_SETTING_PLANEMODE, 0);
+            assert_eq!(plane_mode(), true);
+            invalidate();
+            assert_eq!(plane_mode(), false);
+        }
+    }
+}
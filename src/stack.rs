@@ -0,0 +1,93 @@
+//! Stack usage measurement, enabled by the `stack_usage` feature
+//!
+//! At boot, the stack below the entry frame is painted with a known
+//! pattern, down to the `app_stack_canary` word reserved by link.ld.
+//! [`stack_high_water`] then looks for the deepest word which was
+//! overwritten, giving the peak stack usage since boot.
+//!
+//! To measure a single APDU handler, repaint the free stack before calling
+//! it:
+//!
+//! ```
+//! stack::reset_high_water();
+//! handle_apdu(&mut comm, ins);
+//! let peak = stack::stack_high_water();
+//! ```
+//!
+//! Painting takes a few milliseconds, and interrupts taken while the stack
+//! is deep make the measure conservative: this is for benchmarks, not for
+//! release builds.
+
+use core::arch::asm;
+use core::ptr::addr_of_mut;
+
+extern "C" {
+    // Reserved by link.ld right after .bss, below the stack
+    static mut app_stack_canary: u32;
+}
+
+const PAINT: u32 = 0xa5a5_a5a5;
+
+/// Space left untouched below the stack pointer when painting, for the
+/// frames of the painting function itself
+const PAINT_MARGIN: usize = 64;
+
+/// Stack pointer at boot, from which usage is measured
+static mut STACK_TOP: usize = 0;
+
+#[inline(always)]
+fn sp() -> usize {
+    let sp: usize;
+    unsafe { asm!("mov {}, sp", out(reg) sp) };
+    sp
+}
+
+/// Lowest word the stack can grow to before reaching the canary
+fn stack_bottom() -> *mut u32 {
+    unsafe { addr_of_mut!(app_stack_canary).add(1) }
+}
+
+#[inline(never)]
+fn paint_below(limit: usize) {
+    let mut p = stack_bottom();
+    while (p as usize) < limit {
+        unsafe {
+            p.write_volatile(PAINT);
+            p = p.add(1);
+        }
+    }
+}
+
+/// Paint the whole stack, called by `_start` before anything runs
+#[inline(never)]
+pub(crate) fn paint() {
+    let top = sp();
+    unsafe {
+        STACK_TOP = top;
+        addr_of_mut!(app_stack_canary).write_volatile(PAINT);
+    }
+    paint_below(top - PAINT_MARGIN);
+}
+
+/// Repaint the free stack, so that the next [`stack_high_water`] only
+/// reports what is used from now on
+#[inline(never)]
+pub fn reset_high_water() {
+    paint_below(sp() - PAINT_MARGIN);
+}
+
+/// Peak stack usage in bytes, since boot or the last
+/// [`reset_high_water`]
+pub fn stack_high_water() -> usize {
+    let top = unsafe { STACK_TOP };
+    let mut p = stack_bottom() as *const u32;
+    while (p as usize) < top && unsafe { p.read_volatile() } == PAINT {
+        p = unsafe { p.add(1) };
+    }
+    top - p as usize
+}
+
+/// Whether the stack never grew into the canary word below it
+pub fn canary_intact() -> bool {
+    unsafe { addr_of_mut!(app_stack_canary).read_volatile() == PAINT }
+}
@@ -0,0 +1,196 @@
+//! Inline system calls for the hot paths of the SDK
+//!
+//! The syscalls.c stubs store their arguments in an array and call
+//! `SVC_Call` or `SVC_cx_call` out of line, which issue `svc 1` with the
+//! syscall ID in r0 and the array in r1. The array is part of the OS
+//! calling convention, but the two calls are not: the functions below
+//! issue the `svc` inline, for the SPI exchanges with the MCU, NVM writes,
+//! library calls, the modular arithmetic of the bignum engine and the blocks
+//! of the AES engine.
+//!
+//! They have the same signatures as the bindings, which they shadow when
+//! imported explicitly. With the `host` feature, the calls are handled by
+//! [`crate::host`] instead of the OS.
+
+use crate::bindings::{cx_aes_key_t, cx_bn_mont_ctx_t, cx_bn_t, cx_err_t, os_longjmp};
+#[cfg(not(feature = "host"))]
+use core::arch::asm;
+
+#[cfg(target_os = "nanosplus")]
+pub(crate) mod id {
+    pub const NVM_WRITE: u32 = 0x03000003;
+    pub const CX_AES_SET_KEY_HW: u32 = 0x020000b2;
+    pub const CX_AES_RESET_HW: u32 = 0x000000b3;
+    pub const CX_AES_BLOCK_HW: u32 = 0x020000b4;
+    pub const CX_BN_MOD_ADD: u32 = 0x040000d3;
+    pub const CX_BN_MOD_SUB: u32 = 0x040000d4;
+    pub const CX_BN_MOD_MUL: u32 = 0x040000d5;
+    pub const CX_BN_REDUCE: u32 = 0x030000d6;
+    pub const CX_MONT_MUL: u32 = 0x040000e1;
+    pub const IO_SEPH_SEND: u32 = 0x02000083;
+    pub const IO_SEPH_IS_STATUS_SENT: u32 = 0x00000084;
+    pub const IO_SEPH_RECV: u32 = 0x03000085;
+    pub const OS_LIB_CALL: u32 = 0x01000067;
+}
+
+#[cfg(not(target_os = "nanosplus"))]
+pub(crate) mod id {
+    pub const NVM_WRITE: u32 = 0x6000037f;
+    pub const CX_AES_SET_KEY_HW: u32 = 0x6000b2c8;
+    pub const CX_AES_RESET_HW: u32 = 0x6000b342;
+    pub const CX_AES_BLOCK_HW: u32 = 0x6000b40e;
+    pub const CX_BN_MOD_ADD: u32 = 0x6000d302;
+    pub const CX_BN_MOD_SUB: u32 = 0x6000d475;
+    pub const CX_BN_MOD_MUL: u32 = 0x6000d59d;
+    pub const CX_BN_REDUCE: u32 = 0x6000d60e;
+    pub const CX_MONT_MUL: u32 = 0x6000e14e;
+    pub const IO_SEPH_SEND: u32 = 0x60008381;
+    pub const IO_SEPH_IS_STATUS_SENT: u32 = 0x600084bb;
+    pub const IO_SEPH_RECV: u32 = 0x600085e4;
+    pub const OS_LIB_CALL: u32 = 0x6000670d;
+}
+
+/// `svc 1`, returning r0 and r1. `params` is read and may be written by the
+/// OS, and is 2 words larger than the arguments as in the Nano S and X stubs.
+#[cfg(not(feature = "host"))]
+#[inline(always)]
+unsafe fn svc(id: u32, params: &mut [usize]) -> (usize, usize) {
+    let (r0, r1): (usize, usize);
+    asm!(
+        "svc 1",
+        inout("r0") id as usize => r0,
+        inout("r1") params.as_mut_ptr() => r1,
+        clobber_abi("C"),
+    );
+    (r0, r1)
+}
+
+#[cfg(feature = "host")]
+unsafe fn svc(id: u32, params: &mut [usize]) -> (usize, usize) {
+    crate::host::svc(id, params)
+}
+
+#[cold]
+#[inline(never)]
+fn raise(exception: u32) -> ! {
+    unsafe {
+        os_longjmp(exception);
+        core::hint::unreachable_unchecked()
+    }
+}
+
+/// Same as `SVC_Call`: r1 holds an exception to raise, or 0
+#[inline(always)]
+unsafe fn svc_call(id: u32, params: &mut [usize]) -> u32 {
+    let (ret, exception) = svc(id, params);
+    if exception != 0 {
+        raise(exception as u32);
+    }
+    ret as u32
+}
+
+/// Same as `SVC_cx_call`: errors are returned
+#[inline(always)]
+unsafe fn svc_cx_call(id: u32, params: &mut [usize]) -> cx_err_t {
+    svc(id, params).0 as cx_err_t
+}
+
+#[inline(always)]
+pub unsafe fn io_seph_send(buffer: *const u8, length: u16) {
+    svc_call(
+        id::IO_SEPH_SEND,
+        &mut [buffer as usize, length as usize, 0, 0],
+    );
+}
+
+#[inline(always)]
+pub unsafe fn io_seph_is_status_sent() -> u32 {
+    svc_call(id::IO_SEPH_IS_STATUS_SENT, &mut [0, 0])
+}
+
+#[inline(always)]
+pub unsafe fn io_seph_recv(buffer: *mut u8, maxlength: u16, flags: u32) -> u16 {
+    svc_call(
+        id::IO_SEPH_RECV,
+        &mut [buffer as usize, maxlength as usize, flags as usize, 0, 0],
+    ) as u16
+}
+
+#[inline(always)]
+pub unsafe fn nvm_write(dst: *mut core::ffi::c_void, src: *mut core::ffi::c_void, len: u32) {
+    svc_call(
+        id::NVM_WRITE,
+        &mut [dst as usize, src as usize, len as usize, 0, 0],
+    );
+}
+
+#[inline(always)]
+pub unsafe fn os_lib_call(call_parameters: *mut core::ffi::c_uint) {
+    svc_call(id::OS_LIB_CALL, &mut [call_parameters as usize, 0, 0]);
+}
+
+#[inline(always)]
+pub unsafe fn cx_aes_set_key_hw(key: *const cx_aes_key_t, mode: u32) -> cx_err_t {
+    svc_cx_call(
+        id::CX_AES_SET_KEY_HW,
+        &mut [key as usize, mode as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_aes_reset_hw() {
+    svc_cx_call(id::CX_AES_RESET_HW, &mut [0, 0]);
+}
+
+#[inline(always)]
+pub unsafe fn cx_aes_block_hw(inblock: *const u8, outblock: *mut u8) -> cx_err_t {
+    svc_cx_call(
+        id::CX_AES_BLOCK_HW,
+        &mut [inblock as usize, outblock as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_bn_mod_add(r: cx_bn_t, a: cx_bn_t, b: cx_bn_t, n: cx_bn_t) -> cx_err_t {
+    svc_cx_call(
+        id::CX_BN_MOD_ADD,
+        &mut [r as usize, a as usize, b as usize, n as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_bn_mod_sub(r: cx_bn_t, a: cx_bn_t, b: cx_bn_t, n: cx_bn_t) -> cx_err_t {
+    svc_cx_call(
+        id::CX_BN_MOD_SUB,
+        &mut [r as usize, a as usize, b as usize, n as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_bn_mod_mul(r: cx_bn_t, a: cx_bn_t, b: cx_bn_t, n: cx_bn_t) -> cx_err_t {
+    svc_cx_call(
+        id::CX_BN_MOD_MUL,
+        &mut [r as usize, a as usize, b as usize, n as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_bn_reduce(r: cx_bn_t, d: cx_bn_t, n: cx_bn_t) -> cx_err_t {
+    svc_cx_call(
+        id::CX_BN_REDUCE,
+        &mut [r as usize, d as usize, n as usize, 0, 0],
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_mont_mul(
+    r: cx_bn_t,
+    a: cx_bn_t,
+    b: cx_bn_t,
+    ctx: *const cx_bn_mont_ctx_t,
+) -> cx_err_t {
+    svc_cx_call(
+        id::CX_MONT_MUL,
+        &mut [r as usize, a as usize, b as usize, ctx as usize, 0, 0],
+    )
+}
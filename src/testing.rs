@@ -1,35 +1,199 @@
+#[cfg(not(feature = "host"))]
 use core::arch::asm;
 use core::panic::PanicInfo;
 
-/// Debug 'print' function that uses ARM semihosting
+/// Debug 'print' function that uses ARM semihosting, or the standard output
+/// with the `host` feature
 /// Prints only strings with no formatting
 pub fn debug_print(s: &str) {
-    let p = s.as_bytes().as_ptr();
-    for i in 0..s.len() {
-        let m = unsafe { p.add(i) };
+    DebugWriter::new().write(s);
+}
+
+/// Size of the [`DebugWriter`] buffer
+const DEBUG_BUFFER_SIZE: usize = 128;
+
+/// Text printed through semihosting in strings of up to 128 bytes, each
+/// costing a single trap, instead of one per byte. The buffer is flushed
+/// when full, on [`flush`](DebugWriter::flush) and when the writer is
+/// dropped, so that a line can be built from several pieces:
+///
+/// ```
+/// let mut w = DebugWriter::new();
+/// w.write("  bench  ");
+/// w.write(name);
+/// w.write("\n");
+/// ```
+///
+/// The strings are written with `SYS_WRITE0`, NUL-terminated: NUL bytes of
+/// the text are left out.
+pub struct DebugWriter {
+    buf: [u8; DEBUG_BUFFER_SIZE + 1],
+    len: usize,
+}
+
+impl Default for DebugWriter {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl DebugWriter {
+    pub const fn new() -> Self {
+        DebugWriter {
+            buf: [0; DEBUG_BUFFER_SIZE + 1],
+            len: 0,
+        }
+    }
+
+    pub fn write(&mut self, s: &str) {
+        for &b in s.as_bytes().iter().filter(|&&b| b != 0) {
+            if self.len == DEBUG_BUFFER_SIZE {
+                self.flush();
+            }
+            self.buf[self.len] = b;
+            self.len += 1;
+        }
+    }
+
+    pub fn flush(&mut self) {
+        if self.len == 0 {
+            return;
+        }
+        self.buf[self.len] = 0;
+        #[cfg(not(feature = "host"))]
         unsafe {
             asm!(
                 "svc #0xab",
-                in("r1") m,
-                inout("r0") 3 => _,
+                in("r1") self.buf.as_ptr(),
+                inout("r0") SYS_WRITE0 => _,
             );
         }
+        #[cfg(feature = "host")]
+        crate::host::print(&self.buf[..self.len]);
+        self.len = 0;
+    }
+}
+
+impl Drop for DebugWriter {
+    fn drop(&mut self) {
+        self.flush();
+    }
+}
+
+/// Formatting into a [`DebugWriter`], with `write!`. The formatting
+/// machinery goes through tables of function pointers that need
+/// relocating, so this is only built with the `debug_fmt` feature.
+#[cfg(feature = "debug_fmt")]
+impl core::fmt::Write for DebugWriter {
+    fn write_str(&mut self, s: &str) -> core::fmt::Result {
+        self.write(s);
+        Ok(())
     }
 }
 
 pub fn to_hex(m: u32) -> [u8; 8] {
     let mut hex = [0u8; 8];
-    let mut i = 0;
-    for c in m.to_be_bytes().iter() {
-        let c0 = char::from_digit((c >> 4).into(), 16).unwrap();
-        let c1 = char::from_digit((c & 0xf).into(), 16).unwrap();
-        hex[i] = c0 as u8;
-        hex[i + 1] = c1 as u8;
-        i += 2;
-    }
+    // Cannot fail, the buffer holding the 8 digits
+    let _ = crate::encoding::hex_encode(&m.to_be_bytes(), &mut hex);
     hex
 }
 
+/// Decimal representation of `m`, without leading zeros
+pub fn to_dec(m: u32, buf: &mut [u8; 10]) -> &str {
+    let mut i = buf.len();
+    let mut m = m;
+    loop {
+        i -= 1;
+        buf[i] = b'0' + (m % 10) as u8;
+        m /= 10;
+        if m == 0 {
+            break;
+        }
+    }
+    core::str::from_utf8(&buf[i..]).unwrap()
+}
+
+// Semihosting operations
+#[cfg(not(feature = "host"))]
+const SYS_WRITE0: u32 = 0x04;
+#[cfg(not(feature = "host"))]
+const SYS_ELAPSED: u32 = 0x30;
+#[cfg(not(feature = "host"))]
+const SYS_TICKFREQ: u32 = 0x31;
+
+/// Ticks elapsed since the app started, counted by the emulator through
+/// semihosting, or 0 if it does not support it
+#[cfg(not(feature = "host"))]
+pub fn ticks() -> u64 {
+    let mut t = [0u32; 2];
+    let res: u32;
+    unsafe {
+        asm!(
+            "svc #0xab",
+            in("r1") t.as_mut_ptr(),
+            inout("r0") SYS_ELAPSED => res,
+        );
+    }
+    if res != 0 {
+        return 0;
+    }
+    (t[1] as u64) << 32 | t[0] as u64
+}
+
+/// Frequency of [`ticks`] in Hz. Under QEMU with `-icount`, ticks follow
+/// the instruction count instead of the host clock.
+#[cfg(not(feature = "host"))]
+pub fn tick_frequency() -> u32 {
+    let freq: u32;
+    unsafe {
+        asm!(
+            "svc #0xab",
+            in("r1") 0,
+            inout("r0") SYS_TICKFREQ => freq,
+        );
+    }
+    freq
+}
+
+#[cfg(feature = "host")]
+pub use crate::host::{tick_frequency, ticks};
+
+/// Run `f` `iterations` times and print the average number of [`ticks`] per
+/// run. Benchmarks are regular tests calling this function, so that they are
+/// run by [`sdk_test_runner`] with the other tests:
+///
+/// ```
+/// bench("sha256 64 bytes", 100, || {
+///     black_box(Sha256::hash(&[0u8; 64]).ok());
+/// });
+/// ```
+#[cfg(feature = "speculos")]
+pub fn bench(name: &str, iterations: u32, mut f: impl FnMut()) {
+    // Warm-up run, out of the measure
+    f();
+    #[cfg(feature = "cx_profile")]
+    crate::profile::clear();
+    let start = ticks();
+    for _ in 0..iterations {
+        f();
+    }
+    let per_iter = (ticks() - start) / iterations.max(1) as u64;
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    w.write("  bench  ");
+    w.write(name);
+    w.write(": ");
+    w.write(to_dec(per_iter.min(u32::MAX as u64) as u32, &mut buf));
+    w.write(" ticks/iter at ");
+    w.write(to_dec(tick_frequency(), &mut buf));
+    w.write(" Hz\n");
+    #[cfg(feature = "cx_profile")]
+    {
+        drop(w);
+        crate::profile::dump();
+    }
+}
+
 #[cfg_attr(test, panic_handler)]
 pub fn test_panic(info: &PanicInfo) -> ! {
     debug_print("Panic! ");
@@ -53,40 +217,35 @@ pub struct TestType {
 /// using semihosting. Only reports 'Ok' or 'fail'.
 #[cfg(feature = "speculos")]
 pub fn sdk_test_runner(tests: &[&TestType]) {
-    use crate::{pic, pic_rs};
-    use core::ffi::c_void;
+    use crate::{pic_cached, pic_str};
     let mut failures = 0;
     debug_print("--- Tests ---\n");
     for test_ in tests {
         // (ノಠ益ಠ)ノ彡ꓛIꓒ
-        let test = pic_rs(*test_);
-        let modname;
-        let name;
-        unsafe {
-            let t = pic(test.modname.as_ptr() as *mut c_void) as *const u8;
-            let t = core::ptr::slice_from_raw_parts(t, test.modname.len());
-            let t: &[u8] = core::mem::transmute(t);
-            modname = core::str::from_utf8_unchecked(t);
-
-            let t = pic(test.name.as_ptr() as *mut c_void) as *const u8;
-            let t = core::ptr::slice_from_raw_parts(t, test.name.len());
-            let t: &[u8] = core::mem::transmute(t);
-            name = core::str::from_utf8_unchecked(t);
-        }
-        let fp = unsafe { pic(test.f as *mut c_void) };
+        let test = unsafe { &*pic_cached(*test_) };
+        let modname = pic_str(test.modname);
+        let name = pic_str(test.name);
+        let fp = pic_cached(test.f as *const u8);
         let fp: fn() -> Result<(), ()> = unsafe { core::mem::transmute(fp) };
-        let res = fp();
+        // On the host, each test runs in its own process, and is skipped
+        // if it calls the OS
+        #[cfg(feature = "host")]
+        let res = crate::host::run_isolated(fp);
+        #[cfg(not(feature = "host"))]
+        let res = Some(fp());
+        let mut w = DebugWriter::new();
         match res {
-            Ok(()) => debug_print("\x1b[1;32m   ok   \x1b[0m"),
-            Err(()) => {
+            Some(Ok(())) => w.write("\x1b[1;32m   ok   \x1b[0m"),
+            Some(Err(())) => {
                 failures += 1;
-                debug_print("\x1b[1;31m  fail  \x1b[0m")
+                w.write("\x1b[1;31m  fail  \x1b[0m")
             }
+            None => w.write("\x1b[1;33m  skip  \x1b[0m"),
         }
-        debug_print(modname);
-        debug_print("::");
-        debug_print(name);
-        debug_print("\n");
+        w.write(modname);
+        w.write("::");
+        w.write(name);
+        w.write("\n");
     }
     if failures > 0 {
         crate::exit_app(1);
@@ -0,0 +1,380 @@
+//! Elapsed time and timers, driven by the ticker events of the OS
+//!
+//! The OS sends a ticker event every [`TICK_MS`] milliseconds. The SDK
+//! handler of these events counts them, whether the app is waiting for an
+//! event or transmitting a response, so that [`now_ms`] tells the time
+//! since the app started. Apps registering their own ticker handler with
+//! [`register_handler`](crate::seph::register_handler) must call
+//! [`on_tick`] from it.
+//!
+//! Each ticker event wakes the app and costs an SPI exchange with the MCU.
+//! Apps which do not need them that often can lengthen the interval with
+//! [`set_ticker_interval`], or let [`Timers::adjust_ticker`] pick the
+//! longest one which does not delay the next timer.
+//!
+//! [`Timers`] schedules one-shot or periodic timers on a hashed timer
+//! wheel: timers are kept in one of [`WHEEL_SLOTS`] lists according to
+//! their expiry, and each tick only walks the list it falls in. Timers are
+//! identified by an index chosen by the app, and those expiring on the
+//! same tick are returned together:
+//!
+//! ```
+//! const BLINK: usize = 0;
+//! const LOCK: usize = 1;
+//!
+//! let mut timers = Timers::<2>::new();
+//! timers.start_periodic(BLINK, 500);
+//! timers.start(LOCK, 30_000);
+//! loop {
+//!     match comm.next_event::<Ins>() {
+//!         io::Event::Ticker => {
+//!             for id in timers.poll() {
+//!                 match id {
+//!                     BLINK => toggle_cursor(),
+//!                     LOCK => lock(),
+//!                     _ => (),
+//!                 }
+//!             }
+//!         }
+//!         io::Event::Button(_) => timers.start(LOCK, 30_000),
+//!         ...
+//!     }
+//! }
+//! ```
+
+use crate::bindings::{G_io_app, SEPROXYHAL_TAG_SET_TICKER_INTERVAL};
+
+/// Period of the ticker events sent by the OS, and resolution of the timers
+pub const TICK_MS: u32 = 100;
+
+/// Number of lists of the timer wheel
+pub const WHEEL_SLOTS: usize = 8;
+
+/// Longest ticker interval, a multiple of [`TICK_MS`]
+pub const MAX_INTERVAL_MS: u32 = (u16::MAX as u32 / TICK_MS) * TICK_MS;
+
+static mut TICKS: u32 = 0;
+
+// Ticker intervals requested by the app and last sent to the MCU, 0 being
+// the OS default of TICK_MS
+static mut INTERVAL_MS: u32 = 0;
+static mut APPLIED_MS: u32 = 0;
+
+fn interval_or_default(ms: u32) -> u32 {
+    match ms {
+        0 => TICK_MS,
+        ms => ms,
+    }
+}
+
+/// Account for a ticker event. Called by the SDK ticker handler.
+pub fn on_tick() {
+    let interval = tick_interval_ms();
+    unsafe {
+        TICKS = TICKS.wrapping_add(interval / TICK_MS);
+        G_io_app.ms = G_io_app.ms.wrapping_add(interval);
+    }
+}
+
+/// Time accounted for by each ticker event, in milliseconds
+pub(crate) fn tick_interval_ms() -> u32 {
+    interval_or_default(unsafe { APPLIED_MS })
+}
+
+/// Time since the app started in units of [`TICK_MS`]
+pub fn ticks() -> u32 {
+    unsafe { TICKS }
+}
+
+/// Ask the OS to send ticker events every `interval_ms`, rounded up to a
+/// multiple of [`TICK_MS`] and capped to [`MAX_INTERVAL_MS`]. Commands can
+/// only be sent to the MCU before acknowledging an event, so the new
+/// interval only takes effect once the current event has been processed.
+///
+/// Note that the SDK does not slow down the UX animations of `lib_bagl`
+/// accordingly.
+pub fn set_ticker_interval(interval_ms: u32) {
+    let ms = interval_ms
+        .clamp(TICK_MS, MAX_INTERVAL_MS)
+        .next_multiple_of(TICK_MS);
+    unsafe { INTERVAL_MS = ms };
+}
+
+/// Ticker interval currently requested, in milliseconds
+pub fn ticker_interval_ms() -> u32 {
+    interval_or_default(unsafe { INTERVAL_MS })
+}
+
+/// Send the ticker interval to the MCU if it has changed. Called before
+/// acknowledging an event.
+pub(crate) fn send_ticker_interval() {
+    let ms = unsafe { INTERVAL_MS };
+    if ms == unsafe { APPLIED_MS } {
+        return;
+    }
+    let interval = (interval_or_default(ms) as u16).to_be_bytes();
+    crate::seph::seph_send(&[
+        SEPROXYHAL_TAG_SET_TICKER_INTERVAL as u8,
+        0,
+        2,
+        interval[0],
+        interval[1],
+    ]);
+    unsafe { APPLIED_MS = ms };
+}
+
+/// Milliseconds elapsed since the app started, with a resolution of
+/// [`TICK_MS`]. Wraps around after 49 days.
+pub fn now_ms() -> u32 {
+    unsafe { G_io_app.ms }
+}
+
+/// `a` is at or after `b`, both being tick counts which may have wrapped
+fn reached(a: u32, b: u32) -> bool {
+    (a.wrapping_sub(b) as i32) >= 0
+}
+
+const NONE: u8 = u8::MAX;
+
+#[derive(Copy, Clone)]
+struct Timer {
+    /// Tick count at which the timer expires
+    expires: u32,
+    /// Period in ticks, 0 for one-shot timers
+    period: u32,
+    /// Next timer of the same wheel slot
+    next: u8,
+    armed: bool,
+}
+
+/// Up to `N` timers, `N` being at most 32
+pub struct Timers<const N: usize> {
+    timers: [Timer; N],
+    /// First timer of each slot
+    heads: [u8; WHEEL_SLOTS],
+    /// Last tick processed by `poll`
+    tick: u32,
+}
+
+impl<const N: usize> Default for Timers<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const N: usize> Timers<N> {
+    pub const fn new() -> Self {
+        assert!(N <= 32);
+        Timers {
+            timers: [Timer {
+                expires: 0,
+                period: 0,
+                next: NONE,
+                armed: false,
+            }; N],
+            heads: [NONE; WHEEL_SLOTS],
+            // The first poll then walks every slot once
+            tick: 0,
+        }
+    }
+
+    fn link(&mut self, id: usize) {
+        let slot = self.timers[id].expires as usize % WHEEL_SLOTS;
+        self.timers[id].next = self.heads[slot];
+        self.heads[slot] = id as u8;
+    }
+
+    fn unlink(&mut self, id: usize) {
+        let slot = self.timers[id].expires as usize % WHEEL_SLOTS;
+        let next = self.timers[id].next;
+        if self.heads[slot] == id as u8 {
+            self.heads[slot] = next;
+            return;
+        }
+        let mut i = self.heads[slot];
+        while i != NONE {
+            if self.timers[i as usize].next == id as u8 {
+                self.timers[i as usize].next = next;
+                return;
+            }
+            i = self.timers[i as usize].next;
+        }
+    }
+
+    fn arm(&mut self, id: usize, delay_ms: u32, period_ms: u32) {
+        self.cancel(id);
+        // Round up, and expire on a later tick than the current one
+        let delay = delay_ms.div_ceil(TICK_MS).max(1);
+        self.timers[id] = Timer {
+            expires: ticks().wrapping_add(delay),
+            period: period_ms.div_ceil(TICK_MS),
+            next: NONE,
+            armed: true,
+        };
+        self.link(id);
+    }
+
+    /// Arm timer `id` to expire once in `delay_ms`, replacing its previous
+    /// schedule
+    pub fn start(&mut self, id: usize, delay_ms: u32) {
+        self.arm(id, delay_ms, 0);
+    }
+
+    /// Arm timer `id` to expire every `period_ms`, replacing its previous
+    /// schedule
+    pub fn start_periodic(&mut self, id: usize, period_ms: u32) {
+        self.arm(id, period_ms, period_ms.max(1));
+    }
+
+    /// Disarm timer `id`
+    pub fn cancel(&mut self, id: usize) {
+        if self.timers[id].armed {
+            self.unlink(id);
+            self.timers[id].armed = false;
+        }
+    }
+
+    pub fn is_armed(&self, id: usize) -> bool {
+        self.timers[id].armed
+    }
+
+    /// Milliseconds until timer `id` expires, or `None` if it is not armed
+    pub fn remaining_ms(&self, id: usize) -> Option<u32> {
+        let t = &self.timers[id];
+        let now = ticks();
+        t.armed.then(|| match reached(now, t.expires) {
+            true => 0,
+            false => t.expires.wrapping_sub(now).saturating_mul(TICK_MS),
+        })
+    }
+
+    /// Milliseconds until the first armed timer expires, if any
+    pub fn next_due_ms(&self) -> Option<u32> {
+        (0..N).filter_map(|id| self.remaining_ms(id)).min()
+    }
+
+    /// Set the ticker interval to the time until the next timer is due, or
+    /// to [`MAX_INTERVAL_MS`] if none is armed, so that the app is not woken
+    /// up in between. To be called once the timers have been updated, before
+    /// waiting for the next event.
+    pub fn adjust_ticker(&self) {
+        set_ticker_interval(self.next_due_ms().unwrap_or(MAX_INTERVAL_MS));
+    }
+
+    /// Timers expired since the last call, re-arming the periodic ones.
+    /// A periodic timer which expired several times since then is only
+    /// returned once.
+    pub fn poll(&mut self) -> Expired {
+        let now = ticks();
+        let mut expired = 0u32;
+        // Once the wheel has turned, every slot has been reached
+        let steps = now.wrapping_sub(self.tick).min(WHEEL_SLOTS as u32);
+        for step in 1..=steps {
+            let slot = self.tick.wrapping_add(step) as usize % WHEEL_SLOTS;
+            let mut i = core::mem::replace(&mut self.heads[slot], NONE);
+            while i != NONE {
+                let id = i as usize;
+                i = self.timers[id].next;
+                let t = &mut self.timers[id];
+                if !reached(now, t.expires) {
+                    // Expires on a later turn of the wheel
+                    self.link(id);
+                    continue;
+                }
+                expired |= 1 << id;
+                if t.period == 0 {
+                    t.armed = false;
+                    continue;
+                }
+                t.expires = t.expires.wrapping_add(t.period);
+                if reached(now, t.expires) {
+                    t.expires = now.wrapping_add(t.period);
+                }
+                self.link(id);
+            }
+        }
+        self.tick = now;
+        Expired(expired)
+    }
+}
+
+/// Indices of the timers returned by [`Timers::poll`], in increasing order
+pub struct Expired(u32);
+
+impl Expired {
+    pub fn is_empty(&self) -> bool {
+        self.0 == 0
+    }
+
+    pub fn contains(&self, id: usize) -> bool {
+        self.0 & (1 << id) != 0
+    }
+}
+
+impl Iterator for Expired {
+    type Item = usize;
+
+    fn next(&mut self) -> Option<usize> {
+        if self.0 == 0 {
+            return None;
+        }
+        let id = self.0.trailing_zeros() as usize;
+        self.0 &= self.0 - 1;
+        Some(id)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn wheel() {
+        let mut timers = Timers::<3>::new();
+        timers.start(0, 250);
+        timers.start_periodic(1, 200);
+        // Expires beyond one turn of the wheel
+        timers.start(2, 1000);
+        assert_eq!(timers.remaining_ms(0), Some(300));
+
+        let mut fired = [0u32; 3];
+        for _ in 0..12 {
+            on_tick();
+            for id in timers.poll() {
+                fired[id] += 1;
+            }
+        }
+        assert_eq!(fired, [1, 6, 1]);
+        assert_eq!(timers.is_armed(0), false);
+        assert_eq!(timers.is_armed(1), true);
+
+        // Late poll: the periodic timer is returned once
+        timers.cancel(1);
+        timers.start(0, 100);
+        timers.start_periodic(1, 100);
+        for _ in 0..20 {
+            on_tick();
+        }
+        let expired = timers.poll();
+        assert_eq!(expired.contains(0) && expired.contains(1), true);
+        assert_eq!(timers.poll().is_empty(), true);
+        on_tick();
+        assert_eq!(timers.poll().contains(1), true);
+    }
+
+    #[test]
+    fn interval() {
+        let mut timers = Timers::<2>::new();
+        timers.adjust_ticker();
+        assert_eq!(ticker_interval_ms(), MAX_INTERVAL_MS);
+        timers.start(0, 1250);
+        timers.start(1, 5000);
+        timers.adjust_ticker();
+        assert_eq!(ticker_interval_ms(), 1300);
+        set_ticker_interval(0);
+        assert_eq!(ticker_interval_ms(), TICK_MS);
+    }
+}
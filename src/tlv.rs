@@ -0,0 +1,242 @@
+//! Zero-copy BER-TLV parsing
+//!
+//! [`TlvIter`] walks a TLV list once, returning each tag along with a slice
+//! of its value within the list. Tags and lengths may span several bytes.
+//! When values are looked up by tag more than once, a [`TlvIndex`] records
+//! where each tag is in a single pass, instead of rescanning the list from
+//! the start for each lookup as `os_parse_bertlv` does:
+//!
+//! ```
+//! let index = TlvIndex::<8>::new(TlvIter::new(comm.get_data()?)).map_err(|_| StatusWords::BadLen)?;
+//! let amount = index.get(0x9f02).ok_or(StatusWords::BadLen)?;
+//! let currency = index.get(0x5f2a).ok_or(StatusWords::BadLen)?;
+//! ```
+//!
+//! The install parameters of the app are also a TLV list, whose tags are a
+//! single byte each, even 0x1f and above: see [`install_parameters`].
+
+/// Element of a TLV list
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct Tlv<'a> {
+    /// Bytes of the tag, big-endian: a multi-byte tag 9f 02 is 0x9f02
+    pub tag: u32,
+    pub value: &'a [u8],
+    /// Offset of the value in the list
+    pub offset: usize,
+}
+
+/// Iterator over the elements of a TLV list, stopping at the end of the list
+/// or at its first malformed element
+#[derive(Clone)]
+pub struct TlvIter<'a> {
+    data: &'a [u8],
+    pos: usize,
+    multi_byte_tags: bool,
+}
+
+impl<'a> TlvIter<'a> {
+    /// Parse a BER-TLV list
+    pub fn new(data: &'a [u8]) -> Self {
+        TlvIter {
+            data,
+            pos: 0,
+            multi_byte_tags: true,
+        }
+    }
+
+    /// Parse a TLV list whose tags are a single byte, as the install
+    /// parameters
+    pub fn with_single_byte_tags(data: &'a [u8]) -> Self {
+        TlvIter {
+            data,
+            pos: 0,
+            multi_byte_tags: false,
+        }
+    }
+
+    /// Bytes not parsed yet. Not empty once the iterator is exhausted if the
+    /// list has a malformed element.
+    pub fn remaining(&self) -> &'a [u8] {
+        &self.data[self.pos..]
+    }
+
+    fn byte(&mut self) -> Option<u8> {
+        let b = *self.data.get(self.pos)?;
+        self.pos += 1;
+        Some(b)
+    }
+
+    fn tag(&mut self) -> Option<u32> {
+        let first = self.byte()?;
+        let mut tag = first as u32;
+        if !self.multi_byte_tags || first & 0x1f != 0x1f {
+            return Some(tag);
+        }
+        // Subsequent bytes all have bit 8 set but the last one, up to 4
+        // bytes in total
+        for _ in 0..3 {
+            let b = self.byte()?;
+            tag = (tag << 8) | b as u32;
+            if b & 0x80 == 0 {
+                return Some(tag);
+            }
+        }
+        None
+    }
+
+    fn len(&mut self) -> Option<usize> {
+        let first = self.byte()?;
+        match first {
+            0..=0x7f => Some(first as usize),
+            // The indefinite form 0x80 is not supported
+            0x81..=0x84 => {
+                let mut len = 0;
+                for _ in 0..first & 0x7f {
+                    len = (len << 8) | self.byte()? as usize;
+                }
+                Some(len)
+            }
+            _ => None,
+        }
+    }
+}
+
+impl<'a> Iterator for TlvIter<'a> {
+    type Item = Tlv<'a>;
+
+    fn next(&mut self) -> Option<Tlv<'a>> {
+        let start = self.pos;
+        let element = (|| {
+            let tag = self.tag()?;
+            let len = self.len()?;
+            let offset = self.pos;
+            let value = self.data.get(offset..offset.checked_add(len)?)?;
+            self.pos += len;
+            Some(Tlv { tag, value, offset })
+        })();
+        if element.is_none() {
+            // Leave the malformed element in `remaining`
+            self.pos = start;
+        }
+        element
+    }
+}
+
+/// Returned when a TLV list has more than the `N` elements of a
+/// [`TlvIndex`], or a malformed one
+#[derive(Debug, PartialEq, Eq)]
+pub struct TlvIndexError;
+
+/// Location of the elements of a TLV list, sorted by tag
+pub struct TlvIndex<'a, const N: usize> {
+    data: &'a [u8],
+    /// Tag, offset and length of the values
+    entries: [(u32, u16, u16); N],
+    count: usize,
+}
+
+impl<'a, const N: usize> TlvIndex<'a, N> {
+    /// Index the elements of `tlvs` in a single pass
+    pub fn new(mut tlvs: TlvIter<'a>) -> Result<Self, TlvIndexError> {
+        let mut index = TlvIndex {
+            data: tlvs.data,
+            entries: [(0, 0, 0); N],
+            count: 0,
+        };
+        for tlv in tlvs.by_ref() {
+            if index.count == N || tlv.offset + tlv.value.len() > u16::MAX as usize {
+                return Err(TlvIndexError);
+            }
+            // Insertion sort, keeping the first element of each tag first
+            let entry = (tlv.tag, tlv.offset as u16, tlv.value.len() as u16);
+            let i = index.entries[..index.count].partition_point(|e| e.0 <= tlv.tag);
+            index.entries.copy_within(i..index.count, i + 1);
+            index.entries[i] = entry;
+            index.count += 1;
+        }
+        if !tlvs.remaining().is_empty() {
+            return Err(TlvIndexError);
+        }
+        Ok(index)
+    }
+
+    /// Number of elements
+    pub fn len(&self) -> usize {
+        self.count
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// Value of the first element with `tag`
+    pub fn get(&self, tag: u32) -> Option<&'a [u8]> {
+        let entries = &self.entries[..self.count];
+        let i = entries.partition_point(|e| e.0 < tag);
+        let &(t, offset, len) = entries.get(i)?;
+        (t == tag).then(|| &self.data[offset as usize..offset as usize + len as usize])
+    }
+}
+
+extern "C" {
+    // Linker script symbol at the end of the app, where the loader writes
+    // the install parameters. Declared as a function for the same reason as
+    // `_nvram_data`.
+    fn _install_parameters();
+}
+
+/// TLV list of the install parameters written by the loader, read from Flash
+/// in place. The length of the list is not recorded: `max_len` bytes at most
+/// are parsed, which must not go beyond the size set at installation.
+pub fn install_parameters(max_len: usize) -> TlvIter<'static> {
+    let addr = _install_parameters as *const u8;
+    let data = unsafe {
+        let addr = crate::bindings::pic(addr as *mut core::ffi::c_void) as *const u8;
+        core::slice::from_raw_parts(addr, max_len)
+    };
+    TlvIter::with_single_byte_tags(data)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    // 9f02 (amount), 5a with a long-form length, 82, then a truncated element
+    const LIST: [u8; 17] = [
+        0x9f, 0x02, 0x02, 0x12, 0x34, 0x5a, 0x81, 0x03, 1, 2, 3, 0x82, 0x00, 0x5f, 0x2a, 0x02, 0x09,
+    ];
+
+    #[test]
+    fn iter() {
+        let mut tlvs = TlvIter::new(&LIST);
+        let tags: [Option<u32>; 4] = core::array::from_fn(|_| tlvs.next().map(|t| t.tag));
+        assert_eq!(tags, [Some(0x9f02), Some(0x5a), Some(0x82), None]);
+        assert_eq!(tlvs.remaining(), &LIST[13..]);
+        let tlv = TlvIter::new(&LIST).nth(1).ok_or(())?;
+        assert_eq!((tlv.value, tlv.offset), (&[1u8, 2, 3][..], 8));
+
+        // Single-byte tags: 9f then 02
+        let tlv = TlvIter::with_single_byte_tags(&LIST).next().ok_or(())?;
+        assert_eq!((tlv.tag, tlv.value), (0x9f, &[0x02, 0x12][..]));
+    }
+
+    #[test]
+    fn index() {
+        assert_eq!(
+            TlvIndex::<8>::new(TlvIter::new(&LIST)).err(),
+            Some(TlvIndexError)
+        );
+        let index = TlvIndex::<3>::new(TlvIter::new(&LIST[..13])).map_err(|_| ())?;
+        assert_eq!(index.len(), 3);
+        assert_eq!(index.get(0x9f02), Some(&[0x12u8, 0x34][..]));
+        assert_eq!(index.get(0x82), Some(&[][..]));
+        assert_eq!(index.get(0x5f2a), None);
+        assert_eq!(
+            TlvIndex::<2>::new(TlvIter::new(&LIST[..13])).err(),
+            Some(TlvIndexError)
+        );
+    }
+}
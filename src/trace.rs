@@ -0,0 +1,204 @@
+//! Enter/exit timestamps of instrumented code, kept in a RAM ring buffer
+//!
+//! With the `trace` feature, [`trace_span!`](crate::trace_span) records the
+//! tick count when it is reached and when the enclosing scope ends. The SDK
+//! instruments `Comm::next_event`, the APDU transmission, NVM writes and the
+//! hash and ECDSA calls to the cxlib, and apps may add their own spans:
+//!
+//! ```
+//! fn handle_sign(comm: &mut Comm) {
+//!     trace_span!("handle_sign");
+//!     ...
+//! }
+//! ```
+//!
+//! Without the feature, `trace_span!` expands to nothing. Ticks are read
+//! through semihosting: traces are taken under speculos, which host
+//! software can drive through its APDU port as it would a device.
+//!
+//! The last [`TRACE_LEN`] records are kept. [`dump`] prints them with
+//! semihosting, and [`drain`] serializes them so that an app can return
+//! them from an APDU of its own.
+
+use crate::testing::{ticks, to_dec, DebugWriter};
+
+/// Number of records kept
+pub const TRACE_LEN: usize = 32;
+
+#[derive(Copy, Clone)]
+struct Record {
+    name: *const u8,
+    len: u16,
+    exit: bool,
+    ticks: u32,
+}
+
+impl Record {
+    const EMPTY: Record = Record {
+        name: core::ptr::null(),
+        len: 0,
+        exit: false,
+        ticks: 0,
+    };
+
+    fn name(&self) -> &'static str {
+        unsafe {
+            core::str::from_utf8_unchecked(core::slice::from_raw_parts(
+                self.name,
+                self.len as usize,
+            ))
+        }
+    }
+}
+
+struct Ring {
+    records: [Record; TRACE_LEN],
+    /// Index of the oldest record
+    first: usize,
+    count: usize,
+}
+
+static mut RING: Ring = Ring {
+    records: [Record::EMPTY; TRACE_LEN],
+    first: 0,
+    count: 0,
+};
+
+fn ring() -> &'static mut Ring {
+    // Apps are single-threaded
+    unsafe { &mut *core::ptr::addr_of_mut!(RING) }
+}
+
+fn record(name: &'static str, exit: bool) {
+    let ticks = ticks() as u32;
+    let ring = ring();
+    let i = (ring.first + ring.count) % TRACE_LEN;
+    ring.records[i] = Record {
+        name: name.as_ptr(),
+        len: name.len().min(u16::MAX as usize) as u16,
+        exit,
+        ticks,
+    };
+    if ring.count < TRACE_LEN {
+        ring.count += 1;
+    } else {
+        ring.first = (ring.first + 1) % TRACE_LEN;
+    }
+}
+
+/// Span recording its exit when dropped, created by
+/// [`trace_span!`](crate::trace_span)
+pub struct Span {
+    name: &'static str,
+}
+
+impl Span {
+    #[inline(always)]
+    pub fn enter(name: &'static str) -> Self {
+        record(name, false);
+        Span { name }
+    }
+}
+
+impl Drop for Span {
+    #[inline(always)]
+    fn drop(&mut self) {
+        record(self.name, true);
+    }
+}
+
+/// Record the time spent in the rest of the enclosing scope under `name`
+#[macro_export]
+macro_rules! trace_span {
+    ($name:expr) => {
+        let _span = $crate::trace::Span::enter($name);
+    };
+}
+
+/// Number of records kept
+pub fn len() -> usize {
+    ring().count
+}
+
+/// Drop all the records
+pub fn clear() {
+    let ring = ring();
+    ring.first = 0;
+    ring.count = 0;
+}
+
+/// Print the records, oldest first, one per line: `>` or `<` for the entry
+/// or exit of the span, its name and the tick count
+pub fn dump() {
+    let ring = ring();
+    let mut buf = [0u8; 10];
+    let mut w = DebugWriter::new();
+    for n in 0..ring.count {
+        let r = &ring.records[(ring.first + n) % TRACE_LEN];
+        w.write(if r.exit { "< " } else { "> " });
+        w.write(r.name());
+        w.write(" ");
+        w.write(to_dec(r.ticks, &mut buf));
+        w.write("\n");
+    }
+}
+
+/// Move the oldest records into `out`, as many as fit, returning the number
+/// of bytes written. Each record is serialized as its tick count (big
+/// endian u32), a byte holding the length of its name with the top bit set
+/// for exits, and the name truncated to 127 bytes.
+pub fn drain(out: &mut [u8]) -> usize {
+    let ring = ring();
+    let mut pos = 0;
+    while ring.count > 0 {
+        let r = &ring.records[ring.first];
+        let name = &r.name().as_bytes()[..(r.len as usize).min(0x7f)];
+        let end = pos + 5 + name.len();
+        if end > out.len() {
+            break;
+        }
+        out[pos..pos + 4].copy_from_slice(&r.ticks.to_be_bytes());
+        out[pos + 4] = name.len() as u8 | (r.exit as u8) << 7;
+        out[pos + 5..end].copy_from_slice(name);
+        pos = end;
+        ring.first = (ring.first + 1) % TRACE_LEN;
+        ring.count -= 1;
+    }
+    pos
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn ring_buffer() {
+        clear();
+        {
+            trace_span!("outer");
+            for _ in 0..TRACE_LEN {
+                trace_span!("inner");
+            }
+        }
+        assert_eq!(len(), TRACE_LEN);
+
+        // Oldest records were overwritten: the last one is the exit of outer
+        let mut out = [0u8; 16];
+        let mut last = [0u8; 10];
+        let mut total = 0;
+        loop {
+            let n = drain(&mut out);
+            if n == 0 {
+                break;
+            }
+            total += n;
+            last[..n - 4].copy_from_slice(&out[4..n]);
+        }
+        assert_eq!(len(), 0);
+        assert_eq!(total, TRACE_LEN * 10);
+        assert_eq!(&last[..6], &[0x85, b'o', b'u', b't', b'e', b'r']);
+    }
+}
@@ -0,0 +1,94 @@
+//! Direct calls to the cxlib of the OS for the hottest functions
+//!
+//! Functions of the cxlib are reached through the `CX_TRAMPOLINE` stubs of
+//! cx_stubs.S: each stub saves r0-r1, loads the number of the function and
+//! branches to a helper, which jumps to the trampoline of the OS. The
+//! functions below set up the same registers inline and call the OS
+//! trampoline directly, which then jumps to the function itself. Only
+//! functions with at most 4 arguments can be called this way, as the
+//! arguments on the stack would be offset by the saved registers.
+//!
+//! The function numbers are taken from cx_stubs.h by build.rs. These
+//! functions have the same signatures as the bindings, which they shadow
+//! when imported explicitly. With the `host` feature, the calls go to the
+//! software cxlib of [`crate::host`].
+
+use crate::bindings::{cx_err_t, cx_hash_t, cx_hmac_t, size_t};
+#[cfg(not(feature = "host"))]
+use core::arch::asm;
+
+#[allow(dead_code, non_upper_case_globals)]
+pub(crate) mod nr {
+    include!(concat!(env!("OUT_DIR"), "/cx_numbers.rs"));
+}
+
+// CX_TRAMPOLINE_ADDR of cx_trampoline.h, with the Thumb bit
+#[cfg(target_os = "nanos")]
+const CX_TRAMPOLINE_ADDR: u32 = 0x00120001;
+#[cfg(target_os = "nanox")]
+const CX_TRAMPOLINE_ADDR: u32 = 0x00210001;
+#[cfg(target_os = "nanosplus")]
+const CX_TRAMPOLINE_ADDR: u32 = 0x00808001;
+
+#[cfg(not(feature = "host"))]
+#[inline(always)]
+unsafe fn call(nr: u32, a0: usize, a1: usize, a2: usize, a3: usize) -> u32 {
+    let ret: usize;
+    asm!(
+        // The trampoline pops r0-r1 before jumping to the function
+        "push {{r0, r1}}",
+        "mov r0, {nr}",
+        "blx r12",
+        nr = in(reg) nr,
+        inout("r0") a0 => ret,
+        inout("r1") a1 => _,
+        inout("r2") a2 => _,
+        inout("r3") a3 => _,
+        inout("r12") CX_TRAMPOLINE_ADDR => _,
+        clobber_abi("C"),
+    );
+    ret as u32
+}
+
+#[cfg(feature = "host")]
+unsafe fn call(nr: u32, a0: usize, a1: usize, a2: usize, a3: usize) -> u32 {
+    crate::host::cx_call(nr, [a0, a1, a2, a3])
+}
+
+#[inline(always)]
+pub unsafe fn cx_hash_update(hash: *mut cx_hash_t, input: *const u8, len: size_t) -> cx_err_t {
+    call(
+        nr::cx_hash_update,
+        hash as usize,
+        input as usize,
+        len as usize,
+        0,
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_hash_final(hash: *mut cx_hash_t, digest: *mut u8) -> cx_err_t {
+    call(nr::cx_hash_final, hash as usize, digest as usize, 0, 0)
+}
+
+#[inline(always)]
+pub unsafe fn cx_hmac_update(hmac: *mut cx_hmac_t, input: *const u8, len: size_t) -> cx_err_t {
+    call(
+        nr::cx_hmac_update,
+        hmac as usize,
+        input as usize,
+        len as usize,
+        0,
+    )
+}
+
+#[inline(always)]
+pub unsafe fn cx_hmac_final(hmac: *mut cx_hmac_t, out: *mut u8, out_len: *mut size_t) -> cx_err_t {
+    call(
+        nr::cx_hmac_final,
+        hmac as usize,
+        out as usize,
+        out_len as usize,
+        0,
+    )
+}
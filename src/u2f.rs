@@ -0,0 +1,525 @@
+//! FIDO U2F transport, enabled by the `u2f` feature
+//!
+//! The feature adds the FIDO HID interface of `usbd_impl.c`, on endpoints
+//! 0x81 and 0x01, which browsers reach through the FIDO API of the OS
+//! without any relay. Its reports carry CTAPHID messages:
+//!
+//! | CID (4) | command (1) | length (2, big-endian) | data |  (first packet)
+//! | CID (4) | sequence (1) | data |  (continuation packets)
+//!
+//! [`Transport`] reassembles `CTAPHID_MSG` requests straight into the APDU
+//! buffer of [`Comm`](crate::io::Comm), which returns them as commands like
+//! the HID ones, and streams the reply from that buffer in place. Channel
+//! allocation, ping and wink are answered here. While a request is being
+//! processed, a `CTAPHID_KEEPALIVE` is sent on each ticker event, and a
+//! `CTAPHID_CANCEL` from the host drops the reply:
+//!
+//! ```
+//! u2f::set_keepalive_status(u2f::KeepaliveStatus::UpNeeded);
+//! while !confirmed() {
+//!     if u2f::is_cancelled() {
+//!         break;
+//!     }
+//!     // ...
+//! }
+//! u2f::set_keepalive_status(u2f::KeepaliveStatus::Processing);
+//! ```
+//!
+//! The transport used by `lib_u2f` in the C SDK is replaced by this module,
+//! whose `u2f_transport_*` entry points are the ones `usbd_impl.c` calls.
+
+use crate::bindings::{io_usb_send_ep, G_io_app, APDU_U2F, IO_APDU_MEDIA_NONE, IO_APDU_MEDIA_U2F};
+use crate::seph::{USBD_Device, USBD_LL_PrepareReceive};
+use core::ffi::c_void;
+use core::ptr::addr_of_mut;
+
+/// Address of the FIDO interrupt endpoints
+pub const EPIN_ADDR: u8 = 0x81;
+pub const EPOUT_ADDR: u8 = 0x01;
+/// Size of the HID reports
+pub const PACKET_SIZE: usize = 64;
+
+pub const CTAPHID_PING: u8 = 0x81;
+pub const CTAPHID_MSG: u8 = 0x83;
+pub const CTAPHID_INIT: u8 = 0x86;
+pub const CTAPHID_WINK: u8 = 0x88;
+pub const CTAPHID_CANCEL: u8 = 0x91;
+pub const CTAPHID_KEEPALIVE: u8 = 0xbb;
+pub const CTAPHID_ERROR: u8 = 0xbf;
+
+const ERR_INVALID_CMD: u8 = 0x01;
+const ERR_INVALID_LEN: u8 = 0x03;
+const ERR_INVALID_SEQ: u8 = 0x04;
+const ERR_CHANNEL_BUSY: u8 = 0x06;
+const ERR_INVALID_CHANNEL: u8 = 0x0b;
+
+const BROADCAST_CID: u32 = 0xffff_ffff;
+/// Header length of the first packet of a message
+const INIT_HEADER_LEN: usize = 7;
+/// Header length of the continuation packets
+const CONT_HEADER_LEN: usize = 5;
+/// Wink is the only optional command supported
+const CAPABILITY_WINK: u8 = 0x01;
+/// Version of the CTAPHID protocol
+const PROTOCOL_VERSION: u8 = 2;
+
+/// Status sent in the keep-alive messages
+#[repr(u8)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum KeepaliveStatus {
+    Processing = 1,
+    /// Waiting for the user to confirm
+    UpNeeded = 2,
+}
+
+/// Outcome of a packet fed to [`Transport::receive`]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Action {
+    /// Nothing to do, more packets may be expected
+    None,
+    /// An APDU of this length has been received into the buffer
+    Apdu(u16),
+    /// A response is ready to be sent
+    Send,
+}
+
+/// State of the CTAPHID transport
+pub struct Transport {
+    /// Last channel allocated
+    last_cid: u32,
+    // Message being received
+    rx_cid: u32,
+    rx_cmd: u8,
+    rx_length: u16,
+    rx_offset: u16,
+    /// Next expected sequence number, or `None` when no message is being
+    /// received
+    rx_sequence: Option<u8>,
+    /// Channel of the request processed by the app
+    pending: Option<u32>,
+    cancelled: bool,
+    keepalive: KeepaliveStatus,
+    // Message being sent. Its data is borrowed from the APDU buffer, or from
+    // `small` for the replies built here.
+    tx_cid: u32,
+    tx_cmd: u8,
+    tx_data: *const u8,
+    tx_length: u16,
+    tx_offset: u16,
+    /// Sequence number of the next packet, or `None` when all of them have
+    /// been sent
+    tx_sequence: Option<u8>,
+    /// Whether a packet is in flight
+    tx_busy: bool,
+    small: [u8; 17],
+}
+
+impl Default for Transport {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Transport {
+    pub const fn new() -> Self {
+        Transport {
+            last_cid: 0,
+            rx_cid: 0,
+            rx_cmd: 0,
+            rx_length: 0,
+            rx_offset: 0,
+            rx_sequence: None,
+            pending: None,
+            cancelled: false,
+            keepalive: KeepaliveStatus::Processing,
+            tx_cid: 0,
+            tx_cmd: 0,
+            tx_data: core::ptr::null(),
+            tx_length: 0,
+            tx_offset: 0,
+            tx_sequence: None,
+            tx_busy: false,
+            small: [0; 17],
+        }
+    }
+
+    /// Whether a message is being sent
+    pub fn tx_pending(&self) -> bool {
+        self.tx_sequence.is_some()
+    }
+
+    /// Drop the rest of the message being sent
+    pub fn abort_tx(&mut self) {
+        self.tx_sequence = None;
+        self.tx_busy = false;
+    }
+
+    fn start_send(&mut self, cid: u32, cmd: u8, data: *const u8, len: u16) -> Action {
+        if self.tx_pending() {
+            // The host must not send a request before the previous reply
+            return Action::None;
+        }
+        self.tx_cid = cid;
+        self.tx_cmd = cmd;
+        self.tx_data = data;
+        self.tx_length = len;
+        self.tx_offset = 0;
+        self.tx_sequence = Some(0);
+        Action::Send
+    }
+
+    fn reply_small(&mut self, cid: u32, cmd: u8, data: &[u8]) -> Action {
+        self.small[..data.len()].copy_from_slice(data);
+        let small = self.small.as_ptr();
+        self.start_send(cid, cmd, small, data.len() as u16)
+    }
+
+    fn error(&mut self, cid: u32, code: u8) -> Action {
+        self.reply_small(cid, CTAPHID_ERROR, &[code])
+    }
+
+    fn allocate_cid(&mut self) -> u32 {
+        self.last_cid = match self.last_cid.wrapping_add(1) {
+            0 | BROADCAST_CID => 1,
+            cid => cid,
+        };
+        self.last_cid
+    }
+
+    /// Handle a report of the host, reassembling the message into `apdu`
+    pub fn receive(&mut self, packet: &[u8], apdu: &mut [u8]) -> Action {
+        if packet.len() < CONT_HEADER_LEN {
+            return Action::None;
+        }
+        let cid = u32::from_be_bytes([packet[0], packet[1], packet[2], packet[3]]);
+        let cmd = packet[4];
+        if cmd & 0x80 == 0 {
+            return self.receive_continuation(cid, cmd, &packet[CONT_HEADER_LEN..], apdu);
+        }
+        if packet.len() < INIT_HEADER_LEN {
+            return Action::None;
+        }
+        let len = u16::from_be_bytes([packet[5], packet[6]]);
+        let data = &packet[INIT_HEADER_LEN..];
+        match cmd {
+            CTAPHID_INIT => return self.init(cid, len, data),
+            // Not replied to, the reply of the request being dropped
+            CTAPHID_CANCEL => {
+                if self.pending == Some(cid) {
+                    self.cancelled = true;
+                }
+                return Action::None;
+            }
+            _ => (),
+        }
+        if cid == 0 || cid == BROADCAST_CID {
+            return self.error(cid, ERR_INVALID_CHANNEL);
+        }
+        let busy = unsafe { G_io_app.apdu_media != IO_APDU_MEDIA_NONE };
+        if self.pending.is_some() || busy || (self.rx_sequence.is_some() && self.rx_cid != cid) {
+            return self.error(cid, ERR_CHANNEL_BUSY);
+        }
+        if !matches!(cmd, CTAPHID_PING | CTAPHID_MSG | CTAPHID_WINK) {
+            return self.error(cid, ERR_INVALID_CMD);
+        }
+        if len as usize > apdu.len() || (cmd == CTAPHID_MSG && len < 4) {
+            return self.error(cid, ERR_INVALID_LEN);
+        }
+        self.rx_cid = cid;
+        self.rx_cmd = cmd;
+        self.rx_length = len;
+        self.rx_offset = 0;
+        self.rx_sequence = Some(0);
+        self.append(data, apdu)
+    }
+
+    fn receive_continuation(&mut self, cid: u32, seq: u8, data: &[u8], apdu: &mut [u8]) -> Action {
+        // Spurious packets of other channels are ignored
+        if cid != self.rx_cid {
+            return Action::None;
+        }
+        match self.rx_sequence {
+            Some(expected) if expected == seq => {
+                self.rx_sequence = Some(seq + 1);
+                self.append(data, apdu)
+            }
+            Some(_) => {
+                self.rx_sequence = None;
+                self.error(cid, ERR_INVALID_SEQ)
+            }
+            None => Action::None,
+        }
+    }
+
+    fn append(&mut self, data: &[u8], apdu: &mut [u8]) -> Action {
+        // The buffer may have been replaced by a smaller one in between
+        if self.rx_length as usize > apdu.len() {
+            self.rx_sequence = None;
+            return self.error(self.rx_cid, ERR_INVALID_LEN);
+        }
+        // Padding after the end of the message is ignored
+        let offset = self.rx_offset as usize;
+        let len = data.len().min(self.rx_length as usize - offset);
+        apdu[offset..offset + len].copy_from_slice(&data[..len]);
+        self.rx_offset += len as u16;
+        if self.rx_offset < self.rx_length {
+            return Action::None;
+        }
+        self.rx_sequence = None;
+        match self.rx_cmd {
+            CTAPHID_MSG => {
+                self.pending = Some(self.rx_cid);
+                self.cancelled = false;
+                self.keepalive = KeepaliveStatus::Processing;
+                Action::Apdu(self.rx_length)
+            }
+            CTAPHID_PING => {
+                self.start_send(self.rx_cid, CTAPHID_PING, apdu.as_ptr(), self.rx_length)
+            }
+            _ => self.start_send(self.rx_cid, CTAPHID_WINK, apdu.as_ptr(), 0),
+        }
+    }
+
+    fn init(&mut self, cid: u32, len: u16, nonce: &[u8]) -> Action {
+        if len != 8 || nonce.len() < 8 {
+            return self.error(cid, ERR_INVALID_LEN);
+        }
+        let new_cid = match cid {
+            BROADCAST_CID => self.allocate_cid(),
+            0 => return self.error(cid, ERR_INVALID_CHANNEL),
+            // Synchronization of an allocated channel, aborting what it was
+            // doing
+            _ => {
+                if self.rx_cid == cid {
+                    self.rx_sequence = None;
+                }
+                if self.pending == Some(cid) {
+                    self.cancelled = true;
+                }
+                cid
+            }
+        };
+        let mut reply = [0u8; 17];
+        reply[..8].copy_from_slice(&nonce[..8]);
+        reply[8..12].copy_from_slice(&new_cid.to_be_bytes());
+        // Protocol, then major, minor and build versions of the device
+        reply[12] = PROTOCOL_VERSION;
+        reply[16] = CAPABILITY_WINK;
+        self.reply_small(cid, CTAPHID_INIT, &reply)
+    }
+
+    /// Start sending the reply to the pending request, unless it has been
+    /// cancelled. `data` must stay in place until it has been sent.
+    pub fn reply(&mut self, data: &[u8]) -> Action {
+        let cid = match self.pending.take() {
+            Some(cid) if !self.cancelled => cid,
+            _ => return Action::None,
+        };
+        self.start_send(cid, CTAPHID_MSG, data.as_ptr(), data.len() as u16)
+    }
+
+    /// Queue a keep-alive message if a request is being processed and
+    /// nothing is being sent
+    pub fn keepalive(&mut self) -> Action {
+        match self.pending {
+            Some(cid) if !self.cancelled && !self.tx_busy => {
+                let status = self.keepalive as u8;
+                self.reply_small(cid, CTAPHID_KEEPALIVE, &[status])
+            }
+            _ => Action::None,
+        }
+    }
+
+    /// Build the next packet of the message being sent into `frame`.
+    /// Returns false if everything has been sent.
+    pub fn next_frame(&mut self, frame: &mut [u8; PACKET_SIZE]) -> bool {
+        let seq = match self.tx_sequence {
+            Some(seq) => seq,
+            None => return false,
+        };
+        frame.fill(0);
+        frame[..4].copy_from_slice(&self.tx_cid.to_be_bytes());
+        let header = if seq == 0 {
+            frame[4] = self.tx_cmd;
+            frame[5..7].copy_from_slice(&self.tx_length.to_be_bytes());
+            INIT_HEADER_LEN
+        } else {
+            frame[4] = seq - 1;
+            CONT_HEADER_LEN
+        };
+        let offset = self.tx_offset as usize;
+        let len = (PACKET_SIZE - header).min(self.tx_length as usize - offset);
+        let data = unsafe { core::slice::from_raw_parts(self.tx_data.add(offset), len) };
+        frame[header..header + len].copy_from_slice(data);
+        self.tx_offset += len as u16;
+        self.tx_sequence = match self.tx_offset < self.tx_length {
+            true => Some(seq + 1),
+            false => None,
+        };
+        true
+    }
+}
+
+// Named after the service of lib_u2f, whose address `usbd_impl.c` passes to
+// the transport functions
+#[no_mangle]
+static mut G_io_u2f: Transport = Transport::new();
+
+fn transport() -> &'static mut Transport {
+    unsafe { &mut *addr_of_mut!(G_io_u2f) }
+}
+
+/// Send the next packet, unless one is in flight
+fn flush(transport: &mut Transport) {
+    if transport.tx_busy {
+        return;
+    }
+    let mut frame = [0u8; PACKET_SIZE];
+    if transport.next_frame(&mut frame) {
+        transport.tx_busy = true;
+        unsafe { io_usb_send_ep(EPIN_ADDR as u32, frame.as_mut_ptr(), PACKET_SIZE as u16, 0) };
+    }
+}
+
+fn run(transport: &mut Transport, action: Action) {
+    match action {
+        Action::Apdu(len) => unsafe {
+            G_io_app.apdu_media = IO_APDU_MEDIA_U2F;
+            G_io_app.apdu_state = APDU_U2F;
+            G_io_app.apdu_length = len;
+        },
+        Action::Send => flush(transport),
+        Action::None => (),
+    }
+}
+
+/// Handle a report received on the FIDO OUT endpoint, whose data is
+/// `packet`. Called for the SEPH transfer events instead of the C class, as
+/// the request is reassembled into `apdu_buffer`.
+pub fn receive(apdu_buffer: &mut [u8], packet: &[u8]) {
+    unsafe { USBD_LL_PrepareReceive(addr_of_mut!(USBD_Device), EPOUT_ADDR, PACKET_SIZE as u16) };
+    let transport = transport();
+    let action = transport.receive(packet, apdu_buffer);
+    run(transport, action);
+}
+
+/// Send `data`, the reply to the request received with [`receive`]
+pub fn send(data: &[u8]) {
+    let transport = transport();
+    let action = transport.reply(data);
+    run(transport, action);
+}
+
+/// Send a keep-alive message for the request being processed, called on
+/// each ticker event
+pub fn on_ticker() {
+    let transport = transport();
+    let action = transport.keepalive();
+    run(transport, action);
+}
+
+/// Drop the reply being sent, whose last packet the host has not read in
+/// time
+pub fn abort_send() {
+    transport().abort_tx();
+}
+
+/// Whether the host has cancelled the request being processed. Its reply
+/// will not be sent.
+pub fn is_cancelled() -> bool {
+    transport().cancelled
+}
+
+/// Status reported by the keep-alive messages of the request being
+/// processed, reset to [`KeepaliveStatus::Processing`] for each request
+pub fn set_keepalive_status(status: KeepaliveStatus) {
+    transport().keepalive = status;
+}
+
+/// `u2f_transport_init` of lib_u2f, called when USB is powered on. The
+/// buffer is unused, requests being received into the buffer of `Comm`.
+///
+/// # Safety
+///
+/// `service` must be `G_io_u2f`.
+#[no_mangle]
+pub unsafe extern "C" fn u2f_transport_init(service: *mut c_void, _buffer: *mut u8, _len: u16) {
+    *(service as *mut Transport) = Transport::new();
+}
+
+/// `u2f_transport_received` of lib_u2f. Never called, [`receive`] handling
+/// the reports of the FIDO endpoint before they reach the C class.
+#[no_mangle]
+pub extern "C" fn u2f_transport_received(
+    _service: *mut c_void,
+    _buffer: *mut u8,
+    _len: u16,
+    _media: u8,
+) {
+}
+
+/// `u2f_transport_sent` of lib_u2f, called once the IN packet has been sent
+///
+/// # Safety
+///
+/// `service` must be `G_io_u2f`.
+#[no_mangle]
+pub unsafe extern "C" fn u2f_transport_sent(service: *mut c_void, _media: u8) {
+    let transport = &mut *(service as *mut Transport);
+    transport.tx_busy = false;
+    flush(transport);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    fn packet(cid: u32, cmd: u8, data: &[u8]) -> [u8; PACKET_SIZE] {
+        let mut p = [0u8; PACKET_SIZE];
+        p[..4].copy_from_slice(&cid.to_be_bytes());
+        p[4] = cmd;
+        p[5..5 + data.len()].copy_from_slice(data);
+        p
+    }
+
+    #[test]
+    fn init_and_msg() {
+        let mut t = Transport::new();
+        let mut apdu = [0u8; 260];
+        let mut frame = [0u8; PACKET_SIZE];
+        // Channel allocation
+        let init = packet(BROADCAST_CID, CTAPHID_INIT, &[0, 8, 1, 2, 3, 4, 5, 6, 7, 8]);
+        assert_eq!(t.receive(&init, &mut apdu), Action::Send);
+        assert_eq!(t.next_frame(&mut frame), true);
+        assert_eq!(&frame[..7], &[0xff, 0xff, 0xff, 0xff, CTAPHID_INIT, 0, 17]);
+        assert_eq!(&frame[7..19], &[1, 2, 3, 4, 5, 6, 7, 8, 0, 0, 0, 1]);
+        assert_eq!(t.next_frame(&mut frame), false);
+
+        // 70-byte request, in two packets
+        let mut first = packet(1, CTAPHID_MSG, &[0, 70]);
+        first[7..].fill(0xaa);
+        assert_eq!(t.receive(&first, &mut apdu), Action::None);
+        let mut next = packet(1, 0, &[]);
+        next[5..].fill(0xbb);
+        assert_eq!(t.receive(&packet(1, 1, &[]), &mut apdu), Action::Send);
+        t.next_frame(&mut frame);
+        assert_eq!(frame[4..8], [CTAPHID_ERROR, 0, 1, ERR_INVALID_SEQ]);
+
+        assert_eq!(t.receive(&first, &mut apdu), Action::None);
+        assert_eq!(t.receive(&next, &mut apdu), Action::Apdu(70));
+        assert_eq!((apdu[56], apdu[57], apdu[69]), (0xaa, 0xbb, 0xbb));
+        assert_eq!(t.keepalive(), Action::Send);
+        t.next_frame(&mut frame);
+        assert_eq!(frame[4..8], [CTAPHID_KEEPALIVE, 0, 1, 1]);
+
+        // The reply of a cancelled request is dropped
+        assert_eq!(
+            t.receive(&packet(1, CTAPHID_CANCEL, &[0, 0]), &mut apdu),
+            Action::None
+        );
+        assert_eq!(t.reply(&[0x90, 0x00]), Action::None);
+    }
+}
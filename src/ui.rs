@@ -0,0 +1,782 @@
+//! Pages of labels, icons and progress bars drawn without `lib_bagl`
+//!
+//! Widgets are laid out once, when they are created, and are drawn into a
+//! [`Compositor`], which only sends the regions they cover to the screen.
+//! No `bagl_component_t` is involved, so apps using this module can be built
+//! without the `lib_bagl` feature.
+//!
+//! A [`Review`] shows a list of pages, one at a time, with arrows telling
+//! whether there are pages before and after the current one. Button events
+//! only redraw the widgets of the pages left and shown, and the arrows whose
+//! visibility changes:
+//!
+//! ```
+//! let title = Label::new("Review", &fonts::OPEN_SANS_EXTRABOLD_11PX, Rect::new(0, 12, 128, 12), Align::Center);
+//! let amount = Label::new(&amount_text, &fonts::OPEN_SANS_REGULAR_11PX, Rect::new(0, 28, 128, 12), Align::Center);
+//! let approve = Label::new("Approve", &fonts::OPEN_SANS_EXTRABOLD_11PX, Rect::new(0, 26, 128, 12), Align::Center);
+//! let pages: [&[Widget]; 2] = [&[Widget::Label(title), Widget::Label(amount)], &[Widget::Label(approve)]];
+//!
+//! let mut screen = Compositor::new();
+//! let mut review = Review::new(&pages);
+//! review.show(&mut screen);
+//! loop {
+//!     if let io::Event::Button(button) = comm.next_event::<u8>() {
+//!         if review.on_button(&mut screen, button) == Some(1) {
+//!             break;
+//!         }
+//!     }
+//! }
+//! ```
+//!
+//! Pages can also be rendered ahead, while the app waits for events, into
+//! frames it lends for the duration of a scope: the pages next to the one
+//! shown, the one in the direction of the last move first, are drawn one
+//! widget per [`idle`](crate::idle) unit. A press then swaps a whole frame
+//! in, sent with a single bitmap, instead of laying out and drawing the
+//! page after the event:
+//!
+//! ```
+//! let mut frames = [Frame::EMPTY; 2];
+//! let approved = review.prerendered(&mut frames, |review| loop {
+//!     if let io::Event::Button(button) = comm.next_event::<u8>() {
+//!         if let Some(index) = review.on_button(&mut screen, button) {
+//!             break index == 1;
+//!         }
+//!     }
+//! });
+//! ```
+//!
+//! Each frame takes `size_of::<Frame>()` bytes, about 1 KiB: with a single
+//! one, only the page ahead is prerendered. The screen must only be drawn
+//! by the review within the scope, as the page left is kept from it.
+
+use crate::buttons::ButtonEvent;
+use crate::screen::{Compositor, Rect, SCREEN_HEIGHT, SCREEN_WIDTH};
+use crate::{pic_cached, pic_slice, pic_str};
+
+/// 1 bpp font, in the format of `lib_bagl`: the rows of each character are
+/// packed, least significant bit first, and start on a byte
+pub struct Font {
+    pub height: u8,
+    /// Space between two characters
+    pub kerning: u8,
+    /// First character of `glyphs`
+    pub first: u8,
+    /// Width and offset in `bitmap` of each character
+    pub glyphs: &'static [(u8, u16)],
+    pub bitmap: &'static [u8],
+}
+
+/// Fonts of `lib_bagl`, exported by build.rs
+pub mod fonts {
+    use super::Font;
+
+    include!(concat!(env!("OUT_DIR"), "/ui_fonts.rs"));
+}
+
+impl Font {
+    /// Width and bitmap of character `c`, if the font has it
+    fn glyph(&self, c: u8) -> Option<(u32, &[u8])> {
+        let (width, offset) = *pic_slice(self.glyphs).get(c.checked_sub(self.first)? as usize)?;
+        Some((width as u32, &pic_slice(self.bitmap)[offset as usize..]))
+    }
+
+    /// Width of `text` drawn on a single line. Characters missing from the
+    /// font are skipped.
+    pub fn text_width(&self, text: &str) -> u32 {
+        let width: u32 = text
+            .bytes()
+            .filter_map(|c| self.glyph(c))
+            .map(|(w, _)| w + self.kerning as u32)
+            .sum();
+        width.saturating_sub(self.kerning as u32)
+    }
+}
+
+/// Line breaks of a text wrapped to a width, computed in a single pass over
+/// the text so that long fields (such as hex calldata) are laid out once,
+/// then paged through for free
+///
+/// Lines are broken after the last space fitting on them, or anywhere in
+/// words too long for a line, and at newlines. At most `N` lines are kept,
+/// [`is_complete`](Self::is_complete) telling whether the text was cut.
+/// Texts are limited to 64 KiB.
+///
+/// ```
+/// let layout = TextLayout::<32>::new(calldata_hex, font, 120);
+/// for (i, line) in layout.page(index, 3).enumerate() {
+///     Label::new(line, font, Rect::new(4, 12 * i as u32, 120, 12), Align::Left).draw(screen);
+/// }
+/// ```
+pub struct TextLayout<'a, const N: usize> {
+    text: &'a str,
+    /// End offset of each line
+    ends: [u16; N],
+    lines: usize,
+    complete: bool,
+}
+
+impl<'a, const N: usize> TextLayout<'a, N> {
+    pub fn new(text: &'a str, font: &Font, width: u32) -> Self {
+        assert!(text.len() <= u16::MAX as usize);
+        let mut layout = TextLayout {
+            text,
+            ends: [0; N],
+            lines: 0,
+            complete: true,
+        };
+        let chars = pic_str(text);
+        let bytes = chars.as_bytes();
+        let glyphs = pic_slice(font.glyphs);
+        // Width of a line once `c` is added to it, as drawn by `Label`
+        let advance = |line: u32, c: u8| match c
+            .checked_sub(font.first)
+            .and_then(|i| glyphs.get(i as usize))
+        {
+            Some(&(w, _)) if line == 0 => w as u32,
+            Some(&(w, _)) => line + font.kerning as u32 + w as u32,
+            None => line,
+        };
+        let (mut start, mut i, mut line, mut space) = (0, 0, 0, None);
+        while i < bytes.len() {
+            let c = bytes[i];
+            let end = if c == b'\n' {
+                i
+            } else {
+                let next = advance(line, c);
+                if next <= width || i == start || !chars.is_char_boundary(i) {
+                    line = next;
+                    if c == b' ' {
+                        space = Some(i);
+                    }
+                    i += 1;
+                    continue;
+                }
+                match space {
+                    Some(space) if c != b' ' => space,
+                    _ => i,
+                }
+            };
+            if !layout.push(end) {
+                return layout;
+            }
+            // The space or newline ending the line is not drawn. The end of
+            // a word cut at a space is walked again, on its new line.
+            start = end + matches!(bytes[end], b' ' | b'\n') as usize;
+            (i, line, space) = (start, 0, None);
+        }
+        layout.push(bytes.len());
+        layout
+    }
+
+    fn push(&mut self, end: usize) -> bool {
+        if self.lines == N {
+            self.complete = false;
+            return false;
+        }
+        self.ends[self.lines] = end as u16;
+        self.lines += 1;
+        true
+    }
+
+    /// Number of lines
+    pub fn lines(&self) -> usize {
+        self.lines
+    }
+
+    /// Whether the whole text fit in the `N` lines
+    pub fn is_complete(&self) -> bool {
+        self.complete
+    }
+
+    /// Text of line `index`, without the space or newline ending it
+    pub fn line(&self, index: usize) -> &'a str {
+        let start = match index {
+            0 => 0,
+            _ => {
+                let end = self.ends[index - 1] as usize;
+                let skip = pic_str(self.text).as_bytes().get(end);
+                end + matches!(skip, Some(b' ' | b'\n')) as usize
+            }
+        };
+        &self.text[start..self.ends[index] as usize]
+    }
+
+    /// Number of pages of `lines_per_page` lines
+    pub fn pages(&self, lines_per_page: usize) -> usize {
+        self.lines.div_ceil(lines_per_page).max(1)
+    }
+
+    /// Lines of page `index`
+    pub fn page(&self, index: usize, lines_per_page: usize) -> impl Iterator<Item = &'a str> + '_ {
+        let start = (index * lines_per_page).min(self.lines);
+        let end = (start + lines_per_page).min(self.lines);
+        (start..end).map(|i| self.line(i))
+    }
+}
+
+#[derive(Copy, Clone, PartialEq, Eq)]
+pub enum Align {
+    Left,
+    Center,
+    Right,
+}
+
+/// Single line of text, cut to the characters fitting in its area
+#[derive(Copy, Clone)]
+pub struct Label<'a> {
+    text: &'a str,
+    font: &'a Font,
+    rect: Rect,
+    /// Position of the text, and number of bytes of it drawn
+    x: u32,
+    y: u32,
+    len: usize,
+}
+
+impl<'a> Label<'a> {
+    /// Lay out `text` in `rect`, vertically centered
+    pub fn new(text: &'a str, font: &'a Font, rect: Rect, align: Align) -> Self {
+        let (mut width, mut len) = (0, 0);
+        for c in pic_str(text).bytes() {
+            if let Some((w, _)) = font.glyph(c) {
+                let start = if width == 0 {
+                    0
+                } else {
+                    width + font.kerning as u32
+                };
+                if start + w > rect.width {
+                    break;
+                }
+                width = start + w;
+            }
+            len += 1;
+        }
+        let x = match align {
+            Align::Left => rect.x,
+            Align::Center => rect.x + (rect.width - width) / 2,
+            Align::Right => rect.x + rect.width - width,
+        };
+        let y = rect.y + rect.height.saturating_sub(font.height as u32) / 2;
+        Label {
+            text,
+            font,
+            rect,
+            x,
+            y,
+            len,
+        }
+    }
+
+    fn draw(&self, screen: &mut Compositor) {
+        screen.fill_rect(self.rect, false);
+        let font = unsafe { &*pic_cached(self.font) };
+        let mut x = self.x;
+        for c in pic_str(self.text).bytes().take(self.len) {
+            if let Some((width, bitmap)) = font.glyph(c) {
+                screen.draw_bitmap(x, self.y, width, font.height as u32, bitmap);
+                x += width + font.kerning as u32;
+            }
+        }
+    }
+}
+
+/// 1 bpp bitmap, as drawn by [`Compositor::draw_bitmap`]
+#[derive(Copy, Clone)]
+pub struct Icon<'a> {
+    rect: Rect,
+    bitmap: &'a [u8],
+}
+
+impl<'a> Icon<'a> {
+    pub const fn new(x: u32, y: u32, width: u32, height: u32, bitmap: &'a [u8]) -> Self {
+        Icon {
+            rect: Rect::new(x, y, width, height),
+            bitmap,
+        }
+    }
+
+    fn draw(&self, screen: &mut Compositor) {
+        let r = self.rect;
+        screen.draw_bitmap(r.x, r.y, r.width, r.height, pic_slice(self.bitmap));
+    }
+}
+
+/// Framed bar filled in proportion of `value` over `max`
+#[derive(Copy, Clone)]
+pub struct ProgressBar {
+    rect: Rect,
+    value: u32,
+    max: u32,
+}
+
+impl ProgressBar {
+    pub const fn new(rect: Rect, max: u32) -> Self {
+        ProgressBar {
+            rect,
+            value: 0,
+            max,
+        }
+    }
+
+    /// Inside of the frame
+    fn inner(&self) -> Rect {
+        let r = self.rect;
+        Rect::new(
+            r.x + 1,
+            r.y + 1,
+            r.width.saturating_sub(2),
+            r.height.saturating_sub(2),
+        )
+    }
+
+    fn filled(&self, value: u32) -> u32 {
+        let width = self.inner().width;
+        match self.max {
+            0 => width,
+            max => (width as u64 * value.min(max) as u64 / max as u64) as u32,
+        }
+    }
+
+    fn draw(&self, screen: &mut Compositor) {
+        let (r, inner) = (self.rect, self.inner());
+        screen.fill_rect(r, true);
+        let filled = self.filled(self.value);
+        screen.fill_rect(
+            Rect::new(
+                inner.x + filled,
+                inner.y,
+                inner.width - filled,
+                inner.height,
+            ),
+            false,
+        );
+    }
+
+    /// Set the value, only redrawing the part of the bar which changes
+    pub fn set_value(&mut self, screen: &mut Compositor, value: u32) {
+        let (old, new) = (self.filled(self.value), self.filled(value));
+        self.value = value;
+        let inner = self.inner();
+        let (start, end) = (old.min(new), old.max(new));
+        screen.fill_rect(
+            Rect::new(inner.x + start, inner.y, end - start, inner.height),
+            new > old,
+        );
+    }
+}
+
+#[derive(Copy, Clone)]
+pub enum Widget<'a> {
+    Label(Label<'a>),
+    Icon(Icon<'a>),
+    Progress(ProgressBar),
+}
+
+impl Widget<'_> {
+    /// Area drawn by the widget, entirely
+    pub fn rect(&self) -> Rect {
+        match self {
+            Widget::Label(label) => label.rect,
+            Widget::Icon(icon) => icon.rect,
+            Widget::Progress(bar) => bar.rect,
+        }
+    }
+
+    pub fn draw(&self, screen: &mut Compositor) {
+        match self {
+            Widget::Label(label) => label.draw(screen),
+            Widget::Icon(icon) => icon.draw(screen),
+            Widget::Progress(bar) => bar.draw(screen),
+        }
+    }
+}
+
+const ARROW_WIDTH: u32 = 4;
+const ARROW_HEIGHT: u32 = 7;
+const ARROW_Y: u32 = (SCREEN_HEIGHT as u32 - ARROW_HEIGHT) / 2;
+const LEFT_ARROW: [u8; 4] = [0x48, 0x12, 0x42, 0x08];
+const RIGHT_ARROW: [u8; 4] = [0x21, 0x84, 0x24, 0x01];
+
+/// Draw or erase the arrows telling whether there are pages before and
+/// after the one shown
+pub(crate) fn draw_arrows(screen: &mut Compositor, left: bool, right: bool) {
+    let x = SCREEN_WIDTH as u32 - 2 - ARROW_WIDTH;
+    for (x, bitmap, shown) in [(2, &LEFT_ARROW, left), (x, &RIGHT_ARROW, right)] {
+        match shown {
+            true => screen.draw_bitmap(x, ARROW_Y, ARROW_WIDTH, ARROW_HEIGHT, bitmap),
+            false => screen.fill_rect(Rect::new(x, ARROW_Y, ARROW_WIDTH, ARROW_HEIGHT), false),
+        }
+    }
+}
+
+fn page<'a>(pages: &'a [&'a [Widget<'a>]], index: usize) -> &'a [Widget<'a>] {
+    pic_slice(pic_slice(pages)[index])
+}
+
+/// Page of a review drawn offscreen, lent to [`Review::prerendered`]
+pub struct Frame {
+    /// Index of the page held, `NO_PAGE` for a free frame
+    page: usize,
+    /// Units done: clearing, one per widget, then drawing the arrows
+    drawn: usize,
+    screen: Compositor,
+}
+
+const NO_PAGE: usize = usize::MAX;
+
+impl Frame {
+    pub const EMPTY: Frame = Frame {
+        page: NO_PAGE,
+        drawn: 0,
+        screen: Compositor::new(),
+    };
+}
+
+/// Pages and frames of the review rendered ahead, set for the duration of
+/// [`Review::prerendered`]
+struct Prerender {
+    pages: *const [&'static [Widget<'static>]],
+    frames: *mut [Frame],
+    /// Most likely page to be shown next, then the other one
+    wanted: [Option<usize>; 2],
+}
+
+// Apps are single-threaded
+static mut PRERENDER: Option<Prerender> = None;
+
+fn prerender() -> &'static mut Option<Prerender> {
+    unsafe { &mut *core::ptr::addr_of_mut!(PRERENDER) }
+}
+
+impl Prerender {
+    fn pages(&self) -> &[&[Widget<'_>]] {
+        unsafe { &*self.pages }
+    }
+
+    fn frames(&mut self) -> &mut [Frame] {
+        unsafe { &mut *self.frames }
+    }
+
+    fn units(&self, index: usize) -> usize {
+        page(self.pages(), index).len() + 2
+    }
+
+    /// Frame holding page `index`, fully drawn
+    fn ready(&mut self, index: usize) -> Option<&mut Frame> {
+        let units = self.units(index);
+        self.frames()
+            .iter_mut()
+            .find(|f| f.page == index && f.drawn == units)
+    }
+
+    /// Render the pages next to `index`, `forward` telling which one to
+    /// render first, in the frames holding none of them
+    fn retarget(&mut self, index: usize, forward: bool) {
+        let last = self.pages().len() - 1;
+        let next = (index < last).then_some(index + 1);
+        let previous = index.checked_sub(1);
+        let mut wanted = if forward {
+            [next, previous]
+        } else {
+            [previous, next]
+        };
+        if wanted[0].is_none() {
+            wanted.swap(0, 1);
+        }
+        // The frames only hold the most likely pages
+        let count = self.frames().len();
+        for w in wanted.iter_mut().skip(count) {
+            *w = None;
+        }
+        self.wanted = wanted;
+        for page in wanted.into_iter().flatten() {
+            let frames = self.frames();
+            if frames.iter().any(|f| f.page == page) {
+                continue;
+            }
+            if let Some(frame) = frames.iter_mut().find(|f| !wanted.contains(&Some(f.page))) {
+                frame.page = page;
+                frame.drawn = 0;
+            }
+        }
+        if wanted
+            .into_iter()
+            .flatten()
+            .any(|page| self.ready(page).is_none())
+        {
+            // Without a free slot, pages are only drawn when shown
+            let _ = crate::idle::register(prerender_unit);
+        }
+    }
+}
+
+/// Draw one unit of a page wanted and not fully drawn yet
+fn prerender_unit() -> bool {
+    let Some(prerender) = prerender() else {
+        return false;
+    };
+    let pages = unsafe { &*prerender.pages };
+    let last = pages.len() - 1;
+    for page_index in prerender.wanted.into_iter().flatten() {
+        let widgets = page(pages, page_index);
+        let frames = prerender.frames();
+        let Some(frame) = frames.iter_mut().find(|f| f.page == page_index) else {
+            continue;
+        };
+        match frame.drawn {
+            0 => frame.screen.clear(),
+            n if n <= widgets.len() => widgets[n - 1].draw(&mut frame.screen),
+            n if n == widgets.len() + 1 => {
+                draw_arrows(&mut frame.screen, page_index > 0, page_index < last)
+            }
+            _ => continue,
+        }
+        frame.drawn += 1;
+        return true;
+    }
+    false
+}
+
+/// Pages shown one at a time, the left and right buttons going to the
+/// previous and next ones
+pub struct Review<'a> {
+    pages: &'a [&'a [Widget<'a>]],
+    index: usize,
+}
+
+impl<'a> Review<'a> {
+    pub fn new(pages: &'a [&'a [Widget<'a>]]) -> Self {
+        assert!(!pages.is_empty());
+        Review { pages, index: 0 }
+    }
+
+    /// Index of the page shown
+    pub fn index(&self) -> usize {
+        self.index
+    }
+
+    fn page(&self, index: usize) -> &'a [Widget<'a>] {
+        page(self.pages, index)
+    }
+
+    fn draw_arrows(&self, screen: &mut Compositor, index: usize) {
+        draw_arrows(screen, index > 0, index < self.pages.len() - 1);
+    }
+
+    /// Frames rendered ahead for this review, if within its
+    /// [`prerendered`](Review::prerendered) scope
+    fn prerender(&self) -> Option<&'static mut Prerender> {
+        prerender()
+            .as_mut()
+            .filter(|p| core::ptr::addr_eq(p.pages, self.pages as *const [&[Widget]]))
+    }
+
+    /// Run `f` with the pages next to the one shown rendered ahead into
+    /// `frames`, while the app waits for events
+    pub fn prerendered<R>(&mut self, frames: &mut [Frame], f: impl FnOnce(&mut Self) -> R) -> R {
+        frames.iter_mut().for_each(|frame| frame.page = NO_PAGE);
+        // The pages outlive the scope, after which they are forgotten
+        let pages = unsafe {
+            core::mem::transmute::<*const [&[Widget]], *const [&'static [Widget<'static>]]>(
+                self.pages,
+            )
+        };
+        let previous = prerender().replace(Prerender {
+            pages,
+            frames: frames as *mut [Frame],
+            wanted: [None; 2],
+        });
+        if let Some(prerender) = self.prerender() {
+            prerender.retarget(self.index, true);
+        }
+        let result = f(self);
+        crate::idle::unregister(prerender_unit);
+        *prerender() = previous;
+        if prerender().is_some() {
+            let _ = crate::idle::register(prerender_unit);
+        }
+        result
+    }
+
+    /// Draw the whole screen
+    pub fn show(&self, screen: &mut Compositor) {
+        screen.clear();
+        for widget in self.page(self.index) {
+            widget.draw(screen);
+        }
+        self.draw_arrows(screen, self.index);
+        screen.update();
+    }
+
+    /// Go to page `index`, erasing the widgets of the page shown which are
+    /// not covered by those of the new one
+    pub fn go_to(&mut self, screen: &mut Compositor, index: usize) {
+        if let Some(prerender) = self.prerender() {
+            let forward = index > self.index;
+            let units = prerender.units(self.index);
+            if let Some(frame) = prerender.ready(index) {
+                // The page left becomes a frame, for going back
+                screen.swap_frame(&mut frame.screen);
+                frame.page = self.index;
+                frame.drawn = units;
+                self.index = index;
+                prerender.retarget(index, forward);
+                screen.update();
+                return;
+            }
+            prerender.retarget(index, forward);
+        }
+        let (old, new) = (self.page(self.index), self.page(index));
+        for widget in old {
+            if !new.iter().any(|w| w.rect() == widget.rect()) {
+                screen.fill_rect(widget.rect(), false);
+            }
+        }
+        for widget in new {
+            widget.draw(screen);
+        }
+        let last = self.pages.len() - 1;
+        if (self.index == 0) != (index == 0) || (self.index == last) != (index == last) {
+            self.draw_arrows(screen, index);
+        }
+        self.index = index;
+        screen.update();
+    }
+
+    /// Handle a button event. Holding a button scrolls through the pages.
+    /// Returns the index of the page shown when both buttons are released.
+    pub fn on_button(&mut self, screen: &mut Compositor, event: ButtonEvent) -> Option<usize> {
+        match event {
+            ButtonEvent::LeftButtonRelease
+            | ButtonEvent::LeftButtonLongPress
+            | ButtonEvent::LeftButtonRepeat
+                if self.index > 0 =>
+            {
+                self.go_to(screen, self.index - 1)
+            }
+            ButtonEvent::RightButtonRelease
+            | ButtonEvent::RightButtonLongPress
+            | ButtonEvent::RightButtonRepeat
+                if self.index + 1 < self.pages.len() =>
+            {
+                self.go_to(screen, self.index + 1)
+            }
+            ButtonEvent::BothButtonsRelease => return Some(self.index),
+            _ => (),
+        }
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn layout() {
+        let font = &fonts::OPEN_SANS_REGULAR_11PX;
+        let width = font.text_width("Hello");
+        let label = Label::new("Hello", font, Rect::new(10, 0, 100, 20), Align::Center);
+        assert_eq!(
+            (label.x, label.y, label.len),
+            (10 + (100 - width) / 2, 4, 5)
+        );
+        let label = Label::new("Hello", font, Rect::new(0, 0, width - 1, 12), Align::Right);
+        assert_eq!(label.len, 4);
+    }
+
+    #[test]
+    fn text_layout() {
+        let font = &fonts::OPEN_SANS_REGULAR_11PX;
+        let layout = TextLayout::<4>::new("ab cd ef\ngh", font, font.text_width("ab cd"));
+        assert_eq!((layout.lines(), layout.is_complete()), (3, true));
+        let lines: [&str; 3] = core::array::from_fn(|i| layout.line(i));
+        assert_eq!(lines, ["ab cd", "ef", "gh"]);
+
+        // Hex is cut anywhere, the digits having different widths
+        let layout = TextLayout::<4>::new("01230123012", font, font.text_width("0123"));
+        assert_eq!((layout.lines(), layout.pages(2)), (3, 2));
+        let mut page = layout.page(1, 2);
+        assert_eq!((page.next(), page.next()), (Some("012"), None));
+
+        let layout = TextLayout::<2>::new("01230123012", font, font.text_width("0123"));
+        assert_eq!((layout.lines(), layout.is_complete()), (2, false));
+        assert_eq!(layout.line(1), "0123");
+    }
+
+    #[test]
+    fn glyph_cache() {
+        // 3x2 glyph: X.X / .X.
+        const GLYPH: [u8; 1] = [0b0001_0101];
+        let mut slots = [crate::screen::CachedGlyph::EMPTY; 1];
+        let mut glyphs = crate::screen::GlyphCache::new(&mut slots);
+        let mut screen = Compositor::new();
+        let mut direct = Compositor::new();
+        for x in [0, 126] {
+            glyphs.draw(&mut screen, x, 1, 3, 2, &GLYPH);
+            direct.draw_bitmap(x, 1, 3, 2, &GLYPH);
+        }
+        for y in 0..4 {
+            for x in (0..4).chain(124..128) {
+                assert_eq!(screen.pixel(x, y), direct.pixel(x, y));
+            }
+        }
+        assert_eq!(screen.pixel(2, 1), true);
+        assert_eq!(screen.pixel(1, 2), true);
+    }
+
+    #[test]
+    fn progress() {
+        let mut screen = Compositor::new();
+        let mut bar = ProgressBar::new(Rect::new(0, 0, 12, 4), 10);
+        Widget::Progress(bar).draw(&mut screen);
+        assert_eq!((screen.pixel(0, 0), screen.pixel(1, 1)), (true, false));
+        bar.set_value(&mut screen, 5);
+        assert_eq!((screen.pixel(5, 1), screen.pixel(6, 1)), (true, false));
+        bar.set_value(&mut screen, 2);
+        assert_eq!((screen.pixel(2, 2), screen.pixel(3, 2)), (true, false));
+    }
+
+    static mut FRAMES: [Frame; 2] = [Frame::EMPTY; 2];
+
+    #[test]
+    fn prerender_next_page() {
+        let font = &fonts::OPEN_SANS_REGULAR_11PX;
+        let title = [Widget::Label(Label::new(
+            "Review",
+            font,
+            Rect::new(0, 12, 128, 12),
+            Align::Center,
+        ))];
+        let approve = [Widget::Label(Label::new(
+            "Approve",
+            font,
+            Rect::new(0, 26, 128, 12),
+            Align::Center,
+        ))];
+        let pages: [&[Widget]; 2] = [&title, &approve];
+        let mut review = Review::new(&pages);
+        let frames = unsafe { &mut *core::ptr::addr_of_mut!(FRAMES) };
+        let units = review.prerendered(frames, |_| {
+            let mut units = 0;
+            while prerender_unit() {
+                units += 1;
+            }
+            units
+        });
+        // Cleared, the label, then the arrows
+        assert_eq!((units, frames[0].page, frames[1].page), (3, 1, NO_PAGE));
+        let mut direct = Compositor::new();
+        approve[0].draw(&mut direct);
+        draw_arrows(&mut direct, true, false);
+        let same = (0..SCREEN_HEIGHT as u32).all(|y| {
+            (0..SCREEN_WIDTH as u32).all(|x| frames[0].screen.pixel(x, y) == direct.pixel(x, y))
+        });
+        assert_eq!(same, true);
+        assert_eq!(prerender_unit(), false);
+    }
+}
@@ -0,0 +1,571 @@
+//! Native USB device core, enabled by the `native_usb` feature
+//!
+//! The STM32 device library routes every USB event from the MCU through
+//! `usbd_core.c`, `usbd_ctlreq.c` and the class callbacks of `usbd_impl.c`,
+//! with its state in `USBD_Device`. This module replaces the whole stack
+//! for the configuration of most apps, a single generic HID interface
+//! carrying the APDUs:
+//!
+//! - the descriptors are `static` tables, looked up by a `match` on the
+//!   request,
+//! - control requests are decoded into a [`Control`] action in one pass,
+//!   and sent back from the descriptor tables without being copied,
+//! - the data endpoints are dispatched inline: OUT reports go straight from
+//!   the SPI buffer to the HID framing of `os_io_usb.c`, which stays in C
+//!   as `io_usb_hid_send` uses it for the replies.
+//!
+//! WebUSB and CCID still need the C stack, and cannot be enabled along
+//! with this feature.
+
+use crate::bindings::{
+    apdu_buffer_t, io_usb_send_apdu_data, G_io_app, APDU_USB_HID, IO_APDU_MEDIA_NONE,
+    IO_APDU_MEDIA_USB_HID, IO_USB_MAX_ENDPOINTS, SEPROXYHAL_TAG_USB_CONFIG,
+    SEPROXYHAL_TAG_USB_CONFIG_ADDR, SEPROXYHAL_TAG_USB_CONFIG_CONNECT,
+    SEPROXYHAL_TAG_USB_CONFIG_DISCONNECT, SEPROXYHAL_TAG_USB_CONFIG_ENDPOINTS,
+    SEPROXYHAL_TAG_USB_CONFIG_TYPE_CONTROL, SEPROXYHAL_TAG_USB_CONFIG_TYPE_DISABLED,
+    SEPROXYHAL_TAG_USB_CONFIG_TYPE_INTERRUPT, SEPROXYHAL_TAG_USB_EP_PREPARE,
+    SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_OUT,
+    SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_STALL, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_UNSTALL,
+    SEPROXYHAL_TAG_USB_EP_XFER_IN, SEPROXYHAL_TAG_USB_EP_XFER_OUT,
+    SEPROXYHAL_TAG_USB_EP_XFER_SETUP, SEPROXYHAL_TAG_USB_EVENT_RESET,
+};
+use crate::seph::seph_send;
+use core::ptr::addr_of_mut;
+
+const EP0_SIZE: usize = 64;
+const HID_INTF: u16 = 0;
+const HID_EPIN_ADDR: u8 = 0x82;
+const HID_EPOUT_ADDR: u8 = 0x02;
+const HID_EP_SIZE: u8 = 0x40;
+
+#[cfg(target_os = "nanos")]
+const PID: u16 = 0x1001;
+#[cfg(target_os = "nanox")]
+const PID: u16 = 0x4001;
+// Host builds emulate a Nano S Plus
+#[cfg(any(target_os = "nanosplus", feature = "host"))]
+const PID: u16 = 0x5001;
+
+/// Product string, set by build.rs from USB_PRODUCT or the name of the device
+const PRODUCT: &str = env!("USB_PRODUCT");
+
+// Standard requests
+const GET_STATUS: u8 = 0x00;
+const CLEAR_FEATURE: u8 = 0x01;
+const SET_FEATURE: u8 = 0x03;
+const SET_ADDRESS: u8 = 0x05;
+const GET_DESCRIPTOR: u8 = 0x06;
+const GET_CONFIGURATION: u8 = 0x08;
+const SET_CONFIGURATION: u8 = 0x09;
+const GET_INTERFACE: u8 = 0x0a;
+const SET_INTERFACE: u8 = 0x0b;
+
+// HID class requests
+const HID_GET_IDLE: u8 = 0x02;
+const HID_GET_PROTOCOL: u8 = 0x03;
+const HID_SET_IDLE: u8 = 0x0a;
+const HID_SET_PROTOCOL: u8 = 0x0b;
+
+#[rustfmt::skip]
+static DEVICE_DESC: [u8; 18] = [
+    0x12, // bLength
+    0x01, // bDescriptorType: device
+    0x00, 0x02, // bcdUSB 2.00
+    0x00, // bDeviceClass
+    0x00, // bDeviceSubClass
+    0x00, // bDeviceProtocol
+    EP0_SIZE as u8,
+    0x97, 0x2c, // idVendor
+    PID as u8, (PID >> 8) as u8,
+    0x01, 0x02, // bcdDevice 2.01
+    0x01, // iManufacturer
+    0x02, // iProduct
+    0x03, // iSerialNumber
+    0x01, // bNumConfigurations
+];
+
+#[rustfmt::skip]
+static REPORT_DESC: [u8; 34] = [
+    0x06, 0xa0, 0xff, // Usage page (vendor defined)
+    0x09, 0x01, // Usage ID (vendor defined)
+    0xa1, 0x01, // Collection (application)
+    // Input report
+    0x09, 0x03, // Usage ID (vendor defined)
+    0x15, 0x00, // Logical minimum (0)
+    0x26, 0xff, 0x00, // Logical maximum (255)
+    0x75, 0x08, // Report size (8 bits)
+    0x95, HID_EP_SIZE, // Report count
+    0x81, 0x08, // Input (data, variable, absolute)
+    // Output report
+    0x09, 0x04, // Usage ID (vendor defined)
+    0x15, 0x00, // Logical minimum (0)
+    0x26, 0xff, 0x00, // Logical maximum (255)
+    0x75, 0x08, // Report size (8 bits)
+    0x95, HID_EP_SIZE, // Report count
+    0x91, 0x08, // Output (data, variable, absolute)
+    0xc0, // End collection
+];
+
+/// Offset of the HID descriptor in the configuration descriptor
+const HID_DESC_OFFSET: usize = 18;
+
+#[rustfmt::skip]
+static CONFIG_DESC: [u8; 41] = [
+    0x09, // bLength
+    0x02, // bDescriptorType: configuration
+    41, 0x00, // wTotalLength
+    0x01, // bNumInterfaces
+    0x01, // bConfigurationValue
+    0x02, // iConfiguration
+    0xc0, // bmAttributes: bus powered
+    0x32, // bMaxPower: 100 mA
+    // Interface
+    0x09, // bLength
+    0x04, // bDescriptorType: interface
+    HID_INTF as u8,
+    0x00, // bAlternateSetting
+    0x02, // bNumEndpoints
+    0x03, // bInterfaceClass: HID
+    0x00, // bInterfaceSubClass: no boot
+    0x00, // bInterfaceProtocol: none
+    0x02, // iInterface
+    // HID
+    0x09, // bLength
+    0x21, // bDescriptorType: HID
+    0x11, 0x01, // bcdHID 1.11
+    0x00, // bCountryCode
+    0x01, // bNumDescriptors
+    0x22, // bDescriptorType: report
+    REPORT_DESC.len() as u8, 0x00,
+    // Endpoint IN
+    0x07, // bLength
+    0x05, // bDescriptorType: endpoint
+    HID_EPIN_ADDR,
+    0x03, // bmAttributes: interrupt
+    HID_EP_SIZE, 0x00,
+    0x01, // bInterval
+    // Endpoint OUT
+    0x07, // bLength
+    0x05, // bDescriptorType: endpoint
+    HID_EPOUT_ADDR,
+    0x03, // bmAttributes: interrupt
+    HID_EP_SIZE, 0x00,
+    0x01, // bInterval
+];
+
+/// String descriptor of an ASCII string
+const fn string_desc<const N: usize>(s: &str) -> [u8; N] {
+    let s = s.as_bytes();
+    assert!(N == 2 + 2 * s.len());
+    let mut desc = [0u8; N];
+    desc[0] = N as u8;
+    desc[1] = 0x03;
+    let mut i = 0;
+    while i < s.len() {
+        desc[2 + 2 * i] = s[i];
+        i += 1;
+    }
+    desc
+}
+
+static LANGID_DESC: [u8; 4] = [0x04, 0x03, 0x09, 0x04];
+static MANUFACTURER_DESC: [u8; 14] = string_desc("Ledger");
+static PRODUCT_DESC: [u8; 2 + 2 * PRODUCT.len()] = string_desc(PRODUCT);
+static SERIAL_DESC: [u8; 10] = string_desc("0001");
+
+/// Standard or HID descriptor requested with `w_value`, the type in the high
+/// byte and the index in the low one
+fn descriptor(w_value: u16) -> Option<&'static [u8]> {
+    Some(match w_value {
+        0x0100 => &DEVICE_DESC,
+        0x0200 => &CONFIG_DESC,
+        0x0300 => &LANGID_DESC,
+        0x0301 => &MANUFACTURER_DESC,
+        0x0302 | 0x0304 | 0x0305 => &PRODUCT_DESC,
+        0x0303 => &SERIAL_DESC,
+        0x2100 => &CONFIG_DESC[HID_DESC_OFFSET..HID_DESC_OFFSET + 9],
+        0x2200 => &REPORT_DESC,
+        _ => return None,
+    })
+}
+
+/// Response to a control request
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+enum Control {
+    /// Data stage from a descriptor, truncated to the requested length
+    Send(&'static [u8]),
+    /// Data stage of at most 2 bytes, built for the request
+    SendSmall([u8; 2], usize),
+    /// Status stage only, after `Effect`
+    Status(Effect),
+    Stall,
+}
+
+/// Action of a request without data stage
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+enum Effect {
+    None,
+    SetAddress(u8),
+    SetConfiguration(u8),
+    ClearStall(u8),
+    SetStall(u8),
+}
+
+struct Setup {
+    request_type: u8,
+    request: u8,
+    value: u16,
+    index: u16,
+    length: u16,
+}
+
+impl Setup {
+    fn parse(p: &[u8]) -> Option<Setup> {
+        let p: &[u8; 8] = p.get(..8)?.try_into().ok()?;
+        Some(Setup {
+            request_type: p[0],
+            request: p[1],
+            value: u16::from_le_bytes([p[2], p[3]]),
+            index: u16::from_le_bytes([p[4], p[5]]),
+            length: u16::from_le_bytes([p[6], p[7]]),
+        })
+    }
+}
+
+/// Decode a request, `configuration` being the current configuration
+fn control(setup: &Setup, configuration: u8) -> Control {
+    let small = |b: &[u8]| {
+        let mut data = [0; 2];
+        data[..b.len()].copy_from_slice(b);
+        Control::SendSmall(data, b.len())
+    };
+    let hid_intf = setup.index & 0xff == HID_INTF;
+    // Type and recipient, with the direction left out
+    match (setup.request_type & 0x7f, setup.request) {
+        // Device
+        (0x00, GET_DESCRIPTOR) => descriptor(setup.value).map_or(Control::Stall, Control::Send),
+        (0x00, SET_ADDRESS) if setup.value < 128 => {
+            Control::Status(Effect::SetAddress(setup.value as u8))
+        }
+        (0x00, SET_CONFIGURATION) if setup.value <= 1 => {
+            Control::Status(Effect::SetConfiguration(setup.value as u8))
+        }
+        (0x00, GET_CONFIGURATION) => small(&[configuration]),
+        (0x00, GET_STATUS) => small(&[0, 0]),
+        // Remote wakeup is not supported, but the request is acknowledged
+        (0x00, CLEAR_FEATURE | SET_FEATURE) => Control::Status(Effect::None),
+        // Interface
+        (0x01, GET_DESCRIPTOR) if hid_intf && setup.value >> 8 >= 0x21 => {
+            descriptor(setup.value & 0xff00).map_or(Control::Stall, Control::Send)
+        }
+        (0x01, GET_INTERFACE) if hid_intf => small(&[0]),
+        (0x01, SET_INTERFACE) if hid_intf && setup.value == 0 => Control::Status(Effect::None),
+        (0x01, GET_STATUS) => small(&[0, 0]),
+        // Endpoint
+        (0x02, GET_STATUS) => small(&[0, 0]),
+        (0x02, CLEAR_FEATURE) => Control::Status(Effect::ClearStall(setup.index as u8)),
+        (0x02, SET_FEATURE) => Control::Status(Effect::SetStall(setup.index as u8)),
+        // HID class
+        (0x21, HID_SET_IDLE | HID_SET_PROTOCOL) if hid_intf => Control::Status(Effect::None),
+        (0x21, HID_GET_IDLE | HID_GET_PROTOCOL) if hid_intf => small(&[0]),
+        _ => Control::Stall,
+    }
+}
+
+/// State of the device, reset with the bus
+struct Device {
+    configuration: u8,
+    /// Remaining data of a control transfer larger than the endpoint
+    ep0_data: &'static [u8],
+    /// Whether the data stage must end with a zero length packet, being a
+    /// whole number of packets shorter than requested
+    ep0_zlp: bool,
+}
+
+static mut DEVICE: Device = Device {
+    configuration: 0,
+    ep0_data: &[],
+    ep0_zlp: false,
+};
+
+fn device() -> &'static mut Device {
+    unsafe { &mut *addr_of_mut!(DEVICE) }
+}
+
+fn usb_config(config: &[u8]) {
+    let mut msg = [0u8; 8];
+    msg[0] = SEPROXYHAL_TAG_USB_CONFIG as u8;
+    msg[2] = config.len() as u8;
+    msg[3..3 + config.len()].copy_from_slice(config);
+    seph_send(&msg[..3 + config.len()]);
+}
+
+fn open_ep(ep: u8, kind: u32, size: u8) {
+    usb_config(&[
+        SEPROXYHAL_TAG_USB_CONFIG_ENDPOINTS as u8,
+        1,
+        ep,
+        kind as u8,
+        size,
+    ]);
+}
+
+fn ep_prepare(ep: u8, dir: u32, size: u8) {
+    seph_send(&[
+        SEPROXYHAL_TAG_USB_EP_PREPARE as u8,
+        0,
+        3,
+        ep,
+        dir as u8,
+        size,
+    ]);
+}
+
+/// Send `data` on the IN endpoint `ep`, at most one packet
+fn transmit(ep: u8, data: &[u8]) {
+    let len = 3 + data.len();
+    seph_send(&[
+        SEPROXYHAL_TAG_USB_EP_PREPARE as u8,
+        (len >> 8) as u8,
+        len as u8,
+        ep,
+        SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN as u8,
+        data.len() as u8,
+    ]);
+    seph_send(data);
+}
+
+/// Send the next packet of the data stage of a control transfer
+fn ep0_send_next(dev: &mut Device) {
+    let (packet, rest) = dev.ep0_data.split_at(dev.ep0_data.len().min(EP0_SIZE));
+    transmit(0x80, packet);
+    dev.ep0_data = rest;
+}
+
+fn ep0_stall() {
+    ep_prepare(0x80, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_STALL, 0);
+    ep_prepare(0x00, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_STALL, 0);
+}
+
+fn set_configuration(dev: &mut Device, configuration: u8) {
+    if configuration == dev.configuration {
+        return;
+    }
+    dev.configuration = configuration;
+    let kind = match configuration {
+        0 => SEPROXYHAL_TAG_USB_CONFIG_TYPE_DISABLED,
+        _ => SEPROXYHAL_TAG_USB_CONFIG_TYPE_INTERRUPT,
+    };
+    let size = if configuration == 0 { 0 } else { HID_EP_SIZE };
+    open_ep(HID_EPIN_ADDR, kind, size);
+    open_ep(HID_EPOUT_ADDR, kind, size);
+    if configuration != 0 {
+        ep_prepare(
+            HID_EPOUT_ADDR,
+            SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_OUT,
+            HID_EP_SIZE,
+        );
+    }
+}
+
+fn on_setup(packet: &[u8]) {
+    let dev = device();
+    let setup = match Setup::parse(packet) {
+        Some(setup) => setup,
+        None => return,
+    };
+    match control(&setup, dev.configuration) {
+        Control::Send(data) => {
+            let len = data.len().min(setup.length as usize);
+            dev.ep0_data = &data[..len];
+            dev.ep0_zlp = len < setup.length as usize && len % EP0_SIZE == 0;
+            ep0_send_next(dev);
+        }
+        Control::SendSmall(data, len) => {
+            dev.ep0_data = &[];
+            dev.ep0_zlp = false;
+            transmit(0x80, &data[..len.min(setup.length as usize)]);
+        }
+        Control::Status(effect) => {
+            match effect {
+                Effect::None => (),
+                Effect::SetAddress(address) => {
+                    usb_config(&[SEPROXYHAL_TAG_USB_CONFIG_ADDR as u8, address])
+                }
+                Effect::SetConfiguration(configuration) => set_configuration(dev, configuration),
+                Effect::ClearStall(ep) => {
+                    ep_prepare(ep, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_UNSTALL, 0)
+                }
+                Effect::SetStall(ep) => ep_prepare(ep, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_STALL, 0),
+            }
+            transmit(0x80, &[]);
+        }
+        Control::Stall => ep0_stall(),
+    }
+}
+
+fn on_ep0_in() {
+    let dev = device();
+    if !dev.ep0_data.is_empty() {
+        ep0_send_next(dev);
+    } else if dev.ep0_zlp {
+        dev.ep0_zlp = false;
+        transmit(0x80, &[]);
+    } else {
+        // Status stage of the host
+        ep_prepare(0x00, SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_OUT, 0);
+    }
+}
+
+extern "C" {
+    static G_io_usb_hid_total_length: u32;
+    fn io_usb_hid_receive(
+        sndfct: unsafe extern "C" fn(*mut u8, u16),
+        buffer: *const u8,
+        l: u16,
+        apdu_buffer: *mut apdu_buffer_t,
+    ) -> u8;
+    fn io_usb_hid_sent(sndfct: unsafe extern "C" fn(*mut u8, u16));
+}
+
+/// `IO_USB_APDU_RECEIVED`
+const HID_APDU_RECEIVED: u8 = 2;
+
+fn on_hid_out(apdu_buffer: &mut [u8], data: &[u8]) {
+    // Prepare the next report while this one is processed
+    ep_prepare(
+        HID_EPOUT_ADDR,
+        SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_OUT,
+        HID_EP_SIZE,
+    );
+    unsafe {
+        // An APDU not replied to yet is left alone by the HID transport,
+        // which still answers the control commands
+        let mut apdu_buf = apdu_buffer_t {
+            buf: apdu_buffer.as_mut_ptr(),
+            len: apdu_buffer.len() as u16,
+        };
+        let status = io_usb_hid_receive(
+            io_usb_send_apdu_data,
+            data.as_ptr(),
+            data.len() as u16,
+            &mut apdu_buf,
+        );
+        if status == HID_APDU_RECEIVED {
+            G_io_app.apdu_media = IO_APDU_MEDIA_USB_HID;
+            G_io_app.apdu_state = APDU_USB_HID;
+            G_io_app.apdu_length =
+                core::ptr::read_volatile(core::ptr::addr_of!(G_io_usb_hid_total_length)) as u16;
+        }
+    }
+}
+
+fn reset() {
+    let dev = device();
+    dev.configuration = 0;
+    dev.ep0_data = &[];
+    dev.ep0_zlp = false;
+    open_ep(0x00, SEPROXYHAL_TAG_USB_CONFIG_TYPE_CONTROL, EP0_SIZE as u8);
+    open_ep(0x80, SEPROXYHAL_TAG_USB_CONFIG_TYPE_CONTROL, EP0_SIZE as u8);
+}
+
+/// Bus event, the USB event code being in `event`
+pub fn handle_usb_event(event: u8) {
+    // Start of frame, suspend and resume need nothing
+    if event as u32 == SEPROXYHAL_TAG_USB_EVENT_RESET {
+        reset();
+        unsafe {
+            if G_io_app.apdu_media != IO_APDU_MEDIA_NONE {
+                return;
+            }
+            G_io_app.usb_ep_xfer_len = core::mem::zeroed();
+            G_io_app.usb_ep_timeouts = core::mem::zeroed();
+        }
+    }
+}
+
+/// Transfer event, `buffer` being the whole SEPH message
+#[optimize(speed)]
+pub fn handle_usb_ep_xfer_event(apdu_buffer: &mut [u8], buffer: &[u8]) {
+    let ep = buffer[3] & 0x7f;
+    if ep as u32 >= IO_USB_MAX_ENDPOINTS {
+        return;
+    }
+    let len = (buffer[5] as usize).min(buffer.len().saturating_sub(6));
+    let data = &buffer[6..6 + len];
+    match (buffer[4] as u32, ep) {
+        (SEPROXYHAL_TAG_USB_EP_XFER_SETUP, 0) => on_setup(&buffer[6..]),
+        (SEPROXYHAL_TAG_USB_EP_XFER_IN, 0) => on_ep0_in(),
+        (SEPROXYHAL_TAG_USB_EP_XFER_IN, _) => unsafe {
+            G_io_app.usb_ep_timeouts[ep as usize].timeout = 0;
+            if ep == HID_EPIN_ADDR & 0x7f {
+                io_usb_hid_sent(io_usb_send_apdu_data);
+            }
+        },
+        (SEPROXYHAL_TAG_USB_EP_XFER_OUT, _) => {
+            unsafe { G_io_app.usb_ep_xfer_len[ep as usize] = buffer[5] };
+            if ep == HID_EPOUT_ADDR {
+                on_hid_out(apdu_buffer, data);
+            }
+        }
+        _ => (),
+    }
+}
+
+/// Connect to the bus or disconnect, in place of the C stack's function of
+/// the same name called at boot
+#[no_mangle]
+pub extern "C" fn USB_power(enabled: u8) {
+    unsafe {
+        G_io_app.usb_ep_xfer_len = core::mem::zeroed();
+        G_io_app.usb_ep_timeouts = core::mem::zeroed();
+    }
+    let dev = device();
+    dev.configuration = 0;
+    dev.ep0_data = &[];
+    if enabled != 0 {
+        usb_config(&[SEPROXYHAL_TAG_USB_CONFIG_ADDR as u8, 0]);
+        usb_config(&[SEPROXYHAL_TAG_USB_CONFIG_CONNECT as u8]);
+    } else {
+        usb_config(&[SEPROXYHAL_TAG_USB_CONFIG_DISCONNECT as u8]);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::assert_eq_err as assert_eq;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    fn request(packet: [u8; 8], configuration: u8) -> Result<Control, ()> {
+        Ok(control(&Setup::parse(&packet).ok_or(())?, configuration))
+    }
+
+    #[test]
+    fn control_requests() {
+        let get_config = [0x80, 0x06, 0x00, 0x02, 0x00, 0x00, 0xff, 0x00];
+        assert_eq!(request(get_config, 0)?, Control::Send(&CONFIG_DESC));
+        assert_eq!(CONFIG_DESC[2] as usize, CONFIG_DESC.len());
+        // Report descriptor, from the HID interface
+        let get_report = [0x81, 0x06, 0x00, 0x22, 0x00, 0x00, 0x40, 0x00];
+        assert_eq!(request(get_report, 1)?, Control::Send(&REPORT_DESC));
+        let get_hid = [0x81, 0x06, 0x00, 0x21, 0x00, 0x00, 0x09, 0x00];
+        assert_eq!(request(get_hid, 1)?, Control::Send(&CONFIG_DESC[18..27]));
+        assert_eq!(CONFIG_DESC[HID_DESC_OFFSET + 1], 0x21);
+        let set_address = [0x00, 0x05, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00];
+        assert_eq!(
+            request(set_address, 0)?,
+            Control::Status(Effect::SetAddress(0x12))
+        );
+        let get_configuration = [0x80, 0x08, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00];
+        assert_eq!(
+            request(get_configuration, 1)?,
+            Control::SendSmall([1, 0], 1)
+        );
+        // Device qualifier, a full speed device has none
+        let get_qualifier = [0x80, 0x06, 0x00, 0x06, 0x00, 0x00, 0x0a, 0x00];
+        assert_eq!(request(get_qualifier, 0)?, Control::Stall);
+        assert_eq!(PRODUCT_DESC[0] as usize, PRODUCT_DESC.len());
+    }
+}
@@ -0,0 +1,120 @@
+//! Forwarding of the events to the UX of the OS
+//!
+//! The OS draws its own screens over the app: the lock screen and the PIN
+//! prompt after the auto-lock delay, and the BLE pairing modals of the Nano
+//! X. They run in the UX task of the OS, which needs the button and ticker
+//! events the app receives. [`Comm::next_event`](crate::io::Comm::next_event)
+//! forwards them with `os_ux(BOLOS_UX_EVENT)`, as the `UX_FORWARD_EVENT` of
+//! the C SDK does:
+//!
+//! - while a screen of the OS is displayed, it consumes them and they are
+//!   not returned,
+//! - once it is closed, the app is asked to redraw its screen with
+//!   [`Event::UxEvent`](crate::io::Event::UxEvent).
+//!
+//! Commands keep being received meanwhile, and the state of `Comm` (the
+//! APDU being reassembled, the chained response) is left alone, so the app
+//! resumes where it stood instead of restarting and syncing again with the
+//! host. The response cache and the caches registered with [`crate::lock`]
+//! are dropped, as the PIN may have to be entered again.
+//!
+//! ```
+//! loop {
+//!     match comm.next_event::<Ins>() {
+//!         io::Event::UxEvent => screen.show(),
+//!         ...
+//!     }
+//! }
+//! ```
+
+use crate::bindings::{
+    bolos_ux_params_t, os_sched_last_status, os_ux, BOLOS_UX_CONTINUE, BOLOS_UX_EVENT,
+    BOLOS_UX_IGNORE, BOLOS_UX_REDRAW, TASK_BOLOS_UX,
+};
+
+/// What to do with an event once the UX of the OS has seen it
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub(crate) enum Forwarded {
+    /// No screen of the OS is displayed, or it let the event through: the
+    /// event is for the app
+    App,
+    /// The OS is done with the screen, which the app must redraw
+    Redraw,
+    /// The event was consumed by a screen of the OS
+    Consumed,
+}
+
+// Read by the UX task of the OS, as the `G_ux_params` of the C SDK
+static mut PARAMS: bolos_ux_params_t = bolos_ux_params_t { ux_id: 0, len: 0 };
+
+/// Forward the event being dispatched to the UX of the OS
+pub(crate) fn forward_event() -> Forwarded {
+    let status = unsafe {
+        let params = &mut *core::ptr::addr_of_mut!(PARAMS);
+        params.ux_id = BOLOS_UX_EVENT;
+        params.len = 0;
+        os_ux(params);
+        os_sched_last_status(TASK_BOLOS_UX as u32) as u32
+    };
+    #[cfg(target_os = "nanox")]
+    end_asynch_modal();
+    match status {
+        BOLOS_UX_REDRAW => Forwarded::Redraw,
+        BOLOS_UX_CONTINUE | BOLOS_UX_IGNORE => Forwarded::Consumed,
+        _ => Forwarded::App,
+    }
+}
+
+#[cfg(target_os = "nanox")]
+extern "C" {
+    fn os_ux_get_status(ux_id: u32) -> u32;
+}
+
+/// `BOLOS_UX_ASYNCHMODAL_PAIRING_REQUEST` of os_ux.h
+#[cfg(target_os = "nanox")]
+const ASYNCHMODAL_PAIRING_REQUEST: u32 = 36;
+
+/// Report the answer of the user to the code which opened a pairing modal,
+/// once the modal is closed
+#[cfg(target_os = "nanox")]
+fn end_asynch_modal() {
+    use crate::bindings::G_io_asynch_ux_callback;
+    unsafe {
+        let callback = &mut *core::ptr::addr_of_mut!(G_io_asynch_ux_callback);
+        if let Some(end) = callback.asynchmodal_end_callback {
+            let status = os_ux_get_status(ASYNCHMODAL_PAIRING_REQUEST);
+            if status != 0 {
+                callback.asynchmodal_end_callback = None;
+                end(status);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::assert_eq_err as assert_eq;
+    use crate::bindings::SEPROXYHAL_TAG_TICKER_EVENT;
+    use crate::io::{Comm, Event};
+    use crate::seph::Events;
+    use crate::testing::TestType;
+    use testmacro::test_item as test;
+
+    #[test]
+    fn resume_after_lock() {
+        let mut comm = Comm::new();
+        comm.seph_buffer[..3].copy_from_slice(&[SEPROXYHAL_TAG_TICKER_EVENT as u8, 0, 0]);
+        let mut tick = || comm.decode_event::<u8>(Events::TickerEvent);
+        assert_eq!(tick() == Some(Event::Ticker), true);
+        // The lock screen takes the events until it is closed, then the app
+        // redraws and gets them again
+        #[cfg(feature = "host")]
+        {
+            crate::host::lock_screen(2);
+            assert_eq!(tick().is_none(), true);
+            assert_eq!(tick().is_none(), true);
+            assert_eq!(tick() == Some(Event::UxEvent), true);
+            assert_eq!(tick() == Some(Event::Ticker), true);
+        }
+    }
+}
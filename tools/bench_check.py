@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Compare the benchmarks of a speculos test run with golden tick counts.
+
+Benchmarks print a line per measure, `bench  <name>: <n> ticks/iter at <f>
+Hz`, among the results of the tests. This reads them from a saved test
+output, or stdin, and compares them with the counts of the target in a JSON
+file, failing when one of them is slower by more than the tolerance:
+
+    cargo test --release --target nanosplus.json --features speculos | tee bench.log
+    tools/bench_check.py --target nanosplus bench.log
+
+Benchmarks missing from the file are listed, without failing. --update
+writes the counts of the run to the file instead, after an intended change
+or to record a new benchmark.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+GOLDEN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench_golden.json")
+
+BENCH_LINE = re.compile(r"bench\s+(.+?): (\d+) ticks/iter at (\d+) Hz")
+
+
+def parse(lines):
+    """Tick counts by benchmark name"""
+    counts = {}
+    for line in lines:
+        m = BENCH_LINE.search(line)
+        if m:
+            counts[m.group(1)] = int(m.group(2))
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="output of the test run, stdin if omitted")
+    parser.add_argument("--target", required=True, choices=("nanos", "nanox", "nanosplus"))
+    parser.add_argument("--golden", default=GOLDEN, help="JSON file of the golden counts, by target")
+    parser.add_argument("--tolerance", type=float, default=5.0, help="slowdown allowed, in percent")
+    parser.add_argument("--update", action="store_true", help="write the counts of the run to the golden file")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, errors="replace") as f:
+            current = parse(f)
+    else:
+        current = parse(sys.stdin)
+    if not current:
+        print("no benchmark in the test output", file=sys.stderr)
+        return 1
+
+    golden = {}
+    if os.path.exists(args.golden):
+        with open(args.golden) as f:
+            golden = json.load(f)
+
+    if args.update:
+        golden.setdefault(args.target, {}).update(current)
+        with open(args.golden, "w") as f:
+            json.dump(golden, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print(f"{len(current)} counts written for {args.target}")
+        return 0
+
+    expected = golden.get(args.target, {})
+    regressions = 0
+    for name, ticks in sorted(current.items()):
+        if name not in expected:
+            print(f"  {ticks:>10}  {'':>8}  {name} (new)")
+            continue
+        delta = 100.0 * (ticks - expected[name]) / max(expected[name], 1)
+        flag = ""
+        if delta > args.tolerance:
+            regressions += 1
+            flag = " REGRESSION"
+        print(f"  {ticks:>10}  {delta:>+7.1f}%  {name}{flag}")
+    for name in sorted(set(expected) - set(current)):
+        print(f"  {'':>10}  {'':>8}  {name} (not run)")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) slower than {args.golden} by more than {args.tolerance}%", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
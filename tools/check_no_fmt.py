@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Check that `core::fmt` is not linked into a release build of an app.
+
+The formatting code of `core` takes several KiB of Flash. It is linked as
+soon as something formats: a panic handler printing its `PanicInfo`, a
+`write!` to a `DebugWriter` with the `debug_fmt` feature, or a `Debug`
+implementation reached from code which is kept. The SDK reports its own
+unrecoverable errors with `nanos_sdk::fatal` and numeric exit statuses, so
+that release images need none of it.
+
+    tools/check_no_fmt.py target/nanosplus/release/app
+
+Exits with an error listing the formatting symbols found, largest first.
+"""
+
+import argparse
+import sys
+
+from size_report import demangle_path
+from stack_usage import Elf
+
+
+def is_fmt(name):
+    """Whether a symbol is part of core::fmt, or a formatting trait impl"""
+    path = demangle_path(name)
+    if not path:
+        return False
+    if path[:2] == ["core", "fmt"]:
+        return True
+    # `<T as core::fmt::Debug>::fmt` and the like
+    return path[0].startswith("_$LT$") and "core..fmt.." in path[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="linked app, not stripped")
+    args = parser.parse_args()
+
+    found = sorted(
+        (
+            (size, name)
+            for name, _, size, _, section in Elf(args.elf).symbols()
+            if section.startswith(".text") and is_fmt(name)
+        ),
+        reverse=True,
+    )
+    if not found:
+        print("core::fmt is not linked")
+        return 0
+    print(f"core::fmt is linked: {len(found)} symbols, {sum(s for s, _ in found)} bytes")
+    for size, name in found:
+        print(f"  {size:>8}  {name}")
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""Flash and RAM usage of an app, by component and by symbol.
+
+Sizes are split between code (.text), constants (.rodata, linked into the
+.text output section of link.ld), .nvm_data and .bss. They are grouped by
+object file when a linker map is given, and otherwise by component guessed
+from the symbol names: Rust crates and SDK modules, cxlib, BLE, USB and
+bagl.
+
+    tools/size_report.py target/nanosplus/release/app
+    tools/size_report.py --map target/app.map target/nanosplus/release/app
+
+A report saved with --save can be compared with a later build:
+
+    tools/size_report.py --save size.json target/nanosplus/release/app
+    tools/size_report.py --baseline size.json target/nanosplus/release/app
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+from stack_usage import Elf
+
+SECTIONS = (".text", ".rodata", ".nvm_data", ".bss")
+
+# Components of the C symbols, by name prefix
+C_COMPONENTS = (
+    ("cxlib", re.compile(r"^_?(cx_|CX_|G_cx)")),
+    ("ble", re.compile(r"^(LEDGER_BLE|BLE_|ble_|aci_|hci_|G_io_ble)", re.I)),
+    ("usb", re.compile(r"^(USBD_|usbd_|io_usb|USB_|HID_|CCID_|G_io_usb)")),
+    ("bagl", re.compile(r"^(bagl|C_bagl|C_font|fonts?_|C_icon|G_bagl)")),
+    ("seproxyhal", re.compile(r"^(io_seproxyhal|io_seph|G_io_seproxyhal|G_io_app)")),
+)
+
+
+def demangle_path(name):
+    """Path components of a legacy-mangled Rust symbol, or None"""
+    m = re.match(r"^_ZN(.*)E$", name)
+    if not m:
+        return None
+    rest, path = m.group(1), []
+    while rest:
+        m = re.match(r"^(\d+)", rest)
+        if not m:
+            break
+        n = int(m.group(1))
+        start = len(m.group(1))
+        path.append(rest[start : start + n])
+        rest = rest[start + n :]
+    # Drop the hash
+    if path and re.match(r"^h[0-9a-f]{16}$", path[-1]):
+        path.pop()
+    return path
+
+
+# Escapes of the legacy Rust mangling
+ESCAPES = {"$LT$": "<", "$GT$": ">", "$RF$": "&", "$BP$": "*", "$LP$": "(", "$RP$": ")", "$C$": ","}
+
+
+def component(name):
+    path = demangle_path(name)
+    if path:
+        first = path[0]
+        if first.startswith("_$LT$"):
+            # Trait impl: `<Type as Trait>`, attributed to the first path
+            # found, which is the crate of the type or of the trait
+            for esc, c in ESCAPES.items():
+                first = first.replace(esc, c)
+            m = re.search(r"([A-Za-z_]\w*)\.\.(\w+)", first.replace("$u20$", " "))
+            if not m:
+                return "other"
+            path = [m.group(1), m.group(2), ""]
+        crate = path[0]
+        if crate == "nanos_sdk" and len(path) > 2:
+            return f"nanos_sdk::{path[1]}"
+        return crate
+    for comp, pattern in C_COMPONENTS:
+        if pattern.match(name):
+            return comp
+    return "other"
+
+
+def section_of(sym_section, typ):
+    """Report section of a symbol: .text holds both code and constants"""
+    if sym_section.startswith(".text"):
+        return ".text" if typ == 2 else ".rodata"  # STT_FUNC
+    for s in SECTIONS:
+        if sym_section.startswith(s):
+            return s
+    return None
+
+
+def parse_map(path):
+    """Input sections of an lld map file as (object, section, size)"""
+    line_re = re.compile(r"^\s*[0-9a-f]+\s+[0-9a-f]+\s+([0-9a-f]+)\s+\d+ (\s*)(\S.*)$")
+    out_section, inputs = None, []
+    with open(path) as f:
+        for line in f:
+            m = line_re.match(line)
+            if not m:
+                continue
+            size, indent, what = int(m.group(1), 16), len(m.group(2)), m.group(3)
+            if indent == 0:
+                out_section = what
+            elif indent <= 8 and ":(" in what:
+                obj, sec = what.rsplit(":(", 1)
+                sec = sec.rstrip(")")
+                if out_section == ".text":
+                    sec = ".rodata" if sec.startswith(".rodata") else ".text"
+                inputs.append((os.path.basename(obj), sec, size))
+    return inputs
+
+
+def report(elf_path, map_path):
+    syms = {}
+    for name, _, size, typ, sec in Elf(elf_path).symbols():
+        s = section_of(sec, typ)
+        if s and size:
+            syms[name] = (s, size)
+
+    groups = {}
+    if map_path:
+        for obj, sec, size in parse_map(map_path):
+            s = section_of(sec, 2 if sec == ".text" else 1)
+            if s:
+                g = groups.setdefault(obj, dict.fromkeys(SECTIONS, 0))
+                g[s] += size
+    else:
+        for name, (s, size) in syms.items():
+            g = groups.setdefault(component(name), dict.fromkeys(SECTIONS, 0))
+            g[s] += size
+    return {"groups": groups, "symbols": {n: {"section": s, "size": size} for n, (s, size) in syms.items()}}
+
+
+def print_groups(groups, baseline):
+    header = "".join(f"{s:>10}" for s in SECTIONS)
+    print(f"{'':32}{header}{'flash':>10}")
+    total = dict.fromkeys(SECTIONS, 0)
+    rows = sorted(groups.items(), key=lambda x: -(x[1][".text"] + x[1][".rodata"] + x[1][".nvm_data"]))
+    for name, sizes in rows:
+        for s in SECTIONS:
+            total[s] += sizes[s]
+        flash = sizes[".text"] + sizes[".rodata"] + sizes[".nvm_data"]
+        line = f"{name[:31]:32}" + "".join(f"{sizes[s]:>10}" for s in SECTIONS) + f"{flash:>10}"
+        if baseline is not None:
+            old = baseline.get(name)
+            old_flash = old[".text"] + old[".rodata"] + old[".nvm_data"] if old else 0
+            if flash != old_flash:
+                line += f"  {flash - old_flash:+}"
+        print(line)
+    flash = total[".text"] + total[".rodata"] + total[".nvm_data"]
+    print(f"{'total':32}" + "".join(f"{total[s]:>10}" for s in SECTIONS) + f"{flash:>10}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="linked app, not stripped")
+    parser.add_argument("--map", help="linker map, from -C link-arg=-Map=<file>, to group by object file")
+    parser.add_argument("--top", type=int, default=20, help="number of largest symbols listed")
+    parser.add_argument("--save", help="write the report to this JSON file")
+    parser.add_argument("--baseline", help="JSON report to compare with")
+    args = parser.parse_args()
+
+    current = report(args.elf, args.map)
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    print_groups(current["groups"], baseline["groups"] if baseline else None)
+
+    print("\nlargest symbols:")
+    symbols = current["symbols"]
+    for name, sym in sorted(symbols.items(), key=lambda x: -x[1]["size"])[: args.top]:
+        print(f"  {sym['size']:>8}  {sym['section']:<10}  {name}")
+
+    if baseline:
+        old = baseline["symbols"]
+        changes = [
+            (name, symbols.get(name, {}).get("size", 0) - old.get(name, {}).get("size", 0))
+            for name in set(symbols) | set(old)
+        ]
+        changes = sorted((c for c in changes if c[1]), key=lambda c: -abs(c[1]))
+        if changes:
+            print("\nlargest changes from the baseline:")
+            for name, delta in changes[: args.top]:
+                state = " (new)" if name not in old else " (removed)" if name not in symbols else ""
+                print(f"  {delta:>+8}  {name}{state}")
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(current, f, indent=1, sort_keys=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""Worst-case stack usage of an app, from the .stack_sizes section of its ELF.
+
+rustc emits the frame size of every function in .stack_sizes when building
+with `-Z emit-stack-sizes`, and link.ld keeps the section in the final ELF.
+This script combines these sizes with the call graph found by disassembling
+the app, and reports the deepest call chain from each entry point. It exits
+with an error when one of them exceeds the limit, by default the STACK_SIZE
+of the target's layout file.
+
+    tools/stack_usage.py target/nanosplus/release/app
+    tools/stack_usage.py --limit 1200 --entry sample_main target/nanosplus/release/app
+
+Estimates are lower bounds when the graph has recursion, indirect calls
+(function pointers, trait objects) or functions without stack size
+information (assembly, C files built without -fstack-usage). All of them are
+listed, so that they can be checked by hand.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+
+DEFAULT_ENTRIES = ["_start"]
+
+# Repository root, holding the layout files
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+class Elf:
+    """Minimal little-endian ELF reader: sections and symbols"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError(f"{path} is not an ELF file")
+        self.is64 = self.data[4] == 2
+        if self.data[5] != 1:
+            raise ValueError("big-endian ELF files are not supported")
+        if self.is64:
+            (self.shoff,) = struct.unpack_from("<Q", self.data, 0x28)
+            self.shentsize, self.shnum, self.shstrndx = struct.unpack_from("<HHH", self.data, 0x3A)
+        else:
+            (self.shoff,) = struct.unpack_from("<I", self.data, 0x20)
+            self.shentsize, self.shnum, self.shstrndx = struct.unpack_from("<HHH", self.data, 0x2E)
+        self.sections = [self._section(i) for i in range(self.shnum)]
+        names = self.sections[self.shstrndx]
+        for s in self.sections:
+            s["name"] = self._str(names["offset"], s["name_off"])
+
+    def _section(self, i):
+        off = self.shoff + i * self.shentsize
+        if self.is64:
+            name, typ, _, addr, offset, size, link, _, _, entsize = struct.unpack_from(
+                "<IIQQQQIIQQ", self.data, off
+            )
+        else:
+            name, typ, _, addr, offset, size, link, _, _, entsize = struct.unpack_from(
+                "<IIIIIIIIII", self.data, off
+            )
+        return dict(
+            name_off=name, type=typ, addr=addr, offset=offset, size=size, link=link, entsize=entsize
+        )
+
+    def _str(self, table_off, off):
+        end = self.data.index(b"\0", table_off + off)
+        return self.data[table_off + off : end].decode(errors="replace")
+
+    def section(self, name):
+        return next((s for s in self.sections if s["name"] == name), None)
+
+    def functions(self):
+        """Map of function address to name. Thumb addresses have their low
+        bit cleared."""
+        funcs = {}
+        for name, value, _, typ, _ in self.symbols():
+            if typ == 2:  # STT_FUNC
+                funcs.setdefault(value & ~1, name)
+        return funcs
+
+    def symbols(self):
+        """Defined symbols as (name, address, size, type, section name)"""
+        symtab = self.section(".symtab")
+        if symtab is None:
+            raise ValueError("the ELF file has no symbol table: do not strip it")
+        strtab = self.sections[symtab["link"]]
+        syms = []
+        for i in range(symtab["size"] // symtab["entsize"]):
+            off = symtab["offset"] + i * symtab["entsize"]
+            if self.is64:
+                name, info, _, shndx, value, size = struct.unpack_from("<IBBHQQ", self.data, off)
+            else:
+                name, value, size, info, _, shndx = struct.unpack_from("<IIIBBH", self.data, off)
+            if 0 < shndx < len(self.sections):
+                section = self.sections[shndx]["name"]
+                syms.append((self._str(strtab["offset"], name), value, size, info & 0xF, section))
+        return syms
+
+    def stack_sizes(self):
+        """Map of function address to frame size, from .stack_sizes"""
+        section = self.section(".stack_sizes")
+        if section is None:
+            raise ValueError("no .stack_sizes section: build with RUSTFLAGS='-Z emit-stack-sizes'")
+        data = self.data[section["offset"] : section["offset"] + section["size"]]
+        sizes = {}
+        pos, width = 0, 8 if self.is64 else 4
+        while pos + width <= len(data):
+            (addr,) = struct.unpack_from("<Q" if self.is64 else "<I", data, pos)
+            pos += width
+            size, shift = 0, 0
+            while True:
+                b = data[pos]
+                pos += 1
+                size |= (b & 0x7F) << shift
+                shift += 7
+                if b & 0x80 == 0:
+                    break
+            sizes[addr & ~1] = size
+        return sizes
+
+
+CALL = re.compile(r"^\s*[0-9a-f]+:\s+(\S+)\s+(?:0x)?([0-9a-f]+)\s+<([^>+]+)>")
+INDIRECT = re.compile(r"^\s*[0-9a-f]+:\s+(blx|callq?)\s+(r\d|ip|lr|\*)")
+FUNC = re.compile(r"^([0-9a-f]+) <(.+)>:$")
+# Calls, and the branches to other functions which are tail calls
+CALL_MNEMONICS = ("bl", "blx", "call", "callq", "b", "b.w", "b.n", "jmp", "jmpq")
+
+
+def call_graph(path, objdump):
+    """Callees and whether there are indirect calls, for each function"""
+    out = subprocess.run(
+        [objdump, "-d", "--no-show-raw-insn", path], check=True, capture_output=True, text=True
+    ).stdout
+    graph, indirect, current = {}, set(), None
+    for line in out.splitlines():
+        m = FUNC.match(line)
+        if m:
+            current = m.group(2)
+            graph.setdefault(current, set())
+            continue
+        if current is None:
+            continue
+        m = CALL.match(line)
+        if m and m.group(1).split(".")[0] in CALL_MNEMONICS:
+            graph[current].add(m.group(3))
+        elif INDIRECT.match(line):
+            indirect.add(current)
+    return graph, indirect
+
+
+def layout_stack_size(target):
+    try:
+        with open(os.path.join(ROOT, f"{target}_layout.ld")) as f:
+            m = re.search(r"STACK_SIZE\s*=\s*(?:DEFINED\(\w+\)\s*\?\s*\w+\s*:\s*)?(\d+)", f.read())
+    except OSError:
+        return None
+    return int(m.group(1)) if m else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="linked app, not stripped")
+    parser.add_argument("--entry", action="append", help="entry point, can be repeated (default: _start)")
+    parser.add_argument("--limit", type=int, help="maximum stack usage in bytes (default: STACK_SIZE of the target)")
+    parser.add_argument("--target", help="nanos, nanox or nanosplus (default: guessed from the path)")
+    parser.add_argument("--top", type=int, default=10, help="number of largest frames listed")
+    parser.add_argument("--objdump", default=os.environ.get("OBJDUMP"), help="objdump to use")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    names = elf.functions()
+    sizes = {names[a]: s for a, s in elf.stack_sizes().items() if a in names}
+    objdump = args.objdump or shutil.which("llvm-objdump") or shutil.which("arm-none-eabi-objdump")
+    if objdump is None:
+        sys.exit("no objdump found: install llvm-objdump or set OBJDUMP")
+    graph, indirect = call_graph(args.elf, objdump)
+
+    limit = args.limit
+    if limit is None:
+        target = args.target or next(
+            (t for t in ("nanosplus", "nanos", "nanox") if t in args.elf.split(os.sep)), None
+        )
+        limit = layout_stack_size(target) if target else None
+
+    worst, unknown, recursive = {}, set(), set()
+
+    def visit(func, stack):
+        """Worst-case stack usage of `func` and its deepest chain of callees"""
+        if func in worst:
+            return worst[func]
+        if func in stack:
+            recursive.add(func)
+            return 0, []
+        if func not in sizes:
+            unknown.add(func)
+        stack.add(func)
+        deepest, chain = 0, []
+        for callee in graph.get(func, ()):
+            usage, callee_chain = visit(callee, stack)
+            if usage > deepest or not chain:
+                deepest, chain = usage, callee_chain
+        stack.discard(func)
+        worst[func] = (sizes.get(func, 0) + deepest, [func] + chain)
+        return worst[func]
+
+    failed = False
+    for entry in args.entry or DEFAULT_ENTRIES:
+        if entry not in graph:
+            sys.exit(f"entry point {entry} not found")
+        usage, chain = visit(entry, set())
+        over = limit is not None and usage > limit
+        failed |= over
+        print(f"{entry}: {usage} bytes" + (f" (limit {limit})" if limit is not None else ""))
+        for func in chain:
+            print(f"  {sizes.get(func, '?'):>6}  {func}")
+        if over:
+            print(f"error: {entry} may use {usage} bytes of stack, over the {limit} byte limit")
+
+    print("\nlargest frames:")
+    for func, size in sorted(sizes.items(), key=lambda x: -x[1])[: args.top]:
+        print(f"  {size:>6}  {func}")
+    reached = set(worst)
+    for title, funcs in (
+        ("recursive functions", recursive),
+        ("functions with indirect calls", indirect & reached),
+        ("functions without stack size information", unknown),
+    ):
+        if funcs:
+            print(f"\n{title} (estimates are lower bounds):")
+            for func in sorted(funcs):
+                print(f"  {func}")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()